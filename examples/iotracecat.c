@@ -0,0 +1,207 @@
+#include <getopt.h>
+#include <inttypes.h>           /* PRIu64 */
+#include <stdio.h>              /* printf */
+#include <stdlib.h>             /* exit */
+#include <string.h>             /* memcmp */
+
+#include "iotrace.h"
+
+/* columns, in the order of the server IO-set CSV then the extra ones */
+enum column {
+  COL_APPID, COL_WITER, COL_WAITSTART, COL_IOSTART, COL_IOEND, COL_NBYTES,
+  COL_SETID, COL_NSLICES, COL_WAIT, COL_TYPE, NCOLUMNS
+};
+
+static const char *const column_names[NCOLUMNS] = {
+  "\"appid\"", "witer", "waitstart", "iostart", "ioend", "nbytes",
+  "setid", "nslices", "wait", "type"
+};
+
+static const char *const type_names[] = {
+  [IOTRACE_PHASE] = "phase",
+  [IOTRACE_REVOKED] = "revoked",
+};
+
+static void print_field(const struct iotrace_rec *rec, enum column col);
+
+
+void
+usage(void)
+{
+  fputs("usage: iotracecat [--columns] FILE...\n"
+        "Convert IO-set trace files of the controller to text\n"
+        "  --columns  print one line per column instead of one per record\n"
+        "Without options, print the records as CSV, with the columns of the\n"
+        "former iosets_out.csv first.\n", stderr);
+  exit(1);
+}
+
+
+/**
+ * Read the records of the trace file PATH, appending them to *RECS.
+ *
+ * Return 0 or -1 in case of error.
+ */
+static int
+read_trace(const char *path, struct iotrace_rec **recs, size_t *nrecs, size_t *cap)
+{
+  struct iotrace_header h;
+  struct iotrace_rec rec;
+  FILE *f;
+
+  f = fopen(path, "r");
+  if (!f) {
+    perror(path);
+    return -1;
+  }
+
+  if (fread(&h, sizeof(h), 1, f) != 1 ||
+      memcmp(h.magic, IOTRACE_MAGIC, sizeof(IOTRACE_MAGIC))) {
+    fprintf(stderr, "%s: not an IO-set trace\n", path);
+    fclose(f);
+    return -1;
+  }
+
+  if (h.version != IOTRACE_VERSION || h.recsize != sizeof(rec)) {
+    fprintf(stderr, "%s: unsupported trace version %"PRIu32" (record size %"PRIu32")\n",
+            path, h.version, h.recsize);
+    fclose(f);
+    return -1;
+  }
+
+  while (fread(&rec, sizeof(rec), 1, f) == 1) {
+    if (*nrecs == *cap) {
+      size_t c = *cap ? *cap * 2 : 1024;
+      struct iotrace_rec *r = realloc(*recs, c * sizeof(*r));
+      if (!r) {
+        fputs("Out of memory\n", stderr);
+        fclose(f);
+        return -1;
+      }
+      *recs = r;
+      *cap = c;
+    }
+    (*recs)[(*nrecs)++] = rec;
+  }
+
+  if (ferror(f)) {
+    perror(path);
+    fclose(f);
+    return -1;
+  }
+
+  fclose(f);
+  return 0;
+}
+
+
+int
+main(int argc, char **argv)
+{
+  static struct option longopts[] = {
+    { "columns", no_argument, NULL, 'c' },
+    { NULL,      0,           NULL,  0  },
+  };
+
+  struct iotrace_rec *recs = NULL;
+  size_t nrecs = 0, cap = 0;
+  int ch, columns = 0, rc = EXIT_SUCCESS;
+
+  while ((ch = getopt_long(argc, argv, "c", longopts, NULL)) != -1)
+    switch (ch) {
+    case 'c':
+      columns = 1;
+      continue;
+    case 0:
+      continue;
+    default:
+      usage();
+    }
+  argc -= optind;
+  argv += optind;
+
+  if (argc < 1)
+    usage();
+
+  for (int i = 0; i < argc; i++) {
+    if (read_trace(argv[i], &recs, &nrecs, &cap))
+      rc = EXIT_FAILURE;
+  }
+
+  if (columns) {
+    for (int col = 0; col < NCOLUMNS; col++) {
+      fputs(column_names[col], stdout);
+      for (size_t i = 0; i < nrecs; i++) {
+        putchar(',');
+        print_field(&recs[i], col);
+      }
+      putchar('\n');
+    }
+  } else {
+    for (int col = 0; col < NCOLUMNS; col++)
+      printf("%s%s", col ? "," : "", column_names[col]);
+    putchar('\n');
+
+    for (size_t i = 0; i < nrecs; i++) {
+      for (int col = 0; col < NCOLUMNS; col++) {
+        if (col)
+          putchar(',');
+        print_field(&recs[i], col);
+      }
+      putchar('\n');
+    }
+  }
+
+  free(recs);
+
+  return rc;
+}
+
+
+static void
+print_ns(uint64_t ns)
+{
+  printf("%"PRIu64".%.9"PRIu64, ns / 1000000000, ns % 1000000000);
+}
+
+static void
+print_field(const struct iotrace_rec *rec, enum column col)
+{
+  switch (col) {
+  case COL_APPID:
+    printf("\"%"PRIu32".%"PRIu32"\"", rec->jobid, rec->jobstepid);
+    break;
+  case COL_WITER:
+    printf("%"PRIu32, rec->witer);
+    break;
+  case COL_WAITSTART:
+    print_ns(rec->waitstart);
+    break;
+  case COL_IOSTART:
+    print_ns(rec->iostart);
+    break;
+  case COL_IOEND:
+    print_ns(rec->ioend);
+    break;
+  case COL_NBYTES:
+    printf("%"PRIu64, rec->nbytes);
+    break;
+  case COL_SETID:
+    printf("%"PRId32, rec->setid);
+    break;
+  case COL_NSLICES:
+    printf("%"PRIu32, rec->nslices);
+    break;
+  case COL_WAIT:
+    print_ns(rec->iostart > rec->waitstart ? rec->iostart - rec->waitstart : 0);
+    break;
+  case COL_TYPE:
+    if (rec->type < sizeof(type_names) / sizeof(*type_names) && type_names[rec->type])
+      fputs(type_names[rec->type], stdout);
+    else
+      printf("%"PRIu32, rec->type);
+    break;
+  default:
+    break;
+  }
+}
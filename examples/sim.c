@@ -0,0 +1,1288 @@
+/**
+ * Offline discrete-event simulator of the malleability and IO-set
+ * policies of the controller.
+ *
+ * Jobs of a workload trace run on a simulated cluster with a FCFS
+ * scheduler. Each job alternates compute and IO phases. IO phases go
+ * through the IO-set scheduling of the server (one application per
+ * set, IO slices in proportion to the set priority, see ioset.h) and
+ * the malleability events are handed to the real policy (see
+ * icc_mall.h), whose actions are applied to the simulated jobs.
+ *
+ * With --budget, the applications of different sets do IO
+ * concurrently as long as the sum of their expected bandwidths stays
+ * within the budget, in MiB/s. Without one, or for a job of unknown
+ * bandwidth, a single application does IO at a time.
+ *
+ * Two trace formats are read:
+ *  - the IO-set results of the server, as converted by icc_iotrace:
+ *    "jobid.stepid",witer,waitstart,iostart,ioend,nbytes[,...]
+ *  - a workload description, one job per line:
+ *    submit,nnodes,nphases,compute,witer,nbytes[,malleable[,bandwidth]]
+ *    with times in seconds, compute the duration of a compute phase
+ *    on NNODES nodes, nbytes the size of an IO phase (0 for none),
+ *    bandwidth the one the job expects, in MiB/s (0 if unknown).
+ *
+ * A transfer runs at the bandwidth of its job, or of the whole file
+ * system if unknown. Concurrent transfers asking for more than the
+ * file system has share it in proportion to their bandwidth.
+ */
+#include <assert.h>
+#include <getopt.h>
+#include <inttypes.h>           /* PRIu32 */
+#include <math.h>               /* ceil */
+#include <stdio.h>              /* printf */
+#include <stdlib.h>             /* strtod */
+#include <string.h>             /* strchr */
+#include <margo.h>
+
+#include "hashmap.h"
+#include "ioset.h"
+#include "icc_mall.h"
+#include "mallpolicy.h"
+
+#define SIM_NSLICES 4           /* IO slices per phase, as examples/writer.c */
+#define SIM_WINDOW_MAX 64       /* longest monitoring window kept */
+#define SIM_LINE_LEN 1024
+#define SIM_NS(t) ((uint64_t)((t) * 1e9))  /* simulated time for the scheduler */
+
+enum simev_type {
+  SIMEV_SUBMIT,
+  SIMEV_COMPUTE_END,
+  SIMEV_IO_END,
+  SIMEV_STREAM,
+};
+
+struct simev {
+  double          t;
+  uint64_t        seq;          /* FIFO order between simultaneous events */
+  enum simev_type type;
+  struct simjob   *job;
+  uint64_t        ver;          /* of the transfer of JOB, for SIMEV_IO_END */
+};
+
+struct simphase {
+  double   compute;             /* in s, on the submitted number of processes */
+  uint32_t witer;               /* IO-set characteristic time, 0 for none */
+  uint64_t nbytes;
+  double   ioend;               /* in the trace */
+};
+
+enum simjob_state {
+  SIMJOB_PENDING,
+  SIMJOB_RUNNING,
+  SIMJOB_DONE,
+};
+
+struct simjob {
+  uint32_t          jobid;
+  char              clid[ICC_MALL_CLID_LEN];
+  enum simjob_state state;
+  int               malleable;
+  double            submit, start, end;
+
+  uint32_t          nnodes0;    /* at submission */
+  uint64_t          nprocs0;
+  uint32_t          nnodes;
+  uint64_t          nprocs;
+  double            nodesec;    /* node-seconds used */
+  double            lastchange; /* of the allocation */
+
+  struct simphase   *phases;
+  size_t            nphases, phasescap;
+  size_t            phase;      /* current one */
+  double            computestart; /* of the phase */
+
+  /* IO phase in progress */
+  unsigned          slicesleft; /* of the phase */
+  double            waitstart;
+  double            iostart;
+  int               iostarted;
+  uint32_t          bandwidth;  /* expected, in MiB/s, 0 if unknown */
+  struct ioset_req  req;
+
+  /* transfer in progress */
+  double            iobytes;    /* left */
+  double            iorate;     /* in bytes/s */
+  double            iolast;     /* time of the last update */
+  uint64_t          iover;      /* current IO end event */
+  size_t            xferidx;
+
+  double            stretchsum, stretchmax;
+  size_t            nstretch;
+
+  /* monitoring window */
+  double            rtime[SIM_WINDOW_MAX];
+  double            ctime[SIM_WINDOW_MAX];
+  uint32_t          nsamples, sampleidx;
+};
+
+struct sim {
+  /* parameters */
+  uint32_t          nnodes;
+  uint32_t          ncores;     /* per node */
+  double            bandwidth;  /* of the file system, in bytes/s */
+  uint64_t          budget;     /* of the IO-set scheduler, in MiB/s */
+  double            serial;     /* serial fraction of the compute phases */
+  double            rscale;     /* scale of the iteration times sent to the policy */
+  double            streamint;  /* interval of the Beegfs stream events, 0 for none */
+  int               malleable;  /* apply the malleability policy */
+  FILE              *ioout;     /* simulated IO-set results, or NULL */
+
+  /* event queue */
+  struct simev      *heap;
+  size_t            nheap, heapcap;
+  uint64_t          seq;
+  double            now;
+
+  /* resource manager */
+  uint32_t          freenodes;
+  struct simjob     **jobs;
+  size_t            njobs, jobscap;
+  size_t            nextpending;  /* FCFS head */
+  size_t            nrunning;
+  size_t            ndone;
+  hm_t              *clients;     /* clid -> struct simjob * */
+
+  /* IO */
+  struct ioset_sched *iosched;
+  size_t            nio;          /* apps in an IO phase */
+  struct simjob     **xfer;       /* running transfers */
+  size_t            nxfer, xfercap;
+  double            lastxfer;     /* time of the last update */
+  int               ioerror;
+
+  /* malleability */
+  struct mallpolicy *policy;
+  struct icc_mall_client *snapclients;
+  size_t            snapcap;
+
+  /* results */
+  double            first, last;
+  double            stretchsum, stretchmax;
+  size_t            nstretch;
+  double            bytes;        /* written */
+  double            busy;         /* time with transfers running */
+  size_t            nactions[3], nrefused;
+  size_t            nstream;
+};
+
+
+/* event queue, binary min-heap on (t, seq) */
+
+static int
+simev_before(const struct simev *a, const struct simev *b)
+{
+  return a->t < b->t || (a->t == b->t && a->seq < b->seq);
+}
+
+static int
+sim_push(struct sim *sim, double t, enum simev_type type, struct simjob *job,
+         uint64_t ver)
+{
+  if (sim->nheap == sim->heapcap) {
+    size_t cap = sim->heapcap ? sim->heapcap * 2 : 1024;
+    struct simev *h = realloc(sim->heap, cap * sizeof(*h));
+    if (!h) {
+      fputs("Out of memory\n", stderr);
+      return -1;
+    }
+    sim->heap = h;
+    sim->heapcap = cap;
+  }
+
+  size_t i = sim->nheap++;
+  struct simev ev = { .t = t, .seq = sim->seq++, .type = type, .job = job, .ver = ver };
+
+  while (i > 0 && simev_before(&ev, &sim->heap[(i - 1) / 2])) {
+    sim->heap[i] = sim->heap[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  sim->heap[i] = ev;
+
+  return 0;
+}
+
+static int
+sim_pop(struct sim *sim, struct simev *ev)
+{
+  if (sim->nheap == 0)
+    return -1;
+
+  *ev = sim->heap[0];
+
+  struct simev last = sim->heap[--sim->nheap];
+  size_t i = 0, child;
+
+  while ((child = 2 * i + 1) < sim->nheap) {
+    if (child + 1 < sim->nheap && simev_before(&sim->heap[child + 1], &sim->heap[child]))
+      child++;
+    if (!simev_before(&sim->heap[child], &last))
+      break;
+    sim->heap[i] = sim->heap[child];
+    i = child;
+  }
+  if (sim->nheap > 0)
+    sim->heap[i] = last;
+
+  return 0;
+}
+
+
+/* malleability policy services and snapshots */
+
+static int
+sim_monitor_sample(void *ctx, const char *clid, double rtime, double ctime,
+                   uint32_t window, double *avg_rtime, double *avg_ctime,
+                   uint32_t *nsamples)
+{
+  struct sim *sim = ctx;
+  struct simjob *const *j = hm_get(sim->clients, clid);
+
+  if (!j || window == 0)
+    return -1;
+
+  struct simjob *job = *j;
+
+  if (window > SIM_WINDOW_MAX)
+    window = SIM_WINDOW_MAX;
+
+  job->rtime[job->sampleidx] = rtime;
+  job->ctime[job->sampleidx] = ctime;
+  job->sampleidx = (job->sampleidx + 1) % SIM_WINDOW_MAX;
+  if (job->nsamples < SIM_WINDOW_MAX)
+    job->nsamples++;
+
+  uint32_t n = job->nsamples < window ? job->nsamples : window;
+  double rsum = 0, csum = 0;
+
+  for (uint32_t i = 1; i <= n; i++) {
+    uint32_t k = (job->sampleidx + SIM_WINDOW_MAX - i) % SIM_WINDOW_MAX;
+    rsum += job->rtime[k];
+    csum += job->ctime[k];
+  }
+
+  *avg_rtime = rsum / n;
+  *avg_ctime = csum / n;
+  *nsamples = n;
+
+  return 0;
+}
+
+static int
+sim_monitor_reset(void *ctx, const char *clid)
+{
+  struct sim *sim = ctx;
+  struct simjob *const *j = hm_get(sim->clients, clid);
+
+  if (!j)
+    return -1;
+
+  (*j)->nsamples = 0;
+  (*j)->sampleidx = 0;
+
+  return 0;
+}
+
+static void
+sim_client(const struct simjob *job, struct icc_mall_client *c)
+{
+  memset(c, 0, sizeof(*c));
+  c->clid = job->clid;
+  c->type = "mpi";
+  c->addr = "";
+  c->nodelist = "";
+  c->jobid = job->jobid;
+  c->nnodes = job->nnodes;
+  c->nprocs = job->nprocs;
+}
+
+static int
+sim_snapshot(void *arg, uint32_t jobid, struct icc_mall_snapshot *snap)
+{
+  struct sim *sim = arg;
+  size_t n = 0;
+
+  if (sim->snapcap < sim->nrunning) {
+    struct icc_mall_client *c = realloc(sim->snapclients, sim->nrunning * sizeof(*c));
+    if (!c)
+      return -1;
+    sim->snapclients = c;
+    sim->snapcap = sim->nrunning;
+  }
+
+  for (size_t i = 0; i < sim->njobs && n < sim->nrunning; i++) {
+    const struct simjob *job = sim->jobs[i];
+    if (job->state == SIMJOB_RUNNING && job->malleable &&
+        (jobid == 0 || job->jobid == jobid))
+      sim_client(job, &sim->snapclients[n++]);
+  }
+
+  snap->jobid = jobid;
+  snap->clients = sim->snapclients;
+  snap->nclients = n;
+
+  return 0;
+}
+
+
+/* resource manager */
+
+static void
+sim_account(struct sim *sim, struct simjob *job)
+{
+  job->nodesec += job->nnodes * (sim->now - job->lastchange);
+  job->lastchange = sim->now;
+}
+
+static size_t sim_policy(struct sim *sim, struct mallpolicy_event *ev);
+static int sim_phase(struct sim *sim, struct simjob *job);
+
+/**
+ * Start the pending jobs in submission order while there are nodes
+ * for the first one.
+ */
+static int
+sim_schedule(struct sim *sim)
+{
+  while (sim->nextpending < sim->njobs) {
+    struct simjob *job = sim->jobs[sim->nextpending];
+
+    if (job->submit > sim->now || job->nnodes0 > sim->freenodes)
+      break;
+
+    sim->nextpending++;
+    sim->freenodes -= job->nnodes0;
+    sim->nrunning++;
+
+    job->state = SIMJOB_RUNNING;
+    job->start = sim->now;
+    job->lastchange = sim->now;
+    job->nnodes = job->nnodes0;
+    job->nprocs = job->nprocs0;
+
+    if (sim->malleable && job->malleable) {
+      struct icc_mall_client c;
+      struct mallpolicy_event ev = { .type = MALLPOLICY_REGISTER, .jobid = job->jobid };
+      sim_client(job, &c);
+      ev.u.client = &c;
+      sim_policy(sim, &ev);
+    }
+
+    if (sim_phase(sim, job))
+      return -1;
+  }
+
+  return 0;
+}
+
+static void
+sim_release(struct sim *sim, struct simjob *job, uint32_t nnodes)
+{
+  sim_account(sim, job);
+  job->nnodes -= nnodes;
+  sim->freenodes += nnodes;
+}
+
+static int
+sim_finish(struct sim *sim, struct simjob *job)
+{
+  job->state = SIMJOB_DONE;
+  job->end = sim->now;
+  sim_release(sim, job, job->nnodes);
+  sim->nrunning--;
+  sim->ndone++;
+
+  if (job->end > sim->last)
+    sim->last = job->end;
+
+  if (sim->malleable && job->malleable) {
+    struct mallpolicy_event ev = { .type = MALLPOLICY_DEREGISTER, .jobid = job->jobid };
+    ev.u.clid = job->clid;
+    sim_policy(sim, &ev);
+  }
+
+  return sim_schedule(sim);
+}
+
+/**
+ * Carry out ACTION the way Slurm would: expanding takes free nodes,
+ * shrinking gives back the nodes the job no longer needs.
+ */
+static void
+sim_apply(struct sim *sim, const struct icc_mall_action *action)
+{
+  struct simjob *const *j = hm_get(sim->clients, action->clid);
+  struct simjob *job;
+  uint32_t need;
+
+  if (!j || (*j)->state != SIMJOB_RUNNING) {
+    sim->nrefused++;
+    return;
+  }
+  job = *j;
+
+  switch (action->type) {
+  case ICC_MALL_EXPAND:
+    need = ceil((double)(job->nprocs + action->ncpus) / sim->ncores);
+    if (need < job->nnodes)
+      need = job->nnodes;
+    if (need - job->nnodes > sim->freenodes) {
+      sim->nrefused++;
+      return;
+    }
+    sim_account(sim, job);
+    sim->freenodes -= need - job->nnodes;
+    job->nnodes = need;
+    job->nprocs += action->ncpus;
+    break;
+
+  case ICC_MALL_SHRINK:
+    if (job->nprocs <= 1) {
+      sim->nrefused++;
+      return;
+    }
+    job->nprocs = job->nprocs > action->ncpus ? job->nprocs - action->ncpus : 1;
+    need = ceil((double)job->nprocs / sim->ncores);
+    if (need < job->nnodes)
+      sim_release(sim, job, job->nnodes - need);
+    break;
+
+  case ICC_MALL_SHRINK_NODES:
+    if (job->nnodes <= 1) {
+      sim->nrefused++;
+      return;
+    }
+    sim_release(sim, job, job->nnodes / 2);
+    if (job->nprocs > (uint64_t)job->nnodes * sim->ncores)
+      job->nprocs = (uint64_t)job->nnodes * sim->ncores;
+    break;
+
+  default:
+    sim->nrefused++;
+    return;
+  }
+
+  sim->nactions[action->type]++;
+}
+
+static size_t
+sim_policy(struct sim *sim, struct mallpolicy_event *ev)
+{
+  struct icc_mall_action actions[MALLPOLICY_MAXACTIONS];
+  size_t n;
+
+  n = mallpolicy_handle(sim->policy, ev, sim_snapshot, sim, actions, MALLPOLICY_MAXACTIONS);
+  for (size_t i = 0; i < n; i++)
+    sim_apply(sim, &actions[i]);
+
+  return n;
+}
+
+
+/* IO, scheduled as hint_io_begin_cb and hint_io_end_cb */
+
+static void sim_io_granted(struct sim *sim, struct simjob *job);
+
+/**
+ * Account for the bytes moved by the running transfers since the last
+ * change.
+ */
+static void
+sim_xfer_update(struct sim *sim)
+{
+  if (sim->nxfer > 0)
+    sim->busy += sim->now - sim->lastxfer;
+  sim->lastxfer = sim->now;
+
+  for (size_t i = 0; i < sim->nxfer; i++) {
+    struct simjob *job = sim->xfer[i];
+    double done = job->iorate * (sim->now - job->iolast);
+    if (done > job->iobytes)
+      done = job->iobytes;
+    job->iobytes -= done;
+    job->iolast = sim->now;
+    sim->bytes += done;
+  }
+}
+
+static double
+sim_demand(const struct sim *sim, const struct simjob *job)
+{
+  double bw = job->bandwidth * 1048576.0;
+  return bw > 0 && bw < sim->bandwidth ? bw : sim->bandwidth;
+}
+
+/**
+ * Share the file system bandwidth between the running transfers, in
+ * proportion to their demand, and schedule their end.
+ */
+static int
+sim_xfer_reschedule(struct sim *sim)
+{
+  double demand = 0, factor = 1;
+
+  for (size_t i = 0; i < sim->nxfer; i++)
+    demand += sim_demand(sim, sim->xfer[i]);
+  if (demand > sim->bandwidth)
+    factor = sim->bandwidth / demand;
+
+  for (size_t i = 0; i < sim->nxfer; i++) {
+    struct simjob *job = sim->xfer[i];
+    job->iorate = sim_demand(sim, job) * factor;
+    job->iover++;
+    if (sim_push(sim, sim->now + job->iobytes / job->iorate, SIMEV_IO_END, job, job->iover))
+      return -1;
+  }
+
+  return 0;
+}
+
+static int
+sim_xfer_start(struct sim *sim, struct simjob *job, double nbytes)
+{
+  sim_xfer_update(sim);
+
+  if (sim->nxfer == sim->xfercap) {
+    size_t cap = sim->xfercap ? sim->xfercap * 2 : 64;
+    struct simjob **x = realloc(sim->xfer, cap * sizeof(*x));
+    if (!x) {
+      fputs("Out of memory\n", stderr);
+      return -1;
+    }
+    sim->xfer = x;
+    sim->xfercap = cap;
+  }
+
+  job->xferidx = sim->nxfer;
+  sim->xfer[sim->nxfer++] = job;
+  job->iobytes = nbytes;
+  job->iolast = sim->now;
+
+  return sim_xfer_reschedule(sim);
+}
+
+static int
+sim_xfer_end(struct sim *sim, struct simjob *job)
+{
+  sim_xfer_update(sim);
+
+  size_t i = job->xferidx;
+  sim->xfer[i] = sim->xfer[--sim->nxfer];
+  sim->xfer[i]->xferidx = i;
+
+  return sim_xfer_reschedule(sim);
+}
+
+/**
+ * JOB got the permission to write some slices of its IO phase.
+ */
+static void
+sim_io_granted(struct sim *sim, struct simjob *job)
+{
+  const struct simphase *p = &job->phases[job->phase];
+  unsigned nslices = job->req.nslices;
+
+  if (!job->iostarted) {
+    job->iostart = sim->now;
+    job->iostarted = 1;
+  }
+
+  if (nslices > job->slicesleft)
+    nslices = job->slicesleft;
+  job->slicesleft -= nslices;
+
+  if (sim_xfer_start(sim, job, nslices * ((double)p->nbytes / SIM_NSLICES)))
+    sim->ioerror = -1;
+}
+
+static int
+sim_io_request(struct sim *sim, struct simjob *job)
+{
+  int rc = ioset_begin(sim->iosched, &job->req, SIM_NS(sim->now));
+
+  if (rc == -1) {
+    fprintf(stderr, "Cannot schedule IO of witer %"PRIu32"\n", job->req.witer);
+    return -1;
+  }
+  if (rc == IOSET_GRANTED)
+    sim_io_granted(sim, job);
+
+  return sim->ioerror;
+}
+
+static int
+sim_io_begin(struct sim *sim, struct simjob *job)
+{
+  const struct simphase *p = &job->phases[job->phase];
+
+  sim->nio++;
+  job->waitstart = sim->now;
+  job->iostarted = 0;
+  job->slicesleft = SIM_NSLICES;
+
+  /* IO outside of the IO-sets does not wait */
+  if (p->witer == 0) {
+    job->iostart = sim->now;
+    job->iostarted = 1;
+    job->slicesleft = 0;
+    return sim_xfer_start(sim, job, p->nbytes);
+  }
+
+  job->req.jobid = job->jobid;
+  job->req.jobstepid = 0;
+  job->req.witer = p->witer;
+  job->req.bandwidth = job->bandwidth;
+  job->req.arg = job;
+
+  return sim_io_request(sim, job);
+}
+
+static int
+sim_io_end(struct sim *sim, struct simjob *job)
+{
+  const struct simphase *p = &job->phases[job->phase];
+
+  if (sim_xfer_end(sim, job))
+    return -1;
+
+  if (p->witer != 0) {
+    struct ioset_req *granted;
+
+    granted = ioset_end(sim->iosched, job->jobid, 0, p->witer, job->slicesleft == 0,
+                        SIM_NS(sim->now));
+    while (granted) {
+      struct ioset_req *next = granted->next;
+      sim_io_granted(sim, granted->arg);
+      granted = next;
+    }
+    if (sim->ioerror)
+      return -1;
+
+    if (job->slicesleft > 0) {
+      /* back in line for the rest of the phase */
+      return sim_io_request(sim, job);
+    }
+  }
+
+  sim->nio--;
+
+  if (p->nbytes > 0) {
+    double stretch = (sim->now - job->waitstart) / (p->nbytes / sim_demand(sim, job));
+    sim->stretchsum += stretch;
+    sim->nstretch++;
+    if (stretch > sim->stretchmax)
+      sim->stretchmax = stretch;
+    job->stretchsum += stretch;
+    job->nstretch++;
+    if (stretch > job->stretchmax)
+      job->stretchmax = stretch;
+  }
+
+  if (sim->ioout && p->witer != 0) {
+    fprintf(sim->ioout, "\"%"PRIu32".0\",%"PRIu32",%.9f,%.9f,%.9f,%"PRIu64"\n",
+            job->jobid, p->witer, job->waitstart, job->iostart, sim->now, p->nbytes);
+  }
+
+  job->phase++;
+  return sim_phase(sim, job);
+}
+
+
+/* jobs */
+
+/**
+ * Start the compute part of the current phase of JOB, or finish it.
+ */
+static int
+sim_phase(struct sim *sim, struct simjob *job)
+{
+  if (job->phase >= job->nphases)
+    return sim_finish(sim, job);
+
+  const struct simphase *p = &job->phases[job->phase];
+  double ratio = (double)job->nprocs0 / job->nprocs;
+  double t = p->compute * (sim->serial + (1 - sim->serial) * ratio);
+
+  /* a reconfiguration during the computation applies to the next one */
+  job->computestart = sim->now;
+  return sim_push(sim, sim->now + t, SIMEV_COMPUTE_END, job, 0);
+}
+
+static int
+sim_compute_end(struct sim *sim, struct simjob *job, double elapsed)
+{
+  const struct simphase *p = &job->phases[job->phase];
+
+  /* the client enters a malleability region at the end of each
+     iteration, after sending its monitoring data */
+  if (sim->malleable && job->malleable) {
+    struct icc_mall_metric m = {
+      .clid = job->clid,
+      .jobid = job->jobid,
+      .nprocs = job->nprocs,
+      .rtime = elapsed * sim->rscale,
+    };
+    struct icc_mall_region r = {
+      .clid = job->clid,
+      .jobid = job->jobid,
+      .enter = 1,
+    };
+    struct mallpolicy_event ev = { .type = MALLPOLICY_METRIC, .jobid = job->jobid };
+    ev.u.metric = &m;
+    sim_policy(sim, &ev);
+
+    ev.type = MALLPOLICY_REGION;
+    ev.u.region = &r;
+    sim_policy(sim, &ev);
+
+    /* nodes given back by a shrink may let pending jobs start */
+    if (sim_schedule(sim))
+      return -1;
+  }
+
+  if (p->nbytes == 0) {
+    job->phase++;
+    return sim_phase(sim, job);
+  }
+
+  return sim_io_begin(sim, job);
+}
+
+static int
+sim_stream(struct sim *sim)
+{
+  struct icc_mall_stream_event s = {
+    .stream = "beegfs",
+    .timestamp = sim->now,
+    .qlen = sim->nio,
+  };
+  struct mallpolicy_event ev = { .type = MALLPOLICY_STREAM, .jobid = 0 };
+  ev.u.stream = &s;
+
+  sim->nstream++;
+  sim_policy(sim, &ev);
+
+  if (sim_schedule(sim))
+    return -1;
+
+  if (sim->ndone < sim->njobs)
+    return sim_push(sim, sim->now + sim->streamint, SIMEV_STREAM, NULL, 0);
+
+  return 0;
+}
+
+static int
+sim_run(struct sim *sim)
+{
+  struct simev ev;
+  int rc = 0;
+
+  for (size_t i = 0; i < sim->njobs; i++) {
+    if (sim_push(sim, sim->jobs[i]->submit, SIMEV_SUBMIT, sim->jobs[i], 0))
+      return -1;
+  }
+  if (sim->malleable && sim->streamint > 0 && sim->njobs > 0) {
+    if (sim_push(sim, sim->first + sim->streamint, SIMEV_STREAM, NULL, 0))
+      return -1;
+  }
+
+  while (rc == 0 && sim_pop(sim, &ev) == 0) {
+    sim->now = ev.t;
+
+    switch (ev.type) {
+    case SIMEV_SUBMIT:
+      rc = sim_schedule(sim);
+      break;
+    case SIMEV_COMPUTE_END:
+      rc = sim_compute_end(sim, ev.job, sim->now - ev.job->computestart);
+      break;
+    case SIMEV_IO_END:
+      if (ev.ver == ev.job->iover)  /* else rescheduled */
+        rc = sim_io_end(sim, ev.job);
+      break;
+    case SIMEV_STREAM:
+      rc = sim_stream(sim);
+      break;
+    }
+  }
+
+  return rc;
+}
+
+
+/* workload */
+
+static struct simjob *
+sim_newjob(struct sim *sim, uint32_t nnodes, int malleable)
+{
+  struct simjob *job;
+
+  if (sim->njobs == sim->jobscap) {
+    size_t cap = sim->jobscap ? sim->jobscap * 2 : 256;
+    struct simjob **j = realloc(sim->jobs, cap * sizeof(*j));
+    if (!j)
+      return NULL;
+    sim->jobs = j;
+    sim->jobscap = cap;
+  }
+
+  job = calloc(1, sizeof(*job));
+  if (!job)
+    return NULL;
+
+  job->jobid = sim->njobs + 1;  /* 0 means no job in an IO-set */
+  snprintf(job->clid, sizeof(job->clid), "sim-%08"PRIu32, job->jobid);
+  job->state = SIMJOB_PENDING;
+  job->malleable = malleable;
+  job->nnodes0 = nnodes;
+  job->nprocs0 = (uint64_t)nnodes * sim->ncores;
+
+  if (hm_set(sim->clients, job->clid, &job, sizeof(job)) == -1) {
+    free(job);
+    return NULL;
+  }
+
+  sim->jobs[sim->njobs++] = job;
+
+  return job;
+}
+
+static struct simphase *
+sim_newphase(struct simjob *job)
+{
+  if (job->nphases == job->phasescap) {
+    size_t cap = job->phasescap ? job->phasescap * 2 : 16;
+    struct simphase *p = realloc(job->phases, cap * sizeof(*p));
+    if (!p)
+      return NULL;
+    job->phases = p;
+    job->phasescap = cap;
+  }
+
+  struct simphase *p = &job->phases[job->nphases++];
+  memset(p, 0, sizeof(*p));
+  return p;
+}
+
+static int
+phase_cmp(const void *a, const void *b)
+{
+  const struct simphase *p = a, *q = b;
+  return (p->compute > q->compute) - (p->compute < q->compute);
+}
+
+static int
+job_cmp(const void *a, const void *b)
+{
+  const struct simjob *j = *(struct simjob *const *)a, *k = *(struct simjob *const *)b;
+  if (j->submit != k->submit)
+    return (j->submit > k->submit) - (j->submit < k->submit);
+  return (j->jobid > k->jobid) - (j->jobid < k->jobid);
+}
+
+/**
+ * Read a line of the IO-set results of the server. Each application
+ * becomes a job with one phase per line, computing between the end
+ * of its previous IO phase and the wait for the next one. Its
+ * bandwidth is the fastest of its IO phases.
+ *
+ * Return 0 or -1 in case of error.
+ */
+static int
+sim_read_ioset(struct sim *sim, hm_t *apps, char *line, uint32_t nnodes,
+               double *bandwidth)
+{
+  char *appid, *end;
+  double waitstart, iostart, ioend;
+  unsigned long witer;
+  unsigned long long nbytes;
+  struct simjob *job;
+
+  appid = line + 1;
+  end = strchr(appid, '"');
+  if (!end)
+    return -1;
+  *end = '\0';
+
+  if (sscanf(end + 1, ",%lu,%lf,%lf,%lf,%llu", &witer, &waitstart, &iostart,
+             &ioend, &nbytes) != 5 || witer == 0 || witer > UINT32_MAX)
+    return -1;
+
+  struct simjob *const *j = hm_get(apps, appid);
+  if (j) {
+    job = *j;
+  } else {
+    job = sim_newjob(sim, nnodes, 1);
+    if (!job || hm_set(apps, appid, &job, sizeof(job)) == -1)
+      return -1;
+  }
+
+  struct simphase *p = sim_newphase(job);
+  if (!p)
+    return -1;
+
+  p->compute = waitstart;         /* until all phases are read */
+  p->ioend = ioend;
+  p->witer = witer;
+  p->nbytes = nbytes;
+
+  if (ioend > iostart) {
+    double bw = nbytes / (ioend - iostart);
+    if (bw > *bandwidth)
+      *bandwidth = bw;
+    if (ceil(bw / 1048576) > job->bandwidth && ceil(bw / 1048576) <= UINT32_MAX)
+      job->bandwidth = ceil(bw / 1048576);
+  }
+
+  return 0;
+}
+
+static int
+sim_read_job(struct sim *sim, const char *line)
+{
+  double submit, compute;
+  unsigned long nnodes, nphases, witer, bandwidth = 0;
+  unsigned long long nbytes;
+  int malleable = 1, n;
+  struct simjob *job;
+
+  n = sscanf(line, "%lf,%lu,%lu,%lf,%lu,%llu,%d,%lu", &submit, &nnodes, &nphases,
+             &compute, &witer, &nbytes, &malleable, &bandwidth);
+  if (n < 6 || nnodes == 0 || nphases == 0 || witer > UINT32_MAX ||
+      bandwidth > UINT32_MAX)
+    return -1;
+
+  job = sim_newjob(sim, nnodes, malleable);
+  if (!job)
+    return -1;
+  job->submit = submit;
+  job->bandwidth = bandwidth;
+
+  for (unsigned long i = 0; i < nphases; i++) {
+    struct simphase *p = sim_newphase(job);
+    if (!p)
+      return -1;
+    p->compute = compute;
+    p->witer = witer;
+    p->nbytes = nbytes;
+  }
+
+  return 0;
+}
+
+/**
+ * Read the workload in PATH, in either format.
+ *
+ * Return 0 or -1 in case of error.
+ */
+static int
+sim_load(struct sim *sim, const char *path, uint32_t nnodes)
+{
+  char line[SIM_LINE_LEN];
+  double bandwidth = 0;
+  unsigned lineno = 0;
+  int rc = 0, iosets = 0;
+  FILE *f;
+  hm_t *apps;
+
+  f = fopen(path, "r");
+  if (!f) {
+    perror(path);
+    return -1;
+  }
+
+  apps = hm_create();
+  if (!apps) {
+    fclose(f);
+    return -1;
+  }
+
+  while (rc == 0 && fgets(line, sizeof(line), f)) {
+    lineno++;
+    if (line[0] == '#' || line[0] == '\n' || !strncmp(line, "\"appid\"", 7))
+      continue;              /* header of icc_iotrace */
+
+    if (line[0] == '"') {
+      iosets = 1;
+      rc = sim_read_ioset(sim, apps, line, nnodes, &bandwidth);
+    } else {
+      rc = sim_read_job(sim, line);
+    }
+    if (rc)
+      fprintf(stderr, "%s:%u: invalid line\n", path, lineno);
+  }
+
+  hm_free(apps);
+  fclose(f);
+
+  if (rc)
+    return -1;
+
+  if (iosets) {
+    for (size_t i = 0; i < sim->njobs; i++) {
+      struct simjob *job = sim->jobs[i];
+      double prevend;
+
+      if (job->nphases == 0)
+        continue;
+
+      qsort(job->phases, job->nphases, sizeof(*job->phases), phase_cmp);
+      job->submit = job->phases[0].compute;
+
+      prevend = job->submit;
+      for (size_t k = 0; k < job->nphases; k++) {
+        double waitstart = job->phases[k].compute;
+        job->phases[k].compute = waitstart > prevend ? waitstart - prevend : 0;
+        prevend = job->phases[k].ioend;
+      }
+    }
+
+    /* without a bandwidth, assume the fastest IO phase of the trace
+       had all of it */
+    if (sim->bandwidth == 0)
+      sim->bandwidth = bandwidth;
+  }
+
+  /* time starts at the first submission */
+  qsort(sim->jobs, sim->njobs, sizeof(*sim->jobs), job_cmp);
+  sim->first = sim->njobs ? sim->jobs[0]->submit : 0;
+  for (size_t i = 0; i < sim->njobs; i++) {
+    sim->jobs[i]->submit -= sim->first;
+    if (sim->jobs[i]->nnodes0 > sim->nnodes) {
+      fprintf(stderr, "Job %"PRIu32" needs %"PRIu32" nodes, the cluster has %"PRIu32"\n",
+              sim->jobs[i]->jobid, sim->jobs[i]->nnodes0, sim->nnodes);
+      return -1;
+    }
+  }
+  sim->first = 0;
+
+  return 0;
+}
+
+
+static void
+sim_report(const struct sim *sim, int perjob)
+{
+  double nodesec = 0, wait = 0;
+  double makespan = sim->last - sim->first;
+
+  for (size_t i = 0; i < sim->njobs; i++) {
+    nodesec += sim->jobs[i]->nodesec;
+    wait += sim->jobs[i]->start - sim->jobs[i]->submit;
+  }
+
+  printf("%-16s %zu\n", "jobs", sim->njobs);
+  printf("%-16s %zu\n", "unfinished", sim->njobs - sim->ndone);
+  printf("%-16s %.3f s\n", "makespan", makespan);
+  printf("%-16s %.3f\n", "node-hours", nodesec / 3600);
+  printf("%-16s %.3f s\n", "mean wait", sim->njobs ? wait / sim->njobs : 0);
+  printf("%-16s %zu\n", "IO phases", sim->nstretch);
+  printf("%-16s mean %.3f max %.3f\n", "IO stretch",
+         sim->nstretch ? sim->stretchsum / sim->nstretch : 0, sim->stretchmax);
+  printf("%-16s %.3f (busy %.3f)\n", "IO utilisation",
+         makespan > 0 ? sim->bytes / (sim->bandwidth * makespan) : 0,
+         makespan > 0 ? sim->busy / makespan : 0);
+  printf("%-16s expand %zu shrink %zu shrink_nodes %zu refused %zu\n", "decisions",
+         sim->nactions[ICC_MALL_EXPAND], sim->nactions[ICC_MALL_SHRINK],
+         sim->nactions[ICC_MALL_SHRINK_NODES], sim->nrefused);
+  printf("%-16s %zu\n", "stream events", sim->nstream);
+
+  if (!perjob)
+    return;
+
+  printf("\n%8s %6s %6s %12s %12s %10s %10s\n", "JOBID", "NODES", "PHASES",
+         "START", "END", "STRETCH", "MAX");
+  for (size_t i = 0; i < sim->njobs; i++) {
+    const struct simjob *job = sim->jobs[i];
+    printf("%8"PRIu32" %6"PRIu32" %6zu %12.3f %12.3f %10.3f %10.3f\n", job->jobid,
+           job->nnodes0, job->nphases, job->start, job->end,
+           job->nstretch ? job->stretchsum / job->nstretch : 0, job->stretchmax);
+  }
+}
+
+
+static void
+usage(void)
+{
+  fputs("usage: sim [options] TRACE\n"
+        "Replay the workload TRACE on a simulated cluster with the malleability\n"
+        "and IO-set policies of the controller\n"
+        "  --nodes N          nodes of the cluster (default 64)\n"
+        "  --cores N          cores per node (default 16)\n"
+        "  --bandwidth MiB/s  file system bandwidth (default: fastest IO phase\n"
+        "                     of an IO-set trace, 1024 otherwise)\n"
+        "  --budget MiB/s     bandwidth the IO-set scheduler hands out, 0 to\n"
+        "                     let applications do IO one at a time (default 0)\n"
+        "  --job-nodes N      nodes of the jobs of an IO-set trace (default 1)\n"
+        "  --serial F         serial fraction of the computations (default 0)\n"
+        "  --rtime-scale F    scale of the iteration times seen by the policy (default 1)\n"
+        "  --stream S         interval of the Beegfs events in s, 0 for none (default 10)\n"
+        "  --policy NAME      malleability policy (default $"ICC_MALL_POLICY_ENV" or \"default\")\n"
+        "  --static           do not apply the malleability policy\n"
+        "  --output FILE      write the simulated IO-set results to FILE\n"
+        "  --per-job          print the results of each job\n"
+        "TRACE is either an IO-set result file of the server or lines of\n"
+        "  submit,nnodes,nphases,compute,witer,nbytes[,malleable[,bandwidth]]\n", stderr);
+  exit(1);
+}
+
+static double
+parse_double(const char *arg, const char *name, double min)
+{
+  char *end;
+  double d = strtod(arg, &end);
+  if (*arg == '\0' || *end != '\0' || d < min) {
+    fprintf(stderr, "Invalid argument: %s\n", name);
+    usage();
+  }
+  return d;
+}
+
+
+int
+main(int argc, char **argv)
+{
+  static struct option longopts[] = {
+    { "nodes",       required_argument, NULL, 'N' },
+    { "cores",       required_argument, NULL, 'c' },
+    { "bandwidth",   required_argument, NULL, 'b' },
+    { "budget",      required_argument, NULL, 'B' },
+    { "job-nodes",   required_argument, NULL, 'n' },
+    { "serial",      required_argument, NULL, 's' },
+    { "rtime-scale", required_argument, NULL, 'r' },
+    { "stream",      required_argument, NULL, 'q' },
+    { "policy",      required_argument, NULL, 'p' },
+    { "static",      no_argument,       NULL, 'S' },
+    { "output",      required_argument, NULL, 'o' },
+    { "per-job",     no_argument,       NULL, 'j' },
+    { NULL,          0,                 NULL,  0  },
+  };
+
+  struct sim sim = {
+    .nnodes = 64,
+    .ncores = 16,
+    .rscale = 1,
+    .streamint = 10,
+    .malleable = 1,
+  };
+  const char *policy = getenv(ICC_MALL_POLICY_ENV);
+  const char *output = NULL;
+  uint32_t jobnodes = 1;
+  int ch, perjob = 0, rc = EXIT_FAILURE;
+
+  while ((ch = getopt_long(argc, argv, "N:c:b:B:n:s:r:q:p:So:j", longopts, NULL)) != -1)
+    switch (ch) {
+    case 'N':
+      sim.nnodes = parse_double(optarg, "nodes", 1);
+      continue;
+    case 'c':
+      sim.ncores = parse_double(optarg, "cores", 1);
+      continue;
+    case 'b':
+      sim.bandwidth = parse_double(optarg, "bandwidth", 0) * 1024 * 1024;
+      continue;
+    case 'B':
+      sim.budget = parse_double(optarg, "budget", 0);
+      continue;
+    case 'n':
+      jobnodes = parse_double(optarg, "job-nodes", 1);
+      continue;
+    case 's':
+      sim.serial = parse_double(optarg, "serial", 0);
+      if (sim.serial > 1)
+        usage();
+      continue;
+    case 'r':
+      sim.rscale = parse_double(optarg, "rtime-scale", 0);
+      continue;
+    case 'q':
+      sim.streamint = parse_double(optarg, "stream", 0);
+      continue;
+    case 'p':
+      policy = optarg;
+      continue;
+    case 'S':
+      sim.malleable = 0;
+      continue;
+    case 'o':
+      output = optarg;
+      continue;
+    case 'j':
+      perjob = 1;
+      continue;
+    case 0:
+      continue;
+    default:
+      usage();
+    }
+  argc -= optind;
+  argv += optind;
+
+  if (argc != 1)
+    usage();
+
+  sim.freenodes = sim.nnodes;
+  sim.clients = hm_create();
+  if (!sim.clients || ioset_sched_init(&sim.iosched, sim.budget, 0)) {
+    fputs("Cannot initialize the simulator\n", stderr);
+    goto end;
+  }
+
+  if (sim_load(&sim, argv[0], jobnodes))
+    goto end;
+
+  if (sim.bandwidth == 0)
+    sim.bandwidth = 1024.0 * 1024 * 1024;
+
+  if (output) {
+    sim.ioout = fopen(output, "w");
+    if (!sim.ioout) {
+      perror(output);
+      goto end;
+    }
+  }
+
+  /* the policy locks with Argobots and logs with Margo */
+  if (ABT_init(0, NULL) != ABT_SUCCESS) {
+    fputs("Cannot initialize Argobots\n", stderr);
+    goto end;
+  }
+
+  struct icc_mall_services srv = {
+    .ctx = &sim,
+    .monitor_sample = sim_monitor_sample,
+    .monitor_reset = sim_monitor_reset,
+  };
+
+  if (mallpolicy_load(&sim.policy, MARGO_INSTANCE_NULL, policy, &srv)) {
+    fputs("Cannot load malleability policy\n", stderr);
+  } else {
+    if (sim_run(&sim) == 0) {
+      sim_report(&sim, perjob);
+      rc = EXIT_SUCCESS;
+    }
+    mallpolicy_fini(&sim.policy);
+  }
+
+  ABT_finalize();
+
+ end:
+  if (sim.ioout)
+    fclose(sim.ioout);
+
+  ioset_sched_fini(&sim.iosched);
+  if (sim.clients)
+    hm_free(sim.clients);
+
+  for (size_t i = 0; i < sim.njobs; i++) {
+    free(sim.jobs[i]->phases);
+    free(sim.jobs[i]);
+  }
+  free(sim.jobs);
+  free(sim.heap);
+  free(sim.xfer);
+  free(sim.snapclients);
+
+  return rc;
+}
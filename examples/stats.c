@@ -0,0 +1,122 @@
+#include <assert.h>
+#include <getopt.h>
+#include <inttypes.h>           /* SCNu64 */
+#include <stdio.h>              /* printf */
+#include <stdlib.h>             /* exit */
+#include <string.h>             /* strtok_r */
+
+#include "icc.h"
+
+static const char *fmtns(char *buf, size_t size, double ns);
+
+
+void
+usage(void)
+{
+  fputs("usage: stats [--reset] [--raw]\n"
+        "Print the latency histograms and gauges of the controller\n"
+        "  --reset  zero the statistics after reading them\n"
+        "  --raw    print the statistics as sent by the controller\n", stderr);
+  exit(1);
+}
+
+
+int
+main(int argc, char **argv)
+{
+  static struct option longopts[] = {
+    { "reset", no_argument, NULL, 'r' },
+    { "raw",   no_argument, NULL, 'R' },
+    { NULL,    0,           NULL,  0  },
+  };
+
+  int ch, ret, rpcret, reset, raw;
+  char *text, *line, *saveptr;
+
+  reset = raw = 0;
+
+  while ((ch = getopt_long(argc, argv, "rR", longopts, NULL)) != -1)
+    switch (ch) {
+    case 'r':
+      reset = 1;
+      continue;
+    case 'R':
+      raw = 1;
+      continue;
+    case 0:
+      continue;
+    default:
+      usage();
+    }
+  argc -= optind;
+  argv += optind;
+
+  struct icc_context *icc;
+  icc_init(ICC_LOG_INFO, ICC_TYPE_UNDEFINED, &icc);
+  assert(icc != NULL);
+
+  ret = icc_rpc_stats(icc, reset, &text, &rpcret);
+  if (ret != ICC_SUCCESS || rpcret != ICC_SUCCESS) {
+    fprintf(stderr, "Error getting the statistics of the controller\n");
+    icc_fini(icc);
+    exit(1);
+  }
+
+  if (raw) {
+    fputs(text ? text : "", stdout);
+  } else if (text) {
+    char b[6][16];
+    char family[64], name[128];
+    uint64_t count, sum, max, p50, p90, p99, p999;
+    int64_t value, vmax;
+
+    printf("%-12s %-32s %10s %9s %9s %9s %9s %9s %9s\n", "FAMILY", "NAME",
+           "COUNT", "MEAN", "P50", "P90", "P99", "P99.9", "MAX");
+
+    for (line = strtok_r(text, "\n", &saveptr); line;
+         line = strtok_r(NULL, "\n", &saveptr)) {
+      if (sscanf(line, "hist %63s %127s %"SCNu64" %"SCNu64" %"SCNu64
+                 " %"SCNu64" %"SCNu64" %"SCNu64" %"SCNu64,
+                 family, name, &count, &sum, &max,
+                 &p50, &p90, &p99, &p999) == 9) {
+        if (count == 0)
+          continue;
+        printf("%-12s %-32s %10"PRIu64" %9s %9s %9s %9s %9s %9s\n",
+               family, name, count,
+               fmtns(b[0], sizeof(b[0]), (double)sum / count),
+               fmtns(b[1], sizeof(b[1]), p50), fmtns(b[2], sizeof(b[2]), p90),
+               fmtns(b[3], sizeof(b[3]), p99), fmtns(b[4], sizeof(b[4]), p999),
+               fmtns(b[5], sizeof(b[5]), max));
+      } else if (sscanf(line, "gauge %63s %127s %"SCNd64" %"SCNd64,
+                        family, name, &value, &vmax) == 4) {
+        printf("%-12s %-32s %10"PRId64" %49s %9"PRId64"\n",
+               family, name, value, "", vmax);
+      }
+    }
+  }
+
+  free(text);
+
+  ret = icc_fini(icc);
+  assert(ret == 0);
+
+  return EXIT_SUCCESS;
+}
+
+
+/**
+ * Format the duration NS in BUF with a human readable unit.
+ */
+static const char *
+fmtns(char *buf, size_t size, double ns)
+{
+  if (ns < 1e3)
+    snprintf(buf, size, "%.0fns", ns);
+  else if (ns < 1e6)
+    snprintf(buf, size, "%.1fus", ns / 1e3);
+  else if (ns < 1e9)
+    snprintf(buf, size, "%.1fms", ns / 1e6);
+  else
+    snprintf(buf, size, "%.2fs", ns / 1e9);
+  return buf;
+}
@@ -68,7 +68,8 @@
 static void
 usage(char *name)
 {
-  fprintf(stderr, "Usage: %s --witer --bandwidth (MiB/s) [--duration (s) --ioshare(%%] FILEPATH\n", name);
+  fprintf(stderr, "Usage: %s --witer --bandwidth (MiB/s) [--duration (s) --ioshare(%%) --crash PHASE] FILEPATH\n", name);
+  fputs("  --crash PHASE  die in the middle of IO phase PHASE (from 0), holding the IO-set\n", stderr);
 }
 
 
@@ -81,19 +82,21 @@ int main(int argc, char *argv[])
   long duration = DURATION_DEFAULT;
   long bandwidth = 0;
   long ioshare = IOSHARE_DEFAULT;
+  long crash = -1;
 
   static struct option longopts[] = {
     { "witer",     required_argument, NULL, 'w' },
     { "duration",  required_argument, NULL, 'h' },
     { "bandwdith", required_argument, NULL, 'b' },
     { "ioshare",   required_argument, NULL, 'i' },
+    { "crash",     required_argument, NULL, 'c' },
     { NULL,        0,                 NULL,  0  },
   };
 
   int ch;
   char *endptr;
 
-  while ((ch = getopt_long(argc, argv, "w:h:b:i:", longopts, NULL)) != -1) {
+  while ((ch = getopt_long(argc, argv, "w:h:b:i:c:", longopts, NULL)) != -1) {
     switch (ch) {
     case 'w':
       witer_s = strtol(optarg, &endptr, 0);
@@ -124,6 +127,13 @@ int main(int argc, char *argv[])
         exit(EXIT_FAILURE);
       }
       break;
+    case 'c':
+      crash = strtol(optarg, &endptr, 0);
+      if (errno != 0 || endptr == optarg || *endptr != '\0' || crash < 0) {
+        fputs("Invalid argument: crash\n", stderr);
+        exit(EXIT_FAILURE);
+      }
+      break;
     case 0:
       continue;
     default:
@@ -201,6 +211,10 @@ int main(int argc, char *argv[])
       fputs("Could not initialize libicc\n", stderr);
       MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
     }
+    /* lets the IC run other writers alongside */
+    if (icc_hint_io_bandwidth(icc, bandwidth)) {
+      fputs("icc_hint_io_bandwidth error\n", stderr);
+    }
   }
 
   long int niter = duration / witer.tv_sec;
@@ -214,6 +228,12 @@ int main(int argc, char *argv[])
         ICC_HINT_IO_BEGIN(rank, icc, witer.tv_sec, j == 0, &nslices);
         nslices = nslices > NSLICES_TOTAL ? NSLICES_TOTAL : nslices;
       }
+
+      /* fault injection: the IC must revoke our IO-set once the lease expires */
+      if (i == crash && j == NSLICES_TOTAL / 2) {
+        fprintf(stderr, "Crashing in IO phase %ld\n", i);
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+      }
       /* rewind file pointer + collective: wait for authorization from root rank */
       MPI_File_seek_shared(fh, 0, MPI_SEEK_SET);
 
@@ -0,0 +1,79 @@
+#ifndef _ADMIRE_IC_ADDRCACHE_H
+#define _ADMIRE_IC_ADDRCACHE_H
+/**
+ * Cache of Mercury addresses, keyed by address string.
+ *
+ * Looking up an address sets up the connection to its peer, which is
+ * worth keeping between the notifications sent to the same
+ * clients. The cache holds one reference on each address, lookups
+ * return a duplicate reference to be freed with margo_addr_free as
+ * usual, so evicting an address in use is safe.
+ *
+ * The least recently used addresses are evicted past the capacity of
+ * the cache. Addresses that could not be looked up or reached are
+ * remembered as such for a while (negative entries), lookups of them
+ * fail immediately instead of waiting for another timeout.
+ *
+ * All functions accept a NULL cache, lookups then go to Mercury.
+ */
+
+#include <stdint.h>
+#include <margo.h>
+
+#define ADDRCACHE_CAPACITY_DEFAULT 1024
+#define ADDRCACHE_NEG_TTL_DEFAULT  5.0   /* seconds */
+
+struct addrcache;
+
+struct addrcache_stats {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t neghits;             /* lookups failed by a negative entry */
+  uint64_t evictions;
+  uint64_t invalidations;
+  uint64_t lookups;             /* Mercury lookups */
+  double   lookup_time;         /* total time spent in them, in s */
+  double   lookup_max;          /* longest one, in s */
+};
+
+/**
+ * Initialize a cache of up to CAPACITY addresses, with negative
+ * entries expiring after NEG_TTL seconds. 0 selects the defaults.
+ *
+ * Returns 0 if everything went fine, -1 otherwise.
+ */
+int addrcache_init(struct addrcache **cache, margo_instance_id mid,
+                   size_t capacity, double neg_ttl);
+
+/**
+ * Free CACHE and release the addresses it holds.
+ */
+void addrcache_fini(struct addrcache **cache);
+
+/**
+ * Get the counters of CACHE into STATS.
+ */
+void addrcache_stats(struct addrcache *cache, struct addrcache_stats *stats);
+
+/**
+ * Cached margo_addr_lookup of address string STR. ADDR must be freed
+ * with margo_addr_free.
+ *
+ * Return a Mercury code, HG_NOENTRY if STR has a negative entry.
+ */
+hg_return_t addrcache_lookup(struct addrcache *cache, margo_instance_id mid,
+                             const char *str, hg_addr_t *addr);
+
+/**
+ * Report that STR could not be reached, replacing its entry by a
+ * negative one.
+ */
+void addrcache_fail(struct addrcache *cache, const char *str);
+
+/**
+ * Forget the entry of STR, if any, e.g when the client at this
+ * address goes away.
+ */
+void addrcache_invalidate(struct addrcache *cache, const char *str);
+
+#endif
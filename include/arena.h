@@ -0,0 +1,53 @@
+#ifndef ADMIRE_ARENA_H
+#define ADMIRE_ARENA_H
+
+#include <stddef.h>
+
+/**
+ * Region allocator: memory is carved out of large blocks and released
+ * all at once, for data sharing a lifetime. NOT thread-safe.
+ */
+struct arena;
+
+struct arena_stats {
+  size_t nblocks;
+  size_t size;                  /* bytes in blocks */
+  size_t used;                  /* bytes handed out */
+};
+
+/**
+ * Create an arena allocating blocks of BLOCKSIZE bytes, 0 for a
+ * default size. Larger requests get a block of their own.
+ *
+ * Return the arena or NULL in case of error.
+ */
+struct arena *arena_create(size_t blocksize);
+
+/**
+ * Free ARENA and all the memory allocated from it.
+ */
+void arena_free(struct arena *arena);
+
+/**
+ * Release all the memory allocated from ARENA at once, keeping one
+ * block for reuse.
+ */
+void arena_reset(struct arena *arena);
+
+/**
+ * Return SIZE bytes of zeroed memory from ARENA, suitably aligned for
+ * any type, or NULL in case of error.
+ */
+void *arena_alloc(struct arena *arena, size_t size);
+
+/**
+ * Copy the first LEN bytes of S to ARENA, as a NULL-terminated string.
+ */
+char *arena_strndup(struct arena *arena, const char *s, size_t len);
+
+/**
+ * Get the memory usage of ARENA into STATS.
+ */
+void arena_stats(const struct arena *arena, struct arena_stats *stats);
+
+#endif
@@ -43,4 +43,15 @@ DECLARE_MARGO_RPC_HANDLER(resalloc_cb);
 void lowmem_cb(hg_handle_t h);
 DECLARE_MARGO_RPC_HANDLER(lowmem_cb);
 
+/**
+ * Multicast callback. Forwards the message to the subtree of the
+ * client and handles it like the RPC it wraps.
+ *
+ * RPC status code:
+ * The number of clients of the subtree, this one included, the
+ * message could not be delivered to or that failed to handle it.
+ */
+void multicast_cb(hg_handle_t h);
+DECLARE_MARGO_RPC_HANDLER(multicast_cb);
+
 #endif
@@ -4,7 +4,13 @@
  * IC server callbacks. Some need access to the DB.
  */
 
+#include "arena.h"
 #include "hashmap.h"
+#include "clcache.h"
+#include "addrcache.h"
+#include "evqueue.h"
+#include "ioset.h"
+#include "iotrace.h"
 
 // CHANGE JAVI
 #include "rpc.h"
@@ -26,6 +32,7 @@ void hint_io_end_cb(hg_handle_t h);
 void metricalert_cb(hg_handle_t h);
 void alert_cb(hg_handle_t h);
 void nodealert_cb(hg_handle_t h);
+void stats_cb(hg_handle_t h);
 
 //ALBERTO
 void malleability_query_cb(hg_handle_t h);
@@ -45,6 +52,7 @@ DECLARE_MARGO_RPC_HANDLER(hint_io_end_cb);
 DECLARE_MARGO_RPC_HANDLER(metricalert_cb);
 DECLARE_MARGO_RPC_HANDLER(alert_cb);
 DECLARE_MARGO_RPC_HANDLER(nodealert_cb);
+DECLARE_MARGO_RPC_HANDLER(stats_cb);
 //ALBERTO
 DECLARE_MARGO_RPC_HANDLER(checkpoint_cb);
 DECLARE_MARGO_RPC_HANDLER(malleability_query_cb);
@@ -52,49 +60,50 @@ DECLARE_MARGO_RPC_HANDLER(malleability_query_cb);
 
 /* XX fixme: duplication in structs */
 struct malleability_data {
-  ABT_mutex           mutex;    /* malleability thread mutex etc. */
-  ABT_cond            cond;
-  char                sleep;
-  // CHANGE JAVI
-  ABT_cond            cond2;
-  enum icc_rpc_code   rpc_code; /* rpc using condition to trigger maleability thread */
-  void *              rpc_data; /* generic data transfered from rpc to maleability thread */
-  char                clid[UUID_STR_LEN]; /* client uuid */
-  // END CHANGE JAVI
+  struct evqueue      *events;  /* events handed over by the RPC handlers */
   margo_instance_id   mid;
-  uint32_t            jobid;    /* job that triggered malleability */
   struct icdb_context **icdbs;  /* DB connection pool */
+  struct clcache      *clcache; /* DB client & job cache */
+  struct addrcache    *addrcache; /* client address cache */
+  struct mallpolicy   *policy;  /* malleability policy */
   hg_id_t             *rpcids;  /* RPC handles */
 };
 
-struct ioset {
-  double    priority;
-  long      jobid;              /* job of the running app, 0 if none */
-  long      jobstepid;          /* jobstep of the running app */
-  ABT_cond  waitq;              /* waiting queue for app in this set */
-  ABT_mutex lock;
-};
-
-struct ioset_time {
-  struct timespec iostart;      /* IO start time */
-  struct timespec waitstart;    /* IO-set wait time */
-};
-
 struct cb_data {
   struct icdb_context **icdbs;  /* DB connection pool */
+  struct clcache      *clcache; /* DB client & job cache */
+  struct addrcache    *addrcache; /* client address cache */
   hg_id_t             *rpcids;  /* RPC handles */
   struct malleability_data *malldat;
 
-  int       ioset_isrunning; /* an app is running, regardless of set */
-  ABT_cond  iosetq;          /* queue for running apps, XX FIFO? */
-  ABT_mutex iosetlock;
-
-  hm_t      *iosets;         /* map of struct ioset, lock! */
-  ABT_rwlock iosets_lock;
+  struct ioset_sched *iosched; /* IO-set scheduler */
+  ABT_mutex iosetlock;       /* of the scheduler */
 
   hm_t      *ioset_time;     /*  map of elapsed IO/CPU time, lock! */
   ABT_rwlock ioset_time_lock;
-  FILE      *ioset_outfile;  /*  ioset result file */
+  struct arena *ioset_time_arena; /* memory of the timings, same lock */
+  struct iotrace *iotrace;   /* ioset result trace */
 };
 
+#define IOSET_LEASE_CHECK_MS 1000  /* longest time between two expiry checks */
+
+/* expiry of the IO-set leases */
+struct ioset_lease {
+  margo_instance_id mid;
+  struct cb_data    *data;
+  double            interval;   /* ms between two checks */
+  int               terminate;
+  ABT_thread        thread;
+};
+
+/**
+ * Start revoking the expired leases of the IO-set scheduler of DATA,
+ * of DURATION ns per slice, from a ULT in POOL. The ULT is stopped
+ * when Margo finalizes.
+ *
+ * Returns 0 if everything went fine, -1 otherwise.
+ */
+int ioset_lease_start(struct ioset_lease *lease, margo_instance_id mid, ABT_pool pool,
+                      struct cb_data *data, uint64_t duration);
+
 #endif
@@ -0,0 +1,102 @@
+#ifndef _ADMIRE_IC_CLCACHE_H
+#define _ADMIRE_IC_CLCACHE_H
+/**
+ * Server-side cache of the client and job records of the IC
+ * database. Reads are served from memory when possible. Writes go to
+ * the database first and are then applied to the cache. Changes made
+ * by other processes (other servers, Slurm plugins, etc.) are caught
+ * with Redis keyspace notifications, read on a dedicated connection
+ * and Argobots execution stream.
+ *
+ * Changes made through the cache also trigger notifications, so a
+ * record written by the server is refetched once after the
+ * notification arrives. If notifications cannot be received, every
+ * read goes to the database.
+ *
+ * The functions take the DB context to use on a miss, typically the
+ * one of the calling execution stream, and return ICDB_xx codes. In
+ * case of error, use icdb_errstr on that context.
+ *
+ * The nodelist of a client is cached with it, but not in the lists of
+ * clients: the nodelist of the clients returned by clcache_getclients
+ * is always NULL.
+ */
+
+#include <stdint.h>
+#include <margo.h>
+
+#include "icdb.h"
+
+struct clcache;
+
+struct clcache_stats {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t invalidations;       /* entries invalidated */
+};
+
+/**
+ * Initialize a cache of the database at DBADDR, and start listening
+ * to its notifications.
+ *
+ * Returns 0 if everything went fine, -1 otherwise.
+ */
+int clcache_init(struct clcache **cache, margo_instance_id mid, char *dbaddr);
+
+/**
+ * Stop listening and free CACHE.
+ */
+void clcache_fini(struct clcache **cache);
+
+/**
+ * Get the hit/miss counters of CACHE into STATS.
+ */
+void clcache_stats(struct clcache *cache, struct clcache_stats *stats);
+
+/**
+ * Cached icdb_getclient. The nodelist of CLIENT is a copy owned by the
+ * caller, to be freed with free(), whatever reads follow.
+ */
+int clcache_getclient(struct clcache *cache, struct icdb_context *icdb,
+                      const char *clid, struct icdb_client *client);
+
+/**
+ * Cached icdb_getjob. The job must be freed with icdb_job_free.
+ */
+int clcache_getjob(struct clcache *cache, struct icdb_context *icdb,
+                   uint32_t jobid, struct icdb_job *job);
+
+/**
+ * Get the clients matching JOBID and TYPE, with 0 and NULL or ""
+ * respectively meaning any, into the array *CLIENTS of *SIZE
+ * elements. The array is grown as needed, so that it can be reused
+ * across calls, and must be freed by the caller. COUNT is set to the
+ * number of clients found.
+ */
+int clcache_getclients(struct clcache *cache, struct icdb_context *icdb,
+                       uint32_t jobid, const char *type,
+                       struct icdb_client **clients, size_t *size,
+                       size_t *count);
+
+/**
+ * Write-through icdb_setclient.
+ */
+int clcache_setclient(struct clcache *cache, struct icdb_context *icdb,
+                      const char *clid, const char *type, const char *addr,
+                      const char *nodelist, uint16_t provid, uint32_t jobid,
+                      uint32_t jobncpus, const char *jobnodelist,
+                      uint64_t nprocs);
+
+/**
+ * Write-through icdb_delclient.
+ */
+int clcache_delclient(struct clcache *cache, struct icdb_context *icdb,
+                      const char *clid, uint32_t *jobid);
+
+/**
+ * Write-through icdb_deljob.
+ */
+int clcache_deljob(struct clcache *cache, struct icdb_context *icdb,
+                   uint32_t jobid);
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef ADMIRE_CRC32C_H
+#define ADMIRE_CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Update CRC, the CRC32C (Castagnoli) of the data before, with the LEN
+ * bytes of BUF. Start with a CRC of 0.
+ *
+ * Return the updated CRC.
+ */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+
+#endif
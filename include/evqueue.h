@@ -0,0 +1,126 @@
+#ifndef _ADMIRE_IC_EVQUEUE_H
+#define _ADMIRE_IC_EVQUEUE_H
+/**
+ * Bounded event queue between the RPC handlers and the malleability
+ * thread.
+ *
+ * Pushing never waits for the consumer: an event is either queued,
+ * coalesced with a pending event, or dropped if the queue is full,
+ * according to the backpressure policy of the queue. Popping blocks
+ * the calling ULT until an event is available or the queue is
+ * closed.
+ *
+ * Two pending events coalesce if they have the same code and job (and
+ * client, see enum evq_coalesce). The pending event keeps its place
+ * in the queue and takes the arguments of the newest one. Events of
+ * the same job but different clients keep the list of their clients,
+ * so that the consumer still sees every one of them.
+ *
+ * The depth of the queue is exported as the gauge ("queue", NAME),
+ * the time spent in the queue as the histogram ("queue", NAME), and
+ * the coalesced and dropped events as the gauges ("queue",
+ * NAME_coalesced) and ("queue", NAME_dropped), see icstats.h.
+ */
+
+#include <stdint.h>
+#include <margo.h>
+
+#include "rpc.h"                /* enum icc_rpc_code */
+#include "uuid_admire.h"        /* UUID_STR_LEN */
+
+#define EVQUEUE_CAPACITY_DEFAULT 1024
+
+/* what to do with a push to a full queue */
+enum evq_policy {
+  EVQ_DROP_NEWEST,              /* the pushed event is dropped */
+  EVQ_DROP_OLDEST,              /* the oldest pending event is dropped */
+};
+
+/* which pending event a pushed event may merge with */
+enum evq_coalesce {
+  EVQ_COALESCE_NONE,
+  EVQ_COALESCE_JOB,             /* same code and job, clients listed */
+  EVQ_COALESCE_CLIENT,          /* same code, job and client */
+};
+
+struct evq_event {
+  enum icc_rpc_code code;
+  uint32_t          jobid;
+  char              clid[UUID_STR_LEN];
+  int32_t           args[3];    /* depends on the code */
+  uint32_t          count;      /* number of events coalesced in this one */
+  uint64_t          queued;     /* time of the first push, in ns */
+  /* with EVQ_COALESCE_JOB, the clients of the COUNT events, in push
+     order, or NULL if COUNT is 1 */
+  char            (*clids)[UUID_STR_LEN];
+};
+
+struct evqueue;
+
+struct evqueue_stats {
+  uint64_t pushed;
+  uint64_t coalesced;
+  uint64_t dropped;
+  uint64_t popped;
+  size_t   maxdepth;
+};
+
+/**
+ * Initialize a queue of up to CAPACITY events (0 for the default)
+ * named NAME in the statistics, with backpressure policy POLICY.
+ *
+ * Returns 0 if everything went fine, -1 otherwise.
+ */
+int evqueue_init(struct evqueue **queue, margo_instance_id mid, const char *name,
+                 size_t capacity, enum evq_policy policy);
+
+/**
+ * Free QUEUE and the events still pending in it. No ULT must be
+ * waiting on it, see evqueue_close.
+ */
+void evqueue_fini(struct evqueue **queue);
+
+/**
+ * Push a copy of EV to QUEUE, coalescing it with a pending event as
+ * specified by HOW. EV's count, queued time and clients are ignored.
+ *
+ * Returns 0 if EV was queued, possibly dropping the oldest event, 1
+ * if it was coalesced, -1 if it was dropped or the queue is closed.
+ */
+int evqueue_push(struct evqueue *queue, const struct evq_event *ev,
+                 enum evq_coalesce how);
+
+/**
+ * Pop the oldest event of QUEUE into EV, waiting for one if the queue
+ * is empty. The clients of EV are released with evqueue_event_free.
+ *
+ * Returns 0, or -1 if the queue was closed.
+ */
+int evqueue_pop(struct evqueue *queue, struct evq_event *ev);
+
+/**
+ * Client I of the COUNT clients of popped event EV.
+ */
+static inline const char *
+evqueue_event_clid(const struct evq_event *ev, uint32_t i)
+{
+  return ev->clids ? ev->clids[i] : ev->clid;
+}
+
+/**
+ * Free the clients of popped event EV.
+ */
+void evqueue_event_free(struct evq_event *ev);
+
+/**
+ * Close QUEUE, waking up the ULTs waiting in evqueue_pop. Pending
+ * events are discarded and further pushes fail.
+ */
+void evqueue_close(struct evqueue *queue);
+
+/**
+ * Get the counters of QUEUE into STATS.
+ */
+void evqueue_stats(struct evqueue *queue, struct evqueue_stats *stats);
+
+#endif
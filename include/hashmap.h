@@ -11,6 +11,30 @@ typedef struct hashmap hm_t;
 hm_t *hm_create(void);
 
 
+/**
+ * Create and return a string table, a map whose keys are stored in an
+ * arena and stay at the same address until the table is freed. Items
+ * should not be deleted from a string table.
+ */
+hm_t *hm_create_strings(void);
+
+
+/**
+ * Create and return a map storing its keys in the string table
+ * STRINGS, which must outlive it. Maps sharing a table share the
+ * memory of their keys.
+ */
+hm_t *hm_create_interned(hm_t *strings);
+
+
+/**
+ * Return the copy of STR held by the string table STRINGS, adding it
+ * if needed, or NULL in case of error. Equal strings get the same
+ * pointer.
+ */
+const char *hm_intern(hm_t *strings, const char *str);
+
+
 /**
  * Free MAP.
  */
@@ -20,6 +44,11 @@ void hm_free(hm_t *map);
 /**
  * Return the value associated with NULL-terminated string KEY in MAP,
  * or NULL if not present.
+ *
+ * The pointer, like the keys and values returned by hm_next and
+ * hm_keys, stays valid until the next insertion of a new key or
+ * deletion in MAP, or until the value of KEY is replaced by one of a
+ * different size.
  */
 const void *hm_get(hm_t *map, const char *key);
 
@@ -35,6 +64,23 @@ const void *hm_get(hm_t *map, const char *key);
 int hm_set(hm_t *map, const char *key, void *value, size_t size);
 
 
+/**
+ * Remove KEY from MAP. Deleting during an iteration with hm_next may
+ * cause items to be skipped.
+ *
+ * Return 1 if an item was removed, 0 if KEY was not present.
+ */
+int hm_del(hm_t *map, const char *key);
+
+
+/**
+ * Make room in MAP for NITEMS items without further resizing.
+ *
+ * Return 0 or -1 in case of error.
+ */
+int hm_reserve(hm_t *map, size_t nitems);
+
+
 /**
  * Get KEY and, if the passed pointer is not NULL, VALUE from the next
  * item in MAP.
@@ -53,14 +99,45 @@ size_t hm_next(hm_t *map, size_t cursor, const char **key, const void **value);
  */
 size_t hm_length(hm_t *map);
 
+
+/**
+ * Store up to SIZE keys of MAP in KEYS.
+ *
+ * Return the number of elements present in MAP, which may be larger
+ * than SIZE.
+ */
+size_t hm_keys(hm_t *map, const char **keys, size_t size);
+
 /**
- * Function to serialize a hashmap to a file
+ * Snapshot error codes, HM_EIO leaves the cause in errno.
  */
-void serialize_hashmap(const struct hashmap *map, const char *filename);
+#define HM_SUCCESS   0
+#define HM_EIO      -1
+#define HM_ENOMEM   -2
+#define HM_EFORMAT  -3
+#define HM_EVERSION -4
+#define HM_ECORRUPT -5
 
 /**
- * Function to deserialize a hashmap from a file and return a pointer to it
+ * Return a string describing snapshot error ERR.
  */
-struct hashmap *deserialize_hashmap(const char *filename);
-	
+const char *hm_strerror(int err);
+
+/**
+ * Save MAP to FILENAME, atomically replacing it. The snapshot
+ * stores the table as is, with a checksum per section.
+ *
+ * Return HM_SUCCESS or an error code.
+ */
+int hm_save(hm_t *map, const char *filename);
+
+/**
+ * Load the snapshot FILENAME into a new map, returned in MAP. The file
+ * is mapped in memory and queried in place, items are only copied on
+ * the first modification of the map.
+ *
+ * Return HM_SUCCESS or an error code, MAP is then NULL.
+ */
+int hm_load(hm_t **map, const char *filename);
+
 #endif
@@ -171,6 +171,12 @@ int icc_release_nodes(struct icc_context *icc);
  * Returns when no other application in the same IO-set is running,
  * setting NSLICES to the number of slices the application is allowed
  * to write before having to ask for permission again.
+ *
+ * The permission is a lease: the IC revokes it if the application
+ * neither ends its slices nor asks again within the lease of its
+ * slices (ICC_IOSET_LEASE on the server). Asking again while holding
+ * the permission renews it. Gives up with ICC_FAILURE after
+ * ICC_IO_TIMEOUT seconds (1 hour by default) without permission.
  */
 iccret_t icc_hint_io_begin(struct icc_context *icc, unsigned long witer,
                            int isfirst, unsigned int *nslices);
@@ -184,6 +190,16 @@ iccret_t icc_hint_io_begin(struct icc_context *icc, unsigned long witer,
 iccret_t icc_hint_io_end(struct icc_context *icc, unsigned long witer, int islast, unsigned long long nbytes);
 
 
+/**
+ * Set the bandwidth the application expects from the file system,
+ * in MiB/s, sent along with the next IO hints. The IC lets
+ * applications with a known bandwidth do IO concurrently as long as
+ * the file system can take it. 0 (the default) means unknown, the
+ * application then does IO alone.
+ */
+iccret_t icc_hint_io_bandwidth(struct icc_context *icc, unsigned long bandwidth);
+
+
 /**
  * RPC TEST: Test the server by sending a number and having it logged.
  *
@@ -328,6 +344,22 @@ int icc_rpc_alert(struct icc_context *icc, enum icc_alert_type type, int *retcod
  */
 int icc_rpc_nodealert(struct icc_context *icc, enum icc_alert_type type, const char *node, int *retcode);
 
+/**
+ * Statistics
+ */
+
+/**
+ * Get the latency histograms and gauges of the controller in *TEXT,
+ * to be freed by the caller. The format is one item per line, see
+ * icstats_summary in icstats.h. If RESET is non-zero, the statistics
+ * are zeroed after being read.
+ *
+ * RETCODE is filled with the RPC return status code on completion.
+ *
+ * Return ICC_SUCCESS or an error code.
+ */
+int icc_rpc_stats(struct icc_context *icc, int reset, char **text, int *retcode);
+
 /*ALBERTO 26062023 */
 /**
  * Register NCPUS on HOST for release. The resources will be actually
@@ -367,14 +399,4 @@ int icc_rpc_malleability_query(struct icc_context *icc, int *malleability, int *
  */
 int icc_rpc_malleability_ss(struct icc_context *icc, int *retcode);
 
-/**
- * Backup relevant data from icc_context to file
-*/
-void _icc_context_backup(struct icc_context *icc, char *filename);
-
-/**
- * Load relevant data from binary file to icc_context
-*/
-void _icc_context_load(struct icc_context *icc, char *filename);
-
 #endif
@@ -0,0 +1,48 @@
+#ifndef ADMIRE_ICC_CKPT_H
+#define ADMIRE_ICC_CKPT_H
+/**
+ * Checkpoint of the client context of a stop/restart application.
+ *
+ * Only the state that survives a restart is saved: client and job
+ * identifiers, type, registration and reconfiguration status,
+ * nodelists and the host maps. Margo and database handles are
+ * re-created from scratch by the restarted process.
+ *
+ * Checkpoints are kept in the directory ICC_CKPT_DIR (default /tmp)
+ * under icc-ckpt.<jobid>, one file per generation, ckpt.<gen>. A new
+ * generation is written to a temporary file, synced and renamed, so a
+ * crash never leaves a torn checkpoint behind. The last
+ * ICC_CKPT_GENERATIONS generations are kept, and loading falls back to
+ * an older one if the newest does not validate.
+ *
+ * The file is a magic string and a version, followed by tagged
+ * records of little-endian fields. Unknown tags are skipped. The last
+ * record holds the CRC32C of the rest of the file.
+ */
+
+#include "icc_priv.h"
+
+#define ICC_CKPT_ENV         "ICC_CKPT_DIR"
+#define ICC_CKPT_DIR_DEFAULT "/tmp"
+#define ICC_CKPT_GENERATIONS 3
+
+/**
+ * Write a new checkpoint generation of ICC, using the job ID of ICC
+ * to locate the directory.
+ *
+ * Return ICC_SUCCESS or an error code.
+ */
+int icc_ckpt_save(struct icc_context *icc);
+
+/**
+ * Restore ICC from the newest valid checkpoint of job JOBID. The
+ * saved identifiers, including the job ID, replace those of ICC and
+ * the host maps are replaced by maps interned in icc->hostnames,
+ * created if needed.
+ *
+ * Return ICC_SUCCESS or an error code, ICC_FAILURE if no valid
+ * checkpoint was found.
+ */
+int icc_ckpt_load(struct icc_context *icc, uint32_t jobid);
+
+#endif
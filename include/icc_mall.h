@@ -0,0 +1,142 @@
+#ifndef _ADMIRE_ICC_MALL_H
+#define _ADMIRE_ICC_MALL_H
+/**
+ * Malleability policy interface.
+ *
+ * The IC server hands the events relevant to malleability to a
+ * policy, and asks it for a decision when one of its hooks requests
+ * it. The policy then gets a read-only snapshot of the clients
+ * concerned and returns a set of actions, which the server carries
+ * out.
+ *
+ * A policy is a shared library exporting a `const struct
+ * icc_mall_policy` named ICC_MALL_POLICY_SYMBOL. The server loads it
+ * by name from the environment variable ICC_MALL_POLICY_ENV: "name"
+ * loads libicc_mall_name.so from the library search path, a name
+ * containing a '/' is used as the path of the library. Without it,
+ * the built-in "default" policy is used.
+ *
+ * Hooks and decide are never called concurrently, but not always
+ * from the same thread. Hooks may be NULL. Pointers passed to the
+ * policy are only valid for the duration of the call.
+ *
+ * Registrations (or deregistrations) of a job that were pending
+ * together are passed to the hook one by one, then decide is called
+ * once if any of them returned ICC_MALL_DECIDE.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ICC_MALL_POLICY_VERSION 1
+#define ICC_MALL_POLICY_SYMBOL  "icc_mall_policy"
+#define ICC_MALL_POLICY_ENV     "ICC_MALL_POLICY"
+#define ICC_MALL_POLICY_DEFAULT "default"
+
+#define ICC_MALL_CLID_LEN 37    /* UUID string, with the terminating NUL */
+
+/* return values of the hooks */
+#define ICC_MALL_PASS   0       /* nothing to decide */
+#define ICC_MALL_DECIDE 1       /* call decide */
+
+struct icc_mall_client {
+  const char *clid;
+  const char *type;             /* "mpi", "flexmpi", etc. */
+  const char *addr;
+  const char *nodelist;
+  uint32_t    jobid;
+  uint32_t    nnodes;           /* nodes of the job at registration */
+  uint64_t    nprocs;
+  int32_t     reconfig_nprocs;  /* last hints of the client */
+  int32_t     reconfig_nnodes;
+};
+
+/* a client entering or leaving a malleability region */
+struct icc_mall_region {
+  const char *clid;
+  uint32_t    jobid;
+  int         enter;            /* 0 when leaving */
+  int32_t     nprocs;           /* hint, negative to shrink, 0 if none */
+  int32_t     nnodes;           /* hint, 0 if none */
+};
+
+/* monitoring data of a client, sent before it enters a region */
+struct icc_mall_metric {
+  const char *clid;
+  uint32_t    jobid;
+  int         nprocs;
+  double      ratio_cpu;
+  double      ratio_mem;
+  double      rtime;            /* iteration times, in s */
+  double      ptime;
+  double      ctime;
+};
+
+/* message of an external status stream */
+struct icc_mall_stream_event {
+  const char *stream;           /* e.g "beegfs" */
+  uint64_t    timestamp;
+  uint32_t    qlen;             /* request queue length */
+};
+
+/* what the decision is about */
+struct icc_mall_snapshot {
+  uint32_t                      jobid;    /* 0 for the whole cluster */
+  const struct icc_mall_client *clients;  /* of the job, or all of them */
+  size_t                        nclients;
+};
+
+enum icc_mall_action_type {
+  ICC_MALL_EXPAND,              /* give NCPUS more to the MPI clients of JOBID */
+  ICC_MALL_SHRINK,              /* take NCPUS away from them */
+  ICC_MALL_SHRINK_NODES,        /* release half of the nodes of client CLID */
+};
+
+struct icc_mall_action {
+  enum icc_mall_action_type type;
+  uint32_t                  jobid;
+  char                      clid[ICC_MALL_CLID_LEN];
+  uint32_t                  ncpus;
+  uint32_t                  nnodes;   /* exclusive nodes hint, 0 if none */
+};
+
+/**
+ * Services of the server available to policies. Functions return 0 or
+ * -1 in case of error.
+ */
+struct icc_mall_services {
+  void *ctx;                    /* first argument of the functions */
+
+  /* add an iteration sample of CLID to a window of the last WINDOW
+     samples kept by the server, and get the window averages */
+  int (*monitor_sample)(void *ctx, const char *clid, double rtime, double ctime,
+                        uint32_t window, double *avg_rtime, double *avg_ctime,
+                        uint32_t *nsamples);
+  /* forget the samples of CLID */
+  int (*monitor_reset)(void *ctx, const char *clid);
+};
+
+struct icc_mall_policy {
+  unsigned    version;          /* ICC_MALL_POLICY_VERSION */
+  const char *name;
+
+  /* set up the private state of the policy, passed to the other
+     functions. Return 0 or -1 in case of error */
+  int    (*init)(const struct icc_mall_services *srv, void **state);
+  void   (*fini)(void *state);
+
+  /* return ICC_MALL_DECIDE or ICC_MALL_PASS */
+  int    (*on_register)(void *state, const struct icc_mall_client *client);
+  int    (*on_deregister)(void *state, const char *clid, uint32_t jobid);
+  int    (*on_region)(void *state, const struct icc_mall_region *region);
+  int    (*on_metric)(void *state, const struct icc_mall_metric *metric);
+  int    (*on_stream_event)(void *state, const struct icc_mall_stream_event *ev);
+
+  /* fill up to MAXACTIONS ACTIONS, return their number. SNAP is
+     about the job of the event that requested the decision, or the
+     cluster for stream events. Mandatory */
+  size_t (*decide)(void *state, const struct icc_mall_snapshot *snap,
+                   struct icc_mall_action *actions, size_t maxactions);
+};
+
+#endif
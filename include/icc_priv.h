@@ -9,8 +9,21 @@
 #include "icc.h"
 #include "rpc.h"
 #include "icrm.h"
+#include "icrmq.h"
 #include "flexmpi.h"           /* flexmpi function signature */
 
+/* DB connections of a client: one for the main functions, one for
+   the callbacks */
+#define ICC_DB_POOLSIZE   2
+#define ICC_DB_TIMEOUT_MS 5000
+
+/* RM worker ULTs, and as many execution streams */
+#define ICC_ICRM_NWORKERS 2
+
+/* longest wait for the permission to do IO, in s */
+#define ICC_IO_TIMEOUT_ENV     "ICC_IO_TIMEOUT"
+#define ICC_IO_TIMEOUT_DEFAULT 3600
+
 struct icc_context {
   /* read-only after initialization */
   margo_instance_id mid;
@@ -23,10 +36,11 @@ struct icc_context {
   uint32_t          jobstepid;          /* resource manager jobstep id */
   char              clid[UUID_STR_LEN]; /* client uuid */
   // CHANGE: JAVI
-  struct icdb_context *icdbs_main;      /* connection to DB for main icc functions*/
-  struct icdb_context *icdbs_cb;        /* connection to DB for client callbacks */
+  struct icdb_pool  *icdb_pool;         /* connections to DB, opened on use */
   // END CHANGE: JAVI
   enum icc_client_type type;            /* client type */
+  uint32_t          io_bandwidth;       /* expected IO bandwidth, MiB/s */
+  double            io_timeout_ms;      /* of icc_hint_io_begin */
 
   /* can be modified on reconfiguration order, need lock */
 
@@ -42,6 +56,7 @@ struct icc_context {
    * want to do.
    */
   ABT_rwlock hostlock;
+  hm_t       *hostnames;                /* host names shared by the maps */
   hm_t       *hostalloc;                /* map of host:ncpus allocated */
   hm_t       *hostrelease;              /* map of host:ncpus released */
   hm_t       *hostjob;                  /* map of host:jobid */
@@ -54,10 +69,10 @@ struct icc_context {
   ABT_rwlock lowmemlock;
   bool       lowmem;
 
-  /* XX fixme icrm not thread-safe */
   char              icrm_terminate;     /* terminate flag */
   ABT_pool          icrm_pool;          /* pool for blocking RM requests */
-  ABT_xstream       icrm_xstream;       /* exec stream associated to the pool */
+  ABT_xstream       icrm_xstreams[ICC_ICRM_NWORKERS]; /* exec streams of the pool */
+  struct icrmq      *icrmq;             /* RM worker, owns the RM calls */
 
   icc_reconfigure_func_t reconfig_func;
   void                   *reconfig_data;
@@ -16,15 +16,26 @@
 
 #define ICDB_ERRSTR_LEN 256
 
+#define ICDB_PORT 6379          /* default DB port */
+
+#define ICDB_ADDR_ENV     "ICC_DB_ADDR"  /* DB address of the server */
+#define ICDB_ADDR_DEFAULT "127.0.0.1"
+
 
 struct icdb_context;
 
 
 /**
- * Initialize connection the IC database.
- * Returns ICDB_SUCCESS or an error code.
+ * Initialize connection the IC database at IP_ADDR, of the form
+ * host[:port], or [host][:port] for an IPv6 address, the port
+ * defaulting to ICDB_PORT. A bare IPv6 address is taken whole.
+ * Returns ICDB_SUCCESS or an error code. Once allocated, the context
+ * is returned even in case of error, so that icdb_errstr can be
+ * called. It must then be freed with icdb_fini.
  *
- * Warning: An icdb context is NOT thread-safe.
+ * Calls on a context are serialized by a lock owned by the context,
+ * so it can be shared by the ULTs of an execution stream. Use one
+ * context per execution stream to get concurrent DB accesses.
  */
 int icdb_init(struct icdb_context **icdb, char *ip_addr);
 
@@ -33,6 +44,67 @@ int icdb_init(struct icdb_context **icdb, char *ip_addr);
  */
 void icdb_fini(struct icdb_context **icdb);
 
+/**
+ * Fail commands on ICDB that take longer than TIMEOUT_MS milliseconds,
+ * 0 meaning no timeout, the default. The connection is then
+ * reestablished on the next call.
+ *
+ * A broken connection is reestablished on the next call, no sooner
+ * than an exponentially growing delay after the previous attempt.
+ *
+ * Returns ICDB_SUCCESS or an error code.
+ */
+int icdb_set_timeout(struct icdb_context *icdb, int timeout_ms);
+
+/**
+ * Pool of connections to the IC database.
+ */
+struct icdb_pool;
+
+struct icdb_pool_stats {
+  uint64_t gets;                /* connections handed out */
+  uint64_t waits;               /* gets that waited for a connection */
+  uint64_t wait_ms;             /* total waiting time */
+  uint64_t reconnects;          /* reconnections of pooled contexts */
+  uint64_t check_failures;      /* failed health checks */
+  size_t   nopen;               /* connections opened */
+  size_t   nbusy;               /* connections in use */
+};
+
+/**
+ * Initialize a pool of at most SIZE connections to the IC database at
+ * IP_ADDR (see icdb_init), with a command timeout of TIMEOUT_MS (see
+ * icdb_set_timeout). Connections are opened on first use.
+ *
+ * Returns ICDB_SUCCESS or an error code.
+ */
+int icdb_pool_init(struct icdb_pool **pool, char *ip_addr, size_t size,
+                   int timeout_ms);
+
+/**
+ * Free POOL and its connections, which must all have been put back.
+ */
+void icdb_pool_fini(struct icdb_pool **pool);
+
+/**
+ * Get a connection from POOL, waiting for one to be put back if they
+ * are all in use. Connections idle for a while are checked first.
+ *
+ * Returns the connection, which may be in error (see icdb_errstr),
+ * or NULL if it could not be allocated.
+ */
+struct icdb_context *icdb_pool_get(struct icdb_pool *pool);
+
+/**
+ * Give ICDB back to POOL.
+ */
+void icdb_pool_put(struct icdb_pool *pool, struct icdb_context *icdb);
+
+/**
+ * Get the usage statistics of POOL into STATS.
+ */
+void icdb_pool_stats(struct icdb_pool *pool, struct icdb_pool_stats *stats);
+
 /**
  * In case of error, return an error string suitable for display.
  * The string will be overwritten in case of further errors, so it
@@ -48,18 +120,21 @@ int icdb_command(struct icdb_context *icdb, const char *format, ...);
 
 /**
  * IC client
- * XX fixme: get rid of NFIELDS
+ *
+ * The nodelist has no size limit and is stored in memory owned by the
+ * DB context the client was read with. It stays valid until the next
+ * call reading clients on that context, and must be copied to be kept
+ * longer. As the context may be shared, clcache_getclient, which
+ * returns a copy, is to be preferred.
  */
-#define ICDB_NODELIST_LEN   512
-#define ICDB_CLIENT_NFIELDS 9
-
 struct icdb_client {
   char clid[UUID_STR_LEN];
   char type[ICC_TYPE_LEN];
   char addr[ICC_ADDR_LEN];
-  char nodelist[ICDB_NODELIST_LEN];
+  char *nodelist;
   uint16_t provid;
   uint32_t jobid;
+  uint32_t nnodes;              /* nodes of the job at registration */
   uint64_t nprocs;              /* nprocesses in client */
   int32_t reconfig_nprocs;  /* procs requested by client for malleab. */
   int32_t reconfig_nnodes;
@@ -73,9 +148,10 @@ icdb_initclient(struct icdb_client *client) {
   client->clid[0] = '\0';
   client->type[0] = '\0';
   client->addr[0] = '\0';
-  client->nodelist[0] = '\0';
+  client->nodelist = NULL;
   client->provid = 0;
   client->jobid = 0;
+  client->nnodes = 0;
   client->nprocs = 0;
 }
 
@@ -111,6 +187,45 @@ int icdb_delnodes(struct icdb_context *icdb, const char *clid, const char *nodel
  ** Returns ICDB_SUCCESS or an error code in case of error.
  */
 int icdb_getMonitor(struct icdb_context *icdb, const char *clid, double *rate_cpu, double *rate_mem, int *num_proc, double *rtime, double *ptime, double *ctime);
+
+/**
+ * Store VALUE as the current FlexMPI iteration data of client CLID
+ * under KEY, and index it for icdb_getMonitor. Monitors can also call
+ * "FCALL icdb_monitor_set 0 CLID KEY VALUE" directly. Keys not stored
+ * this way are still found, with a slower keyspace scan.
+ *
+ ** Returns ICDB_SUCCESS or an error code in case of error.
+ */
+int icdb_setmonitor(struct icdb_context *icdb, const char *clid,
+                    const char *key, const char *value);
+
+/**
+ * Rolling average of the iteration times of a client.
+ */
+struct icdb_monitor_avg {
+  uint32_t nsamples;            /* samples in the window */
+  double   rtime;
+  double   ctime;
+};
+
+/**
+ * Add the RTIME and CTIME iteration sample of client CLID to a window
+ * of the last WINDOW samples kept in the database, and return the
+ * window averages in AVG.
+ *
+ ** Returns ICDB_SUCCESS or an error code in case of error.
+ */
+int icdb_monitor_sample(struct icdb_context *icdb, const char *clid,
+                        double rtime, double ctime, uint32_t window,
+                        struct icdb_monitor_avg *avg);
+
+/**
+ * Empty the sample window of client CLID.
+ *
+ ** Returns ICDB_SUCCESS or an error code in case of error.
+ */
+int icdb_monitor_reset(struct icdb_context *icdb, const char *clid);
+
 /**
  * Add an IC client identified by CLID to the database.
  */
@@ -147,20 +262,57 @@ int icdb_getclients(struct icdb_context *icdb, uint32_t jobid,
                     struct icdb_client clients[], size_t *count);
 
 /**
- * Get clients matching jobid and type, with 0 and "" respectively meaning any
- * XX intersection not implemented
- * return results in clients, the caller is responsible for freeing it.
+ * Get clients matching JOBID and TYPE, with 0 and "" respectively meaning any.
+ * Return results in CLIENTS, the caller is responsible for freeing it.
  * Cursor based, start call with 0, iteration is finished when cursor is 0 again.
  * Note: we rely on redis returning a "reasonable" number of clients at each
  * call.
  *
  * Similar to icdb_getclients but cursor based.
  */
-
 int
 icdb_getclients2(struct icdb_context *icdb, uint32_t jobid, const char *type,
    struct icdb_client *clients[], size_t *count, uint64_t *cursor);
 
+/**
+ * Sort the NCLIENTS CLIENTS of job JOBID by the position of their
+ * first node in the nodelist of the job, so that clients on
+ * neighbouring nodes end up next to each other. Clients with no known
+ * node go last, in the same order.
+ *
+ * Returns ICDB_SUCCESS or an error code in case of error.
+ */
+int icdb_sort_clients(struct icdb_context *icdb, uint32_t jobid,
+                      struct icdb_client *clients, size_t nclients);
+
+/**
+ * Client filter, a JOBID of 0 or a NULL or empty TYPE mean any.
+ */
+struct icdb_client_filter {
+  uint32_t   jobid;
+  const char *type;
+};
+
+/**
+ * Client iteration callback. Returning non-zero stops the iteration.
+ */
+typedef int (*icdb_client_cb)(const struct icdb_client *client, void *arg);
+
+/**
+ * Call CB on every client matching FILTER (NULL for all clients).
+ * Clients are fetched BATCH_SIZE at a time (0 for a default size),
+ * in one round trip per batch. CB is called without the context
+ * lock held, so it may issue other queries on ICDB.
+ *
+ * Clients added or deleted during the iteration may or may not be
+ * seen.
+ *
+ * Returns ICDB_SUCCESS or an error code.
+ */
+int icdb_iter_clients(struct icdb_context *icdb,
+                      const struct icdb_client_filter *filter,
+                      size_t batch_size, icdb_client_cb cb, void *arg);
+
 /**
  * Delete IC client CLID.
  *
@@ -232,21 +384,110 @@ int icdb_deljob(struct icdb_context *icdb, uint32_t jobid);
 int icdb_getlargestjob(struct icdb_context *icdb, uint32_t *jobid);
 
 
+/*
+ * Message streams
+ */
+#define ICDB_MSTREAM_ID_LEN 48
+
+/**
+ * A stream entry: ID and NFIELDS key/value pairs. The pointers are
+ * only valid for the duration of the callback they are passed to.
+ */
+struct icdb_mstream_msg {
+  const char  *id;
+  size_t       nfields;
+  const char **keys;
+  const char **vals;
+};
+
+typedef void (*icdb_mstream_cb)(const struct icdb_mstream_msg *msg, void *arg);
+
+/**
+ * Create consumer group GROUP on stream STREAMKEY, creating the
+ * stream if needed. An already existing group is not an error.
+ *
+ * Returns ICDB_SUCCESS or an error code.
+ */
+int icdb_mstream_group(struct icdb_context *icdb, const char *streamkey,
+                       const char *group);
+
+/**
+ * Block for at most TIMEOUT_MS milliseconds (0 means forever) waiting
+ * for new entries on STREAMKEY, and call CB on each of them in order.
+ *
+ * Without GROUP, the entries after LASTID are read ("$" for the
+ * entries arriving after the call). With GROUP, the entries not yet
+ * delivered to the group are read on behalf of CONSUMER, and they
+ * must be acknowledged with icdb_mstream_ack. In both cases, LASTID
+ * (of size ICDB_MSTREAM_ID_LEN) is updated with the last ID read.
+ *
+ * The context lock is held while blocking, so the context should be
+ * dedicated to the stream.
+ *
+ * Returns ICDB_SUCCESS, ICDB_NORESULT if the timeout expired or an
+ * error code.
+ */
+int icdb_mstream_consume(struct icdb_context *icdb, const char *streamkey,
+                         const char *group, const char *consumer,
+                         char *lastid, int timeout_ms,
+                         icdb_mstream_cb cb, void *arg);
+
 /**
- * Get message from stream STREAMKEY
+ * Acknowledge entry ID of STREAMKEY for consumer group GROUP.
  *
  * Returns ICDB_SUCCESS or an error code.
  */
-int icdb_mstream_read(struct icdb_context *icdb, char *streamkey);
+int icdb_mstream_ack(struct icdb_context *icdb, const char *streamkey,
+                     const char *group, const char *id);
 
 /*
- * Message streams
+ * Keyspace notifications
+ */
+typedef void (*icdb_keyspace_cb)(const char *key, const char *event, void *arg);
+
+/**
+ * Enable the keyspace notifications of the event classes EVENTS (see
+ * the notify-keyspace-events Redis setting) and subscribe to those of
+ * the keys matching the NPATTERNS PATTERNS, as well as to channel
+ * WAKECHAN. The context can then only be used with icdb_keyspace_wait.
+ *
+ * Returns ICDB_SUCCESS or an error code.
+ */
+int icdb_keyspace_subscribe(struct icdb_context *icdb, const char *events,
+                            const char *const patterns[], size_t npatterns,
+                            const char *wakechan);
+
+/**
+ * Block until the next message of a subscribed context. Call CB with
+ * the key and the event if it is a keyspace notification.
+ *
+ * Returns ICDB_SUCCESS, ICDB_NORESULT if the message was published on
+ * the wake-up channel or an error code, in which case the context
+ * must be discarded.
+ */
+int icdb_keyspace_wait(struct icdb_context *icdb, icdb_keyspace_cb cb, void *arg);
+
+/**
+ * Publish MESSAGE on CHANNEL.
+ *
+ * Returns ICDB_SUCCESS or an error code.
  */
+int icdb_publish(struct icdb_context *icdb, const char *channel, const char *message);
+
+
+/* Beegfs status message stream */
+#define ICDB_MSTREAM_BEEGFS "admire:beegfs:status"
+
 struct icdb_beegfs {
   uint64_t  timestamp;
   uint32_t qlen;
 };
 
-int icdb_mstream_beegfs(struct icdb_context *icdb, struct icdb_beegfs *result);
+/**
+ * Decode a message of the Beegfs status stream into RESULT.
+ *
+ * Returns ICDB_SUCCESS or ICDB_EBADRESP if a field is malformed.
+ */
+int icdb_mstream_beegfs(const struct icdb_mstream_msg *msg, struct icdb_beegfs *result);
 
 #endif
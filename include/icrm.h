@@ -100,6 +100,20 @@ icrmerr_t icrm_merge(uint32_t jobid, char errstr[ICC_ERRSTR_LEN]);
 icrmerr_t icrm_release_node(const char *nodename, uint32_t jobid, uint32_t ncpus,
                             char errstr[ICC_ERRSTR_LEN]);
 
+/**
+ * Release the N nodes NODENAMES of job JOBID to the resource manager
+ * with a single job update, after checking that JOBID indeed used
+ * NCPUS[i] from NODENAMES[i]. The outcome for each node is set in
+ * NODERETS, ICRM_EAGAIN and ICRM_FAILURE as icrm_release_node, the
+ * other nodes are still released.
+ *
+ * Return ICRM_SUCCESS or an error code of the whole request, in which
+ * case NODERETS is not meaningful.
+ */
+icrmerr_t icrm_release_nodes(uint32_t jobid, size_t n, const char *nodenames[],
+                             const uint32_t ncpus[], icrmerr_t noderets[],
+                             char errstr[ICC_ERRSTR_LEN]);
+
 // CHANGE:  JAVI
 /**
  * Get Hostmap from a currently running Slurm job using its JOBID.
@@ -0,0 +1,82 @@
+#ifndef ADMIRE_ICRMQ_H
+#define ADMIRE_ICRMQ_H
+
+#include <stdint.h>
+#include <abt.h>
+
+#include "hashmap.h"
+#include "icc_common.h"         /* ICC_ERRSTR_LEN */
+#include "icrm.h"
+
+/**
+ * Resource manager worker. The requests to the resource manager are
+ * queued and served by a fixed number of ULTs, so that no caller
+ * waits on the resource manager while holding a lock: submitting
+ * never blocks, and the outcome is delivered through an Argobots
+ * eventual, to be collected with icrmq_wait.
+ *
+ * Releases of nodes of the same job that are queued together are
+ * coalesced into a single job update.
+ *
+ * The cancellation of a pending allocation
+ * (icrm_kill_wait_pending_job) must not wait behind the allocation,
+ * it keeps calling the resource manager directly.
+ */
+
+#define ICRMQ_LEN      256      /* requests pending at most */
+#define ICRMQ_COALESCE 64       /* releases merged at most */
+
+struct icrmq;
+
+/* outcome of a request, the value of its eventual */
+struct icrmq_result {
+  icrmerr_t rc;
+  char      errstr[ICC_ERRSTR_LEN];
+  /* allocation */
+  uint32_t  jobid;              /* of the new job */
+  uint32_t  ncpus;              /* actually granted */
+  uint32_t  nnodes;
+  hm_t      *hostmap;           /* host:ncpus, freed by the caller */
+};
+
+/**
+ * Start NWORKERS ULTs serving the requests in POOL. At most NWORKERS
+ * calls to the resource manager are in progress at a time, provided
+ * the pool has as many execution streams.
+ *
+ * Return ICRM_SUCCESS or an error code.
+ */
+icrmerr_t icrmq_init(struct icrmq **queue, ABT_pool pool, unsigned nworkers);
+
+/**
+ * Serve the pending requests, then stop the workers and free QUEUE.
+ */
+void icrmq_fini(struct icrmq **queue);
+
+/**
+ * Request a new allocation of NCPUS on NNODES, as icrm_alloc.
+ *
+ * Return ICRM_SUCCESS with the eventual of the request in EV,
+ * ICRM_EAGAIN if the queue is full, or another error code.
+ */
+icrmerr_t icrmq_submit_alloc(struct icrmq *queue, uint32_t ncpus, uint32_t nnodes,
+                             ABT_eventual *ev);
+
+/**
+ * Request the release of node NODENAME of job JOBID, as
+ * icrm_release_node.
+ *
+ * Return as icrmq_submit_alloc.
+ */
+icrmerr_t icrmq_submit_release(struct icrmq *queue, const char *nodename, uint32_t jobid,
+                               uint32_t ncpus, ABT_eventual *ev);
+
+/**
+ * Wait for the request of eventual EV to complete, copy its outcome
+ * to RESULT and free EV.
+ *
+ * Return the outcome of the request.
+ */
+icrmerr_t icrmq_wait(ABT_eventual *ev, struct icrmq_result *result);
+
+#endif
@@ -0,0 +1,170 @@
+#ifndef _ADMIRE_IC_ICSTATS_H
+#define _ADMIRE_IC_ICSTATS_H
+/**
+ * Latency histograms and gauges.
+ *
+ * Histograms and gauges are identified by a family (e.g "rpc",
+ * "icdb") and a name within the family. They are created on first use
+ * and live until the process exits. Recording is lock-free: a
+ * histogram is a set of log-linear buckets (16 per power of two, so
+ * within about 6%) updated with relaxed atomic increments.
+ *
+ * Values are durations in nanoseconds, clamped to 2^40 ns (about 18
+ * minutes).
+ *
+ * The ICSTATS_HIST and ICSTATS_GAUGE macros cache the lookup in a
+ * static variable, their family and name must be constant at the call
+ * site. ICSTATS_SCOPE times the rest of the enclosing block. A goto
+ * must not jump over it into its block.
+ */
+
+#include <stdint.h>
+#include <stdio.h>              /* FILE */
+#include <time.h>               /* clock_gettime */
+
+#define ICSTATS_SUB_BITS 4
+#define ICSTATS_SUB      (1 << ICSTATS_SUB_BITS)
+#define ICSTATS_MAX_BITS 40
+#define ICSTATS_NBUCKETS (ICSTATS_SUB + (ICSTATS_MAX_BITS - ICSTATS_SUB_BITS) * ICSTATS_SUB)
+
+/* environment of the exporter, see icstats_export_start */
+#define ICSTATS_FILE_ENV     "ICC_STATS_FILE"
+#define ICSTATS_SOCKET_ENV   "ICC_STATS_SOCKET"
+#define ICSTATS_INTERVAL_ENV "ICC_STATS_INTERVAL"
+#define ICSTATS_INTERVAL_DEFAULT 10   /* seconds */
+
+struct icstats_hist {
+  const char *family;
+  const char *name;
+  uint64_t    count;
+  uint64_t    sum;
+  uint64_t    max;
+  uint64_t    buckets[ICSTATS_NBUCKETS];
+};
+
+struct icstats_gauge {
+  const char *family;
+  const char *name;
+  int64_t     value;
+  int64_t     max;
+};
+
+struct icstats_scope {
+  struct icstats_hist *hist;
+  uint64_t             start;
+};
+
+/**
+ * Return the histogram NAME of FAMILY, created if needed, or NULL in
+ * case of error. Recording to a NULL histogram does nothing.
+ */
+struct icstats_hist *icstats_hist(const char *family, const char *name);
+
+/**
+ * Return the gauge NAME of FAMILY, created if needed, or NULL in
+ * case of error.
+ */
+struct icstats_gauge *icstats_gauge(const char *family, const char *name);
+
+/**
+ * Add the duration NS to HIST.
+ */
+void icstats_record(struct icstats_hist *hist, uint64_t ns);
+
+/**
+ * Add DELTA to GAUGE, keeping track of its maximum.
+ */
+void icstats_gauge_add(struct icstats_gauge *gauge, int64_t delta);
+
+/**
+ * Return an estimate of the Q quantile (0 to 1) of HIST, in ns.
+ */
+uint64_t icstats_quantile(const struct icstats_hist *hist, double q);
+
+/**
+ * Zero all the histograms and the gauge maxima. Records made
+ * concurrently may be lost.
+ */
+void icstats_reset(void);
+
+/**
+ * Put a summary of all histograms and gauges in *TEXT, to be freed by
+ * the caller. One line per item, fields separated by a space:
+ *
+ *   hist <family> <name> <count> <sum> <max> <p50> <p90> <p99> <p999>
+ *   gauge <family> <name> <value> <max>
+ *
+ * Durations are in ns. Returns 0 or -1 in case of error.
+ */
+int icstats_summary(char **text);
+
+/**
+ * Write all histograms and gauges to F in the Prometheus text
+ * format. Histograms are exported as icc_<family>_seconds{name=...}
+ * with a bucket per power of two, gauges as icc_<family>{name=...}
+ * and icc_<family>_max{name=...}.
+ *
+ * Returns 0 or -1 in case of error.
+ */
+int icstats_prometheus(FILE *f);
+
+/**
+ * Start a thread exporting the statistics in the Prometheus format to
+ * FILE every INTERVAL seconds, replacing it atomically, and to each
+ * connection on the Unix socket SOCKPATH. Either can be NULL.
+ *
+ * Returns 0 or -1 in case of error.
+ */
+int icstats_export_start(const char *file, const char *sockpath, unsigned interval);
+
+/**
+ * Stop the exporter thread, if any.
+ */
+void icstats_export_stop(void);
+
+
+/**
+ * Monotonic time in ns.
+ */
+static inline uint64_t
+icstats_now(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t)t.tv_sec * 1000000000 + (uint64_t)t.tv_nsec;
+}
+
+static inline void
+icstats_scope_end(struct icstats_scope *scope)
+{
+  icstats_record(scope->hist, icstats_now() - scope->start);
+}
+
+#define ICSTATS_HIST(family, name)                                      \
+  ({                                                                    \
+    static struct icstats_hist *_icstats_h;                             \
+    struct icstats_hist *_h = __atomic_load_n(&_icstats_h, __ATOMIC_ACQUIRE); \
+    if (!_h) {                                                          \
+      _h = icstats_hist(family, name);                                  \
+      __atomic_store_n(&_icstats_h, _h, __ATOMIC_RELEASE);              \
+    }                                                                   \
+    _h;                                                                 \
+  })
+
+#define ICSTATS_GAUGE(family, name)                                     \
+  ({                                                                    \
+    static struct icstats_gauge *_icstats_g;                            \
+    struct icstats_gauge *_g = __atomic_load_n(&_icstats_g, __ATOMIC_ACQUIRE); \
+    if (!_g) {                                                          \
+      _g = icstats_gauge(family, name);                                 \
+      __atomic_store_n(&_icstats_g, _g, __ATOMIC_RELEASE);              \
+    }                                                                   \
+    _g;                                                                 \
+  })
+
+#define ICSTATS_SCOPE(family, name)                                     \
+  struct icstats_scope _icstats_scope                                   \
+  __attribute__((cleanup(icstats_scope_end))) =                         \
+    { ICSTATS_HIST(family, name), icstats_now() }
+
+#endif
@@ -0,0 +1,150 @@
+#ifndef _ADMIRE_IC_IOSET_H
+#define _ADMIRE_IC_IOSET_H
+/**
+ * IO-sets: applications with the same characteristic time between IO
+ * phases (WITER) belong to the same set. Only one application of a
+ * set does IO at a time, and the sets share the IO bandwidth in
+ * proportion to their priority, the inverse of WITER rounded to a
+ * power of ten.
+ *
+ * The scheduler admits the applications holding their set to the
+ * file system in arrival order, as long as the sum of their expected
+ * bandwidths stays within a budget. An application without a
+ * bandwidth, or a scheduler without a budget, runs alone. An admitted
+ * application gets a number of IO slices proportional to the priority
+ * of its set, the lowest priority among the held sets getting one.
+ *
+ * With a lease, an application holding its set must come back before
+ * its deadline: the lease of a grant is one lease per slice (up to
+ * 16), renewed by asking again, and an application between two slices
+ * has one lease to ask for the next. Otherwise ioset_expire revokes it as if
+ * it had ended its IO phase. Time spent waiting for admission does
+ * not count.
+ *
+ * The scheduler does no locking and never blocks: a request that
+ * cannot be granted is queued, and handed back to the caller by the
+ * call to ioset_end or ioset_expire that grants it. Times are in ns
+ * on any monotonic clock.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>               /* struct timespec */
+
+/* aggregate bandwidth of the admitted apps, in MiB/s */
+#define IOSET_BUDGET_ENV "ICC_IOSET_BUDGET"
+/* lease of an IO slice, in s, 0 for none */
+#define IOSET_LEASE_ENV "ICC_IOSET_LEASE"
+#define IOSET_LEASE_DEFAULT 300
+
+#define IOSETID_LEN 256
+#define APPID_LEN 256
+
+struct ioset;
+struct ioset_sched;
+
+struct ioset_time {
+  struct timespec iostart;      /* IO start time */
+  struct timespec waitstart;    /* IO-set wait time */
+  uint32_t        nslices;      /* granted during the phase */
+};
+
+/* a request to start IO, owned by the caller until granted */
+struct ioset_req {
+  uint32_t         jobid;
+  uint32_t         jobstepid;
+  uint32_t         witer;       /* characteristic time, in s */
+  uint32_t         bandwidth;   /* expected, in MiB/s, 0 if unknown */
+  void             *arg;        /* for the caller */
+
+  /* set by the scheduler */
+  unsigned         nslices;     /* when granted */
+  struct ioset     *set;
+  struct ioset_req *next;       /* in a queue or the granted list */
+};
+
+#define IOSET_QUEUED  0
+#define IOSET_GRANTED 1
+
+struct ioset_sched_stats {
+  uint64_t budget;              /* MiB/s, 0 for none */
+  uint64_t used;                /* bandwidth of the admitted apps */
+  size_t   running;             /* admitted apps */
+  size_t   nsets;               /* held sets */
+  size_t   setwaiting;          /* apps waiting for their set */
+  size_t   waiting;             /* apps waiting for admission */
+  size_t   revoked;             /* leases expired so far */
+};
+
+/* called for each application whose lease expired */
+typedef void (*ioset_revoke_fn)(void *arg, uint32_t jobid, uint32_t jobstepid,
+                                uint32_t witer);
+
+/**
+ * Create an IO-set scheduler in SCHED, admitting applications up to
+ * an aggregate bandwidth of BUDGET MiB/s, or one at a time if 0, with
+ * a LEASE of that many ns per slice, or none if 0.
+ *
+ * Return 0 or -1 in case of error.
+ */
+int ioset_sched_init(struct ioset_sched **sched, uint64_t budget, uint64_t lease);
+
+/**
+ * Free SCHED. The queued requests are dropped.
+ */
+void ioset_sched_fini(struct ioset_sched **sched);
+
+/**
+ * Ask for the permission to do IO at time NOW. R must live until
+ * granted.
+ *
+ * Return IOSET_GRANTED with R->nslices set, IOSET_QUEUED, or -1 in
+ * case of error.
+ */
+int ioset_begin(struct ioset_sched *sched, struct ioset_req *r, uint64_t now);
+
+/**
+ * Give back the permission to do IO of application JOBID.JOBSTEPID of
+ * characteristic time WITER at time NOW, and release its set if
+ * ITERFLAG is set (end of the IO phase). Nothing happens if the
+ * application does not hold the set, e.g. its lease was revoked.
+ *
+ * Return the list of the requests granted as a consequence, linked
+ * by their NEXT field, or NULL.
+ */
+struct ioset_req *ioset_end(struct ioset_sched *sched, uint32_t jobid, uint32_t jobstepid,
+                            uint32_t witer, int iterflag, uint64_t now);
+
+/**
+ * Revoke the applications whose lease expired at time NOW, calling
+ * REVOKE with ARG for each, and release their set.
+ *
+ * Return the list of the requests granted as a consequence, as
+ * ioset_end.
+ */
+struct ioset_req *ioset_expire(struct ioset_sched *sched, uint64_t now,
+                               ioset_revoke_fn revoke, void *arg);
+
+void ioset_sched_stats(const struct ioset_sched *sched, struct ioset_sched_stats *stats);
+
+/**
+ * Compute the IO-set ID corresponding to a characteristic time of
+ * WITER seconds.
+ *
+ * Return 0 or -1 if IOSETID is too short.
+ */
+int ioset_id(unsigned long witer, char *iosetid, size_t len);
+
+/**
+ * Priority of the IO-set of characteristic time WITER.
+ */
+double ioset_prio(unsigned long witer);
+
+/**
+ * Write the application ID of JOBID.JOBSTEPID in APPID.
+ *
+ * Return 0 or -1 if APPID is too short.
+ */
+int ioset_appid(unsigned long jobid, unsigned long jobstepid, char *appid, size_t len);
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef _ADMIRE_IC_IOTRACE_H
+#define _ADMIRE_IC_IOTRACE_H
+/**
+ * Binary trace of the IO phases of the IO-set applications.
+ *
+ * Records are appended to per-execution stream rings without locking
+ * and written out by a background ULT, so tracing an IO phase costs a
+ * few atomic operations on the RPC path. A record is dropped if its
+ * ring is full.
+ *
+ * The trace file starts with a struct iotrace_header followed by
+ * struct iotrace_rec records, in the byte order of the server and in
+ * the order they are written, which is only roughly chronological.
+ * When the file grows past its maximum size, it is renamed to
+ * PATH.1, PATH.1 to PATH.2, etc., and a new one is started. The
+ * icc_iotrace tool converts trace files to text.
+ */
+
+#include <stdint.h>
+#include <margo.h>
+
+#define IOTRACE_FILE_ENV      "ICC_IOTRACE_FILE"
+#define IOTRACE_FILE_DEFAULT  "iosets_out.trace"
+#define IOTRACE_MAXSIZE_ENV   "ICC_IOTRACE_MAXSIZE"     /* MiB */
+#define IOTRACE_MAXSIZE_DEFAULT 64
+#define IOTRACE_KEEP          4         /* rotated files kept */
+#define IOTRACE_RINGSIZE      4096      /* records per ring */
+
+#define IOTRACE_MAGIC   "ICIOTRC"
+#define IOTRACE_VERSION 1
+
+struct iotrace_header {
+  char     magic[8];            /* IOTRACE_MAGIC */
+  uint32_t version;             /* IOTRACE_VERSION */
+  uint32_t recsize;             /* sizeof(struct iotrace_rec) */
+};
+
+enum iotrace_type {
+  IOTRACE_PHASE,                /* end of an IO phase */
+  IOTRACE_REVOKED,              /* lease expired before the end */
+};
+
+struct iotrace_rec {
+  uint64_t waitstart;           /* ns, CLOCK_MONOTONIC of the server */
+  uint64_t iostart;             /* ns, when the IO was granted */
+  uint64_t ioend;               /* ns */
+  uint64_t nbytes;
+  uint32_t jobid;
+  uint32_t jobstepid;
+  uint32_t witer;               /* s */
+  int32_t  setid;               /* see ioset_id */
+  uint32_t nslices;             /* granted during the phase */
+  uint32_t type;                /* enum iotrace_type */
+};
+
+struct iotrace;
+
+struct iotrace_stats {
+  uint64_t appended;
+  uint64_t dropped;             /* ring full */
+  uint64_t written;
+  uint64_t rotations;
+};
+
+/**
+ * Start tracing to the file PATH, rotated when larger than MAXSIZE
+ * bytes (0 for never), with NRINGS rings of IOTRACE_RINGSIZE records.
+ * The writer ULT runs in the handler pool of MID.
+ *
+ * Returns 0 if everything went fine, -1 otherwise.
+ */
+int iotrace_init(struct iotrace **trace, margo_instance_id mid, const char *path,
+                 uint64_t maxsize, unsigned nrings);
+
+/**
+ * Write out the pending records and free TRACE. The writer ULT is
+ * stopped when Margo finalizes, call it after margo_wait_for_finalize.
+ */
+void iotrace_fini(struct iotrace **trace);
+
+/**
+ * Append REC to TRACE, never blocks.
+ *
+ * Return 0, or -1 if the record was dropped.
+ */
+int iotrace_append(struct iotrace *trace, const struct iotrace_rec *rec);
+
+void iotrace_stats(struct iotrace *trace, struct iotrace_stats *stats);
+
+#endif
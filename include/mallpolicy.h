@@ -0,0 +1,94 @@
+#ifndef _ADMIRE_IC_MALLPOLICY_H
+#define _ADMIRE_IC_MALLPOLICY_H
+/**
+ * Loading and serialized use of malleability policies, see
+ * icc_mall.h for the policy side.
+ */
+
+#include <stdint.h>
+#include <margo.h>
+
+#include "icc_mall.h"
+
+#define MALLPOLICY_MAXACTIONS 16
+
+/* the heuristic the server has always applied */
+extern const struct icc_mall_policy icc_mall_policy_default;
+
+enum mallpolicy_event_type {
+  MALLPOLICY_REGISTER,
+  MALLPOLICY_DEREGISTER,
+  MALLPOLICY_REGION,
+  MALLPOLICY_METRIC,
+  MALLPOLICY_STREAM,
+};
+
+struct mallpolicy_event {
+  enum mallpolicy_event_type type;
+  uint32_t                   jobid;   /* snapshot to take, 0 for all */
+  union {
+    const struct icc_mall_client       *client;
+    const char                         *clid;     /* deregister */
+    const struct icc_mall_region       *region;
+    const struct icc_mall_metric       *metric;
+    const struct icc_mall_stream_event *stream;
+  } u;
+};
+
+/**
+ * Take a snapshot of the clients of job JOBID, or all clients if 0,
+ * in SNAP, valid until the next call with the same ARG.
+ *
+ * Return 0 or -1 in case of error.
+ */
+typedef int (*mallpolicy_snapshot_t)(void *arg, uint32_t jobid,
+                                     struct icc_mall_snapshot *snap);
+
+struct mallpolicy;
+
+/**
+ * Load the policy NAME, or the default policy if NAME is NULL or
+ * empty, and initialize it with the services SRV, which must outlive
+ * it. See icc_mall.h for the naming of policies.
+ *
+ * Returns 0 if everything went fine, -1 otherwise.
+ */
+int mallpolicy_load(struct mallpolicy **policy, margo_instance_id mid,
+                    const char *name, const struct icc_mall_services *srv);
+
+/**
+ * Finalize and unload POLICY.
+ */
+void mallpolicy_fini(struct mallpolicy **policy);
+
+/**
+ * Pass EV to the matching hook of POLICY, under the lock.
+ *
+ * Return ICC_MALL_DECIDE if the policy asks for a decision,
+ * ICC_MALL_PASS otherwise.
+ */
+int mallpolicy_hook(struct mallpolicy *policy, const struct mallpolicy_event *ev);
+
+/**
+ * Take a snapshot with SNAPSHOT(ARG, JOBID) and let POLICY decide,
+ * under the lock. Several events delivered with mallpolicy_hook can
+ * share one decision.
+ *
+ * Return the number of actions written in ACTIONS, up to MAXACTIONS.
+ */
+size_t mallpolicy_decide(struct mallpolicy *policy, uint32_t jobid,
+                         mallpolicy_snapshot_t snapshot, void *arg,
+                         struct icc_mall_action *actions, size_t maxactions);
+
+/**
+ * Pass EV to the matching hook of POLICY and, if it asks for it, take
+ * a snapshot with SNAPSHOT(ARG, EV->jobid) and let the policy decide.
+ * The hook, snapshot and decision are done under a lock.
+ *
+ * Return the number of actions written in ACTIONS, up to MAXACTIONS.
+ */
+size_t mallpolicy_handle(struct mallpolicy *policy, const struct mallpolicy_event *ev,
+                         mallpolicy_snapshot_t snapshot, void *arg,
+                         struct icc_mall_action *actions, size_t maxactions);
+
+#endif
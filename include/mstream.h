@@ -0,0 +1,56 @@
+#ifndef _ADMIRE_IC_MSTREAM_H
+#define _ADMIRE_IC_MSTREAM_H
+/**
+ * Message stream consumer. Entries of a Redis stream are read with
+ * blocking reads on a dedicated DB connection and Argobots execution
+ * stream, then handed in order to the registered handlers by a ULT
+ * running in the pool passed at initialization.
+ */
+
+#include <margo.h>
+
+#include "icdb.h"
+
+#define MSTREAM_HANDLERS_MAX 8
+
+typedef void (*mstream_handler_t)(const struct icdb_mstream_msg *msg, void *arg);
+
+struct mstream;
+
+/**
+ * Initialize a consumer of stream STREAMKEY on the database at
+ * DBADDR. Handlers are run in a ULT of POOL.
+ *
+ * If GROUP is not NULL, the entries are read as CONSUMER in the
+ * consumer group GROUP, so that several servers can share the stream,
+ * and they are acknowledged once all handlers have run. Otherwise,
+ * every entry added after mstream_start is delivered.
+ *
+ * Returns 0 if everything went fine, -1 otherwise.
+ */
+int mstream_init(struct mstream **ms, margo_instance_id mid, ABT_pool pool,
+                 char *dbaddr, const char *streamkey,
+                 const char *group, const char *consumer);
+
+/**
+ * Register HANDLER, called with ARG on each entry. Must be called
+ * before mstream_start.
+ *
+ * Returns 0 if everything went fine, -1 otherwise.
+ */
+int mstream_add_handler(struct mstream *ms, mstream_handler_t handler, void *arg);
+
+/**
+ * Start reading the stream.
+ *
+ * Returns 0 if everything went fine, -1 otherwise.
+ */
+int mstream_start(struct mstream *ms);
+
+/**
+ * Stop the consumer and free its resources. Entries already read are
+ * still dispatched.
+ */
+void mstream_fini(struct mstream **ms);
+
+#endif
@@ -101,6 +101,10 @@ icc_to_margo_log_level(enum icc_log_level icc_log_level)
  * RPC_RESALLOCDONE (client): Inform the IC that a resource allocation
  * has been granted.
  *
+ * RPC_MULTICAST (ic, client): Deliver a RPC_RESALLOC or RPC_LOWMEM
+ * notification to a client, which forwards it to the clients of its
+ * subtree, see rpc_multicast.
+ *
  * For the public RPCs, see the functions documentation in icc.h.
  */
 enum icc_rpc_code {
@@ -111,6 +115,7 @@ enum icc_rpc_code {
   RPC_CLIENT_DEREGISTER,
   RPC_HINT_IO_BEGIN,
   RPC_HINT_IO_END,
+  RPC_MULTICAST,
 
   /* public RPCs */
   RPC_TEST = 128,
@@ -131,6 +136,7 @@ enum icc_rpc_code {
   RPC_CHECKPOINTING,
   RPC_MALLEABILITY_QUERY,
   RPC_MALLEABILITY_SS,
+  RPC_STATS,                    /* latency histograms, see icstats.h */
   RPC_COUNT
 };
 
@@ -304,6 +310,7 @@ MERCURY_GEN_PROC(hint_io_in_t,
                  ((uint32_t)(jobstepid))
                  ((uint32_t)(ioset_witer)) /* app characteristic time (ms) */
                  ((int8_t)(iterflag))      /* set if we start/end an IO phase */
+                 ((uint32_t)(bandwidth))   /* expected bandwidth in MiB/s, 0 if unknown */
                  ((uint64_t)(nbytes)))     /* number of bytes written (for io_end) */
 
 MERCURY_GEN_PROC(hint_io_out_t,
@@ -313,6 +320,15 @@ MERCURY_GEN_PROC(hint_io_out_t,
 #define RPC_LOWMEM_NAME "icc_lowmem"
 MERCURY_GEN_PROC(lowmem_in_t, ((hg_const_string_t)(nodename)))
 
+#define RPC_MULTICAST_NAME "icc_multicast"
+MERCURY_GEN_PROC(multicast_in_t,
+                 ((uint32_t)(code))         /* RPC_RESALLOC or RPC_LOWMEM */
+                 ((hg_bool_t)(shrink))      /* RPC_RESALLOC payload */
+                 ((hg_uint32_t)(ncpus))
+                 ((hg_uint32_t)(nnodes))
+                 ((uint32_t)(fanout))
+                 ((hg_const_string_t)(subtree))) /* addresses, one per line */
+
 #define RPC_METRIC_ALERT_NAME "icc_metric_alert"
 MERCURY_GEN_PROC(metricalert_in_t,
                  ((hg_const_string_t)(source))
@@ -333,6 +349,12 @@ MERCURY_GEN_PROC(nodealert_in_t,
                  ((uint32_t)(jobid))
                  ((hg_const_string_t)(nodename)))
 
+#define RPC_STATS_NAME "icc_stats"
+MERCURY_GEN_PROC(stats_in_t, ((hg_bool_t)(reset)))
+MERCURY_GEN_PROC(stats_out_t,
+                 ((int64_t)(rc))
+                 ((hg_const_string_t)(text))) /* see icstats_summary */
+
 /**
  * Send RPC identifed by RPC_CODE from Margo instance MID to the Margo
  * provider identified by ADDR with input struct DATA.
@@ -344,4 +366,88 @@ int
 rpc_send(margo_instance_id mid, hg_addr_t addr, hg_id_t rpc_id,
          void *data, int *retcode, double timeout_ms);
 
+
+/**
+ * Completion callback of an RPC sent with rpc_isend. RET is 0 or -1
+ * if the RPC failed or timed out, RETCODE is the RPC return code when
+ * RET is 0. ARG is the argument given to rpc_isend.
+ */
+typedef void (*rpc_done_func_t)(margo_instance_id mid, int ret, int retcode, void *arg);
+
+struct rpc_req;
+struct addrcache;
+
+/**
+ * A batch of RPCs in flight. The Margo handles are kept and reused
+ * from one batch to the next, a batch should be reused for repeated
+ * broadcasts. Not thread-safe.
+ */
+struct rpc_batch {
+  margo_instance_id mid;
+  struct rpc_req    *reqs;
+  size_t            nreqs;      /* RPCs in flight */
+  size_t            size;       /* requests allocated */
+  struct addrcache  *addrcache; /* lookups of rpc_multicast, or NULL */
+};
+
+/**
+ * Initialize BATCH for sending RPCs from Margo instance MID. The
+ * address cache can be set afterwards, it is not owned by the batch.
+ */
+void rpc_batch_init(struct rpc_batch *batch, margo_instance_id mid);
+
+/**
+ * Wait for the RPCs in flight in BATCH and release its resources.
+ */
+void rpc_batch_fini(struct rpc_batch *batch);
+
+/**
+ * Start sending RPC RPC_ID to ADDR with input struct DATA, without
+ * waiting for the response. DATA is serialized before returning and
+ * can be reused, ADDR must stay valid until rpc_wait_all returns.
+ *
+ * CB, if not NULL, is called with ARG by rpc_wait_all once the RPC
+ * completes or TIMEOUT_MS expires.
+ *
+ * Returns 0 or -1 in case of error, in which case CB is not called.
+ */
+int
+rpc_isend(struct rpc_batch *batch, hg_addr_t addr, hg_id_t rpc_id,
+          void *data, double timeout_ms, rpc_done_func_t cb, void *arg);
+
+/**
+ * Wait for all the RPCs in flight in BATCH and call their completion
+ * callbacks, in the order the RPCs were sent.
+ *
+ * Returns the number of RPCs that failed or returned an error code.
+ */
+size_t
+rpc_wait_all(struct rpc_batch *batch);
+
+
+#define RPC_MULTICAST_FANOUT 8
+
+/**
+ * Deliver IN with RPC RPC_ID (RPC_MULTICAST) to the NADDRS clients at
+ * the addresses ADDRS, through a tree rooted at the caller.
+ *
+ * ADDRS is split in up to IN.fanout contiguous ranges. The first
+ * client of each range gets the rest of the range as its subtree in
+ * IN.subtree, and multicasts to it in turn. Neighbours in ADDRS
+ * should be close in the network. A client that cannot be reached is
+ * skipped, and the caller adopts its subtree. TIMEOUT_MS applies to
+ * each hop. Addresses are looked up and reported unreachable through
+ * the address cache of BATCH.
+ *
+ * If not NULL, LOCAL is called with ARG once the first RPCs are in
+ * flight, so that the caller can handle the message meanwhile.
+ *
+ * Returns the number of clients the message could not be delivered
+ * to, which is also the RPC return code of RPC_MULTICAST.
+ */
+size_t
+rpc_multicast(struct rpc_batch *batch, hg_id_t rpc_id, multicast_in_t *in,
+              const char **addrs, size_t naddrs, double timeout_ms,
+              void (*local)(void *), void *arg);
+
 #endif
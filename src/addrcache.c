@@ -0,0 +1,323 @@
+#include <inttypes.h>           /* PRIuXX */
+#include <stdlib.h>             /* malloc */
+#include <string.h>             /* strlen, memcpy */
+#include <margo.h>
+
+#include "rpc.h"                /* LOG_ERROR */
+#include "hashmap.h"
+#include "addrcache.h"
+
+struct addrcache_entry {
+  struct addrcache_entry *prev;   /* LRU list, most recent first */
+  struct addrcache_entry *next;
+  hg_addr_t               addr;   /* HG_ADDR_NULL if negative */
+  double                  expire; /* expiration of negative entries */
+  char                    key[];
+};
+
+struct addrcache {
+  margo_instance_id       mid;
+  size_t                  capacity;
+  double                  neg_ttl;
+
+  ABT_mutex               lock;   /* protects everything below */
+  hm_t                   *map;    /* address -> struct addrcache_entry * */
+  struct addrcache_entry *head;
+  struct addrcache_entry *tail;
+  size_t                  count;
+
+  struct addrcache_stats  stats;
+};
+
+/**
+ * List and map functions, called with the lock held.
+ */
+static struct addrcache_entry *find(struct addrcache *cache, const char *str);
+static void unlink_entry(struct addrcache *cache, struct addrcache_entry *e);
+static void push_front(struct addrcache *cache, struct addrcache_entry *e);
+static void remove_entry(struct addrcache *cache, struct addrcache_entry *e);
+static int put(struct addrcache *cache, const char *str, hg_addr_t addr);
+
+
+int
+addrcache_init(struct addrcache **cache, margo_instance_id mid,
+               size_t capacity, double neg_ttl)
+{
+  int rc;
+
+  *cache = NULL;
+
+  struct addrcache *c = calloc(1, sizeof(*c));
+  if (!c) {
+    LOG_ERROR(mid, "Failed calloc");
+    return -1;
+  }
+
+  c->mid = mid;
+  c->capacity = capacity ? capacity : ADDRCACHE_CAPACITY_DEFAULT;
+  c->neg_ttl = neg_ttl > 0 ? neg_ttl : ADDRCACHE_NEG_TTL_DEFAULT;
+  c->lock = ABT_MUTEX_NULL;
+
+  c->map = hm_create();
+  if (!c->map) {
+    LOG_ERROR(mid, "Failed allocation");
+    goto error;
+  }
+
+  rc = ABT_mutex_create(&c->lock);
+  if (rc != ABT_SUCCESS) {
+    c->lock = ABT_MUTEX_NULL;
+    LOG_ERROR(mid, "Could not create mutex (ret = %d)", rc);
+    goto error;
+  }
+
+  *cache = c;
+  return 0;
+
+ error:
+  addrcache_fini(&c);
+  return -1;
+}
+
+
+void
+addrcache_fini(struct addrcache **cache)
+{
+  if (!cache || !*cache)
+    return;
+
+  struct addrcache *c = *cache;
+  struct addrcache_stats *s = &c->stats;
+  uint64_t total = s->hits + s->misses + s->neghits;
+
+  margo_info(c->mid, "Address cache: %"PRIu64" hits, %"PRIu64" misses, "
+             "%"PRIu64" negative hits (hit rate %.1f%%), %"PRIu64" evictions, "
+             "%"PRIu64" invalidations, %"PRIu64" lookups (avg %.3f ms, max %.3f ms)",
+             s->hits, s->misses, s->neghits,
+             total ? 100.0 * (s->hits + s->neghits) / total : 0.0,
+             s->evictions, s->invalidations, s->lookups,
+             s->lookups ? 1000.0 * s->lookup_time / s->lookups : 0.0,
+             1000.0 * s->lookup_max);
+
+  while (c->head)
+    remove_entry(c, c->head);
+
+  if (c->lock != ABT_MUTEX_NULL)
+    ABT_mutex_free(&c->lock);
+
+  hm_free(c->map);
+  free(c);
+
+  *cache = NULL;
+}
+
+
+void
+addrcache_stats(struct addrcache *cache, struct addrcache_stats *stats)
+{
+  if (!cache || !stats)
+    return;
+
+  ABT_mutex_lock(cache->lock);
+  *stats = cache->stats;
+  ABT_mutex_unlock(cache->lock);
+}
+
+
+hg_return_t
+addrcache_lookup(struct addrcache *cache, margo_instance_id mid,
+                 const char *str, hg_addr_t *addr)
+{
+  struct addrcache_entry *e;
+  hg_return_t hret;
+  hg_addr_t newaddr;
+  double start, elapsed;
+
+  if (!cache)
+    return margo_addr_lookup(mid, str, addr);
+
+  *addr = HG_ADDR_NULL;
+
+  ABT_mutex_lock(cache->lock);
+  e = find(cache, str);
+  if (e && e->addr == HG_ADDR_NULL) {
+    if (ABT_get_wtime() < e->expire) {
+      cache->stats.neghits++;
+      ABT_mutex_unlock(cache->lock);
+      return HG_NOENTRY;
+    }
+    remove_entry(cache, e);
+    e = NULL;
+  }
+  if (e) {
+    hret = margo_addr_dup(mid, e->addr, addr);
+    unlink_entry(cache, e);
+    push_front(cache, e);
+    cache->stats.hits++;
+    ABT_mutex_unlock(cache->lock);
+    return hret;
+  }
+  cache->stats.misses++;
+  ABT_mutex_unlock(cache->lock);
+
+  /* the lookup yields, do not hold the lock meanwhile */
+  start = ABT_get_wtime();
+  hret = margo_addr_lookup(mid, str, &newaddr);
+  elapsed = ABT_get_wtime() - start;
+
+  ABT_mutex_lock(cache->lock);
+  cache->stats.lookups++;
+  cache->stats.lookup_time += elapsed;
+  if (elapsed > cache->stats.lookup_max)
+    cache->stats.lookup_max = elapsed;
+
+  if (hret != HG_SUCCESS) {
+    if (put(cache, str, HG_ADDR_NULL))
+      LOG_ERROR(mid, "Address cache: failed allocation");
+    ABT_mutex_unlock(cache->lock);
+    return hret;
+  }
+
+  /* another ULT may have looked it up meanwhile, keep the first */
+  e = find(cache, str);
+  if (e && e->addr != HG_ADDR_NULL) {
+    hret = margo_addr_dup(mid, e->addr, addr);
+    ABT_mutex_unlock(cache->lock);
+    margo_addr_free(mid, newaddr);
+    return hret;
+  }
+
+  hret = margo_addr_dup(mid, newaddr, addr);
+  if (hret != HG_SUCCESS) {
+    ABT_mutex_unlock(cache->lock);
+    margo_addr_free(mid, newaddr);
+    return hret;
+  }
+
+  if (put(cache, str, newaddr)) {
+    LOG_ERROR(mid, "Address cache: failed allocation");
+    margo_addr_free(mid, newaddr);
+  }
+  ABT_mutex_unlock(cache->lock);
+
+  return HG_SUCCESS;
+}
+
+
+void
+addrcache_fail(struct addrcache *cache, const char *str)
+{
+  if (!cache || !str)
+    return;
+
+  ABT_mutex_lock(cache->lock);
+  if (put(cache, str, HG_ADDR_NULL))
+    LOG_ERROR(cache->mid, "Address cache: failed allocation");
+  ABT_mutex_unlock(cache->lock);
+}
+
+
+void
+addrcache_invalidate(struct addrcache *cache, const char *str)
+{
+  if (!cache || !str)
+    return;
+
+  struct addrcache_entry *e;
+
+  ABT_mutex_lock(cache->lock);
+  e = find(cache, str);
+  if (e) {
+    remove_entry(cache, e);
+    cache->stats.invalidations++;
+  }
+  ABT_mutex_unlock(cache->lock);
+}
+
+
+static struct addrcache_entry *
+find(struct addrcache *cache, const char *str)
+{
+  struct addrcache_entry *const *e = hm_get(cache->map, str);
+  return e ? *e : NULL;
+}
+
+static void
+unlink_entry(struct addrcache *cache, struct addrcache_entry *e)
+{
+  if (e->prev)
+    e->prev->next = e->next;
+  else
+    cache->head = e->next;
+  if (e->next)
+    e->next->prev = e->prev;
+  else
+    cache->tail = e->prev;
+  e->prev = e->next = NULL;
+}
+
+static void
+push_front(struct addrcache *cache, struct addrcache_entry *e)
+{
+  e->prev = NULL;
+  e->next = cache->head;
+  if (cache->head)
+    cache->head->prev = e;
+  else
+    cache->tail = e;
+  cache->head = e;
+}
+
+static void
+remove_entry(struct addrcache *cache, struct addrcache_entry *e)
+{
+  unlink_entry(cache, e);
+  hm_del(cache->map, e->key);
+  if (e->addr != HG_ADDR_NULL)
+    margo_addr_free(cache->mid, e->addr);
+  free(e);
+  cache->count--;
+}
+
+/**
+ * Make ADDR, which the cache takes ownership of, the entry of STR, or
+ * make it negative if ADDR is HG_ADDR_NULL. Evict the least recently
+ * used entries past the capacity.
+ *
+ * Return 0 or -1 in case of error.
+ */
+static int
+put(struct addrcache *cache, const char *str, hg_addr_t addr)
+{
+  struct addrcache_entry *e = find(cache, str);
+
+  if (e) {
+    if (e->addr != HG_ADDR_NULL)
+      margo_addr_free(cache->mid, e->addr);
+    unlink_entry(cache, e);
+  } else {
+    size_t len = strlen(str) + 1;
+
+    e = malloc(sizeof(*e) + len);
+    if (!e)
+      return -1;
+    memcpy(e->key, str, len);
+
+    if (hm_set(cache->map, e->key, &e, sizeof(e)) == -1) {
+      free(e);
+      return -1;
+    }
+    cache->count++;
+  }
+
+  e->addr = addr;
+  e->expire = addr == HG_ADDR_NULL ? ABT_get_wtime() + cache->neg_ttl : 0;
+  push_front(cache, e);
+
+  while (cache->count > cache->capacity && cache->tail != e) {
+    remove_entry(cache, cache->tail);
+    cache->stats.evictions++;
+  }
+
+  return 0;
+}
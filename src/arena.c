@@ -0,0 +1,152 @@
+/**
+ * Region allocator. Blocks are chained newest first, and allocations
+ * are served from the newest block only.
+ */
+
+#include "arena.h"
+
+#include <stdint.h>             /* SIZE_MAX */
+#include <stdlib.h>             /* malloc */
+#include <string.h>             /* memset */
+
+
+#define ARENA_BLOCKSIZE 4096    /* default block size */
+#define ARENA_ALIGN     16      /* alignment of allocations */
+
+struct block {
+  struct block *next;
+  size_t        size;
+  size_t        used;
+  /* align the data like the allocations */
+  unsigned char data[] __attribute__((aligned(ARENA_ALIGN)));
+};
+
+struct arena {
+  struct block *blocks;         /* newest first */
+  size_t        blocksize;
+  size_t        nblocks;
+  size_t        size;
+  size_t        used;
+};
+
+
+static struct block *
+block_new(struct arena *arena, size_t size)
+{
+  if (size < arena->blocksize)
+    size = arena->blocksize;
+
+  struct block *b = malloc(sizeof(*b) + size);
+  if (b == NULL)
+    return NULL;
+
+  b->next = arena->blocks;
+  b->size = size;
+  b->used = 0;
+  arena->blocks = b;
+  arena->nblocks++;
+  arena->size += size;
+
+  return b;
+}
+
+
+struct arena *
+arena_create(size_t blocksize)
+{
+  struct arena *arena = calloc(1, sizeof(*arena));
+  if (arena == NULL)
+    return NULL;
+
+  arena->blocksize = blocksize ? blocksize : ARENA_BLOCKSIZE;
+
+  return arena;
+}
+
+
+void
+arena_free(struct arena *arena)
+{
+  if (arena == NULL)
+    return;
+
+  struct block *b = arena->blocks;
+  while (b) {
+    struct block *next = b->next;
+    free(b);
+    b = next;
+  }
+  free(arena);
+}
+
+
+void
+arena_reset(struct arena *arena)
+{
+  if (arena == NULL || arena->blocks == NULL)
+    return;
+
+  /* keep the newest block, often sized for the typical use */
+  struct block *b = arena->blocks->next;
+  while (b) {
+    struct block *next = b->next;
+    free(b);
+    b = next;
+  }
+  arena->blocks->next = NULL;
+  arena->blocks->used = 0;
+  arena->nblocks = 1;
+  arena->size = arena->blocks->size;
+  arena->used = 0;
+}
+
+
+void *
+arena_alloc(struct arena *arena, size_t size)
+{
+  struct block *b = arena->blocks;
+  size_t off = 0;
+
+  if (size > SIZE_MAX - ARENA_ALIGN)
+    return NULL;
+
+  if (b)
+    off = (b->used + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+  if (b == NULL || off > b->size || b->size - off < size) {
+    b = block_new(arena, size);
+    if (b == NULL)
+      return NULL;
+    off = 0;
+  }
+
+  b->used = off + size;
+  arena->used += size;
+
+  return memset(b->data + off, 0, size);
+}
+
+
+char *
+arena_strndup(struct arena *arena, const char *s, size_t len)
+{
+  if (len == SIZE_MAX)
+    return NULL;
+
+  char *str = arena_alloc(arena, len + 1);
+  if (str == NULL)
+    return NULL;
+
+  memcpy(str, s, len);        /* zeroed, so terminated */
+
+  return str;
+}
+
+
+void
+arena_stats(const struct arena *arena, struct arena_stats *stats)
+{
+  stats->nblocks = arena->nblocks;
+  stats->size = arena->size;
+  stats->used = arena->used;
+}
@@ -47,6 +47,17 @@ struct alloc_args {
  */
 static void alloc_th(struct alloc_args *args);
 
+/**
+ * Raise the low memory flag of ICC.
+ */
+static void
+lowmem_act(struct icc_context *icc)
+{
+  ABT_rwlock_wrlock(icc->lowmemlock);
+  icc->lowmem = true;
+  ABT_rwlock_unlock(icc->lowmemlock);
+}
+
 
 
 void
@@ -102,36 +113,22 @@ reconfigure_cb(hg_handle_t h)
 DEFINE_MARGO_RPC_HANDLER(reconfigure_cb);
 
 
-void
-resalloc_cb(hg_handle_t h)
+/**
+ * Handle a resource allocation request of NCPUS on NNODES for ICC,
+ * a release if SHRINK is set.
+ *
+ * Return the RPC status code.
+ */
+static int
+resalloc_act(margo_instance_id mid, struct icc_context *icc,
+             hg_bool_t shrink, uint32_t ncpus, uint32_t nnodes)
 {
-  hg_return_t hret;
-  margo_instance_id mid;
-  resalloc_in_t in;
-  rpc_out_t out;
   int ret;
-
-  mid = margo_hg_handle_get_instance(h);
-  assert(mid);
-  margo_info(mid, "resalloc_cb: begin"); // CHANGE JAVI
-
-  out.rc = ICC_SUCCESS;
-
-  const struct hg_info *info;
-  struct icc_context *icc;
-
-  info = margo_get_info(h);
-  icc = (struct icc_context *)margo_registered_data(mid, info->id);
-
-  MARGO_GET_INPUT(h, in, hret);
-  if (hret != HG_SUCCESS) {
-    out.rc = ICC_FAILURE;
-    goto respond;
-  }
+  int rc = ICC_SUCCESS;
 
   // CHANGE: JAVI
   // if shrinking kill pending jobs and wait until in_resalloc == 0
-  if (in.shrink) {
+  if (shrink) {
     icrmerr_t ret = ICRM_SUCCESS;
     char errstr[ICC_ERRSTR_LEN];
     margo_info(mid, "resalloc_cb: begin icrm_kill_wait_pending_job");
@@ -139,7 +136,7 @@ resalloc_cb(hg_handle_t h)
     margo_info(mid, "resalloc_cb: end icrm_kill_wait_pending_job");
     if (ret != ICRM_SUCCESS) {
       margo_error(mid, "resalloc_cb: icrm_kill_wait_pending_job error: %s",errstr);
-      goto respond;
+      return rc;
     }
   }
   // END CHANGE: JAVI
@@ -150,18 +147,17 @@ resalloc_cb(hg_handle_t h)
   ABT_mutex_lock(mutex);
     
   if (in_resalloc) {
-    out.rc = RPC_EAGAIN;
     ABT_mutex_unlock(mutex);
     margo_info(mid, "resalloc_cb: unlock error"); // CHANGE JAVI
 
-    goto respond;
+    return RPC_EAGAIN;
   } else {
     in_resalloc = 1;
     ABT_mutex_unlock(mutex);
   }
 
   /* shrinking request can be dealt with immediately */
-  if (in.shrink) {
+  if (shrink) {
     /* ALBERTO - Indicate if there is a restarting pending */
     if (icc->type == ICC_TYPE_STOPRESTART)
       icc->restarting = 1;
@@ -169,12 +165,12 @@ resalloc_cb(hg_handle_t h)
     if (icc->reconfig_func) {
       margo_info(mid, "resalloc_cb: call reconfig_func"); // CHANGE JAVI
       /* call callback immediately if available */
-      ret = icc->reconfig_func(in.shrink, in.ncpus, NULL, icc->reconfig_data); /*ALBERTO - I need the hostlist, not NULL. Or new_nodes_list with the default values */
+      ret = icc->reconfig_func(shrink, ncpus, NULL, icc->reconfig_data); /*ALBERTO - I need the hostlist, not NULL. Or new_nodes_list with the default values */
       margo_info(mid, "resalloc_cb: exit reconfig_func"); // CHANGE JAVI
-      out.rc = ret ? RPC_FAILURE : RPC_SUCCESS;
+      rc = ret ? RPC_FAILURE : RPC_SUCCESS;
     } else if (icc->type == ICC_TYPE_FLEXMPI) {
-      ret = icc_flexmpi_reconfigure(icc->mid, in.shrink, in.ncpus, NULL, icc->flexmpi_func, icc->flexmpi_sock);
-      out.rc = ret ? RPC_FAILURE : RPC_SUCCESS;
+      ret = icc_flexmpi_reconfigure(icc->mid, shrink, ncpus, NULL, icc->flexmpi_func, icc->flexmpi_sock);
+      rc = ret ? RPC_FAILURE : RPC_SUCCESS;
     } else {
       /* set flag to be polled later otherwise */
       ABT_rwlock_wrlock(icc->hostlock);
@@ -185,7 +181,7 @@ resalloc_cb(hg_handle_t h)
     in_resalloc = 0;
     ABT_mutex_unlock(mutex);
 
-    goto respond;
+    return rc;
   }
 
   /* expand request: dispatch allocation to an Argobots ULT that will
@@ -195,19 +191,17 @@ resalloc_cb(hg_handle_t h)
 
   /* first, check that we are not being shut down */
   if (icc->icrm_terminate) {
-    out.rc = RPC_TERMINATED;
-    goto respond;
+    return RPC_TERMINATED;
   }
 
   struct alloc_args *args = malloc(sizeof(*args));
   if (args == NULL) {
-    out.rc = ICC_ENOMEM;
-    goto respond;
+    return ICC_ENOMEM;
   }
 
   args->icc = icc;
-  args->ncpus = in.ncpus;
-  args->nnodes = in.nnodes;
+  args->ncpus = ncpus;
+  args->nnodes = nnodes;
   args->retcode = ICC_SUCCESS;
 
   /* note: args must be freed in the ULT */
@@ -217,10 +211,42 @@ resalloc_cb(hg_handle_t h)
                             ABT_THREAD_ATTR_NULL, NULL);
     if (ret != ABT_SUCCESS) {
       margo_error(mid, "ABT_thread_create failure: ret=%d", ret);
-      out.rc = ICC_FAILURE;
+      rc = ICC_FAILURE;
     }
   }
 
+  return rc;
+}
+
+
+void
+resalloc_cb(hg_handle_t h)
+{
+  hg_return_t hret;
+  margo_instance_id mid;
+  resalloc_in_t in;
+  rpc_out_t out;
+
+  mid = margo_hg_handle_get_instance(h);
+  assert(mid);
+  margo_info(mid, "resalloc_cb: begin"); // CHANGE JAVI
+
+  out.rc = ICC_SUCCESS;
+
+  const struct hg_info *info;
+  struct icc_context *icc;
+
+  info = margo_get_info(h);
+  icc = (struct icc_context *)margo_registered_data(mid, info->id);
+
+  MARGO_GET_INPUT(h, in, hret);
+  if (hret != HG_SUCCESS) {
+    out.rc = ICC_FAILURE;
+    goto respond;
+  }
+
+  out.rc = resalloc_act(mid, icc, in.shrink, in.ncpus, in.nnodes);
+
  respond:
   margo_info(mid, "resalloc_cb: end"); // CHANGE JAVI
   MARGO_RESPOND(h, out, hret)
@@ -244,12 +270,26 @@ alloc_th(struct alloc_args *args)
     
   uint32_t newjobid;
     
-  /* allocation request: blocking call */
-  hm_t *newalloc;
-  char icrmerr[ICC_ERRSTR_LEN];
+  /* allocation request, served by the RM worker */
+  hm_t *newalloc = NULL;
+  char *icrmerr;
+  struct icrmq_result res = { 0 };
+  ABT_eventual ev;
   // CHANGE JAVI
   //icrmerr_t icrmret = icrm_alloc(icc->jobid, &newjobid, &in.ncpus, &in.nnodes, &newalloc, icrmerr);
-  icrmerr_t icrmret = icrm_alloc(&newjobid, &in.ncpus, &in.nnodes, &newalloc, icrmerr);
+  icrmerr_t icrmret = icrmq_submit_alloc(icc->icrmq, in.ncpus, in.nnodes, &ev);
+  if (icrmret == ICRM_SUCCESS) {
+    icrmret = icrmq_wait(&ev, &res);
+  } else {
+    snprintf(res.errstr, sizeof(res.errstr), "Could not queue allocation request");
+  }
+  icrmerr = res.errstr;
+  newjobid = res.jobid;
+  newalloc = res.hostmap;
+  if (icrmret == ICRM_SUCCESS) {
+    in.ncpus = res.ncpus;
+    in.nnodes = res.nnodes;
+  }
   if (icrmret == ICRM_ERESOURCEMAN) {
     margo_error(icc->mid, "alloc_th: Error allocating job: %s", icrmerr);
     goto end; //CHANGE: JAVI
@@ -304,7 +344,14 @@ alloc_th(struct alloc_args *args)
     
   // add hostlist to redis database
   char *nodelist = icrm_hostlist(newalloc, 0, NULL);
-  int icdbret = icdb_addnodes(icc->icdbs_cb, icc->clid, nodelist);
+  int icdbret = ICDB_ENOMEM;
+  struct icdb_context *icdb = icdb_pool_get(icc->icdb_pool);
+  if (icdb) {
+    icdbret = icdb_addnodes(icdb, icc->clid, nodelist);
+    if (icdbret != ICDB_SUCCESS)
+      margo_error(icc->mid, "icdb_addnodes: %s", icdb_errstr(icdb));
+    icdb_pool_put(icc->icdb_pool, icdb);
+  }
   free(nodelist);
   if (icdbret != ICDB_SUCCESS) {
       margo_error(icc->mid, "New hosts ca not be added to redis");
@@ -462,9 +509,7 @@ lowmem_cb(hg_handle_t h)
     goto respond;
   }
 
-  ABT_rwlock_wrlock(icc->lowmemlock);
-  icc->lowmem = true;
-  ABT_rwlock_unlock(icc->hostlock);
+  lowmem_act(icc);
 
  respond:
   hret = margo_respond(h, &out);
@@ -473,3 +518,109 @@ lowmem_cb(hg_handle_t h)
   }
 }
 DEFINE_MARGO_RPC_HANDLER(lowmem_cb);
+
+
+struct multicast_args {
+  margo_instance_id  mid;
+  struct icc_context *icc;
+  multicast_in_t     *in;
+  int                rc;
+};
+
+/**
+ * Handle the message of a multicast locally, the signature makes it
+ * suitable for rpc_multicast.
+ */
+static void
+multicast_act(struct multicast_args *args)
+{
+  switch (args->in->code) {
+  case RPC_RESALLOC:
+    args->rc = resalloc_act(args->mid, args->icc, args->in->shrink,
+                            args->in->ncpus, args->in->nnodes);
+    break;
+  case RPC_LOWMEM:
+    lowmem_act(args->icc);
+    args->rc = RPC_SUCCESS;
+    break;
+  default:
+    margo_error(args->mid, "RPC_MULTICAST: unsupported RPC code %"PRIu32, args->in->code);
+    args->rc = RPC_FAILURE;
+  }
+}
+
+
+void
+multicast_cb(hg_handle_t h)
+{
+  hg_return_t hret;
+  margo_instance_id mid;
+  multicast_in_t in;
+  rpc_out_t out;
+  char *subtree = NULL;
+  const char **addrs = NULL;
+  size_t naddrs = 0;
+
+  mid = margo_hg_handle_get_instance(h);
+  assert(mid);
+
+  out.rc = RPC_FAILURE;
+
+  MARGO_GET_INPUT(h, in, hret);
+  if (hret != HG_SUCCESS) {
+    goto respond;
+  }
+
+  const struct hg_info *info = margo_get_info(h);
+  struct icc_context *icc = (struct icc_context *)margo_registered_data(mid, info->id);
+  if (!icc) {
+    margo_error(mid, "RPC_MULTICAST: no registered data");
+    goto end;
+  }
+
+  /* split the subtree in place, one address per line */
+  if (in.subtree && in.subtree[0] != '\0') {
+    subtree = strdup(in.subtree);
+    if (!subtree) {
+      margo_error(mid, "RPC_MULTICAST subtree: %s", strerror(errno));
+      goto end;
+    }
+    naddrs = 1;
+    for (char *p = subtree; *p; p++)
+      naddrs += (*p == '\n');
+
+    addrs = malloc(naddrs * sizeof(*addrs));
+    if (!addrs) {
+      margo_error(mid, "RPC_MULTICAST subtree: %s", strerror(errno));
+      goto end;
+    }
+    naddrs = 0;
+    char *saveptr;
+    for (char *tok = strtok_r(subtree, "\n", &saveptr); tok;
+         tok = strtok_r(NULL, "\n", &saveptr))
+      addrs[naddrs++] = tok;
+  }
+
+  struct multicast_args args = { mid, icc, &in, RPC_FAILURE };
+  struct rpc_batch batch;
+  multicast_in_t fwd = in;
+  size_t nfailed;
+
+  rpc_batch_init(&batch, mid);
+  nfailed = rpc_multicast(&batch, icc->rpcids[RPC_MULTICAST], &fwd, addrs, naddrs,
+                          RPC_TIMEOUT_MS_DEFAULT, (void (*)(void *))multicast_act, &args);
+  rpc_batch_fini(&batch);
+
+  /* report the failures of the subtree, this client included */
+  out.rc = nfailed + (args.rc != RPC_SUCCESS);
+
+ end:
+  free(addrs);
+  free(subtree);
+  margo_free_input(h, &in);
+
+ respond:
+  MARGO_RESPOND(h, out, hret);
+  MARGO_DESTROY_HANDLE(h, hret);
+}
+DEFINE_MARGO_RPC_HANDLER(multicast_cb);
@@ -3,6 +3,7 @@
 #include <margo.h>
 
 #include "rpc.h"                /* for RPC i/o structs */
+#include "icstats.h"
 
 #define MARGO_GET_INPUT(h,in,hret)  hret = margo_get_input(h, &in);	\
   if (hret != HG_SUCCESS) {						\
@@ -23,6 +24,7 @@
 void
 test_cb(hg_handle_t h)
 {
+  ICSTATS_SCOPE("rpc", RPC_TEST_NAME);
   hg_return_t hret;
   margo_instance_id mid;
   test_in_t in;
@@ -1,7 +1,6 @@
 #include <assert.h>
 #include <errno.h>
 #include <inttypes.h>
-#include <math.h>               /* log10, lround */
 #include <string.h>
 #include <margo.h>
 
@@ -10,9 +9,8 @@
 #include "icdb.h"
 #include "icrm.h"                 /* ressource manager */
 #include "uuid_admire.h"        /* UUID_STR_LEN */
+#include "icstats.h"
 
-#define IOSETID_LEN 256
-#define APPID_LEN 256
 
 
 #define MARGO_GET_INPUT(h,in,hret)  hret = margo_get_input(h, &in);     \
@@ -49,6 +47,8 @@
     }                                                   \
   }
 
+#define TIMESPEC_NS(t) ((uint64_t)(t).tv_sec * 1000000000 + (uint64_t)(t).tv_nsec)
+
 /* ALBERTO: for testing. Review later */
 int _checkpoint_iteration = 20;
 
@@ -56,6 +56,7 @@ int _checkpoint_iteration = 20;
 void
 client_register_cb(hg_handle_t h)
 {
+  ICSTATS_SCOPE("rpc", RPC_CLIENT_REGISTER_NAME);
   hg_return_t hret;
   margo_instance_id mid;
   int ret, xrank;
@@ -100,7 +101,7 @@ client_register_cb(hg_handle_t h)
   /* write client to DB */
   /* CHANGE JAVI NOTE: activate clement version*/ 
   //ret = icdb_setclient(data->icdbs[xrank], in.clid, in.type, in.addr_str, in.provid, in.jobid, in.jobncpus, in.jobnnodes, in.nprocs);
-    ret = icdb_setclient(data->icdbs[xrank], in.clid, in.type, in.addr_str, in.nodelist ? in.nodelist : "", in.provid, in.jobid, in.jobncpus, in.jobnodelist ? in.jobnodelist : "", in.nprocs);
+    ret = clcache_setclient(data->clcache, data->icdbs[xrank], in.clid, in.type, in.addr_str, in.nodelist ? in.nodelist : "", in.provid, in.jobid, in.jobncpus, in.jobnodelist ? in.jobnodelist : "", in.nprocs);
   /* END CHANGE JAVI */
 
     //margo_info(mid, "[DEBUG] ICDB After setclient %s", in.clid);
@@ -111,19 +112,15 @@ client_register_cb(hg_handle_t h)
     }
     out.rc = RPC_FAILURE;
   }
-  /* CHANGE JAVI */
-  /* wake up the malleability thread */
-  ABT_mutex_lock(data->malldat->mutex);
-  while (data->malldat->sleep == 0)
-    ABT_cond_wait(data->malldat->cond2, data->malldat->mutex);
-  data->malldat->rpc_code = RPC_CLIENT_REGISTER;
-  data->malldat->rpc_data = NULL;
-  data->malldat->jobid = in.jobid;
-  data->malldat->sleep = 0;
-  strncpy(data->malldat->clid, in.clid, UUID_STR_LEN);
-  ABT_cond_signal(data->malldat->cond);
-  ABT_mutex_unlock(data->malldat->mutex);
-  /* END CHANGE JAVI */
+
+  /* the address may have belonged to a client that went away */
+  addrcache_invalidate(data->addrcache, in.addr_str);
+  /* hand over to the malleability thread, pending registrations of
+     the same job are handed over together */
+  struct evq_event ev = { .code = RPC_CLIENT_REGISTER, .jobid = in.jobid };
+  strncpy(ev.clid, in.clid, UUID_STR_LEN - 1);
+  if (evqueue_push(data->malldat->events, &ev, EVQ_COALESCE_JOB) == -1)
+    margo_warning(mid, "%s: malleability queue full, event dropped", __func__);
 
  respond:
   MARGO_RESPOND(h, out, hret);
@@ -135,6 +132,7 @@ DEFINE_MARGO_RPC_HANDLER(client_register_cb);
 void
 client_deregister_cb(hg_handle_t h)
 {
+  ICSTATS_SCOPE("rpc", RPC_CLIENT_DEREGISTER_NAME);
   hg_return_t hret;
   margo_instance_id mid;
   int ret, xrank;
@@ -170,28 +168,28 @@ client_deregister_cb(hg_handle_t h)
   }
   assert(data->icdbs != NULL);
 
-  /* remove client from DB */
+  /* remove client from DB, and its address from the cache */
+  struct icdb_client client;
   uint32_t jobid;
-  ret = icdb_delclient(data->icdbs[xrank], in.clid, &jobid);
+  int known;
+
+  known = clcache_getclient(data->clcache, data->icdbs[xrank], in.clid, &client) == ICDB_SUCCESS;
+  ret = clcache_delclient(data->clcache, data->icdbs[xrank], in.clid, &jobid);
 
   if (ret != ICDB_SUCCESS) {
     margo_error(mid, "%s: Could not delete client %s: %s", __func__, in.clid, icdb_errstr(data->icdbs[xrank]));
     out.rc = RPC_FAILURE;
+  } else if (known) {
+    addrcache_invalidate(data->addrcache, client.addr);
   }
+  if (known)
+    free(client.nodelist);
 
-  /* CHANGE JAVI */
-  /* wake up the malleability thread */
-  ABT_mutex_lock(data->malldat->mutex);
-  while (data->malldat->sleep == 0)
-    ABT_cond_wait(data->malldat->cond2, data->malldat->mutex);
-  data->malldat->rpc_code = RPC_CLIENT_DEREGISTER;
-  data->malldat->rpc_data = NULL;
-  data->malldat->jobid = jobid;
-  data->malldat->sleep = 0;
-  strncpy(data->malldat->clid, in.clid, UUID_STR_LEN);
-  ABT_cond_signal(data->malldat->cond);
-  ABT_mutex_unlock(data->malldat->mutex);
-  /* END CHANGE JAVI */
+  /* hand over to the malleability thread */
+  struct evq_event ev = { .code = RPC_CLIENT_DEREGISTER, .jobid = jobid };
+  strncpy(ev.clid, in.clid, UUID_STR_LEN - 1);
+  if (evqueue_push(data->malldat->events, &ev, EVQ_COALESCE_JOB) == -1)
+    margo_warning(mid, "%s: malleability queue full, event dropped", __func__);
 
  respond:
   MARGO_RESPOND(h, out, hret);
@@ -203,6 +201,7 @@ DEFINE_MARGO_RPC_HANDLER(client_deregister_cb);
 void
 resallocdone_cb(hg_handle_t h)
 {
+  ICSTATS_SCOPE("rpc", RPC_RESALLOCDONE_NAME);
   hg_return_t hret;
   margo_instance_id mid;
   resallocdone_in_t in;
@@ -236,6 +235,7 @@ DEFINE_MARGO_RPC_HANDLER(resallocdone_cb);
 void
 jobclean_cb(hg_handle_t h)
 {
+  ICSTATS_SCOPE("rpc", RPC_JOBCLEAN_NAME);
   hg_return_t hret;
   margo_instance_id mid;
   jobclean_in_t in;
@@ -285,11 +285,24 @@ jobclean_cb(hg_handle_t h)
   if (state != ICRM_JOB_PENDING && state != ICRM_JOB_RUNNING) {
     margo_info(mid, "Job cleaner: Will cleanup job %"PRIu32, in.jobid);
 
-    ret = icdb_deljob(data->icdbs[xrank], in.jobid);
+    /* the addresses of the clients go with the job */
+    struct icdb_client *c = NULL;
+    size_t size = 0, count = 0;
+
+    if (clcache_getclients(data->clcache, data->icdbs[xrank], in.jobid, NULL,
+                           &c, &size, &count) != ICDB_SUCCESS) {
+      count = 0;
+    }
+
+    ret = clcache_deljob(data->clcache, data->icdbs[xrank], in.jobid);
     if (ret != ICDB_SUCCESS) {
       LOG_ERROR(mid, "Cleanup failure job %"PRIu32": %s", in.jobid, icdb_errstr(data->icdbs[xrank]));
       out.rc = RPC_FAILURE;
+    } else {
+      for (size_t i = 0; i < count; i++)
+        addrcache_invalidate(data->addrcache, c[i].addr);
     }
+    free(c);
   } else {
     margo_info(mid, "Job cleaner: ignoring running job %"PRIu32, in.jobid);
     out.rc = RPC_FAILURE;
@@ -305,6 +318,7 @@ DEFINE_MARGO_RPC_HANDLER(jobclean_cb);
 void
 jobmon_submit_cb(hg_handle_t h)
 {
+  ICSTATS_SCOPE("rpc", RPC_JOBMON_SUBMIT_NAME);
   hg_return_t hret;
   margo_instance_id mid;
   int ret, xrank;
@@ -358,6 +372,7 @@ DEFINE_MARGO_RPC_HANDLER(jobmon_submit_cb);
 void
 jobmon_exit_cb(hg_handle_t h)
 {
+  ICSTATS_SCOPE("rpc", RPC_JOBMON_EXIT_NAME);
   hg_return_t hret;
   margo_instance_id mid;
   jobmon_submit_in_t in;
@@ -385,6 +400,7 @@ DEFINE_MARGO_RPC_HANDLER(jobmon_exit_cb);
 void
 adhoc_nodes_cb(hg_handle_t h)
 {
+  ICSTATS_SCOPE("rpc", RPC_ADHOC_NODES_NAME);
   hg_return_t hret;
   margo_instance_id mid;
   adhoc_nodes_in_t in;
@@ -412,6 +428,7 @@ DEFINE_MARGO_RPC_HANDLER(adhoc_nodes_cb);
 void
 malleability_avail_cb(hg_handle_t h)
 {
+  ICSTATS_SCOPE("rpc", RPC_MALLEABILITY_AVAIL_NAME);
   hg_return_t hret;
   margo_instance_id mid;
   malleability_avail_in_t in;
@@ -464,6 +481,7 @@ DEFINE_MARGO_RPC_HANDLER(malleability_avail_cb);
 void
 malleability_region_cb(hg_handle_t h)
 {
+  ICSTATS_SCOPE("rpc", RPC_MALLEABILITY_REGION_NAME);
   hg_return_t hret;
   margo_instance_id mid;
   malleability_region_in_t in;
@@ -517,21 +535,16 @@ malleability_region_cb(hg_handle_t h)
   //margo_info(mid, "Application %s %s malleability region", in.clid,in.type == ICC_MALLEABILITY_REGION_ENTER ? "entering" : "leaving");
   //margo_info(mid, "Application %s (%d:%d) %s malleability region", in.clid,in.jobid, in.nprocs, in.type == ICC_MALLEABILITY_REGION_ENTER ? "entering" : "leaving");
 
-  /* wake up the malleability thread */
-  ABT_mutex_lock(data->malldat->mutex);
-  while (data->malldat->sleep == 0) {
-    ABT_cond_wait(data->malldat->cond2, data->malldat->mutex);
-  }
-  data->malldat->rpc_code = RPC_MALLEABILITY_REGION;
-  data->malldat->rpc_data = (void *) malloc(sizeof(int32_t)*3);
-  ((int32_t *)(data->malldat->rpc_data))[0] = (int32_t)in.type;
-  ((int32_t *)(data->malldat->rpc_data))[1] = (int32_t)in.nprocs;
-  ((int32_t *)(data->malldat->rpc_data))[2] = (int32_t)in.nnodes;
-  data->malldat->jobid = in.jobid;
-  data->malldat->sleep = 0;
-  strncpy(data->malldat->clid, in.clid, UUID_STR_LEN);
-  ABT_cond_broadcast(data->malldat->cond);
-  ABT_mutex_unlock(data->malldat->mutex);
+  /* hand over to the malleability thread, only the latest region
+     change of a client matters */
+  struct evq_event ev = {
+    .code = RPC_MALLEABILITY_REGION,
+    .jobid = in.jobid,
+    .args = { (int32_t)in.type, (int32_t)in.nprocs, (int32_t)in.nnodes },
+  };
+  strncpy(ev.clid, in.clid, UUID_STR_LEN - 1);
+  if (evqueue_push(data->malldat->events, &ev, EVQ_COALESCE_CLIENT) == -1)
+    margo_warning(mid, "%s: malleability queue full, event dropped", __func__);
   /* END CHANGE JAVI */
 
  respond:
@@ -542,68 +555,23 @@ DEFINE_MARGO_RPC_HANDLER(malleability_region_cb);
 
 
 /**
- * Compute the IO-set ID corresponding to a characteristic time of
- * WITER seconds.
+ * Wake up the handlers waiting for the requests of the GRANTED list.
  */
-static int
-ioset_id(unsigned long witer, char *iosetid, size_t len) {
-  unsigned int n;
-  long round;
-
-  /* XX TODO handle errors */
-  /* double sec = witer/1000.0; */
-  /* double a = log10(sec); */
-  /* double b = lround(a); */
-
-  round = lround(log10(witer));
-
-  n = snprintf(iosetid, len, "%ld", round);
-  if (n >= len) {            /* output truncated */
-    return -1;
-  }
-
-  return 0;
-}
-
-static double
-ioset_prio(unsigned long witer) {
-  return pow(10, -lround(log10(witer)));
-}
-
-static double
-ioset_scale(hm_t *iosets) {
-  const char *setid;
-  struct ioset *const *set;
-  size_t curs = 0;
-  double prio_min = INFINITY;
-
-  /* find the lowest priority */
-  while ((curs = hm_next(iosets, curs, &setid, (const void **)&set)) != 0) {
-    if ((*set)->jobid != 0 && (*set)->priority < prio_min)
-      prio_min = (*set)->priority;
-  }
-
-  if (prio_min == INFINITY) {
-    return 0;
+static void
+ioset_wake(struct ioset_req *granted)
+{
+  while (granted) {
+    struct ioset_req *next = granted->next; /* granted is gone once woken up */
+    ABT_eventual_set(granted->arg, NULL, 0);
+    granted = next;
   }
-
-  /* scale it to 1 */
-  return 1 / prio_min;
 }
 
-static int
-ioset_appid(unsigned long jobid, unsigned long jobstepid, char *appid, size_t len) {
-  int n;
-  n = snprintf(appid, len, "%lu.%lu", jobid, jobstepid);
-  if (n < 0 || (unsigned)n >= len) {
-    return -1;
-  }
-  return 0;
-}
 
 void
 hint_io_begin_cb(hg_handle_t h)
 {
+  ICSTATS_SCOPE("rpc", RPC_HINT_IO_BEGIN_NAME);
   hg_return_t hret;
   margo_instance_id mid;
   hint_io_in_t in;
@@ -631,53 +599,7 @@ hint_io_begin_cb(hg_handle_t h)
     goto respond;
   }
 
-  assert(data->iosetq != NULL);
-  assert(data->iosetlock != NULL);
-  assert(data->iosets != NULL);
-
-  /* compute the IO-set ID */
-  char iosetid[IOSETID_LEN];
-
-  if (ioset_id(in.ioset_witer, iosetid, IOSETID_LEN)) {
-    out.rc = RPC_FAILURE;
-    LOG_ERROR(mid, "Error computing IO-set from witer \"%"PRIu32"\"", in.ioset_witer);
-    goto respond;
-  }
-
-  /* get a writer lock in case we need to initialize */
-  ABT_rwlock_wrlock(data->iosets_lock);
-
-  struct ioset *set;
-  struct ioset *const *s = hm_get(data->iosets, iosetid);
-
-  if (!s) {
-    /* lazily initialize ioset data */
-    set = calloc(1, sizeof(struct ioset));
-    if (!set) {
-      LOG_ERROR(mid, "Out of memory");
-      out.rc = RPC_FAILURE;
-      ABT_rwlock_unlock(data->iosets_lock);
-      goto respond;
-    }
-    set->priority = ioset_prio(in.ioset_witer);
-    set->jobid = in.jobid;
-    set->jobstepid = in.jobstepid;
-    ABT_mutex_create(&set->lock);
-    ABT_cond_create(&set->waitq);
-
-    int rc;
-    rc = hm_set(data->iosets, iosetid, &set, sizeof(set));
-    if (rc == -1) {
-      LOG_ERROR(mid, "Cannot set IO-set data");
-      out.rc = RPC_FAILURE;
-      ABT_rwlock_unlock(data->iosets_lock);
-      goto respond;
-    }
-  } else {
-    set = *s;
-  }
-
-  ABT_rwlock_unlock(data->iosets_lock);
+  assert(data->iosched != NULL);
 
   /* get ioset time record */
   int rc;
@@ -694,7 +616,7 @@ hint_io_begin_cb(hg_handle_t h)
   struct ioset_time *time;
   struct ioset_time *const *t = hm_get(data->ioset_time, appid);
   if (!t) {
-    time = calloc(1, sizeof(struct ioset_time));
+    time = arena_alloc(data->ioset_time_arena, sizeof(struct ioset_time));
     if (!time) {
       LOG_ERROR(mid, "Out of memory");
       out.rc = RPC_FAILURE;
@@ -718,53 +640,61 @@ hint_io_begin_cb(hg_handle_t h)
   /* record wait start time */
   if (in.iterflag) {
     TIMESPEC_SET(time->waitstart);
+    time->nslices = 0;
   }
 
-  /* if there already is an application in the same set running, we go
-   * to sleep on cond. When it finishes running, the condition will be
-   * signaled to wake us up.
+  /* if another application of the set is running, or the file system
+   * bandwidth is taken, the request is queued and we go to sleep until
+   * the end of IO that grants it wakes us up.
    */
-
-  ABT_mutex_lock(set->lock);
-
-  while (set->jobid != 0 &&
-         (set->jobid != in.jobid || set->jobstepid != in.jobstepid)) {
-    ABT_cond_wait(set->waitq, set->lock);
+  struct ioset_req req = {
+    .jobid = in.jobid,
+    .jobstepid = in.jobstepid,
+    .witer = in.ioset_witer,
+    .bandwidth = in.bandwidth,
+  };
+  ABT_eventual granted;
+
+  rc = ABT_eventual_create(0, &granted);
+  if (rc != ABT_SUCCESS) {
+    LOG_ERROR(mid, "Could not create eventual (ret = %d)", rc);
+    out.rc = RPC_FAILURE;
+    goto respond;
   }
-  set->jobid = in.jobid;
-  set->jobstepid = in.jobstepid;
+  req.arg = granted;
 
-  ABT_mutex_unlock(set->lock);
+  struct icstats_gauge *waiting = ICSTATS_GAUGE("queue", "ioset_waitq");
+  uint64_t waitstart = icstats_now();
 
-  /* we are the running app in the set, wait for our share */
+  ABT_mutex_lock(data->iosetlock);
+  rc = ioset_begin(data->iosched, &req, icstats_now());
+  ABT_mutex_unlock(data->iosetlock);
 
-  /* record wait end/io start time */
-  if (in.iterflag) {
-      TIMESPEC_SET(time->iostart);
+  if (rc == IOSET_QUEUED) {
+    icstats_gauge_add(waiting, 1);
+    ABT_eventual_wait(granted, NULL);
+    icstats_gauge_add(waiting, -1);
   }
+  ABT_eventual_free(&granted);
 
-  ABT_mutex_lock(data->iosetlock);
-  while (data->ioset_isrunning) {
-    ABT_cond_wait(data->iosetq, data->iosetlock);
+  if (rc == -1) {
+    LOG_ERROR(mid, "Error scheduling IO of witer \"%"PRIu32"\"", in.ioset_witer);
+    out.rc = RPC_FAILURE;
+    goto respond;
   }
 
-  data->ioset_isrunning = 1;
+  icstats_record(ICSTATS_HIST("ioset", "waitq"), icstats_now() - waitstart);
 
-  ABT_rwlock_rdlock(data->iosets_lock);
-  double scale = ioset_scale(data->iosets);
-  ABT_rwlock_unlock(data->iosets_lock);
-
-  if (scale == 0) {
-    out.rc = RPC_FAILURE;
-    LOG_ERROR(mid, "Wrong scale");
+  /* record wait end/io start time */
+  if (in.iterflag) {
+      TIMESPEC_SET(time->iostart);
   }
 
-  out.nslices = set->priority * scale;
+  out.nslices = req.nslices > UINT16_MAX ? UINT16_MAX : req.nslices;
+  time->nslices += out.nslices;
 
-  ABT_mutex_unlock(data->iosetlock);
-
-  margo_debug(mid, "%"PRIu32".%"PRIu32" (set ID %s): %u IO slice%s",
-              in.jobid, in.jobstepid, iosetid, out.nslices, out.nslices > 1 ? "s" : "");
+  margo_debug(mid, "%"PRIu32".%"PRIu32" (witer %"PRIu32"): %u IO slice%s",
+              in.jobid, in.jobstepid, in.ioset_witer, out.nslices, out.nslices > 1 ? "s" : "");
 
  respond:
   MARGO_RESPOND(h, out, ret);
@@ -775,6 +705,7 @@ DEFINE_MARGO_RPC_HANDLER(hint_io_begin_cb);
 void
 hint_io_end_cb(hg_handle_t h)
 {
+  ICSTATS_SCOPE("rpc", RPC_HINT_IO_END_NAME);
   hg_return_t hret;
   margo_instance_id mid;
   hint_io_in_t in;
@@ -801,21 +732,16 @@ hint_io_end_cb(hg_handle_t h)
     goto respond;
   }
 
-  assert(data->iosets != NULL);
-  assert(data->iosetq != NULL);
-  assert(data->iosetlock != NULL);
+  assert(data->iosched != NULL);
 
+  /* give back the bandwidth, and the set at the end of the phase, and
+     wake up the applications that got in */
   ABT_mutex_lock(data->iosetlock);
-  data->ioset_isrunning = 0;
-  ABT_cond_signal(data->iosetq);
+  struct ioset_req *granted = ioset_end(data->iosched, in.jobid, in.jobstepid,
+                                        in.ioset_witer, in.iterflag, icstats_now());
   ABT_mutex_unlock(data->iosetlock);
 
-  char iosetid[IOSETID_LEN];
-  if (ioset_id(in.ioset_witer, iosetid, IOSETID_LEN)) {
-      out.rc = RPC_FAILURE;
-      LOG_ERROR(mid, "Could compute IO-set from witer \"%"PRIu32"\"", in.ioset_witer);
-      goto respond;
-  }
+  ioset_wake(granted);
 
   if (in.iterflag) {          /* reached end of IO phase */
     int rc;
@@ -833,45 +759,38 @@ hint_io_end_cb(hg_handle_t h)
     ABT_rwlock_unlock(data->ioset_time_lock);
     if (!t) {
       LOG_ERROR(mid, "No IO-set timing data for app  %s", appid);
+      out.rc = RPC_FAILURE;
+      goto respond;
     }
     struct timespec ioend;
     TIMESPEC_SET(ioend);
 
-    /* appid, witer, waitstart/cpuend, waitend/iostart, ioend, cpustart (next phase), nbytes */
-    fprintf(data->ioset_outfile,
-            "\"%s\",%"PRIu32",%lld.%.9ld,%lld.%.9ld,%lld.%.9ld,%"PRIu64"\n",
-            appid, in.ioset_witer,
-            (long long)(*t)->waitstart.tv_sec, (*t)->waitstart.tv_nsec,
-            (long long)(*t)->iostart.tv_sec, (*t)->iostart.tv_nsec,
-            (long long)ioend.tv_sec, ioend.tv_nsec,
-            in.nbytes);
-
-    if(fflush(data->ioset_outfile)) {
-      LOG_ERROR(mid, "fflush IO-set result file: %s", strerror(errno));
-    }
-
-    ABT_rwlock_rdlock(data->iosets_lock);
-    struct ioset *const *s = hm_get(data->iosets, iosetid);
-    ABT_rwlock_unlock(data->iosets_lock);
-
-    if (!s) {
-      LOG_ERROR(mid, "No running IO-set with id %s", iosetid);
-      goto respond;
+    char iosetid[IOSETID_LEN];
+    if (ioset_id(in.ioset_witer, iosetid, IOSETID_LEN)) {
+      iosetid[0] = '\0';
     }
 
-    struct ioset *set = *s;
-
-    /* signal waiting app in the same set */
-    ABT_mutex_lock(set->lock);
-    if (set->jobid == in.jobid && set->jobstepid == in.jobstepid) {
-      set->jobid = 0;
-      set->jobstepid = 0;
-      ABT_cond_signal(set->waitq);
+    struct iotrace_rec rec = {
+      .waitstart = TIMESPEC_NS((*t)->waitstart),
+      .iostart = TIMESPEC_NS((*t)->iostart),
+      .ioend = TIMESPEC_NS(ioend),
+      .nbytes = in.nbytes,
+      .jobid = in.jobid,
+      .jobstepid = in.jobstepid,
+      .witer = in.ioset_witer,
+      .setid = atoi(iosetid),
+      .nslices = (*t)->nslices,
+      .type = IOTRACE_PHASE,
+    };
+
+    uint64_t start = icstats_now();
+    if (iotrace_append(data->iotrace, &rec)) {
+      LOG_ERROR(mid, "IO trace full, record of %s dropped", appid);
     }
-    ABT_mutex_unlock(set->lock);
+    icstats_record(ICSTATS_HIST("ioset", "trace"), icstats_now() - start);
 
-    margo_debug(mid, "%"PRIu32".%"PRIu32" (set ID %s): IO phase end ",
-                in.jobid, in.jobstepid, iosetid);
+    margo_debug(mid, "%"PRIu32".%"PRIu32" (witer %"PRIu32"): IO phase end ",
+                in.jobid, in.jobstepid, in.ioset_witer);
   }
 
  respond:
@@ -881,6 +800,123 @@ hint_io_end_cb(hg_handle_t h)
 DEFINE_MARGO_RPC_HANDLER(hint_io_end_cb);
 
 
+/**
+ * Record in the trace that the lease of JOBID.JOBSTEPID expired. Runs
+ * with the IO-set lock held.
+ */
+static void
+ioset_revoke(void *arg, uint32_t jobid, uint32_t jobstepid, uint32_t witer)
+{
+  struct ioset_lease *lease = arg;
+  struct cb_data *data = lease->data;
+  margo_instance_id mid = lease->mid;
+  char appid[APPID_LEN], iosetid[IOSETID_LEN];
+  struct timespec ioend;
+
+  margo_warning(mid, "%"PRIu32".%"PRIu32" (witer %"PRIu32"): IO lease expired, revoked",
+                jobid, jobstepid, witer);
+
+  if (ioset_appid(jobid, jobstepid, appid, APPID_LEN))
+    return;
+
+  if (ioset_id(witer, iosetid, IOSETID_LEN)) {
+    iosetid[0] = '\0';
+  }
+
+  TIMESPEC_SET(ioend);
+
+  struct iotrace_rec rec = {
+    .ioend = TIMESPEC_NS(ioend),
+    .jobid = jobid,
+    .jobstepid = jobstepid,
+    .witer = witer,
+    .setid = atoi(iosetid),
+    .type = IOTRACE_REVOKED,
+  };
+
+  ABT_rwlock_rdlock(data->ioset_time_lock);
+  struct ioset_time *const *t = hm_get(data->ioset_time, appid);
+  if (t) {
+    rec.waitstart = TIMESPEC_NS((*t)->waitstart);
+    rec.iostart = TIMESPEC_NS((*t)->iostart);
+    rec.nslices = (*t)->nslices;
+  }
+  ABT_rwlock_unlock(data->ioset_time_lock);
+
+  if (iotrace_append(data->iotrace, &rec)) {
+    LOG_ERROR(mid, "IO trace full, revocation of %s dropped", appid);
+  }
+}
+
+static void
+ioset_lease_th(void *arg)
+{
+  struct ioset_lease *lease = arg;
+  struct cb_data *data = lease->data;
+
+  while (!__atomic_load_n(&lease->terminate, __ATOMIC_ACQUIRE)) {
+    margo_thread_sleep(lease->mid, lease->interval);
+
+    ABT_mutex_lock(data->iosetlock);
+    struct ioset_req *granted = ioset_expire(data->iosched, icstats_now(),
+                                             ioset_revoke, lease);
+    ABT_mutex_unlock(data->iosetlock);
+
+    ioset_wake(granted);
+  }
+}
+
+static void
+ioset_lease_stop(void *arg)
+{
+  struct ioset_lease *lease = arg;
+
+  if (lease->thread != ABT_THREAD_NULL) {
+    __atomic_store_n(&lease->terminate, 1, __ATOMIC_RELEASE);
+    ABT_thread_join(lease->thread);
+    ABT_thread_free(&lease->thread);
+  }
+}
+
+int
+ioset_lease_start(struct ioset_lease *lease, margo_instance_id mid, ABT_pool pool,
+                  struct cb_data *data, uint64_t duration)
+{
+  int rc;
+
+  lease->mid = mid;
+  lease->data = data;
+  lease->terminate = 0;
+  lease->thread = ABT_THREAD_NULL;
+
+  /* check a few times per lease, and at least once a second so that
+     a revocation is late by a second at most, but not more often than
+     every millisecond */
+  lease->interval = duration / 4 / 1000000.0;
+  if (lease->interval > IOSET_LEASE_CHECK_MS)
+    lease->interval = IOSET_LEASE_CHECK_MS;
+  if (lease->interval < 1)
+    lease->interval = 1;
+
+  rc = ABT_thread_create(pool, ioset_lease_th, lease, ABT_THREAD_ATTR_NULL, &lease->thread);
+  if (rc != ABT_SUCCESS) {
+    lease->thread = ABT_THREAD_NULL;
+    LOG_ERROR(mid, "Could not create IO-set lease ULT (ret = %d)", rc);
+    return -1;
+  }
+
+  /* the ULT must be gone before Margo stops its pool */
+  rc = margo_push_prefinalize_callback(mid, ioset_lease_stop, lease);
+  if (rc != 0) {
+    LOG_ERROR(mid, "Could not register IO-set lease finalization");
+    ioset_lease_stop(lease);
+    return -1;
+  }
+
+  return 0;
+}
+
+
 static void
 lowmem_act(margo_instance_id mid, const struct cb_data *data) {
   int ret, xrank;
@@ -889,44 +925,49 @@ lowmem_act(margo_instance_id mid, const struct cb_data *data) {
     return;
   }
   struct icdb_context *icdb = data->icdbs[xrank];
-  struct icdb_client *c;
-
-  size_t count;
-  uint64_t cursor = 0;
+  struct icdb_client *c = NULL;
+  size_t size = 0, count = 0;
 
-  do {
-    c = NULL;
-    /* XX filter on job ID */
-    ret = icdb_getclients2(icdb, 0, "alert", &c, &count, &cursor);
-    if (ret != ICDB_SUCCESS) {
-      LOG_ERROR(mid, "lowmem: icdb getclients2: %s", icdb_errstr(icdb));
-      break;
-    }
+  /* XX filter on job ID */
+  ret = clcache_getclients(data->clcache, icdb, 0, "alert", &c, &size, &count);
+  if (ret != ICDB_SUCCESS) {
+    LOG_ERROR(mid, "lowmem: icdb getclients: %s", icdb_errstr(icdb));
+    free(c);
+    return;
+  }
 
-    hg_addr_t addr;
-    hg_return_t hret;
-    int rpcret;
-    for (size_t i = 0; i < count; i++) {
-      hret = margo_addr_lookup(mid, c[i].addr, &addr);
-      if (hret != HG_SUCCESS) {
-        LOG_ERROR(mid, "lowmem: %s response hg address: %s", c[i].clid, HG_Error_to_string(hret));
-        continue;
-      }
-
-      lowmem_in_t rin = { 0 };
-      ret = rpc_send(mid, addr, data->rpcids[RPC_LOWMEM], &rin, &rpcret, RPC_TIMEOUT_MS_DEFAULT);
-      if (ret || rpcret) {
-        LOG_ERROR(mid, "lowmem:  %s: RPC_LOWMEM failed", c[i].clid);
-        continue;
-      }
-    }
+  const char **addrs = calloc(count, sizeof(*addrs));
+  if (count && !addrs) {
+    LOG_ERROR(mid, "lowmem: %s", strerror(errno));
     free(c);
-  } while (cursor != 0);
+    return;
+  }
+  for (size_t i = 0; i < count; i++) {
+    addrs[i] = c[i].addr;
+  }
+
+  /* the clients relay the notification to each other */
+  struct rpc_batch batch;
+  multicast_in_t mcin = { .code = RPC_LOWMEM, .fanout = RPC_MULTICAST_FANOUT };
+  size_t nfailed;
+
+  rpc_batch_init(&batch, mid);
+  batch.addrcache = data->addrcache;
+  nfailed = rpc_multicast(&batch, data->rpcids[RPC_MULTICAST], &mcin, addrs, count,
+                          RPC_TIMEOUT_MS_DEFAULT, NULL, NULL);
+  rpc_batch_fini(&batch);
+
+  if (nfailed) {
+    LOG_ERROR(mid, "lowmem: RPC_LOWMEM failed on %zu/%zu clients", nfailed, count);
+  }
+  free(addrs);
+  free(c);
 }
 
 void
 metricalert_cb(hg_handle_t h)
 {
+  ICSTATS_SCOPE("rpc", RPC_METRIC_ALERT_NAME);
   hg_return_t hret;
   margo_instance_id mid = NULL;
   metricalert_in_t in;
@@ -967,6 +1008,7 @@ DEFINE_MARGO_RPC_HANDLER(metricalert_cb);
 void
 alert_cb(hg_handle_t h)
 {
+  ICSTATS_SCOPE("rpc", RPC_ALERT_NAME);
   hg_return_t hret;
   margo_instance_id mid;
   int ret, xrank;
@@ -1018,7 +1060,7 @@ alert_cb(hg_handle_t h)
 
   hg_addr_t addr;
   hg_return_t hret2;
-  hret2 = margo_addr_lookup(mid, c.addr, &addr);
+  hret2 = addrcache_lookup(data->addrcache, mid, c.addr, &addr);
   if (hret2 != HG_SUCCESS) {
     LOG_ERROR(mid, "hg address: %s", HG_Error_to_string(hret2));
     goto respond;
@@ -1030,9 +1072,11 @@ alert_cb(hg_handle_t h)
   ret = rpc_send(mid, addr, data->rpcids[RPC_RECONFIGURE2], &rin, &rpcret, RPC_TIMEOUT_MS_DEFAULT);
   if (ret) {
     LOG_ERROR(mid, "mall: client %s: RPC_RECONFIGURE2 send failed ", c.clid);
+    addrcache_fail(data->addrcache, c.addr);
   } else if (rpcret) {
     LOG_ERROR(mid, "mall: client %s: RPC_RECONFIGURE2 returned %d", c.clid, rpcret);
   }
+  margo_addr_free(mid, addr);
 
  respond:
   MARGO_RESPOND(h, out, hret);
@@ -1044,6 +1088,7 @@ DEFINE_MARGO_RPC_HANDLER(alert_cb);
 void
 nodealert_cb(hg_handle_t h)
 {
+  ICSTATS_SCOPE("rpc", RPC_NODEALERT_NAME);
   hg_return_t hret;
   rpc_out_t out;
   out.rc = RPC_SUCCESS;
@@ -1062,10 +1107,53 @@ respond:
 }
 DEFINE_MARGO_RPC_HANDLER(nodealert_cb);
 
+
+void
+stats_cb(hg_handle_t h)
+{
+  hg_return_t hret;
+  margo_instance_id mid;
+  stats_in_t in;
+  stats_out_t out;
+  char *text = NULL;
+
+  mid = margo_hg_handle_get_instance(h);
+  assert(mid);
+
+  out.rc = RPC_SUCCESS;
+  out.text = "";
+
+  MARGO_GET_INPUT(h, in, hret);
+  if (hret != HG_SUCCESS) {
+    out.rc = RPC_FAILURE;
+    goto respond;
+  }
+
+  if (icstats_summary(&text)) {
+    LOG_ERROR(mid, "Could not summarize statistics");
+    out.rc = RPC_FAILURE;
+  } else {
+    out.text = text;
+  }
+
+  /* after the summary, so that the last values are not lost */
+  if (in.reset)
+    icstats_reset();
+
+  margo_free_input(h, &in);
+
+ respond:
+  MARGO_RESPOND(h, out, hret);
+  MARGO_DESTROY_HANDLE(h, hret);
+  free(text);
+}
+DEFINE_MARGO_RPC_HANDLER(stats_cb);
+
 /*ALBERTO 26062023*/
 void
 checkpoint_cb(hg_handle_t h)
 {
+  ICSTATS_SCOPE("rpc", RPC_CHECKPOINTING_NAME);
   hg_return_t hret;
   margo_instance_id mid;
   rpc_out_t out;
@@ -1096,6 +1184,7 @@ DEFINE_MARGO_RPC_HANDLER(checkpoint_cb);
 void
 malleability_query_cb(hg_handle_t h)
 {
+  ICSTATS_SCOPE("rpc", RPC_MALLEABILITY_QUERY_NAME);
   hg_return_t hret;
   margo_instance_id mid;
   malleability_query_out_t out;
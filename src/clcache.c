@@ -0,0 +1,932 @@
+#include <inttypes.h>           /* PRIuXX */
+#include <stdio.h>              /* snprintf */
+#include <stdlib.h>             /* malloc, strtoul */
+#include <string.h>             /* strdup, strncmp */
+#include <unistd.h>             /* getpid, sleep */
+#include <margo.h>
+
+#include "rpc.h"                /* LOG_ERROR */
+#include "hashmap.h"
+#include "icdb.h"
+#include "clcache.h"
+
+/* keyspace event classes: generic (DEL, etc.), hash, set, expired
+   and evicted */
+#define CLCACHE_EVENTS "ghsxe"
+
+/* delay before subscribing again after a connection failure */
+#define CLCACHE_RETRY_S 1
+
+/* entries are never removed from a hashmap, invalidated entries are
+   dropped by rebuilding the maps past that number */
+#define CLCACHE_COMPACT 1024
+
+#define CLCACHE_NAME_LEN (ICC_TYPE_LEN + 16)
+
+#define STAT_INC(cache,counter)                                         \
+  __atomic_fetch_add(&(cache)->stats.counter, 1, __ATOMIC_RELAXED)
+
+static const char *const clcache_patterns[] = {
+  "client:*", "job:*", "index:clients*"
+};
+
+struct clcache_client {
+  int                valid;
+  struct icdb_client client;
+};
+
+struct clcache_job {
+  int             valid;
+  struct icdb_job job;
+};
+
+/* clients of a job, of a type or all of them */
+struct clcache_list {
+  int                 valid;
+  size_t              count;
+  struct icdb_client *clients;
+};
+
+struct clcache {
+  margo_instance_id    mid;
+  char                *dbaddr;
+  struct icdb_context *icdb;        /* subscription, NULL if down */
+  struct icdb_context *icdb_pub;    /* wake-ups */
+  char                 wakechan[64];
+
+  ABT_rwlock           lock;        /* protects the maps, gen & live */
+  hm_t                *clients;     /* clid -> struct clcache_client * */
+  hm_t                *jobs;        /* jobid -> struct clcache_job * */
+  hm_t                *lists;       /* list name -> struct clcache_list * */
+  size_t               ninvalid;    /* invalid entries in the maps */
+  uint64_t             gen;         /* bumped on each invalidation */
+  int                  live;        /* notifications are received */
+
+  struct clcache_stats stats;
+
+  ABT_pool             pool;
+  ABT_xstream          xstream;
+  ABT_thread           listener;
+  int                  terminate;
+};
+
+/* growable array of clients */
+struct collect {
+  struct icdb_client *clients;
+  size_t              size;
+  size_t              count;
+  int                 err;
+};
+
+static void listener_th(void *arg);
+static void notify(const char *key, const char *event, void *arg);
+
+/**
+ * Invalidation functions, called with the write lock held. A client
+ * is invalidated with the lists it belongs to.
+ */
+static void invalidate_client(struct clcache *cache, const char *clid);
+static void invalidate_job(struct clcache *cache, uint32_t jobid);
+static void invalidate_list(struct clcache *cache, const char *name);
+static void invalidate_all(struct clcache *cache);
+static void compact(struct clcache *cache);
+
+/**
+ * Insertion functions, called with the write lock held. put_list
+ * takes ownership of CLIENTS.
+ */
+static void put_client(struct clcache *cache, const struct icdb_client *client);
+static void put_job(struct clcache *cache, const struct icdb_job *job);
+static void put_list(struct clcache *cache, const char *name,
+                     struct icdb_client *clients, size_t count);
+
+static int collect_cb(const struct icdb_client *client, void *arg);
+static int list_copy(const struct icdb_client *src, size_t n, const char *type,
+                     struct icdb_client **clients, size_t *size, size_t *count);
+static void free_clients(struct icdb_client *clients, size_t count);
+static void free_maps(struct clcache *cache);
+
+
+int
+clcache_init(struct clcache **cache, margo_instance_id mid, char *dbaddr)
+{
+  int rc;
+
+  *cache = NULL;
+
+  struct clcache *c = calloc(1, sizeof(*c));
+  if (!c) {
+    LOG_ERROR(mid, "Failed calloc");
+    return -1;
+  }
+
+  c->mid = mid;
+  c->lock = ABT_RWLOCK_NULL;
+  c->xstream = ABT_XSTREAM_NULL;
+  c->listener = ABT_THREAD_NULL;
+  snprintf(c->wakechan, sizeof(c->wakechan), "clcache:%ld:%p",
+           (long)getpid(), (void *)c);
+
+  c->dbaddr = strdup(dbaddr);
+  c->clients = hm_create();
+  c->jobs = hm_create();
+  c->lists = hm_create();
+  if (!c->dbaddr || !c->clients || !c->jobs || !c->lists) {
+    LOG_ERROR(mid, "Failed allocation");
+    goto error;
+  }
+
+  rc = ABT_rwlock_create(&c->lock);
+  if (rc != ABT_SUCCESS) {
+    c->lock = ABT_RWLOCK_NULL;
+    LOG_ERROR(mid, "Could not create rwlock (ret = %d)", rc);
+    goto error;
+  }
+
+  rc = icdb_init(&c->icdb_pub, c->dbaddr);
+  if (rc != ICDB_SUCCESS) {
+    LOG_ERROR(mid, "Could not initialize IC database: %s",
+              c->icdb_pub ? icdb_errstr(c->icdb_pub) : "?");
+    goto error;
+  }
+
+  /* the subscription blocks, give it its own execution stream */
+  rc = ABT_pool_create_basic(ABT_POOL_FIFO_WAIT, ABT_POOL_ACCESS_MPMC, ABT_TRUE,
+                             &c->pool);
+  if (rc != ABT_SUCCESS) {
+    LOG_ERROR(mid, "ABT_pool_create_basic error: ret=%d", rc);
+    goto error;
+  }
+
+  rc = ABT_xstream_create_basic(ABT_SCHED_BASIC_WAIT, 1, &c->pool,
+                                ABT_SCHED_CONFIG_NULL, &c->xstream);
+  if (rc != ABT_SUCCESS) {
+    c->xstream = ABT_XSTREAM_NULL;
+    LOG_ERROR(mid, "ABT_xstream_create_basic error: ret=%d", rc);
+    goto error;
+  }
+
+  rc = ABT_thread_create(c->pool, listener_th, c, ABT_THREAD_ATTR_NULL,
+                         &c->listener);
+  if (rc != ABT_SUCCESS) {
+    c->listener = ABT_THREAD_NULL;
+    LOG_ERROR(mid, "Could not create listener ULT (ret = %d)", rc);
+    goto error;
+  }
+
+  *cache = c;
+  return 0;
+
+ error:
+  clcache_fini(&c);
+  return -1;
+}
+
+
+void
+clcache_fini(struct clcache **cache)
+{
+  if (!cache || !*cache)
+    return;
+
+  struct clcache *c = *cache;
+
+  c->terminate = 1;
+
+  if (c->listener != ABT_THREAD_NULL) {
+    /* wake the listener up from its blocking read */
+    if (icdb_publish(c->icdb_pub, c->wakechan, "stop") != ICDB_SUCCESS) {
+      LOG_ERROR(c->mid, "Client cache: %s", icdb_errstr(c->icdb_pub));
+    }
+    ABT_thread_join(c->listener);
+    ABT_thread_free(&c->listener);
+  }
+  if (c->xstream != ABT_XSTREAM_NULL) {
+    ABT_xstream_join(c->xstream);
+    ABT_xstream_free(&c->xstream);
+  }
+
+  margo_info(c->mid, "Client cache: %"PRIu64" hits, %"PRIu64" misses, "
+             "%"PRIu64" invalidations", c->stats.hits, c->stats.misses,
+             c->stats.invalidations);
+
+  if (c->lock != ABT_RWLOCK_NULL)
+    ABT_rwlock_free(&c->lock);
+
+  free_maps(c);
+  icdb_fini(&c->icdb);
+  icdb_fini(&c->icdb_pub);
+  free(c->dbaddr);
+  free(c);
+
+  *cache = NULL;
+}
+
+
+void
+clcache_stats(struct clcache *cache, struct clcache_stats *stats)
+{
+  if (!cache || !stats)
+    return;
+
+  stats->hits = __atomic_load_n(&cache->stats.hits, __ATOMIC_RELAXED);
+  stats->misses = __atomic_load_n(&cache->stats.misses, __ATOMIC_RELAXED);
+
+  ABT_rwlock_rdlock(cache->lock);
+  stats->invalidations = cache->stats.invalidations;
+  ABT_rwlock_unlock(cache->lock);
+}
+
+
+int
+clcache_getclient(struct clcache *cache, struct icdb_context *icdb,
+                  const char *clid, struct icdb_client *client)
+{
+  if (!cache || !clid || !client)
+    return ICDB_EPARAM;
+
+  struct clcache_client *const *e;
+  uint64_t gen;
+  int live, rc;
+
+  ABT_rwlock_rdlock(cache->lock);
+  live = cache->live;
+  gen = cache->gen;
+  if (live && (e = hm_get(cache->clients, clid)) && (*e)->valid) {
+    const char *nodelist = (*e)->client.nodelist;
+    *client = (*e)->client;
+    client->nodelist = nodelist ? strdup(nodelist) : NULL;
+    ABT_rwlock_unlock(cache->lock);
+    if (nodelist && !client->nodelist)
+      return ICDB_ENOMEM;
+    STAT_INC(cache, hits);
+    return ICDB_SUCCESS;
+  }
+  ABT_rwlock_unlock(cache->lock);
+  STAT_INC(cache, misses);
+
+  rc = icdb_getclient(icdb, clid, client);
+  if (rc != ICDB_SUCCESS) {
+    client->nodelist = NULL;
+    return rc;
+  }
+
+  /* the record is only kept if nothing was invalidated meanwhile */
+  if (live) {
+    ABT_rwlock_wrlock(cache->lock);
+    if (cache->gen == gen)
+      put_client(cache, client);
+    ABT_rwlock_unlock(cache->lock);
+  }
+
+  /* the nodelist read is in the context arena */
+  if (client->nodelist && !(client->nodelist = strdup(client->nodelist)))
+    return ICDB_ENOMEM;
+
+  return ICDB_SUCCESS;
+}
+
+
+int
+clcache_getjob(struct clcache *cache, struct icdb_context *icdb,
+               uint32_t jobid, struct icdb_job *job)
+{
+  if (!cache || !job)
+    return ICDB_EPARAM;
+
+  struct clcache_job *const *e;
+  char key[16];
+  uint64_t gen;
+  int live, rc;
+
+  snprintf(key, sizeof(key), "%"PRIu32, jobid);
+
+  ABT_rwlock_rdlock(cache->lock);
+  live = cache->live;
+  gen = cache->gen;
+  if (live && (e = hm_get(cache->jobs, key)) && (*e)->valid) {
+    const char *nodelist = (*e)->job.nodelist;
+    *job = (*e)->job;
+    job->nodelist = nodelist ? strdup(nodelist) : NULL;
+    ABT_rwlock_unlock(cache->lock);
+    if (nodelist && !job->nodelist)
+      return ICDB_ENOMEM;
+    STAT_INC(cache, hits);
+    return ICDB_SUCCESS;
+  }
+  ABT_rwlock_unlock(cache->lock);
+  STAT_INC(cache, misses);
+
+  rc = icdb_getjob(icdb, jobid, job);
+
+  if (rc == ICDB_SUCCESS && live) {
+    ABT_rwlock_wrlock(cache->lock);
+    if (cache->gen == gen)
+      put_job(cache, job);
+    ABT_rwlock_unlock(cache->lock);
+  }
+
+  return rc;
+}
+
+
+int
+clcache_getclients(struct clcache *cache, struct icdb_context *icdb,
+                   uint32_t jobid, const char *type,
+                   struct icdb_client **clients, size_t *size, size_t *count)
+{
+  if (!cache || !clients || !size || !count)
+    return ICDB_EPARAM;
+
+  struct icdb_client_filter filter = { .jobid = 0, .type = NULL };
+  struct clcache_list *const *e;
+  char name[CLCACHE_NAME_LEN];
+  const char *t = type && type[0] ? type : NULL;
+  uint64_t gen;
+  int live, rc;
+
+  /* clients of a job are few, they are cached regardless of type */
+  if (jobid) {
+    snprintf(name, sizeof(name), "job:%"PRIu32, jobid);
+    filter.jobid = jobid;
+  } else if (t) {
+    snprintf(name, sizeof(name), "type:%s", t);
+    filter.type = t;
+    t = NULL;
+  } else {
+    strcpy(name, "all");
+  }
+
+  ABT_rwlock_rdlock(cache->lock);
+  live = cache->live;
+  gen = cache->gen;
+  if (live && (e = hm_get(cache->lists, name)) && (*e)->valid) {
+    rc = list_copy((*e)->clients, (*e)->count, t, clients, size, count);
+    ABT_rwlock_unlock(cache->lock);
+    STAT_INC(cache, hits);
+    return rc;
+  }
+  ABT_rwlock_unlock(cache->lock);
+  STAT_INC(cache, misses);
+
+  struct collect col = { .clients = NULL, .size = 0, .count = 0, .err = 0 };
+
+  rc = icdb_iter_clients(icdb, &filter, 0, collect_cb, &col);
+  if (rc == ICDB_SUCCESS && col.err)
+    rc = col.err;
+  if (rc == ICDB_SUCCESS)
+    rc = list_copy(col.clients, col.count, t, clients, size, count);
+
+  if (rc == ICDB_SUCCESS && live) {
+    ABT_rwlock_wrlock(cache->lock);
+    if (cache->gen == gen) {
+      put_list(cache, name, col.clients, col.count);
+      col.clients = NULL;
+    }
+    ABT_rwlock_unlock(cache->lock);
+  }
+  free_clients(col.clients, col.count);
+
+  return rc;
+}
+
+
+int
+clcache_setclient(struct clcache *cache, struct icdb_context *icdb,
+                  const char *clid, const char *type, const char *addr,
+                  const char *nodelist, uint16_t provid, uint32_t jobid,
+                  uint32_t jobncpus, const char *jobnodelist,
+                  uint64_t nprocs)
+{
+  if (!cache)
+    return ICDB_EPARAM;
+
+  int rc = icdb_setclient(icdb, clid, type, addr, nodelist, provid, jobid,
+                          jobncpus, jobnodelist, nprocs);
+  if (rc != ICDB_SUCCESS)
+    return rc;
+
+  struct clcache_client *const *e;
+  char name[CLCACHE_NAME_LEN];
+
+  ABT_rwlock_wrlock(cache->lock);
+
+  /* a known client only gets its address updated, as in the DB.
+     Otherwise there is no telling whether the DB record is new */
+  e = hm_get(cache->clients, clid);
+  if (e && (*e)->valid) {
+    strncpy((*e)->client.addr, addr, ICC_ADDR_LEN - 1);
+    (*e)->client.addr[ICC_ADDR_LEN - 1] = '\0';
+  } else {
+    invalidate_client(cache, clid);
+  }
+
+  snprintf(name, sizeof(name), "job:%"PRIu32, jobid);
+  invalidate_list(cache, name);
+  snprintf(name, sizeof(name), "type:%s", type);
+  invalidate_list(cache, name);
+  invalidate_list(cache, "all");
+  /* the job record is rewritten for new clients */
+  invalidate_job(cache, jobid);
+
+  ABT_rwlock_unlock(cache->lock);
+
+  return rc;
+}
+
+
+int
+clcache_delclient(struct clcache *cache, struct icdb_context *icdb,
+                  const char *clid, uint32_t *jobid)
+{
+  if (!cache)
+    return ICDB_EPARAM;
+
+  int rc = icdb_delclient(icdb, clid, jobid);
+  if (rc != ICDB_SUCCESS)
+    return rc;
+
+  char name[CLCACHE_NAME_LEN];
+
+  ABT_rwlock_wrlock(cache->lock);
+  invalidate_client(cache, clid);
+  snprintf(name, sizeof(name), "job:%"PRIu32, *jobid);
+  invalidate_list(cache, name);
+  invalidate_list(cache, "all");
+  ABT_rwlock_unlock(cache->lock);
+
+  return rc;
+}
+
+
+int
+clcache_deljob(struct clcache *cache, struct icdb_context *icdb, uint32_t jobid)
+{
+  if (!cache)
+    return ICDB_EPARAM;
+
+  int rc = icdb_deljob(icdb, jobid);
+  if (rc != ICDB_SUCCESS)
+    return rc;
+
+  const char *clid;
+  struct clcache_client *const *e;
+  char name[CLCACHE_NAME_LEN];
+  size_t curs = 0;
+
+  ABT_rwlock_wrlock(cache->lock);
+  while ((curs = hm_next(cache->clients, curs, &clid, (const void **)&e)) != 0) {
+    if ((*e)->valid && (*e)->client.jobid == jobid)
+      invalidate_client(cache, clid);
+  }
+  invalidate_job(cache, jobid);
+  snprintf(name, sizeof(name), "job:%"PRIu32, jobid);
+  invalidate_list(cache, name);
+  invalidate_list(cache, "all");
+  ABT_rwlock_unlock(cache->lock);
+
+  return rc;
+}
+
+
+static void
+listener_th(void *arg)
+{
+  struct clcache *cache = (struct clcache *)arg;
+  int ret;
+
+  while (!cache->terminate) {
+    if (!cache->icdb) {
+      ret = icdb_init(&cache->icdb, cache->dbaddr);
+      if (ret == ICDB_SUCCESS) {
+        ret = icdb_keyspace_subscribe(cache->icdb, CLCACHE_EVENTS, clcache_patterns,
+                                      sizeof(clcache_patterns) / sizeof(*clcache_patterns),
+                                      cache->wakechan);
+      }
+      if (ret != ICDB_SUCCESS) {
+        LOG_ERROR(cache->mid, "Client cache: could not subscribe to notifications: %s",
+                  cache->icdb ? icdb_errstr(cache->icdb) : "?");
+        icdb_fini(&cache->icdb);
+        sleep(CLCACHE_RETRY_S);
+        continue;
+      }
+
+      /* changes might have been missed while not subscribed */
+      ABT_rwlock_wrlock(cache->lock);
+      invalidate_all(cache);
+      cache->live = 1;
+      ABT_rwlock_unlock(cache->lock);
+
+      margo_info(cache->mid, "Client cache: receiving DB notifications");
+    }
+
+    ret = icdb_keyspace_wait(cache->icdb, notify, cache);
+    if (ret != ICDB_SUCCESS && ret != ICDB_NORESULT) {
+      LOG_ERROR(cache->mid, "Client cache: %s", icdb_errstr(cache->icdb));
+
+      /* stop caching until subscribed again */
+      ABT_rwlock_wrlock(cache->lock);
+      cache->live = 0;
+      invalidate_all(cache);
+      ABT_rwlock_unlock(cache->lock);
+
+      icdb_fini(&cache->icdb);
+    }
+  }
+}
+
+
+/**
+ * Invalidate the entries depending on KEY. Called by the listener.
+ */
+static void
+notify(const char *key, const char *event __attribute__((unused)), void *arg)
+{
+  struct clcache *cache = (struct clcache *)arg;
+  char buf[CLCACHE_NAME_LEN];
+
+  ABT_rwlock_wrlock(cache->lock);
+
+  if (!strncmp(key, "client:", 7)) {
+    /* client:<clid> or client:<clid>:<field> */
+    size_t len = strcspn(key + 7, ":");
+    if (len < UUID_STR_LEN) {
+      memcpy(buf, key + 7, len);
+      buf[len] = '\0';
+      invalidate_client(cache, buf);
+    }
+  } else if (!strncmp(key, "job:", 4)) {
+    /* job:<jobid> or job:<jobid>.<stepid> */
+    invalidate_job(cache, (uint32_t)strtoul(key + 4, NULL, 10));
+  } else if (!strncmp(key, "index:clients:jobid:", 20)) {
+    snprintf(buf, sizeof(buf), "job:%s", key + 20);
+    invalidate_list(cache, buf);
+  } else if (!strncmp(key, "index:clients:type:", 19)) {
+    snprintf(buf, sizeof(buf), "type:%s", key + 19);
+    invalidate_list(cache, buf);
+  } else if (!strcmp(key, "index:clients")) {
+    invalidate_list(cache, "all");
+  }
+
+  if (cache->ninvalid > CLCACHE_COMPACT)
+    compact(cache);
+
+  ABT_rwlock_unlock(cache->lock);
+}
+
+
+static void
+invalidate_client(struct clcache *cache, const char *clid)
+{
+  struct clcache_client *const *e = hm_get(cache->clients, clid);
+  char name[CLCACHE_NAME_LEN];
+
+  cache->gen++;
+
+  if (!e || !(*e)->valid)
+    return;
+
+  (*e)->valid = 0;
+  free((*e)->client.nodelist);
+  (*e)->client.nodelist = NULL;
+  cache->ninvalid++;
+  cache->stats.invalidations++;
+
+  snprintf(name, sizeof(name), "job:%"PRIu32, (*e)->client.jobid);
+  invalidate_list(cache, name);
+  snprintf(name, sizeof(name), "type:%s", (*e)->client.type);
+  invalidate_list(cache, name);
+  invalidate_list(cache, "all");
+}
+
+
+static void
+invalidate_job(struct clcache *cache, uint32_t jobid)
+{
+  struct clcache_job *const *e;
+  char key[16];
+
+  cache->gen++;
+
+  snprintf(key, sizeof(key), "%"PRIu32, jobid);
+  e = hm_get(cache->jobs, key);
+  if (!e || !(*e)->valid)
+    return;
+
+  (*e)->valid = 0;
+  free((*e)->job.nodelist);
+  (*e)->job.nodelist = NULL;
+  cache->ninvalid++;
+  cache->stats.invalidations++;
+}
+
+
+static void
+invalidate_list(struct clcache *cache, const char *name)
+{
+  struct clcache_list *const *e = hm_get(cache->lists, name);
+
+  cache->gen++;
+
+  if (!e || !(*e)->valid)
+    return;
+
+  (*e)->valid = 0;
+  free((*e)->clients);
+  (*e)->clients = NULL;
+  (*e)->count = 0;
+  cache->ninvalid++;
+  cache->stats.invalidations++;
+}
+
+
+static void
+invalidate_all(struct clcache *cache)
+{
+  const char *key;
+  const void *e;
+  size_t curs;
+
+  curs = 0;
+  while ((curs = hm_next(cache->clients, curs, &key, &e)) != 0) {
+    invalidate_client(cache, key);
+  }
+  curs = 0;
+  while ((curs = hm_next(cache->jobs, curs, &key, &e)) != 0) {
+    invalidate_job(cache, (uint32_t)strtoul(key, NULL, 10));
+  }
+  curs = 0;
+  while ((curs = hm_next(cache->lists, curs, &key, &e)) != 0) {
+    invalidate_list(cache, key);
+  }
+
+  compact(cache);
+}
+
+
+/**
+ * Rebuild MAP without its invalid entries. Every entry type starts
+ * with its valid flag.
+ */
+static void
+compact_map(margo_instance_id mid, hm_t **map)
+{
+  hm_t *newmap = hm_create();
+  if (!newmap) {
+    LOG_ERROR(mid, "Client cache: could not compact map");
+    return;
+  }
+
+  const char *key;
+  int *const *e;
+  size_t curs = 0;
+
+  while ((curs = hm_next(*map, curs, &key, (const void **)&e)) != 0) {
+    if (**e) {
+      if (hm_set(newmap, key, (void *)e, sizeof(*e)) == -1) {
+        LOG_ERROR(mid, "Client cache: could not compact map");
+        hm_free(newmap);
+        return;
+      }
+    }
+  }
+
+  /* only drop entries once they are all in the new map */
+  curs = 0;
+  while ((curs = hm_next(*map, curs, &key, (const void **)&e)) != 0) {
+    if (!**e)
+      free(*e);
+  }
+
+  hm_free(*map);
+  *map = newmap;
+}
+
+
+static void
+compact(struct clcache *cache)
+{
+  compact_map(cache->mid, &cache->clients);
+  compact_map(cache->mid, &cache->jobs);
+  compact_map(cache->mid, &cache->lists);
+  cache->ninvalid = 0;
+}
+
+
+static void
+put_client(struct clcache *cache, const struct icdb_client *client)
+{
+  struct clcache_client *const *e = hm_get(cache->clients, client->clid);
+  char *nodelist = NULL;
+
+  if (client->nodelist && !(nodelist = strdup(client->nodelist)))
+    return;
+
+  if (e) {
+    if (!(*e)->valid)
+      cache->ninvalid--;
+    free((*e)->client.nodelist);
+    (*e)->valid = 1;
+    (*e)->client = *client;
+    (*e)->client.nodelist = nodelist;
+    return;
+  }
+
+  struct clcache_client *new = malloc(sizeof(*new));
+  if (!new) {
+    free(nodelist);
+    return;
+  }
+
+  new->valid = 1;
+  new->client = *client;
+  new->client.nodelist = nodelist;
+  if (hm_set(cache->clients, client->clid, &new, sizeof(new)) == -1) {
+    free(nodelist);
+    free(new);
+  }
+}
+
+
+static void
+put_job(struct clcache *cache, const struct icdb_job *job)
+{
+  struct clcache_job *const *e;
+  struct clcache_job *new = NULL;
+  char key[16];
+  char *nodelist = NULL;
+
+  if (job->nodelist && !(nodelist = strdup(job->nodelist)))
+    return;
+
+  snprintf(key, sizeof(key), "%"PRIu32, job->jobid);
+  e = hm_get(cache->jobs, key);
+
+  if (e) {
+    if (!(*e)->valid)
+      cache->ninvalid--;
+    free((*e)->job.nodelist);
+    (*e)->valid = 1;
+    (*e)->job = *job;
+    (*e)->job.nodelist = nodelist;
+    return;
+  }
+
+  new = malloc(sizeof(*new));
+  if (!new) {
+    free(nodelist);
+    return;
+  }
+
+  new->valid = 1;
+  new->job = *job;
+  new->job.nodelist = nodelist;
+  if (hm_set(cache->jobs, key, &new, sizeof(new)) == -1) {
+    free(nodelist);
+    free(new);
+  }
+}
+
+
+static void
+put_list(struct clcache *cache, const char *name,
+         struct icdb_client *clients, size_t count)
+{
+  struct clcache_list *const *e = hm_get(cache->lists, name);
+
+  /* a cached client must be cached along with the lists it belongs
+     to, for these to be invalidated with it. Lists do not keep the
+     nodelists, only the clients do */
+  for (size_t i = 0; i < count; i++) {
+    put_client(cache, &clients[i]);
+    free(clients[i].nodelist);
+    clients[i].nodelist = NULL;
+  }
+
+  if (e) {
+    if (!(*e)->valid)
+      cache->ninvalid--;
+    free((*e)->clients);
+    (*e)->valid = 1;
+    (*e)->clients = clients;
+    (*e)->count = count;
+    return;
+  }
+
+  struct clcache_list *new = malloc(sizeof(*new));
+  if (!new) {
+    free(clients);
+    return;
+  }
+
+  new->valid = 1;
+  new->clients = clients;
+  new->count = count;
+  if (hm_set(cache->lists, name, &new, sizeof(new)) == -1) {
+    free(clients);
+    free(new);
+  }
+}
+
+
+static int
+collect_cb(const struct icdb_client *client, void *arg)
+{
+  struct collect *col = (struct collect *)arg;
+
+  if (col->count == col->size) {
+    size_t size = col->size ? 2 * col->size : 16;
+    struct icdb_client *tmp = reallocarray(col->clients, size, sizeof(*tmp));
+    if (!tmp) {
+      col->err = ICDB_ENOMEM;
+      return 1;
+    }
+    col->clients = tmp;
+    col->size = size;
+  }
+  /* the nodelist lives in the context arena, it is copied for the
+     client to be cached with it */
+  col->clients[col->count] = *client;
+  if (client->nodelist &&
+      !(col->clients[col->count].nodelist = strdup(client->nodelist))) {
+    col->err = ICDB_ENOMEM;
+    return 1;
+  }
+  col->count++;
+
+  return 0;
+}
+
+
+static int
+list_copy(const struct icdb_client *src, size_t n, const char *type,
+          struct icdb_client **clients, size_t *size, size_t *count)
+{
+  if (n > *size) {
+    struct icdb_client *tmp = reallocarray(*clients, n, sizeof(*tmp));
+    if (!tmp)
+      return ICDB_ENOMEM;
+    *clients = tmp;
+    *size = n;
+  }
+
+  *count = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (!type || !strncmp(src[i].type, type, ICC_TYPE_LEN)) {
+      (*clients)[*count] = src[i];
+      (*clients)[(*count)++].nodelist = NULL;
+    }
+  }
+
+  return ICDB_SUCCESS;
+}
+
+
+static void
+free_clients(struct icdb_client *clients, size_t count)
+{
+  if (!clients)
+    return;
+
+  for (size_t i = 0; i < count; i++)
+    free(clients[i].nodelist);
+  free(clients);
+}
+
+
+static void
+free_maps(struct clcache *cache)
+{
+  const char *key;
+  size_t curs;
+
+  if (cache->clients) {
+    struct clcache_client *const *e;
+    curs = 0;
+    while ((curs = hm_next(cache->clients, curs, &key, (const void **)&e)) != 0) {
+      free((*e)->client.nodelist);
+      free(*e);
+    }
+    hm_free(cache->clients);
+  }
+
+  if (cache->jobs) {
+    struct clcache_job *const *e;
+    curs = 0;
+    while ((curs = hm_next(cache->jobs, curs, &key, (const void **)&e)) != 0) {
+      free((*e)->job.nodelist);
+      free(*e);
+    }
+    hm_free(cache->jobs);
+  }
+
+  if (cache->lists) {
+    struct clcache_list *const *e;
+    curs = 0;
+    while ((curs = hm_next(cache->lists, curs, &key, (const void **)&e)) != 0) {
+      free((*e)->clients);
+      free(*e);
+    }
+    hm_free(cache->lists);
+  }
+}
@@ -0,0 +1,101 @@
+/**
+ * CRC32C, with the SSE 4.2 instruction when the CPU has it and a
+ * slicing-by-8 table otherwise.
+ */
+
+#include "crc32c.h"
+
+#include <string.h>             /* memcpy */
+
+
+#define POLY 0x82f63b78         /* reversed Castagnoli polynomial */
+
+static uint32_t table[8][256];
+
+__attribute__((constructor))
+static void
+crc32c_init(void)
+{
+  for (uint32_t n = 0; n < 256; n++) {
+    uint32_t crc = n;
+    for (int k = 0; k < 8; k++)
+      crc = crc & 1 ? (crc >> 1) ^ POLY : crc >> 1;
+    table[0][n] = crc;
+  }
+
+  for (uint32_t n = 0; n < 256; n++) {
+    uint32_t crc = table[0][n];
+    for (int k = 1; k < 8; k++) {
+      crc = table[0][crc & 0xff] ^ (crc >> 8);
+      table[k][n] = crc;
+    }
+  }
+}
+
+
+static uint32_t
+crc32c_sw(uint32_t crc, const unsigned char *p, size_t len)
+{
+  while (len >= 8) {
+    uint64_t w;
+    memcpy(&w, p, 8);
+    /* little-endian: the low bytes come first */
+    w ^= crc;
+    crc = table[7][w & 0xff] ^ table[6][(w >> 8) & 0xff] ^
+      table[5][(w >> 16) & 0xff] ^ table[4][(w >> 24) & 0xff] ^
+      table[3][(w >> 32) & 0xff] ^ table[2][(w >> 40) & 0xff] ^
+      table[1][(w >> 48) & 0xff] ^ table[0][w >> 56];
+    p += 8;
+    len -= 8;
+  }
+
+  while (len--)
+    crc = table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+  return crc;
+}
+
+
+#if defined(__x86_64__) && defined(__GNUC__)
+__attribute__((target("sse4.2")))
+static uint32_t
+crc32c_hw(uint32_t crc, const unsigned char *p, size_t len)
+{
+  uint64_t c = crc;
+
+  while (len >= 8) {
+    uint64_t w;
+    memcpy(&w, p, 8);
+    c = __builtin_ia32_crc32di(c, w);
+    p += 8;
+    len -= 8;
+  }
+
+  while (len--)
+    c = __builtin_ia32_crc32qi((uint32_t)c, *p++);
+
+  return (uint32_t)c;
+}
+#endif
+
+
+uint32_t
+crc32c(uint32_t crc, const void *buf, size_t len)
+{
+  crc = ~crc;
+
+#if defined(__x86_64__) && defined(__GNUC__)
+  if (__builtin_cpu_supports("sse4.2"))
+    return ~crc32c_hw(crc, buf, len);
+#endif
+
+  /* the table version assumes a little-endian host */
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  return ~crc32c_sw(crc, buf, len);
+#else
+  const unsigned char *p = buf;
+  while (len--)
+    crc = table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+  return ~crc;
+#endif
+}
@@ -0,0 +1,310 @@
+#include <inttypes.h>           /* PRIuXX */
+#include <stdio.h>              /* snprintf */
+#include <stdlib.h>             /* calloc, realloc */
+#include <string.h>             /* strdup, strncmp, strncpy */
+#include <margo.h>
+
+#include "rpc.h"                /* LOG_ERROR */
+#include "icstats.h"
+#include "evqueue.h"
+
+struct evqueue {
+  margo_instance_id     mid;
+  char                 *name;
+  size_t                capacity;
+  enum evq_policy       policy;
+
+  ABT_mutex             lock;   /* protects everything below */
+  ABT_cond              nonempty;
+  struct evq_event     *events; /* ring of CAPACITY events */
+  size_t                head;   /* oldest event */
+  size_t                len;
+  int                   closed;
+
+  struct evqueue_stats  stats;
+
+  struct icstats_gauge *depth;
+  struct icstats_gauge *coalesced;
+  struct icstats_gauge *dropped;
+  struct icstats_hist  *waited;
+};
+
+static struct evq_event *find(struct evqueue *queue, const struct evq_event *ev,
+                              enum evq_coalesce how);
+static void drop_oldest(struct evqueue *queue);
+static int add_client(struct evq_event *e, const char *clid);
+
+
+int
+evqueue_init(struct evqueue **queue, margo_instance_id mid, const char *name,
+             size_t capacity, enum evq_policy policy)
+{
+  char statname[128];
+  int rc;
+
+  *queue = NULL;
+
+  struct evqueue *q = calloc(1, sizeof(*q));
+  if (!q) {
+    LOG_ERROR(mid, "Failed calloc");
+    return -1;
+  }
+
+  q->mid = mid;
+  q->capacity = capacity ? capacity : EVQUEUE_CAPACITY_DEFAULT;
+  q->policy = policy;
+  q->lock = ABT_MUTEX_NULL;
+  q->nonempty = ABT_COND_NULL;
+
+  q->name = strdup(name);
+  q->events = calloc(q->capacity, sizeof(*q->events));
+  if (!q->name || !q->events) {
+    LOG_ERROR(mid, "Failed allocation");
+    goto error;
+  }
+
+  rc = ABT_mutex_create(&q->lock);
+  if (rc != ABT_SUCCESS) {
+    q->lock = ABT_MUTEX_NULL;
+    LOG_ERROR(mid, "Could not create mutex (ret = %d)", rc);
+    goto error;
+  }
+
+  rc = ABT_cond_create(&q->nonempty);
+  if (rc != ABT_SUCCESS) {
+    q->nonempty = ABT_COND_NULL;
+    LOG_ERROR(mid, "Could not create condition (ret = %d)", rc);
+    goto error;
+  }
+
+  /* NULL if the registry is full, recording to them does nothing */
+  q->depth = icstats_gauge("queue", name);
+  q->waited = icstats_hist("queue", name);
+  snprintf(statname, sizeof(statname), "%s_coalesced", name);
+  q->coalesced = icstats_gauge("queue", statname);
+  snprintf(statname, sizeof(statname), "%s_dropped", name);
+  q->dropped = icstats_gauge("queue", statname);
+
+  *queue = q;
+  return 0;
+
+ error:
+  evqueue_fini(&q);
+  return -1;
+}
+
+
+void
+evqueue_fini(struct evqueue **queue)
+{
+  if (!queue || !*queue)
+    return;
+
+  struct evqueue *q = *queue;
+  struct evqueue_stats *s = &q->stats;
+
+  margo_info(q->mid, "Event queue %s: %"PRIu64" pushed, %"PRIu64" coalesced, "
+             "%"PRIu64" dropped, %"PRIu64" popped, max depth %zu/%zu",
+             q->name ? q->name : "", s->pushed, s->coalesced, s->dropped,
+             s->popped, s->maxdepth, q->capacity);
+
+  /* events still pending are lost */
+  icstats_gauge_add(q->depth, -(int64_t)q->len);
+  for (size_t i = 0; i < q->len; i++)
+    evqueue_event_free(&q->events[(q->head + i) % q->capacity]);
+
+  if (q->nonempty != ABT_COND_NULL)
+    ABT_cond_free(&q->nonempty);
+  if (q->lock != ABT_MUTEX_NULL)
+    ABT_mutex_free(&q->lock);
+
+  free(q->events);
+  free(q->name);
+  free(q);
+
+  *queue = NULL;
+}
+
+
+int
+evqueue_push(struct evqueue *queue, const struct evq_event *ev,
+             enum evq_coalesce how)
+{
+  struct evq_event *e;
+
+  ABT_mutex_lock(queue->lock);
+
+  if (queue->closed) {
+    ABT_mutex_unlock(queue->lock);
+    return -1;
+  }
+
+  queue->stats.pushed++;
+
+  e = find(queue, ev, how);
+  /* queued on its own if its client cannot be listed */
+  if (e && (how != EVQ_COALESCE_JOB || add_client(e, ev->clid) == 0)) {
+    memcpy(e->args, ev->args, sizeof(e->args));
+    e->count++;
+    queue->stats.coalesced++;
+    ABT_mutex_unlock(queue->lock);
+    icstats_gauge_add(queue->coalesced, 1);
+    return 1;
+  }
+
+  if (queue->len == queue->capacity) {
+    queue->stats.dropped++;
+    icstats_gauge_add(queue->dropped, 1);
+    if (queue->policy == EVQ_DROP_NEWEST) {
+      ABT_mutex_unlock(queue->lock);
+      return -1;
+    }
+    drop_oldest(queue);
+  }
+
+  e = &queue->events[(queue->head + queue->len) % queue->capacity];
+  *e = *ev;
+  e->count = 1;
+  e->queued = icstats_now();
+  e->clids = NULL;
+
+  queue->len++;
+  if (queue->len > queue->stats.maxdepth)
+    queue->stats.maxdepth = queue->len;
+  icstats_gauge_add(queue->depth, 1);
+
+  ABT_cond_signal(queue->nonempty);
+  ABT_mutex_unlock(queue->lock);
+
+  return 0;
+}
+
+
+int
+evqueue_pop(struct evqueue *queue, struct evq_event *ev)
+{
+  ABT_mutex_lock(queue->lock);
+
+  while (queue->len == 0 && !queue->closed)
+    ABT_cond_wait(queue->nonempty, queue->lock);
+
+  if (queue->closed) {
+    ABT_mutex_unlock(queue->lock);
+    return -1;
+  }
+
+  *ev = queue->events[queue->head];
+  queue->head = (queue->head + 1) % queue->capacity;
+  queue->len--;
+  queue->stats.popped++;
+
+  ABT_mutex_unlock(queue->lock);
+
+  icstats_gauge_add(queue->depth, -1);
+  icstats_record(queue->waited, icstats_now() - ev->queued);
+
+  return 0;
+}
+
+
+void
+evqueue_event_free(struct evq_event *ev)
+{
+  free(ev->clids);
+  ev->clids = NULL;
+}
+
+
+void
+evqueue_close(struct evqueue *queue)
+{
+  if (!queue)
+    return;
+
+  ABT_mutex_lock(queue->lock);
+  icstats_gauge_add(queue->depth, -(int64_t)queue->len);
+  for (size_t i = 0; i < queue->len; i++)
+    evqueue_event_free(&queue->events[(queue->head + i) % queue->capacity]);
+  queue->len = 0;
+  queue->closed = 1;
+  ABT_cond_broadcast(queue->nonempty);
+  ABT_mutex_unlock(queue->lock);
+}
+
+
+void
+evqueue_stats(struct evqueue *queue, struct evqueue_stats *stats)
+{
+  if (!queue || !stats)
+    return;
+
+  ABT_mutex_lock(queue->lock);
+  *stats = queue->stats;
+  ABT_mutex_unlock(queue->lock);
+}
+
+
+/**
+ * Return the pending event of QUEUE that EV coalesces with according
+ * to HOW, or NULL. Called with the lock held.
+ *
+ * The queue is short in practice, a linear scan beats maintaining an
+ * index of the ring.
+ */
+static struct evq_event *
+find(struct evqueue *queue, const struct evq_event *ev, enum evq_coalesce how)
+{
+  if (how == EVQ_COALESCE_NONE)
+    return NULL;
+
+  for (size_t i = 0; i < queue->len; i++) {
+    struct evq_event *e = &queue->events[(queue->head + i) % queue->capacity];
+
+    if (e->code != ev->code || e->jobid != ev->jobid)
+      continue;
+    if (how == EVQ_COALESCE_CLIENT && strncmp(e->clid, ev->clid, UUID_STR_LEN))
+      continue;
+    return e;
+  }
+  return NULL;
+}
+
+/**
+ * Discard the oldest event of QUEUE. Called with the lock held.
+ */
+static void
+drop_oldest(struct evqueue *queue)
+{
+  struct evq_event *e = &queue->events[queue->head];
+
+  margo_warning(queue->mid, "Event queue %s full, dropping event %d of job %"PRIu32,
+                queue->name, e->code, e->jobid);
+  evqueue_event_free(e);
+
+  queue->head = (queue->head + 1) % queue->capacity;
+  queue->len--;
+  icstats_gauge_add(queue->depth, -1);
+}
+
+/**
+ * Add CLID to the clients of pending event E, which becomes one more
+ * event. Called with the lock held.
+ *
+ * Returns 0 or -1 if out of memory.
+ */
+static int
+add_client(struct evq_event *e, const char *clid)
+{
+  /* the list doubles when COUNT reaches a power of two */
+  if ((e->count & (e->count - 1)) == 0) {
+    char (*clids)[UUID_STR_LEN] = realloc(e->clids, 2 * e->count * sizeof(*clids));
+    if (!clids)
+      return -1;
+    if (!e->clids)
+      memcpy(clids[0], e->clid, UUID_STR_LEN);
+    e->clids = clids;
+  }
+  strncpy(e->clids[e->count], clid, UUID_STR_LEN - 1);
+  e->clids[e->count][UUID_STR_LEN - 1] = '\0';
+  return 0;
+}
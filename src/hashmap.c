@@ -3,40 +3,149 @@
  * https://benhoyt.com/writings/hash-table-in-c/.
  *
  * Definitely NOT thread-safe, protect with a rw-lock.  Both key and
- * value are allocated on hm_set, and can be freed by the caller
+ * value are copied on hm_set, and can be freed by the caller
  * afterwards. On the other hand, memory returned by hm_get should not
  * be modified.
+ *
+ * Open addressing with Robin Hood probing: on insertion, an item
+ * further from its home slot than the one in place takes the slot,
+ * which keeps probe sequences short even at high load. Deletion
+ * shifts the following items back instead of leaving tombstones.
+ * Hashes are cached in the slots, and small keys and values are
+ * stored inline, so that most operations do not allocate.
+ *
+ * A string table is a map whose keys are copied to an arena, never
+ * moved nor freed until the table is. Maps created on top of a string
+ * table store a pointer to the table copy of their keys, so that
+ * tables indexed by the same names (e.g. hosts) share a single copy.
  */
 
 #include "hashmap.h"
+#include "arena.h"
+#include "crc32c.h"
 
+#include <errno.h>
+#include <fcntl.h>              /* open */
+#include <limits.h>             /* PATH_MAX */
 #include <stdlib.h>             /* malloc */
 #include <stdint.h>             /* uint64_t */
 #include <string.h>             /* strdup */
 #include <stdio.h>
 #include <inttypes.h>
+#include <sys/mman.h>           /* mmap */
+#include <sys/stat.h>
+#include <unistd.h>             /* fsync */
+
+
+#define INITIAL_NSLOTS 32       /* initial capacity, power of 2 */
 
+#define KEY_INLINE   24         /* keys shorter than this are inline */
+#define VALUE_INLINE 16         /* values up to this size are inline */
 
-#define INITIAL_NSLOTS 32       /* initial capacity of the hashmap */
+/* max load factor, in percent */
+#define MAX_LOAD 75
 
-#define SIZE 512
+/* define HM_DEBUG to trace every operation on stderr */
+#ifdef HM_DEBUG
+#define HM_LOG(...) fprintf(stderr, __VA_ARGS__)
+#else
+#define HM_LOG(...) do { } while (0)
+#endif
 
 typedef struct {
-  const char *key;              /* NULL if slot is empty */
-  void       *value;
-  size_t     size; /* Specify the size of the memory allocated */
+  uint64_t hash;
+  uint32_t dist;                /* probe distance + 1, 0 if slot is empty */
+  uint32_t keylen;
+  size_t   size;                /* size of the value */
+  union {
+    char     inl[KEY_INLINE];
+    char    *ptr;
+    uint64_t off;               /* in a snapshot */
+  } key;
+  union {
+    unsigned char inl[VALUE_INLINE];
+    void         *ptr;
+    uint64_t      off;          /* in a snapshot, aligns too */
+  } value;
 } hm_item;
 
 struct hashmap {
   hm_item  *items;
   size_t   nitems;              /* current length */
-  size_t   nslots;              /* total capacity */
+  size_t   nslots;              /* total capacity, power of 2 */
+  struct arena   *arena;        /* keys of a string table */
+  struct hashmap *strings;      /* string table holding the keys */
+  void           *mapping;      /* loaded snapshot holding the items */
+  size_t          maplen;
+  const char     *data;         /* out-of-line keys and values in it */
 };
 
+/* keys are pointers not owned by the slot */
+#define EXTKEYS(map) ((map)->arena || (map)->strings)
+
+
+static uint64_t hash_key(const char *key, size_t *len);
+static int hm_resize(struct hashmap *map, size_t nslots);
+static size_t hm_find(const struct hashmap *map, const char *key);
+static void hm_place(hm_item *items, size_t nslots, hm_item item);
+static int hm_unmap(struct hashmap *map);
+
+#define FNV_OFFSET 14695981039346656037UL
+#define FNV_PRIME 1099511628211UL
+
+
+static inline const char *
+item_key(const struct hashmap *map, const hm_item *item)
+{
+  if (item->keylen < KEY_INLINE && !EXTKEYS(map))
+    return item->key.inl;
+  return map->data ? map->data + item->key.off : item->key.ptr;
+}
+
+static inline const void *
+item_value(const struct hashmap *map, const hm_item *item)
+{
+  if (item->size <= VALUE_INLINE)
+    return item->value.inl;
+  return map->data ? map->data + item->value.off : item->value.ptr;
+}
+
+static inline void
+item_clear(const struct hashmap *map, hm_item *item)
+{
+  if (item->keylen >= KEY_INLINE && !EXTKEYS(map))
+    free(item->key.ptr);
+  if (item->size > VALUE_INLINE)
+    free(item->value.ptr);
+  item->dist = 0;
+}
+
+/**
+ * Copy VALUE of SIZE into ITEM, freeing the previous value if any.
+ * Values that stay inline are overwritten in place.
+ *
+ * Return 0 or -1 in case of a memory error.
+ */
+static int
+item_setvalue(hm_item *item, const void *value, size_t size, int replace)
+{
+  if (size <= VALUE_INLINE) {
+    if (replace && item->size > VALUE_INLINE)
+      free(item->value.ptr);
+    memcpy(item->value.inl, value, size);
+  } else {
+    void *val = malloc(size);
+    if (val == NULL)
+      return -1;
+    memcpy(val, value, size);
+    if (replace && item->size > VALUE_INLINE)
+      free(item->value.ptr);
+    item->value.ptr = val;
+  }
+  item->size = size;
 
-static uint64_t hash_key(const char *key);
-static struct hashmap *hm_expand(struct hashmap *map);
-static int hm_set_internal(hm_item *items, size_t size, const char *k, void *v, size_t datatype_size);
+  return 0;
+}
 
 
 struct hashmap *
@@ -49,6 +158,11 @@ hm_create(void)
 
   map->nslots = INITIAL_NSLOTS;
   map->nitems = 0;
+  map->arena = NULL;
+  map->strings = NULL;
+  map->mapping = NULL;
+  map->maplen = 0;
+  map->data = NULL;
 
   map->items = calloc(INITIAL_NSLOTS, sizeof(*map->items));
   if (map->items == NULL) {
@@ -60,19 +174,74 @@ hm_create(void)
 }
 
 
+struct hashmap *
+hm_create_strings(void)
+{
+  struct hashmap *map = hm_create();
+  if (map == NULL)
+    return NULL;
+
+  map->arena = arena_create(0);
+  if (map->arena == NULL) {
+    hm_free(map);
+    return NULL;
+  }
+
+  return map;
+}
+
+
+struct hashmap *
+hm_create_interned(struct hashmap *strings)
+{
+  if (strings == NULL || strings->arena == NULL)
+    return NULL;
+
+  struct hashmap *map = hm_create();
+  if (map == NULL)
+    return NULL;
+
+  map->strings = strings;
+
+  return map;
+}
+
+
+const char *
+hm_intern(struct hashmap *strings, const char *str)
+{
+  size_t i = hm_find(strings, str);
+
+  if (i == strings->nslots) {
+    char none = 0;
+    if (hm_set(strings, str, &none, 0) == -1)
+      return NULL;
+    i = hm_find(strings, str);
+  }
+
+  return strings->items[i].key.ptr;
+}
+
+
 void
 hm_free(struct hashmap *map)
 {
-  hm_item item;
+  if (map == NULL)
+    return;
+
+  if (map->mapping) {
+    munmap(map->mapping, map->maplen);
+    free(map);
+    return;
+  }
 
   for (size_t i = 0; i < map->nslots; i++) {
-    item = map->items[i];
-    if (item.key) {
-      free((char *)item.key);
-      free(item.value);
-    }
+    if (map->items[i].dist)
+      item_clear(map, &map->items[i]);
   }
 
+  /* all the keys of a string table at once */
+  arena_free(map->arena);
   free(map->items);
   free(map);
 }
@@ -81,71 +250,129 @@ hm_free(struct hashmap *map)
 const void *
 hm_get(struct hashmap* map, const char *key)
 {
-  uint64_t hash;
-  size_t index;
-  
-  fprintf(stderr, "HM_GET: key = %s\n", key);
+  size_t i = hm_find(map, key);
 
-  hash = hash_key(key);
-  index = hash % map->nslots;
-
-  while (map->items[index].key != NULL) {
-    if (!strcmp(key, map->items[index].key)) {
-      fprintf(stderr, "HM_GET: key found %s\n", key);
-      return map->items[index].value;     /* key found */
-    }
-
-    index = (index + 1) % map->nslots;    /* key not found, linear probe + wrap */
+  if (i == map->nslots) {
+    HM_LOG("HM_GET: key not found %s\n", key);
+    return NULL;
   }
 
-  /* warning: the loop is only exited on reaching the right key or
-     NULL, so the map must never be completely full, otherwise an
-     inexistent key will trigger an infinite loop */
-
-  fprintf(stderr, "HM_GET: key not found %s\n", key);
-  return NULL;
+  return item_value(map, &map->items[i]);
 }
 
 
 int
 hm_set(struct hashmap *map, const char *key, void *value, size_t size)
 {
-  int rc;
-  void *val;
-
   if (value == NULL) {
     return -1;
   }
 
-  fprintf(stderr, "HM_SET: Key %s\n", key);
+  HM_LOG("HM_SET: key %s, size %zu\n", key, size);
+
+  if (map->mapping && hm_unmap(map) == -1)
+    return -1;
 
-  if (map->nitems >= map->nslots / 2) {
-    fprintf(stderr, "HM_SET: nitems >= nslots\n");
-    if (hm_expand(map) == NULL)   /* memory error */
+  /* updates never move items, so that they can be done while
+     iterating */
+  size_t i = hm_find(map, key);
+  if (i != map->nslots) {
+    return item_setvalue(&map->items[i], value, size, 1);
+  }
+
+  if ((map->nitems + 1) * 100 > map->nslots * MAX_LOAD) {
+    if (map->nslots * 2 < map->nslots ||  /* overflow */
+        hm_resize(map, map->nslots * 2) == -1)
       return -1;
   }
 
-  val = malloc(size);
-  if (val == NULL) {
+  hm_item item;
+  size_t len;
+
+  item.hash = hash_key(key, &len);
+  item.dist = 1;
+  if (len > UINT32_MAX)
+    return -1;
+  item.keylen = (uint32_t)len;
+
+  if (map->arena) {
+    item.key.ptr = arena_strndup(map->arena, key, len);
+  } else if (map->strings) {
+    item.key.ptr = (char *)hm_intern(map->strings, key);
+  } else if (len < KEY_INLINE) {
+    memcpy(item.key.inl, key, len + 1);
+  } else {
+    item.key.ptr = strdup(key);
+  }
+  if ((len >= KEY_INLINE || EXTKEYS(map)) && item.key.ptr == NULL)
+    return -1;
+
+  /* a table key left in the arena is only lost until the table is
+     freed */
+  if (item_setvalue(&item, value, size, 0) == -1) {
+    if (len >= KEY_INLINE && !EXTKEYS(map))
+      free(item.key.ptr);
     return -1;
   }
-  memcpy(val, value, size);
 
-  fprintf(stderr, "HM_SET (call to hm_set_internal): Key %s, value %hu, size %lu\n", key, *(uint16_t*)val, size);
-  rc = hm_set_internal(map->items, map->nslots, key, val, size);
-  fprintf(stderr, "HM_SET_INTERNAL: Return %d\n", rc); 
+  hm_place(map->items, map->nslots, item);
+  map->nitems++;
 
+  return 1;
+}
 
-  /* ALBERTO - Debug with hm_get to check if the value can be obtained later */
-  //void * query = (void*)hm_get(map, key);
 
-  // 0 if an existing item was updated, 1 if a new item was created and -1 in case of a memory error.
-  if (rc != -1) {
-    map->nitems += rc;
+int
+hm_del(struct hashmap *map, const char *key)
+{
+  size_t i = hm_find(map, key);
+  size_t mask = map->nslots - 1;
+
+  if (i == map->nslots)
+    return 0;
+
+  if (map->mapping && hm_unmap(map) == -1)
+    return -1;
+
+  HM_LOG("HM_DEL: key %s\n", key);
+
+  item_clear(map, &map->items[i]);
+
+  /* backward shift: pull the following items of the cluster one slot
+     closer to their home, until an empty slot or an item already
+     home */
+  size_t next = (i + 1) & mask;
+  while (map->items[next].dist > 1) {
+    map->items[i] = map->items[next];
+    map->items[i].dist--;
+    i = next;
+    next = (next + 1) & mask;
   }
+  map->items[i].dist = 0;
+  map->nitems--;
 
-  fprintf(stderr, "HM_SET: end\n");
-  return rc;
+  return 1;
+}
+
+
+int
+hm_reserve(struct hashmap *map, size_t nitems)
+{
+  size_t nslots = map->nslots;
+
+  while (nitems * 100 > nslots * MAX_LOAD) {
+    if (nslots * 2 < nslots)    /* overflow */
+      return -1;
+    nslots *= 2;
+  }
+
+  if (nslots == map->nslots)
+    return 0;
+
+  if (map->mapping && hm_unmap(map) == -1)
+    return -1;
+
+  return hm_resize(map, nslots);
 }
 
 
@@ -160,12 +387,11 @@ size_t
 hm_next(struct hashmap *map, size_t cursor, const char **key, const void **value)
 {
   for (size_t i = cursor; i < map->nslots; i++) {
-    if (map->items[i].key) {
-      *key = map->items[i].key;
+    if (map->items[i].dist) {
+      *key = item_key(map, &map->items[i]);
       if (value) {
-        *value = map->items[i].value;
+        *value = item_value(map, &map->items[i]);
       }
-      //return (i + 1) % map->nslots;
       return (i + 1);
     }
   }
@@ -175,11 +401,23 @@ hm_next(struct hashmap *map, size_t cursor, const char **key, const void **value
 }
 
 
-#define FNV_OFFSET 14695981039346656037UL
-#define FNV_PRIME 1099511628211UL
+size_t
+hm_keys(struct hashmap *map, const char **keys, size_t size)
+{
+  size_t n = 0;
+
+  for (size_t i = 0; i < map->nslots && n < size; i++) {
+    if (map->items[i].dist)
+      keys[n++] = item_key(map, &map->items[i]);
+  }
+
+  return map->nitems;
+}
+
 
 /**
- * Return the FNV-1a hash of the NULL terminated KEY.
+ * Return the FNV-1a hash of the NULL terminated KEY, and its length
+ * in LEN.
  *
  * Description:
  * https://en.wikipedia.org/wiki/Fowler–Noll–Vo_hash_function
@@ -187,242 +425,473 @@ hm_next(struct hashmap *map, size_t cursor, const char **key, const void **value
  * FIXME: Should we use the more secure SipHash?
  */
 static uint64_t
-hash_key(const char *key)
+hash_key(const char *key, size_t *len)
 {
   uint64_t hash = FNV_OFFSET;
-  for (const char *p = key; *p; p++) {
+  const char *p;
+  for (p = key; *p; p++) {
     hash ^= (uint64_t)(unsigned char)(*p);
     hash *= FNV_PRIME;
   }
+  *len = p - key;
   return hash;
 }
 
 
 /**
- * Set KEY to VALUE in the item list pointed by ITEMS.
+ * Return the slot of KEY in MAP, or MAP->nslots if not present.
+ */
+static size_t
+hm_find(const struct hashmap *map, const char *key)
+{
+  size_t len, mask = map->nslots - 1;
+  uint64_t hash = hash_key(key, &len);
+  size_t index = hash & mask;
+
+  /* an item is never further from home than the ones before it, so
+     the search stops at the first item closer to its home slot than
+     KEY would be */
+  for (uint32_t dist = 1; ; dist++) {
+    const hm_item *item = &map->items[index];
+
+    if (item->dist < dist)
+      return map->nslots;
+    if (item->hash == hash && item->keylen == len &&
+        !memcmp(item_key(map, item), key, len))
+      return index;
+
+    index = (index + 1) & mask;
+  }
+}
+
+
+/**
+ * Insert ITEM, not present yet, into the slots ITEMS. There must be a
+ * free slot.
+ */
+static void
+hm_place(hm_item *items, size_t nslots, hm_item item)
+{
+  size_t mask = nslots - 1;
+  size_t index = item.hash & mask;
+
+  item.dist = 1;
+  while (items[index].dist) {
+    /* rob the richer: the item closer to home moves on */
+    if (items[index].dist < item.dist) {
+      hm_item tmp = items[index];
+      items[index] = item;
+      item = tmp;
+    }
+    index = (index + 1) & mask;
+    item.dist++;
+  }
+  items[index] = item;
+}
+
+
+/**
+ * Move the items of MAP to a new array of NSLOTS slots. Keys and
+ * values are moved as is, inline or not.
  *
- * Return 0 if an existing item was updated, 1 if a new item was
- * created and -1 in case of a memory error.
+ * Return 0 or -1 in case of a memory error.
  */
 static int
-/*hm_set_internal(hm_item *items, size_t size, const char *key, void *value)*/
-hm_set_internal(hm_item *items, size_t size, const char *key, void *value, size_t datatype_size)
+hm_resize(struct hashmap *map, size_t nslots)
 {
-  uint64_t hash;
-  size_t index;
+  hm_item *newitems;
 
+  HM_LOG("HM_RESIZE: %zu -> %zu slots\n", map->nslots, nslots);
 
-  hash = hash_key(key);
-  index = hash % size;
+  newitems = calloc(nslots, sizeof(*newitems));
+  if (newitems == NULL) {
+    return -1;
+  }
 
-  fprintf(stderr, "HM_SET_INTERNAL: Key = %s, index = %ld, ", key, index);
-  fprintf(stderr, "hash = %" PRIu64 "\n", hash); 
+  for (size_t i = 0; i < map->nslots; i++) {
+    if (map->items[i].dist)
+      hm_place(newitems, nslots, map->items[i]);
+  }
 
-  while (items[index].key != NULL) {
-    fprintf(stderr, "HM_SET_INTERNAL: Looking for = %s; items[index(%ld)].key = %s \n", key, index, items[index].key);
-    if (!strcmp(key, items[index].key)) {  /* key found */
-      fprintf(stderr, "HM_SET_INTERNAL: Key = %s found\n", key);
-      free(items[index].value); 
-      items[index].value = value;
-      items[index].size = datatype_size;
-      fprintf(stderr, "HM_SET_INTERNAL: Key %s, value %hu, size %lu\n", key, *(uint16_t*)items[index].value, items[index].size);
-      return 0;
-    }
+  free(map->items);
+  map->items = newitems;
+  map->nslots = nslots;
 
-    index = (index + 1) % size;            /* key not found, linear probe + wrap */
-  }
+  return 0;
+}
 
-  /* XX FIXME: the following alloc could be avoided when expanding the
-     hashmap, because keys have already been allocated */
 
-  /* key is not present in the map, alloc and set value */
-  key = strdup(key);
-  if (key == NULL) {
-    return -1;
+/*
+ * Snapshots. The file holds a header, the slot array as is and the
+ * keys and values that do not fit in the slots:
+ *
+ *   header | padding up to SNAP_SLOTS | nslots slots | data
+ *
+ * Out-of-line keys and values are replaced by their offset in the
+ * data section, so that a loaded snapshot is used in place from the
+ * mapping. Each section has its own CRC32C. Snapshots are only
+ * readable on hosts with the same endianness and slot layout.
+ */
+#define SNAP_MAGIC   "ICHMSNAP"
+#define SNAP_VERSION 1
+#define SNAP_ENDIAN  0x01020304
+#define SNAP_SLOTS   128         /* offset of the slots */
+#define SNAP_ALIGN   16          /* alignment of out-of-line data */
+
+#define SNAP_PAD(n) (((n) + SNAP_ALIGN - 1) & ~(uint64_t)(SNAP_ALIGN - 1))
+
+struct snap_header {
+  char     magic[8];
+  uint32_t version;
+  uint32_t endian;              /* SNAP_ENDIAN as written by the host */
+  uint64_t seed;                /* hash function offset basis */
+  uint32_t slotsize;
+  uint16_t keyinline;
+  uint16_t valueinline;
+  uint64_t nslots;
+  uint64_t nitems;
+  uint64_t datasize;
+  uint32_t slotscrc;
+  uint32_t datacrc;
+  uint32_t headercrc;           /* computed with this field at 0 */
+  uint32_t pad;
+};
+
+
+const char *
+hm_strerror(int err)
+{
+  switch (err) {
+  case HM_SUCCESS:
+    return "Success";
+  case HM_EIO:
+    return strerror(errno);
+  case HM_ENOMEM:
+    return "Out of memory";
+  case HM_EFORMAT:
+    return "Not a hashmap snapshot, or from an incompatible host";
+  case HM_EVERSION:
+    return "Unsupported snapshot version";
+  case HM_ECORRUPT:
+    return "Corrupted snapshot";
+  default:
+    return "Unknown error";
   }
+}
 
-  items[index].key = key;
-  items[index].value = value;
-  items[index].size = datatype_size;
 
-  return 1;
+static int
+snap_write(FILE *file, const void *buf, size_t len, uint32_t *crc)
+{
+  if (len && fwrite(buf, len, 1, file) != 1)
+    return -1;
+  *crc = crc32c(*crc, buf, len);
+  return 0;
 }
 
 
 /**
- * Double the size of the hashmap.
- *
- * Return MAP or NULL in case of a memory error
+ * Write the LEN bytes at BUF, padded to SNAP_ALIGN.
  */
-static struct hashmap *
-hm_expand(struct hashmap *map)
+static int
+snap_write_data(FILE *file, const void *buf, size_t len, uint32_t *crc)
 {
-  int rc;
-  size_t newsize;
-  hm_item *newitems;
+  static const char zeros[SNAP_ALIGN];
 
-  newsize = map->nslots * 2;
-  if (newsize < map->nslots) {  /* overflow */
-    return NULL;
-  }
+  if (snap_write(file, buf, len, crc))
+    return -1;
+  return snap_write(file, zeros, SNAP_PAD(len) - len, crc);
+}
 
-  newitems = calloc(newsize, sizeof(*newitems));
-  if (newitems == NULL) {
-    return NULL;
+
+int
+hm_save(hm_t *map, const char *filename)
+{
+  char tmpname[PATH_MAX];
+  struct snap_header h;
+  uint64_t off = 0;
+  uint32_t crc = 0;
+
+  /* written aside and renamed, so that the file is never partial */
+  if (snprintf(tmpname, sizeof(tmpname), "%s.tmp", filename) >= (int)sizeof(tmpname)) {
+    errno = ENAMETOOLONG;
+    return HM_EIO;
   }
 
+  FILE *file = fopen(tmpname, "wb");
+  if (file == NULL)
+    return HM_EIO;
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, SNAP_MAGIC, sizeof(h.magic));
+  h.version = SNAP_VERSION;
+  h.endian = SNAP_ENDIAN;
+  h.seed = FNV_OFFSET;
+  h.slotsize = sizeof(hm_item);
+  h.keyinline = KEY_INLINE;
+  h.valueinline = VALUE_INLINE;
+  h.nslots = map->nslots;
+  h.nitems = map->nitems;
+
+  if (fseek(file, SNAP_SLOTS, SEEK_SET))
+    goto error;
+
   for (size_t i = 0; i < map->nslots; i++) {
-    hm_item item = map->items[i];
-    if (item.key != NULL) {
-      rc = hm_set_internal(newitems, newsize, item.key, item.value, item.size);
-      free((char *)item.key);
-      if (rc == -1)             /* memory error */
-        return NULL;
+    const hm_item *item = &map->items[i];
+    hm_item slot;
+
+    memset(&slot, 0, sizeof(slot));
+    if (item->dist) {
+      slot.hash = item->hash;
+      slot.dist = item->dist;
+      slot.keylen = item->keylen;
+      slot.size = item->size;
+      if (item->keylen < KEY_INLINE) {
+        memcpy(slot.key.inl, item_key(map, item), item->keylen + 1);
+      } else {
+        slot.key.off = off;
+        off += SNAP_PAD(item->keylen + 1);
+      }
+      if (item->size <= VALUE_INLINE) {
+        memcpy(slot.value.inl, item_value(map, item), item->size);
+      } else {
+        slot.value.off = off;
+        off += SNAP_PAD(item->size);
+      }
     }
+    if (snap_write(file, &slot, sizeof(slot), &crc))
+      goto error;
   }
+  h.slotscrc = crc;
+  h.datasize = off;
 
-  free(map->items);
-  map->items = newitems;
-  map->nslots = newsize;
+  crc = 0;
+  for (size_t i = 0; i < map->nslots; i++) {
+    const hm_item *item = &map->items[i];
+
+    if (!item->dist)
+      continue;
+    if (item->keylen >= KEY_INLINE &&
+        snap_write_data(file, item_key(map, item), item->keylen + 1, &crc))
+      goto error;
+    if (item->size > VALUE_INLINE &&
+        snap_write_data(file, item_value(map, item), item->size, &crc))
+      goto error;
+  }
+  h.datacrc = crc;
+  h.headercrc = crc32c(0, &h, sizeof(h));
+
+  if (fseek(file, 0, SEEK_SET) ||
+      fwrite(&h, sizeof(h), 1, file) != 1 ||
+      fflush(file) ||
+      fsync(fileno(file)))
+    goto error;
+
+  if (fclose(file)) {
+    file = NULL;
+    goto error;
+  }
+  file = NULL;
 
-  return map;
+  if (rename(tmpname, filename))
+    goto error;
+
+  HM_LOG("HM_SAVE: %s: %zu items\n", filename, map->nitems);
+
+  return HM_SUCCESS;
+
+ error:
+  {
+    int errsv = errno;
+    if (file)
+      fclose(file);
+    unlink(tmpname);
+    errno = errsv;
+  }
+  return HM_EIO;
 }
 
-/*ALBERTO - Functions to store and load the hashmaps*/
+
 /**
- * Function to serialize a hashmap to a file
+ * Check the snapshot of LEN bytes at P.
  */
-void serialize_hashmap(const struct hashmap *map, const char *filename) {
-    int count = 0; 
-    char *buffer = (char*)calloc(SIZE, 1);
-
-    FILE *file = fopen(filename, "wb");
-    if (file == NULL) {
-        perror("Error opening file for writing");
-        exit(EXIT_FAILURE);
-    }
-
-    // Write nitems and nslots
-    fwrite(&(map->nitems), sizeof(size_t), 1, file);
-    count += snprintf(&(buffer[count]), SIZE-count, "%ld::", map->nitems);
-    fwrite(&(map->nslots), sizeof(size_t), 1, file);
-    count += snprintf(&(buffer[count]), SIZE-count, "%ld::", map->nslots);
-
-    // Write the items array
-    //fwrite(map->items, sizeof(hm_item), map->nitems, file);
-
-    // Write the string data: loop until i < nslots not items because keys are stored based on a hash key.
-    for (size_t i = 0; i < map->nslots; ++i) {
-        size_t key_len = (map->items[i].key != NULL) ? strlen(map->items[i].key) + 1 : 0;
-        fwrite(&key_len, sizeof(size_t), 1, file);
-        count += snprintf(&(buffer[count]), SIZE-count, "%ld::", key_len);
-
-        if (key_len > 0) {
-            fwrite(map->items[i].key, sizeof(char), key_len, file);
-            count += snprintf(&(buffer[count]), SIZE-count, "%s::", map->items[i].key);
-
-            if (map->items[i].size > 0){
-              fwrite(&map->items[i].size, sizeof(size_t), 1, file);
-              count += snprintf(&(buffer[count]), SIZE-count, "%ld::", map->items[i].size);
-              fwrite(map->items[i].value, map->items[i].size, 1, file);
-              count += snprintf(&(buffer[count]), SIZE-count, "%hu::", *(uint16_t*)(map->items[i].value));
-            }
-        } 
+static int
+snap_check(const char *p, size_t len)
+{
+  struct snap_header h;
+
+  if (len < SNAP_SLOTS)
+    return HM_EFORMAT;
+
+  memcpy(&h, p, sizeof(h));
+  if (memcmp(h.magic, SNAP_MAGIC, sizeof(h.magic)) || h.endian != SNAP_ENDIAN)
+    return HM_EFORMAT;
+
+  uint32_t crc = h.headercrc;
+  h.headercrc = 0;
+  if (crc32c(0, &h, sizeof(h)) != crc)
+    return HM_ECORRUPT;
+
+  if (h.version != SNAP_VERSION)
+    return HM_EVERSION;
+
+  if (h.seed != FNV_OFFSET || h.slotsize != sizeof(hm_item) ||
+      h.keyinline != KEY_INLINE || h.valueinline != VALUE_INLINE)
+    return HM_EFORMAT;
+
+  /* there must be an empty slot for lookups to end */
+  if (h.nslots == 0 || (h.nslots & (h.nslots - 1)) || h.nitems >= h.nslots ||
+      h.nslots > (len - SNAP_SLOTS) / sizeof(hm_item) ||
+      h.datasize != len - SNAP_SLOTS - h.nslots * sizeof(hm_item))
+    return HM_ECORRUPT;
+
+  const hm_item *items = (const hm_item *)(p + SNAP_SLOTS);
+  const char *data = (const char *)(items + h.nslots);
+
+  if (crc32c(0, items, h.nslots * sizeof(hm_item)) != h.slotscrc ||
+      crc32c(0, data, h.datasize) != h.datacrc)
+    return HM_ECORRUPT;
+
+  /* the checksums do not protect against a forged file */
+  uint64_t n = 0;
+  for (uint64_t i = 0; i < h.nslots; i++) {
+    const hm_item *item = &items[i];
+
+    if (!item->dist)
+      continue;
+    n++;
+    if (item->dist > h.nslots)
+      return HM_ECORRUPT;
+    if (item->keylen < KEY_INLINE) {
+      if (item->key.inl[item->keylen] != '\0')
+        return HM_ECORRUPT;
+    } else if (item->key.off >= h.datasize ||
+               h.datasize - item->key.off <= item->keylen ||
+               data[item->key.off + item->keylen] != '\0') {
+      return HM_ECORRUPT;
     }
-    fprintf(stderr, "SERIALIZED HASHMAP: %s\n", buffer);
-    fprintf(stderr, "SERIALIZED HASHMAP: Name = %s, Count = %d\n", filename, count);
+    if (item->size > VALUE_INLINE &&
+        (item->value.off > h.datasize || h.datasize - item->value.off < item->size))
+      return HM_ECORRUPT;
+  }
+  if (n != h.nitems)
+    return HM_ECORRUPT;
 
-    free(buffer);
-    fclose(file);
+  return HM_SUCCESS;
 }
 
-/** 
- * Function to deserialize a hashmap from a file and return a pointer to it
- */
-struct hashmap *deserialize_hashmap(const char *filename) {
-    int count = 0; 
-    char *buffer = (char*)calloc(SIZE, 1);
-    struct hashmap *map = hm_create();
-    if (map == NULL) {
-        perror("Memory allocation error");
-        exit(EXIT_FAILURE);
-    }
 
-    FILE *file = fopen(filename, "rb");
-    if (file == NULL) {
-        perror("Error opening file for reading");
-        free(map);
-        exit(EXIT_FAILURE);
-    }
+int
+hm_load(hm_t **map, const char *filename)
+{
+  struct stat st;
+  int fd, rc;
 
-    // Read nitems and nslots
-    fread(&(map->nitems), sizeof(size_t), 1, file);
-    count += snprintf(&(buffer[count]), SIZE-count, "%ld::", map->nitems);
-    fread(&(map->nslots), sizeof(size_t), 1, file);
-    count += snprintf(&(buffer[count]), SIZE-count, "%ld::", map->nslots);
-
-    // Allocate memory for the items array
-    //free(map->items); // free original allocation in creation
-    map->items = calloc(map->nslots, sizeof(*map->items));
-    if (map->items == NULL) {
-        perror("Memory allocation error");
-        free(map);
-        fclose(file);
-        exit(EXIT_FAILURE);
-    }
+  *map = NULL;
 
-    // Read the items array
-    //fread(map->items, sizeof(hm_item), map->nitems, file);
-
-    // Read the string data: loop until i < nslots not items because keys are stored based on a hash key.
-    for (size_t i = 0; i < map->nslots; ++i) {
-        size_t key_len;
-        fread(&key_len, sizeof(size_t), 1, file);
-        count += snprintf(&(buffer[count]), SIZE-count, "%ld::", key_len);
-
-        if (key_len > 0) {
-            map->items[i].key = calloc(key_len, 1);
-            if (map->items[i].key == NULL) {
-                perror("Memory allocation error");
-                hm_free(map);
-                fclose(file);
-                exit(EXIT_FAILURE);
-            }
-            fread((char*)map->items[i].key, sizeof(char), key_len, file);
-            count += snprintf(&(buffer[count]), SIZE-count, "%s::", map->items[i].key);
-
-            fread(&map->items[i].size, sizeof(size_t), 1, file);
-            count += snprintf(&(buffer[count]), SIZE-count, "%ld::", map->items[i].size);
-
-            if (map->items[i].size > 0) {
-                map->items[i].value = calloc(map->items[i].size, 1);
-                if (map->items[i].value == NULL) {
-                    perror("Memory allocation error");
-                    hm_free(map);
-                    fclose(file);
-                    exit(EXIT_FAILURE);
-                }
-                
-                fread(map->items[i].value, map->items[i].size, 1, file);
-                count += snprintf(&(buffer[count]), SIZE-count, "%hu::", *(uint16_t*)(map->items[i].value));
-            } else {
-                map->items[i].value = NULL;
-            }
-            
-        } else {
-            map->items[i].key = NULL;
-        }
-    }
+  fd = open(filename, O_RDONLY);
+  if (fd == -1)
+    return HM_EIO;
+
+  if (fstat(fd, &st) == -1) {
+    rc = errno;
+    close(fd);
+    errno = rc;
+    return HM_EIO;
+  }
+  if ((size_t)st.st_size < SNAP_SLOTS) {
+    close(fd);
+    return HM_EFORMAT;
+  }
+
+  void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  rc = errno;
+  close(fd);
+  if (p == MAP_FAILED) {
+    errno = rc;
+    return HM_EIO;
+  }
+
+  rc = snap_check(p, st.st_size);
+  if (rc != HM_SUCCESS) {
+    munmap(p, st.st_size);
+    return rc;
+  }
 
-    //serialize_hashmap(map, "/tmp/loaded_hashmap");
+  struct hashmap *m = malloc(sizeof(*m));
+  if (m == NULL) {
+    munmap(p, st.st_size);
+    return HM_ENOMEM;
+  }
 
-    fprintf(stderr, "DESERIALIZED HASHMAP: %s\n", buffer);
-    fprintf(stderr, "DESERIALIZED HASHMAP: Name = %s, Count = %d\n", filename, count);
+  const struct snap_header *h = p;
+  m->nslots = h->nslots;
+  m->nitems = h->nitems;
+  m->arena = NULL;
+  m->strings = NULL;
+  m->items = (hm_item *)((char *)p + SNAP_SLOTS);
+  m->mapping = p;
+  m->maplen = st.st_size;
+  m->data = (const char *)(m->items + m->nslots);
 
-    free(buffer);
-    fclose(file);
+  HM_LOG("HM_LOAD: %s: %zu items\n", filename, m->nitems);
 
-    return map;
+  *map = m;
+  return HM_SUCCESS;
 }
 
 
+/**
+ * Copy the items of a loaded snapshot to memory of MAP's own, before
+ * modifying it.
+ *
+ * Return 0 or -1 in case of a memory error, MAP is unchanged then.
+ */
+static int
+hm_unmap(struct hashmap *map)
+{
+  hm_item *items = calloc(map->nslots, sizeof(*items));
+  size_t i;
+
+  if (items == NULL)
+    return -1;
+
+  for (i = 0; i < map->nslots; i++) {
+    const hm_item *src = &map->items[i];
+    hm_item *item = &items[i];
+
+    if (!src->dist)
+      continue;
+    *item = *src;
+    if (src->keylen >= KEY_INLINE) {
+      item->key.ptr = strndup(map->data + src->key.off, src->keylen);
+      if (item->key.ptr == NULL)
+        goto error;
+    }
+    if (src->size > VALUE_INLINE) {
+      item->value.ptr = malloc(src->size);
+      if (item->value.ptr == NULL) {
+        if (src->keylen >= KEY_INLINE)
+          free(item->key.ptr);
+        goto error;
+      }
+      memcpy(item->value.ptr, map->data + src->value.off, src->size);
+    }
+  }
+
+  munmap(map->mapping, map->maplen);
+  map->mapping = NULL;
+  map->data = NULL;
+  map->items = items;
+
+  return 0;
+
+ error:
+  /* the map has no external keys, item_clear frees what was copied */
+  while (i-- > 0) {
+    if (items[i].dist)
+      item_clear(map, &items[i]);
+  }
+  free(items);
+  return -1;
+}
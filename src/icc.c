@@ -13,11 +13,14 @@
 
 #include "hashmap.h"
 #include "icc_priv.h"
+#include "icc_ckpt.h"
 #include "rpc.h"
 #include "cb.h"
 #include "icdb.h"
 #include "cbcommon.h"
 #include "flexmpi.h"
+#include "icrmq.h"
+#include "icstats.h"
 
 #define NTHREADS 2              /* threads set aside for RPC handling */
 
@@ -27,6 +30,9 @@
 /* Variable to know if the execution is a restart (1) */
 int _run_mode;
 
+/* serialize the releases of nodes */
+static ABT_mutex_memory release_mutex = ABT_MUTEX_INITIALIZER;
+
 
 /* utils */
 
@@ -46,14 +52,28 @@ static const char *_icc_type_str(enum icc_client_type type);
  */
 static int _strtouint32(const char *nptr, uint32_t *dest);
 
-/**
- * Release HOST to the resource manager. The caller must get hostlock
- * before calling this function.
- */
+/* a node being given back to the resource manager */
+struct node_release {
+  char         *host;
+  uint32_t     jobid;
+  uint32_t     ncpus;
+  ABT_eventual ev;
+};
+
 //CHANGE JAVIER
 static int remove_extra_nodes(struct icc_context *icc, const char *hostlist);
 // END CHANGE JAVIER
-static int release_node(struct icc_context *icc, const char *host);
+
+/**
+ * Forget the node of REL once released to the resource manager. The
+ * caller must get hostlock before calling this function.
+ */
+static int release_node_done(struct icc_context *icc, const struct node_release *rel);
+
+/**
+ * Remove the node HOST of the client from the DB.
+ */
+static int release_node_db(struct icc_context *icc, const char *host);
 static iccret_t clear_hostmap(hm_t *hostmap);
 char * icc_get_ip_addr(struct icc_context *icc);
 
@@ -99,6 +119,9 @@ icc_init_mpi(enum icc_log_level log_level, enum icc_client_type typeid,
 
   icc->type = typeid;
 
+  char *iotimeout = getenv(ICC_IO_TIMEOUT_ENV);
+  icc->io_timeout_ms = (iotimeout ? strtod(iotimeout, NULL) : ICC_IO_TIMEOUT_DEFAULT) * 1000;
+
   /*  apps that must be able to both receive AND send RPCs to the IC */
   if (typeid == ICC_TYPE_MPI || typeid == ICC_TYPE_FLEXMPI || typeid == ICC_TYPE_RECONFIG2 ||
       typeid == ICC_TYPE_STOPRESTART || typeid == ICC_TYPE_ALERT)
@@ -107,57 +130,56 @@ icc_init_mpi(enum icc_log_level log_level, enum icc_client_type typeid,
   /* resource manager stuff */
   char *jobid, *jobstepid, *nodelist;
 
-  if(run_mode == 0){
-    _run_mode = 0;
+  _run_mode = run_mode ? 1 : 0;
 
-    jobid = getenv("SLURM_JOB_ID");
-    if (!jobid) {
-      jobid = getenv("SLURM_JOBID");
-    }
-    jobstepid = getenv("SLURM_STEP_ID");
-    if (!jobstepid) {
-      jobstepid = getenv("SLURM_STEPID");
-    }
+  /* on restart, the job ID locates the checkpoint of the context */
+  jobid = getenv("SLURM_JOB_ID");
+  if (!jobid) {
+    jobid = getenv("SLURM_JOBID");
+  }
+  jobstepid = getenv("SLURM_STEP_ID");
+  if (!jobstepid) {
+    jobstepid = getenv("SLURM_STEPID");
+  }
 
-    /* jobid is only required for registered clients */
-    if (icc->bidirectional && !jobid) {
-        margo_warning(MARGO_INSTANCE_NULL, "icc (init): job ID not found");
-    }
+  /* jobid is only required for registered clients */
+  if (icc->bidirectional && !jobid) {
+      margo_warning(MARGO_INSTANCE_NULL, "icc (init): job ID not found");
+  }
 
-    if (jobid) {
-      rc = _strtouint32(jobid, &icc->jobid);
-      if (rc) {
-        margo_error(MARGO_INSTANCE_NULL, "icc (init): Error converting job id \"%s\": %s", jobid, strerror(-rc));
-        rc = ICC_FAILURE;
-        goto error;
-      }
-    } else {
-      icc->jobid = 0;
+  if (jobid) {
+    rc = _strtouint32(jobid, &icc->jobid);
+    if (rc) {
+      margo_error(MARGO_INSTANCE_NULL, "icc (init): Error converting job id \"%s\": %s", jobid, strerror(-rc));
+      rc = ICC_FAILURE;
+      goto error;
     }
+  } else {
+    icc->jobid = 0;
+  }
 
-    if (jobstepid) {
-      rc = _strtouint32(jobstepid, &icc->jobstepid);
-      if (rc) {
-        margo_error(MARGO_INSTANCE_NULL, "icc (init): Error converting job step id \"%s\": %s", jobstepid, strerror(-rc));
-        rc = ICC_FAILURE;
-        goto error;
-      }
-    } else {
-      icc->jobstepid = 0;
+  if (jobstepid) {
+    rc = _strtouint32(jobstepid, &icc->jobstepid);
+    if (rc) {
+      margo_error(MARGO_INSTANCE_NULL, "icc (init): Error converting job step id \"%s\": %s", jobstepid, strerror(-rc));
+      rc = ICC_FAILURE;
+      goto error;
     }
   } else {
-    _run_mode = 1;
-    // Load icc backup
-    _icc_context_load(icc, "/tmp/nek.bin");
-    nodelist = icc->nodelist;
-    
-    int digits = snprintf(NULL, 0, "%d", icc->jobid);
-    jobid = (char*)malloc(digits + 1);
-    snprintf(jobid, digits + 1, "%d", icc->jobid);
+    icc->jobstepid = 0;
+  }
 
-    digits = snprintf(NULL, 0, "%d", icc->jobstepid);
-    jobstepid = (char*)malloc(digits + 1);
-    snprintf(jobstepid, digits + 1, "%d", icc->jobstepid);
+  if (run_mode) {
+    /* the maps are restored in place, set them up first */
+    rc = _setup_hostmaps(icc);
+    if (rc)
+      goto error;
+
+    rc = icc_ckpt_load(icc, icc->jobid);
+    if (rc) {
+      margo_error(MARGO_INSTANCE_NULL, "icc (init): Cannot restore the context of job %"PRIu32, icc->jobid);
+      goto error;
+    }
 
     // Do release nodes on restart
     //icc_release_nodes(icc);
@@ -221,21 +243,11 @@ icc_init_mpi(enum icc_log_level log_level, enum icc_client_type typeid,
   }
   // CHANGE: JAVI
 
-  rc = icdb_init(&(icc->icdbs_main), icc->addr_ic_str);
-  if (!icc->icdbs_main) {
-    LOG_ERROR(icc->mid, "Could not initialize IC database for main func.");
-    goto error;
-  } else if (rc != ICDB_SUCCESS) {
-    LOG_ERROR(icc->mid, "Could not initialize IC database for main func.: %s", icdb_errstr(icc->icdbs_main));
-    goto error;
-  }
-
-  rc = icdb_init(&(icc->icdbs_cb), icc->addr_ic_str);
-  if (!icc->icdbs_cb) {
-    LOG_ERROR(icc->mid, "Could not initialize IC database for client cb");
-    goto error;
-  } else if (rc != ICDB_SUCCESS) {
-    LOG_ERROR(icc->mid, "Could not initialize IC database for client cb: %s", icdb_errstr(icc->icdbs_cb));
+  /* most clients never touch the DB, connections are opened lazily */
+  rc = icdb_pool_init(&icc->icdb_pool, icc->addr_ic_str, ICC_DB_POOLSIZE,
+                      ICC_DB_TIMEOUT_MS);
+  if (rc != ICDB_SUCCESS) {
+    LOG_ERROR(icc->mid, "Could not initialize IC database pool");
     goto error;
   }
   // END CHANGE: JAVI
@@ -245,6 +257,7 @@ icc_init_mpi(enum icc_log_level log_level, enum icc_client_type typeid,
   margo_register_data(icc->mid, icc->rpcids[RPC_RECONFIGURE2], icc, NULL);
   margo_register_data(icc->mid, icc->rpcids[RPC_RESALLOC], icc, NULL);
   margo_register_data(icc->mid, icc->rpcids[RPC_LOWMEM], icc, NULL);
+  margo_register_data(icc->mid, icc->rpcids[RPC_MULTICAST], icc, NULL);
 
   /* nprocs should unsigned, but MPI defines it as an int, so we take
      care of the check here */
@@ -370,10 +383,8 @@ icc_fini(struct icc_context *icc)
 
   if (icc->restarting == 1 && icc->type == ICC_TYPE_STOPRESTART){
     margo_info(icc->mid, "icc_fini: Finalizing for restart\n");
-    /* set to 0 for the backup, but restored to continue the execution */
-    icc->restarting = 0;
-    _icc_context_backup(icc, "/tmp/nek.bin");
-    icc->restarting = 1;
+    if (icc_ckpt_save(icc) != ICC_SUCCESS)
+      margo_error(icc->mid, "icc_fini: Could not checkpoint the context");
   }
   
   if (icc->restarting == 0 || icc->type != ICC_TYPE_STOPRESTART){
@@ -408,9 +419,13 @@ icc_fini(struct icc_context *icc)
   
   margo_info(icc->mid, "icc_fini: ABT_xstream_free\n");
 
-  if (icc->icrm_xstream) {
-    icc->icrm_terminate = 1;
-    ABT_xstream_free(&icc->icrm_xstream);
+  /* serve the pending requests before stopping */
+  icrmq_fini(&icc->icrmq);
+
+  icc->icrm_terminate = 1;
+  for (unsigned i = 0; i < ICC_ICRM_NWORKERS; i++) {
+    if (icc->icrm_xstreams[i])
+      ABT_xstream_free(&icc->icrm_xstreams[i]);
     /* pool is freed by ABT_xstream_free? */
     /* ABT_pool_free(&icc->icrm_pool); */
   }
@@ -430,8 +445,7 @@ icc_fini(struct icc_context *icc)
   }
 
   /* close connections to DB */
-  icdb_fini(&(icc->icdbs_main));
-  icdb_fini(&(icc->icdbs_cb));
+  icdb_pool_fini(&icc->icdb_pool);
 
   margo_info(icc->mid, "icc_fini: free hostmaps\n");
 
@@ -439,6 +453,8 @@ icc_fini(struct icc_context *icc)
     free(icc->nodelist);
   }
 
+  free(icc->jobnodelist);
+
   if (icc->hostlock) {
     ABT_rwlock_free(&icc->hostlock);
   }
@@ -461,6 +477,9 @@ icc_fini(struct icc_context *icc)
     hm_free(icc->reconfigalloc);
   }
 
+  /* after the maps using it */
+  hm_free(icc->hostnames);
+
   icrm_fini();
 
   if (icc->flexhandle) {
@@ -718,6 +737,7 @@ icc_hint_io_begin(struct icc_context *icc, unsigned long witer, int isfirst, uns
   in.jobstepid = icc->jobstepid;
   in.ioset_witer = (uint32_t)witer;
   in.iterflag = isfirst ? 1 : 0;
+  in.bandwidth = icc->io_bandwidth;
   in.nbytes = 0;
 
   /* make RPC by hand instead of using rpc_send() because of the
@@ -733,8 +753,15 @@ icc_hint_io_begin(struct icc_context *icc, unsigned long witer, int isfirst, uns
     return ICC_FAILURE;
   }
 
-  /* we expect to block until it is our turn to run, so no timeout */
-  hret = margo_forward(handle, &in);
+  /* we expect to block until it is our turn to run, which the leases
+     of the other applications bound, so only give up on a lost server */
+  hret = margo_forward_timed(handle, &in, icc->io_timeout_ms);
+  if (hret == HG_TIMEOUT) {
+    margo_error(icc->mid, "icc (hint_io_begin): no IO permission after %.0f s",
+                icc->io_timeout_ms / 1000);
+    margo_destroy(handle);
+    return ICC_FAILURE;
+  }
   if (hret != HG_SUCCESS) {
     margo_error(icc->mid, "icc (hint_io_begin): RPC forwarding failure: %s", HG_Error_to_string(hret));
     if (hret != HG_NOENTRY) {
@@ -795,6 +822,7 @@ icc_hint_io_end(struct icc_context *icc, unsigned long witer, int islast, unsign
   in.jobstepid = icc->jobstepid;
   in.ioset_witer = (uint32_t)witer;
   in.iterflag = islast ? 1 : 0;
+  in.bandwidth = icc->io_bandwidth;
   in.nbytes = nbytes;
 
   rc = rpc_send(icc->mid, icc->addr, icc->rpcids[RPC_HINT_IO_END], &in, &rpcret, RPC_TIMEOUT_MS_DEFAULT);
@@ -807,6 +835,22 @@ icc_hint_io_end(struct icc_context *icc, unsigned long witer, int islast, unsign
 }
 
 
+iccret_t
+icc_hint_io_bandwidth(struct icc_context *icc, unsigned long bandwidth)
+{
+  assert(icc);
+
+  if (bandwidth > UINT32_MAX) {
+    margo_error(icc->mid, "icc (hint_io_bandwidth): bandwidth is too big");
+    return ICC_EINVAL;
+  }
+
+  icc->io_bandwidth = (uint32_t)bandwidth;
+
+  return ICC_SUCCESS;
+}
+
+
 int icc_rpc_metric_alert(struct icc_context * icc, char * source, char * name, char * metric, char * operator, double current_value, int active, char * pretty_print, int *retcode)
 {
   int rc = 0;
@@ -861,6 +905,64 @@ icc_rpc_nodealert(struct icc_context *icc, enum icc_alert_type type, const char
   return rc ? ICC_FAILURE : ICC_SUCCESS;
 }
 
+int
+icc_rpc_stats(struct icc_context *icc, int reset, char **text, int *retcode)
+{
+  hg_return_t hret;
+  hg_handle_t handle;
+  stats_in_t in;
+  stats_out_t out;
+  int rc;
+
+  CHECK_ICC(icc);
+
+  if (!text || !retcode)
+    return ICC_EINVAL;
+
+  *text = NULL;
+  in.reset = reset ? HG_TRUE : HG_FALSE;
+
+  hret = margo_create(icc->mid, icc->addr, icc->rpcids[RPC_STATS], &handle);
+  if (hret != HG_SUCCESS) {
+    margo_error(icc->mid, "Margo RPC creation failure: %s", HG_Error_to_string(hret));
+    return ICC_FAILURE;
+  }
+
+  hret = margo_forward_timed(handle, &in, RPC_TIMEOUT_MS_DEFAULT);
+  if (hret != HG_SUCCESS) {
+    margo_error(icc->mid, "Margo RPC forwarding failure: %s", HG_Error_to_string(hret));
+    margo_destroy(handle);
+    return ICC_FAILURE;
+  }
+
+  hret = margo_get_output(handle, &out);
+  if (hret != HG_SUCCESS) {
+    margo_error(icc->mid, "Could not get RPC output: %s", HG_Error_to_string(hret));
+    margo_destroy(handle);
+    return ICC_FAILURE;
+  }
+
+  rc = ICC_SUCCESS;
+  *retcode = out.rc;
+  if (out.text) {
+    *text = strdup(out.text);
+    if (!*text)
+      rc = ICC_ENOMEM;
+  }
+
+  hret = margo_free_output(handle, &out);
+  if (hret != HG_SUCCESS) {
+    margo_error(icc->mid, "Could not free RPC output: %s", HG_Error_to_string(hret));
+  }
+
+  hret = margo_destroy(handle);
+  if (hret != HG_SUCCESS) {
+    margo_error(icc->mid, "Could not destroy Margo RPC handle: %s", HG_Error_to_string(hret));
+  }
+
+  return rc;
+}
+
 int
 icc_release_register(struct icc_context *icc, const char *host, uint16_t ncpus)
 {
@@ -917,50 +1019,115 @@ icc_release_register(struct icc_context *icc, const char *host, uint16_t ncpus)
 int
 icc_release_nodes(struct icc_context *icc)
 {
-  margo_info(icc->mid, "icc_release_nodes: START - hostrelease = %d",hm_length(icc->hostrelease));
   CHECK_ICC(icc);
 
-  int rc=ICC_SUCCESS;
-    
+  /* one release at a time, a node must not be given back twice */
+  ABT_mutex mutex = ABT_MUTEX_MEMORY_GET_HANDLE(&release_mutex);
+  ABT_mutex_lock(mutex);
+
+  margo_info(icc->mid, "icc_release_nodes: START - hostrelease = %d",hm_length(icc->hostrelease));
+
+  int rc = ICC_SUCCESS;
+  struct node_release *rels = NULL;
+  size_t nrels = 0;
+
   const char *host;
   size_t curs = 0;
 
-  ABT_rwlock_wrlock(icc->hostlock);
+  /* pick the nodes whose CPUs are all released. The resource manager
+     is only called without the lock, the nodes are forgotten once it
+     is done */
+  ABT_rwlock_rdlock(icc->hostlock);
+  uint64_t lockstart = icstats_now();
+
+  rels = calloc(hm_length(icc->hostrelease) + 1, sizeof(*rels));
+  if (!rels) {
+    rc = ICC_ENOMEM;
+  }
 
   // CHANGE JAVI
   uint16_t *ncpus_rem;
 
-  //while ((curs = hm_next(icc->hostrelease, curs, &host, NULL)) != 0) {
-  while ((curs = hm_next(icc->hostrelease, curs, &host, (const void **)&ncpus_rem)) != 0) {
+  while (rels && (curs = hm_next(icc->hostrelease, curs, &host, (const void **)&ncpus_rem)) != 0) {
     margo_debug(icc->mid, "icc_release_nodes: host:cpusReleased %s:%"PRIu16, host, *ncpus_rem);
     
     const uint16_t *ncpus_alo = hm_get(icc->hostalloc, host);
     assert(ncpus_alo);
       margo_debug(icc->mid, "icc_release_nodes: host:cpusallocated %s:%"PRIu16, host, *ncpus_alo);
 
-      
     if (((*ncpus_rem) > 0) && ((*ncpus_rem) >= (*ncpus_alo))) {
+      // CHANGE #MUL-JOBS
+      const uint32_t *jobid = hm_get(icc->hostjob, host);
+      if (!jobid) {
+        rc = ICC_EINVAL;
+        break;
+      }
+      // END CHANGE #MUL-JOBS
       margo_debug(icc->mid, "icc_release_nodes: remove node %s",host);
-      rc = release_node(icc, host);
-      if (rc != ICC_SUCCESS) {
+      rels[nrels].host = strdup(host);
+      if (!rels[nrels].host) {
+        rc = ICC_ENOMEM;
         break;
       }
+      rels[nrels].jobid = *jobid;
+      rels[nrels].ncpus = *ncpus_rem;
+      rels[nrels].ev = ABT_EVENTUAL_NULL;
+      nrels++;
     }
-
   }
-  //if (icc->hostrelease) {
-  //  hm_free(icc->hostrelease);
-  //}
-  //icc->hostrelease = hm_create();
-  //if (!icc->hostrelease) {
-  //  ABT_rwlock_unlock(icc->hostlock);
-  //  return ICC_FAILURE;
-  //}
   // END CHANGE JAVI
 
+  icstats_record(ICSTATS_HIST("icc", "hostlock_release"), icstats_now() - lockstart);
+  ABT_rwlock_unlock(icc->hostlock);
+
+  /* the releases of a job are merged in a single update by the RM
+     worker, submit them all before waiting */
+  for (size_t i = 0; rc == ICC_SUCCESS && i < nrels; i++) {
+    icrmerr_t icrmret = icrmq_submit_release(icc->icrmq, rels[i].host, rels[i].jobid,
+                                             rels[i].ncpus, &rels[i].ev);
+    if (icrmret != ICRM_SUCCESS) {
+      margo_error(icc->mid, "Could not submit release of node %s: %d", rels[i].host, icrmret);
+      rc = ICC_FAILURE;
+    }
+  }
+
+  for (size_t i = 0; i < nrels; i++) {
+    struct icrmq_result res;
+
+    if (rels[i].ev == ABT_EVENTUAL_NULL)
+      continue;
+
+    icrmerr_t icrmret = icrmq_wait(&rels[i].ev, &res);
+
+    if (icrmret == ICRM_SUCCESS) {
+      margo_debug(icc->mid, "Released %s:%"PRIu32, rels[i].host, rels[i].ncpus);
+
+      ABT_rwlock_wrlock(icc->hostlock);
+      lockstart = icstats_now();
+      int ret = release_node_done(icc, &rels[i]);
+      icstats_record(ICSTATS_HIST("icc", "hostlock_release"), icstats_now() - lockstart);
+      ABT_rwlock_unlock(icc->hostlock);
+
+      if (ret == ICC_SUCCESS)
+        ret = release_node_db(icc, rels[i].host);
+      if (ret != ICC_SUCCESS && rc == ICC_SUCCESS)
+        rc = ret;
+    } else {
+      margo_info(icc->mid, "Not releasing node %s", rels[i].host);
+      margo_debug(icc->mid, "%s", res.errstr);
+      /* not all CPUs released on node, ignore */
+      if (icrmret != ICRM_EAGAIN && rc == ICC_SUCCESS)
+        rc = ICC_FAILURE;
+    }
+  }
+
+  for (size_t i = 0; i < nrels; i++)
+    free(rels[i].host);
+  free(rels);
+
   margo_info(icc->mid, "icc_release_nodes: END");
 
-  ABT_rwlock_unlock(icc->hostlock);
+  ABT_mutex_unlock(mutex);
 
   return rc;
 }
@@ -1175,69 +1342,55 @@ static int remove_extra_nodes(struct icc_context *icc, const char *hostlist)
 //END CHANGE JAVIER
 
 static int
-release_node(struct icc_context *icc, const char *host)
+release_node_done(struct icc_context *icc, const struct node_release *rel)
 {
-  margo_info(icc->mid, "release_node: START");
   CHECK_ICC(icc);
-  if (!host) {
-    return ICC_EINVAL;
-  }
 
-  const uint16_t *nreleased = hm_get(icc->hostrelease, host);
-  if (!nreleased) {  /* ignore empty nodes */
+  /* the node went to another job meanwhile */
+  const uint32_t *jobid = hm_get(icc->hostjob, rel->host);
+  if (!jobid || *jobid != rel->jobid) {
     return ICC_SUCCESS;
   }
 
-  // CHANGE #MUL-JOBS
-  const uint32_t *jobid = hm_get(icc->hostjob, host);
-  if (!jobid) {
-    return ICC_EINVAL;
+  uint16_t nocpu = 0;
+  uint32_t nojobid = 0;
+  if (hm_set(icc->hostrelease, rel->host, &nocpu, sizeof(nocpu)) == -1) {
+    return ICC_ENOMEM;
   }
-  // END CHANGE #MUL-JOBS
-
-  char icrmerr[ICC_ERRSTR_LEN];
-
+  if (hm_set(icc->hostalloc, rel->host, &nocpu, sizeof(nocpu)) == -1) {
+    return ICC_ENOMEM;
+  }
+ 
   // CHANGE JAVI
-  //int rc = icrm_release_node(host, icc->jobid, *nreleased, icrmerr);
-  int rc = icrm_release_node(host, *jobid, *nreleased, icrmerr);
+  if (hm_set(icc->hostjob, rel->host, &nojobid, sizeof(nojobid)) == -1) {
+    return ICC_ENOMEM;
+  }
   // END CHANGE JAVI
 
-  if (rc == ICRM_SUCCESS) {
-    margo_debug(icc->mid, "Released %s:%"PRIu16, host, *nreleased);
-    uint16_t nocpu = 0;
-    uint32_t nojobid = 0;
-    if (hm_set(icc->hostrelease, host, &nocpu, sizeof(nocpu)) == -1) {
-      return ICC_ENOMEM;
-    }
-    if (hm_set(icc->hostalloc, host, &nocpu, sizeof(nocpu)) == -1) {
-      return ICC_ENOMEM;
-    }
- 
-    // CHANGE JAVI
-    if (hm_set(icc->hostjob, host, &nojobid, sizeof(nojobid)) == -1) {
-      return ICC_ENOMEM;
-    }
-      
-    // remove node from redis database
-    int rcdb = icdb_delnodes(icc->icdbs_main, icc->clid, host);
-    if (rcdb != ICDB_SUCCESS) {
-      return ICC_ENOMEM;
-    }
-    // END CHANGE JAVI
+  return ICC_SUCCESS;
+}
 
 
-  } else {
-    margo_info(icc->mid, "Not releasing node %s", host);
-    margo_debug(icc->mid, icrmerr);
-    if (rc == ICRM_EAGAIN) { /* not all CPUs released on node, ignore */
-      rc = ICC_SUCCESS;
-    } else {
-      rc = ICC_FAILURE;
-    }
+static int
+release_node_db(struct icc_context *icc, const char *host)
+{
+  // CHANGE JAVI
+  // remove node from redis database
+  struct icdb_context *icdb = icdb_pool_get(icc->icdb_pool);
+  if (!icdb) {
+    return ICC_ENOMEM;
+  }
+  int rcdb = icdb_delnodes(icdb, icc->clid, host);
+  if (rcdb != ICDB_SUCCESS) {
+    margo_error(icc->mid, "Could not remove node %s from DB: %s", host, icdb_errstr(icdb));
+  }
+  icdb_pool_put(icc->icdb_pool, icdb);
+  if (rcdb != ICDB_SUCCESS) {
+    return ICC_ENOMEM;
   }
+  // END CHANGE JAVI
 
-  margo_info(icc->mid, "release_node: END");
-  return rc;
+  return ICC_SUCCESS;
 }
 
 
@@ -1326,10 +1479,13 @@ _setup_margo(enum icc_log_level log_level, struct icc_context *icc)
   icc->rpcids[RPC_METRIC_ALERT] = MARGO_REGISTER(icc->mid, RPC_METRIC_ALERT_NAME, metricalert_in_t, rpc_out_t, NULL);
   icc->rpcids[RPC_ALERT] = MARGO_REGISTER(icc->mid, RPC_ALERT_NAME, alert_in_t, rpc_out_t, NULL);
   icc->rpcids[RPC_NODEALERT] = MARGO_REGISTER(icc->mid, RPC_NODEALERT_NAME, nodealert_in_t, rpc_out_t, NULL);
+  icc->rpcids[RPC_STATS] = MARGO_REGISTER(icc->mid, RPC_STATS_NAME, stats_in_t, stats_out_t, NULL);
 
   if (icc->bidirectional) {
     icc->rpcids[RPC_CLIENT_REGISTER] = MARGO_REGISTER(icc->mid, RPC_CLIENT_REGISTER_NAME, client_register_in_t, rpc_out_t, NULL);
     icc->rpcids[RPC_CLIENT_DEREGISTER] = MARGO_REGISTER(icc->mid, RPC_CLIENT_DEREGISTER_NAME, client_deregister_in_t, rpc_out_t, NULL);
+    /* registered clients relay the notifications of the IC */
+    icc->rpcids[RPC_MULTICAST] = MARGO_REGISTER(icc->mid, RPC_MULTICAST_NAME, multicast_in_t, rpc_out_t, multicast_cb);
   }
 
   if (icc->type == ICC_TYPE_JOBCLEANER) {
@@ -1401,15 +1557,24 @@ _setup_icrm(struct icc_context *icc)
     return ICC_FAILURE;
   }
 
-  rc = ABT_xstream_create_basic(ABT_SCHED_BASIC_WAIT, 1, &icc->icrm_pool,
-                                ABT_SCHED_CONFIG_NULL, &icc->icrm_xstream);
-  if (rc != ABT_SUCCESS) {
-    margo_debug(icc->mid, "ABT_xstream_create_basic error: ret=%d", rc);
-    return ICC_FAILURE;
+  /* one stream per worker, so that as many RM calls may block */
+  for (unsigned i = 0; i < ICC_ICRM_NWORKERS; i++) {
+    rc = ABT_xstream_create_basic(ABT_SCHED_BASIC_WAIT, 1, &icc->icrm_pool,
+                                  ABT_SCHED_CONFIG_NULL, &icc->icrm_xstreams[i]);
+    if (rc != ABT_SUCCESS) {
+      margo_debug(icc->mid, "ABT_xstream_create_basic error: ret=%d", rc);
+      return ICC_FAILURE;
+    }
   }
 
   icrm_init();
 
+  icrmerr_t icrmret = icrmq_init(&icc->icrmq, icc->icrm_pool, ICC_ICRM_NWORKERS);
+  if (icrmret != ICRM_SUCCESS) {
+    margo_debug(icc->mid, "icrmq_init error: ret=%d", icrmret);
+    return ICC_FAILURE;
+  }
+
   return ICC_SUCCESS;
 }
 
@@ -1422,21 +1587,26 @@ _setup_hostmaps(struct icc_context *icc)
 
   icc->reconfig_flag = ICC_RECONFIG_NONE;
 
-  icc->hostalloc = hm_create();
+  /* the maps are indexed by the same hosts, keep one copy of each name */
+  icc->hostnames = hm_create_strings();
+  if (!icc->hostnames)
+    return ICC_FAILURE;
+
+  icc->hostalloc = hm_create_interned(icc->hostnames);
   if (!icc->hostalloc)
     return ICC_FAILURE;
 
-  icc->hostrelease = hm_create();
+  icc->hostrelease = hm_create_interned(icc->hostnames);
   if (!icc->hostrelease)
     return ICC_FAILURE;
 
   // CHANGE JAVI
-  icc->hostjob = hm_create();
+  icc->hostjob = hm_create_interned(icc->hostnames);
   if (!icc->hostjob)
     return ICC_FAILURE;
   // END CHANGE JAVI
 
-  icc->reconfigalloc = hm_create();
+  icc->reconfigalloc = hm_create_interned(icc->hostnames);
   if (!icc->reconfigalloc)
     return ICC_FAILURE;
  
@@ -1499,107 +1669,6 @@ _register_client(struct icc_context *icc, unsigned int nprocs)
   return rc;
 }
 
-/* ALBERTO - Functions to Store and Load the ICC_CONTEXT for stop and restart apps*/
-
-/**
- * Write a string into a file
-*/
-void 
-_write_string(FILE *file, const char *str) {
-    if(str == NULL){
-      size_t len = 0;
-      fwrite(&len, sizeof(size_t), 1, file);
-    } else {
-      size_t len = strlen(str);
-      fwrite(&len, sizeof(size_t), 1, file);
-      fwrite(str, len, 1, file);
-    }
-}
-
-/**
- * Read a string from file
-*/
-char *
-_read_string(FILE *file) {
-    size_t len;
-    fread(&len, sizeof(size_t), 1, file);
-    if (len == 0)
-      return NULL;
-
-    char *str = (char *)malloc(len + 1);
-    fread(str, len, 1, file);
-    str[len] = '\0';
-    return str;
-}
-
-/**
- * Store relevant data from icc_context to a binary file
-*/
-void 
-_icc_context_backup(struct icc_context *icc, char *filename){
-    FILE *file = fopen(filename, "wb");
-    if (file == NULL) {
-        perror("Error opening file");
-    }
-
-    fwrite(icc, sizeof(struct icc_context), 1, file);
-    _write_string(file, icc->nodelist);
-    _write_string(file, icc->jobnodelist);
-
-    fclose(file);
-
-    /* Now store hashmaps*/
-    serialize_hashmap(icc->hostalloc, "hostalloc.map");
-    serialize_hashmap(icc->hostrelease, "hostrelease.map");
-    serialize_hashmap(icc->reconfigalloc, "reconfigalloc.map");
-    serialize_hashmap(icc->hostjob, "hostjob.map");
-
-    /*Debug*/
-    margo_info(icc->mid, "ICC hostalloc (BAK) size = %d", hm_length(icc->hostalloc));
-    margo_info(icc->mid, "ICC hostrelease (BAK) size = %d", hm_length(icc->hostrelease));
-    margo_info(icc->mid, "ICC reconfigalloc (BAK) size = %d", hm_length(icc->reconfigalloc));
-    margo_info(icc->mid, "ICC hostjob (BAK) size = %d", hm_length(icc->hostjob));
-
-}
-
-/**
- * Load relevant data from binary file to icc_context
-*/
-void 
-_icc_context_load(struct icc_context *icc, char *filename){
-    FILE *file = fopen(filename, "rb");
-    if (file == NULL) {
-        perror("Error opening file");
-    }
-
-    struct icc_context read_context;
-    fread(&read_context, sizeof(struct icc_context), 1, file);
-    icc->registered = read_context.registered;
-    icc->jobid = read_context.jobid;
-    icc->jobstepid = read_context.jobstepid;
-    strcpy(icc->clid, read_context.clid);
-    icc->type = read_context.type;
-
-    icc->nodelist = _read_string(file);
-    icc->jobnodelist = _read_string(file);
-
-    fclose(file);
-
-    /* Now load the hashmaps*/
-    icc->hostalloc = deserialize_hashmap("hostalloc.map");
-    icc->hostrelease = deserialize_hashmap("hostrelease.map");
-    icc->reconfigalloc = deserialize_hashmap("reconfigalloc.map");
-    icc->hostjob = deserialize_hashmap("hostjob.map");
-
-
-    /*Debug*/
-    margo_info(icc->mid, "ICC hostalloc (LOAD) size = %d", hm_length(icc->hostalloc));
-    margo_info(icc->mid, "ICC hostrelease (LOAD) size = %d", hm_length(icc->hostrelease));
-    margo_info(icc->mid, "ICC reconfigalloc (LOAD) size = %d", hm_length(icc->reconfigalloc));
-    margo_info(icc->mid, "ICC hostjob (LOAD) size = %d", hm_length(icc->hostjob));
-}
-
-
 static inline const char *
 _icc_type_str(enum icc_client_type type)
 {
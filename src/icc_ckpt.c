@@ -0,0 +1,800 @@
+#include <dirent.h>             /* opendir */
+#include <errno.h>
+#include <fcntl.h>              /* open */
+#include <inttypes.h>           /* PRIu32 */
+#include <limits.h>             /* PATH_MAX */
+#include <stddef.h>             /* offsetof */
+#include <stdio.h>
+#include <stdlib.h>             /* getenv, strtoull, qsort */
+#include <string.h>
+#include <sys/stat.h>           /* mkdir, fstat */
+#include <unistd.h>             /* fsync */
+#include <margo.h>
+
+#include "crc32c.h"
+#include "hashmap.h"
+#include "icc_ckpt.h"
+
+#define CKPT_MAGIC   "ICCCKPT"    /* 8 bytes with the NUL */
+#define CKPT_VERSION 1            /* bumped on incompatible changes only */
+#define CKPT_HDRLEN  16           /* magic, version, reserved */
+#define CKPT_RECLEN  8            /* tag, flags, length */
+#define CKPT_MAXSIZE (64 << 20)   /* sanity limit when loading */
+#define CKPT_PREFIX  "ckpt."
+
+/* record tags, append only */
+enum ckpt_tag {
+  CKPT_END = 0,                 /* CRC32C of everything before */
+  CKPT_CLID,
+  CKPT_JOBID,
+  CKPT_JOBSTEPID,
+  CKPT_TYPE,
+  CKPT_REGISTERED,
+  CKPT_RECONFIG,
+  CKPT_NODELIST,
+  CKPT_JOBNODELIST,
+  CKPT_HOSTALLOC,
+  CKPT_HOSTRELEASE,
+  CKPT_HOSTJOB,
+  CKPT_RECONFIGALLOC,
+};
+
+/* host maps of the context and the size of their values, as stored by
+   icc.c */
+static const struct {
+  enum ckpt_tag tag;
+  const char    *name;
+  size_t        offset;
+  uint8_t       width;
+} ckpt_maps[] = {
+  { CKPT_HOSTALLOC, "hostalloc", offsetof(struct icc_context, hostalloc), sizeof(uint16_t) },
+  { CKPT_HOSTRELEASE, "hostrelease", offsetof(struct icc_context, hostrelease), sizeof(unsigned int) },
+  { CKPT_HOSTJOB, "hostjob", offsetof(struct icc_context, hostjob), sizeof(uint32_t) },
+  { CKPT_RECONFIGALLOC, "reconfigalloc", offsetof(struct icc_context, reconfigalloc), sizeof(uint16_t) },
+};
+
+#define CKPT_NMAPS (sizeof(ckpt_maps) / sizeof(ckpt_maps[0]))
+#define CKPT_MAP(icc,i) (*(hm_t **)((char *)(icc) + ckpt_maps[i].offset))
+
+/* semantic state read from a checkpoint, applied once fully decoded */
+struct ckpt_state {
+  char     clid[UUID_STR_LEN];
+  uint64_t jobid;
+  uint64_t jobstepid;
+  uint64_t type;
+  uint64_t registered;
+  uint64_t reconfig;
+  char     *nodelist;
+  char     *jobnodelist;
+  hm_t     *maps[CKPT_NMAPS];
+};
+
+struct ckpt_buf {
+  unsigned char *data;
+  size_t        len;
+  size_t        size;
+  int           err;            /* allocation failed */
+};
+
+
+static void
+le_store(unsigned char *p, uint64_t v, size_t width)
+{
+  for (size_t i = 0; i < width; i++)
+    p[i] = (v >> (8 * i)) & 0xff;
+}
+
+static uint64_t
+le_load(const unsigned char *p, size_t width)
+{
+  uint64_t v = 0;
+  for (size_t i = 0; i < width; i++)
+    v |= (uint64_t)p[i] << (8 * i);
+  return v;
+}
+
+/**
+ * Return the value of WIDTH bytes at P, in host order.
+ */
+static uint64_t
+value_load(const void *p, uint8_t width)
+{
+  uint16_t v16;
+  uint32_t v32;
+
+  switch (width) {
+  case sizeof(uint16_t):
+    memcpy(&v16, p, sizeof(v16));
+    return v16;
+  case sizeof(uint32_t):
+    memcpy(&v32, p, sizeof(v32));
+    return v32;
+  default:
+    return 0;
+  }
+}
+
+
+static void
+buf_put(struct ckpt_buf *b, const void *p, size_t len)
+{
+  if (b->err)
+    return;
+
+  if (b->len + len > b->size) {
+    size_t size = b->size ? b->size : 4096;
+    while (size < b->len + len)
+      size *= 2;
+    unsigned char *data = realloc(b->data, size);
+    if (!data) {
+      b->err = 1;
+      return;
+    }
+    b->data = data;
+    b->size = size;
+  }
+  memcpy(b->data + b->len, p, len);
+  b->len += len;
+}
+
+static void
+buf_uint(struct ckpt_buf *b, uint64_t v, size_t width)
+{
+  unsigned char p[sizeof(v)];
+  le_store(p, v, width);
+  buf_put(b, p, width);
+}
+
+/**
+ * Start a record of type TAG, return the position of its length.
+ */
+static size_t
+rec_begin(struct ckpt_buf *b, enum ckpt_tag tag)
+{
+  size_t pos;
+
+  buf_uint(b, tag, 2);
+  buf_uint(b, 0, 2);
+  pos = b->len;
+  buf_uint(b, 0, 4);
+  return pos;
+}
+
+static void
+rec_end(struct ckpt_buf *b, size_t pos)
+{
+  if (!b->err)
+    le_store(b->data + pos, b->len - pos - 4, 4);
+}
+
+static void
+rec_uint(struct ckpt_buf *b, enum ckpt_tag tag, uint64_t v, size_t width)
+{
+  size_t pos = rec_begin(b, tag);
+  buf_uint(b, v, width);
+  rec_end(b, pos);
+}
+
+/**
+ * Add a record for string STR, a NULL string is left out.
+ */
+static void
+rec_str(struct ckpt_buf *b, enum ckpt_tag tag, const char *str)
+{
+  if (!str)
+    return;
+
+  size_t pos = rec_begin(b, tag);
+  buf_put(b, str, strlen(str));
+  rec_end(b, pos);
+}
+
+/**
+ * Add a record for MAP: the width of the values and the number of
+ * items, then the length of each key, the key and the value.
+ */
+static int
+rec_map(struct ckpt_buf *b, enum ckpt_tag tag, hm_t *map, uint8_t width)
+{
+  const char *key;
+  const void *value;
+  size_t curs = 0;
+
+  if (!map)
+    return ICC_SUCCESS;
+
+  size_t pos = rec_begin(b, tag);
+  buf_uint(b, width, 1);
+  buf_uint(b, hm_length(map), 4);
+  while ((curs = hm_next(map, curs, &key, &value)) != 0) {
+    size_t keylen = strlen(key);
+    if (keylen > UINT16_MAX)
+      return ICC_EOVERFLOW;
+    buf_uint(b, keylen, 2);
+    buf_put(b, key, keylen);
+    buf_uint(b, value_load(value, width), width);
+  }
+  rec_end(b, pos);
+
+  return ICC_SUCCESS;
+}
+
+static int
+ckpt_encode(struct icc_context *icc, struct ckpt_buf *b)
+{
+  unsigned char hdr[CKPT_HDRLEN] = { 0 };
+  int rc;
+
+  memcpy(hdr, CKPT_MAGIC, sizeof(CKPT_MAGIC));
+  le_store(hdr + sizeof(CKPT_MAGIC), CKPT_VERSION, 4);
+  buf_put(b, hdr, sizeof(hdr));
+
+  rec_str(b, CKPT_CLID, icc->clid);
+  rec_uint(b, CKPT_JOBID, icc->jobid, 4);
+  rec_uint(b, CKPT_JOBSTEPID, icc->jobstepid, 4);
+  rec_uint(b, CKPT_TYPE, icc->type, 4);
+  rec_uint(b, CKPT_REGISTERED, icc->registered, 1);
+  rec_uint(b, CKPT_RECONFIG, icc->reconfig_flag, 4);
+  rec_str(b, CKPT_NODELIST, icc->nodelist);
+  rec_str(b, CKPT_JOBNODELIST, icc->jobnodelist);
+
+  for (size_t i = 0; i < CKPT_NMAPS; i++) {
+    rc = rec_map(b, ckpt_maps[i].tag, CKPT_MAP(icc, i), ckpt_maps[i].width);
+    if (rc)
+      return rc;
+  }
+
+  if (b->err)
+    return ICC_ENOMEM;
+
+  rec_uint(b, CKPT_END, crc32c(0, b->data, b->len), 4);
+
+  return b->err ? ICC_ENOMEM : ICC_SUCCESS;
+}
+
+
+/**
+ * Check the header and the checksum of the checkpoint of LEN bytes at
+ * DATA, and put the offset of the END record in END.
+ *
+ * Return 0 on success, -errno on error.
+ */
+static int
+ckpt_check(const unsigned char *data, size_t len, size_t *end)
+{
+  size_t pos;
+
+  if (len < CKPT_HDRLEN || memcmp(data, CKPT_MAGIC, sizeof(CKPT_MAGIC)))
+    return -EINVAL;
+
+  if (le_load(data + sizeof(CKPT_MAGIC), 4) > CKPT_VERSION)
+    return -ENOTSUP;
+
+  pos = CKPT_HDRLEN;
+  while (len - pos >= CKPT_RECLEN) {
+    uint64_t tag = le_load(data + pos, 2);
+    uint64_t reclen = le_load(data + pos + 4, 4);
+
+    if (reclen > len - pos - CKPT_RECLEN)
+      return -EBADMSG;
+
+    if (tag == CKPT_END) {
+      if (reclen != 4 || pos + CKPT_RECLEN + reclen != len ||
+          le_load(data + pos + CKPT_RECLEN, 4) != crc32c(0, data, pos))
+        return -EBADMSG;
+      *end = pos;
+      return 0;
+    }
+    pos += CKPT_RECLEN + reclen;
+  }
+
+  /* truncated */
+  return -EBADMSG;
+}
+
+static int
+dec_uint(const unsigned char *p, size_t len, uint64_t max, uint64_t *v)
+{
+  if (len != 1 && len != 2 && len != 4 && len != 8)
+    return -EBADMSG;
+
+  *v = le_load(p, len);
+
+  return *v > max ? -ERANGE : 0;
+}
+
+static int
+dec_str(const unsigned char *p, size_t len, char **str)
+{
+  if (memchr(p, '\0', len))
+    return -EBADMSG;
+
+  free(*str);
+  *str = strndup((const char *)p, len);
+
+  return *str ? 0 : -ENOMEM;
+}
+
+/**
+ * Decode a map record into a new map interned in STRINGS.
+ */
+static int
+dec_map(const unsigned char *p, size_t len, uint8_t width, hm_t *strings, hm_t **map)
+{
+  const unsigned char *end = p + len;
+  uint64_t max = width == sizeof(uint16_t) ? UINT16_MAX : UINT32_MAX;
+  uint8_t recwidth;
+  uint32_t count;
+  int rc;
+
+  if (len < 5)
+    return -EBADMSG;
+
+  recwidth = p[0];
+  count = le_load(p + 1, 4);
+  p += 5;
+
+  if (recwidth != 1 && recwidth != 2 && recwidth != 4 && recwidth != 8)
+    return -EBADMSG;
+
+  /* each item takes at least its key length and value */
+  if (count > (size_t)(end - p) / (2 + recwidth))
+    return -EBADMSG;
+
+  hm_free(*map);
+  *map = hm_create_interned(strings);
+  if (!*map || hm_reserve(*map, count))
+    return -ENOMEM;
+
+  for (uint32_t i = 0; i < count; i++) {
+    uint16_t keylen;
+    uint64_t v;
+    char *key;
+
+    if (end - p < 2)
+      return -EBADMSG;
+    keylen = le_load(p, 2);
+    p += 2;
+
+    if ((size_t)(end - p) < (size_t)keylen + recwidth || memchr(p, '\0', keylen))
+      return -EBADMSG;
+
+    v = le_load(p + keylen, recwidth);
+    if (v > max)
+      return -ERANGE;
+
+    key = strndup((const char *)p, keylen);
+    if (!key)
+      return -ENOMEM;
+
+    if (width == sizeof(uint16_t)) {
+      uint16_t v16 = v;
+      rc = hm_set(*map, key, &v16, sizeof(v16));
+    } else {
+      uint32_t v32 = v;
+      rc = hm_set(*map, key, &v32, sizeof(v32));
+    }
+    free(key);
+    if (rc == -1)
+      return -ENOMEM;
+
+    p += keylen + recwidth;
+  }
+
+  return p == end ? 0 : -EBADMSG;
+}
+
+/**
+ * Decode the records of a checked checkpoint into STATE, with maps
+ * interned in STRINGS.
+ */
+static int
+ckpt_decode(const unsigned char *data, size_t end, hm_t *strings,
+            struct ckpt_state *state)
+{
+  size_t pos = CKPT_HDRLEN;
+  int rc = 0;
+
+  while (pos < end && rc == 0) {
+    uint16_t tag = le_load(data + pos, 2);
+    uint32_t len = le_load(data + pos + 4, 4);
+    const unsigned char *p = data + pos + CKPT_RECLEN;
+
+    switch (tag) {
+    case CKPT_CLID:
+      if (len >= sizeof(state->clid) || memchr(p, '\0', len))
+        return -EBADMSG;
+      memcpy(state->clid, p, len);
+      state->clid[len] = '\0';
+      break;
+    case CKPT_JOBID:
+      rc = dec_uint(p, len, UINT32_MAX, &state->jobid);
+      break;
+    case CKPT_JOBSTEPID:
+      rc = dec_uint(p, len, UINT32_MAX, &state->jobstepid);
+      break;
+    case CKPT_TYPE:
+      rc = dec_uint(p, len, ICC_TYPE_COUNT - 1, &state->type);
+      break;
+    case CKPT_REGISTERED:
+      rc = dec_uint(p, len, 1, &state->registered);
+      break;
+    case CKPT_RECONFIG:
+      rc = dec_uint(p, len, ICC_RECONFIG_SHRINK, &state->reconfig);
+      break;
+    case CKPT_NODELIST:
+      rc = dec_str(p, len, &state->nodelist);
+      break;
+    case CKPT_JOBNODELIST:
+      rc = dec_str(p, len, &state->jobnodelist);
+      break;
+    default:
+      for (size_t i = 0; i < CKPT_NMAPS; i++) {
+        if (ckpt_maps[i].tag == tag) {
+          rc = dec_map(p, len, ckpt_maps[i].width, strings, &state->maps[i]);
+          break;
+        }
+      }
+      /* unknown tags are left to newer versions */
+      break;
+    }
+    pos += CKPT_RECLEN + len;
+  }
+
+  return rc;
+}
+
+static void
+ckpt_state_free(struct ckpt_state *state)
+{
+  free(state->nodelist);
+  free(state->jobnodelist);
+  for (size_t i = 0; i < CKPT_NMAPS; i++)
+    hm_free(state->maps[i]);
+}
+
+
+/**
+ * Put the checkpoint directory of job JOBID in BUF of size SIZE.
+ *
+ * Return 0 on success, -errno on error.
+ */
+static int
+ckpt_dir(uint32_t jobid, char *buf, size_t size)
+{
+  const char *base = getenv(ICC_CKPT_ENV);
+  if (!base || base[0] == '\0')
+    base = ICC_CKPT_DIR_DEFAULT;
+
+  if (snprintf(buf, size, "%s/icc-ckpt.%"PRIu32, base, jobid) >= (int)size)
+    return -ENAMETOOLONG;
+
+  return 0;
+}
+
+static int
+gen_cmp(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  /* newest first */
+  return (x < y) - (x > y);
+}
+
+/**
+ * List the generations present in DIR in GENS, newest first. GENS
+ * must be freed by the caller.
+ *
+ * Return 0 on success, -errno on error.
+ */
+static int
+ckpt_generations(const char *dir, uint64_t **gens, size_t *ngens)
+{
+  struct dirent *ent;
+  size_t size = 0;
+  DIR *d;
+
+  *gens = NULL;
+  *ngens = 0;
+
+  d = opendir(dir);
+  if (!d)
+    return errno == ENOENT ? 0 : -errno;
+
+  while ((ent = readdir(d)) != NULL) {
+    const char *num = ent->d_name + sizeof(CKPT_PREFIX) - 1;
+    char *end;
+
+    /* skip temporary files and anything else */
+    if (strncmp(ent->d_name, CKPT_PREFIX, sizeof(CKPT_PREFIX) - 1) ||
+        *num < '0' || *num > '9')
+      continue;
+
+    errno = 0;
+    unsigned long long gen = strtoull(num, &end, 10);
+    if (errno || *end != '\0')
+      continue;
+
+    if (*ngens == size) {
+      size = size ? size * 2 : 8;
+      uint64_t *tmp = realloc(*gens, size * sizeof(**gens));
+      if (!tmp) {
+        closedir(d);
+        free(*gens);
+        *gens = NULL;
+        *ngens = 0;
+        return -ENOMEM;
+      }
+      *gens = tmp;
+    }
+    (*gens)[(*ngens)++] = gen;
+  }
+  closedir(d);
+
+  if (*ngens)
+    qsort(*gens, *ngens, sizeof(**gens), gen_cmp);
+
+  return 0;
+}
+
+/**
+ * Write the LEN bytes at DATA to the temporary file TMPNAME, sync it
+ * and rename it to FILENAME.
+ *
+ * Return 0 on success, -errno on error.
+ */
+static int
+ckpt_write(const char *tmpname, const char *filename, const void *data, size_t len)
+{
+  FILE *file = fopen(tmpname, "wb");
+  if (!file)
+    return -errno;
+
+  if (fwrite(data, len, 1, file) != 1 ||
+      fflush(file) ||
+      fsync(fileno(file)))
+    goto error;
+
+  if (fclose(file)) {
+    file = NULL;
+    goto error;
+  }
+  file = NULL;
+
+  if (rename(tmpname, filename))
+    goto error;
+
+  return 0;
+
+ error:
+  {
+    int errsv = errno;
+    if (file)
+      fclose(file);
+    unlink(tmpname);
+    return -errsv;
+  }
+}
+
+/**
+ * Sync directory DIR, so that a rename in it is durable.
+ */
+static int
+sync_dir(const char *dir)
+{
+  int rc = 0;
+  int fd = open(dir, O_RDONLY | O_DIRECTORY);
+  if (fd == -1)
+    return -errno;
+  if (fsync(fd))
+    rc = -errno;
+  close(fd);
+  return rc;
+}
+
+/**
+ * Read checkpoint FILENAME in a buffer allocated in DATA, of size LEN.
+ *
+ * Return 0 on success, -errno on error.
+ */
+static int
+ckpt_read(const char *filename, unsigned char **data, size_t *len)
+{
+  struct stat st;
+  int rc = 0;
+
+  *data = NULL;
+
+  FILE *file = fopen(filename, "rb");
+  if (!file)
+    return -errno;
+
+  if (fstat(fileno(file), &st)) {
+    rc = -errno;
+    goto end;
+  }
+
+  if (st.st_size > CKPT_MAXSIZE) {
+    rc = -EFBIG;
+    goto end;
+  }
+
+  *len = st.st_size;
+  *data = malloc(*len ? *len : 1);
+  if (!*data) {
+    rc = -ENOMEM;
+    goto end;
+  }
+
+  if (*len && fread(*data, *len, 1, file) != 1) {
+    rc = ferror(file) ? -EIO : -EBADMSG;
+    free(*data);
+    *data = NULL;
+  }
+
+ end:
+  fclose(file);
+  return rc;
+}
+
+
+int
+icc_ckpt_save(struct icc_context *icc)
+{
+  struct ckpt_buf b = { 0 };
+  char dir[PATH_MAX], path[PATH_MAX], tmpname[PATH_MAX];
+  uint64_t *gens = NULL;
+  size_t ngens;
+  uint64_t gen;
+  int rc;
+
+  rc = ckpt_dir(icc->jobid, dir, sizeof(dir));
+  if (rc) {
+    margo_error(icc->mid, "icc (checkpoint): %s", strerror(-rc));
+    return ICC_FAILURE;
+  }
+
+  if (mkdir(dir, 0700) && errno != EEXIST) {
+    margo_error(icc->mid, "icc (checkpoint): Cannot create %s: %s", dir, strerror(errno));
+    return ICC_FAILURE;
+  }
+
+  rc = ckpt_generations(dir, &gens, &ngens);
+  if (rc) {
+    margo_error(icc->mid, "icc (checkpoint): Cannot list %s: %s", dir, strerror(-rc));
+    return ICC_FAILURE;
+  }
+  gen = ngens ? gens[0] + 1 : 1;
+
+  if (icc->hostlock)
+    ABT_rwlock_rdlock(icc->hostlock);
+  rc = ckpt_encode(icc, &b);
+  if (icc->hostlock)
+    ABT_rwlock_unlock(icc->hostlock);
+
+  if (rc) {
+    margo_error(icc->mid, "icc (checkpoint): Cannot encode context (ret=%d)", rc);
+    goto end;
+  }
+
+  if (snprintf(path, sizeof(path), "%s/"CKPT_PREFIX"%"PRIu64, dir, gen) >= (int)sizeof(path) ||
+      snprintf(tmpname, sizeof(tmpname), "%s.tmp", path) >= (int)sizeof(tmpname)) {
+    margo_error(icc->mid, "icc (checkpoint): %s", strerror(ENAMETOOLONG));
+    rc = ICC_FAILURE;
+    goto end;
+  }
+
+  rc = ckpt_write(tmpname, path, b.data, b.len);
+  if (!rc)
+    rc = sync_dir(dir);
+  if (rc) {
+    margo_error(icc->mid, "icc (checkpoint): Cannot write %s: %s", path, strerror(-rc));
+    rc = ICC_FAILURE;
+    goto end;
+  }
+
+  margo_info(icc->mid, "icc (checkpoint): Saved %s (%lu bytes)", path, (unsigned long)b.len);
+
+  /* the new generation is durable, drop the oldest ones */
+  for (size_t i = ICC_CKPT_GENERATIONS - 1; i < ngens; i++) {
+    if (snprintf(path, sizeof(path), "%s/"CKPT_PREFIX"%"PRIu64, dir, gens[i]) < (int)sizeof(path) &&
+        unlink(path) && errno != ENOENT)
+      margo_warning(icc->mid, "icc (checkpoint): Cannot remove %s: %s", path, strerror(errno));
+  }
+
+ end:
+  free(gens);
+  free(b.data);
+  return rc;
+}
+
+
+int
+icc_ckpt_load(struct icc_context *icc, uint32_t jobid)
+{
+  char dir[PATH_MAX], path[PATH_MAX];
+  uint64_t *gens = NULL;
+  size_t ngens;
+  int rc;
+
+  rc = ckpt_dir(jobid, dir, sizeof(dir));
+  if (rc) {
+    margo_error(icc->mid, "icc (restore): %s", strerror(-rc));
+    return ICC_FAILURE;
+  }
+
+  rc = ckpt_generations(dir, &gens, &ngens);
+  if (rc) {
+    margo_error(icc->mid, "icc (restore): Cannot list %s: %s", dir, strerror(-rc));
+    return ICC_FAILURE;
+  }
+
+  if (!icc->hostnames) {
+    icc->hostnames = hm_create_strings();
+    if (!icc->hostnames) {
+      free(gens);
+      return ICC_ENOMEM;
+    }
+  }
+
+  rc = ICC_FAILURE;
+
+  for (size_t i = 0; i < ngens; i++) {
+    struct ckpt_state state = { 0 };
+    unsigned char *data;
+    size_t len, end;
+    int err;
+
+    if (snprintf(path, sizeof(path), "%s/"CKPT_PREFIX"%"PRIu64, dir, gens[i]) >= (int)sizeof(path))
+      continue;
+
+    err = ckpt_read(path, &data, &len);
+    if (!err)
+      err = ckpt_check(data, len, &end);
+    if (!err)
+      err = ckpt_decode(data, end, icc->hostnames, &state);
+    free(data);
+
+    if (err) {
+      margo_warning(icc->mid, "icc (restore): Skipping %s: %s", path, strerror(-err));
+      ckpt_state_free(&state);
+      continue;
+    }
+
+    strcpy(icc->clid, state.clid);
+    icc->jobid = state.jobid;
+    icc->jobstepid = state.jobstepid;
+    icc->type = state.type;
+    icc->registered = state.registered;
+    icc->reconfig_flag = state.reconfig;
+
+    free(icc->nodelist);
+    icc->nodelist = state.nodelist;
+    free(icc->jobnodelist);
+    icc->jobnodelist = state.jobnodelist;
+
+    /* maps missing from the checkpoint are empty */
+    for (size_t j = 0; j < CKPT_NMAPS; j++) {
+      if (!state.maps[j])
+        state.maps[j] = hm_create_interned(icc->hostnames);
+      hm_free(CKPT_MAP(icc, j));
+      CKPT_MAP(icc, j) = state.maps[j];
+      if (!state.maps[j])
+        rc = ICC_ENOMEM;
+      else
+        margo_info(icc->mid, "icc (restore): %s: %lu hosts", ckpt_maps[j].name,
+                   (unsigned long)hm_length(state.maps[j]));
+    }
+
+    if (rc != ICC_ENOMEM) {
+      margo_info(icc->mid, "icc (restore): Restored %s", path);
+      rc = ICC_SUCCESS;
+    }
+    break;
+  }
+
+  if (rc == ICC_FAILURE)
+    margo_error(icc->mid, "icc (restore): No valid checkpoint in %s", dir);
+
+  free(gens);
+  return rc;
+}
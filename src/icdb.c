@@ -1,17 +1,20 @@
 #include <assert.h>
 #include <errno.h>
 #include <inttypes.h>           /* PRIuXX */
+#include <stddef.h>             /* offsetof */
 #include <stdlib.h>             /* malloc */
 #include <string.h>             /* strncpy */
 #include <hiredis.h>
 #include <margo.h>
-#include <unistd.h>             /* sleep */ // CHANGE: JAVI
 #include <time.h>
 
 
 #include "uuid_admire.h"        /* UUID_STR_LEN */
 
 #include "icdb.h"
+#include "arena.h"
+#include "hashmap.h"
+#include "icstats.h"
 
 /** XX TODO
  *
@@ -36,20 +39,6 @@
     ICDB_SET_STATUS(icdb, ICDB_FAILURE, "Failure");                     \
   }
 
-#define ICDB_GET_STRDUP(icdb,rep,dest,name) switch (_icdb_get_strdup(rep, dest)) { \
-  case ICDB_SUCCESS:                                                    \
-    ICDB_SET_STATUS(icdb, ICDB_SUCCESS, "Success");                     \
-    break;                                                              \
-  case ICDB_EPARAM:                                                     \
-    ICDB_SET_STATUS(icdb, ICDB_EPARAM, "Bad parameters for %s", name);  \
-    break;                                                              \
-  case ICDB_ENOMEM:                                                     \
-    ICDB_SET_STATUS(icdb, ICDB_ENOMEM, "Out of memory field %s", name); \
-    break;                                                              \
-  default:                                                              \
-    ICDB_SET_STATUS(icdb, ICDB_FAILURE, "Failure");                     \
-  }
-
 #define ICDB_GET_INT(icdb,rep,dest,name,fmt) {                         \
     CHECK_REP_TYPE(icdb, rep, REDIS_REPLY_STRING);                      \
     int _n = sscanf(rep->str, "%"fmt, dest);                            \
@@ -61,10 +50,7 @@
       ICDB_SET_STATUS(icdb, ICDB_FAILURE, "No conversion possible for %s", name); \
   }
 
-#define ICDB_GET_UINT16(icdb,rep,dest,name)  ICDB_GET_INT(icdb,rep,dest,name,SCNu16)
 #define ICDB_GET_UINT32(icdb,rep,dest,name)  ICDB_GET_INT(icdb,rep,dest,name,SCNu32)
-#define ICDB_GET_UINT64(icdb,rep,dest,name)  ICDB_GET_INT(icdb,rep,dest,name,SCNu64)
-#define ICDB_GET_INT32(icdb,rep,dest,name)  ICDB_GET_INT(icdb,rep,dest,name,SCNi32)
 
 #define CHECK_ICDB(icdb)  if (!(icdb) || !(icdb)->redisctx) {           \
     if ((icdb)) {                                                       \
@@ -82,36 +68,320 @@
     ICDB_SET_STATUS(icdb, ICDB_EBADRESP, "Null DB response");           \
     return ICDB_FAILURE;                                                \
   } else if ((rep)->type == REDIS_REPLY_ERROR) {                        \
-    ICDB_SET_STATUS(icdb, ICDB_EBADRESP, (rep)->str);                   \
+    ICDB_SET_STATUS(icdb, ICDB_EBADRESP, "%s", (rep)->str);             \
+    freeReplyObject(rep);                                               \
     return ICDB_FAILURE;                                                \
   }
 
 #define CHECK_REP_TYPE(icdb,rep,rtype) CHECK_REP(icdb, rep);            \
   if ((rep)->type != rtype) {                                           \
     ICDB_SET_STATUS(icdb, ICDB_EBADRESP, "Expected Redis response type %d, got %d", rtype, (rep)->type); \
+    freeReplyObject(rep);                                               \
     return ICDB_FAILURE;                                                \
   }
 
+/* max number of pipelined replies held at once when only their
+   type is checked */
+#define ICDB_PIPELINE_CHUNK 64
+
+/* default number of clients fetched per index scan page */
+#define ICDB_SCAN_BATCH 128
+
+/* in the order of client_schema */
 #define ICDB_CLIENT_QUERY "GET client:*->clid " \
   "GET client:*->type "                         \
   "GET client:*->addr "                         \
   "GET client:*->nodelist "                     \
   "GET client:*->provid "                       \
   "GET client:*->jobid "                        \
+  "GET client:*->nnodes "                       \
   "GET client:*->nprocs "                       \
   "GET client:*->reconfig_nprocs "              \
   "GET client:*->reconfig_nnodes"
 
 
+/*
+ * Reply decoding. A schema maps the fields of a DB hash to the
+ * members of a struct, which are filled directly from the reply
+ * elements: fixed-size strings are copied in place, unbounded ones go
+ * to the arena of the context or are allocated, and integers are
+ * range-checked against the size of the member.
+ */
+enum icdb_ftype {
+  ICDB_F_STR,                   /* char[], error if too long */
+  ICDB_F_ASTR,                  /* char *, in the context arena */
+  ICDB_F_DUP,                   /* char *, malloc'ed, frees the previous one */
+  ICDB_F_UINT,
+  ICDB_F_INT,
+};
+
+struct icdb_field {
+  const char      *name;
+  size_t           namelen;
+  enum icdb_ftype  type;
+  size_t           offset;
+  size_t           size;        /* of the member */
+};
+
+/* the hash field has the name of the member */
+#define ICDB_FIELD(stype,member,ftype)                                  \
+  { #member, sizeof(#member) - 1, ftype, offsetof(stype, member),       \
+    sizeof(((stype *)0)->member) }
+
+static const struct icdb_field client_schema[] = {
+  ICDB_FIELD(struct icdb_client, clid, ICDB_F_STR),
+  ICDB_FIELD(struct icdb_client, type, ICDB_F_STR),
+  ICDB_FIELD(struct icdb_client, addr, ICDB_F_STR),
+  ICDB_FIELD(struct icdb_client, nodelist, ICDB_F_ASTR),
+  ICDB_FIELD(struct icdb_client, provid, ICDB_F_UINT),
+  ICDB_FIELD(struct icdb_client, jobid, ICDB_F_UINT),
+  ICDB_FIELD(struct icdb_client, nnodes, ICDB_F_UINT),
+  ICDB_FIELD(struct icdb_client, nprocs, ICDB_F_UINT),
+  ICDB_FIELD(struct icdb_client, reconfig_nprocs, ICDB_F_INT),
+  ICDB_FIELD(struct icdb_client, reconfig_nnodes, ICDB_F_INT),
+};
+
+static const struct icdb_field job_schema[] = {
+  ICDB_FIELD(struct icdb_job, jobid, ICDB_F_UINT),
+  ICDB_FIELD(struct icdb_job, nnodes, ICDB_F_UINT),
+  ICDB_FIELD(struct icdb_job, ncpus, ICDB_F_UINT),
+  ICDB_FIELD(struct icdb_job, nodelist, ICDB_F_DUP),
+};
+
+#define ICDB_NFIELDS(schema) (sizeof(schema) / sizeof(schema[0]))
+
+
+
+/*
+ * Server-side library. Multi-key client operations run as a single
+ * atomic call instead of one round-trip per command. The library is
+ * loaded as a Redis Function (Redis >= 7); older servers get the same
+ * code as plain scripts called with EVALSHA. Bump ICDB_LUA_VERSION
+ * whenever the Lua code changes so that the library stored on the
+ * server gets replaced.
+ *
+ * Every function takes its parameters as ARGV and builds the keys
+ * itself, which only works against a standalone Redis.
+ */
+#define ICDB_LUA_VERSION 4
+
+#define ICDB_LUA_PRELUDE                                                \
+  "local function split(s)\n"                                           \
+  "  local t = {}\n"                                                    \
+  "  for n in string.gmatch(s, '[^,]+') do t[#t+1] = n end\n"           \
+  "  return t\n"                                                        \
+  "end\n"                                                               \
+  /* unpack is limited by the Lua stack size */                         \
+  "local function rpush(key, t)\n"                                      \
+  "  for i = 1, #t, 1000 do\n"                                          \
+  "    redis.call('RPUSH', key, unpack(t, i, math.min(i + 999, #t)))\n" \
+  "  end\n"                                                             \
+  "end\n"                                                               \
+  "local function delclient(clid)\n"                                    \
+  "  local f = redis.call('HMGET', 'client:' .. clid, 'jobid', 'type')\n" \
+  "  if not f[1] then return false end\n"                               \
+  "  redis.call('SREM', 'index:clients:jobid:' .. f[1], clid)\n"        \
+  "  redis.call('SREM', 'index:clients:type:' .. (f[2] or ''), clid)\n" \
+  "  redis.call('SREM', 'index:clients', clid)\n"                       \
+  "  redis.call('DEL', 'client:' .. clid, 'nodelist:client:' .. clid,\n" \
+  "             'nodelist:job:' .. f[1], 'client:' .. clid .. ':reconfig',\n" \
+  "             'index:monitorFlexMPI:' .. clid, 'monitorFlexMPI:' .. clid .. ':samples')\n" \
+  "  return tonumber(f[1])\n"                                           \
+  "end\n"
+
+/* ARGV: clid type addr nodelist provid jobid jobncpus jobnodelist nprocs */
+#define ICDB_LUA_SETCLIENT                                              \
+  "local clid, jobid = args[1], args[6]\n"                              \
+  "local ckey = 'client:' .. clid\n"                                    \
+  /* re-registering client, only update its address */                 \
+  "if redis.call('HEXISTS', ckey, 'addr') == 1 then\n"                  \
+  "  redis.call('HSET', ckey, 'addr', args[3])\n"                       \
+  "  return 0\n"                                                        \
+  "end\n"                                                               \
+  "local nodes = split(args[8])\n"                                      \
+  "rpush('nodelist:client:' .. clid, nodes)\n"                          \
+  "rpush('nodelist:job:' .. jobid, nodes)\n"                            \
+  "redis.call('HSET', 'job:' .. jobid, 'jobid', jobid, 'ncpus', args[7],\n" \
+  "           'nnodes', #nodes, 'nodelist', args[8])\n"                 \
+  "redis.call('HSET', ckey, 'clid', clid, 'type', args[2], 'addr', args[3],\n" \
+  "           'nnodes', #nodes, 'nodelist', args[4], 'provid', args[5],\n" \
+  "           'jobid', jobid, 'nprocs', args[9],\n"                     \
+  "           'reconfig_nprocs', 0, 'reconfig_nnodes', 0)\n"            \
+  "redis.call('SADD', 'index:clients', clid)\n"                         \
+  "redis.call('SADD', 'index:clients:type:' .. args[2], clid)\n"        \
+  "redis.call('SADD', 'index:clients:jobid:' .. jobid, clid)\n"         \
+  "return 1\n"
+
+/* ARGV: clid. Returns the jobid of the client or nil */
+#define ICDB_LUA_DELCLIENT                      \
+  "return delclient(args[1])\n"
+
+/* ARGV: jobid. Returns the number of clients deleted */
+#define ICDB_LUA_DELJOB                                                 \
+  "local n = 0\n"                                                       \
+  "for _, clid in ipairs(redis.call('SMEMBERS', 'index:clients:jobid:' .. args[1])) do\n" \
+  "  if delclient(clid) then n = n + 1 end\n"                           \
+  "end\n"                                                               \
+  "redis.call('DEL', 'job:' .. args[1])\n"                              \
+  "return n\n"
+
+/* ARGV: clid nodelist. Returns the number of nodes added */
+#define ICDB_LUA_ADDNODES                               \
+  "local nodes = split(args[2])\n"                      \
+  "rpush('nodelist:client:' .. args[1], nodes)\n"       \
+  "return #nodes\n"
+
+/* ARGV: clid key value. Writer side of the FlexMPI monitor: store
+   the current iteration data of a client and index its key, so that
+   readers never have to search the keyspace */
+#define ICDB_LUA_MONITOR_SET                                            \
+  "redis.call('SET', args[2], args[3])\n"                               \
+  "redis.call('SET', 'index:monitorFlexMPI:' .. args[1], args[2])\n"    \
+  "return 1\n"
+
+/* ARGV: clid rtime ctime window. Add an iteration time sample to the
+   rolling window of the client. Returns the number of samples in the
+   window followed by the average rtime and ctime, as strings since
+   Lua numbers would be truncated to integers */
+#define ICDB_LUA_MONITOR_SAMPLE                                         \
+  "local key = 'monitorFlexMPI:' .. args[1] .. ':samples'\n"            \
+  "redis.call('LPUSH', key, args[2] .. ' ' .. args[3])\n"               \
+  "redis.call('LTRIM', key, 0, tonumber(args[4]) - 1)\n"                \
+  "local s = redis.call('LRANGE', key, 0, -1)\n"                        \
+  "local r, c = 0, 0\n"                                                 \
+  "for _, v in ipairs(s) do\n"                                          \
+  "  local a, b = string.match(v, '(%S+) (%S+)')\n"                     \
+  "  r = r + tonumber(a)\n"                                             \
+  "  c = c + tonumber(b)\n"                                             \
+  "end\n"                                                               \
+  "return {#s, tostring(r / #s), tostring(c / #s)}\n"
+
+/* ARGV: clid. Returns the first half of the nodelist of the client,
+   comma-separated */
+#define ICDB_LUA_SHRINK                                                 \
+  "local key = 'nodelist:client:' .. args[1]\n"                         \
+  "local n = math.floor(redis.call('LLEN', key) / 2)\n"                 \
+  "return table.concat(redis.call('LRANGE', key, 0, n - 1), ',')\n"
+
+#define ICDB_LUA_FUNCTION(name,body,flags)                              \
+  "local function fn_" name "(keys, args)\n" body "end\n"               \
+  "redis.register_function{function_name='icdb_" name "', callback=fn_" name \
+  ", flags={" flags "}}\n"
+
+/* the first line names the script, in SCRIPT LIST or a slow log */
+#define ICDB_LUA_SCRIPT(name,body)                                      \
+  "-- icdb_" name "\n"                                                   \
+  "local keys, args = KEYS, ARGV\n" ICDB_LUA_PRELUDE body
+
+#define ICDB_LUA_STR(x) ICDB_LUA_STR_(x)
+#define ICDB_LUA_STR_(x) #x
+
+#define ICDB_LUA_LIBRARY                                                \
+  "#!lua name=icdb\n"                                                   \
+  ICDB_LUA_PRELUDE                                                      \
+  ICDB_LUA_FUNCTION("setclient", ICDB_LUA_SETCLIENT, "")                \
+  ICDB_LUA_FUNCTION("delclient", ICDB_LUA_DELCLIENT, "")                \
+  ICDB_LUA_FUNCTION("deljob", ICDB_LUA_DELJOB, "")                      \
+  ICDB_LUA_FUNCTION("addnodes", ICDB_LUA_ADDNODES, "")                  \
+  ICDB_LUA_FUNCTION("monitor_set", ICDB_LUA_MONITOR_SET, "")            \
+  ICDB_LUA_FUNCTION("monitor_sample", ICDB_LUA_MONITOR_SAMPLE, "")      \
+  ICDB_LUA_FUNCTION("shrink", ICDB_LUA_SHRINK, "'no-writes'")           \
+  "redis.register_function{function_name='icdb_version', "              \
+  "callback=function() return " ICDB_LUA_STR(ICDB_LUA_VERSION) " end, " \
+  "flags={'no-writes'}}\n"
+
+enum icdb_lua_fn {
+  ICDB_LUA_FN_SETCLIENT = 0,
+  ICDB_LUA_FN_DELCLIENT,
+  ICDB_LUA_FN_DELJOB,
+  ICDB_LUA_FN_ADDNODES,
+  ICDB_LUA_FN_MONITOR_SET,
+  ICDB_LUA_FN_MONITOR_SAMPLE,
+  ICDB_LUA_FN_SHRINK,
+
+  ICDB_LUA_FN_COUNT
+};
+
+static const struct {
+  const char *name;             /* Redis Function name */
+  const char *script;           /* EVALSHA fallback */
+} icdb_lua_fns[ICDB_LUA_FN_COUNT] = {
+  [ICDB_LUA_FN_SETCLIENT]  = { "icdb_setclient",
+                               ICDB_LUA_SCRIPT("setclient", ICDB_LUA_SETCLIENT) },
+  [ICDB_LUA_FN_DELCLIENT]  = { "icdb_delclient",
+                               ICDB_LUA_SCRIPT("delclient", ICDB_LUA_DELCLIENT) },
+  [ICDB_LUA_FN_DELJOB]     = { "icdb_deljob",
+                               ICDB_LUA_SCRIPT("deljob", ICDB_LUA_DELJOB) },
+  [ICDB_LUA_FN_ADDNODES]   = { "icdb_addnodes",
+                               ICDB_LUA_SCRIPT("addnodes", ICDB_LUA_ADDNODES) },
+  [ICDB_LUA_FN_MONITOR_SET]    = { "icdb_monitor_set",
+                                   ICDB_LUA_SCRIPT("monitor_set", ICDB_LUA_MONITOR_SET) },
+  [ICDB_LUA_FN_MONITOR_SAMPLE] = { "icdb_monitor_sample",
+                                   ICDB_LUA_SCRIPT("monitor_sample", ICDB_LUA_MONITOR_SAMPLE) },
+  [ICDB_LUA_FN_SHRINK]     = { "icdb_shrink",
+                               ICDB_LUA_SCRIPT("shrink", ICDB_LUA_SHRINK) },
+};
+
+#define ICDB_LUA_SHA_LEN 41
+
+/* Call library function FN with the arguments in FMT. In case the
+   library or scripts disappeared from the server (restart, FLUSH),
+   load them again and retry once */
+#define ICDB_LUA_CALL(icdb,rep,fn,fmt,...) {                            \
+    int _tries = 0;                                                     \
+    do {                                                                \
+      rep = _icdb_command(icdb, "%s %s 0 "fmt,                          \
+                          (icdb)->lua_fcall ? "FCALL" : "EVALSHA",      \
+                          (icdb)->lua_fcall ? icdb_lua_fns[fn].name : (icdb)->lua_sha[fn], \
+                          __VA_ARGS__);                                 \
+    } while (_tries++ == 0 && _icdb_lua_reload(icdb, &rep));            \
+  }
+
+
+/* The lock serializes the users of a connection. Callers keep one
+   context per execution stream, so contention stays local to the
+   ULTs of that stream and independent streams never wait on each
+   other. Taking the lock reconnects a broken connection. */
+#define ICDB_LOCK(icdb)    _icdb_lock(icdb)
+#define ICDB_UNLOCK(icdb)  _icdb_unlock(icdb)
+
+/* reconnection backoff bounds */
+#define ICDB_BACKOFF_MIN_MS 100
+#define ICDB_BACKOFF_MAX_MS 10000
+
+/* pooled connections idle for longer are checked before use */
+#define ICDB_POOL_CHECK_MS 30000
+
 struct icdb_context {
   redisContext      *redisctx;
+  ABT_mutex          lock;
+  size_t             npending;  /* appended commands awaiting a reply */
+  int                lua_fcall; /* library loaded as a Redis Function */
+  char               lua_sha[ICDB_LUA_FN_COUNT][ICDB_LUA_SHA_LEN];
+  char               host[256];
+  int                port;
+  int                timeout_ms;  /* command timeout, 0 for none */
+  unsigned           backoff_ms;  /* current reconnection delay */
+  uint64_t           retry_at;    /* no reconnection before, in ms */
+  uint64_t           nreconnects;
+  uint64_t           last_used;   /* when put back in a pool, in ms */
+  uint64_t           locked_at;   /* when the lock was taken, in ns */
+  struct arena      *arena;       /* decoded strings, created on use */
   int                status;
   char               errstr[ICDB_ERRSTR_LEN];
 };
 
-// CHANGE: JAVI
-static ABT_mutex_memory icdb_mutex = ABT_MUTEX_INITIALIZER;
-// END CHANGE: JAVI
+struct icdb_pool {
+  char                 *addr;
+  int                   timeout_ms;
+  size_t                size;       /* max number of connections */
+  size_t                nopen;      /* connections created */
+  size_t                nidle;
+  struct icdb_context **idle;       /* stack of idle connections */
+  ABT_mutex             lock;
+  ABT_cond              cond;
+  struct icdb_pool_stats stats;
+};
 
 /* internal utility functions */
 /**
@@ -121,15 +391,120 @@ static ABT_mutex_memory icdb_mutex = ABT_MUTEX_INITIALIZER;
  */
 static int
 _icdb_get_str(const redisReply *rep, char *dest, size_t maxlen);
-static int
-_icdb_get_strdup(const redisReply *rep, char **dest);
 
 static int
 _icdb_set_status(struct icdb_context *icdb, int status,
                  const char *filename, int lineno, const char *funcname,
                  const char *format, ...);
+/**
+ * Fill DEST from a HGETALL reply, according to SCHEMA. Fields missing
+ * from the hash are left untouched, unknown ones are ignored.
+ */
+static int
+_icdb_decode_hash(struct icdb_context *icdb, const redisReply *rep,
+                  const struct icdb_field *schema, size_t nfields, void *dest);
+/**
+ * Fill DEST from the NFIELDS first REPS, in the order of SCHEMA, as
+ * returned by SORT ... GET. Nil elements are skipped.
+ */
+static int
+_icdb_decode_array(struct icdb_context *icdb, redisReply **reps,
+                   const struct icdb_field *schema, size_t nfields, void *dest);
+/**
+ * Copy LEN bytes of S in the context arena, as a string. The arena is
+ * reset at the beginning of every call returning data that lives
+ * there.
+ */
+static char *
+_icdb_arena_strndup(struct icdb_context *icdb, const char *s, size_t len);
+/**
+ * Convert a Redis string reply to an integer no greater than MAX (or
+ * between MIN and MAX) into DEST.
+ */
+static int
+_icdb_get_uint(const redisReply *rep, uint64_t max, uint64_t *dest);
+static int
+_icdb_get_int(const redisReply *rep, int64_t min, int64_t max, int64_t *dest);
+/**
+ * Process one page of the client index matching FILTER, starting at
+ * CURSOR, which is updated. Clients are fetched with one pipelined
+ * HGETALL each and passed to CB. STOP is set if CB asks to stop.
+ */
+static int
+_icdb_scan_clients(struct icdb_context *icdb,
+                   const struct icdb_client_filter *filter,
+                   uint64_t *cursor, size_t batch_size,
+                   icdb_client_cb cb, void *arg, int *stop);
+
+/**
+ * Command engine. _icdb_command is a locked redisCommand. The
+ * pipeline functions must be called with the context lock held:
+ * _icdb_append queues a command in the output buffer, _icdb_flush
+ * sends every queued command at once and collects the first N
+ * replies into REPS (the caller frees them), _icdb_flush_expect
+ * checks that all replies are of type RTYPE and frees them.
+ */
+static redisReply *
+_icdb_command(struct icdb_context *icdb, const char *format, ...);
+static int
+_icdb_append(struct icdb_context *icdb, const char *format, ...);
+static int
+_icdb_append_argv(struct icdb_context *icdb, int argc, const char **argv,
+                  const size_t *argvlen);
+static int
+_icdb_flush(struct icdb_context *icdb, redisReply **reps, size_t n);
 static int
-client_set(struct icdb_context *icdb, redisReply **rep, struct icdb_client *c);
+_icdb_flush_expect(struct icdb_context *icdb, int rtype);
+static void
+_icdb_free_replies(redisReply **reps, size_t n);
+/**
+ * Same checks as CHECK_REP_TYPE, for code paths that cannot return
+ * directly because they hold the lock or replies to free.
+ */
+static int
+_icdb_check_reply(struct icdb_context *icdb, const redisReply *rep, int rtype);
+
+/**
+ * Find the current FlexMPI iteration key of client CLID for monitors
+ * that do not maintain the index, with a non-blocking SCAN, and index
+ * it. Must be called with the lock held.
+ */
+static int
+_icdb_monitor_lookup(struct icdb_context *icdb, const char *clid, char **key);
+
+/**
+ * Make sure the icdb Lua library is available on the server, as a
+ * Redis Function if possible or as scripts otherwise.
+ * _icdb_lua_reload is meant for ICDB_LUA_CALL: if REP is an error
+ * telling that the code is missing, free it and load the library
+ * again. Returns 1 if the call should be retried.
+ */
+static int
+_icdb_lua_load(struct icdb_context *icdb);
+
+/**
+ * Lock ICDB and, if its connection is broken, try to reconnect it,
+ * no sooner than the backoff delay after the previous attempt.
+ */
+static void
+_icdb_lock(struct icdb_context *icdb);
+/**
+ * Release the lock of ICDB, recording how long it was held.
+ */
+static void
+_icdb_unlock(struct icdb_context *icdb);
+/**
+ * Connect ICDB to its server, replacing the current connection.
+ */
+static int
+_icdb_connect(struct icdb_context *icdb);
+/**
+ * Monotonic time in milliseconds.
+ */
+static uint64_t
+_icdb_now_ms(void);
+static int
+_icdb_lua_reload(struct icdb_context *icdb, redisReply **rep);
 
 
 /* public functions */
@@ -148,21 +523,59 @@ icdb_init(struct icdb_context **icdb_context, char *ip_addr)
 
   icdb->status = ICDB_SUCCESS;
 
-  icdb->redisctx = redisConnect(ip_addr, 6379);
-
-  if (icdb->redisctx == NULL) {
-    ICDB_SET_STATUS(icdb, ICDB_FAILURE, "Null DB context");
+  if (ABT_mutex_create(&icdb->lock) != ABT_SUCCESS) {
+    free(icdb);
     return ICDB_FAILURE;
   }
 
-  if (icdb->redisctx->err) {
-    icdb->status = ICDB_EPROTO;
-    return ICDB_FAILURE;
+  /* from here on, the context is returned even on failure, so that
+     the caller can get the error string */
+  *icdb_context = icdb;
+
+  /* host[:port] or [v6host][:port]. A bare v6 address has several
+     colons and no port */
+  const char *host = ip_addr, *colon;
+  size_t len;
+
+  if (*ip_addr == '[') {
+    const char *close = strchr(ip_addr, ']');
+    if (!close || (close[1] != '\0' && close[1] != ':')) {
+      ICDB_SET_STATUS(icdb, ICDB_EPARAM, "Bad DB address %s", ip_addr);
+      return ICDB_EPARAM;
+    }
+    host = ip_addr + 1;
+    len = close - host;
+    colon = close[1] == ':' ? close + 1 : NULL;
+  } else {
+    colon = strchr(ip_addr, ':');
+    if (colon && strchr(colon + 1, ':'))
+      colon = NULL;
+    len = colon ? (size_t)(colon - ip_addr) : strlen(ip_addr);
   }
 
-  *icdb_context = icdb;
+  if (len >= sizeof(icdb->host)) {
+    ICDB_SET_STATUS(icdb, ICDB_EPARAM, "DB address too long");
+    return ICDB_EPARAM;
+  }
+  memcpy(icdb->host, host, len);
+  icdb->host[len] = '\0';
+  icdb->port = ICDB_PORT;
+
+  if (colon) {
+    char *end;
+    errno = 0;
+    unsigned long p = strtoul(colon + 1, &end, 10);
+    if (errno || end == colon + 1 || *end != '\0' || p == 0 || p > UINT16_MAX) {
+      ICDB_SET_STATUS(icdb, ICDB_EPARAM, "Bad DB port in %s", ip_addr);
+      return ICDB_EPARAM;
+    }
+    icdb->port = (int)p;
+  }
 
-  return ICDB_SUCCESS;
+  if (_icdb_connect(icdb) != ICDB_SUCCESS)
+    return icdb->status;
+
+  return _icdb_lua_load(icdb);
 }
 
 
@@ -170,14 +583,206 @@ void
 icdb_fini(struct icdb_context **icdb)
 {
   if (icdb) {
-      if (*icdb)
+      if (*icdb) {
         redisFree((*icdb)->redisctx);
+        ABT_mutex_free(&(*icdb)->lock);
+        arena_free((*icdb)->arena);
+      }
       free(*icdb);
   }
   *icdb = NULL;
 }
 
 
+int
+icdb_set_timeout(struct icdb_context *icdb, int timeout_ms)
+{
+  CHECK_ICDB(icdb);
+  CHECK_PARAM(icdb, timeout_ms >= 0);
+
+  icdb->status = ICDB_SUCCESS;
+
+  /* a zero socket timeout means none */
+  struct timeval tv = {
+    .tv_sec = timeout_ms / 1000,
+    .tv_usec = (timeout_ms % 1000) * 1000,
+  };
+
+  ICDB_LOCK(icdb);
+  icdb->timeout_ms = timeout_ms;
+  if (icdb->redisctx && !icdb->redisctx->err &&
+      redisSetTimeout(icdb->redisctx, tv) != REDIS_OK) {
+    ICDB_SET_STATUS(icdb, ICDB_FAILURE, "Could not set DB timeout");
+  }
+  ICDB_UNLOCK(icdb);
+
+  return icdb->status;
+}
+
+
+int
+icdb_pool_init(struct icdb_pool **pool, char *ip_addr, size_t size,
+               int timeout_ms)
+{
+  *pool = NULL;
+
+  if (!ip_addr || size == 0 || timeout_ms < 0)
+    return ICDB_EPARAM;
+
+  struct icdb_pool *p = calloc(1, sizeof(*p));
+  if (!p)
+    return ICDB_ENOMEM;
+
+  p->addr = strdup(ip_addr);
+  p->idle = calloc(size, sizeof(*p->idle));
+  if (!p->addr || !p->idle) {
+    free(p->addr);
+    free(p->idle);
+    free(p);
+    return ICDB_ENOMEM;
+  }
+  p->size = size;
+  p->timeout_ms = timeout_ms;
+
+  if (ABT_mutex_create(&p->lock) != ABT_SUCCESS) {
+    free(p->addr);
+    free(p->idle);
+    free(p);
+    return ICDB_FAILURE;
+  }
+  if (ABT_cond_create(&p->cond) != ABT_SUCCESS) {
+    ABT_mutex_free(&p->lock);
+    free(p->addr);
+    free(p->idle);
+    free(p);
+    return ICDB_FAILURE;
+  }
+
+  /* connections are only opened when needed */
+  *pool = p;
+
+  return ICDB_SUCCESS;
+}
+
+
+void
+icdb_pool_fini(struct icdb_pool **pool)
+{
+  if (!pool || !*pool)
+    return;
+
+  struct icdb_pool *p = *pool;
+
+  /* connections still in use are the caller's problem */
+  for (size_t i = 0; i < p->nidle; i++) {
+    icdb_fini(&p->idle[i]);
+  }
+
+  ABT_cond_free(&p->cond);
+  ABT_mutex_free(&p->lock);
+  free(p->idle);
+  free(p->addr);
+  free(p);
+
+  *pool = NULL;
+}
+
+
+struct icdb_context *
+icdb_pool_get(struct icdb_pool *pool)
+{
+  struct icdb_context *icdb = NULL;
+  int waited = 0;
+  uint64_t start = 0;
+
+  if (!pool)
+    return NULL;
+
+  ABT_mutex_lock(pool->lock);
+  while (pool->nidle == 0 && pool->nopen == pool->size) {
+    if (!waited) {
+      waited = 1;
+      start = _icdb_now_ms();
+      pool->stats.waits++;
+    }
+    ABT_cond_wait(pool->cond, pool->lock);
+  }
+  if (waited)
+    pool->stats.wait_ms += _icdb_now_ms() - start;
+
+  if (pool->nidle > 0) {
+    icdb = pool->idle[--pool->nidle];
+  } else {
+    pool->nopen++;
+  }
+  pool->stats.gets++;
+  ABT_mutex_unlock(pool->lock);
+
+  if (icdb) {
+    /* an idle connection might have been dropped by the server */
+    if (_icdb_now_ms() - icdb->last_used > ICDB_POOL_CHECK_MS) {
+      redisReply *rep = _icdb_command(icdb, "PING");
+      if (!rep || rep->type != REDIS_REPLY_STATUS) {
+        ABT_mutex_lock(pool->lock);
+        pool->stats.check_failures++;
+        ABT_mutex_unlock(pool->lock);
+        ICDB_LOCK(icdb);
+        _icdb_connect(icdb);
+        ICDB_UNLOCK(icdb);
+      }
+      if (rep)
+        freeReplyObject(rep);
+    }
+    return icdb;
+  }
+
+  /* a failed connection is still returned, it will be retried on
+     use. Only an allocation failure gives the slot back */
+  icdb_init(&icdb, pool->addr);
+  if (icdb) {
+    icdb_set_timeout(icdb, pool->timeout_ms);
+  } else {
+    ABT_mutex_lock(pool->lock);
+    pool->nopen--;
+    ABT_cond_signal(pool->cond);
+    ABT_mutex_unlock(pool->lock);
+  }
+
+  return icdb;
+}
+
+
+void
+icdb_pool_put(struct icdb_pool *pool, struct icdb_context *icdb)
+{
+  if (!pool || !icdb)
+    return;
+
+  icdb->last_used = _icdb_now_ms();
+
+  ABT_mutex_lock(pool->lock);
+  pool->stats.reconnects += icdb->nreconnects;
+  icdb->nreconnects = 0;
+  pool->idle[pool->nidle++] = icdb;
+  ABT_cond_signal(pool->cond);
+  ABT_mutex_unlock(pool->lock);
+}
+
+
+void
+icdb_pool_stats(struct icdb_pool *pool, struct icdb_pool_stats *stats)
+{
+  if (!pool || !stats)
+    return;
+
+  ABT_mutex_lock(pool->lock);
+  *stats = pool->stats;
+  stats->nopen = pool->nopen;
+  stats->nbusy = pool->nopen - pool->nidle;
+  ABT_mutex_unlock(pool->lock);
+}
+
+
 char *
 icdb_errstr(struct icdb_context *icdb)
 {
@@ -197,6 +802,7 @@ icdb_errstr(struct icdb_context *icdb)
 int
 icdb_command(struct icdb_context *icdb, const char *format, ...)
 {
+  ICSTATS_SCOPE("icdb", __func__);
   CHECK_ICDB(icdb);
 
   if (!icdb->redisctx)
@@ -204,7 +810,9 @@ icdb_command(struct icdb_context *icdb, const char *format, ...)
 
   va_list ap;
   va_start(ap, format);
+  ICDB_LOCK(icdb);
   redisReply *redisrep = redisvCommand(icdb->redisctx, format, ap);
+  ICDB_UNLOCK(icdb);
   va_end(ap);
 
   if (redisrep == NULL)
@@ -241,65 +849,28 @@ icdb_command(struct icdb_context *icdb, const char *format, ...)
 int
 icdb_getclient(struct icdb_context *icdb, const char *clid, struct icdb_client *client)
 {
+  ICSTATS_SCOPE("icdb", __func__);
   CHECK_ICDB(icdb);
   CHECK_PARAM(icdb, clid);
   CHECK_PARAM(icdb, client);
 
   icdb->status = ICDB_SUCCESS;
+  arena_reset(icdb->arena);
 
-  // CHANGE: JAVI
-  ABT_mutex mutex = ABT_MUTEX_MEMORY_GET_HANDLE(&icdb_mutex);
-  ABT_mutex_lock(mutex);
   redisReply *rep;
-  rep = redisCommand(icdb->redisctx, "HGETALL client:%s", clid);
-  ABT_mutex_unlock(mutex);
-  // END CHANGE: JAVI
+  rep = _icdb_command(icdb, "HGETALL client:%s", clid);
 
   CHECK_REP_TYPE(icdb, rep, REDIS_REPLY_ARRAY);
 
   if (rep->elements == 0) {
+    freeReplyObject(rep);
     ICDB_SET_STATUS(icdb, ICDB_NORESULT, "No client with id %s", clid);
     return ICDB_NORESULT;
   }
 
-  /* HGETALL returns all keys followed by their respective value */
-  for (size_t i = 0; i < rep->elements; i++) {
-    char *key = rep->element[i]->str;
-    redisReply *r = rep->element[++i];
-
-    CHECK_REP_TYPE(icdb, r, REDIS_REPLY_STRING);
-
-    if (!strcmp(key, "clid")) {
-      ICDB_GET_STR(icdb, r, client->clid, key, UUID_STR_LEN);
-    }
-    else if (!strcmp(key, "type")) {
-      ICDB_GET_STR(icdb, r, client->type, key, ICC_TYPE_LEN);
-    }
-    else if (!strcmp(key, "addr")) {
-      ICDB_GET_STR(icdb, r, client->addr, key, ICC_ADDR_LEN);
-    }
-    else if (!strcmp(key, "nodelist")) {
-      ICDB_GET_STR(icdb, r, client->nodelist, key, ICDB_NODELIST_LEN);
-    }
-    else if (!strcmp(key, "provid")) {
-      ICDB_GET_UINT16(icdb, r, &client->provid, key);
-    }
-    else if (!strcmp(key, "jobid")) {
-      ICDB_GET_UINT32(icdb, r, &client->jobid, key);
-    }
-    else if (!strcmp(key, "nprocs")) {
-      ICDB_GET_UINT64(icdb, r, &client->nprocs, key);
-    }
-    else if (!strcmp(key, "reconfig_ncpus")) {
-      ICDB_GET_INT32(icdb, r, &client->reconfig_nprocs, key);
-    }
-    else if (!strcmp(key, "reconfig_nnodes")) {
-      ICDB_GET_INT32(icdb, r, &client->reconfig_nnodes, key);
-    }
-
-    if (icdb->status != ICDB_SUCCESS)
-      break;
-  }
+  memset(client, 0, sizeof(*client));
+  _icdb_decode_hash(icdb, rep, client_schema, ICDB_NFIELDS(client_schema), client);
+  freeReplyObject(rep);
 
   return icdb->status;
 }
@@ -307,27 +878,101 @@ icdb_getclient(struct icdb_context *icdb, const char *clid, struct icdb_client *
 int
 icdb_getlargestclient(struct icdb_context *icdb, struct icdb_client *client)
 {
+  ICSTATS_SCOPE("icdb", __func__);
   CHECK_ICDB(icdb);
   CHECK_PARAM(icdb, client);
 
-  // CHANGE: JAVI
-  ABT_mutex mutex = ABT_MUTEX_MEMORY_GET_HANDLE(&icdb_mutex);
-  ABT_mutex_lock(mutex);
-  redisReply *rep = redisCommand(icdb->redisctx,
+  icdb->status = ICDB_SUCCESS;
+  arena_reset(icdb->arena);
+
+  redisReply *rep = _icdb_command(icdb,
                     "SORT index:clients DESC BY client:*->nnodes LIMIT 0 1 "
                     ICDB_CLIENT_QUERY);
-  ABT_mutex_unlock(mutex);
-  // END CHANGE: JAVI
-    
+
   CHECK_REP_TYPE(icdb, rep, REDIS_REPLY_ARRAY);
 
-  return client_set(icdb, rep->element, client);
+  if (rep->elements < ICDB_NFIELDS(client_schema)) {
+    freeReplyObject(rep);
+    ICDB_SET_STATUS(icdb, ICDB_NORESULT, "No client");
+    return ICDB_NORESULT;
+  }
+
+  memset(client, 0, sizeof(*client));
+  _icdb_decode_array(icdb, rep->element, client_schema,
+                     ICDB_NFIELDS(client_schema), client);
+  freeReplyObject(rep);
+
+  return icdb->status;
+}
+
+struct getclients_arg {
+  struct icdb_client *clients;
+  size_t              size;     /* capacity of clients */
+  size_t              count;    /* number of clients found */
+  int                 err;
+};
+
+static int
+_getclients_cb(const struct icdb_client *client, void *arg)
+{
+  struct getclients_arg *a = (struct getclients_arg *)arg;
+
+  /* keep counting when the array is full, to report the need */
+  if (a->count < a->size)
+    a->clients[a->count] = *client;
+  a->count++;
+
+  return 0;
+}
+
+/* growing version, for cursor-based calls */
+static int
+_getclients_grow_cb(const struct icdb_client *client, void *arg)
+{
+  struct getclients_arg *a = (struct getclients_arg *)arg;
+
+  if (a->count == a->size) {
+    size_t size = a->size ? 2 * a->size : 16;
+    struct icdb_client *tmp = reallocarray(a->clients, size, sizeof(*tmp));
+    if (!tmp) {
+      a->err = ICDB_ENOMEM;
+      return 1;
+    }
+    a->clients = tmp;
+    a->size = size;
+  }
+  a->clients[a->count++] = *client;
+
+  return 0;
+}
+
+int
+icdb_iter_clients(struct icdb_context *icdb,
+                  const struct icdb_client_filter *filter, size_t batch_size,
+                  icdb_client_cb cb, void *arg)
+{
+  ICSTATS_SCOPE("icdb", __func__);
+  CHECK_ICDB(icdb);
+  CHECK_PARAM(icdb, cb);
+
+  icdb->status = ICDB_SUCCESS;
+  arena_reset(icdb->arena);
+
+  uint64_t cursor = 0;
+  int stop = 0, rc;
+
+  do {
+    rc = _icdb_scan_clients(icdb, filter, &cursor, batch_size, cb, arg, &stop);
+  } while (rc == ICDB_SUCCESS && !stop && cursor != 0);
+
+  return rc;
 }
 
 int
 icdb_getclients(struct icdb_context *icdb, uint32_t jobid,
                 struct icdb_client *clients, size_t *count)
 {
+  ICSTATS_SCOPE("icdb", __func__);
   /*
    * XX For now we return every clients at once. The thinking is
    * that this query is mainly used with a jobid filter, and there
@@ -336,48 +981,23 @@ icdb_getclients(struct icdb_context *icdb, uint32_t jobid,
    */
   CHECK_ICDB(icdb);
   CHECK_PARAM(icdb, clients);
+  CHECK_PARAM(icdb, count);
 
-  redisReply *rep = NULL;
-  size_t need;
-
-
-  /* XX if multiple filters use SINTER */
-  // CHANGE: JAVI
-  ABT_mutex mutex = ABT_MUTEX_MEMORY_GET_HANDLE(&icdb_mutex);
-  ABT_mutex_lock(mutex);
-  if (jobid) {
-    rep = redisCommand(icdb->redisctx,
-                       "SORT index:clients:jobid:%"PRIu32" ALPHA DESC "
-                       ICDB_CLIENT_QUERY, jobid);
-
-  } else {
-    rep = redisCommand(icdb->redisctx,
-                       "SORT index:clients ALPHA DESC "
-                       ICDB_CLIENT_QUERY);
-  }
-  ABT_mutex_unlock(mutex);
-  // END CHANGE: JAVI
-
-    CHECK_REP_TYPE(icdb, rep, REDIS_REPLY_ARRAY);
-
-  /* SORT returns fields one after the other, a client is
-     ICDB_CLIENT_NFIELDS fields */
-  assert(rep->elements % ICDB_CLIENT_NFIELDS == 0);
+  struct icdb_client_filter filter = { .jobid = jobid, .type = NULL };
+  struct getclients_arg a = { .clients = clients, .size = *count };
+  int rc;
 
-  need = rep->elements / ICDB_CLIENT_NFIELDS;
+  rc = icdb_iter_clients(icdb, &filter, ICDB_SCAN_BATCH, _getclients_cb, &a);
+  if (rc != ICDB_SUCCESS)
+    return rc;
 
-  if (*count < need) {
-    *count = need;
+  if (a.count > *count) {
+    *count = a.count;
     ICDB_SET_STATUS(icdb, ICDB_E2BIG, "Too many clients to store");
     return ICDB_E2BIG;
   }
-  *count = need;
-  for (size_t i = 0; i < *count; i++) {
-    int r = client_set(icdb, rep->element + i * ICDB_CLIENT_NFIELDS, &clients[i]);
-    if (r != ICDB_SUCCESS) {
-      return r;
-    }
-  }
+  *count = a.count;
+
   return ICDB_SUCCESS;
 }
 
@@ -386,6 +1006,7 @@ icdb_getclients(struct icdb_context *icdb, uint32_t jobid,
 int
 icdb_addnodes(struct icdb_context *icdb, const char *clid, const char *nodelist)
 {
+  ICSTATS_SCOPE("icdb", __func__);
   CHECK_ICDB(icdb);
   CHECK_PARAM(icdb, clid);
   CHECK_PARAM(icdb, nodelist);
@@ -393,26 +1014,11 @@ icdb_addnodes(struct icdb_context *icdb, const char *clid, const char *nodelist)
   icdb->status = ICDB_SUCCESS;
 
   redisReply *rep;
-  redisContext *ctx = icdb->redisctx;
 
-  /* XX fixme: wrap in transaction */
-  ABT_mutex mutex = ABT_MUTEX_MEMORY_GET_HANDLE(&icdb_mutex);
-
-  /* parse comma-separated node lists and add them to the nodelist */
-  uint32_t nnodes = 0;
-  char *l = strdup(nodelist);
-  if (!l) { return ICDB_ENOMEM; }
-
-  char *node = strtok(l, ",");
-  do {
-    nnodes++;
-    ABT_mutex_lock(mutex);
-    rep = redisCommand(ctx, "RPUSH nodelist:client:%s %s", clid, node);
-    ABT_mutex_unlock(mutex);
-    CHECK_REP_TYPE(icdb, rep, REDIS_REPLY_INTEGER);
-  } while ((node = strtok(NULL, ",")));
-  free(l);
-  freeReplyObject(rep);
+  /* the node list is parsed on the server side */
+  ICDB_LUA_CALL(icdb, rep, ICDB_LUA_FN_ADDNODES, "%s %s", clid, nodelist);
+  CHECK_REP_TYPE(icdb, rep, REDIS_REPLY_INTEGER);
+  freeReplyObject(rep);
 
   return icdb->status;
 }
@@ -420,33 +1026,29 @@ icdb_addnodes(struct icdb_context *icdb, const char *clid, const char *nodelist)
 int
 icdb_delnodes(struct icdb_context *icdb, const char *clid, const char *nodelist)
 {
+  ICSTATS_SCOPE("icdb", __func__);
   CHECK_ICDB(icdb);
   CHECK_PARAM(icdb, clid);
   CHECK_PARAM(icdb, nodelist);
 
   icdb->status = ICDB_SUCCESS;
 
-  redisReply *rep = NULL;
-  redisContext *ctx = icdb->redisctx;
-
-  /* XX fixme: wrap in transaction */
-  ABT_mutex mutex = ABT_MUTEX_MEMORY_GET_HANDLE(&icdb_mutex);
-
-  /* parse comma-separated node lists and add them to the nodelist */
-  uint32_t nnodes = 0;
+  /* parse comma-separated node lists and remove them from the nodelist */
   char *l = strdup(nodelist);
   if (!l) { return ICDB_ENOMEM; }
 
-  char *node = strtok(l, ",");
-  do {
-    nnodes++;
-    ABT_mutex_lock(mutex);
-    rep = redisCommand(ctx, "LREM nodelist:client:%s 0 %s", clid, node);
-    ABT_mutex_unlock(mutex);
-    CHECK_REP_TYPE(icdb, rep, REDIS_REPLY_INTEGER);
-  } while ((node = strtok(NULL, ",")));
+  char *saveptr;
+  char *node = strtok_r(l, ",", &saveptr);
+
+  ICDB_LOCK(icdb);
+  while (node && icdb->status == ICDB_SUCCESS) {
+    _icdb_append(icdb, "LREM nodelist:client:%s 0 %s", clid, node);
+    node = strtok_r(NULL, ",", &saveptr);
+  }
+  _icdb_flush_expect(icdb, REDIS_REPLY_INTEGER);
+  ICDB_UNLOCK(icdb);
+
   free(l);
-  freeReplyObject(rep);
 
   return icdb->status;
 }
@@ -454,6 +1056,7 @@ icdb_delnodes(struct icdb_context *icdb, const char *clid, const char *nodelist)
 int
 icdb_getMonitor(struct icdb_context *icdb, const char *clid, double *rate_cpu, double *rate_mem, int *num_proc, double *rtime, double *ptime, double *ctime)
 {
+  ICSTATS_SCOPE("icdb", __func__);
   CHECK_ICDB(icdb);
   CHECK_PARAM(icdb, clid);
   CHECK_PARAM(icdb, rate_cpu);
@@ -465,93 +1068,110 @@ icdb_getMonitor(struct icdb_context *icdb, const char *clid, double *rate_cpu, d
 
   icdb->status = ICDB_SUCCESS;
 
-  redisReply *rep = NULL;
-  redisReply *rep2 = NULL;
-  redisContext *ctx = icdb->redisctx;
+  redisReply *rep[2] = { NULL };    /* node list and iteration key */
+  redisReply *mget = NULL;          /* node monitors + iteration data */
+  const char **argv = NULL;
+  size_t *argvlen = NULL;
+  char *keys = NULL, *iterkey = NULL;
+  size_t nvals = 0;
   double rate_cpu_total=0.0, rate_mem_total=0.0;
   int num_nodes=0;
-    
-    
 
-  ABT_mutex mutex = ABT_MUTEX_MEMORY_GET_HANDLE(&icdb_mutex);
-    
-  //ABT_mutex_lock(mutex);
-  //rep = redisCommand(ctx, "KEYS *", clid);
-  //ABT_mutex_unlock(mutex);
-  //fprintf(stderr, "icdb_getMonitor: step 0: KEYS *\n");
-  //CHECK_REP_TYPE(icdb, rep, REDIS_REPLY_ARRAY);
-  //for (size_t i = 0; i < rep->elements; i++) {
-  //    fprintf(stderr, "icdb_getMonitor: KEYS: %s\n",rep->element[i]->str);
-  //}
-  //freeReplyObject(rep);
-
-  // get list of nodes for clid
-  ABT_mutex_lock(mutex);
-  rep = redisCommand(ctx, "LRANGE nodelist:client:%s 0 -1", clid);
-  ABT_mutex_unlock(mutex);
-  //fprintf(stderr, "icdb_getMonitor: step 1: LRANGE nodelist:client:%s 0 -1 (%p)\n",clid, rep);
-  CHECK_REP_TYPE(icdb, rep, REDIS_REPLY_ARRAY);
+  ICDB_LOCK(icdb);
+
+  /* 1) get list of nodes & current iteration key for clid, from the
+     index maintained by the monitor */
+  _icdb_append(icdb, "LRANGE nodelist:client:%s 0 -1", clid);
+  _icdb_append(icdb, "GET index:monitorFlexMPI:%s", clid);
+  if (_icdb_flush(icdb, rep, 2) != ICDB_SUCCESS)
+    goto end;
+
+  if (_icdb_check_reply(icdb, rep[0], REDIS_REPLY_ARRAY) != ICDB_SUCCESS)
+    goto end;
+
+  if (rep[1] && rep[1]->type == REDIS_REPLY_NIL) {
+    if (_icdb_monitor_lookup(icdb, clid, &iterkey) != ICDB_SUCCESS)
+      goto end;
+  } else {
+    if (_icdb_check_reply(icdb, rep[1], REDIS_REPLY_STRING) != ICDB_SUCCESS)
+      goto end;
+    iterkey = strdup(rep[1]->str);
+    if (!iterkey) {
+      ICDB_SET_STATUS(icdb, ICDB_ENOMEM, "Out of memory");
+      goto end;
+    }
+  }
+
+  /* 2) get monitor values for each node of clid, followed by the
+     current iteration data, in a single MGET */
+  nvals = rep[0]->elements + 1;
+  argv = calloc(nvals + 1, sizeof(*argv));
+  argvlen = calloc(nvals + 1, sizeof(*argvlen));
+  size_t keyslen = 0;
+  for (size_t i = 0; i < rep[0]->elements; i++) {
+    if (_icdb_check_reply(icdb, rep[0]->element[i], REDIS_REPLY_STRING) != ICDB_SUCCESS)
+      goto end;
+    keyslen += sizeof("monitor:") + rep[0]->element[i]->len;
+  }
+  keys = malloc(keyslen + 1);
+  if (!argv || !argvlen || !keys) {
+    ICDB_SET_STATUS(icdb, ICDB_ENOMEM, "Out of memory");
+    goto end;
+  }
+
+  argv[0] = "MGET";
+  argvlen[0] = 4;
+  char *k = keys;
+  for (size_t i = 0; i < rep[0]->elements; i++) {
+    argv[i + 1] = k;
+    argvlen[i + 1] = sprintf(k, "monitor:%s", rep[0]->element[i]->str);
+    k += argvlen[i + 1] + 1;
+  }
+  argv[nvals] = iterkey;
+  argvlen[nvals] = strlen(iterkey);
+
+  _icdb_append_argv(icdb, nvals + 1, argv, argvlen);
+  if (_icdb_flush(icdb, &mget, 1) != ICDB_SUCCESS)
+    goto end;
+  if (_icdb_check_reply(icdb, mget, REDIS_REPLY_ARRAY) != ICDB_SUCCESS)
+    goto end;
+  if (mget->elements != nvals) {
+    ICDB_SET_STATUS(icdb, ICDB_EBADRESP, "Unexpected MGET response");
+    goto end;
+  }
 
   int memory=0, ncpu=0, ncores=0;
   double rate_mem_local=0.0, rate_cpu_local=0.0;
 
-  // get monitor values for each node of clid
-  for (size_t i = 0; i < rep->elements; i++) {
-    ABT_mutex_lock(mutex);
-    rep2 = redisCommand(ctx, "GET monitor:%s", rep->element[i]->str);
-    ABT_mutex_unlock(mutex);
-    //fprintf(stderr, "icdb_getMonitor: step 2: GET monitor:%s\n", rep->element[i]->str);
-    CHECK_REP_TYPE(icdb, rep2, REDIS_REPLY_STRING);
+  for (size_t i = 0; i < rep[0]->elements; i++) {
+    if (_icdb_check_reply(icdb, mget->element[i], REDIS_REPLY_STRING) != ICDB_SUCCESS)
+      goto end;
     char ip_addr[20];
-    int nfields =  sscanf(rep2->str, "%[^ ] %d %lf %d %d %lf", ip_addr, &memory, &rate_mem_local, &ncpu, &ncores, &rate_cpu_local);
-    freeReplyObject(rep2);
+    int nfields =  sscanf(mget->element[i]->str, "%19[^ ] %d %lf %d %d %lf", ip_addr, &memory, &rate_mem_local, &ncpu, &ncores, &rate_cpu_local);
     if (nfields != 6) {
-        fprintf(stderr, "icdb_getMonitor: Error with sscanf of GET monitor:%s\n",rep->element[i]->str);
+        fprintf(stderr, "icdb_getMonitor: Error with sscanf of GET monitor:%s\n",rep[0]->element[i]->str);
         icdb->status = ICDB_ENOMEM;
-        freeReplyObject(rep);
         goto end;
     }
     rate_cpu_total = rate_cpu_total + rate_cpu_local;
     rate_mem_total = rate_mem_total + rate_mem_local;
     num_nodes++;
   }
-  freeReplyObject(rep);
-
-  // get current iteration key for clid
-  ABT_mutex_lock(mutex);
-  rep = redisCommand(ctx, "KEYS monitorFlexMPI:%s:*:current", clid);
-  ABT_mutex_unlock(mutex);
-  //fprintf(stderr, "icdb_getMonitor: step 3: KEYS monitorFlexMPI:%s:*:current\n", clid);
-  CHECK_REP_TYPE(icdb, rep, REDIS_REPLY_ARRAY);
-  if (rep->elements != 1) {
-    fprintf(stderr, "icdb_getMonitor: KEYS monitorFlexMPI:%s:*:current, there is  not just a single entry\n",clid);
-    icdb->status = ICDB_EBADRESP;
-    freeReplyObject(rep);
-    goto end;
-  }
-  //fprintf(stderr, "icdb_getMonitor: step 4\n");
-  CHECK_REP_TYPE(icdb, rep->element[0], REDIS_REPLY_STRING);
-  char *iter_key = strdup(rep->element[0]->str);
-  freeReplyObject(rep);
 
   // get current iteration data for clid
   double aux_rtime=0-0, aux_ptime=0.0, aux_ctime=0.0;
   int aux_num_proc=0;
-  ABT_mutex_lock(mutex);
-  rep = redisCommand(ctx, "GET %s", iter_key);
-  ABT_mutex_unlock(mutex);
-  //fprintf(stderr, "icdb_getMonitor: step 5: GET %s\n", iter_key);
-  free(iter_key);
-  CHECK_REP_TYPE(icdb, rep, REDIS_REPLY_STRING);
-  int nfields =  sscanf(rep->str, "%*d %*f %lf %lf %lf %*f %d", &aux_rtime, &aux_ptime, &aux_ctime, &aux_num_proc);
-  freeReplyObject(rep);
+  redisReply *iter = mget->element[nvals - 1];
+  if (_icdb_check_reply(icdb, iter, REDIS_REPLY_STRING) != ICDB_SUCCESS)
+    goto end;
+  int nfields =  sscanf(iter->str, "%*d %*f %lf %lf %lf %*f %d", &aux_rtime, &aux_ptime, &aux_ctime, &aux_num_proc);
   if (nfields != 4) {
-    fprintf(stderr, "icdb_getMonitor: Error with sscanf of GET %s\n",iter_key);
+    fprintf(stderr, "icdb_getMonitor: Error with sscanf of GET %s\n", iterkey);
     icdb->status = ICDB_ENOMEM;
     goto end;
   }
 
-    
+
   // calculate final rates
   (*rate_cpu) = rate_cpu_total / ((double) num_nodes);
   (*rate_mem) = rate_mem_total / ((double) num_nodes);
@@ -566,207 +1186,159 @@ icdb_getMonitor(struct icdb_context *icdb, const char *clid, double *rate_cpu, d
   char val_str[256];
   sprintf(val_str, "%ld %d %d %lf %lf %lf %lf %lf", time(NULL), num_nodes, (*num_proc), (*rate_cpu), (*rate_mem), (*rtime), (*ptime), (*ctime));
 
-  ABT_mutex_lock(mutex);
-  rep = redisCommand(ctx, "RPUSH log:%s %s", clid, val_str);
-  ABT_mutex_unlock(mutex);
-  //fprintf(stderr, "icdb_getMonitor: step 5: RPUSH log:%s %s\n",clid, val_str);
-  CHECK_REP_TYPE(icdb, rep, REDIS_REPLY_INTEGER);
-  freeReplyObject(rep);
-    
+  _icdb_append(icdb, "RPUSH log:%s %s", clid, val_str);
+  _icdb_flush_expect(icdb, REDIS_REPLY_INTEGER);
+
 end:
+  ICDB_UNLOCK(icdb);
+  if (mget)
+    freeReplyObject(mget);
+  free(argv);
+  free(argvlen);
+  free(keys);
+  free(iterkey);
+  _icdb_free_replies(rep, 2);
   return icdb->status;
 }
-// END CHANGE: JAVI
 
 
 int
-icdb_setclient(struct icdb_context *icdb, const char *clid,
-               const char *type, const char *addr, const char *nodelist,
-               uint16_t provid, uint32_t jobid, uint32_t jobncpus,
-               const char *jobnodelist, uint64_t nprocs)
+icdb_setmonitor(struct icdb_context *icdb, const char *clid,
+                const char *key, const char *value)
 {
+  ICSTATS_SCOPE("icdb", __func__);
   CHECK_ICDB(icdb);
   CHECK_PARAM(icdb, clid);
-  CHECK_PARAM(icdb, type);
-  CHECK_PARAM(icdb, addr);
+  CHECK_PARAM(icdb, key);
+  CHECK_PARAM(icdb, value);
 
   icdb->status = ICDB_SUCCESS;
 
   redisReply *rep;
-  redisContext *ctx = icdb->redisctx;
 
-  /* XX fixme: wrap in transaction */
-  // CHANGE: JAVI
-  ABT_mutex mutex = ABT_MUTEX_MEMORY_GET_HANDLE(&icdb_mutex);
-  // END CHANGE: JAVI
+  ICDB_LUA_CALL(icdb, rep, ICDB_LUA_FN_MONITOR_SET, "%s %s %s", clid, key, value);
+  CHECK_REP_TYPE(icdb, rep, REDIS_REPLY_INTEGER);
+  freeReplyObject(rep);
 
-  /* ALBERTO - Check if client exisits and update his addr*/
-  ABT_mutex_lock(mutex);
-  rep = redisCommand(ctx, "HMGET client:%s addr", clid);
-  ABT_mutex_unlock(mutex);
-  //CHECK_REP_TYPE(icdb, rep, REDIS_REPLY_ARRAY);
-  if (rep == NULL || rep->type == REDIS_REPLY_ERROR) 
-        fprintf(stderr, "[DEBUG] Error getting client address from redis");
-
-  //fprintf(stderr, "[DEBUG] Get client addr - num elements returned= %lu - addr = %s\n", rep->elements, rep->element[0]->str);
-  if (rep->type == REDIS_REPLY_ARRAY && rep->elements == 1 && rep->element[0]->str != NULL){
-  //if (rep->elements > 0 && rep->str != NULL){ 
-    //fprintf(stderr, "[DEBUG] Reloading client address\n");
-    ABT_mutex_lock(mutex);
-    rep = redisCommand(ctx, "HSET client:%s addr %s", clid, addr);
-    ABT_mutex_unlock(mutex);
-    if (rep == NULL || rep->type == REDIS_REPLY_ERROR) 
-        fprintf(stderr, "[DEBUG] Error updating the client addr\n");
-    return ICDB_SUCCESS;
-  } 
+  return icdb->status;
+}
 
-  //fprintf(stderr, "[DEBUG] Client registered normally\n");
 
-  /* parse comma-separated node lists and add them to the nodelist */
-  uint32_t nnodes = 0, jobnnodes = 0;
-  char *l = strdup(jobnodelist);
-  if (!l) { return ICDB_ENOMEM; }
+int
+icdb_monitor_sample(struct icdb_context *icdb, const char *clid,
+                    double rtime, double ctime, uint32_t window,
+                    struct icdb_monitor_avg *avg)
+{
+  ICSTATS_SCOPE("icdb", __func__);
+  CHECK_ICDB(icdb);
+  CHECK_PARAM(icdb, clid);
+  CHECK_PARAM(icdb, avg);
+  CHECK_PARAM(icdb, window > 0);
 
-  char *node = strtok(l, ",");
-  if (node) {
-    do {
-      nnodes++;
-      // CHANGE: JAVI
-      ABT_mutex_lock(mutex);
-      rep = redisCommand(ctx, "RPUSH nodelist:client:%s %s", clid, node);
-      ABT_mutex_unlock(mutex);
-      // END CHANGE: JAVI
-      CHECK_REP_TYPE(icdb, rep, REDIS_REPLY_INTEGER);
-    } while ((node = strtok(NULL, ",")));
-  }
-  free(l);
+  icdb->status = ICDB_SUCCESS;
 
-  l = strdup(jobnodelist);
-  if (!l) { return ICDB_ENOMEM; }
+  redisReply *rep;
 
-  node = strtok(l, ",");
-  if (node) {
-    do {
-      jobnnodes++;
-      // CHANGE: JAVI
-      ABT_mutex_lock(mutex);
-      rep = redisCommand(ctx, "RPUSH nodelist:job:%"PRIu32" %s", jobid, node);
-      ABT_mutex_unlock(mutex);
-      // END CHANGE: JAVI
-      CHECK_REP_TYPE(icdb, rep, REDIS_REPLY_INTEGER);
-    } while ((node = strtok(NULL, ",")));
+  ICDB_LUA_CALL(icdb, rep, ICDB_LUA_FN_MONITOR_SAMPLE, "%s %.17g %.17g %"PRIu32,
+                clid, rtime, ctime, window);
+  CHECK_REP_TYPE(icdb, rep, REDIS_REPLY_ARRAY);
+
+  if (rep->elements != 3 ||
+      rep->element[0]->type != REDIS_REPLY_INTEGER ||
+      rep->element[1]->type != REDIS_REPLY_STRING ||
+      rep->element[2]->type != REDIS_REPLY_STRING) {
+    freeReplyObject(rep);
+    ICDB_SET_STATUS(icdb, ICDB_EBADRESP, "Malformed monitor sample response");
+    return ICDB_EBADRESP;
   }
-  free(l);
 
-  /* 1) Create or update job */
-  // CHANGE: JAVI
-  ABT_mutex_lock(mutex);
-  rep = redisCommand(ctx, "HSET job:%"PRIu32" jobid %"PRIu32" ncpus %"PRIu32" nnodes %"PRIu32" nodelist %s",jobid, jobid, jobncpus, jobnnodes, jobnodelist);
-  ABT_mutex_unlock(mutex);
-  // END CHANGE: JAVI
-  CHECK_REP_TYPE(icdb, rep, REDIS_REPLY_INTEGER);
+  avg->nsamples = (uint32_t)rep->element[0]->integer;
+  avg->rtime = strtod(rep->element[1]->str, NULL);
+  avg->ctime = strtod(rep->element[2]->str, NULL);
+  freeReplyObject(rep);
 
-  /* 2) write client to hashmap */
-  // CHANGE: JAVI
-  ABT_mutex_lock(mutex);
-  rep = redisCommand(ctx, "HSET client:%s clid %s type %s addr %s nnodes %"PRIu32" nodelist %s provid %"PRIu32" jobid %"PRIu32" nprocs %"PRIu64" reconfig_nprocs 0 reconfig_nnodes 0", clid, clid, type, addr, nnodes, nodelist, provid, jobid, nprocs);
-  ABT_mutex_unlock(mutex);
-  // END CHANGE: JAVI
-  CHECK_REP_TYPE(icdb, rep, REDIS_REPLY_INTEGER);
+  return icdb->status;
+}
 
-  /* 3) write to client sets (~indexes)  */
-  // CHANGE: JAVI
-  ABT_mutex_lock(mutex);
-  rep = redisCommand(ctx, "SADD index:clients %s", clid);
-  ABT_mutex_unlock(mutex);
-  // END CHANGE: JAVI
-  CHECK_REP_TYPE(icdb, rep, REDIS_REPLY_INTEGER);
 
-  // CHANGE: JAVI
-  ABT_mutex_lock(mutex);
-  rep = redisCommand(ctx, "SADD index:clients:type:%s %s", type, clid);
-  ABT_mutex_unlock(mutex);
-  // END CHANGE: JAVI
-  CHECK_REP_TYPE(icdb, rep, REDIS_REPLY_INTEGER);
+int
+icdb_monitor_reset(struct icdb_context *icdb, const char *clid)
+{
+  ICSTATS_SCOPE("icdb", __func__);
+  CHECK_ICDB(icdb);
+  CHECK_PARAM(icdb, clid);
 
-  // CHANGE: JAVI
-  ABT_mutex_lock(mutex);
-  rep = redisCommand(ctx, "SADD index:clients:jobid:%"PRIu32" %s", jobid, clid);
-  ABT_mutex_unlock(mutex);
-  // END CHANGE: JAVI
+  icdb->status = ICDB_SUCCESS;
+
+  redisReply *rep;
+
+  rep = _icdb_command(icdb, "DEL monitorFlexMPI:%s:samples", clid);
   CHECK_REP_TYPE(icdb, rep, REDIS_REPLY_INTEGER);
+  freeReplyObject(rep);
 
   return icdb->status;
 }
+// END CHANGE: JAVI
 
 
 int
-icdb_delclient(struct icdb_context *icdb, const char *clid, uint32_t *jobid)
+icdb_setclient(struct icdb_context *icdb, const char *clid,
+               const char *type, const char *addr, const char *nodelist,
+               uint16_t provid, uint32_t jobid, uint32_t jobncpus,
+               const char *jobnodelist, uint64_t nprocs)
 {
+  ICSTATS_SCOPE("icdb", __func__);
   CHECK_ICDB(icdb);
   CHECK_PARAM(icdb, clid);
+  CHECK_PARAM(icdb, type);
+  CHECK_PARAM(icdb, addr);
+  CHECK_PARAM(icdb, nodelist);
+  CHECK_PARAM(icdb, jobnodelist);
 
   icdb->status = ICDB_SUCCESS;
 
   redisReply *rep;
-  char *type;
-  // CHANGE: JAVI
-  ABT_mutex mutex = ABT_MUTEX_MEMORY_GET_HANDLE(&icdb_mutex);
-  ABT_mutex_lock(mutex);
-  rep = redisCommand(icdb->redisctx, "HMGET client:%s jobid type", clid);
-  ABT_mutex_unlock(mutex);
-  // END CHANGE: JAVI
-  CHECK_REP_TYPE(icdb, rep, REDIS_REPLY_ARRAY);
 
-  if (rep->elements == 0) {
-    ICDB_SET_STATUS(icdb, ICDB_NORESULT, "No client with id %s", clid);
-    return ICDB_NORESULT;
-  }
+  /* a client that exists already only gets its addr updated (restart
+     after checkpoint), otherwise write the client and its job,
+     nodelists and indexes at once. Returns 0 or 1 respectively. */
+  ICDB_LUA_CALL(icdb, rep, ICDB_LUA_FN_SETCLIENT,
+                "%s %s %s %s %"PRIu16" %"PRIu32" %"PRIu32" %s %"PRIu64,
+                clid, type, addr, nodelist, provid, jobid, jobncpus,
+                jobnodelist, nprocs);
+  CHECK_REP_TYPE(icdb, rep, REDIS_REPLY_INTEGER);
+  freeReplyObject(rep);
 
-  /* HMGET gets values in order */
-  CHECK_REP_TYPE(icdb, rep->element[0], REDIS_REPLY_STRING);
-  CHECK_REP_TYPE(icdb, rep->element[1], REDIS_REPLY_STRING);
+  return icdb->status;
+}
 
-  ICDB_GET_UINT32(icdb, rep->element[0], jobid, "jobid");
-  type = rep->element[1]->str;
 
-  /* Remove client and client index  */
-  /* DEL & SREM return the number of keys that were deleted */
+int
+icdb_delclient(struct icdb_context *icdb, const char *clid, uint32_t *jobid)
+{
+  ICSTATS_SCOPE("icdb", __func__);
+  CHECK_ICDB(icdb);
+  CHECK_PARAM(icdb, clid);
+  CHECK_PARAM(icdb, jobid);
 
-  /* begin transaction */
-  // CHANGE: JAVI
-  ABT_mutex_lock(mutex);
-  rep = redisCommand(icdb->redisctx, "MULTI");
-  ABT_mutex_unlock(mutex);
-  // END CHANGE: JAVI
-  assert(rep->type == REDIS_REPLY_STATUS);
+  icdb->status = ICDB_SUCCESS;
 
-  // CHANGE: JAVI
-  ABT_mutex_lock(mutex);
-  redisCommand(icdb->redisctx, "SREM index:clients:jobid:%"PRIu32" %s", *jobid, clid);
-  redisCommand(icdb->redisctx, "SREM index:clients:type:%s %s", type, clid);
-  redisCommand(icdb->redisctx, "SREM index:clients %s", clid);
-  redisCommand(icdb->redisctx, "DEL client:%s", clid);
-  redisCommand(icdb->redisctx, "DEL nodelist:client:%s", clid);
-  redisCommand(icdb->redisctx, "DEL nodelist:job:%"PRIu32, *jobid);
-  redisCommand(icdb->redisctx, "DEL client:%s:reconfig", clid);
-  ABT_mutex_unlock(mutex);
-  // END CHANGE: JAVI
+  redisReply *rep;
 
-  /* end transaction & check responses */
-  // CHANGE: JAVI
-  ABT_mutex_lock(mutex);
-  rep = redisCommand(icdb->redisctx, "EXEC");
-  ABT_mutex_unlock(mutex);
-  // END CHANGE: JAVI
-  CHECK_REP_TYPE(icdb, rep, REDIS_REPLY_ARRAY);
-  CHECK_REP_TYPE(icdb, rep->element[0], REDIS_REPLY_INTEGER); /* SREM */
-  CHECK_REP_TYPE(icdb, rep->element[1], REDIS_REPLY_INTEGER); /* SREM */
-  CHECK_REP_TYPE(icdb, rep->element[2], REDIS_REPLY_INTEGER); /* SREM */
-  CHECK_REP_TYPE(icdb, rep->element[3], REDIS_REPLY_INTEGER); /* DEL  */
-  CHECK_REP_TYPE(icdb, rep->element[4], REDIS_REPLY_INTEGER); /* DEL  */
-  CHECK_REP_TYPE(icdb, rep->element[5], REDIS_REPLY_INTEGER); /* DEL  */
-  CHECK_REP_TYPE(icdb, rep->element[6], REDIS_REPLY_INTEGER); /* DEL  */
+  /* remove client, its nodelists and indexes. Returns its jobid or
+     nil if there is no such client */
+  ICDB_LUA_CALL(icdb, rep, ICDB_LUA_FN_DELCLIENT, "%s", clid);
+  CHECK_REP(icdb, rep);
+
+  if (rep->type == REDIS_REPLY_NIL) {
+    freeReplyObject(rep);
+    ICDB_SET_STATUS(icdb, ICDB_NORESULT, "No client with id %s", clid);
+    return ICDB_NORESULT;
+  }
+
+  CHECK_REP_TYPE(icdb, rep, REDIS_REPLY_INTEGER);
+  *jobid = (uint32_t)rep->integer;
+  freeReplyObject(rep);
 
   return icdb->status;
 }
@@ -774,16 +1346,17 @@ icdb_delclient(struct icdb_context *icdb, const char *clid, uint32_t *jobid)
 int
 icdb_reconfigurable(struct icdb_context *icdb, const char *clid, int32_t procs_hint, int32_t nodes_hint)
 {
+  ICSTATS_SCOPE("icdb", __func__);
   CHECK_ICDB(icdb);
   CHECK_PARAM(icdb, clid);
 
   icdb->status = ICDB_SUCCESS;
 
   redisReply *rep;
-  redisContext *ctx = icdb->redisctx;
 
-  rep = redisCommand(ctx, "HSET client:%s reconfig_nprocs %"PRIi32" reconfig_nnodes %"PRIi32, clid, procs_hint, nodes_hint);
+  rep = _icdb_command(icdb, "HSET client:%s reconfig_nprocs %"PRIi32" reconfig_nnodes %"PRIi32, clid, procs_hint, nodes_hint);
   CHECK_REP_TYPE(icdb, rep, REDIS_REPLY_INTEGER);
+  freeReplyObject(rep);
 
  return icdb->status;
 }
@@ -791,38 +1364,17 @@ icdb_reconfigurable(struct icdb_context *icdb, const char *clid, int32_t procs_h
 int
 icdb_deljob(struct icdb_context *icdb, uint32_t jobid)
 {
+  ICSTATS_SCOPE("icdb", __func__);
   CHECK_ICDB(icdb);
 
   icdb->status = ICDB_SUCCESS;
 
   redisReply *rep;
-  int ret;
-
-  /* 1. delete clients associated with jobid */
-  // CHANGE: JAVI
-  ABT_mutex mutex = ABT_MUTEX_MEMORY_GET_HANDLE(&icdb_mutex);
-  ABT_mutex_lock(mutex);
-  rep = redisCommand(icdb->redisctx, "SMEMBERS index:clients:jobid:%"PRIu32, jobid);
-  ABT_mutex_unlock(mutex);
-  // END CHANGE: JAVI
-  CHECK_REP_TYPE(icdb, rep, REDIS_REPLY_ARRAY);
-
-  for (size_t i = 0; i < rep->elements; i++) {
-    uint32_t _jobid;
-    ret = icdb_delclient(icdb, rep->element[i]->str, &_jobid);
-    if (ret != ICDB_SUCCESS) {
-      return ret;
-    }
-    assert(_jobid == jobid);
-  }
 
-  /* 2. delete jobid */
-  // CHANGE: JAVI
-  ABT_mutex_lock(mutex);
-  rep = redisCommand(icdb->redisctx, "DEL job:%"PRIu32, jobid);
-  ABT_mutex_unlock(mutex);
-  // END CHANGE: JAVI
+  /* delete clients associated with jobid, then jobid */
+  ICDB_LUA_CALL(icdb, rep, ICDB_LUA_FN_DELJOB, "%"PRIu32, jobid);
   CHECK_REP_TYPE(icdb, rep, REDIS_REPLY_INTEGER);
+  freeReplyObject(rep);
 
   return icdb->status;
 }
@@ -831,82 +1383,150 @@ int
 icdb_getclients2(struct icdb_context *icdb, uint32_t jobid, const char *type,
                 struct icdb_client *clients[], size_t *count, uint64_t *cursor)
 {
+  ICSTATS_SCOPE("icdb", __func__);
   CHECK_ICDB(icdb);
   CHECK_PARAM(icdb, clients);
+  CHECK_PARAM(icdb, count);
+  CHECK_PARAM(icdb, cursor);
 
-  redisReply *rep = NULL;
+  icdb->status = ICDB_SUCCESS;
+  arena_reset(icdb->arena);
 
-  if (jobid && type) {
-    /* XX sinter return length is unbounded, no cursor */
-    rep = redisCommand(icdb->redisctx,
-            "SINTER index:clients:jobid:%"PRIu32" index:clients:type:%s", jobid, type);
-  } else if (jobid) {
-     rep = redisCommand(icdb->redisctx, "SSCAN index:clients:jobid:%"PRIu32" %d", jobid, *cursor);
-  } else if (type) {
-     rep = redisCommand(icdb->redisctx, "SSCAN index:clients:type:%s %d", type, *cursor);
-  } else {
-     rep = redisCommand(icdb->redisctx, "SSCAN index:clients %d", *cursor);
+  struct icdb_client_filter filter = { .jobid = jobid, .type = type };
+  struct getclients_arg a = { .clients = *clients };
+  int stop = 0, rc;
+
+  rc = _icdb_scan_clients(icdb, &filter, cursor, ICDB_SCAN_BATCH,
+                          _getclients_grow_cb, &a, &stop);
+  *clients = a.clients;
+  *count = a.count;
+
+  if (rc == ICDB_SUCCESS && a.err) {
+    ICDB_SET_STATUS(icdb, a.err, "Out of memory");
+    rc = a.err;
   }
 
-  /* SSCAN returns the cursor + an array of elements */
-  CHECK_REP_TYPE(icdb, rep, REDIS_REPLY_ARRAY);
-  CHECK_REP_TYPE(icdb, rep->element[0], REDIS_REPLY_STRING)
-  CHECK_REP_TYPE(icdb, rep->element[1], REDIS_REPLY_ARRAY)
+  return rc;
+}
 
-  ICDB_GET_UINT64(icdb, rep->element[0], cursor, "cursor");
-  *count = rep->element[1]->elements;
 
-  struct icdb_client *tmp = reallocarray(*clients, *count, sizeof(struct icdb_client));
-  if (!tmp) {
-    return ICDB_ENOMEM;
+struct client_rank {
+  size_t rank;                  /* first node in the job nodelist */
+  size_t idx;
+};
+
+static int
+_client_rank_cmp(const void *a, const void *b)
+{
+  const struct client_rank *x = a, *y = b;
+
+  if (x->rank != y->rank)
+    return x->rank < y->rank ? -1 : 1;
+  return (x->idx > y->idx) - (x->idx < y->idx);
+}
+
+int
+icdb_sort_clients(struct icdb_context *icdb, uint32_t jobid,
+                  struct icdb_client *clients, size_t nclients)
+{
+  ICSTATS_SCOPE("icdb", __func__);
+  CHECK_ICDB(icdb);
+  CHECK_PARAM(icdb, clients || nclients == 0);
+
+  icdb->status = ICDB_SUCCESS;
+
+  if (nclients < 2)
+    return ICDB_SUCCESS;
+
+  redisReply **reps = calloc(nclients + 1, sizeof(*reps));
+  struct client_rank *ranks = malloc(nclients * sizeof(*ranks));
+  struct icdb_client *sorted = malloc(nclients * sizeof(*sorted));
+  hm_t *pos = hm_create();
+
+  if (!reps || !ranks || !sorted || !pos) {
+    ICDB_SET_STATUS(icdb, ICDB_ENOMEM, "Out of memory");
+    goto end;
   }
 
-  /* XX check return code */
-  for (size_t i = 0; i < *count; i++) {
-    icdb_getclient(icdb, rep->element[1]->element[i]->str, &(tmp[i]));
+  /* the nodes of the job and the first node of each client, at once */
+  ICDB_LOCK(icdb);
+  _icdb_append(icdb, "LRANGE nodelist:job:%"PRIu32" 0 -1", jobid);
+  for (size_t i = 0; i < nclients; i++) {
+    _icdb_append(icdb, "LINDEX nodelist:client:%s 0", clients[i].clid);
   }
-  *clients = tmp;
+  _icdb_flush(icdb, reps, nclients + 1);
+  ICDB_UNLOCK(icdb);
 
-  return ICDB_SUCCESS;
+  if (icdb->status != ICDB_SUCCESS ||
+      _icdb_check_reply(icdb, reps[0], REDIS_REPLY_ARRAY) != ICDB_SUCCESS)
+    goto end;
+
+  for (size_t j = 0; j < reps[0]->elements; j++) {
+    const redisReply *node = reps[0]->element[j];
+    if (node->type == REDIS_REPLY_STRING && !hm_get(pos, node->str) &&
+        hm_set(pos, node->str, &j, sizeof(j)) == -1) {
+      ICDB_SET_STATUS(icdb, ICDB_ENOMEM, "Out of memory");
+      goto end;
+    }
+  }
+
+  for (size_t i = 0; i < nclients; i++) {
+    const redisReply *node = reps[i + 1];
+    const size_t *rank = NULL;
+    if (node && node->type == REDIS_REPLY_STRING)
+      rank = hm_get(pos, node->str);
+    ranks[i].rank = rank ? *rank : SIZE_MAX;
+    ranks[i].idx = i;
+  }
+
+  qsort(ranks, nclients, sizeof(*ranks), _client_rank_cmp);
+
+  for (size_t i = 0; i < nclients; i++) {
+    sorted[i] = clients[ranks[i].idx];
+  }
+  memcpy(clients, sorted, nclients * sizeof(*clients));
+
+ end:
+  _icdb_free_replies(reps, nclients + 1);
+  free(reps);
+  free(ranks);
+  free(sorted);
+  hm_free(pos);
+
+  return icdb->status;
 }
 
 
 int icdb_shrink(struct icdb_context *icdb, char *clid, char **newnodelist)
 {
+  ICSTATS_SCOPE("icdb", __func__);
   CHECK_ICDB(icdb);
   icdb->status = ICDB_SUCCESS;
 
   redisReply *rep;
 
-  // CHANGE: JAVI
-  ABT_mutex mutex = ABT_MUTEX_MEMORY_GET_HANDLE(&icdb_mutex);
-  ABT_mutex_lock(mutex);
-  rep = redisCommand(icdb->redisctx, "EVAL %s 1 nodelist:client:%s",
-    "local n = math.floor(redis.call('LLEN', KEYS[1]) / 2) "
-    "return table.concat(redis.call('LRANGE', KEYS[1], 0, n-1), ',')",
-    clid);
-  ABT_mutex_unlock(mutex);
-  // END CHANGE: JAVI
+  ICDB_LUA_CALL(icdb, rep, ICDB_LUA_FN_SHRINK, "%s", clid);
   CHECK_REP_TYPE(icdb, rep, REDIS_REPLY_STRING);
 
   *newnodelist = strdup(rep->str);
+  freeReplyObject(rep);
+  if (!*newnodelist)
+    ICDB_SET_STATUS(icdb, ICDB_ENOMEM, "Out of memory");
+
   return icdb->status;
 }
 
 int icdb_incrnprocs(struct icdb_context *icdb, char *clid, int64_t incrby)
 {
+  ICSTATS_SCOPE("icdb", __func__);
   CHECK_ICDB(icdb);
   icdb->status = ICDB_SUCCESS;
 
   redisReply *rep;
     
-  // CHANGE: JAVI
-  ABT_mutex mutex = ABT_MUTEX_MEMORY_GET_HANDLE(&icdb_mutex);
-  ABT_mutex_lock(mutex);
-  rep = redisCommand(icdb->redisctx, "HINCRBY client:%s nprocs %"PRId64, clid, incrby);
-  ABT_mutex_unlock(mutex);
-  // END CHANGE: JAVI
-  CHECK_REP_TYPE(icdb, rep, REDIS_REPLY_ARRAY);
+  rep = _icdb_command(icdb, "HINCRBY client:%s nprocs %"PRId64, clid, incrby);
+  CHECK_REP_TYPE(icdb, rep, REDIS_REPLY_INTEGER);
+  freeReplyObject(rep);
 
   return icdb->status;
 }
@@ -937,47 +1557,23 @@ icdb_job_free(struct icdb_job **job) {
 int
 icdb_getjob(struct icdb_context *icdb, uint32_t jobid, struct icdb_job *job)
 {
+  ICSTATS_SCOPE("icdb", __func__);
   CHECK_ICDB(icdb);
 
   icdb->status = ICDB_SUCCESS;
 
   redisReply *rep;
-  redisContext *ctx = icdb->redisctx;
 
   // CHANGE: JAVI
   //assert(-1==0);
   fprintf(stderr, "icdb_getjob: jobid=%d\n", jobid);
-  ABT_mutex mutex = ABT_MUTEX_MEMORY_GET_HANDLE(&icdb_mutex);
-  ABT_mutex_lock(mutex);
-  rep = redisCommand(ctx, "HGETALL job:%"PRIu32, jobid);
-  ABT_mutex_unlock(mutex);
+  rep = _icdb_command(icdb, "HGETALL job:%"PRIu32, jobid);
   //assert(1==0);
   // END CHANGE: JAVI
   CHECK_REP_TYPE(icdb, rep, REDIS_REPLY_ARRAY);
 
-  /* HGETALL returns all keys followed by their respective value */
-  for (size_t i = 0; i < rep->elements; i++) {
-    char *key = rep->element[i]->str;
-    redisReply *r = rep->element[++i];
-
-    CHECK_REP_TYPE(icdb, r, REDIS_REPLY_STRING);
-
-    if (!strcmp(key, "jobid")) {
-      ICDB_GET_UINT32(icdb, r, &job->jobid, key);
-    }
-    else if (!strcmp(key, "nnodes")) {
-      ICDB_GET_UINT32(icdb, r, &job->nnodes, key);
-    }
-    else if (!strcmp(key, "ncpus")) {
-      ICDB_GET_UINT32(icdb, r, &job->ncpus, key);
-    }
-    else if (!strcmp(key, "nodelist")) {
-      ICDB_GET_STRDUP(icdb, r, &job->nodelist, key);
-    }
-
-    if (icdb->status != ICDB_SUCCESS)
-      break;
-  }
+  _icdb_decode_hash(icdb, rep, job_schema, ICDB_NFIELDS(job_schema), job);
+  freeReplyObject(rep);
 
   return icdb->status;
 }
@@ -988,53 +1584,81 @@ icdb_getjob(struct icdb_context *icdb, uint32_t jobid, struct icdb_job *job)
 
 int
 icdb_getlargestjob(struct icdb_context *icdb, uint32_t *jobid) {
+  ICSTATS_SCOPE("icdb", __func__);
  CHECK_ICDB(icdb);
 
   icdb->status = ICDB_SUCCESS;
   *jobid = 0;
 
   redisReply *rep;
-  redisContext *ctx = icdb->redisctx;
 
-  // CHANGE: JAVI
-  ABT_mutex mutex = ABT_MUTEX_MEMORY_GET_HANDLE(&icdb_mutex);
-  ABT_mutex_lock(mutex);
-  rep = redisCommand(ctx, "SORT admire:jobs:running DESC LIMIT 0 1 "
-                          "BY admire:job:*->nnodes "
-                          "GET admire:job:*->jobid");
-  ABT_mutex_unlock(mutex);
-  // END CHANGE: JAVI
+  rep = _icdb_command(icdb, "SORT admire:jobs:running DESC LIMIT 0 1 "
+                            "BY admire:job:*->nnodes "
+                            "GET admire:job:*->jobid");
   CHECK_REP_TYPE(icdb, rep, REDIS_REPLY_ARRAY);
 
   if (rep->elements > 0) {
     ICDB_GET_UINT32(icdb, rep->element[0], jobid, "jobid");
   }
+  freeReplyObject(rep);
 
   return icdb->status;
 }
 
 /* Message stream */
 int
-icdb_mstream_read(struct icdb_context *icdb, char *streamkey)
+icdb_mstream_group(struct icdb_context *icdb, const char *streamkey,
+                   const char *group)
 {
+  ICSTATS_SCOPE("icdb", __func__);
   CHECK_ICDB(icdb);
+  CHECK_PARAM(icdb, streamkey);
+  CHECK_PARAM(icdb, group);
 
   icdb->status = ICDB_SUCCESS;
 
   redisReply *rep;
-  redisContext *ctx = icdb->redisctx;
 
-  // CHANGE: JAVI
-  ABT_mutex mutex = ABT_MUTEX_MEMORY_GET_HANDLE(&icdb_mutex);
-  do {
-    ABT_mutex_lock(mutex);
-    //rep = redisCommand(ctx, "XREAD BLOCK 0 STREAMS %s $", streamkey);
-    rep = redisCommand(ctx, "XREAD STREAMS %s $", streamkey);
-    ABT_mutex_unlock(mutex);
-      if ((rep)->type == REDIS_REPLY_NIL) sleep(1);
-  } while ((rep)->type == REDIS_REPLY_NIL);
-  // END CHANGE: JAVI
+  rep = _icdb_command(icdb, "XGROUP CREATE %s %s $ MKSTREAM", streamkey, group);
+  if (rep && rep->type == REDIS_REPLY_ERROR && !strncmp(rep->str, "BUSYGROUP", 9)) {
+    freeReplyObject(rep);
+    return ICDB_SUCCESS;
+  }
+  CHECK_REP_TYPE(icdb, rep, REDIS_REPLY_STATUS);
+  freeReplyObject(rep);
+
+  return icdb->status;
+}
+
+int
+icdb_mstream_consume(struct icdb_context *icdb, const char *streamkey,
+                     const char *group, const char *consumer,
+                     char *lastid, int timeout_ms,
+                     icdb_mstream_cb cb, void *arg)
+{
+  CHECK_ICDB(icdb);
+  CHECK_PARAM(icdb, streamkey);
+  CHECK_PARAM(icdb, lastid);
+  CHECK_PARAM(icdb, cb);
+
+  icdb->status = ICDB_SUCCESS;
+
+  redisReply *rep;
+
+  if (group) {
+    CHECK_PARAM(icdb, consumer);
+    rep = _icdb_command(icdb, "XREADGROUP GROUP %s %s BLOCK %d STREAMS %s >",
+                        group, consumer, timeout_ms, streamkey);
+  } else {
+    rep = _icdb_command(icdb, "XREAD BLOCK %d STREAMS %s %s",
+                        timeout_ms, streamkey, lastid);
+  }
+  CHECK_REP(icdb, rep);
 
+  if (rep->type == REDIS_REPLY_NIL) {   /* timeout */
+    freeReplyObject(rep);
+    return ICDB_NORESULT;
+  }
   CHECK_REP_TYPE(icdb, rep, REDIS_REPLY_ARRAY);
 
   /* XREAD returns an array of arrays:
@@ -1043,95 +1667,354 @@ icdb_mstream_read(struct icdb_context *icdb, char *streamkey)
               2) 1) "foo"
                  2) "bar"
   */
+  const char **fields = NULL;
+  size_t maxfields = 0;
+
   for (size_t s = 0; s < rep->elements; s++) {	/* iterate over streams */
-    redisReply *r;
-    r = rep->element[s];
-    fprintf(stderr, "stream %s\n", r->element[0]->str);
-	size_t nmsg = r->element[1]->elements;
+    redisReply *r = rep->element[s];
+    if (r->type != REDIS_REPLY_ARRAY || r->elements != 2 ||
+        r->element[1]->type != REDIS_REPLY_ARRAY) {
+      ICDB_SET_STATUS(icdb, ICDB_EBADRESP, "Malformed stream %s", streamkey);
+      goto end;
+    }
 
+    size_t nmsg = r->element[1]->elements;
     for (size_t m = 0; m < nmsg; m++) {			/* iterate over messages */
-      r = r->element[1]->element[m];
-      fprintf(stderr, "  message %s\n", r->element[0]->str);
-      size_t nkv = r->element[1]->elements;
-
-      for (size_t i = 0; i < nkv; i++) {		/* iterate over key val */
-        char *key = r->element[1]->element[i]->str;
-        char *val = r->element[1]->element[++i]->str;
-        printf("    %s: %s\n", key, val);
+      redisReply *e = r->element[1]->element[m];
+      if (e->type != REDIS_REPLY_ARRAY || e->elements != 2 ||
+          e->element[0]->type != REDIS_REPLY_STRING) {
+        ICDB_SET_STATUS(icdb, ICDB_EBADRESP, "Malformed message in stream %s", streamkey);
+        goto end;
       }
-    }
-  }
+
+      struct icdb_mstream_msg msg = { .id = e->element[0]->str };
+      redisReply *kv = e->element[1];
+
+      /* a deleted entry still pending in a group has no field */
+      if (kv->type == REDIS_REPLY_ARRAY) {
+        if (kv->elements > maxfields) {
+          const char **tmp = realloc(fields, kv->elements * sizeof(*fields));
+          if (!tmp) {
+            ICDB_SET_STATUS(icdb, ICDB_ENOMEM, "Out of memory");
+            goto end;
+          }
+          fields = tmp;
+          maxfields = kv->elements;
+        }
+        /* keys first, then values */
+        msg.nfields = kv->elements / 2;
+        msg.keys = fields;
+        msg.vals = fields + msg.nfields;
+        for (size_t i = 0; i < msg.nfields; i++) {
+          msg.keys[i] = kv->element[2 * i]->str;
+          msg.vals[i] = kv->element[2 * i + 1]->str;
+        }
+      }
+
+      cb(&msg, arg);
+
+      if (e->element[0]->len + 1 > ICDB_MSTREAM_ID_LEN) {
+        ICDB_SET_STATUS(icdb, ICDB_E2BIG, "Stream ID %s too long", msg.id);
+        goto end;
+      }
+      strcpy(lastid, msg.id);
+    }
+  }
+
+end:
+  free(fields);
+  freeReplyObject(rep);
   return icdb->status;
 }
 
-/* Beegfs status message stream */
-#define BEEGFS_MSTREAM "admire:beegfs:status"
+int
+icdb_mstream_ack(struct icdb_context *icdb, const char *streamkey,
+                 const char *group, const char *id)
+{
+  ICSTATS_SCOPE("icdb", __func__);
+  CHECK_ICDB(icdb);
+  CHECK_PARAM(icdb, streamkey);
+  CHECK_PARAM(icdb, group);
+  CHECK_PARAM(icdb, id);
+
+  icdb->status = ICDB_SUCCESS;
+
+  redisReply *rep;
+
+  rep = _icdb_command(icdb, "XACK %s %s %s", streamkey, group, id);
+  CHECK_REP_TYPE(icdb, rep, REDIS_REPLY_INTEGER);
+  freeReplyObject(rep);
+
+  return icdb->status;
+}
 
 int
-icdb_mstream_beegfs(struct icdb_context *icdb, struct icdb_beegfs *result)
+icdb_mstream_beegfs(const struct icdb_mstream_msg *msg, struct icdb_beegfs *result)
 {
+  if (!msg || !result)
+    return ICDB_EPARAM;
+
   result->qlen = 0;
   result->timestamp = 0;
 
+  for (size_t i = 0; i < msg->nfields; i++) {
+    const char *val = msg->vals[i];
+    char *end;
+
+    if (!msg->keys[i] || !val)
+      return ICDB_EBADRESP;
+
+    errno = 0;
+    if (!strcmp(msg->keys[i], "timestamp")) {
+      result->timestamp = strtoull(val, &end, 10);
+    } else if (!strcmp(msg->keys[i], "qlen")) {
+      unsigned long qlen = strtoul(val, &end, 10);
+      if (qlen > UINT32_MAX)
+        return ICDB_EBADRESP;
+      result->qlen = (uint32_t)qlen;
+    } else {
+      continue;
+    }
+    if (errno || end == val || *end != '\0')
+      return ICDB_EBADRESP;
+  }
+
+  return ICDB_SUCCESS;
+}
+
+
+int
+icdb_keyspace_subscribe(struct icdb_context *icdb, const char *events,
+                        const char *const patterns[], size_t npatterns,
+                        const char *wakechan)
+{
   CHECK_ICDB(icdb);
+  CHECK_PARAM(icdb, events);
+  CHECK_PARAM(icdb, patterns);
+  CHECK_PARAM(icdb, wakechan);
 
   icdb->status = ICDB_SUCCESS;
 
   redisReply *rep;
-  redisContext *ctx = icdb->redisctx;
+  char flags[32];
 
-  // CHANGE: JAVI
-  ABT_mutex mutex = ABT_MUTEX_MEMORY_GET_HANDLE(&icdb_mutex);
-  do {
-    ABT_mutex_lock(mutex);
-    //rep = redisCommand(ctx, "XREAD BLOCK 0 STREAMS " BEEGFS_MSTREAM " $");
-    rep = redisCommand(ctx, "XREAD STREAMS " BEEGFS_MSTREAM " $");
-    ABT_mutex_unlock(mutex);
-      if ((rep)->type == REDIS_REPLY_NIL) sleep(1);
-  } while ((rep)->type == REDIS_REPLY_NIL);
-  // END CHANGE: JAVI
+  /* add the missing event classes to the server configuration,
+     without disabling those someone else relies on */
+  rep = _icdb_command(icdb, "CONFIG GET notify-keyspace-events");
   CHECK_REP_TYPE(icdb, rep, REDIS_REPLY_ARRAY);
+  if (rep->elements != 2 || rep->element[1]->type != REDIS_REPLY_STRING ||
+      rep->element[1]->len + strlen(events) + 2 > sizeof(flags)) {
+    freeReplyObject(rep);
+    ICDB_SET_STATUS(icdb, ICDB_EBADRESP, "Unexpected notify-keyspace-events");
+    return ICDB_EBADRESP;
+  }
+  strcpy(flags, rep->element[1]->str);
+  freeReplyObject(rep);
 
-  /*
-   * XREAD returns an array of arrays
-   * we only care about the last message of the one stream
-   */
-  size_t n;
+  size_t len = strlen(flags);
+  int changed = 0;
+  /* K enables keyspace notifications, A is an alias for most event
+     classes */
+  int all = strchr(flags, 'A') != NULL;
+
+  for (const char *e = events; ; e++) {
+    char c = *e ? *e : 'K';
+    if (!strchr(flags, c) && !(all && strchr("g$lshzxetd", c))) {
+      flags[len++] = c;
+      flags[len] = '\0';
+      changed = 1;
+    }
+    if (!*e)
+      break;
+  }
 
-  if (rep->elements != 1) {            /* 1 stream only */
-    ICDB_SET_STATUS(icdb, ICDB_FAILURE, "got %lld streams admire:beegfs", rep->elements);
+  if (changed) {
+    rep = _icdb_command(icdb, "CONFIG SET notify-keyspace-events %s", flags);
+    CHECK_REP_TYPE(icdb, rep, REDIS_REPLY_STATUS);
+    freeReplyObject(rep);
   }
-  rep = rep->element[0];
-  n = rep->element[1]->elements;
-  rep = rep->element[1]->element[n-1];  /* last message */
 
-  n = rep->element[1]->elements;
-  for (size_t i = 0; i < n; i++) {
-    char *key = rep->element[1]->element[i]->str;
-    redisReply *val = rep->element[1]->element[++i];
+  /* each (P)SUBSCRIBE is confirmed by its own reply */
+  for (size_t i = 0; i < npatterns; i++) {
+    rep = _icdb_command(icdb, "PSUBSCRIBE __keyspace@*__:%s", patterns[i]);
+    CHECK_REP_TYPE(icdb, rep, REDIS_REPLY_ARRAY);
+    freeReplyObject(rep);
+  }
 
-    if (!strcmp(key, "timestamp")) {
-       ICDB_GET_UINT64(icdb, val, &result->timestamp, "timestamp")
-    } else if (!strcmp(key, "qlen")) {
-      ICDB_GET_UINT32(icdb, val, &result->qlen, "qlen")
-    }
-    if (icdb->status != ICDB_SUCCESS) {
-      return ICDB_FAILURE;
+  rep = _icdb_command(icdb, "SUBSCRIBE %s", wakechan);
+  CHECK_REP_TYPE(icdb, rep, REDIS_REPLY_ARRAY);
+  freeReplyObject(rep);
+
+  return icdb->status;
+}
+
+int
+icdb_keyspace_wait(struct icdb_context *icdb, icdb_keyspace_cb cb, void *arg)
+{
+  CHECK_ICDB(icdb);
+  CHECK_PARAM(icdb, cb);
+
+  icdb->status = ICDB_SUCCESS;
+
+  redisReply *rep = NULL;
+  int rc;
+
+  ICDB_LOCK(icdb);
+  rc = redisGetReply(icdb->redisctx, (void **)&rep);
+  ICDB_UNLOCK(icdb);
+
+  if (rc != REDIS_OK) {
+    ICDB_SET_STATUS(icdb, ICDB_EPROTO, "Subscription: %s", icdb->redisctx->errstr);
+    return ICDB_EPROTO;
+  }
+  CHECK_REP_TYPE(icdb, rep, REDIS_REPLY_ARRAY);
+
+  /* pmessage: pattern, channel, event. message: channel, payload */
+  const char *kind = rep->elements > 0 ? rep->element[0]->str : NULL;
+
+  if (kind && !strcmp(kind, "pmessage") && rep->elements == 4 &&
+      rep->element[2]->type == REDIS_REPLY_STRING &&
+      rep->element[3]->type == REDIS_REPLY_STRING) {
+    /* channel is __keyspace@<db>__:<key> */
+    const char *key = strstr(rep->element[2]->str, "__:");
+    if (key) {
+      cb(key + 3, rep->element[3]->str, arg);
     }
+  } else if (kind && !strcmp(kind, "message")) {
+    icdb->status = ICDB_NORESULT;
+  } else {
+    ICDB_SET_STATUS(icdb, ICDB_EBADRESP, "Unexpected subscription message");
   }
+
+  freeReplyObject(rep);
+  return icdb->status;
+}
+
+int
+icdb_publish(struct icdb_context *icdb, const char *channel, const char *message)
+{
+  ICSTATS_SCOPE("icdb", __func__);
+  CHECK_ICDB(icdb);
+  CHECK_PARAM(icdb, channel);
+  CHECK_PARAM(icdb, message);
+
+  icdb->status = ICDB_SUCCESS;
+
+  redisReply *rep;
+
+  rep = _icdb_command(icdb, "PUBLISH %s %s", channel, message);
+  CHECK_REP_TYPE(icdb, rep, REDIS_REPLY_INTEGER);
+  freeReplyObject(rep);
+
   return icdb->status;
 }
 
 
 /** ICDB Utils */
 
+static uint64_t
+_icdb_now_ms(void)
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t)t.tv_sec * 1000 + t.tv_nsec / 1000000;
+}
+
+
+static int
+_icdb_connect(struct icdb_context *icdb)
+{
+  redisContext *ctx = redisConnect(icdb->host, icdb->port);
+
+  if (ctx == NULL) {
+    ICDB_SET_STATUS(icdb, ICDB_FAILURE, "Null DB context");
+    return ICDB_FAILURE;
+  }
+
+  if (ctx->err) {
+    ICDB_SET_STATUS(icdb, ICDB_EPROTO, "Could not connect to %s:%d: %s",
+                    icdb->host, icdb->port, ctx->errstr);
+    /* keep the failed connection, commands on it fail cleanly until
+       the next reconnection attempt */
+    if (icdb->redisctx)
+      redisFree(icdb->redisctx);
+    icdb->redisctx = ctx;
+    icdb->npending = 0;
+    return ICDB_EPROTO;
+  }
+
+  if (icdb->timeout_ms) {
+    struct timeval tv = {
+      .tv_sec = icdb->timeout_ms / 1000,
+      .tv_usec = (icdb->timeout_ms % 1000) * 1000,
+    };
+    if (redisSetTimeout(ctx, tv) != REDIS_OK) {
+      ICDB_SET_STATUS(icdb, ICDB_FAILURE, "Could not set DB timeout");
+      redisFree(ctx);
+      return ICDB_FAILURE;
+    }
+  }
+
+  if (icdb->redisctx)
+    redisFree(icdb->redisctx);
+  icdb->redisctx = ctx;
+  icdb->npending = 0;
+
+  return ICDB_SUCCESS;
+}
+
+
+static void
+_icdb_lock(struct icdb_context *icdb)
+{
+  uint64_t start = icstats_now();
+
+  ABT_mutex_lock(icdb->lock);
+
+  icdb->locked_at = icstats_now();
+  icstats_record(ICSTATS_HIST("icdb_lock", "wait"), icdb->locked_at - start);
+
+  if (icdb->redisctx && !icdb->redisctx->err)
+    return;
+
+  uint64_t now = _icdb_now_ms();
+  if (now < icdb->retry_at)
+    return;
+
+  /* the server-side library is reloaded on the first call that
+     misses it, see ICDB_LUA_CALL */
+  if (_icdb_connect(icdb) == ICDB_SUCCESS) {
+    icdb->backoff_ms = 0;
+    icdb->nreconnects++;
+    return;
+  }
+
+  if (icdb->backoff_ms < ICDB_BACKOFF_MIN_MS)
+    icdb->backoff_ms = ICDB_BACKOFF_MIN_MS;
+  else if (icdb->backoff_ms < ICDB_BACKOFF_MAX_MS / 2)
+    icdb->backoff_ms *= 2;
+  else
+    icdb->backoff_ms = ICDB_BACKOFF_MAX_MS;
+  icdb->retry_at = now + icdb->backoff_ms;
+}
+
+static void
+_icdb_unlock(struct icdb_context *icdb)
+{
+  icstats_record(ICSTATS_HIST("icdb_lock", "hold"), icstats_now() - icdb->locked_at);
+  ABT_mutex_unlock(icdb->lock);
+}
+
 static int
 _icdb_set_status(struct icdb_context *icdb, int status,
                  const char *filename, int lineno, const char *funcname,
                  const char *format, ...)
 {
-  CHECK_ICDB(icdb);
-  CHECK_PARAM(icdb, format);
+  /* no CHECK_ICDB, the status of a context that is not connected yet
+     is set too */
+  if (!icdb || !format)
+    return ICDB_EPARAM;
 
   icdb->status = status;
 
@@ -1148,7 +2031,7 @@ _icdb_set_status(struct icdb_context *icdb, int status,
   va_start(ap, format);
 
   if (nbytes < ICDB_ERRSTR_LEN) {
-    vsnprintf(icdb->errstr + nbytes, ICDB_ERRSTR_LEN, format, ap);
+    vsnprintf(icdb->errstr + nbytes, ICDB_ERRSTR_LEN - nbytes, format, ap);
   }
 
   icdb->errstr[ICDB_ERRSTR_LEN - 1] = '\0';
@@ -1160,6 +2043,211 @@ _icdb_set_status(struct icdb_context *icdb, int status,
 }
 
 
+static redisReply *
+_icdb_command(struct icdb_context *icdb, const char *format, ...)
+{
+  va_list ap;
+  va_start(ap, format);
+  ICDB_LOCK(icdb);
+  redisReply *rep = redisvCommand(icdb->redisctx, format, ap);
+  ICDB_UNLOCK(icdb);
+  va_end(ap);
+
+  return rep;
+}
+
+
+static int
+_icdb_append(struct icdb_context *icdb, const char *format, ...)
+{
+  va_list ap;
+  va_start(ap, format);
+  int rc = redisvAppendCommand(icdb->redisctx, format, ap);
+  va_end(ap);
+
+  if (rc != REDIS_OK) {
+    icdb->status = ICDB_EPROTO;
+    return ICDB_EPROTO;
+  }
+  icdb->npending++;
+
+  return ICDB_SUCCESS;
+}
+
+
+static int
+_icdb_append_argv(struct icdb_context *icdb, int argc, const char **argv,
+                  const size_t *argvlen)
+{
+  if (redisAppendCommandArgv(icdb->redisctx, argc, argv, argvlen) != REDIS_OK) {
+    icdb->status = ICDB_EPROTO;
+    return ICDB_EPROTO;
+  }
+  icdb->npending++;
+
+  return ICDB_SUCCESS;
+}
+
+
+static int
+_icdb_flush(struct icdb_context *icdb, redisReply **reps, size_t n)
+{
+  /* every pending reply must be read, even in case of error, or the
+     next command would get a stale response. A failed read however
+     leaves the connection unusable, so stop there */
+  size_t npending = icdb->npending;
+  int rc = ICDB_SUCCESS;
+
+  icdb->npending = 0;
+
+  for (size_t i = 0; i < npending; i++) {
+    void *r = NULL;
+    if (rc == ICDB_SUCCESS &&
+        redisGetReply(icdb->redisctx, &r) != REDIS_OK) {
+      icdb->status = ICDB_EPROTO;
+      rc = ICDB_EPROTO;
+      r = NULL;
+    }
+    if (i < n) {
+      reps[i] = r;
+    } else if (r) {
+      freeReplyObject(r);
+    }
+  }
+
+  for (size_t i = npending; i < n; i++) {
+    reps[i] = NULL;
+  }
+
+  return rc;
+}
+
+
+static int
+_icdb_flush_expect(struct icdb_context *icdb, int rtype)
+{
+  size_t n = icdb->npending;
+  redisReply *reps[ICDB_PIPELINE_CHUNK];
+
+  /* replies are collected in bounded chunks */
+  while (n > 0) {
+    size_t chunk = n < ICDB_PIPELINE_CHUNK ? n : ICDB_PIPELINE_CHUNK;
+    int rc = ICDB_SUCCESS;
+
+    icdb->npending = chunk;
+    rc = _icdb_flush(icdb, reps, chunk);
+    icdb->npending = n - chunk;
+
+    for (size_t i = 0; rc == ICDB_SUCCESS && i < chunk; i++) {
+      rc = _icdb_check_reply(icdb, reps[i], rtype);
+    }
+    _icdb_free_replies(reps, chunk);
+
+    if (rc == ICDB_EPROTO) {
+      icdb->npending = 0;
+      break;
+    }
+    n -= chunk;
+  }
+
+  return icdb->status;
+}
+
+
+static void
+_icdb_free_replies(redisReply **reps, size_t n)
+{
+  if (!reps)
+    return;
+
+  for (size_t i = 0; i < n; i++) {
+    if (reps[i]) {
+      freeReplyObject(reps[i]);
+      reps[i] = NULL;
+    }
+  }
+}
+
+
+static int
+_icdb_check_reply(struct icdb_context *icdb, const redisReply *rep, int rtype)
+{
+  if (!rep) {
+    ICDB_SET_STATUS(icdb, ICDB_EBADRESP, "Null DB response");
+    return ICDB_FAILURE;
+  } else if (rep->type == REDIS_REPLY_ERROR) {
+    ICDB_SET_STATUS(icdb, ICDB_EBADRESP, rep->str);
+    return ICDB_FAILURE;
+  } else if (rep->type != rtype) {
+    ICDB_SET_STATUS(icdb, ICDB_EBADRESP, "Expected Redis response type %d, got %d", rtype, rep->type);
+    return ICDB_FAILURE;
+  }
+  return ICDB_SUCCESS;
+}
+
+
+static int
+_icdb_lua_load(struct icdb_context *icdb)
+{
+  redisReply *rep;
+
+  icdb->lua_fcall = 0;
+
+  /* library already loaded, possibly by another context */
+  rep = _icdb_command(icdb, "FCALL icdb_version 0");
+  if (rep && rep->type == REDIS_REPLY_INTEGER && rep->integer == ICDB_LUA_VERSION) {
+    freeReplyObject(rep);
+    icdb->lua_fcall = 1;
+    return ICDB_SUCCESS;
+  }
+  if (rep)
+    freeReplyObject(rep);
+
+  rep = _icdb_command(icdb, "FUNCTION LOAD REPLACE %s", ICDB_LUA_LIBRARY);
+  if (rep && rep->type == REDIS_REPLY_STRING) {
+    freeReplyObject(rep);
+    icdb->lua_fcall = 1;
+    return ICDB_SUCCESS;
+  }
+  if (rep)
+    freeReplyObject(rep);
+
+  /* no Redis Functions, fallback to EVALSHA */
+  for (int i = 0; i < ICDB_LUA_FN_COUNT; i++) {
+    rep = _icdb_command(icdb, "SCRIPT LOAD %s", icdb_lua_fns[i].script);
+    if (_icdb_check_reply(icdb, rep, REDIS_REPLY_STRING) != ICDB_SUCCESS) {
+      if (rep)
+        freeReplyObject(rep);
+      return ICDB_FAILURE;
+    }
+    ICDB_GET_STR(icdb, rep, icdb->lua_sha[i], icdb_lua_fns[i].name, ICDB_LUA_SHA_LEN);
+    freeReplyObject(rep);
+    if (icdb->status != ICDB_SUCCESS)
+      return ICDB_FAILURE;
+  }
+
+  return ICDB_SUCCESS;
+}
+
+
+static int
+_icdb_lua_reload(struct icdb_context *icdb, redisReply **rep)
+{
+  redisReply *r = *rep;
+
+  if (!r || r->type != REDIS_REPLY_ERROR || !r->str)
+    return 0;
+
+  if (strncmp(r->str, "NOSCRIPT", 8) && !strstr(r->str, "Function not found"))
+    return 0;
+
+  freeReplyObject(r);
+  *rep = NULL;
+
+  return _icdb_lua_load(icdb) == ICDB_SUCCESS;
+}
+
+
 static int
 _icdb_get_str(const redisReply *rep, char *dest, size_t maxlen)
 {
@@ -1181,65 +2269,333 @@ _icdb_get_str(const redisReply *rep, char *dest, size_t maxlen)
   return ICDB_SUCCESS;
 }
 
+
 static int
-_icdb_get_strdup(const redisReply *rep, char **dest)
+_icdb_decode_field(struct icdb_context *icdb, const struct icdb_field *f,
+                   const redisReply *r, void *dest)
 {
-  if (!rep || !(rep->str)) {
-    return ICDB_EPARAM;
+  char *member = (char *)dest + f->offset;
+  uint64_t u;
+  int64_t i;
+  int rc;
+
+  switch (f->type) {
+  case ICDB_F_STR:
+    return _icdb_get_str(r, member, f->size);
+
+  case ICDB_F_ASTR:
+  case ICDB_F_DUP: {
+    if (!r || r->type != REDIS_REPLY_STRING || !r->str)
+      return ICDB_EPARAM;
+    char *str = f->type == ICDB_F_ASTR ?
+      _icdb_arena_strndup(icdb, r->str, r->len) : strndup(r->str, r->len);
+    if (!str)
+      return ICDB_ENOMEM;
+    if (f->type == ICDB_F_DUP) {
+      /* a field repeated in the reply, or a struct reused */
+      char *old;
+      memcpy(&old, member, sizeof(old));
+      free(old);
+    }
+    memcpy(member, &str, sizeof(str));
+    return ICDB_SUCCESS;
   }
 
-  if (rep->type != REDIS_REPLY_STRING) {
-    return ICDB_EPARAM;
+  case ICDB_F_UINT:
+    rc = _icdb_get_uint(r, f->size >= 8 ? UINT64_MAX : (UINT64_C(1) << (8 * f->size)) - 1, &u);
+    if (rc != ICDB_SUCCESS)
+      return rc;
+    switch (f->size) {
+    case 1: { uint8_t v = u; memcpy(member, &v, 1); break; }
+    case 2: { uint16_t v = u; memcpy(member, &v, 2); break; }
+    case 4: { uint32_t v = u; memcpy(member, &v, 4); break; }
+    default: memcpy(member, &u, 8);
+    }
+    return ICDB_SUCCESS;
+
+  case ICDB_F_INT:
+    if (f->size >= 8)
+      rc = _icdb_get_int(r, INT64_MIN, INT64_MAX, &i);
+    else
+      rc = _icdb_get_int(r, -(INT64_C(1) << (8 * f->size - 1)),
+                         (INT64_C(1) << (8 * f->size - 1)) - 1, &i);
+    if (rc != ICDB_SUCCESS)
+      return rc;
+    switch (f->size) {
+    case 1: { int8_t v = i; memcpy(member, &v, 1); break; }
+    case 2: { int16_t v = i; memcpy(member, &v, 2); break; }
+    case 4: { int32_t v = i; memcpy(member, &v, 4); break; }
+    default: memcpy(member, &i, 8);
+    }
+    return ICDB_SUCCESS;
+  }
+
+  return ICDB_FAILURE;
+}
+
+
+/* set the context status from the return code of _icdb_decode_field */
+static int
+_icdb_decode_status(struct icdb_context *icdb, int rc, const char *name)
+{
+  switch (rc) {
+  case ICDB_SUCCESS:
+    break;
+  case ICDB_E2BIG:
+    ICDB_SET_STATUS(icdb, ICDB_E2BIG, "Field %s too long", name);
+    break;
+  case ICDB_ENOMEM:
+    ICDB_SET_STATUS(icdb, ICDB_ENOMEM, "Out of memory for field %s", name);
+    break;
+  default:
+    ICDB_SET_STATUS(icdb, ICDB_EBADRESP, "Bad value for field %s", name);
   }
+  return rc == ICDB_SUCCESS ? ICDB_SUCCESS : icdb->status;
+}
+
 
-  *dest = strdup(rep->str);
-  if (!dest) {
-  	return ICDB_ENOMEM;
+static int
+_icdb_decode_hash(struct icdb_context *icdb, const redisReply *rep,
+                  const struct icdb_field *schema, size_t nfields, void *dest)
+{
+  if (!rep || rep->type != REDIS_REPLY_ARRAY || rep->elements % 2) {
+    ICDB_SET_STATUS(icdb, ICDB_EBADRESP, "Malformed hash response");
+    return ICDB_EBADRESP;
+  }
+
+  /* HGETALL returns all keys followed by their respective value */
+  for (size_t i = 0; i < rep->elements; i += 2) {
+    const redisReply *key = rep->element[i];
+    const struct icdb_field *f = NULL;
+
+    if (!key || key->type != REDIS_REPLY_STRING || !key->str) {
+      ICDB_SET_STATUS(icdb, ICDB_EBADRESP, "Malformed hash key");
+      return ICDB_EBADRESP;
+    }
+
+    for (size_t j = 0; j < nfields; j++) {
+      if (schema[j].namelen == key->len &&
+          !memcmp(schema[j].name, key->str, key->len)) {
+        f = &schema[j];
+        break;
+      }
+    }
+    if (!f)
+      continue;
+
+    int rc = _icdb_decode_field(icdb, f, rep->element[i + 1], dest);
+    if (rc != ICDB_SUCCESS)
+      return _icdb_decode_status(icdb, rc, f->name);
   }
 
   return ICDB_SUCCESS;
 }
 
+
 static int
-client_set(struct icdb_context *icdb, redisReply **rep, struct icdb_client *c)
+_icdb_decode_array(struct icdb_context *icdb, redisReply **reps,
+                   const struct icdb_field *schema, size_t nfields, void *dest)
 {
-  for (int i = 0; i < ICDB_CLIENT_NFIELDS; i++) {
-    redisReply *r = rep[i];
-    CHECK_REP_TYPE(icdb, r, REDIS_REPLY_STRING);
-    switch (i) {
-    case 0:
-      ICDB_GET_STR(icdb, r, c->clid, "clid", UUID_STR_LEN);
-      break;
-    case 1:
-      ICDB_GET_STR(icdb, r, c->type, "type", ICC_TYPE_LEN);
-      break;
-    case 2:
-      _icdb_get_str(r, c->addr, ICC_ADDR_LEN);
-      break;
-    case 3:
-      /* will fail if nodelist is too long */
-      ICDB_GET_STR(icdb, r, c->nodelist, "nodelist", ICDB_NODELIST_LEN);
-      break;
-    case 4:
-      ICDB_GET_UINT16(icdb, r, &c->provid,  "provid");
-      break;
-    case 5:
-      ICDB_GET_UINT32(icdb, r, &c->jobid, "jobid");
-      break;
-    case 6:
-      ICDB_GET_UINT64(icdb, r, &c->nprocs, "nprocs");
-      break;
-    case 7:
-      ICDB_GET_INT32(icdb, r, &c->reconfig_nprocs, "reconfig_ncpus");
+  for (size_t i = 0; i < nfields; i++) {
+    if (!reps[i] || reps[i]->type == REDIS_REPLY_NIL)
+      continue;
+
+    int rc = _icdb_decode_field(icdb, &schema[i], reps[i], dest);
+    if (rc != ICDB_SUCCESS)
+      return _icdb_decode_status(icdb, rc, schema[i].name);
+  }
+
+  return ICDB_SUCCESS;
+}
+
+
+static char *
+_icdb_arena_strndup(struct icdb_context *icdb, const char *s, size_t len)
+{
+  if (!icdb->arena && !(icdb->arena = arena_create(0)))
+    return NULL;
+
+  return arena_strndup(icdb->arena, s, len);
+}
+
+
+static int
+_icdb_get_uint(const redisReply *rep, uint64_t max, uint64_t *dest)
+{
+  if (!rep || rep->type != REDIS_REPLY_STRING || !rep->str || !dest)
+    return ICDB_EPARAM;
+
+  char *end;
+  errno = 0;
+  unsigned long long v = strtoull(rep->str, &end, 10);
+  if (errno || end == rep->str || *end != '\0' || rep->str[0] == '-' || v > max)
+    return ICDB_EBADRESP;
+
+  *dest = v;
+  return ICDB_SUCCESS;
+}
+
+
+static int
+_icdb_get_int(const redisReply *rep, int64_t min, int64_t max, int64_t *dest)
+{
+  if (!rep || rep->type != REDIS_REPLY_STRING || !rep->str || !dest)
+    return ICDB_EPARAM;
+
+  char *end;
+  errno = 0;
+  long long v = strtoll(rep->str, &end, 10);
+  if (errno || end == rep->str || *end != '\0' || v < min || v > max)
+    return ICDB_EBADRESP;
+
+  *dest = v;
+  return ICDB_SUCCESS;
+}
+
+
+static int
+_icdb_scan_clients(struct icdb_context *icdb,
+                   const struct icdb_client_filter *filter,
+                   uint64_t *cursor, size_t batch_size,
+                   icdb_client_cb cb, void *arg, int *stop)
+{
+  uint32_t jobid = filter ? filter->jobid : 0;
+  const char *type = filter && filter->type && filter->type[0] ? filter->type : NULL;
+  unsigned long count = batch_size ? batch_size : ICDB_SCAN_BATCH;
+  redisReply *rep, **reps = NULL;
+  size_t n = 0;
+  uint64_t next;
+
+  /* with both filters, scan the job index and check the type of
+     the clients, there are few clients per job */
+  ICDB_LOCK(icdb);
+  if (jobid) {
+    rep = redisCommand(icdb->redisctx, "SSCAN index:clients:jobid:%"PRIu32" %"PRIu64" COUNT %lu",
+                       jobid, *cursor, count);
+  } else if (type) {
+    rep = redisCommand(icdb->redisctx, "SSCAN index:clients:type:%s %"PRIu64" COUNT %lu",
+                       type, *cursor, count);
+  } else {
+    rep = redisCommand(icdb->redisctx, "SSCAN index:clients %"PRIu64" COUNT %lu",
+                       *cursor, count);
+  }
+
+  /* SSCAN returns the cursor + an array of elements */
+  if (_icdb_check_reply(icdb, rep, REDIS_REPLY_ARRAY) != ICDB_SUCCESS)
+    goto unlock;
+  if (rep->elements != 2 ||
+      _icdb_check_reply(icdb, rep->element[0], REDIS_REPLY_STRING) != ICDB_SUCCESS ||
+      _icdb_check_reply(icdb, rep->element[1], REDIS_REPLY_ARRAY) != ICDB_SUCCESS) {
+    ICDB_SET_STATUS(icdb, ICDB_EBADRESP, "Malformed SSCAN response");
+    goto unlock;
+  }
+  if (_icdb_get_uint(rep->element[0], UINT64_MAX, &next) != ICDB_SUCCESS) {
+    ICDB_SET_STATUS(icdb, ICDB_EBADRESP, "Bad SSCAN cursor");
+    goto unlock;
+  }
+
+  n = rep->element[1]->elements;
+  if (n > 0) {
+    reps = calloc(n, sizeof(*reps));
+    if (!reps) {
+      ICDB_SET_STATUS(icdb, ICDB_ENOMEM, "Out of memory");
+      goto unlock;
+    }
+    for (size_t i = 0; i < n; i++) {
+      _icdb_append(icdb, "HGETALL client:%s", rep->element[1]->element[i]->str);
+    }
+    _icdb_flush(icdb, reps, n);
+  }
+
+ unlock:
+  ICDB_UNLOCK(icdb);
+
+  /* the callback may use the context, it runs without the lock */
+  if (icdb->status == ICDB_SUCCESS) {
+    *cursor = next;
+
+    for (size_t i = 0; i < n; i++) {
+      struct icdb_client client;
+
+      if (_icdb_check_reply(icdb, reps[i], REDIS_REPLY_ARRAY) != ICDB_SUCCESS)
+        break;
+      if (reps[i]->elements == 0)     /* deleted since the scan */
+        continue;
+      memset(&client, 0, sizeof(client));
+      if (_icdb_decode_hash(icdb, reps[i], client_schema,
+                            ICDB_NFIELDS(client_schema), &client) != ICDB_SUCCESS)
+        break;
+      if (type && strncmp(client.type, type, ICC_TYPE_LEN))
+        continue;
+      if (cb(&client, arg)) {
+        *stop = 1;
+        break;
+      }
+    }
+  }
+
+  _icdb_free_replies(reps, n);
+  free(reps);
+  if (rep)
+    freeReplyObject(rep);
+
+  return icdb->status;
+}
+
+
+static int
+_icdb_monitor_lookup(struct icdb_context *icdb, const char *clid, char **key)
+{
+  uint64_t cursor = 0;
+  redisReply *rep;
+
+  *key = NULL;
+
+  do {
+    rep = redisCommand(icdb->redisctx, "SCAN %"PRIu64" MATCH monitorFlexMPI:%s:*:current COUNT 1000",
+                       cursor, clid);
+    if (_icdb_check_reply(icdb, rep, REDIS_REPLY_ARRAY) != ICDB_SUCCESS)
       break;
-    case 8:
-      ICDB_GET_INT32(icdb, r, &c->reconfig_nnodes, "reconfig_nnodes");
+    if (rep->elements != 2 ||
+        _icdb_get_uint(rep->element[0], UINT64_MAX, &cursor) != ICDB_SUCCESS ||
+        rep->element[1]->type != REDIS_REPLY_ARRAY) {
+      ICDB_SET_STATUS(icdb, ICDB_EBADRESP, "Malformed SCAN response");
       break;
     }
-    /* immediately stop processing if one field is in error */
-    if (icdb->status != ICDB_SUCCESS) {
-      return ICDB_FAILURE;
+    for (size_t i = 0; i < rep->element[1]->elements; i++) {
+      if (*key) {
+        ICDB_SET_STATUS(icdb, ICDB_EBADRESP, "monitorFlexMPI:%s:*:current is not a single entry", clid);
+        break;
+      }
+      *key = strdup(rep->element[1]->element[i]->str);
+      if (!*key) {
+        ICDB_SET_STATUS(icdb, ICDB_ENOMEM, "Out of memory");
+        break;
+      }
     }
+    freeReplyObject(rep);
+    rep = NULL;
+  } while (icdb->status == ICDB_SUCCESS && cursor != 0);
+
+  if (rep)
+    freeReplyObject(rep);
+
+  if (icdb->status == ICDB_SUCCESS && !*key) {
+    ICDB_SET_STATUS(icdb, ICDB_NORESULT, "No monitor data for client %s", clid);
   }
-  return ICDB_SUCCESS;
+
+  /* index the key for the next calls */
+  if (icdb->status == ICDB_SUCCESS) {
+    rep = redisCommand(icdb->redisctx, "SET index:monitorFlexMPI:%s %s", clid, *key);
+    _icdb_check_reply(icdb, rep, REDIS_REPLY_STATUS);
+    if (rep)
+      freeReplyObject(rep);
+  }
+
+  if (icdb->status != ICDB_SUCCESS) {
+    free(*key);
+    *key = NULL;
+  }
+
+  return icdb->status;
 }
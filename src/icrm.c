@@ -18,6 +18,7 @@
 #include "hashmap.h"
 #include "icc_common.h"
 #include "icrm.h"
+#include "icstats.h"
 
 // CHANGE JAVI
 #define CWD_MAX_SIZE 10240             /* buffer size for storing CWD */
@@ -63,14 +64,14 @@ static icrmerr_t icrm_load_job_internal(uint32_t jobid, job_info_msg_t **job,
 /**
  * Return a hashmap with host:ncpus pairs. Uses the Slurm values HOSTS
  * (node_list), NCPUS (cpus_per_node) and the REPS CPUs repetition
- * count (cpus_count_reps).
+ * count (cpus_count_reps) of the NGROUPS groups (num_cpu_groups).
  *
  * Return a pointer to the hashmap or NULL in case of memory error.
  *
  * The caller is responsible for freeing the hashmap.
  */
 static hm_t *get_hostmap_internal(const char *hosts, uint16_t ncpus[],
-                                  uint32_t reps[]);
+                                  uint32_t reps[], uint32_t ngroups);
 
 /**
  * Translate the Slurm job state SLURM_STATE to an icrm_jobstate.
@@ -100,6 +101,7 @@ icrmerr_t
 icrm_jobstate(uint32_t jobid, enum icrm_jobstate *jobstate,
               char errstr[ICC_ERRSTR_LEN])
 {
+  ICSTATS_SCOPE("icrm", __func__);
   CHECK_NULL(jobstate);
 
   icrmerr_t rc;
@@ -123,6 +125,7 @@ icrmerr_t
 icrm_info(uint32_t jobid, uint32_t *ncpus, uint32_t *nnodes, char **nodelist,
           char errstr[ICC_ERRSTR_LEN])
 {
+  ICSTATS_SCOPE("icrm", __func__);
   CHECK_NULL(ncpus);
   CHECK_NULL(nnodes);
 
@@ -194,6 +197,7 @@ icrmerr_t
 icrm_alloc(uint32_t *newjobid, uint32_t *ncpus, uint32_t *nnodes, hm_t **hostmap, char errstr[ICC_ERRSTR_LEN])
 // END CHANGE JAVI
 {
+  ICSTATS_SCOPE("icrm", __func__);
   icrmerr_t rc;
   //int sret;
   //unsigned int wait;
@@ -260,7 +264,7 @@ icrm_alloc(uint32_t *newjobid, uint32_t *ncpus, uint32_t *nnodes, hm_t **hostmap
   }
 
   *hostmap = get_hostmap_internal(resp->node_list, resp->cpus_per_node,
-                                  resp->cpu_count_reps);
+                                  resp->cpu_count_reps, resp->num_cpu_groups);
   if (*hostmap == NULL) {
     WRITERR(errstr, "Out of memory");
     rc = ICRM_ENOMEM;
@@ -334,6 +338,7 @@ icrm_alloc(uint32_t *newjobid, uint32_t *ncpus, uint32_t *nnodes, hm_t **hostmap
 icrmerr_t
 icrm_merge(uint32_t jobid, char errstr[ICC_ERRSTR_LEN])
 {
+  ICSTATS_SCOPE("icrm", __func__);
   icrmerr_t rc = ICRM_SUCCESS;
 
   job_array_resp_msg_t *resp = NULL;
@@ -374,6 +379,7 @@ icrmerr_t
 icrm_get_job_hostmap(uint32_t jobid, hm_t **hostmap,
                      char errstr[ICC_ERRSTR_LEN])
 {
+    ICSTATS_SCOPE("icrm", __func__);
     assert(jobid);
     
     icrmerr_t ret = ICRM_SUCCESS;
@@ -387,7 +393,8 @@ icrm_get_job_hostmap(uint32_t jobid, hm_t **hostmap,
     
     (*hostmap) = get_hostmap_internal(allocinfo->node_list,
                                       allocinfo->cpus_per_node,
-                                      allocinfo->cpu_count_reps);
+                                      allocinfo->cpu_count_reps,
+                                      allocinfo->num_cpu_groups);
 
     fprintf(stderr, "GET JOB HOSTMAP: nodelist = %s cpuspernode = %d cpucountreps = %d\n", allocinfo->node_list, allocinfo->cpus_per_node[0], allocinfo->cpu_count_reps[0]);
     
@@ -404,12 +411,27 @@ icrmerr_t
 icrm_release_node(const char *nodename, uint32_t jobid, uint32_t ncpus,
                   char errstr[ICC_ERRSTR_LEN])
 {
+  icrmerr_t noderet;
+  icrmerr_t ret = icrm_release_nodes(jobid, 1, &nodename, &ncpus, &noderet, errstr);
+
+  return ret == ICRM_SUCCESS ? noderet : ret;
+}
+
+
+icrmerr_t
+icrm_release_nodes(uint32_t jobid, size_t n, const char *nodenames[], const uint32_t ncpus[],
+                   icrmerr_t noderets[], char errstr[ICC_ERRSTR_LEN])
+{
+  ICSTATS_SCOPE("icrm", __func__);
   assert(jobid);
-  assert(nodename);
-  assert(ncpus > 0);
+  assert(nodenames);
+  assert(ncpus);
+  assert(noderets);
 
   icrmerr_t ret = ICRM_SUCCESS;
   resource_allocation_response_msg_t *allocinfo = NULL;
+  char *newlist = NULL;
+  size_t nreleased = 0;
 
   int sret = slurm_allocation_lookup(jobid, &allocinfo);
   if (sret != SLURM_SUCCESS) {
@@ -419,7 +441,8 @@ icrm_release_node(const char *nodename, uint32_t jobid, uint32_t ncpus,
 
   hm_t *hostmap = get_hostmap_internal(allocinfo->node_list,
                                        allocinfo->cpus_per_node,
-                                       allocinfo->cpu_count_reps);
+                                       allocinfo->cpu_count_reps,
+                                       allocinfo->num_cpu_groups);
 
   slurm_free_resource_allocation_response_msg(allocinfo);
 
@@ -427,34 +450,37 @@ icrm_release_node(const char *nodename, uint32_t jobid, uint32_t ncpus,
     return ICRM_ENOMEM;
   }
 
-  const uint16_t *nalloced = hm_get(hostmap, nodename);
-  if (!nalloced || *nalloced != ncpus) {
-    WRITERR(errstr, "Cannot release node %s:%"PRIu16", %"PRIu16" CPUs allocated",
-            nodename, ncpus, nalloced ? *nalloced : 0);
-    if (*nalloced > ncpus) {
-      ret = ICRM_EAGAIN;
-    } else {
-      ret = ICRM_FAILURE;
-    }
+  /* remove the nodes whose CPUs are all released */
+  for (size_t i = 0; i < n; i++) {
+    const uint16_t *nalloced = hm_get(hostmap, nodenames[i]);
 
-    hm_free(hostmap);
-    return ret;
-  }
+    assert(nodenames[i]);
+    assert(ncpus[i] > 0);
 
-  /* generate new hostlist with the node removed */
-  uint16_t nocpus = 0;
-  int rc = hm_set(hostmap, nodename, &nocpus, sizeof(nocpus));
-  if (rc == -1) {
-    hm_free(hostmap);
-    return ICRM_ENOMEM;
-  }
+    if (!nalloced || *nalloced != ncpus[i]) {
+      WRITERR(errstr, "Cannot release node %s:%"PRIu32", %"PRIu16" CPUs allocated",
+              nodenames[i], ncpus[i], nalloced ? *nalloced : 0);
+      noderets[i] = nalloced && *nalloced > ncpus[i] ? ICRM_EAGAIN : ICRM_FAILURE;
+      continue;
+    }
 
-  char *newlist = icrm_hostlist(hostmap, 0, NULL);
+    uint16_t nocpus = 0;
+    if (hm_set(hostmap, nodenames[i], &nocpus, sizeof(nocpus)) == -1) {
+      ret = ICRM_ENOMEM;
+      goto end;
+    }
+    noderets[i] = ICRM_SUCCESS;
+    nreleased++;
+  }
 
-  hm_free(hostmap);
+  if (nreleased == 0)
+    goto end;
 
-  if(!newlist) {
-    return ICRM_ENOMEM;
+  /* generate new hostlist with the nodes removed */
+  newlist = icrm_hostlist(hostmap, 0, NULL);
+  if (!newlist) {
+    ret = ICRM_ENOMEM;
+    goto end;
   }
 
   // CHANGE JAVI
@@ -485,7 +511,7 @@ icrm_release_node(const char *nodename, uint32_t jobid, uint32_t ncpus,
     char *ptr_ret = getcwd(buffer_cwd, CWD_MAX_SIZE);
     if (ptr_ret == NULL) {
       WRITERR(errstr, "getcwd: %s",strerror(errno));
-      rc = ICRM_ENOMEM;
+      ret = ICRM_ENOMEM;
       goto end;
     }
     jobreq.work_dir=buffer_cwd;
@@ -498,17 +524,14 @@ icrm_release_node(const char *nodename, uint32_t jobid, uint32_t ncpus,
       goto end;
     } else if (jobresp) {
       slurm_free_job_array_resp(jobresp);
-      ret = ICRM_SUCCESS;
     }
   // CHANGE JAVI
   }
   // END CHANGE JAVI
 
-    
 end:
-  if (newlist) {
-    free(newlist);
-  }
+  hm_free(hostmap);
+  free(newlist);
   return ret;
 }
 
@@ -698,7 +721,7 @@ icrm_load_job_internal(uint32_t jobid, job_info_msg_t **job,
 
 static hm_t *
 get_hostmap_internal(const char *hostlist, uint16_t cpus_per_node[],
-                     uint32_t cpus_count_reps[])
+                     uint32_t cpus_count_reps[], uint32_t ngroups)
 {
   assert(hostlist);
   assert(cpus_per_node);
@@ -727,14 +750,13 @@ get_hostmap_internal(const char *hostlist, uint16_t cpus_per_node[],
      repeated cpus_count_reps[i] time */
 
   icpu = 0;
-  reps = cpus_count_reps[icpu];
+  reps = ngroups > 0 ? cpus_count_reps[icpu] : 0;
 
   char *host;
-  while ((host = slurm_hostlist_shift(hl))) {
+  while (icpu < ngroups && (host = slurm_hostlist_shift(hl))) {
     ncpus = cpus_per_node[icpu];
     reps--;
-    if (reps == 0) {
-      icpu++;
+    if (reps == 0 && ++icpu < ngroups) {
       reps = cpus_count_reps[icpu]; // JAVI ADDED
     }
     fprintf(stderr, "get_hostmap_internal: insert %s:%d", host, ncpus);
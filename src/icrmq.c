@@ -0,0 +1,365 @@
+#include <stdlib.h>             /* calloc */
+#include <string.h>             /* strdup */
+#include <abt.h>
+
+#include "icrmq.h"
+#include "icstats.h"
+
+enum icrmq_type {
+  ICRMQ_ALLOC,
+  ICRMQ_RELEASE,
+};
+
+struct icrmq_req {
+  enum icrmq_type  type;
+  uint32_t         jobid;       /* release */
+  uint32_t         ncpus;
+  uint32_t         nnodes;      /* alloc */
+  char             *nodename;   /* release */
+  ABT_eventual     ev;
+  struct icrmq_req *next;
+};
+
+struct icrmq_worker {
+  struct icrmq     *queue;
+  ABT_thread       thread;
+  uint32_t         busyjob;     /* whose nodes it releases, or 0 */
+};
+
+struct icrmq {
+  ABT_mutex        lock;
+  ABT_cond         cond;        /* a request can be served, or terminate */
+  struct icrmq_req *head;
+  struct icrmq_req *tail;
+  size_t           len;
+  int              terminate;
+
+  unsigned         nworkers;
+  struct icrmq_worker *workers;
+
+  struct icstats_gauge *pending;
+};
+
+static void worker_th(void *arg);
+
+
+icrmerr_t
+icrmq_init(struct icrmq **queue, ABT_pool pool, unsigned nworkers)
+{
+  struct icrmq *q;
+  int rc;
+
+  *queue = NULL;
+
+  if (nworkers == 0)
+    return ICRM_EPARAM;
+
+  q = calloc(1, sizeof(*q));
+  if (!q)
+    return ICRM_ENOMEM;
+
+  q->lock = ABT_MUTEX_NULL;
+  q->cond = ABT_COND_NULL;
+  q->pending = icstats_gauge("queue", "icrm");
+
+  q->workers = calloc(nworkers, sizeof(*q->workers));
+  if (!q->workers) {
+    icrmq_fini(&q);
+    return ICRM_ENOMEM;
+  }
+
+  if (ABT_mutex_create(&q->lock) != ABT_SUCCESS ||
+      ABT_cond_create(&q->cond) != ABT_SUCCESS) {
+    icrmq_fini(&q);
+    return ICRM_FAILURE;
+  }
+
+  for (unsigned i = 0; i < nworkers; i++) {
+    struct icrmq_worker *w = &q->workers[i];
+    w->queue = q;
+    rc = ABT_thread_create(pool, worker_th, w, ABT_THREAD_ATTR_NULL, &w->thread);
+    if (rc != ABT_SUCCESS) {
+      icrmq_fini(&q);
+      return ICRM_FAILURE;
+    }
+    q->nworkers++;
+  }
+
+  *queue = q;
+  return ICRM_SUCCESS;
+}
+
+
+void
+icrmq_fini(struct icrmq **queue)
+{
+  if (!queue || !*queue)
+    return;
+
+  struct icrmq *q = *queue;
+
+  if (q->lock != ABT_MUTEX_NULL) {
+    ABT_mutex_lock(q->lock);
+    q->terminate = 1;
+    ABT_cond_broadcast(q->cond);
+    ABT_mutex_unlock(q->lock);
+  }
+
+  /* the workers leave once the queue is empty */
+  for (unsigned i = 0; i < q->nworkers; i++) {
+    ABT_thread_join(q->workers[i].thread);
+    ABT_thread_free(&q->workers[i].thread);
+  }
+
+  if (q->cond != ABT_COND_NULL)
+    ABT_cond_free(&q->cond);
+  if (q->lock != ABT_MUTEX_NULL)
+    ABT_mutex_free(&q->lock);
+
+  free(q->workers);
+  free(q);
+
+  *queue = NULL;
+}
+
+
+static icrmerr_t
+submit(struct icrmq *q, struct icrmq_req *r, ABT_eventual *ev)
+{
+  *ev = ABT_EVENTUAL_NULL;
+
+  if (ABT_eventual_create(sizeof(struct icrmq_result), &r->ev) != ABT_SUCCESS) {
+    free(r->nodename);
+    free(r);
+    return ICRM_FAILURE;
+  }
+
+  ABT_mutex_lock(q->lock);
+
+  if (q->terminate || q->len == ICRMQ_LEN) {
+    icrmerr_t rc = q->terminate ? ICRM_FAILURE : ICRM_EAGAIN;
+    ABT_mutex_unlock(q->lock);
+    ABT_eventual_free(&r->ev);
+    free(r->nodename);
+    free(r);
+    return rc;
+  }
+
+  r->next = NULL;
+  if (q->tail)
+    q->tail->next = r;
+  else
+    q->head = r;
+  q->tail = r;
+  q->len++;
+
+  *ev = r->ev;
+
+  ABT_cond_broadcast(q->cond);
+  ABT_mutex_unlock(q->lock);
+
+  icstats_gauge_add(q->pending, 1);
+
+  return ICRM_SUCCESS;
+}
+
+icrmerr_t
+icrmq_submit_alloc(struct icrmq *q, uint32_t ncpus, uint32_t nnodes, ABT_eventual *ev)
+{
+  struct icrmq_req *r = calloc(1, sizeof(*r));
+  if (!r)
+    return ICRM_ENOMEM;
+
+  r->type = ICRMQ_ALLOC;
+  r->ncpus = ncpus;
+  r->nnodes = nnodes;
+
+  return submit(q, r, ev);
+}
+
+icrmerr_t
+icrmq_submit_release(struct icrmq *q, const char *nodename, uint32_t jobid,
+                     uint32_t ncpus, ABT_eventual *ev)
+{
+  if (!nodename || jobid == 0 || ncpus == 0)
+    return ICRM_EPARAM;
+
+  struct icrmq_req *r = calloc(1, sizeof(*r));
+  if (!r)
+    return ICRM_ENOMEM;
+
+  r->type = ICRMQ_RELEASE;
+  r->jobid = jobid;
+  r->ncpus = ncpus;
+  r->nodename = strdup(nodename);
+  if (!r->nodename) {
+    free(r);
+    return ICRM_ENOMEM;
+  }
+
+  return submit(q, r, ev);
+}
+
+
+icrmerr_t
+icrmq_wait(ABT_eventual *ev, struct icrmq_result *result)
+{
+  struct icrmq_result *res;
+
+  if (*ev == ABT_EVENTUAL_NULL)
+    return ICRM_EPARAM;
+
+  ABT_eventual_wait(*ev, (void **)&res);
+  *result = *res;
+  ABT_eventual_free(ev);
+
+  return result->rc;
+}
+
+
+/**
+ * Whether a worker is releasing nodes of JOBID. Two updates of the
+ * same job must not interleave, the second would give back the nodes
+ * the first removed.
+ */
+static int
+job_busy(const struct icrmq *q, uint32_t jobid)
+{
+  for (unsigned i = 0; i < q->nworkers; i++) {
+    if (q->workers[i].busyjob == jobid)
+      return 1;
+  }
+  return 0;
+}
+
+static void
+unlink_req(struct icrmq *q, struct icrmq_req *prev, struct icrmq_req *r)
+{
+  if (prev)
+    prev->next = r->next;
+  else
+    q->head = r->next;
+  if (q->tail == r)
+    q->tail = prev;
+  r->next = NULL;
+  q->len--;
+}
+
+/**
+ * Take the oldest request that can be served for worker W, and the
+ * releases of the same job queued after it, up to ICRMQ_COALESCE, in
+ * BATCH. Called with the lock held.
+ *
+ * Return the number of requests taken, 0 if none can be served.
+ */
+static size_t
+take(struct icrmq *q, struct icrmq_worker *w, struct icrmq_req *batch[ICRMQ_COALESCE])
+{
+  struct icrmq_req *prev = NULL, *r;
+  size_t n = 0;
+
+  for (r = q->head; r; prev = r, r = r->next) {
+    if (r->type == ICRMQ_ALLOC || !job_busy(q, r->jobid))
+      break;
+  }
+  if (!r)
+    return 0;
+
+  unlink_req(q, prev, r);
+  batch[n++] = r;
+
+  if (r->type != ICRMQ_RELEASE)
+    return n;
+
+  uint32_t jobid = r->jobid;
+  w->busyjob = jobid;
+
+  for (prev = NULL, r = q->head; r && n < ICRMQ_COALESCE; ) {
+    struct icrmq_req *next = r->next;
+    if (r->type == ICRMQ_RELEASE && r->jobid == jobid) {
+      unlink_req(q, prev, r);
+      batch[n++] = r;
+    } else {
+      prev = r;
+    }
+    r = next;
+  }
+
+  return n;
+}
+
+
+static void
+complete(struct icrmq_req *r, const struct icrmq_result *res)
+{
+  ABT_eventual_set(r->ev, (void *)res, sizeof(*res));
+  free(r->nodename);
+  free(r);
+}
+
+static void
+serve_alloc(struct icrmq_req *r)
+{
+  struct icrmq_result res = { 0 };
+
+  res.ncpus = r->ncpus;
+  res.nnodes = r->nnodes;
+  res.rc = icrm_alloc(&res.jobid, &res.ncpus, &res.nnodes, &res.hostmap, res.errstr);
+
+  complete(r, &res);
+}
+
+static void
+serve_release(struct icrmq_req *batch[], size_t n)
+{
+  const char *nodenames[ICRMQ_COALESCE];
+  uint32_t ncpus[ICRMQ_COALESCE];
+  icrmerr_t noderets[ICRMQ_COALESCE];
+  struct icrmq_result res = { 0 };
+  icrmerr_t rc;
+
+  for (size_t i = 0; i < n; i++) {
+    nodenames[i] = batch[i]->nodename;
+    ncpus[i] = batch[i]->ncpus;
+  }
+
+  rc = icrm_release_nodes(batch[0]->jobid, n, nodenames, ncpus, noderets, res.errstr);
+
+  for (size_t i = 0; i < n; i++) {
+    res.rc = rc == ICRM_SUCCESS ? noderets[i] : rc;
+    complete(batch[i], &res);
+  }
+}
+
+static void
+worker_th(void *arg)
+{
+  struct icrmq_worker *w = arg;
+  struct icrmq *q = w->queue;
+  struct icrmq_req *batch[ICRMQ_COALESCE];
+  size_t n;
+
+  for (;;) {
+    ABT_mutex_lock(q->lock);
+    while ((n = take(q, w, batch)) == 0 && !(q->terminate && !q->head))
+      ABT_cond_wait(q->cond, q->lock);
+    ABT_mutex_unlock(q->lock);
+
+    if (n == 0)                 /* terminating and drained */
+      break;
+
+    icstats_gauge_add(q->pending, -(int64_t)n);
+
+    if (batch[0]->type == ICRMQ_ALLOC) {
+      serve_alloc(batch[0]);
+    } else {
+      serve_release(batch, n);
+
+      /* the releases of the job may go on with another worker */
+      ABT_mutex_lock(q->lock);
+      w->busyjob = 0;
+      ABT_cond_broadcast(q->cond);
+      ABT_mutex_unlock(q->lock);
+    }
+  }
+}
@@ -0,0 +1,559 @@
+#define _GNU_SOURCE             /* for accept4 */
+#include <errno.h>
+#include <inttypes.h>           /* PRIuXX */
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>              /* open_memstream, rename */
+#include <stdlib.h>             /* calloc */
+#include <string.h>             /* strcmp, strdup */
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>             /* pipe, close, unlink */
+
+#include "icstats.h"
+
+/* histograms and gauges are never freed, past that number they are
+   not created */
+#define ICSTATS_MAX 512
+
+/* first power of two exported as a Prometheus bucket, about 1us */
+#define ICSTATS_PROM_MIN_BITS 10
+
+static pthread_mutex_t reglock = PTHREAD_MUTEX_INITIALIZER;
+static struct icstats_hist *hists[ICSTATS_MAX];
+static size_t nhists;
+static struct icstats_gauge *gauges[ICSTATS_MAX];
+static size_t ngauges;
+
+struct exporter {
+  pthread_t  thread;
+  int        running;
+  int        wakefd[2];       /* self-pipe to stop the thread */
+  int        sock;            /* listening socket or -1 */
+  char      *sockpath;
+  char      *file;
+  unsigned   interval;
+};
+
+static struct exporter exporter = { .running = 0 };
+
+static unsigned bucket_index(uint64_t v);
+static uint64_t bucket_low(unsigned i);
+static uint64_t bucket_width(unsigned i);
+static void *export_th(void *arg);
+static int export_file(const char *file);
+static void export_conn(int fd);
+
+
+struct icstats_hist *
+icstats_hist(const char *family, const char *name)
+{
+  struct icstats_hist *h = NULL;
+
+  pthread_mutex_lock(&reglock);
+
+  for (size_t i = 0; i < nhists; i++) {
+    if (!strcmp(hists[i]->family, family) && !strcmp(hists[i]->name, name)) {
+      h = hists[i];
+      goto end;
+    }
+  }
+
+  if (nhists == ICSTATS_MAX)
+    goto end;
+
+  h = calloc(1, sizeof(*h));
+  if (!h)
+    goto end;
+  h->family = strdup(family);
+  h->name = strdup(name);
+  if (!h->family || !h->name) {
+    free((char *)h->family);
+    free((char *)h->name);
+    free(h);
+    h = NULL;
+    goto end;
+  }
+
+  hists[nhists] = h;
+  __atomic_store_n(&nhists, nhists + 1, __ATOMIC_RELEASE);
+
+ end:
+  pthread_mutex_unlock(&reglock);
+  return h;
+}
+
+
+struct icstats_gauge *
+icstats_gauge(const char *family, const char *name)
+{
+  struct icstats_gauge *g = NULL;
+
+  pthread_mutex_lock(&reglock);
+
+  for (size_t i = 0; i < ngauges; i++) {
+    if (!strcmp(gauges[i]->family, family) && !strcmp(gauges[i]->name, name)) {
+      g = gauges[i];
+      goto end;
+    }
+  }
+
+  if (ngauges == ICSTATS_MAX)
+    goto end;
+
+  g = calloc(1, sizeof(*g));
+  if (!g)
+    goto end;
+  g->family = strdup(family);
+  g->name = strdup(name);
+  if (!g->family || !g->name) {
+    free((char *)g->family);
+    free((char *)g->name);
+    free(g);
+    g = NULL;
+    goto end;
+  }
+
+  gauges[ngauges] = g;
+  __atomic_store_n(&ngauges, ngauges + 1, __ATOMIC_RELEASE);
+
+ end:
+  pthread_mutex_unlock(&reglock);
+  return g;
+}
+
+
+void
+icstats_record(struct icstats_hist *hist, uint64_t ns)
+{
+  if (!hist)
+    return;
+
+  __atomic_fetch_add(&hist->buckets[bucket_index(ns)], 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&hist->count, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&hist->sum, ns, __ATOMIC_RELAXED);
+
+  uint64_t max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+  while (ns > max &&
+         !__atomic_compare_exchange_n(&hist->max, &max, ns, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+
+void
+icstats_gauge_add(struct icstats_gauge *gauge, int64_t delta)
+{
+  if (!gauge)
+    return;
+
+  int64_t value = __atomic_add_fetch(&gauge->value, delta, __ATOMIC_RELAXED);
+
+  int64_t max = __atomic_load_n(&gauge->max, __ATOMIC_RELAXED);
+  while (value > max &&
+         !__atomic_compare_exchange_n(&gauge->max, &max, value, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+
+uint64_t
+icstats_quantile(const struct icstats_hist *hist, double q)
+{
+  uint64_t total = 0, rank, n = 0;
+
+  if (!hist)
+    return 0;
+
+  /* the buckets rather than the count, which may be ahead of them */
+  for (unsigned i = 0; i < ICSTATS_NBUCKETS; i++)
+    total += __atomic_load_n(&hist->buckets[i], __ATOMIC_RELAXED);
+  if (total == 0)
+    return 0;
+
+  rank = (uint64_t)(q * total + 0.5);
+  if (rank < 1)
+    rank = 1;
+  if (rank > total)
+    rank = total;
+
+  uint64_t max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+
+  for (unsigned i = 0; i < ICSTATS_NBUCKETS; i++) {
+    n += __atomic_load_n(&hist->buckets[i], __ATOMIC_RELAXED);
+    if (n >= rank) {
+      uint64_t v = bucket_low(i) + bucket_width(i) / 2;
+      return v < max ? v : max;
+    }
+  }
+  return max;
+}
+
+
+void
+icstats_reset(void)
+{
+  size_t nh = __atomic_load_n(&nhists, __ATOMIC_ACQUIRE);
+  size_t ng = __atomic_load_n(&ngauges, __ATOMIC_ACQUIRE);
+
+  for (size_t i = 0; i < nh; i++) {
+    struct icstats_hist *h = hists[i];
+    for (unsigned j = 0; j < ICSTATS_NBUCKETS; j++)
+      __atomic_store_n(&h->buckets[j], 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&h->count, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&h->sum, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&h->max, 0, __ATOMIC_RELAXED);
+  }
+
+  for (size_t i = 0; i < ng; i++) {
+    struct icstats_gauge *g = gauges[i];
+    __atomic_store_n(&g->max, __atomic_load_n(&g->value, __ATOMIC_RELAXED),
+                     __ATOMIC_RELAXED);
+  }
+}
+
+
+int
+icstats_summary(char **text)
+{
+  size_t nh = __atomic_load_n(&nhists, __ATOMIC_ACQUIRE);
+  size_t ng = __atomic_load_n(&ngauges, __ATOMIC_ACQUIRE);
+  size_t len;
+  FILE *f;
+
+  *text = NULL;
+
+  f = open_memstream(text, &len);
+  if (!f)
+    return -1;
+
+  for (size_t i = 0; i < nh; i++) {
+    const struct icstats_hist *h = hists[i];
+    fprintf(f, "hist %s %s %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64
+            " %"PRIu64" %"PRIu64"\n", h->family, h->name,
+            __atomic_load_n(&h->count, __ATOMIC_RELAXED),
+            __atomic_load_n(&h->sum, __ATOMIC_RELAXED),
+            __atomic_load_n(&h->max, __ATOMIC_RELAXED),
+            icstats_quantile(h, 0.5), icstats_quantile(h, 0.9),
+            icstats_quantile(h, 0.99), icstats_quantile(h, 0.999));
+  }
+
+  for (size_t i = 0; i < ng; i++) {
+    const struct icstats_gauge *g = gauges[i];
+    fprintf(f, "gauge %s %s %"PRId64" %"PRId64"\n", g->family, g->name,
+            __atomic_load_n(&g->value, __ATOMIC_RELAXED),
+            __atomic_load_n(&g->max, __ATOMIC_RELAXED));
+  }
+
+  if (ferror(f)) {
+    fclose(f);
+    free(*text);
+    *text = NULL;
+    return -1;
+  }
+  if (fclose(f)) {
+    free(*text);
+    *text = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+
+int
+icstats_prometheus(FILE *f)
+{
+  size_t nh = __atomic_load_n(&nhists, __ATOMIC_ACQUIRE);
+  size_t ng = __atomic_load_n(&ngauges, __ATOMIC_ACQUIRE);
+
+  /* series of a family must be contiguous */
+  for (size_t i = 0; i < nh; i++) {
+    size_t j;
+    for (j = 0; j < i && strcmp(hists[j]->family, hists[i]->family); j++)
+      ;
+    if (j < i)
+      continue;
+
+    fprintf(f, "# TYPE icc_%s_seconds histogram\n", hists[i]->family);
+
+    for (j = i; j < nh; j++) {
+      const struct icstats_hist *h = hists[j];
+      uint64_t n = 0;
+      unsigned b = 0;
+
+      if (strcmp(h->family, hists[i]->family))
+        continue;
+
+      for (unsigned k = ICSTATS_PROM_MIN_BITS; k < ICSTATS_MAX_BITS; k++) {
+        unsigned end = bucket_index(UINT64_C(1) << k);
+        for (; b < end; b++)
+          n += __atomic_load_n(&h->buckets[b], __ATOMIC_RELAXED);
+        fprintf(f, "icc_%s_seconds_bucket{name=\"%s\",le=\"%.9g\"} %"PRIu64"\n",
+                h->family, h->name, (double)(UINT64_C(1) << k) * 1e-9, n);
+      }
+      for (; b < ICSTATS_NBUCKETS; b++)
+        n += __atomic_load_n(&h->buckets[b], __ATOMIC_RELAXED);
+      fprintf(f, "icc_%s_seconds_bucket{name=\"%s\",le=\"+Inf\"} %"PRIu64"\n",
+              h->family, h->name, n);
+      fprintf(f, "icc_%s_seconds_sum{name=\"%s\"} %.9f\n", h->family, h->name,
+              __atomic_load_n(&h->sum, __ATOMIC_RELAXED) * 1e-9);
+      fprintf(f, "icc_%s_seconds_count{name=\"%s\"} %"PRIu64"\n",
+              h->family, h->name, n);
+    }
+  }
+
+  for (size_t i = 0; i < ng; i++) {
+    size_t j;
+    for (j = 0; j < i && strcmp(gauges[j]->family, gauges[i]->family); j++)
+      ;
+    if (j < i)
+      continue;
+
+    fprintf(f, "# TYPE icc_%s gauge\n", gauges[i]->family);
+    for (j = i; j < ng; j++) {
+      const struct icstats_gauge *g = gauges[j];
+      if (!strcmp(g->family, gauges[i]->family))
+        fprintf(f, "icc_%s{name=\"%s\"} %"PRId64"\n", g->family, g->name,
+                __atomic_load_n(&g->value, __ATOMIC_RELAXED));
+    }
+    fprintf(f, "# TYPE icc_%s_max gauge\n", gauges[i]->family);
+    for (j = i; j < ng; j++) {
+      const struct icstats_gauge *g = gauges[j];
+      if (!strcmp(g->family, gauges[i]->family))
+        fprintf(f, "icc_%s_max{name=\"%s\"} %"PRId64"\n", g->family, g->name,
+                __atomic_load_n(&g->max, __ATOMIC_RELAXED));
+    }
+  }
+
+  return ferror(f) ? -1 : 0;
+}
+
+
+int
+icstats_export_start(const char *file, const char *sockpath, unsigned interval)
+{
+  struct exporter *e = &exporter;
+  int rc;
+
+  if (e->running || (!file && !sockpath))
+    return -1;
+
+  e->sock = -1;
+  e->wakefd[0] = e->wakefd[1] = -1;
+  e->interval = interval ? interval : ICSTATS_INTERVAL_DEFAULT;
+  e->file = file ? strdup(file) : NULL;
+  e->sockpath = sockpath ? strdup(sockpath) : NULL;
+  if ((file && !e->file) || (sockpath && !e->sockpath))
+    goto error;
+
+  if (pipe(e->wakefd))
+    goto error;
+
+  if (sockpath) {
+    struct sockaddr_un sa = { .sun_family = AF_UNIX };
+
+    if (strlen(sockpath) >= sizeof(sa.sun_path)) {
+      errno = ENAMETOOLONG;
+      goto error;
+    }
+    strcpy(sa.sun_path, sockpath);
+
+    e->sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (e->sock == -1)
+      goto error;
+
+    /* a stale socket from a previous run */
+    unlink(sockpath);
+    if (bind(e->sock, (struct sockaddr *)&sa, sizeof(sa)) || listen(e->sock, 8))
+      goto error;
+  }
+
+  rc = pthread_create(&e->thread, NULL, export_th, e);
+  if (rc) {
+    errno = rc;
+    goto error;
+  }
+  e->running = 1;
+
+  return 0;
+
+ error:
+  rc = errno;
+  if (e->sock != -1) {
+    close(e->sock);
+    unlink(sockpath);
+  }
+  if (e->wakefd[0] != -1) {
+    close(e->wakefd[0]);
+    close(e->wakefd[1]);
+  }
+  free(e->file);
+  free(e->sockpath);
+  e->file = e->sockpath = NULL;
+  errno = rc;
+  return -1;
+}
+
+
+void
+icstats_export_stop(void)
+{
+  struct exporter *e = &exporter;
+
+  if (!e->running)
+    return;
+
+  if (write(e->wakefd[1], "", 1) != 1) {
+    /* the thread cannot be woken up, leave it be */
+    return;
+  }
+  pthread_join(e->thread, NULL);
+  e->running = 0;
+
+  if (e->sock != -1) {
+    close(e->sock);
+    unlink(e->sockpath);
+  }
+  close(e->wakefd[0]);
+  close(e->wakefd[1]);
+  free(e->file);
+  free(e->sockpath);
+  e->file = e->sockpath = NULL;
+}
+
+
+static unsigned
+bucket_index(uint64_t v)
+{
+  if (v >= UINT64_C(1) << ICSTATS_MAX_BITS)
+    v = (UINT64_C(1) << ICSTATS_MAX_BITS) - 1;
+  if (v < ICSTATS_SUB)
+    return v;
+
+  unsigned e = 63 - __builtin_clzll(v);
+  return ICSTATS_SUB + (e - ICSTATS_SUB_BITS) * ICSTATS_SUB
+    + (unsigned)((v >> (e - ICSTATS_SUB_BITS)) - ICSTATS_SUB);
+}
+
+static uint64_t
+bucket_low(unsigned i)
+{
+  if (i < ICSTATS_SUB)
+    return i;
+
+  unsigned e = (i - ICSTATS_SUB) / ICSTATS_SUB;
+  return (uint64_t)(ICSTATS_SUB + (i - ICSTATS_SUB) % ICSTATS_SUB) << e;
+}
+
+static uint64_t
+bucket_width(unsigned i)
+{
+  if (i < ICSTATS_SUB)
+    return 1;
+  return UINT64_C(1) << ((i - ICSTATS_SUB) / ICSTATS_SUB);
+}
+
+
+static void *
+export_th(void *arg)
+{
+  struct exporter *e = (struct exporter *)arg;
+  uint64_t next = 0;
+
+  while (1) {
+    struct pollfd fds[2] = {
+      { .fd = e->wakefd[0], .events = POLLIN },
+      { .fd = e->sock,      .events = POLLIN },
+    };
+    int timeout = -1;
+
+    if (e->file) {
+      uint64_t now = icstats_now();
+      if (now >= next) {
+        export_file(e->file);
+        next = now + (uint64_t)e->interval * 1000000000;
+      }
+      timeout = (int)((next - now) / 1000000) + 1;
+    }
+
+    int n = poll(fds, e->sock != -1 ? 2 : 1, timeout);
+    if (n == -1 && errno != EINTR)
+      break;
+    if (n <= 0)
+      continue;
+
+    if (fds[0].revents)
+      break;
+
+    if (fds[1].revents & POLLIN) {
+      int fd = accept4(e->sock, NULL, NULL, SOCK_CLOEXEC);
+      if (fd != -1) {
+        export_conn(fd);
+        close(fd);
+      }
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * Write the statistics to FILE through a temporary file, so that
+ * readers never see a partial one.
+ */
+static int
+export_file(const char *file)
+{
+  char tmp[4096];
+  FILE *f;
+  int rc;
+
+  if (snprintf(tmp, sizeof(tmp), "%s.tmp", file) >= (int)sizeof(tmp))
+    return -1;
+
+  f = fopen(tmp, "w");
+  if (!f)
+    return -1;
+
+  rc = icstats_prometheus(f);
+  if (fclose(f))
+    rc = -1;
+
+  if (rc || rename(tmp, file)) {
+    unlink(tmp);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Send the statistics on the connected socket FD. The text is
+ * prepared first so that a reader going away does not raise SIGPIPE.
+ */
+static void
+export_conn(int fd)
+{
+  char *buf = NULL;
+  size_t len = 0;
+  FILE *f;
+
+  f = open_memstream(&buf, &len);
+  if (!f)
+    return;
+  icstats_prometheus(f);
+  if (fclose(f)) {
+    free(buf);
+    return;
+  }
+
+  for (size_t off = 0; off < len; ) {
+    ssize_t n = send(fd, buf + off, len - off, MSG_NOSIGNAL);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    off += n;
+  }
+  free(buf);
+}
@@ -0,0 +1,472 @@
+#include <math.h>               /* log10, lround */
+#include <stdio.h>              /* snprintf */
+#include <stdlib.h>             /* calloc */
+
+#include "arena.h"
+#include "hashmap.h"
+#include "ioset.h"
+
+#define HEAP_NONE ((size_t)-1)
+#define IOSET_LEASE_SLICES 16   /* most slices of lease in a grant */
+
+struct ioset {
+  double           priority;
+  int              held;        /* by an app, until the end of its IO phase */
+  uint32_t         jobid;       /* of the holder */
+  uint32_t         jobstepid;
+  uint32_t         witer;
+  uint64_t         deadline;    /* of the holder lease, 0 while it waits */
+  int              admitted;    /* the holder is doing IO */
+  uint32_t         bandwidth;   /* of the holder when admitted */
+  size_t           heapidx;     /* in the heap of held sets */
+  struct ioset_req *waitq;      /* apps waiting for the set */
+  struct ioset_req *waittail;
+};
+
+struct ioset_sched {
+  uint64_t         budget;      /* MiB/s, 0 for one app at a time */
+  uint64_t         used;
+  size_t           running;
+  int              exclusive;   /* an admitted app runs alone */
+  uint64_t         lease;       /* ns per slice, 0 for none */
+  size_t           nrevoked;
+
+  hm_t             *sets;       /* set ID -> struct ioset * */
+  struct arena     *arena;      /* memory of the sets */
+
+  struct ioset     **heap;      /* held sets, lowest priority on top */
+  size_t           nheap, heapcap;
+
+  struct ioset_req *waitq;      /* apps holding their set, waiting for admission */
+  struct ioset_req *waittail;
+  size_t           nwaiting;
+  size_t           nsetwaiting;
+};
+
+
+int
+ioset_sched_init(struct ioset_sched **sched, uint64_t budget, uint64_t lease)
+{
+  struct ioset_sched *s;
+
+  *sched = NULL;
+
+  s = calloc(1, sizeof(*s));
+  if (!s)
+    return -1;
+
+  s->budget = budget;
+  s->lease = lease;
+  s->sets = hm_create();
+  s->arena = arena_create(0);
+  if (!s->sets || !s->arena) {
+    ioset_sched_fini(&s);
+    return -1;
+  }
+
+  *sched = s;
+  return 0;
+}
+
+void
+ioset_sched_fini(struct ioset_sched **sched)
+{
+  if (!sched || !*sched)
+    return;
+
+  struct ioset_sched *s = *sched;
+
+  if (s->sets)
+    hm_free(s->sets);
+  if (s->arena)
+    arena_free(s->arena);
+  free(s->heap);
+  free(s);
+
+  *sched = NULL;
+}
+
+
+/* min-heap of the held sets on priority */
+
+static void
+heap_place(struct ioset_sched *s, size_t i, struct ioset *set)
+{
+  s->heap[i] = set;
+  set->heapidx = i;
+}
+
+static void
+heap_up(struct ioset_sched *s, size_t i)
+{
+  struct ioset *set = s->heap[i];
+
+  while (i > 0 && set->priority < s->heap[(i - 1) / 2]->priority) {
+    heap_place(s, i, s->heap[(i - 1) / 2]);
+    i = (i - 1) / 2;
+  }
+  heap_place(s, i, set);
+}
+
+static void
+heap_down(struct ioset_sched *s, size_t i)
+{
+  struct ioset *set = s->heap[i];
+  size_t child;
+
+  while ((child = 2 * i + 1) < s->nheap) {
+    if (child + 1 < s->nheap && s->heap[child + 1]->priority < s->heap[child]->priority)
+      child++;
+    if (s->heap[child]->priority >= set->priority)
+      break;
+    heap_place(s, i, s->heap[child]);
+    i = child;
+  }
+  heap_place(s, i, set);
+}
+
+static int
+heap_push(struct ioset_sched *s, struct ioset *set)
+{
+  if (s->nheap == s->heapcap) {
+    size_t cap = s->heapcap ? s->heapcap * 2 : 16;
+    struct ioset **h = realloc(s->heap, cap * sizeof(*h));
+    if (!h)
+      return -1;
+    s->heap = h;
+    s->heapcap = cap;
+  }
+
+  s->heap[s->nheap] = set;
+  heap_up(s, s->nheap++);
+
+  return 0;
+}
+
+static void
+heap_remove(struct ioset_sched *s, struct ioset *set)
+{
+  size_t i = set->heapidx;
+
+  if (i == HEAP_NONE)
+    return;
+
+  set->heapidx = HEAP_NONE;
+  if (i == --s->nheap)
+    return;
+
+  struct ioset *moved = s->heap[s->nheap];
+  heap_place(s, i, moved);
+  heap_up(s, i);
+  heap_down(s, moved->heapidx);
+}
+
+
+static void
+req_push(struct ioset_req **head, struct ioset_req **tail, struct ioset_req *r)
+{
+  r->next = NULL;
+  if (*tail)
+    (*tail)->next = r;
+  else
+    *head = r;
+  *tail = r;
+}
+
+static struct ioset_req *
+req_pop(struct ioset_req **head, struct ioset_req **tail)
+{
+  struct ioset_req *r = *head;
+  if (r) {
+    *head = r->next;
+    if (!*head)
+      *tail = NULL;
+    r->next = NULL;
+  }
+  return r;
+}
+
+
+static struct ioset *
+ioset_get(struct ioset_sched *s, uint32_t witer, int create)
+{
+  char iosetid[IOSETID_LEN];
+  struct ioset *const *p;
+  struct ioset *set;
+
+  if (ioset_id(witer, iosetid, IOSETID_LEN))
+    return NULL;
+
+  p = hm_get(s->sets, iosetid);
+  if (p)
+    return *p;
+  if (!create)
+    return NULL;
+
+  set = arena_alloc(s->arena, sizeof(*set));
+  if (!set)
+    return NULL;
+
+  set->priority = ioset_prio(witer);
+  set->held = 0;
+  set->deadline = 0;
+  set->admitted = 0;
+  set->heapidx = HEAP_NONE;
+  set->waitq = set->waittail = NULL;
+
+  if (hm_set(s->sets, iosetid, &set, sizeof(set)) == -1)
+    return NULL;
+
+  return set;
+}
+
+static int
+ioset_hold(struct ioset_sched *s, struct ioset *set, const struct ioset_req *r)
+{
+  set->held = 1;
+  set->jobid = r->jobid;
+  set->jobstepid = r->jobstepid;
+  set->witer = r->witer;
+  set->deadline = 0;
+  return heap_push(s, set);
+}
+
+static int
+ioset_fits(const struct ioset_sched *s, uint32_t bandwidth)
+{
+  if (s->running == 0)
+    return 1;
+
+  return s->budget != 0 && bandwidth != 0 && !s->exclusive &&
+    s->used + bandwidth <= s->budget;
+}
+
+/**
+ * Slices of the sets are their priority scaled so that the lowest
+ * priority among the held sets gets one.
+ */
+static unsigned
+ioset_slices(const struct ioset_sched *s, const struct ioset *set)
+{
+  long nslices = s->nheap ? lround(set->priority / s->heap[0]->priority) : 1;
+  return nslices > 0 ? nslices : 1;
+}
+
+/**
+ * Give the holder of SET NSLICES slices worth of lease from NOW, up to
+ * IOSET_LEASE_SLICES: a high priority set gets many more slices than
+ * it usually uses, and a dead holder should not stall the others for
+ * all of them.
+ */
+static void
+ioset_renew(const struct ioset_sched *s, struct ioset *set, unsigned nslices, uint64_t now)
+{
+  if (nslices > IOSET_LEASE_SLICES)
+    nslices = IOSET_LEASE_SLICES;
+  set->deadline = s->lease ? now + s->lease * nslices : 0;
+}
+
+static void
+ioset_grant(struct ioset_sched *s, struct ioset_req *r, uint64_t now)
+{
+  struct ioset *set = r->set;
+
+  set->admitted = 1;
+  set->bandwidth = r->bandwidth;
+
+  s->used += r->bandwidth;
+  s->running++;
+  s->exclusive = s->budget == 0 || r->bandwidth == 0;
+
+  r->nslices = ioset_slices(s, set);
+  ioset_renew(s, set, r->nslices, now);
+}
+
+
+int
+ioset_begin(struct ioset_sched *s, struct ioset_req *r, uint64_t now)
+{
+  struct ioset *set;
+
+  set = ioset_get(s, r->witer, 1);
+  if (!set)
+    return -1;
+
+  r->set = set;
+  r->nslices = 0;
+  r->next = NULL;
+
+  if (set->held && (set->jobid != r->jobid || set->jobstepid != r->jobstepid)) {
+    req_push(&set->waitq, &set->waittail, r);
+    s->nsetwaiting++;
+    return IOSET_QUEUED;
+  }
+
+  if (!set->held && ioset_hold(s, set, r))
+    return -1;
+
+  if (set->admitted) {
+    /* asking again without giving back, renews the lease */
+    r->nslices = ioset_slices(s, set);
+    ioset_renew(s, set, r->nslices, now);
+    return IOSET_GRANTED;
+  }
+
+  if (!s->waitq && ioset_fits(s, r->bandwidth)) {
+    ioset_grant(s, r, now);
+    return IOSET_GRANTED;
+  }
+
+  /* the holder cannot be late while we keep it waiting */
+  set->deadline = 0;
+  req_push(&s->waitq, &s->waittail, r);
+  s->nwaiting++;
+
+  return IOSET_QUEUED;
+}
+
+
+/**
+ * Give back the bandwidth of the holder of SET, and the set itself if
+ * ITERFLAG is set, then admit the waiting apps that fit, appending
+ * them to GRANTED.
+ */
+static void
+ioset_release(struct ioset_sched *s, struct ioset *set, int iterflag, uint64_t now,
+              struct ioset_req **granted, struct ioset_req **tail)
+{
+  struct ioset_req *r;
+
+  if (set->admitted) {
+    set->admitted = 0;
+    s->used -= set->bandwidth;
+    s->running--;
+    if (s->running == 0)
+      s->exclusive = 0;
+  }
+
+  if (iterflag) {
+    /* end of the IO phase, the next app of the set gets in line */
+    heap_remove(s, set);
+    set->held = 0;
+    set->deadline = 0;
+
+    r = req_pop(&set->waitq, &set->waittail);
+    if (r) {
+      s->nsetwaiting--;
+      if (ioset_hold(s, set, r) == 0) {
+        req_push(&s->waitq, &s->waittail, r);
+        s->nwaiting++;
+      }
+    }
+  } else {
+    /* between two slices, the holder has a slice of lease to come back */
+    ioset_renew(s, set, 1, now);
+  }
+
+  /* admit in arrival order while there is bandwidth left */
+  while (s->waitq && ioset_fits(s, s->waitq->bandwidth)) {
+    r = req_pop(&s->waitq, &s->waittail);
+    s->nwaiting--;
+    ioset_grant(s, r, now);
+    req_push(granted, tail, r);
+  }
+}
+
+
+struct ioset_req *
+ioset_end(struct ioset_sched *s, uint32_t jobid, uint32_t jobstepid,
+          uint32_t witer, int iterflag, uint64_t now)
+{
+  struct ioset_req *granted = NULL, *tail = NULL;
+  struct ioset *set;
+
+  set = ioset_get(s, witer, 0);
+  if (!set || !set->held || set->jobid != jobid || set->jobstepid != jobstepid)
+    return NULL;
+
+  ioset_release(s, set, iterflag, now, &granted, &tail);
+
+  return granted;
+}
+
+
+struct ioset_req *
+ioset_expire(struct ioset_sched *s, uint64_t now, ioset_revoke_fn revoke, void *arg)
+{
+  struct ioset_req *granted = NULL, *tail = NULL;
+
+  if (!s->lease)
+    return NULL;
+
+  /* releasing a set reorders the heap, start over after each */
+  for (;;) {
+    struct ioset *set = NULL;
+
+    for (size_t i = 0; i < s->nheap; i++) {
+      if (s->heap[i]->deadline && s->heap[i]->deadline <= now) {
+        set = s->heap[i];
+        break;
+      }
+    }
+    if (!set)
+      break;
+
+    s->nrevoked++;
+    if (revoke)
+      revoke(arg, set->jobid, set->jobstepid, set->witer);
+
+    ioset_release(s, set, 1, now, &granted, &tail);
+  }
+
+  return granted;
+}
+
+
+void
+ioset_sched_stats(const struct ioset_sched *s, struct ioset_sched_stats *stats)
+{
+  stats->budget = s->budget;
+  stats->used = s->used;
+  stats->running = s->running;
+  stats->nsets = s->nheap;
+  stats->setwaiting = s->nsetwaiting;
+  stats->waiting = s->nwaiting;
+  stats->revoked = s->nrevoked;
+}
+
+
+int
+ioset_id(unsigned long witer, char *iosetid, size_t len) {
+  unsigned int n;
+  long round;
+
+  /* XX TODO handle errors */
+  /* double sec = witer/1000.0; */
+  /* double a = log10(sec); */
+  /* double b = lround(a); */
+
+  round = lround(log10(witer));
+
+  n = snprintf(iosetid, len, "%ld", round);
+  if (n >= len) {            /* output truncated */
+    return -1;
+  }
+
+  return 0;
+}
+
+double
+ioset_prio(unsigned long witer) {
+  return pow(10, -lround(log10(witer)));
+}
+
+int
+ioset_appid(unsigned long jobid, unsigned long jobstepid, char *appid, size_t len) {
+  int n;
+  n = snprintf(appid, len, "%lu.%lu", jobid, jobstepid);
+  if (n < 0 || (unsigned)n >= len) {
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,328 @@
+#include <errno.h>
+#include <inttypes.h>           /* PRIu64 */
+#include <stdio.h>              /* fopen, rename */
+#include <stdlib.h>             /* calloc */
+#include <string.h>             /* strerror */
+#include <margo.h>
+
+#include "rpc.h"                /* LOG_ERROR */
+#include "icstats.h"
+#include "iotrace.h"
+
+#define IOTRACE_INTERVAL_MS 100 /* between two writes */
+
+#define STAT_ADD(trace,counter,n)                                       \
+  __atomic_fetch_add(&(trace)->stats.counter, (n), __ATOMIC_RELAXED)
+
+/*
+ * Bounded queue of D. Vyukov: a cell is free for the producer of
+ * position pos when its sequence is pos, and holds a record for the
+ * consumer when it is pos + 1. Several execution streams may share a
+ * ring, the writer ULT is the only consumer.
+ */
+struct iotrace_cell {
+  uint64_t           seq;
+  struct iotrace_rec rec;
+};
+
+struct iotrace_ring {
+  uint64_t            head __attribute__((aligned(64)));  /* producers */
+  uint64_t            tail __attribute__((aligned(64)));  /* consumer */
+  struct iotrace_cell *cells;
+};
+
+struct iotrace {
+  margo_instance_id    mid;
+  char                 *path;
+  uint64_t             maxsize;
+  FILE                 *file;
+  uint64_t             size;    /* of the current file */
+
+  unsigned             nrings;
+  struct iotrace_ring  *rings;
+
+  int                  terminate;
+  ABT_thread           writer;
+
+  struct iotrace_stats stats;
+  struct icstats_gauge *dropped;
+};
+
+static void writer_th(void *arg);
+static void writer_stop(void *arg);
+static int trace_open(struct iotrace *t);
+
+
+int
+iotrace_init(struct iotrace **trace, margo_instance_id mid, const char *path,
+             uint64_t maxsize, unsigned nrings)
+{
+  ABT_pool pool;
+  int rc;
+
+  *trace = NULL;
+
+  struct iotrace *t = calloc(1, sizeof(*t));
+  if (!t) {
+    LOG_ERROR(mid, "Failed calloc");
+    return -1;
+  }
+
+  t->mid = mid;
+  t->maxsize = maxsize;
+  t->writer = ABT_THREAD_NULL;
+  t->nrings = nrings > 0 ? nrings : 1;
+  t->dropped = icstats_gauge("queue", "iotrace_dropped");
+
+  t->path = strdup(path);
+  t->rings = calloc(t->nrings, sizeof(*t->rings));
+  if (!t->path || !t->rings) {
+    LOG_ERROR(mid, "Failed allocation");
+    goto error;
+  }
+
+  for (unsigned i = 0; i < t->nrings; i++) {
+    struct iotrace_ring *r = &t->rings[i];
+    r->cells = calloc(IOTRACE_RINGSIZE, sizeof(*r->cells));
+    if (!r->cells) {
+      LOG_ERROR(mid, "Failed allocation");
+      goto error;
+    }
+    for (uint64_t j = 0; j < IOTRACE_RINGSIZE; j++)
+      r->cells[j].seq = j;
+  }
+
+  if (trace_open(t))
+    goto error;
+
+  rc = margo_get_handler_pool(mid, &pool);
+  if (rc != 0) {
+    LOG_ERROR(mid, "Could not get handler pool");
+    goto error;
+  }
+
+  rc = ABT_thread_create(pool, writer_th, t, ABT_THREAD_ATTR_NULL, &t->writer);
+  if (rc != ABT_SUCCESS) {
+    t->writer = ABT_THREAD_NULL;
+    LOG_ERROR(mid, "Could not create IO trace ULT (ret = %d)", rc);
+    goto error;
+  }
+
+  /* the writer must be gone before Margo stops its pool */
+  rc = margo_push_prefinalize_callback(mid, writer_stop, t);
+  if (rc != 0) {
+    LOG_ERROR(mid, "Could not register IO trace finalization");
+    goto error;
+  }
+
+  *trace = t;
+  return 0;
+
+ error:
+  iotrace_fini(&t);
+  return -1;
+}
+
+
+/**
+ * Write out the records pending in the rings.
+ *
+ * Return the number of records written.
+ */
+static uint64_t
+trace_drain(struct iotrace *t)
+{
+  uint64_t n = 0;
+
+  for (unsigned i = 0; i < t->nrings; i++) {
+    struct iotrace_ring *r = &t->rings[i];
+
+    /* not allocated if iotrace_init failed */
+    if (!r->cells)
+      continue;
+
+    for (;;) {
+      struct iotrace_cell *c = &r->cells[r->tail & (IOTRACE_RINGSIZE - 1)];
+      if (__atomic_load_n(&c->seq, __ATOMIC_ACQUIRE) != r->tail + 1)
+        break;
+
+      if (t->file) {
+        if (fwrite(&c->rec, sizeof(c->rec), 1, t->file) == 1) {
+          t->size += sizeof(c->rec);
+          n++;
+        } else {
+          LOG_ERROR(t->mid, "IO trace write: %s", strerror(errno));
+        }
+      }
+
+      __atomic_store_n(&c->seq, r->tail + IOTRACE_RINGSIZE, __ATOMIC_RELEASE);
+      r->tail++;
+    }
+  }
+
+  if (n > 0) {
+    if (fflush(t->file))
+      LOG_ERROR(t->mid, "IO trace fflush: %s", strerror(errno));
+    STAT_ADD(t, written, n);
+  }
+
+  return n;
+}
+
+static int
+trace_open(struct iotrace *t)
+{
+  struct iotrace_header h = {
+    .magic = IOTRACE_MAGIC,
+    .version = IOTRACE_VERSION,
+    .recsize = sizeof(struct iotrace_rec),
+  };
+
+  t->file = fopen(t->path, "w");
+  if (!t->file) {
+    LOG_ERROR(t->mid, "fopen \"%s\" fail: %s", t->path, strerror(errno));
+    return -1;
+  }
+
+  if (fwrite(&h, sizeof(h), 1, t->file) != 1) {
+    LOG_ERROR(t->mid, "IO trace header: %s", strerror(errno));
+    fclose(t->file);
+    t->file = NULL;
+    return -1;
+  }
+  t->size = sizeof(h);
+
+  return 0;
+}
+
+/**
+ * Shift the previous files up to PATH.IOTRACE_KEEP and start a new
+ * one.
+ */
+static void
+trace_rotate(struct iotrace *t)
+{
+  char from[4096], to[4096];
+
+  fclose(t->file);
+  t->file = NULL;
+
+  for (int i = IOTRACE_KEEP - 1; i >= 0; i--) {
+    if (i == 0)
+      snprintf(from, sizeof(from), "%s", t->path);
+    else
+      snprintf(from, sizeof(from), "%s.%d", t->path, i);
+    snprintf(to, sizeof(to), "%s.%d", t->path, i + 1);
+
+    if (rename(from, to) && errno != ENOENT)
+      LOG_ERROR(t->mid, "IO trace rename \"%s\": %s", from, strerror(errno));
+  }
+
+  STAT_ADD(t, rotations, 1);
+
+  /* without a file the records are dropped until the next rotation */
+  trace_open(t);
+}
+
+static void
+writer_th(void *arg)
+{
+  struct iotrace *t = arg;
+
+  while (!__atomic_load_n(&t->terminate, __ATOMIC_ACQUIRE)) {
+    trace_drain(t);
+    if (t->maxsize && (!t->file || t->size >= t->maxsize))
+      trace_rotate(t);
+    margo_thread_sleep(t->mid, IOTRACE_INTERVAL_MS);
+  }
+}
+
+
+static void
+writer_stop(void *arg)
+{
+  struct iotrace *t = arg;
+
+  if (t->writer != ABT_THREAD_NULL) {
+    __atomic_store_n(&t->terminate, 1, __ATOMIC_RELEASE);
+    ABT_thread_join(t->writer);
+    ABT_thread_free(&t->writer);
+  }
+}
+
+
+void
+iotrace_fini(struct iotrace **trace)
+{
+  if (!trace || !*trace)
+    return;
+
+  struct iotrace *t = *trace;
+
+  writer_stop(t);
+
+  if (t->rings) {
+    trace_drain(t);
+    for (unsigned i = 0; i < t->nrings; i++)
+      free(t->rings[i].cells);
+    free(t->rings);
+  }
+
+  if (t->file) {
+    margo_info(t->mid, "IO trace: %"PRIu64" records, %"PRIu64" dropped, "
+               "%"PRIu64" rotations", t->stats.written, t->stats.dropped,
+               t->stats.rotations);
+    fclose(t->file);
+  }
+
+  free(t->path);
+  free(t);
+
+  *trace = NULL;
+}
+
+
+int
+iotrace_append(struct iotrace *t, const struct iotrace_rec *rec)
+{
+  int xrank;
+
+  if (ABT_self_get_xstream_rank(&xrank) != ABT_SUCCESS || xrank < 0)
+    xrank = 0;
+
+  struct iotrace_ring *r = &t->rings[(unsigned)xrank % t->nrings];
+  uint64_t pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+
+  for (;;) {
+    struct iotrace_cell *c = &r->cells[pos & (IOTRACE_RINGSIZE - 1)];
+    uint64_t seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+    int64_t dif = (int64_t)(seq - pos);
+
+    if (dif == 0) {
+      if (__atomic_compare_exchange_n(&r->head, &pos, pos + 1, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        c->rec = *rec;
+        __atomic_store_n(&c->seq, pos + 1, __ATOMIC_RELEASE);
+        STAT_ADD(t, appended, 1);
+        return 0;
+      }
+      /* pos was updated by the failed exchange */
+    } else if (dif < 0) {
+      STAT_ADD(t, dropped, 1);
+      icstats_gauge_add(t->dropped, 1);
+      return -1;
+    } else {
+      pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+
+void
+iotrace_stats(struct iotrace *t, struct iotrace_stats *stats)
+{
+  stats->appended = __atomic_load_n(&t->stats.appended, __ATOMIC_RELAXED);
+  stats->dropped = __atomic_load_n(&t->stats.dropped, __ATOMIC_RELAXED);
+  stats->written = __atomic_load_n(&t->stats.written, __ATOMIC_RELAXED);
+  stats->rotations = __atomic_load_n(&t->stats.rotations, __ATOMIC_RELAXED);
+}
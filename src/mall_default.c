@@ -0,0 +1,221 @@
+#include <stdlib.h>             /* calloc */
+#include <string.h>             /* strcmp */
+
+#include "icc_mall.h"
+#include "mallpolicy.h"
+
+/*
+ * Default malleability policy: follow the hints of a client entering
+ * a malleability region or, without hints, expand or shrink it by
+ * its number of processes when the average iteration time of its
+ * last iterations goes above or below a threshold. Shrink the
+ * largest client when the Beegfs request queue gets long.
+ */
+
+//malleability cpu useage umbral ratios
+#define MAX_CPU_RATE 90.0
+#define MIN_CPU_RATE 80.0
+
+//malleability it rtime umbral ratios
+#define MAX_VAL_IT_RTIME 1.0
+#define MAX_VAL_IT_CTIME 1.0
+
+#define MAX_IT_RTIME 0.02
+#define MIN_IT_RTIME 0.01
+
+#define MAX_RATIO_CPU_COMM 80.0
+#define MIN_RATIO_CPU_COMM 60.0
+
+#define MAX_IT 10               /* iterations in the average */
+
+#define BEEGFS_QLEN_MAX 10      /* Beegfs queue length before shrinking */
+
+struct mall_default {
+  struct icc_mall_services srv;
+
+  /* last region entered, waiting for a decision */
+  int                      has_region;
+  struct icc_mall_region   region;
+  char                     region_clid[ICC_MALL_CLID_LEN];
+
+  /* last monitoring data, for the region */
+  int                      has_metric;
+  struct icc_mall_metric   metric;
+  char                     metric_clid[ICC_MALL_CLID_LEN];
+
+  int                      shrink_largest;
+};
+
+static int
+mall_default_init(const struct icc_mall_services *srv, void **state)
+{
+  struct mall_default *s = calloc(1, sizeof(*s));
+  if (!s)
+    return -1;
+
+  s->srv = *srv;
+  *state = s;
+  return 0;
+}
+
+static void
+mall_default_fini(void *state)
+{
+  free(state);
+}
+
+static int
+mall_default_on_region(void *state, const struct icc_mall_region *region)
+{
+  struct mall_default *s = state;
+
+  if (!region->enter) {
+    s->has_region = 0;
+    return ICC_MALL_PASS;
+  }
+
+  s->region = *region;
+  strncpy(s->region_clid, region->clid, ICC_MALL_CLID_LEN - 1);
+  s->region.clid = s->region_clid;
+  s->has_region = 1;
+
+  return ICC_MALL_DECIDE;
+}
+
+static int
+mall_default_on_metric(void *state, const struct icc_mall_metric *metric)
+{
+  struct mall_default *s = state;
+
+  s->metric = *metric;
+  strncpy(s->metric_clid, metric->clid, ICC_MALL_CLID_LEN - 1);
+  s->metric.clid = s->metric_clid;
+  s->has_metric = 1;
+
+  return ICC_MALL_PASS;
+}
+
+static int
+mall_default_on_stream_event(void *state, const struct icc_mall_stream_event *ev)
+{
+  struct mall_default *s = state;
+
+  if (strcmp(ev->stream, "beegfs") || ev->qlen <= BEEGFS_QLEN_MAX)
+    return ICC_MALL_PASS;
+
+  s->shrink_largest = 1;
+  return ICC_MALL_DECIDE;
+}
+
+/**
+ * Compute the CPUs to add (or remove, if *SHRINK) to the job of the
+ * pending region from its hints or the iteration times of the client.
+ *
+ * Return the number of CPUs, 0 for no change.
+ */
+static uint32_t
+region_ncpus(struct mall_default *s, int *shrink)
+{
+  const struct icc_mall_region *r = &s->region;
+  const struct icc_mall_metric *m = &s->metric;
+  double avg_rtime, avg_ctime;
+  uint32_t nsamples, ncpus = 0;
+  int num_proc;
+
+  *shrink = 0;
+
+  /* if hints -> follow the hints */
+  if (r->nprocs != 0) {
+    *shrink = r->nprocs < 0;
+    return *shrink ? (uint32_t)-r->nprocs : (uint32_t)r->nprocs;
+  }
+
+  /* if no hints, look at monitor */
+  if (!s->has_metric || strcmp(m->clid, r->clid))
+    return 0;
+
+  if (m->rtime > MAX_VAL_IT_RTIME)
+    return 0;
+
+  /* rolling average over the last MAX_IT iterations of the client,
+     kept by the server */
+  if (s->srv.monitor_sample(s->srv.ctx, r->clid, m->rtime, m->ctime, MAX_IT,
+                            &avg_rtime, &avg_ctime, &nsamples))
+    return 0;
+  if (nsamples < MAX_IT)
+    return 0;
+
+  num_proc = m->nprocs;
+  if (r->nnodes > 1) {          /// FIX ME
+    num_proc = 1;
+  }
+
+  if (MAX_IT_RTIME < avg_rtime) {
+    ncpus = num_proc;
+  } else if (MIN_IT_RTIME > avg_rtime) {
+    *shrink = 1;
+    ncpus = num_proc;
+  }
+
+  /* samples from before the reconfiguration do not apply */
+  if (ncpus != 0)
+    s->srv.monitor_reset(s->srv.ctx, r->clid);
+
+  return ncpus;
+}
+
+static size_t
+mall_default_decide(void *state, const struct icc_mall_snapshot *snap,
+                    struct icc_mall_action *actions, size_t maxactions)
+{
+  struct mall_default *s = state;
+  size_t n = 0;
+
+  if (maxactions == 0)
+    return 0;
+
+  if (s->shrink_largest) {
+    const struct icc_mall_client *largest = NULL;
+
+    s->shrink_largest = 0;
+    for (size_t i = 0; i < snap->nclients; i++) {
+      if (!largest || snap->clients[i].nnodes > largest->nnodes)
+        largest = &snap->clients[i];
+    }
+    if (largest) {
+      memset(&actions[n], 0, sizeof(actions[n]));
+      actions[n].type = ICC_MALL_SHRINK_NODES;
+      actions[n].jobid = largest->jobid;
+      strncpy(actions[n].clid, largest->clid, ICC_MALL_CLID_LEN - 1);
+      n++;
+    }
+  } else if (s->has_region) {
+    int shrink;
+    uint32_t ncpus = region_ncpus(s, &shrink);
+
+    if (ncpus != 0) {
+      memset(&actions[n], 0, sizeof(actions[n]));
+      actions[n].type = shrink ? ICC_MALL_SHRINK : ICC_MALL_EXPAND;
+      actions[n].jobid = s->region.jobid;
+      strncpy(actions[n].clid, s->region.clid, ICC_MALL_CLID_LEN - 1);
+      actions[n].ncpus = ncpus;
+      actions[n].nnodes = s->region.nnodes > 0 ? s->region.nnodes : 0;
+      n++;
+    }
+    s->has_region = 0;
+    s->has_metric = 0;
+  }
+
+  return n;
+}
+
+const struct icc_mall_policy icc_mall_policy_default = {
+  .version = ICC_MALL_POLICY_VERSION,
+  .name = ICC_MALL_POLICY_DEFAULT,
+  .init = mall_default_init,
+  .fini = mall_default_fini,
+  .on_region = mall_default_on_region,
+  .on_metric = mall_default_on_metric,
+  .on_stream_event = mall_default_on_stream_event,
+  .decide = mall_default_decide,
+};
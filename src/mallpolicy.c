@@ -0,0 +1,219 @@
+#include <dlfcn.h>              /* dlopen/dlsym */
+#include <inttypes.h>           /* PRIu32 */
+#include <stdio.h>              /* snprintf */
+#include <stdlib.h>             /* calloc */
+#include <string.h>             /* strchr */
+#include <margo.h>
+
+#include "rpc.h"                /* LOG_ERROR */
+#include "mallpolicy.h"
+
+#define MALLPOLICY_LIB_FMT "libicc_mall_%s.so"
+
+struct mallpolicy {
+  margo_instance_id             mid;
+  const struct icc_mall_policy *ops;
+  void                         *state;  /* of the policy */
+  void                         *handle; /* dlopen handle, NULL if built-in */
+  ABT_mutex                     lock;   /* serializes the calls to the policy */
+};
+
+
+int
+mallpolicy_load(struct mallpolicy **policy, margo_instance_id mid,
+                const char *name, const struct icc_mall_services *srv)
+{
+  const struct icc_mall_policy *ops;
+  char path[256];
+  int rc;
+
+  *policy = NULL;
+
+  if (!name || !name[0])
+    name = ICC_MALL_POLICY_DEFAULT;
+
+  struct mallpolicy *p = calloc(1, sizeof(*p));
+  if (!p) {
+    LOG_ERROR(mid, "Failed calloc");
+    return -1;
+  }
+  p->mid = mid;
+  p->lock = ABT_MUTEX_NULL;
+
+  if (!strcmp(name, ICC_MALL_POLICY_DEFAULT)) {
+    ops = &icc_mall_policy_default;
+  } else {
+    if (strchr(name, '/')) {
+      snprintf(path, sizeof(path), "%s", name);
+    } else {
+      snprintf(path, sizeof(path), MALLPOLICY_LIB_FMT, name);
+    }
+
+    p->handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!p->handle) {
+      LOG_ERROR(mid, "Malleability policy dlopen: %s", dlerror());
+      goto error;
+    }
+
+    ops = dlsym(p->handle, ICC_MALL_POLICY_SYMBOL);
+    if (!ops) {
+      LOG_ERROR(mid, "Malleability policy dlsym: %s", dlerror());
+      goto error;
+    }
+  }
+
+  if (ops->version != ICC_MALL_POLICY_VERSION) {
+    LOG_ERROR(mid, "Malleability policy %s: version %u, expected %u",
+              name, ops->version, ICC_MALL_POLICY_VERSION);
+    goto error;
+  }
+  if (!ops->decide) {
+    LOG_ERROR(mid, "Malleability policy %s: no decide function", name);
+    goto error;
+  }
+
+  rc = ABT_mutex_create(&p->lock);
+  if (rc != ABT_SUCCESS) {
+    p->lock = ABT_MUTEX_NULL;
+    LOG_ERROR(mid, "Could not create mutex (ret = %d)", rc);
+    goto error;
+  }
+
+  if (ops->init && ops->init(srv, &p->state)) {
+    LOG_ERROR(mid, "Malleability policy %s: initialization failed", name);
+    goto error;
+  }
+  p->ops = ops;
+
+  margo_info(mid, "Malleability policy: %s", ops->name ? ops->name : name);
+
+  *policy = p;
+  return 0;
+
+ error:
+  mallpolicy_fini(&p);
+  return -1;
+}
+
+
+void
+mallpolicy_fini(struct mallpolicy **policy)
+{
+  if (!policy || !*policy)
+    return;
+
+  struct mallpolicy *p = *policy;
+
+  if (p->ops && p->ops->fini)
+    p->ops->fini(p->state);
+
+  if (p->lock != ABT_MUTEX_NULL)
+    ABT_mutex_free(&p->lock);
+
+  if (p->handle)
+    dlclose(p->handle);
+
+  free(p);
+
+  *policy = NULL;
+}
+
+
+/**
+ * Pass EV to the matching hook of POLICY, with the lock held.
+ */
+static int
+hook_locked(struct mallpolicy *policy, const struct mallpolicy_event *ev)
+{
+  const struct icc_mall_policy *ops = policy->ops;
+  int rc = ICC_MALL_PASS;
+
+  switch (ev->type) {
+  case MALLPOLICY_REGISTER:
+    if (ops->on_register)
+      rc = ops->on_register(policy->state, ev->u.client);
+    break;
+  case MALLPOLICY_DEREGISTER:
+    if (ops->on_deregister)
+      rc = ops->on_deregister(policy->state, ev->u.clid, ev->jobid);
+    break;
+  case MALLPOLICY_REGION:
+    if (ops->on_region)
+      rc = ops->on_region(policy->state, ev->u.region);
+    break;
+  case MALLPOLICY_METRIC:
+    if (ops->on_metric)
+      rc = ops->on_metric(policy->state, ev->u.metric);
+    break;
+  case MALLPOLICY_STREAM:
+    if (ops->on_stream_event)
+      rc = ops->on_stream_event(policy->state, ev->u.stream);
+    break;
+  }
+
+  return rc;
+}
+
+/**
+ * Snapshot JOBID and let POLICY decide, with the lock held.
+ */
+static size_t
+decide_locked(struct mallpolicy *policy, uint32_t jobid,
+              mallpolicy_snapshot_t snapshot, void *arg,
+              struct icc_mall_action *actions, size_t maxactions)
+{
+  struct icc_mall_snapshot snap;
+  size_t n;
+
+  if (snapshot(arg, jobid, &snap)) {
+    LOG_ERROR(policy->mid, "Malleability policy: no snapshot of job %"PRIu32, jobid);
+    return 0;
+  }
+
+  n = policy->ops->decide(policy->state, &snap, actions, maxactions);
+  return n > maxactions ? maxactions : n;
+}
+
+
+int
+mallpolicy_hook(struct mallpolicy *policy, const struct mallpolicy_event *ev)
+{
+  int rc;
+
+  ABT_mutex_lock(policy->lock);
+  rc = hook_locked(policy, ev);
+  ABT_mutex_unlock(policy->lock);
+
+  return rc;
+}
+
+
+size_t
+mallpolicy_decide(struct mallpolicy *policy, uint32_t jobid,
+                  mallpolicy_snapshot_t snapshot, void *arg,
+                  struct icc_mall_action *actions, size_t maxactions)
+{
+  size_t n;
+
+  ABT_mutex_lock(policy->lock);
+  n = decide_locked(policy, jobid, snapshot, arg, actions, maxactions);
+  ABT_mutex_unlock(policy->lock);
+
+  return n;
+}
+
+
+size_t
+mallpolicy_handle(struct mallpolicy *policy, const struct mallpolicy_event *ev,
+                  mallpolicy_snapshot_t snapshot, void *arg,
+                  struct icc_mall_action *actions, size_t maxactions)
+{
+  size_t n = 0;
+
+  ABT_mutex_lock(policy->lock);
+  if (hook_locked(policy, ev) == ICC_MALL_DECIDE)
+    n = decide_locked(policy, ev->jobid, snapshot, arg, actions, maxactions);
+  ABT_mutex_unlock(policy->lock);
+
+  return n;
+}
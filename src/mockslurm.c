@@ -0,0 +1,1003 @@
+/**
+ * Mock libslurm: the subset of the Slurm API used by the IC, served
+ * from an in-memory cluster instead of a Slurm controller.
+ *
+ * It is built against the real Slurm headers, so that it can replace
+ * libslurm at link time (make MOCK_SLURM=1) or be preloaded in front
+ * of it (LD_PRELOAD=libmockslurm.so). The cluster lives in the
+ * process, jobs are not shared between processes.
+ *
+ * The cluster is made of whole nodes, a job gets its nodes
+ * exclusively. Pending jobs are started in submission order, without
+ * backfilling, when enough nodes are free.
+ *
+ * Configuration, from the environment:
+ *
+ *   MOCKSLURM_NODES    hostlist of the nodes, default "node[1-8]"
+ *   MOCKSLURM_CPUS     CPUs per node, default 8
+ *   MOCKSLURM_LATENCY  ms spent in each call to the controller
+ *   MOCKSLURM_PENDING  ms a new job stays pending at least
+ *   MOCKSLURM_FAIL     calls to fail, as "name[:probability],..."
+ *                      e.g. "slurm_update_job2:0.5,slurm_kill_job"
+ *   MOCKSLURM_SEED     seed of the failure draws, default 1
+ *   MOCKSLURM_VERBOSE  log the calls to stderr if set
+ *
+ * If SLURM_JOB_ID (or SLURM_JOBID) is set, a running job with that id
+ * is created on the first SLURM_JOB_NUM_NODES (or SLURM_NNODES) nodes,
+ * one by default, as for a process started by sbatch.
+ *
+ * A failed call sets errno, as slurm_get_errno returns it. Injected
+ * failures are reported as SLURM_COMMUNICATIONS_CONNECTION_ERROR.
+ */
+
+#define _GNU_SOURCE             /* for reallocarray */
+#include <errno.h>
+#include <inttypes.h>           /* PRIu32 */
+#include <pthread.h>
+#include <stdarg.h>             /* va_list */
+#include <stdio.h>              /* fprintf */
+#include <stdlib.h>             /* calloc, getenv */
+#include <string.h>             /* strcmp, strdup */
+#include <time.h>               /* clock_gettime, nanosleep */
+
+#include <slurm/slurm.h>
+#include <slurm/slurm_errno.h>
+
+#define MOCK_NODES_DEFAULT  "node[1-8]"
+#define MOCK_CPUS_DEFAULT   8
+#define MOCK_FIRST_JOBID    1000
+#define MOCK_MAXFAIL        16    /* calls that can be set to fail */
+#define MOCK_NAMELEN        64
+
+struct hostlist {
+  char   **hosts;
+  size_t nhosts;
+  size_t size;                  /* allocated */
+  size_t first;                 /* next to shift */
+};
+
+struct mock_job {
+  uint32_t        id;
+  enum job_states state;
+  uint32_t        nnodes;       /* requested, then granted */
+  size_t          *nodes;       /* indexes in the cluster */
+  uint64_t        eligible;     /* ns, may start from then */
+  struct mock_job *next;
+};
+
+struct mock_fail {
+  char   name[MOCK_NAMELEN];
+  double prob;
+};
+
+static struct {
+  pthread_once_t  once;
+  pthread_mutex_t lock;
+  pthread_cond_t  cond;         /* a job started or ended */
+
+  struct hostlist *nodes;
+  uint32_t        *owner;       /* jobid per node, 0 if free */
+  uint16_t        ncpus;
+
+  struct mock_job *jobs;        /* in submission order */
+  struct mock_job *last;
+  uint32_t        nextid;
+
+  long            latency;      /* ms */
+  long            pending;      /* ms */
+  struct mock_fail fail[MOCK_MAXFAIL];
+  size_t          nfail;
+  unsigned int    seed;
+  int             verbose;
+} mock = {
+  .once = PTHREAD_ONCE_INIT,
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static void mock_init(void);
+
+
+/* utils */
+
+static void
+mock_log(const char *format, ...)
+{
+  va_list ap;
+
+  if (!mock.verbose)
+    return;
+
+  va_start(ap, format);
+  fprintf(stderr, "mockslurm: ");
+  vfprintf(stderr, format, ap);
+  fprintf(stderr, "\n");
+  va_end(ap);
+}
+
+static uint64_t
+mock_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+mock_sleep(long ms)
+{
+  struct timespec ts = { .tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000 };
+  while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+    ;
+}
+
+static long
+env_long(const char *name, long dflt)
+{
+  const char *s = getenv(name);
+  char *end;
+
+  if (!s || *s == '\0')
+    return dflt;
+
+  errno = 0;
+  long v = strtol(s, &end, 0);
+  if (errno || *end != '\0' || v < 0) {
+    fprintf(stderr, "mockslurm: invalid %s \"%s\", using %ld\n", name, s, dflt);
+    return dflt;
+  }
+  return v;
+}
+
+/**
+ * Parse MOCKSLURM_FAIL.
+ */
+static void
+parse_fail(const char *spec)
+{
+  char *s, *tok, *save;
+
+  s = strdup(spec);
+  if (!s)
+    return;
+
+  for (tok = strtok_r(s, ",", &save); tok && mock.nfail < MOCK_MAXFAIL;
+       tok = strtok_r(NULL, ",", &save)) {
+    struct mock_fail *f = &mock.fail[mock.nfail];
+    char *colon = strchr(tok, ':');
+
+    f->prob = 1.0;
+    if (colon) {
+      *colon = '\0';
+      f->prob = strtod(colon + 1, NULL);
+    }
+    snprintf(f->name, sizeof(f->name), "%s", tok);
+    mock.nfail++;
+  }
+
+  free(s);
+}
+
+/**
+ * Wait for the configured latency of the controller, then draw
+ * whether call FUNC fails.
+ *
+ * Return 0, or -1 with errno set if the call must fail.
+ */
+static int
+mock_call(const char *func)
+{
+  pthread_once(&mock.once, mock_init);
+
+  if (mock.latency > 0)
+    mock_sleep(mock.latency);
+
+  for (size_t i = 0; i < mock.nfail; i++) {
+    if (strcmp(mock.fail[i].name, func))
+      continue;
+
+    pthread_mutex_lock(&mock.lock);
+    double draw = (double)rand_r(&mock.seed) / RAND_MAX;
+    pthread_mutex_unlock(&mock.lock);
+
+    if (draw < mock.fail[i].prob) {
+      mock_log("%s: injected failure", func);
+      errno = SLURM_COMMUNICATIONS_CONNECTION_ERROR;
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+
+/* hostlists */
+
+static int
+hl_push(struct hostlist *hl, const char *host)
+{
+  if (hl->nhosts == hl->size) {
+    size_t size = hl->size ? hl->size * 2 : 16;
+    char **hosts = reallocarray(hl->hosts, size, sizeof(*hosts));
+    if (!hosts)
+      return -1;
+    hl->hosts = hosts;
+    hl->size = size;
+  }
+
+  hl->hosts[hl->nhosts] = strdup(host);
+  if (!hl->hosts[hl->nhosts])
+    return -1;
+  hl->nhosts++;
+
+  return 0;
+}
+
+/**
+ * Add the hosts of the single expression EXPR, "name" or
+ * "prefix[ranges]suffix" where ranges is a comma separated list of
+ * "n" or "n-m". Leading zeros of n are kept, as in node[01-10].
+ *
+ * Return 0, or -1 if EXPR is malformed.
+ */
+static int
+hl_push_expr(struct hostlist *hl, const char *expr)
+{
+  const char *open = strchr(expr, '[');
+  char buf[256];
+
+  if (!open)
+    return *expr ? hl_push(hl, expr) : -1;
+
+  const char *close = strchr(open, ']');
+  if (!close || open == expr)
+    return -1;
+
+  int plen = open - expr;
+  const char *suffix = close + 1;
+  const char *r = open + 1;
+
+  while (r < close) {
+    char *end;
+    unsigned long lo, hi;
+    int width = 0;
+
+    for (const char *d = r; *d >= '0' && *d <= '9'; d++)
+      width++;
+    if (width == 0)
+      return -1;
+
+    lo = strtoul(r, &end, 10);
+    hi = lo;
+    if (*end == '-') {
+      hi = strtoul(end + 1, &end, 10);
+      if (hi < lo)
+        return -1;
+    }
+    if (*end != ',' && end != close)
+      return -1;
+
+    for (unsigned long i = lo; i <= hi; i++) {
+      snprintf(buf, sizeof(buf), "%.*s%0*lu%s", plen, expr, width, i, suffix);
+      if (hl_push(hl, buf))
+        return -1;
+    }
+
+    r = end + (*end == ',');
+  }
+
+  return 0;
+}
+
+hostlist_t
+slurm_hostlist_create(const char *hostlist)
+{
+  struct hostlist *hl = calloc(1, sizeof(*hl));
+  if (!hl)
+    return NULL;
+
+  if (hostlist && slurm_hostlist_push(hl, hostlist) < 0) {
+    slurm_hostlist_destroy(hl);
+    errno = EINVAL;
+    return NULL;
+  }
+
+  return hl;
+}
+
+void
+slurm_hostlist_destroy(hostlist_t hl)
+{
+  if (!hl)
+    return;
+
+  for (size_t i = hl->first; i < hl->nhosts; i++)
+    free(hl->hosts[i]);
+  free(hl->hosts);
+  free(hl);
+}
+
+int
+slurm_hostlist_push(hostlist_t hl, const char *hosts)
+{
+  size_t n = hl->nhosts;
+  int depth = 0;
+  const char *start = hosts;
+
+  /* split on the commas outside brackets */
+  for (const char *c = hosts; ; c++) {
+    if (*c == '[') {
+      depth++;
+    } else if (*c == ']') {
+      depth--;
+    } else if ((*c == ',' && depth == 0) || *c == '\0') {
+      char expr[256];
+      if (c - start >= (long)sizeof(expr))
+        return -1;
+      snprintf(expr, sizeof(expr), "%.*s", (int)(c - start), start);
+      if (*expr && hl_push_expr(hl, expr))
+        return -1;
+      start = c + 1;
+    }
+    if (*c == '\0')
+      break;
+  }
+
+  return hl->nhosts - n;
+}
+
+int
+slurm_hostlist_push_host(hostlist_t hl, const char *host)
+{
+  return hl_push(hl, host) ? 0 : 1;
+}
+
+int
+slurm_hostlist_count(hostlist_t hl)
+{
+  return hl ? (int)(hl->nhosts - hl->first) : -1;
+}
+
+int
+slurm_hostlist_find(hostlist_t hl, const char *hostname)
+{
+  for (size_t i = hl->first; i < hl->nhosts; i++) {
+    if (!strcmp(hl->hosts[i], hostname))
+      return i - hl->first;
+  }
+  return -1;
+}
+
+char *
+slurm_hostlist_shift(hostlist_t hl)
+{
+  if (!hl || hl->first == hl->nhosts)
+    return NULL;
+
+  /* the caller frees it */
+  return hl->hosts[hl->first++];
+}
+
+/**
+ * Return the hosts of HL as a comma separated list, to be freed by the
+ * caller, or NULL if out of memory.
+ */
+static char *
+hl_string(struct hostlist *hl)
+{
+  size_t len = 1;
+
+  for (size_t i = hl->first; i < hl->nhosts; i++)
+    len += strlen(hl->hosts[i]) + 1;
+
+  char *s = malloc(len);
+  if (!s)
+    return NULL;
+
+  s[0] = '\0';
+  for (size_t i = hl->first; i < hl->nhosts; i++) {
+    if (i > hl->first)
+      strcat(s, ",");
+    strcat(s, hl->hosts[i]);
+  }
+
+  return s;
+}
+
+ssize_t
+slurm_hostlist_ranged_string(hostlist_t hl, size_t n, char *buf)
+{
+  char *s = hl_string(hl);
+  if (!s)
+    return -1;
+
+  size_t len = strlen(s);
+  snprintf(buf, n, "%s", s);
+  free(s);
+
+  return len < n ? (ssize_t)len : -1;
+}
+
+
+/* cluster model, called with the lock held */
+
+static void
+mock_init(void)
+{
+  const char *nodes = getenv("MOCKSLURM_NODES");
+  const char *fail = getenv("MOCKSLURM_FAIL");
+
+  mock.verbose = getenv("MOCKSLURM_VERBOSE") != NULL;
+  mock.latency = env_long("MOCKSLURM_LATENCY", 0);
+  mock.pending = env_long("MOCKSLURM_PENDING", 0);
+  mock.seed = env_long("MOCKSLURM_SEED", 1);
+  mock.ncpus = env_long("MOCKSLURM_CPUS", MOCK_CPUS_DEFAULT);
+  if (mock.ncpus == 0)
+    mock.ncpus = MOCK_CPUS_DEFAULT;
+  mock.nextid = MOCK_FIRST_JOBID;
+
+  if (fail)
+    parse_fail(fail);
+
+  mock.nodes = slurm_hostlist_create(nodes ? nodes : MOCK_NODES_DEFAULT);
+  if (!mock.nodes || mock.nodes->nhosts == 0) {
+    fprintf(stderr, "mockslurm: invalid MOCKSLURM_NODES \"%s\"\n", nodes);
+    abort();
+  }
+
+  mock.owner = calloc(mock.nodes->nhosts, sizeof(*mock.owner));
+  if (!mock.owner)
+    abort();
+
+  mock_log("%zu nodes of %"PRIu16" CPUs, latency %ld ms", mock.nodes->nhosts,
+           mock.ncpus, mock.latency);
+
+  /* the job of the calling process */
+  const char *jobid = getenv("SLURM_JOB_ID");
+  if (!jobid)
+    jobid = getenv("SLURM_JOBID");
+  if (!jobid)
+    return;
+
+  const char *nnodes = getenv("SLURM_JOB_NUM_NODES");
+  if (!nnodes)
+    nnodes = getenv("SLURM_NNODES");
+
+  struct mock_job *job = calloc(1, sizeof(*job));
+  if (!job)
+    abort();
+
+  job->id = strtoul(jobid, NULL, 10);
+  job->nnodes = nnodes ? strtoul(nnodes, NULL, 10) : 1;
+  if (job->nnodes == 0 || job->nnodes > mock.nodes->nhosts)
+    job->nnodes = 1;
+  job->nodes = calloc(job->nnodes, sizeof(*job->nodes));
+  if (!job->nodes)
+    abort();
+
+  for (size_t i = 0; i < job->nnodes; i++) {
+    job->nodes[i] = i;
+    mock.owner[i] = job->id;
+  }
+  job->state = JOB_RUNNING;
+
+  mock.jobs = mock.last = job;
+  if (job->id >= mock.nextid)
+    mock.nextid = job->id + 1;
+
+  mock_log("job %"PRIu32" running on %"PRIu32" nodes", job->id, job->nnodes);
+}
+
+static struct mock_job *
+job_find(uint32_t jobid)
+{
+  for (struct mock_job *job = mock.jobs; job; job = job->next) {
+    if (job->id == jobid)
+      return job;
+  }
+  return NULL;
+}
+
+static size_t
+nfree_nodes(void)
+{
+  size_t n = 0;
+
+  for (size_t i = 0; i < mock.nodes->nhosts; i++)
+    n += mock.owner[i] == 0;
+  return n;
+}
+
+/**
+ * Give back the nodes of JOB and end it in STATE.
+ */
+static void
+job_end(struct mock_job *job, enum job_states state)
+{
+  /* a pending job has no nodes yet */
+  for (uint32_t i = 0; job->nodes && i < job->nnodes; i++)
+    mock.owner[job->nodes[i]] = 0;
+
+  free(job->nodes);
+  job->nodes = NULL;
+  job->nnodes = 0;
+  job->state = state;
+
+  pthread_cond_broadcast(&mock.cond);
+}
+
+/**
+ * Start the pending jobs in order, as long as the first one fits.
+ */
+static void
+schedule(void)
+{
+  uint64_t now = mock_now();
+
+  for (struct mock_job *job = mock.jobs; job; job = job->next) {
+    if (job->state != JOB_PENDING)
+      continue;
+    if (job->eligible > now || job->nnodes > nfree_nodes())
+      break;
+
+    job->nodes = calloc(job->nnodes, sizeof(*job->nodes));
+    if (!job->nodes)
+      break;
+
+    for (size_t i = 0, n = 0; n < job->nnodes; i++) {
+      if (mock.owner[i] == 0) {
+        mock.owner[i] = job->id;
+        job->nodes[n++] = i;
+      }
+    }
+    job->state = JOB_RUNNING;
+
+    mock_log("job %"PRIu32" started on %"PRIu32" nodes", job->id, job->nnodes);
+    pthread_cond_broadcast(&mock.cond);
+  }
+}
+
+/**
+ * Return the allocation of running JOB, or NULL if out of memory.
+ */
+static resource_allocation_response_msg_t *
+job_alloc_msg(struct mock_job *job)
+{
+  resource_allocation_response_msg_t *msg = calloc(1, sizeof(*msg));
+  struct hostlist *hl = slurm_hostlist_create(NULL);
+
+  if (!msg || !hl)
+    goto error;
+
+  for (uint32_t i = 0; i < job->nnodes; i++) {
+    if (hl_push(hl, mock.nodes->hosts[job->nodes[i]]))
+      goto error;
+  }
+
+  msg->job_id = job->id;
+  msg->node_cnt = job->nnodes;
+  msg->node_list = hl_string(hl);
+  /* nodes are homogeneous, a single group */
+  msg->num_cpu_groups = 1;
+  msg->cpus_per_node = calloc(1, sizeof(*msg->cpus_per_node));
+  msg->cpu_count_reps = calloc(1, sizeof(*msg->cpu_count_reps));
+  if (!msg->node_list || !msg->cpus_per_node || !msg->cpu_count_reps)
+    goto error;
+
+  msg->cpus_per_node[0] = mock.ncpus;
+  msg->cpu_count_reps[0] = job->nnodes;
+
+  slurm_hostlist_destroy(hl);
+  return msg;
+
+ error:
+  slurm_hostlist_destroy(hl);
+  slurm_free_resource_allocation_response_msg(msg);
+  return NULL;
+}
+
+
+/* API */
+
+void
+slurm_init(const char *conf __attribute__((unused)))
+{
+  pthread_once(&mock.once, mock_init);
+}
+
+void
+slurm_fini(void)
+{
+}
+
+int
+slurm_get_errno(void)
+{
+  return errno;
+}
+
+char *
+slurm_strerror(int errnum)
+{
+  switch (errnum) {
+  case SLURM_COMMUNICATIONS_CONNECTION_ERROR:
+    return "Unable to contact slurm controller (mock failure)";
+  case ESLURM_INVALID_JOB_ID:
+    return "Invalid job id specified";
+  case ESLURM_ALREADY_DONE:
+    return "Job/step already completing or completed";
+  case ESLURM_JOB_PENDING:
+    return "Job is pending execution";
+  case ESLURM_INVALID_NODE_NAME:
+    return "Invalid node name specified";
+  case ESLURM_INVALID_NODE_COUNT:
+    return "Node count specification invalid";
+  case ESLURM_REQUESTED_NODE_CONFIG_UNAVAILABLE:
+    return "Requested node configuration is not available";
+  default:
+    return strerror(errnum);
+  }
+}
+
+void
+slurm_init_job_desc_msg(job_desc_msg_t *job_desc_msg)
+{
+  memset(job_desc_msg, 0, sizeof(*job_desc_msg));
+  job_desc_msg->job_id = NO_VAL;
+  job_desc_msg->min_cpus = NO_VAL;
+  job_desc_msg->min_nodes = NO_VAL;
+}
+
+resource_allocation_response_msg_t *
+slurm_allocate_resources_blocking(const job_desc_msg_t *user_req, time_t timeout,
+                                  void (*pending_callback)(uint32_t job_id))
+{
+  resource_allocation_response_msg_t *msg = NULL;
+  struct mock_job *job;
+  uint32_t nnodes;
+  int err = 0;
+
+  if (mock_call(__func__))
+    return NULL;
+
+  /* whole nodes, as many as needed for the CPUs */
+  nnodes = user_req->min_nodes != NO_VAL && user_req->min_nodes > 0 ? user_req->min_nodes : 1;
+  if (user_req->min_cpus != NO_VAL && user_req->min_cpus > nnodes * mock.ncpus)
+    nnodes = (user_req->min_cpus + mock.ncpus - 1) / mock.ncpus;
+
+  if (nnodes > mock.nodes->nhosts) {
+    errno = ESLURM_REQUESTED_NODE_CONFIG_UNAVAILABLE;
+    return NULL;
+  }
+
+  job = calloc(1, sizeof(*job));
+  if (!job) {
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  pthread_mutex_lock(&mock.lock);
+
+  job->id = mock.nextid++;
+  job->state = JOB_PENDING;
+  job->nnodes = nnodes;
+  job->eligible = mock_now() + (uint64_t)mock.pending * 1000000;
+  if (mock.last)
+    mock.last->next = job;
+  else
+    mock.jobs = job;
+  mock.last = job;
+
+  mock_log("job %"PRIu32" submitted for %"PRIu32" nodes", job->id, nnodes);
+
+  schedule();
+
+  if (job->state == JOB_PENDING && pending_callback) {
+    /* Slurm calls it from the waiting thread too */
+    pthread_mutex_unlock(&mock.lock);
+    pending_callback(job->id);
+    pthread_mutex_lock(&mock.lock);
+  }
+
+  uint64_t deadline = timeout > 0 ? mock_now() + (uint64_t)timeout * 1000000000 : 0;
+
+  while (job->state == JOB_PENDING) {
+    /* wake up when the job becomes eligible, or every 100 ms */
+    uint64_t wake = mock_now() + 100000000;
+    if (job->eligible > mock_now() && job->eligible < wake)
+      wake = job->eligible;
+    if (deadline && deadline < wake)
+      wake = deadline;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint64_t abs = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec + (wake - mock_now());
+    ts.tv_sec = abs / 1000000000;
+    ts.tv_nsec = abs % 1000000000;
+    pthread_cond_timedwait(&mock.cond, &mock.lock, &ts);
+
+    schedule();
+
+    if (job->state == JOB_PENDING && deadline && mock_now() >= deadline) {
+      mock_log("job %"PRIu32" timed out", job->id);
+      job_end(job, JOB_CANCELLED);
+      err = ETIMEDOUT;
+    }
+  }
+
+  if (job->state == JOB_RUNNING) {
+    msg = job_alloc_msg(job);
+    if (!msg)
+      err = ENOMEM;
+  } else if (!err) {
+    mock_log("job %"PRIu32" cancelled while pending", job->id);
+    err = ESLURM_ALREADY_DONE;
+  }
+
+  pthread_mutex_unlock(&mock.lock);
+
+  if (!msg)
+    errno = err;
+  return msg;
+}
+
+void
+slurm_free_resource_allocation_response_msg(resource_allocation_response_msg_t *msg)
+{
+  if (!msg)
+    return;
+
+  free(msg->node_list);
+  free(msg->cpus_per_node);
+  free(msg->cpu_count_reps);
+  free(msg);
+}
+
+int
+slurm_allocation_lookup(uint32_t job_id, resource_allocation_response_msg_t **resp)
+{
+  int err = 0;
+
+  if (mock_call(__func__))
+    return SLURM_ERROR;
+
+  *resp = NULL;
+
+  pthread_mutex_lock(&mock.lock);
+
+  struct mock_job *job = job_find(job_id);
+  if (!job) {
+    err = ESLURM_INVALID_JOB_ID;
+  } else if (job->state == JOB_PENDING) {
+    err = ESLURM_JOB_PENDING;
+  } else if (job->state != JOB_RUNNING) {
+    err = ESLURM_ALREADY_DONE;
+  } else {
+    *resp = job_alloc_msg(job);
+    if (!*resp)
+      err = ENOMEM;
+  }
+
+  pthread_mutex_unlock(&mock.lock);
+
+  if (err) {
+    errno = err;
+    return SLURM_ERROR;
+  }
+  return SLURM_SUCCESS;
+}
+
+int
+slurm_load_job(job_info_msg_t **resp, uint32_t job_id,
+               uint16_t show_flags __attribute__((unused)))
+{
+  job_info_msg_t *msg;
+  int err = 0;
+
+  if (mock_call(__func__))
+    return SLURM_ERROR;
+
+  *resp = NULL;
+
+  msg = calloc(1, sizeof(*msg));
+  if (msg)
+    msg->job_array = calloc(1, sizeof(*msg->job_array));
+  if (!msg || !msg->job_array) {
+    slurm_free_job_info_msg(msg);
+    errno = ENOMEM;
+    return SLURM_ERROR;
+  }
+
+  pthread_mutex_lock(&mock.lock);
+
+  struct mock_job *job = job_find(job_id);
+  if (!job) {
+    err = ESLURM_INVALID_JOB_ID;
+  } else {
+    resource_allocation_response_msg_t *alloc = NULL;
+    slurm_job_info_t *info = &msg->job_array[0];
+
+    if (job->state == JOB_RUNNING) {
+      alloc = job_alloc_msg(job);
+      if (!alloc)
+        err = ENOMEM;
+    }
+
+    msg->record_count = 1;
+    info->job_id = job->id;
+    info->job_state = job->state;
+    info->num_nodes = job->nnodes;
+    info->num_cpus = job->nnodes * mock.ncpus;
+    if (alloc) {
+      info->nodes = alloc->node_list;
+      alloc->node_list = NULL;
+      slurm_free_resource_allocation_response_msg(alloc);
+    }
+  }
+
+  pthread_mutex_unlock(&mock.lock);
+
+  if (err) {
+    slurm_free_job_info_msg(msg);
+    errno = err;
+    return SLURM_ERROR;
+  }
+
+  *resp = msg;
+  return SLURM_SUCCESS;
+}
+
+void
+slurm_free_job_info_msg(job_info_msg_t *job_buffer_ptr)
+{
+  if (!job_buffer_ptr)
+    return;
+
+  if (job_buffer_ptr->job_array) {
+    for (uint32_t i = 0; i < job_buffer_ptr->record_count; i++)
+      free(job_buffer_ptr->job_array[i].nodes);
+    free(job_buffer_ptr->job_array);
+  }
+  free(job_buffer_ptr);
+}
+
+/**
+ * Keep the nodes of JOB that are in HOSTS and give back the others.
+ *
+ * Return 0, or an error code if HOSTS is not a non-empty subset of the
+ * nodes of JOB.
+ */
+static int
+job_shrink_to(struct mock_job *job, const char *hosts)
+{
+  struct hostlist *hl = slurm_hostlist_create(hosts);
+  uint32_t n = 0;
+
+  if (!hl)
+    return ESLURM_INVALID_NODE_NAME;
+
+  for (size_t i = 0; i < hl->nhosts; i++) {
+    size_t j;
+    for (j = 0; j < job->nnodes; j++) {
+      if (!strcmp(hl->hosts[i], mock.nodes->hosts[job->nodes[j]]))
+        break;
+    }
+    if (j == job->nnodes) {
+      slurm_hostlist_destroy(hl);
+      return ESLURM_INVALID_NODE_NAME;
+    }
+  }
+
+  if (hl->nhosts == 0) {
+    slurm_hostlist_destroy(hl);
+    return ESLURM_INVALID_NODE_COUNT;
+  }
+
+  for (uint32_t j = 0; j < job->nnodes; j++) {
+    size_t node = job->nodes[j];
+    if (slurm_hostlist_find(hl, mock.nodes->hosts[node]) >= 0)
+      job->nodes[n++] = node;
+    else
+      mock.owner[node] = 0;
+  }
+  job->nnodes = n;
+
+  slurm_hostlist_destroy(hl);
+  return 0;
+}
+
+int
+slurm_update_job2(job_desc_msg_t *job_msg, job_array_resp_msg_t **resp)
+{
+  int err = 0;
+
+  if (mock_call(__func__))
+    return SLURM_ERROR;
+
+  if (resp)
+    *resp = NULL;
+
+  pthread_mutex_lock(&mock.lock);
+
+  struct mock_job *job = job_find(job_msg->job_id);
+  if (!job) {
+    err = ESLURM_INVALID_JOB_ID;
+  } else if (job->state == JOB_PENDING) {
+    err = ESLURM_JOB_PENDING;
+  } else if (job->state != JOB_RUNNING) {
+    err = ESLURM_ALREADY_DONE;
+  } else if (job_msg->req_nodes) {
+    /* scontrol update JobId=X NodeList=Y */
+    err = job_shrink_to(job, job_msg->req_nodes);
+    if (!err)
+      mock_log("job %"PRIu32" shrunk to %s", job->id, job_msg->req_nodes);
+  } else if (job_msg->min_nodes == 0) {
+    /* scontrol update JobId=X NumNodes=0, the nodes are given away */
+    mock_log("job %"PRIu32" released all its nodes", job->id);
+    job_end(job, JOB_COMPLETE);
+  } else if (job_msg->min_nodes != NO_VAL) {
+    /* scontrol update JobId=X NumNodes=N, keep the first N nodes */
+    if (job_msg->min_nodes > job->nnodes) {
+      err = ESLURM_INVALID_NODE_COUNT;
+    } else {
+      for (uint32_t j = job_msg->min_nodes; j < job->nnodes; j++)
+        mock.owner[job->nodes[j]] = 0;
+      job->nnodes = job_msg->min_nodes;
+      mock_log("job %"PRIu32" shrunk to %"PRIu32" nodes", job->id, job->nnodes);
+    }
+  }
+
+  if (!err)
+    schedule();
+
+  pthread_mutex_unlock(&mock.lock);
+
+  if (err) {
+    errno = err;
+    return SLURM_ERROR;
+  }
+  return SLURM_SUCCESS;
+}
+
+void
+slurm_free_job_array_resp(job_array_resp_msg_t *resp)
+{
+  free(resp);
+}
+
+int
+slurm_kill_job(uint32_t job_id, uint16_t signal, uint16_t flags __attribute__((unused)))
+{
+  int err = 0;
+
+  if (mock_call(__func__))
+    return SLURM_ERROR;
+
+  pthread_mutex_lock(&mock.lock);
+
+  struct mock_job *job = job_find(job_id);
+  if (!job) {
+    err = ESLURM_INVALID_JOB_ID;
+  } else if (job->state != JOB_PENDING && job->state != JOB_RUNNING) {
+    err = ESLURM_ALREADY_DONE;
+  } else {
+    /* any signal ends the job, there is no process to deliver it to */
+    mock_log("job %"PRIu32" killed with signal %"PRIu16, job->id, signal);
+    job_end(job, JOB_CANCELLED);
+    schedule();
+  }
+
+  pthread_mutex_unlock(&mock.lock);
+
+  if (err) {
+    errno = err;
+    return SLURM_ERROR;
+  }
+  return SLURM_SUCCESS;
+}
+
+void
+slurm_free_job_step_info_response_msg(job_step_info_response_msg_t *msg)
+{
+  free(msg);
+}
@@ -0,0 +1,376 @@
+#include <inttypes.h>           /* PRIuXX */
+#include <stdlib.h>             /* calloc, strtoull */
+#include <string.h>             /* strdup, strcpy */
+#include <time.h>               /* clock_gettime */
+#include <unistd.h>             /* sleep */
+#include <margo.h>
+
+#include "rpc.h"                /* LOG_ERROR */
+#include "icdb.h"
+#include "mstream.h"
+
+/* bound on a blocking read, so that the reader notices termination */
+#define MSTREAM_BLOCK_MS 1000
+
+/* delay before reading again after an error */
+#define MSTREAM_RETRY_S 1
+
+/* copy of a stream entry, keys, values and strings are allocated
+   along with it */
+struct mstream_entry {
+  struct mstream_entry    *next;
+  struct icdb_mstream_msg  msg;
+};
+
+struct mstream {
+  margo_instance_id    mid;
+  struct icdb_context *icdb;        /* blocking reads */
+  struct icdb_context *icdb_ack;    /* acknowledgments */
+  char                *streamkey;
+  char                *group;       /* NULL if no consumer group */
+  char                *consumer;
+  char                 readid[ICDB_MSTREAM_ID_LEN]; /* last ID read */
+  char                 lastid[ICDB_MSTREAM_ID_LEN]; /* last ID delivered */
+
+  struct {
+    mstream_handler_t  fn;
+    void              *arg;
+  } handlers[MSTREAM_HANDLERS_MAX];
+  size_t               nhandlers;
+
+  ABT_pool             pool;        /* dispatcher pool */
+  ABT_pool             rpool;       /* reader pool */
+  ABT_xstream          xstream;     /* reader execution stream */
+  ABT_thread           reader;
+  ABT_thread           dispatcher;
+
+  ABT_mutex            lock;        /* protects the queue & lastid */
+  ABT_cond             cond;
+  struct mstream_entry *head;
+  struct mstream_entry *tail;
+  int                  terminate;
+};
+
+static void reader_th(void *arg);
+static void dispatcher_th(void *arg);
+static void enqueue(const struct icdb_mstream_msg *msg, void *arg);
+
+
+int
+mstream_init(struct mstream **mstream, margo_instance_id mid, ABT_pool pool,
+             char *dbaddr, const char *streamkey,
+             const char *group, const char *consumer)
+{
+  int rc;
+
+  *mstream = NULL;
+
+  if (!streamkey || (group && !consumer)) {
+    LOG_ERROR(mid, "Bad parameters");
+    return -1;
+  }
+
+  struct mstream *ms = calloc(1, sizeof(*ms));
+  if (!ms) {
+    LOG_ERROR(mid, "Failed calloc");
+    return -1;
+  }
+
+  ms->mid = mid;
+  ms->pool = pool;
+  strcpy(ms->readid, "$");
+
+  ms->streamkey = strdup(streamkey);
+  ms->group = group ? strdup(group) : NULL;
+  ms->consumer = consumer ? strdup(consumer) : NULL;
+  if (!ms->streamkey || (group && !ms->group) || (consumer && !ms->consumer)) {
+    LOG_ERROR(mid, "Failed strdup");
+    goto error;
+  }
+
+  rc = ABT_mutex_create(&ms->lock);
+  if (rc != ABT_SUCCESS) {
+    ms->lock = ABT_MUTEX_NULL;
+    LOG_ERROR(mid, "Could not create mutex (ret = %d)", rc);
+    goto error;
+  }
+  rc = ABT_cond_create(&ms->cond);
+  if (rc != ABT_SUCCESS) {
+    ms->cond = ABT_COND_NULL;
+    LOG_ERROR(mid, "Could not create condition (ret = %d)", rc);
+    goto error;
+  }
+
+  /* the reader connection blocks, it cannot be shared */
+  rc = icdb_init(&ms->icdb, dbaddr);
+  if (rc != ICDB_SUCCESS) {
+    LOG_ERROR(mid, "Could not initialize IC database: %s",
+              ms->icdb ? icdb_errstr(ms->icdb) : "?");
+    goto error;
+  }
+
+  if (ms->group) {
+    rc = icdb_init(&ms->icdb_ack, dbaddr);
+    if (rc != ICDB_SUCCESS) {
+      LOG_ERROR(mid, "Could not initialize IC database: %s",
+                ms->icdb_ack ? icdb_errstr(ms->icdb_ack) : "?");
+      goto error;
+    }
+
+    rc = icdb_mstream_group(ms->icdb, ms->streamkey, ms->group);
+    if (rc != ICDB_SUCCESS) {
+      LOG_ERROR(mid, "Could not create group %s on %s: %s", ms->group,
+                ms->streamkey, icdb_errstr(ms->icdb));
+      goto error;
+    }
+  }
+
+  *mstream = ms;
+  return 0;
+
+ error:
+  mstream_fini(&ms);
+  return -1;
+}
+
+
+int
+mstream_add_handler(struct mstream *ms, mstream_handler_t handler, void *arg)
+{
+  if (!ms || !handler)
+    return -1;
+
+  if (ms->nhandlers >= MSTREAM_HANDLERS_MAX) {
+    LOG_ERROR(ms->mid, "Too many handlers on stream %s", ms->streamkey);
+    return -1;
+  }
+
+  ms->handlers[ms->nhandlers].fn = handler;
+  ms->handlers[ms->nhandlers].arg = arg;
+  ms->nhandlers++;
+
+  return 0;
+}
+
+
+int
+mstream_start(struct mstream *ms)
+{
+  int rc;
+
+  if (!ms)
+    return -1;
+
+  rc = ABT_thread_create(ms->pool, dispatcher_th, ms, ABT_THREAD_ATTR_NULL,
+                         &ms->dispatcher);
+  if (rc != ABT_SUCCESS) {
+    ms->dispatcher = ABT_THREAD_NULL;
+    LOG_ERROR(ms->mid, "Could not create dispatcher ULT (ret = %d)", rc);
+    return -1;
+  }
+
+  /* blocking reads get their own execution stream, so that they
+     never hold up RPC handlers */
+  rc = ABT_pool_create_basic(ABT_POOL_FIFO_WAIT, ABT_POOL_ACCESS_MPMC, ABT_TRUE,
+                             &ms->rpool);
+  if (rc != ABT_SUCCESS) {
+    LOG_ERROR(ms->mid, "ABT_pool_create_basic error: ret=%d", rc);
+    return -1;
+  }
+
+  rc = ABT_xstream_create_basic(ABT_SCHED_BASIC_WAIT, 1, &ms->rpool,
+                                ABT_SCHED_CONFIG_NULL, &ms->xstream);
+  if (rc != ABT_SUCCESS) {
+    ms->xstream = ABT_XSTREAM_NULL;
+    LOG_ERROR(ms->mid, "ABT_xstream_create_basic error: ret=%d", rc);
+    return -1;
+  }
+
+  rc = ABT_thread_create(ms->rpool, reader_th, ms, ABT_THREAD_ATTR_NULL,
+                         &ms->reader);
+  if (rc != ABT_SUCCESS) {
+    ms->reader = ABT_THREAD_NULL;
+    LOG_ERROR(ms->mid, "Could not create reader ULT (ret = %d)", rc);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+void
+mstream_fini(struct mstream **mstream)
+{
+  if (!mstream || !*mstream)
+    return;
+
+  struct mstream *ms = *mstream;
+
+  if (ms->lock != ABT_MUTEX_NULL) {
+    ABT_mutex_lock(ms->lock);
+    ms->terminate = 1;
+    ABT_cond_signal(ms->cond);
+    ABT_mutex_unlock(ms->lock);
+  }
+
+  if (ms->reader != ABT_THREAD_NULL) {
+    ABT_thread_join(ms->reader);
+    ABT_thread_free(&ms->reader);
+  }
+  if (ms->xstream != ABT_XSTREAM_NULL) {
+    ABT_xstream_join(ms->xstream);
+    ABT_xstream_free(&ms->xstream);
+  }
+  if (ms->dispatcher != ABT_THREAD_NULL) {
+    ABT_thread_join(ms->dispatcher);
+    ABT_thread_free(&ms->dispatcher);
+  }
+
+  margo_debug(ms->mid, "Stream %s: last entry delivered %s", ms->streamkey,
+              ms->lastid[0] ? ms->lastid : "none");
+
+  while (ms->head) {
+    struct mstream_entry *e = ms->head;
+    ms->head = e->next;
+    free(e);
+  }
+
+  if (ms->cond != ABT_COND_NULL)
+    ABT_cond_free(&ms->cond);
+  if (ms->lock != ABT_MUTEX_NULL)
+    ABT_mutex_free(&ms->lock);
+
+  icdb_fini(&ms->icdb);
+  icdb_fini(&ms->icdb_ack);
+
+  free(ms->streamkey);
+  free(ms->group);
+  free(ms->consumer);
+  free(ms);
+
+  *mstream = NULL;
+}
+
+
+static void
+reader_th(void *arg)
+{
+  struct mstream *ms = (struct mstream *)arg;
+  int ret;
+
+  margo_debug(ms->mid, "Stream %s: listening%s%s", ms->streamkey,
+              ms->group ? " in group " : "", ms->group ? ms->group : "");
+
+  while (!ms->terminate) {
+    ret = icdb_mstream_consume(ms->icdb, ms->streamkey, ms->group,
+                               ms->consumer, ms->readid, MSTREAM_BLOCK_MS,
+                               enqueue, ms);
+    if (ret != ICDB_SUCCESS && ret != ICDB_NORESULT) {
+      /* the connection is reestablished by the next read, with a
+         backoff of its own */
+      LOG_ERROR(ms->mid, "Stream %s: %s", ms->streamkey, icdb_errstr(ms->icdb));
+      sleep(MSTREAM_RETRY_S);
+    }
+  }
+}
+
+
+/**
+ * Copy MSG at the end of the queue. Called by the reader.
+ */
+static void
+enqueue(const struct icdb_mstream_msg *msg, void *arg)
+{
+  struct mstream *ms = (struct mstream *)arg;
+  size_t len, size;
+
+  /* one allocation for the entry, pointer arrays and strings */
+  size = sizeof(struct mstream_entry) + 2 * msg->nfields * sizeof(char *);
+  size += strlen(msg->id) + 1;
+  for (size_t i = 0; i < msg->nfields; i++) {
+    size += strlen(msg->keys[i]) + strlen(msg->vals[i]) + 2;
+  }
+
+  struct mstream_entry *e = malloc(size);
+  if (!e) {
+    LOG_ERROR(ms->mid, "Stream %s: dropping message %s, out of memory",
+              ms->streamkey, msg->id);
+    return;
+  }
+
+  e->next = NULL;
+  e->msg.nfields = msg->nfields;
+  e->msg.keys = (const char **)(e + 1);
+  e->msg.vals = e->msg.keys + msg->nfields;
+
+  char *p = (char *)(e->msg.vals + msg->nfields);
+  len = strlen(msg->id) + 1;
+  e->msg.id = memcpy(p, msg->id, len);
+  p += len;
+  for (size_t i = 0; i < msg->nfields; i++) {
+    len = strlen(msg->keys[i]) + 1;
+    e->msg.keys[i] = memcpy(p, msg->keys[i], len);
+    p += len;
+    len = strlen(msg->vals[i]) + 1;
+    e->msg.vals[i] = memcpy(p, msg->vals[i], len);
+    p += len;
+  }
+
+  ABT_mutex_lock(ms->lock);
+  if (ms->tail)
+    ms->tail->next = e;
+  else
+    ms->head = e;
+  ms->tail = e;
+  ABT_cond_signal(ms->cond);
+  ABT_mutex_unlock(ms->lock);
+}
+
+
+static void
+dispatcher_th(void *arg)
+{
+  struct mstream *ms = (struct mstream *)arg;
+  struct mstream_entry *e;
+  struct timespec now;
+
+  while (1) {
+    ABT_mutex_lock(ms->lock);
+    while (!ms->head && !ms->terminate) {
+      ABT_cond_wait(ms->cond, ms->lock);
+    }
+    e = ms->head;
+    if (!e) {                   /* terminating and queue drained */
+      ABT_mutex_unlock(ms->lock);
+      break;
+    }
+    ms->head = e->next;
+    if (!ms->head)
+      ms->tail = NULL;
+    ABT_mutex_unlock(ms->lock);
+
+    for (size_t i = 0; i < ms->nhandlers; i++) {
+      ms->handlers[i].fn(&e->msg, ms->handlers[i].arg);
+    }
+
+    if (ms->group) {
+      if (icdb_mstream_ack(ms->icdb_ack, ms->streamkey, ms->group, e->msg.id) != ICDB_SUCCESS) {
+        LOG_ERROR(ms->mid, "Stream %s: %s", ms->streamkey, icdb_errstr(ms->icdb_ack));
+      }
+    }
+
+    /* the first part of an entry ID is its creation time in ms */
+    if (!clock_gettime(CLOCK_REALTIME, &now)) {
+      uint64_t t = strtoull(e->msg.id, NULL, 10);
+      uint64_t nowms = (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+      margo_debug(ms->mid, "Stream %s: entry %s delivered after %"PRIu64" ms",
+                  ms->streamkey, e->msg.id, nowms > t ? nowms - t : 0);
+    }
+
+    ABT_mutex_lock(ms->lock);
+    strcpy(ms->lastid, e->msg.id);
+    ABT_mutex_unlock(ms->lock);
+
+    free(e);
+  }
+}
@@ -2,6 +2,7 @@
 
 #include "icc.h"
 #include "rpc.h"
+#include "addrcache.h"
 
 #define ICC_ADDR_FILENAME  "icc.addr"
 
@@ -114,3 +115,346 @@ rpc_send(margo_instance_id mid, hg_addr_t addr, hg_id_t rpcid,
 
   return 0;
 }
+
+
+struct rpc_req {
+  hg_handle_t     handle;       /* kept across batches, or HG_HANDLE_NULL */
+  margo_request   req;
+  rpc_done_func_t cb;
+  void            *arg;
+};
+
+
+void
+rpc_batch_init(struct rpc_batch *batch, margo_instance_id mid)
+{
+  batch->mid = mid;
+  batch->reqs = NULL;
+  batch->nreqs = 0;
+  batch->size = 0;
+  batch->addrcache = NULL;
+}
+
+
+void
+rpc_batch_fini(struct rpc_batch *batch)
+{
+  rpc_wait_all(batch);
+
+  for (size_t i = 0; i < batch->size; i++) {
+    if (batch->reqs[i].handle != HG_HANDLE_NULL)
+      margo_destroy(batch->reqs[i].handle);
+  }
+  free(batch->reqs);
+  batch->reqs = NULL;
+  batch->size = 0;
+}
+
+
+int
+rpc_isend(struct rpc_batch *batch, hg_addr_t addr, hg_id_t rpcid,
+          void *in, double timeout_ms, rpc_done_func_t cb, void *arg)
+{
+  assert(addr);
+  assert(rpcid);
+
+  if (timeout_ms < 0) {
+    margo_error(batch->mid, "Invalid timeout value: %f", timeout_ms);
+    return -1;
+  }
+
+  if (batch->nreqs == batch->size) {
+    size_t size = batch->size ? batch->size * 2 : 16;
+    struct rpc_req *reqs = realloc(batch->reqs, size * sizeof(*reqs));
+    if (!reqs) {
+      margo_error(batch->mid, "Could not allocate RPC request");
+      return -1;
+    }
+    for (size_t i = batch->size; i < size; i++)
+      reqs[i].handle = HG_HANDLE_NULL;
+    batch->reqs = reqs;
+    batch->size = size;
+  }
+
+  struct rpc_req *r = &batch->reqs[batch->nreqs];
+  hg_return_t hret;
+
+  /* recycle the handle of a previous batch if possible */
+  if (r->handle == HG_HANDLE_NULL) {
+    hret = margo_create(batch->mid, addr, rpcid, &r->handle);
+    if (hret != HG_SUCCESS)
+      r->handle = HG_HANDLE_NULL;
+  } else {
+    hret = margo_reset(r->handle, addr, rpcid);
+  }
+  if (hret != HG_SUCCESS) {
+    margo_error(batch->mid, "Margo RPC creation failure: %s", HG_Error_to_string(hret));
+    goto error;
+  }
+
+  hret = margo_iforward_timed(r->handle, in, timeout_ms, &r->req);
+  if (hret != HG_SUCCESS) {
+    margo_error(batch->mid, "Margo RPC forwarding failure: %s", HG_Error_to_string(hret));
+    goto error;
+  }
+
+  r->cb = cb;
+  r->arg = arg;
+  batch->nreqs++;
+
+  return 0;
+
+ error:
+  if (r->handle != HG_HANDLE_NULL) {
+    margo_destroy(r->handle);
+    r->handle = HG_HANDLE_NULL;
+  }
+  return -1;
+}
+
+
+size_t
+rpc_wait_all(struct rpc_batch *batch)
+{
+  size_t nfailed = 0;
+
+  /* the RPCs are all in flight, waiting in order costs the slowest */
+  for (size_t i = 0; i < batch->nreqs; i++) {
+    struct rpc_req *r = &batch->reqs[i];
+    int ret = 0, retcode = RPC_FAILURE;
+    hg_return_t hret;
+
+    hret = margo_wait(r->req);
+    if (hret != HG_SUCCESS) {
+      margo_error(batch->mid, "Margo RPC forwarding failure: %s", HG_Error_to_string(hret));
+      ret = -1;
+    } else {
+      rpc_out_t resp;
+      hret = margo_get_output(r->handle, &resp);
+      if (hret != HG_SUCCESS) {
+        margo_error(batch->mid, "Could not get RPC output: %s", HG_Error_to_string(hret));
+        ret = -1;
+      } else {
+        retcode = resp.rc;
+        hret = margo_free_output(r->handle, &resp);
+        if (hret != HG_SUCCESS) {
+          margo_error(batch->mid, "Could not free RPC output: %s", HG_Error_to_string(hret));
+        }
+      }
+    }
+
+    /* do not recycle a handle left in an unknown state */
+    if (ret) {
+      margo_destroy(r->handle);
+      r->handle = HG_HANDLE_NULL;
+    }
+
+    if (ret || retcode)
+      nfailed++;
+
+    if (r->cb)
+      r->cb(batch->mid, ret, retcode, r->arg);
+  }
+  batch->nreqs = 0;
+
+  return nfailed;
+}
+
+
+/* a range of clients, the first one gets the rest as its subtree */
+struct mc_range {
+  size_t    start;
+  size_t    end;
+  hg_addr_t addr;
+  int       ret;
+  int       retcode;
+};
+
+
+/**
+ * Return the depth of a multicast tree of N clients.
+ */
+static unsigned
+mc_depth(size_t n, size_t fanout)
+{
+  unsigned depth = 0;
+
+  while (n > 0) {
+    depth++;
+    n = (n - 1 + fanout - 1) / fanout;
+  }
+  return depth;
+}
+
+/**
+ * Split clients START to END in up to FANOUT ranges appended to
+ * RANGES of size *SIZE, with *N ranges in use.
+ */
+static int
+mc_split(struct mc_range **ranges, size_t *n, size_t *size,
+         size_t start, size_t end, size_t fanout)
+{
+  size_t count = end - start;
+  size_t nsplit = count < fanout ? count : fanout;
+
+  if (*n + nsplit > *size) {
+    size_t newsize = *size ? *size : fanout;
+    while (newsize < *n + nsplit)
+      newsize *= 2;
+    struct mc_range *tmp = realloc(*ranges, newsize * sizeof(**ranges));
+    if (!tmp)
+      return -1;
+    *ranges = tmp;
+    *size = newsize;
+  }
+
+  for (size_t i = 0; i < nsplit; i++) {
+    struct mc_range *r = &(*ranges)[(*n)++];
+    r->start = start + count * i / nsplit;
+    r->end = start + count * (i + 1) / nsplit;
+    r->addr = HG_ADDR_NULL;
+    r->ret = -1;
+    r->retcode = RPC_FAILURE;
+  }
+  return 0;
+}
+
+static void
+mc_done(margo_instance_id mid, int ret, int retcode, void *arg)
+{
+  struct mc_range *r = (struct mc_range *)arg;
+  (void)mid;
+
+  r->ret = ret;
+  r->retcode = retcode;
+}
+
+
+size_t
+rpc_multicast(struct rpc_batch *batch, hg_id_t rpcid, multicast_in_t *in,
+              const char **addrs, size_t naddrs, double timeout_ms,
+              void (*local)(void *), void *arg)
+{
+  struct mc_range *cur = NULL, *next = NULL, *tmp;
+  size_t ncur = 0, nnext = 0, curlen = 0, nextlen = 0;
+  size_t fanout, nfailed = 0;
+  char *subtree = NULL;
+  size_t subtreelen = 0;
+
+  fanout = in->fanout > 0 ? in->fanout : RPC_MULTICAST_FANOUT;
+  in->fanout = fanout;
+
+  if (mc_split(&cur, &ncur, &curlen, 0, naddrs, fanout)) {
+    margo_error(batch->mid, "Multicast: Could not allocate ranges");
+    nfailed = naddrs;
+    goto end;
+  }
+
+  /* each round sends to the first reachable client of each range,
+     ranges whose first client turned out to be dead are split again
+     for the next round */
+  while (ncur > 0) {
+    for (size_t i = 0; i < ncur; i++) {
+      struct mc_range *r = &cur[i];
+
+      for (; r->start < r->end; r->start++) {
+        hg_return_t hret;
+
+        hret = addrcache_lookup(batch->addrcache, batch->mid, addrs[r->start], &r->addr);
+        if (hret != HG_SUCCESS) {
+          margo_error(batch->mid, "Multicast: %s: address lookup failed: %s",
+                      addrs[r->start], HG_Error_to_string(hret));
+          r->addr = HG_ADDR_NULL;
+          nfailed++;
+          continue;
+        }
+
+        /* the rest of the range, one address per line */
+        size_t len = 1;
+        for (size_t j = r->start + 1; j < r->end; j++)
+          len += strlen(addrs[j]) + 1;
+        if (len > subtreelen) {
+          char *buf = realloc(subtree, len);
+          if (!buf) {
+            /* the client is fine, do not report it unreachable */
+            margo_error(batch->mid, "Multicast: Could not allocate subtree");
+            margo_addr_free(batch->mid, r->addr);
+            r->addr = HG_ADDR_NULL;
+            nfailed += r->end - r->start;
+            r->start = r->end;
+            break;
+          }
+          subtree = buf;
+          subtreelen = len;
+        }
+        char *p = subtree;
+        for (size_t j = r->start + 1; j < r->end; j++)
+          p += sprintf(p, "%s%s", j > r->start + 1 ? "\n" : "", addrs[j]);
+        *p = '\0';
+        in->subtree = subtree;
+
+        /* leave time for the hops below the child */
+        double timeout = timeout_ms * (1 + 2 * mc_depth(r->end - r->start - 1, fanout));
+
+        if (rpc_isend(batch, r->addr, rpcid, in, timeout, mc_done, r) == 0)
+          break;
+
+        margo_addr_free(batch->mid, r->addr);
+        r->addr = HG_ADDR_NULL;
+        nfailed++;
+      }
+    }
+
+    if (local) {
+      local(arg);
+      local = NULL;
+    }
+
+    rpc_wait_all(batch);
+
+    nnext = 0;
+    for (size_t i = 0; i < ncur; i++) {
+      struct mc_range *r = &cur[i];
+
+      if (r->start >= r->end)
+        continue;
+
+      if (r->addr != HG_ADDR_NULL)
+        margo_addr_free(batch->mid, r->addr);
+
+      if (r->ret == 0) {
+        /* the child reports the failures of its subtree */
+        if (r->retcode > 0)
+          nfailed += r->retcode;
+        else if (r->retcode < 0)
+          nfailed++;
+        continue;
+      }
+
+      margo_warning(batch->mid, "Multicast: %s unreachable, adopting its %zu descendant%s",
+                    addrs[r->start], r->end - r->start - 1, r->end - r->start - 1 != 1 ? "s" : "");
+      nfailed++;
+      addrcache_fail(batch->addrcache, addrs[r->start]);
+
+      if (mc_split(&next, &nnext, &nextlen, r->start + 1, r->end, fanout)) {
+        margo_error(batch->mid, "Multicast: Could not allocate ranges");
+        nfailed += r->end - r->start - 1;
+      }
+    }
+
+    tmp = cur; cur = next; next = tmp;
+    ncur = nnext;
+    size_t len = curlen; curlen = nextlen; nextlen = len;
+  }
+
+ end:
+  if (local)
+    local(arg);
+
+  in->subtree = NULL;
+  free(subtree);
+  free(cur);
+  free(next);
+
+  return nfailed;
+}
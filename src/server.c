@@ -12,38 +12,61 @@
 #include "icrm.h"
 #include "cbcommon.h"
 #include "cbserver.h"
+#include "mstream.h"
+#include "icstats.h"
+#include "mallpolicy.h"
 
 #define NTHREADS 10              /* threads set aside for RPC handling */
-
-//malleability cpu useage umbral ratios
-#define MAX_CPU_RATE 90.0
-#define MIN_CPU_RATE 80.0
-
-//malleability it rtime umbral ratios
-#define MAX_VAL_IT_RTIME 1.0
-#define MAX_VAL_IT_CTIME 1.0
-
-#define MAX_IT_RTIME 0.02
-#define MIN_IT_RTIME 0.01
-
-#define MAX_RATIO_CPU_COMM 80.0
-#define MIN_RATIO_CPU_COMM 60.0
-
+#define DB_TIMEOUT_MS 5000       /* DB command timeout */
+#define MALLEABILITY_QUEUE_LEN 1024 /* events pending for the malleability thread */
 
 /* malleability manager stub */
-#define NCLIENTS     4
 #define NCLIENTS_MAX 1024
-#define IOSET_OUTFILE "iosets_out.csv"
 
 static void malleability_th(void *arg);
 
+/* what a ULT applying the malleability policy works with */
+struct mall_work {
+  struct icdb_context     *icdb;
+  struct clcache          *clcache;
+  struct addrcache        *addrcache;
+  struct icdb_client      *clients;   /* grown as needed */
+  size_t                   clients_size;
+  size_t                   nclients;
+  struct icc_mall_client  *mclients;  /* policy view of clients */
+  size_t                   mclients_size;
+  const char             **addrs;
+  size_t                   addrs_size;
+  struct rpc_batch         batch;     /* recycled RPC handles */
+};
+
+static void mall_work_init(struct mall_work *work, margo_instance_id mid,
+                           struct icdb_context *icdb, struct clcache *clcache,
+                           struct addrcache *addrcache);
+static void mall_work_fini(struct mall_work *work);
+static void mall_client(struct icc_mall_client *mc, const struct icdb_client *client);
+static int mall_snapshot(void *arg, uint32_t jobid, struct icc_mall_snapshot *snap);
+static void mall_apply(margo_instance_id mid, hg_id_t rpcids[], struct mall_work *work,
+                       const struct icc_mall_action *actions, size_t nactions);
+static void mall_shrink(margo_instance_id mid, hg_id_t rpcs[], struct mall_work *work,
+                        const char *clid);
+static int mall_monitor_sample(void *ctx, const char *clid, double rtime, double ctime,
+                               uint32_t window, double *avg_rtime, double *avg_ctime,
+                               uint32_t *nsamples);
+static int mall_monitor_reset(void *ctx, const char *clid);
+
 /* message stream */
-struct mstream {
+#define MSTREAM_GROUP "icc_server"  /* servers share the streams */
+
+struct beegfs_data {
   margo_instance_id   mid;
   struct icdb_context **icdbs;  /* DB connection pool */
+  struct clcache      *clcache; /* DB client & job cache */
+  struct addrcache    *addrcache; /* client address cache */
+  struct mallpolicy   *policy;  /* malleability policy */
   hg_id_t             *rpcids;  /* RPC handles */
 };
-static void mstream_th(void *arg);
+static void beegfs_handler(const struct icdb_mstream_msg *msg, void *arg);
 
 
 int
@@ -113,20 +136,47 @@ main(int argc __attribute__((unused)), char** argv __attribute__((unused)))
   /* initialize connection to the resource manager */
   icrm_init();
 
+  /* database of the server, local by default */
+  char *dbaddr = getenv(ICDB_ADDR_ENV);
+  if (!dbaddr || !*dbaddr)
+    dbaddr = ICDB_ADDR_DEFAULT;
+
   /* initialize connections pool to DB. Because the icdb_context is
      not thread safe, we create one connection per OS threads
      (Argobots "execution stream") */
   struct icdb_context *icdbs[NTHREADS] = { NULL };
 
   for (size_t i = 0; i < NTHREADS; i++) {
-    rc = icdb_init(&icdbs[i], "127.0.0.1");
+    rc = icdb_init(&icdbs[i], dbaddr);
     if (!icdbs[i]) {
       LOG_ERROR(mid, "Could not initialize IC database");
       goto error;
     } else if (rc != ICDB_SUCCESS) {
-      LOG_ERROR(mid, "Could not initialize IC database: %s", icdb_errstr(icdbs[i]));
+      LOG_ERROR(mid, "Could not initialize IC database %s: %s", dbaddr,
+                icdb_errstr(icdbs[i]));
       goto error;
     }
+    /* a stuck DB fails the call, the connection is reestablished on
+       the next one */
+    icdb_set_timeout(icdbs[i], DB_TIMEOUT_MS);
+  }
+
+  /* cache of the client & job records, shared by all ULTs */
+  struct clcache *clcache;
+
+  rc = clcache_init(&clcache, mid, dbaddr);
+  if (rc) {
+    LOG_ERROR(mid, "Could not initialize client cache");
+    goto error;
+  }
+
+  /* Mercury addresses of the clients, shared by all ULTs */
+  struct addrcache *addrcache;
+
+  rc = addrcache_init(&addrcache, mid, 0, 0);
+  if (rc) {
+    LOG_ERROR(mid, "Could not initialize address cache");
+    goto error;
   }
 
   /* register Margo RPCs */
@@ -145,6 +195,7 @@ main(int argc __attribute__((unused)), char** argv __attribute__((unused)))
   rpc_ids[RPC_MALLEABILITY_REGION] = MARGO_REGISTER(mid, RPC_MALLEABILITY_REGION_NAME, malleability_region_in_t, rpc_out_t, malleability_region_cb);
   rpc_ids[RPC_HINT_IO_BEGIN] = MARGO_REGISTER(mid, RPC_HINT_IO_BEGIN_NAME, hint_io_in_t, hint_io_out_t, hint_io_begin_cb);
   rpc_ids[RPC_LOWMEM] = MARGO_REGISTER(mid, RPC_LOWMEM_NAME, lowmem_in_t, rpc_out_t, NULL);
+  rpc_ids[RPC_MULTICAST] = MARGO_REGISTER(mid, RPC_MULTICAST_NAME, multicast_in_t, rpc_out_t, NULL);
   /* ALBERTO */
   rpc_ids[RPC_CHECKPOINTING] = MARGO_REGISTER(mid, RPC_CHECKPOINTING_NAME, checkpointing_in_t, rpc_out_t, checkpoint_cb);
   rpc_ids[RPC_MALLEABILITY_QUERY] = MARGO_REGISTER(mid, RPC_MALLEABILITY_QUERY_NAME, malleability_query_in_t, malleability_query_out_t, malleability_query_cb);
@@ -153,24 +204,40 @@ main(int argc __attribute__((unused)), char** argv __attribute__((unused)))
   rpc_ids[RPC_ALERT] = MARGO_REGISTER(mid, RPC_ALERT_NAME, alert_in_t, rpc_out_t, alert_cb);
   rpc_ids[RPC_NODEALERT] = MARGO_REGISTER(mid, RPC_NODEALERT_NAME, nodealert_in_t, rpc_out_t, nodealert_cb);
   rpc_ids[RPC_METRIC_ALERT] = MARGO_REGISTER(mid, RPC_METRIC_ALERT_NAME, metricalert_in_t, rpc_out_t, metricalert_cb);
+  rpc_ids[RPC_STATS] = MARGO_REGISTER(mid, RPC_STATS_NAME, stats_in_t, stats_out_t, stats_cb);
 
   ABT_pool rpc_pool;
   margo_get_handler_pool(mid, &rpc_pool);
 
-  /* malleability thread from the pool of Margo ULTs */
-  struct malleability_data malldat;
+  /* malleability thread from the pool of Margo ULTs, fed by the RPC
+     handlers through a queue. When full, the oldest event goes: a
+     client that is still reconfigurable will enter a region again */
+  struct malleability_data malldat = {
+    .mid = mid,
+    .rpcids = rpc_ids,
+    .icdbs = icdbs,
+    .clcache = clcache,
+    .addrcache = addrcache,
+  };
+
+  rc = evqueue_init(&malldat.events, mid, "malleability", MALLEABILITY_QUEUE_LEN, EVQ_DROP_OLDEST);
+  if (rc) {
+    LOG_ERROR(mid, "Could not initialize malleability queue");
+    goto error;
+  }
 
-  ABT_mutex_create(&(malldat.mutex));
-  ABT_cond_create(&(malldat.cond));
-  // CHANGE JAVI
-  ABT_cond_create(&(malldat.cond2));
-  // END CHANGE JAVI
-  malldat.sleep = 1;
+  /* decisions are left to a policy, possibly loaded from a library */
+  struct icc_mall_services mallsrv = {
+    .ctx = icdbs,
+    .monitor_sample = mall_monitor_sample,
+    .monitor_reset = mall_monitor_reset,
+  };
 
-  malldat.mid = mid;
-  malldat.rpcids = rpc_ids;
-  malldat.icdbs = icdbs;
-  malldat.jobid = 0;
+  rc = mallpolicy_load(&malldat.policy, mid, getenv(ICC_MALL_POLICY_ENV), &mallsrv);
+  if (rc) {
+    LOG_ERROR(mid, "Could not load malleability policy");
+    goto error;
+  }
 
   rc = ABT_thread_create(rpc_pool, malleability_th, &malldat, ABT_THREAD_ATTR_NULL, NULL);
   if (rc != ABT_SUCCESS) {
@@ -178,38 +245,49 @@ main(int argc __attribute__((unused)), char** argv __attribute__((unused)))
     goto error;
   }
 
-  /* Message stream thread, from the Margo pool*/
-  struct mstream msd = {
+  /* Beegfs message stream, read on its own execution stream and
+     handled from the Margo pool */
+  struct beegfs_data bgd = {
     .mid = mid,
     .icdbs = icdbs,
+    .clcache = clcache,
+    .addrcache = addrcache,
+    .policy = malldat.policy,
     .rpcids = rpc_ids,
   };
-  rc = ABT_thread_create(rpc_pool, mstream_th, &msd, ABT_THREAD_ATTR_NULL, NULL);
-  if (rc != ABT_SUCCESS) {
-    LOG_ERROR(mid, "Could not create message stream ULT (ret = %d)", rc);
+  struct mstream *beegfs_ms;
+
+  rc = mstream_init(&beegfs_ms, mid, rpc_pool, dbaddr, ICDB_MSTREAM_BEEGFS,
+                    MSTREAM_GROUP, addr_str);
+  if (rc) {
+    LOG_ERROR(mid, "Could not initialize message stream "ICDB_MSTREAM_BEEGFS);
+    goto error;
+  }
+  mstream_add_handler(beegfs_ms, beegfs_handler, &bgd);
+  rc = mstream_start(beegfs_ms);
+  if (rc) {
+    LOG_ERROR(mid, "Could not start message stream "ICDB_MSTREAM_BEEGFS);
     goto error;
   }
 
   /* attach various pieces of data to RPCs  */
   struct cb_data d = {
     .icdbs = icdbs,
+    .clcache = clcache,
+    .addrcache = addrcache,
     .rpcids = rpc_ids,
     .malldat = &malldat
   };
 
   /* iosets data */
   ABT_mutex_create(&d.iosetlock);
-  ABT_cond_create(&d.iosetq);
-  d.ioset_isrunning = 0;
 
-  ABT_rwlock_create(&d.iosets_lock);
-  if (rc != ABT_SUCCESS) {
-    LOG_ERROR(mid, "Could not create IO-set lock");
-    goto error;
-  }
-  d.iosets = hm_create();
-  if (!d.iosets) {
-    LOG_ERROR(mid, "Could not create IO-set map");
+  const char *budget = getenv(IOSET_BUDGET_ENV);
+  const char *leasestr = getenv(IOSET_LEASE_ENV);
+  uint64_t lease = (leasestr ? strtoull(leasestr, NULL, 10) : IOSET_LEASE_DEFAULT) * 1000000000;
+  rc = ioset_sched_init(&d.iosched, budget ? strtoull(budget, NULL, 10) : 0, lease);
+  if (rc) {
+    LOG_ERROR(mid, "Could not create IO-set scheduler");
     goto error;
   }
 
@@ -219,19 +297,30 @@ main(int argc __attribute__((unused)), char** argv __attribute__((unused)))
     goto error;
   }
   d.ioset_time = hm_create();
-  if (!d.ioset_time) {
+  d.ioset_time_arena = arena_create(0);
+  if (!d.ioset_time || !d.ioset_time_arena) {
     LOG_ERROR(mid, "Could not create IO-set timing map");
     goto error;
   }
 
-  d.ioset_outfile = fopen(IOSET_OUTFILE, "w+");
-  if (!d.ioset_outfile) {
-    LOG_ERROR(mid, "fopen \"%s\" fail: %s", IOSET_OUTFILE, strerror(errno));
+  const char *tracefile = getenv(IOTRACE_FILE_ENV);
+  const char *tracesize = getenv(IOTRACE_MAXSIZE_ENV);
+  rc = iotrace_init(&d.iotrace, mid, tracefile ? tracefile : IOTRACE_FILE_DEFAULT,
+                    (tracesize ? strtoull(tracesize, NULL, 10) : IOTRACE_MAXSIZE_DEFAULT) << 20,
+                    NTHREADS);
+  if (rc) {
+    LOG_ERROR(mid, "Could not start IO-set trace");
     goto error;
   }
-  if (fputs("\"appid\",witer,waitstart,iostart,ioend,nbytes\n", d.ioset_outfile) == EOF) {
-    LOG_ERROR(mid, "fputs \"%s\" fail", IOSET_OUTFILE);
-    goto error;
+
+  /* revoke the IO-sets of the applications that stopped talking */
+  struct ioset_lease iolease;
+  if (lease) {
+    rc = ioset_lease_start(&iolease, mid, rpc_pool, &d, lease);
+    if (rc) {
+      LOG_ERROR(mid, "Could not start IO-set lease expiry");
+      goto error;
+    }
   }
 
   margo_register_data(mid, rpc_ids[RPC_CLIENT_REGISTER], &d, NULL);
@@ -246,46 +335,51 @@ main(int argc __attribute__((unused)), char** argv __attribute__((unused)))
   margo_register_data(mid, rpc_ids[RPC_NODEALERT], &d, NULL);
   margo_register_data(mid, rpc_ids[RPC_METRIC_ALERT], &d, NULL);
 
+  /* Prometheus export of the statistics, if asked for */
+  const char *statsfile = getenv(ICSTATS_FILE_ENV);
+  const char *statssock = getenv(ICSTATS_SOCKET_ENV);
+  const char *interval = getenv(ICSTATS_INTERVAL_ENV);
+
+  if (statsfile || statssock) {
+    rc = icstats_export_start(statsfile, statssock, interval ? atoi(interval) : 0);
+    if (rc) {
+      LOG_ERROR(mid, "Could not export statistics: %s", strerror(errno));
+    }
+  }
+
   margo_wait_for_finalize(mid);
 
+  icstats_export_stop();
+
+  /* stop message streams */
+  mstream_fini(&beegfs_ms);
+
   /* clean up malleability thread */
-  ABT_mutex_free(&malldat.mutex);
-  ABT_cond_free(&malldat.cond);
-  // CHANGE JAVI
-  ABT_cond_free(&(malldat.cond2));
-  // END CHANGE JAVI
+  evqueue_close(malldat.events);
+  evqueue_fini(&malldat.events);
+  mallpolicy_fini(&malldat.policy);
 
   /* clean resource manager connection */
   icrm_fini();
 
+  /* stop the cache before the DB connections */
+  clcache_fini(&clcache);
+  addrcache_fini(&addrcache);
+
   /* close connections to DB */
   for (size_t i = 0; i < NTHREADS; i++) {
     icdb_fini(&icdbs[i]);
   }
 
   /* clean up ioset data */
-  ABT_cond_free(&d.iosetq);
   ABT_mutex_free(&d.iosetlock);
-  ABT_rwlock_free(&d.iosets_lock);
   ABT_rwlock_free(&d.ioset_time_lock);
+  ioset_sched_fini(&d.iosched);
 
-  /* free the IO-set map */
-  const char *setid;
-  struct ioset *const *set;
-  size_t curs = 0;
-  while ((curs = hm_next(d.iosets, curs, &setid, (const void **)&set)) != 0) {
-    free(*set);
-  }
-  hm_free(d.iosets);
-
-  const char *appid;
-  struct ioset_time *const *time;
-  curs = 0;
-  while ((curs = hm_next(d.ioset_time, curs, &appid, (const void **)&time)) != 0) {
-    free(*time);
-  }
+  /* the timings are in the arena */
   hm_free(d.ioset_time);
-  fclose(d.ioset_outfile);
+  arena_free(d.ioset_time_arena);
+  iotrace_fini(&d.iotrace);
 
   return 0;
 
@@ -297,37 +391,253 @@ main(int argc __attribute__((unused)), char** argv __attribute__((unused)))
 /****************************************************/
 /* Malleability manager stub */
 /****************************************************/
+/**
+ * Working buffers of a ULT running the malleability policy.
+ */
+static void
+mall_work_init(struct mall_work *work, margo_instance_id mid, struct icdb_context *icdb,
+               struct clcache *clcache, struct addrcache *addrcache)
+{
+  memset(work, 0, sizeof(*work));
+  work->icdb = icdb;
+  work->clcache = clcache;
+  work->addrcache = addrcache;
+  rpc_batch_init(&work->batch, mid);
+  work->batch.addrcache = addrcache;
+}
+
+static void
+mall_work_fini(struct mall_work *work)
+{
+  rpc_batch_fini(&work->batch);
+  free(work->addrs);
+  free(work->mclients);
+  for (size_t i = 0; i < work->nclients; i++)
+    free(work->clients[i].nodelist);
+  free(work->clients);
+}
+
+/**
+ * Make MC a policy view of CLIENT, valid as long as CLIENT.
+ */
+static void
+mall_client(struct icc_mall_client *mc, const struct icdb_client *client)
+{
+  mc->clid = client->clid;
+  mc->type = client->type;
+  mc->addr = client->addr;
+  mc->nodelist = client->nodelist ? client->nodelist : "";
+  mc->jobid = client->jobid;
+  mc->nnodes = client->nnodes;
+  mc->nprocs = client->nprocs;
+  mc->reconfig_nprocs = client->reconfig_nprocs;
+  mc->reconfig_nnodes = client->reconfig_nnodes;
+}
+
+/**
+ * Snapshot of the clients of JOBID, or all clients, in the buffers
+ * of the struct mall_work ARG. See mallpolicy_snapshot_t.
+ */
+static int
+mall_snapshot(void *arg, uint32_t jobid, struct icc_mall_snapshot *snap)
+{
+  struct mall_work *work = (struct mall_work *)arg;
+  int ret;
+
+  /* the nodelists of the previous snapshot */
+  for (size_t i = 0; i < work->nclients; i++) {
+    free(work->clients[i].nodelist);
+    work->clients[i].nodelist = NULL;
+  }
+
+  /* the clients array is kept and grown across calls */
+  ret = clcache_getclients(work->clcache, work->icdb, jobid, NULL,
+                           &work->clients, &work->clients_size, &work->nclients);
+  if (ret != ICDB_SUCCESS) {
+    work->nclients = 0;
+    return -1;
+  }
+
+  /* lists come without nodelists, each client has its own copy,
+     kept until the next snapshot */
+  for (size_t i = 0; i < work->nclients; i++) {
+    struct icdb_client c;
+    if (clcache_getclient(work->clcache, work->icdb, work->clients[i].clid, &c) == ICDB_SUCCESS)
+      work->clients[i].nodelist = c.nodelist;
+  }
+
+  if (work->nclients > work->mclients_size) {
+    struct icc_mall_client *tmp;
+    tmp = realloc(work->mclients, work->nclients * sizeof(*tmp));
+    if (!tmp) {
+      return -1;
+    }
+    work->mclients = tmp;
+    work->mclients_size = work->nclients;
+  }
+
+  for (size_t i = 0; i < work->nclients; i++) {
+    mall_client(&work->mclients[i], &work->clients[i]);
+  }
+
+  snap->jobid = jobid;
+  snap->clients = work->mclients;
+  snap->nclients = work->nclients;
+
+  return 0;
+}
+
+/**
+ * Reconfigure the MPI clients of the job of A with RPC_RESALLOC.
+ */
+static void
+mall_resalloc(margo_instance_id mid, hg_id_t rpcids[], struct mall_work *work,
+              const struct icc_mall_action *a)
+{
+  int ret;
+
+  margo_info(mid, "Malleability thread: mallebility region(ENTERING): shrink:%d, ncpus:%"PRIu32,
+             a->type == ICC_MALL_SHRINK, a->ncpus);
+
+  /* XX fixme filter on (flex)MPI clients?*/
+  ret = clcache_getclients(work->clcache, work->icdb, a->jobid, NULL,
+                           &work->clients, &work->clients_size, &work->nclients);
+  if (ret != ICDB_SUCCESS) {
+    LOG_ERROR(mid, "IC database: %s", icdb_errstr(work->icdb));
+    return;
+  } else if (work->nclients > NCLIENTS_MAX) {
+    LOG_ERROR(mid, "Too many clients returned from DB");
+    return;
+  }
+  margo_info(mid, "Malleability: Job %"PRIu32": got %zu client%s",
+             a->jobid, work->nclients, work->nclients > 1 ? "s" : "");
+
+  /* neighbours in the multicast tree should be close */
+  ret = icdb_sort_clients(work->icdb, a->jobid, work->clients, work->nclients);
+  if (ret != ICDB_SUCCESS) {
+    LOG_ERROR(mid, "IC database: %s", icdb_errstr(work->icdb));
+  }
+
+  if (work->nclients > work->addrs_size) {
+    const char **tmp = realloc(work->addrs, work->nclients * sizeof(*tmp));
+    if (!tmp) {
+      LOG_ERROR(mid, "Malleability: %s", strerror(errno));
+      return;
+    }
+    work->addrs = tmp;
+    work->addrs_size = work->nclients;
+  }
+
+  /* reconfigure to share cpus fairly between all steps of a job,
+     the clients relay the RPC to each other */
+  size_t naddrs = 0;
+  for (size_t i = 0; i < work->nclients; i++) {
+    struct icdb_client *c = &work->clients[i];
+    if ((!strncmp(c->type, "flexmpi", ICC_TYPE_LEN)) ||
+        (!strncmp(c->type, "stoprestart", ICC_TYPE_LEN)) ||
+        (!strncmp(c->type, "mpi", ICC_TYPE_LEN))) {
+      work->addrs[naddrs++] = c->addr;
+    }
+  }
+
+  multicast_in_t mcin = {
+    .code = RPC_RESALLOC,
+    .shrink = a->type == ICC_MALL_SHRINK,
+    .ncpus = a->ncpus,
+    .nnodes = a->nnodes,
+    .fanout = RPC_MULTICAST_FANOUT,
+  };
+  size_t nfailed = rpc_multicast(&work->batch, rpcids[RPC_MULTICAST], &mcin, work->addrs, naddrs,
+                                 RPC_TIMEOUT_MS_DEFAULT, NULL, NULL);
+  if (nfailed) {
+    LOG_ERROR(mid, "Malleability: Job %"PRIu32": RPC_RESALLOC failed on %zu/%zu client%s",
+              a->jobid, nfailed, naddrs, naddrs > 1 ? "s" : "");
+  }
+  margo_info(mid, "Malleability: Job %"PRIu32" RPC_RESALLOC for %"PRIu32" CPUs: %zu/%zu client%s done",
+             a->jobid, a->ncpus, naddrs - nfailed, naddrs, naddrs > 1 ? "s" : "");
+}
+
+/**
+ * Carry out the NACTIONS ACTIONS decided by the malleability policy.
+ */
+static void
+mall_apply(margo_instance_id mid, hg_id_t rpcids[], struct mall_work *work,
+           const struct icc_mall_action *actions, size_t nactions)
+{
+  for (size_t i = 0; i < nactions; i++) {
+    const struct icc_mall_action *a = &actions[i];
+
+    switch (a->type) {
+    case ICC_MALL_EXPAND:
+    case ICC_MALL_SHRINK:
+      if (a->ncpus != 0)
+        mall_resalloc(mid, rpcids, work, a);
+      break;
+    case ICC_MALL_SHRINK_NODES:
+      mall_shrink(mid, rpcids, work, a->clid);
+      break;
+    default:
+      LOG_ERROR(mid, "Malleability: unknown action %d", a->type);
+    }
+  }
+}
+
+/**
+ * Services of the server to the malleability policy, CTX is the DB
+ * connection pool.
+ */
+static int
+mall_monitor_sample(void *ctx, const char *clid, double rtime, double ctime,
+                    uint32_t window, double *avg_rtime, double *avg_ctime,
+                    uint32_t *nsamples)
+{
+  struct icdb_context **icdbs = (struct icdb_context **)ctx;
+  struct icdb_monitor_avg avg;
+  int ret, xrank;
+
+  ret = ABT_self_get_xstream_rank(&xrank);
+  if (ret != ABT_SUCCESS)
+    return -1;
+
+  ret = icdb_monitor_sample(icdbs[xrank], clid, rtime, ctime, window, &avg);
+  if (ret != ICDB_SUCCESS) {
+    margo_error(MARGO_INSTANCE_NULL, "server(icdb_monitor_sample): %s", icdb_errstr(icdbs[xrank]));
+    return -1;
+  }
+
+  *avg_rtime = avg.rtime;
+  *avg_ctime = avg.ctime;
+  *nsamples = avg.nsamples;
+  return 0;
+}
+
+static int
+mall_monitor_reset(void *ctx, const char *clid)
+{
+  struct icdb_context **icdbs = (struct icdb_context **)ctx;
+  int ret, xrank;
+
+  ret = ABT_self_get_xstream_rank(&xrank);
+  if (ret != ABT_SUCCESS)
+    return -1;
+
+  ret = icdb_monitor_reset(icdbs[xrank], clid);
+  if (ret != ICDB_SUCCESS) {
+    margo_error(MARGO_INSTANCE_NULL, "server(icdb_monitor_reset): %s", icdb_errstr(icdbs[xrank]));
+    return -1;
+  }
+  return 0;
+}
+
 /* CHANGE: begin */
 void
 malleability_th(void *arg)
 {
-  struct icdb_client *clients = NULL;
   struct malleability_data *data = (struct malleability_data *)arg;
+  struct icc_mall_action actions[MALLPOLICY_MAXACTIONS];
+  struct mall_work work;
+  struct evq_event ev;
   int ret, xrank;
-  size_t nclients = 0;
-  struct icdb_context *icdb = NULL;
-  struct icdb_job job;
-  enum icc_rpc_code rpc_code = RPC_ERROR;
-  void * rpc_data = NULL;
-  uint32_t rpc_jobid = 0;
-  char clid[UUID_STR_LEN];
-  time_t time_limit=time(NULL);
-  time_t time_lapso=30;
-  double cpu_samples_avg=0.0;
-  int cpu_num_samples=0;
-  double it_rtime=0.0;
-  double it_rtime_avg=0.0;
-  double it_ctime=0.0;
-  double it_ctime_avg=0.0;
-  double it_ratio_cpu_comm=0.0;
-  int it_rtime_num_samples=0;
-  int max_it = 10;
-
-  /* init realloc param */
-  resalloc_in_t allocin;
-  allocin.shrink = 0;
-  allocin.ncpus = 0;
-  allocin.nnodes = 0;
 
   ret = ABT_self_get_xstream_rank(&xrank);
   if (ret != ABT_SUCCESS) {
@@ -335,215 +645,98 @@ malleability_th(void *arg)
     return;
   }
 
-  while (1) {
-    ABT_mutex_lock(data->mutex);
-    while (data->sleep == 1) {
-      ABT_cond_wait(data->cond, data->mutex);
-    }
-    /* copy clid */
-    strncpy(clid, data->clid, UUID_STR_LEN);
-    /* get rpc_code */
-    rpc_code = data->rpc_code;
-    /* get rpc_data */
-    rpc_data = data->rpc_data;
-    /* get rpc_jobid */
-    rpc_jobid = data->jobid;
-    /* reset sleep for next time */
-    data->sleep = 1;
-    ABT_cond_broadcast(data->cond2);
-    ABT_mutex_unlock(data->mutex);
-      
-    if (!data->icdbs) {
-      LOG_ERROR(data->mid, "Null ICDB context");
-      return;
-    }
+  if (!data->icdbs) {
+    LOG_ERROR(data->mid, "Null ICDB context");
+    return;
+  }
 
-    icdb = data->icdbs[xrank];
-    
-    if (rpc_code == RPC_CLIENT_REGISTER) {
-      margo_info(data->mid, "Malleability thread: client register"); // CHANGE JAVI
-      continue;
-    } else if (rpc_code == RPC_CLIENT_DEREGISTER) {
-      margo_info(data->mid, "Malleability thread: client deregister"); // CHANGE JAVI
+  /* kept across decisions to recycle the buffers and RPC handles */
+  mall_work_init(&work, data->mid, data->icdbs[xrank], data->clcache, data->addrcache);
 
-      continue;
-    } else if (rpc_code == RPC_MALLEABILITY_REGION) {
-
-      int32_t maleab_type = ((int32_t *)(rpc_data))[0];
-      int32_t procs_hint = ((int32_t *)(rpc_data))[1];
-      int32_t nnodes = ((int32_t *)(rpc_data))[2];
-      free (rpc_data);
-        
-      //if ( (maleab_type != ICC_MALLEABILITY_REGION_ENTER) || (procs_hint == 0) ) {
-      if (maleab_type != ICC_MALLEABILITY_REGION_ENTER) {
-          continue;
-      }
-      
-      // init values
-      allocin.shrink = 0;
-      allocin.ncpus = 0;
-      allocin.nnodes = nnodes;  //excl. hint always work
-        
-      if (procs_hint != 0) {  // if hints -> follow the hints
-        if (procs_hint < 0) {
-          allocin.shrink = 1;
-          allocin.ncpus = -1 * procs_hint;
-        } else {
-          allocin.shrink = 0;
-          allocin.ncpus = procs_hint;
-        }
-      } else { // if no hints, look at monitor
-          double ratio_cpu = 0.0, ratio_mem = 0.0;
-          int num_proc = 0;
-          double rtime = 0.0, ptime = 0.0, ctime = 0.0;
-          int ret = icdb_getMonitor(icdb, clid, &ratio_cpu, &ratio_mem, &num_proc, &rtime, &ptime, &ctime);
-          if (ret != ICDB_SUCCESS) {
-              LOG_ERROR(data->mid, "server(icdb_getMonitor): %s", icdb_errstr(icdb));
-              continue;
-          //} else {
-          //    margo_info(data->mid, "server(icdb_getMonitor) OK");
-          }
-          
-          // compute average cpu
-          //cpu_samples_avg=cpu_samples_avg+ratio_cpu;
-          //cpu_num_samples++;
-
-          // execute scheduler only every 'time_lapso'
-          //time_t lapso = time(NULL) - time_limit;
-          //if (lapso >= time_lapso) {
-          //    time_limit = time(NULL);
-          //    ratio_cpu=cpu_samples_avg/((double)cpu_num_samples);
-          //    cpu_samples_avg = 0.0;
-          //    cpu_num_samples = 0;
-          //} else {
-          //    continue;
-          //}
-	 
-          margo_debug(data->mid, "iter: %d, rtime:%f, ctime:%f", it_rtime_num_samples, rtime, ctime);
-      	  if (rtime > MAX_VAL_IT_RTIME) {
-              continue;
-          }
-          it_rtime = it_rtime + rtime;
-          it_ctime = it_ctime + ctime;
-          it_rtime_num_samples++;
-	  if (it_rtime_num_samples < max_it) {
-	      continue;
-	  } else {
-          it_rtime_avg = it_rtime / ((double)it_rtime_num_samples);
-          it_ctime_avg = it_ctime / ((double)it_rtime_num_samples);
-          it_ratio_cpu_comm = (it_rtime_avg / (it_rtime_avg+it_ctime_avg))*100.0;
-	      it_rtime = 0.0;
-          it_ctime = 0.0;
-	      it_rtime_num_samples = 0;
-          margo_debug(data->mid, "it_rtime_avg:%f, it_ctime_avg:%f", it_rtime_avg, it_ctime_avg);
-
-	  }
-
-          if (allocin.nnodes > 1) {   /// FIX ME
-              num_proc = 1;
-          }
-           
-          //if (MAX_CPU_RATE < ratio_cpu) {
-          if (MAX_IT_RTIME < it_rtime_avg) {
-          //if (MAX_RATIO_CPU_COMM < it_ratio_cpu_comm) {
-              allocin.shrink = 0;
-              allocin.ncpus = num_proc;
-          //} else if (MIN_CPU_RATE > ratio_cpu) {
-          } else if (MIN_IT_RTIME > it_rtime_avg) {
-          //} else if (MIN_RATIO_CPU_COMM > it_ratio_cpu_comm) {
-              allocin.shrink = 1;
-              allocin.ncpus = num_proc;
-          }
-      }
+  while (evqueue_pop(data->events, &ev) == 0) {
+    /* timed until the next wait, whatever the way out */
+    ICSTATS_SCOPE("malleability", "decision");
 
-      // if no changes in cpus, finish the request
-      if (allocin.ncpus == 0) {
-         continue;
-      }
-        
-      margo_info(data->mid, "Malleability thread: mallebility region(ENTERING): shrink:%d, ncpus:%d", allocin.shrink, allocin.ncpus);
-      
-      // init icdb_job structure
-      struct icdb_job *j = &job;
-      icdb_job_init(j);
-
-      ret = icdb_getjob(icdb, rpc_jobid, &job);
-      if (ret != ICDB_SUCCESS) {
-        LOG_ERROR(data->mid, "IC database: %s", icdb_errstr(icdb));
-        return;
-      }
+    struct mallpolicy_event pev = { .jobid = ev.jobid };
+    size_t nactions;
 
-      nclients = NCLIENTS;
-      /* XX fixme: multiplication could overflow, use reallocarray? */
-      /* XX do not alloc/free on every call */
-      clients = malloc(sizeof(*clients) * nclients);
-      if (!clients) {
-        LOG_ERROR(data->mid, "Failed malloc");
-        return;
-      }
+    if (ev.code == RPC_CLIENT_REGISTER || ev.code == RPC_CLIENT_DEREGISTER) {
+      int reg = ev.code == RPC_CLIENT_REGISTER;
+      int decide = 0;
 
-      do {
-        /* XX fixme filter on (flex)MPI clients?*/
-        ret = icdb_getclients(icdb, rpc_jobid, clients, &nclients);
-        /* clients array is too small, expand */
-        if (ret == ICDB_E2BIG && nclients <= NCLIENTS_MAX) {
-          void * tmp = realloc(clients, sizeof(*clients) * nclients);
-          if (!tmp) {
-            LOG_ERROR(data->mid, "Failed malloc");
-            return;
+      margo_info(data->mid, "Malleability thread: client %s (job %"PRIu32", %"PRIu32" event%s)",
+                 reg ? "register" : "deregister", ev.jobid, ev.count,
+                 ev.count > 1 ? "s" : ""); // CHANGE JAVI
+
+      /* the policy sees every client of the coalesced events, then
+         decides once for the job */
+      for (uint32_t i = 0; i < ev.count; i++) {
+        struct icdb_client client = { .nodelist = NULL };
+        struct icc_mall_client mc;
+
+        if (reg) {
+          ret = clcache_getclient(data->clcache, work.icdb, evqueue_event_clid(&ev, i), &client);
+          if (ret != ICDB_SUCCESS) {
+            LOG_ERROR(data->mid, "IC database: %s", icdb_errstr(work.icdb));
+            continue;
           }
-          clients = tmp;
-          continue;
-        } else if (nclients > NCLIENTS_MAX){
-          LOG_ERROR(data->mid, "Too many clients returned from DB");
-          return;
-        } else if (ret != ICDB_SUCCESS) {
-          LOG_ERROR(data->mid, "IC database: %s", icdb_errstr(icdb));
-          free(clients);
-          return;
-        }
-        break;
-      } while (1);
-      margo_info(data->mid, "Malleability: Job %"PRIu32": got %zu client%s",
-                 rpc_jobid, nclients, nclients > 1 ? "s" : "");
-
-      /* reconfigure to share cpus fairly between all steps of a job */
-      for (size_t i = 0; i < nclients; i++) {
-        /* make malleability RPC */
-        hg_addr_t addr;
-        hg_return_t hret;
-        int rpcret;
-
-        hret = margo_addr_lookup(data->mid, clients[i].addr, &addr);
-        if (hret != HG_SUCCESS) {
-          LOG_ERROR(data->mid, "Failed getting Mercury address: %s", HG_Error_to_string(hret));
-          break;
+          mall_client(&mc, &client);
+          pev.type = MALLPOLICY_REGISTER;
+          pev.u.client = &mc;
+        } else {
+          pev.type = MALLPOLICY_DEREGISTER;
+          pev.u.clid = evqueue_event_clid(&ev, i);
         }
 
-        if ( (!strncmp(clients[i].type, "flexmpi", ICC_TYPE_LEN)) ||
-            (!strncmp(clients[i].type, "stoprestart", ICC_TYPE_LEN)) ||
-             (!strncmp(clients[i].type, "mpi", ICC_TYPE_LEN)) ) {
-
-          ret = rpc_send(data->mid, addr, data->rpcids[RPC_RESALLOC], &allocin, &rpcret, RPC_TIMEOUT_MS_DEFAULT);
-          if (ret) {
-            LOG_ERROR(data->mid, "Malleability: Job %"PRIu32": client %s: RPC_RESALLOC send failed ", clients[i].jobid, clients[i].clid);
-          } else if (rpcret) {
-            LOG_ERROR(data->mid, "Malleability: Job %"PRIu32": client %s: RPC_RESALLOC returned with code %d", clients[i].jobid, clients[i].clid, rpcret);
-          } else {
-            margo_info(data->mid, "Malleability: Job %"PRIu32" RPC_RESALLOC for %"PRIu32" CPUs", clients[i].jobid, allocin.ncpus);
-          }
+        if (mallpolicy_hook(data->policy, &pev) == ICC_MALL_DECIDE)
+          decide = 1;
+        free(client.nodelist);
+      }
+      evqueue_event_free(&ev);
+
+      if (!decide)
+        continue;
+      nactions = mallpolicy_decide(data->policy, pev.jobid, mall_snapshot, &work,
+                                   actions, MALLPOLICY_MAXACTIONS);
+    } else if (ev.code == RPC_MALLEABILITY_REGION) {
+      struct icc_mall_region region = {
+        .clid = ev.clid,
+        .jobid = ev.jobid,
+        .enter = ev.args[0] == ICC_MALLEABILITY_REGION_ENTER,
+        .nprocs = ev.args[1],
+        .nnodes = ev.args[2],
+      };
+
+      /* if no hints, the monitoring data of the client comes first */
+      if (region.enter && region.nprocs == 0) {
+        struct icc_mall_metric metric = { .clid = ev.clid, .jobid = ev.jobid };
+
+        ret = icdb_getMonitor(work.icdb, ev.clid, &metric.ratio_cpu, &metric.ratio_mem,
+                              &metric.nprocs, &metric.rtime, &metric.ptime, &metric.ctime);
+        if (ret != ICDB_SUCCESS) {
+          LOG_ERROR(data->mid, "server(icdb_getMonitor): %s", icdb_errstr(work.icdb));
+          continue;
         }
+        margo_debug(data->mid, "rtime:%f, ctime:%f", metric.rtime, metric.ctime);
+        pev.type = MALLPOLICY_METRIC;
+        pev.u.metric = &metric;
+        nactions = mallpolicy_handle(data->policy, &pev, mall_snapshot, &work,
+                                     actions, MALLPOLICY_MAXACTIONS);
+        mall_apply(data->mid, data->rpcids, &work, actions, nactions);
       }
 
-      // erase icdb_job structure
-      icdb_job_free(&j);
-
+      pev.type = MALLPOLICY_REGION;
+      pev.u.region = &region;
+      nactions = mallpolicy_handle(data->policy, &pev, mall_snapshot, &work,
+                                   actions, MALLPOLICY_MAXACTIONS);
+    } else {
       continue;
     }
-    /* go back to sleep */
+
+    mall_apply(data->mid, data->rpcids, &work, actions, nactions);
   }
 
-  free(clients);
+  mall_work_fini(&work);
   return;
 }
 /* CHANGE: end */
@@ -619,29 +812,35 @@ malleability_th(void *arg)
 // }
 
 
-void
-mall_shrink(margo_instance_id mid, hg_id_t rpcs[], struct icdb_context *icdb) {
+/**
+ * Release half of the nodes of client CLID.
+ */
+static void
+mall_shrink(margo_instance_id mid, hg_id_t rpcs[], struct mall_work *work,
+            const char *clid) {
   struct icdb_client c;
   int ret, rpcret;
 
-  ret = icdb_getlargestclient(icdb, &c);
+  ret = clcache_getclient(work->clcache, work->icdb, clid, &c);
   if (ret != ICDB_SUCCESS) {
-    margo_error(mid, "mall: icdb getlargest: %s", icdb_errstr(icdb));
+    margo_error(mid, "mall: icdb getclient: %s", icdb_errstr(work->icdb));
     return;
   }
+  free(c.nodelist);
 
   char *newnodelist;
-  ret = icdb_shrink(icdb, c.clid, &newnodelist);
+  ret = icdb_shrink(work->icdb, c.clid, &newnodelist);
   if (ret != ICDB_SUCCESS) {
-    margo_error(mid, "mall: icdb shrink: %s", icdb_errstr(icdb));
+    margo_error(mid, "mall: icdb shrink: %s", icdb_errstr(work->icdb));
     return;
   }
 
   hg_addr_t addr;
   hg_return_t hret;
-  hret = margo_addr_lookup(mid, c.addr, &addr);
+  hret = addrcache_lookup(work->addrcache, mid, c.addr, &addr);
   if (hret != HG_SUCCESS) {
     LOG_ERROR(mid, "hg address: %s", HG_Error_to_string(hret));
+    free(newnodelist);
     return;
   }
 
@@ -650,16 +849,19 @@ mall_shrink(margo_instance_id mid, hg_id_t rpcs[], struct icdb_context *icdb) {
   ret = rpc_send(mid, addr, rpcs[RPC_RECONFIGURE2], &in, &rpcret, RPC_TIMEOUT_MS_DEFAULT);
   if (ret) {
     LOG_ERROR(mid, "mall: client %s: RPC_RECONFIGURE2 send failed ", c.clid);
+    addrcache_fail(work->addrcache, c.addr);
   } else if (rpcret) {
     LOG_ERROR(mid, "mall: client %s: RPC_RECONFIGURE2 returned %d", c.clid, rpcret);
   }
+  margo_addr_free(mid, addr);
+  free(newnodelist);
 }
 
 /* Message stream */
 void
-mstream_th(void *arg)
+beegfs_handler(const struct icdb_mstream_msg *msg, void *arg)
 {
-  struct mstream *data = (struct mstream *)arg;
+  struct beegfs_data *data = (struct beegfs_data *)arg;
 
   if (!data->icdbs) {
     LOG_ERROR(data->mid, "null ICDB context");
@@ -676,17 +878,30 @@ mstream_th(void *arg)
 
   struct icdb_context *icdb = data->icdbs[xrank];
   struct icdb_beegfs status;
-  margo_debug(data->mid, "message thread: listening on beegfs stream");
-  do {
-    /* blocking read from FS stream */
-    ret = icdb_mstream_beegfs(icdb, &status);
-    if (ret != ICDB_SUCCESS) { return; }
-    if (status.timestamp != 0) {
-      margo_debug(data->mid, "beegfs:qlen:%"PRIu64" %"PRIu32, status.timestamp, status.qlen);
-    }
-    if (status.qlen > 10) {
-      mall_shrink(data->mid, data->rpcids, icdb);
-    }
-  } while (ret == ICDB_SUCCESS);
-  return;
+
+  ret = icdb_mstream_beegfs(msg, &status);
+  if (ret != ICDB_SUCCESS) {
+    LOG_ERROR(data->mid, "malformed beegfs message %s", msg->id);
+    return;
+  }
+  if (status.timestamp != 0) {
+    margo_debug(data->mid, "beegfs:qlen:%"PRIu64" %"PRIu32, status.timestamp, status.qlen);
+  }
+
+  /* the policy decides on the whole cluster */
+  struct icc_mall_stream_event sev = {
+    .stream = "beegfs",
+    .timestamp = status.timestamp,
+    .qlen = status.qlen,
+  };
+  struct mallpolicy_event pev = { .type = MALLPOLICY_STREAM, .jobid = 0, .u.stream = &sev };
+  struct icc_mall_action actions[MALLPOLICY_MAXACTIONS];
+  struct mall_work work;
+  size_t nactions;
+
+  mall_work_init(&work, data->mid, icdb, data->clcache, data->addrcache);
+  nactions = mallpolicy_handle(data->policy, &pev, mall_snapshot, &work,
+                               actions, MALLPOLICY_MAXACTIONS);
+  mall_apply(data->mid, data->rpcids, &work, actions, nactions);
+  mall_work_fini(&work);
 }
@@ -150,7 +150,7 @@ int add_hostlist(char **hostlist, int *size, int *offset, int withcpus, char *ho
  * expand_nodelist
  */
 char * expand_nodelist(const char *listhosts, uint16_t cpus_per_node[],
-                       uint32_t cpus_count_reps[])
+                       uint32_t cpus_count_reps[], uint32_t ngroups)
 {
     assert(listhosts != NULL);
     assert(cpus_per_node != NULL);
@@ -172,13 +172,13 @@ char * expand_nodelist(const char *listhosts, uint16_t cpus_per_node[],
      repeated cpus_count_reps[i] time */
     
     icpu = 0;
-    reps = cpus_count_reps[icpu];
+    reps = ngroups > 0 ? cpus_count_reps[icpu] : 0;
     
     char *host = NULL;
     char *hostlist = NULL;
     int size = 0;
     int offset = 0;
-    while ((host = slurm_hostlist_shift(hl))) {
+    while (icpu < ngroups && (host = slurm_hostlist_shift(hl))) {
         ncpus = cpus_per_node[icpu];
         reps--;
         int ret = add_hostlist(&hostlist, &size, &offset, 1, host, ncpus);
@@ -186,8 +186,7 @@ char * expand_nodelist(const char *listhosts, uint16_t cpus_per_node[],
             fprintf(stderr, "expand_nodelist: add_hostlist Error\n");
             return NULL;
         }
-        if (reps == 0) {
-            icpu++;
+        if (reps == 0 && ++icpu < ngroups) {
             reps = cpus_count_reps[icpu]; // JAVI ADDED
         }
         free(host);
@@ -216,7 +215,8 @@ int get_nodelist(char **hostlist, uint32_t jobid)
     
     (*hostlist) = expand_nodelist(allocinfo->node_list,
                                   allocinfo->cpus_per_node,
-                                  allocinfo->cpu_count_reps);
+                                  allocinfo->cpu_count_reps,
+                                  allocinfo->num_cpu_groups);
     if ((*hostlist) == NULL) {
         fprintf(stderr, "get_nodelist: expand_nodelist: hostlist is NULL");
         return -1;
@@ -0,0 +1,102 @@
+/**
+ * Address cache benchmark: repeated broadcasts to N clients, each
+ * client address looked up for every broadcast as the notification
+ * paths did, against looked up through the address cache. The clients
+ * are Margo instances of this process (see testmargo.h). The cache
+ * counters are printed at the end.
+ *
+ * Usage: bench_addrcache [NCLIENTS [NROUNDS]]
+ */
+#include <inttypes.h>           /* PRIu64 */
+#include <margo.h>
+
+#include "addrcache.h"
+#include "rpc.h"
+#include "tests.h"
+#include "testmargo.h"
+
+
+/* one broadcast, addresses looked up through CACHE, or Mercury if
+   NULL */
+static void
+broadcast(margo_instance_id mid, struct addrcache *cache, struct rpc_batch *batch,
+          hg_id_t ping, hg_addr_t *addrs, size_t n)
+{
+  lowmem_in_t in = { .nodename = "node0" };
+  uint64_t received = testmargo_received();
+  size_t nfailed = 0;
+
+  for (size_t i = 0; i < n; i++) {
+    if (addrcache_lookup(cache, mid, testmargo_addr(i), &addrs[i]) != HG_SUCCESS) {
+      addrs[i] = HG_ADDR_NULL;
+      nfailed++;
+      continue;
+    }
+    nfailed += rpc_isend(batch, addrs[i], ping, &in, RPC_TIMEOUT_MS_DEFAULT, NULL, NULL) != 0;
+  }
+  nfailed += rpc_wait_all(batch);
+
+  for (size_t i = 0; i < n; i++) {
+    if (addrs[i] != HG_ADDR_NULL)
+      margo_addr_free(mid, addrs[i]);
+  }
+  TEST_CHECK_INT(nfailed, 0);
+  TEST_CHECK_INT(testmargo_received() - received, n);
+}
+
+
+int
+main(int argc, char **argv)
+{
+  size_t nclients = test_size_arg(argc, argv, 1, 16);
+  size_t nrounds = test_size_arg(argc, argv, 2, 20);
+  struct test_lat nocache = { 0 }, cached = { 0 };
+  struct addrcache *cache;
+  struct addrcache_stats s;
+  struct rpc_batch batch;
+  margo_instance_id mid;
+  hg_id_t ping;
+
+  mid = testmargo_start(nclients, &ping);
+  if (mid == MARGO_INSTANCE_NULL) {
+    fprintf(stderr, "Margo could not be initialized\n");
+    return TEST_SKIP;
+  }
+
+  hg_addr_t *addrs = calloc(nclients, sizeof(*addrs));
+  TEST_ASSERT(addrs);
+  TEST_ASSERT(addrcache_init(&cache, mid, 0, 0) == 0);
+  rpc_batch_init(&batch, mid);
+
+  for (size_t round = 0; round < nrounds; round++) {
+    uint64_t start = test_now_ns();
+    broadcast(mid, NULL, &batch, ping, addrs, nclients);
+    TEST_CHECK(test_lat_add(&nocache, test_now_ns() - start) == 0);
+  }
+
+  for (size_t round = 0; round < nrounds; round++) {
+    uint64_t start = test_now_ns();
+    broadcast(mid, cache, &batch, ping, addrs, nclients);
+    TEST_CHECK(test_lat_add(&cached, test_now_ns() - start) == 0);
+  }
+
+  addrcache_stats(cache, &s);
+  TEST_CHECK_INT(s.misses, nclients);
+  TEST_CHECK_INT(s.hits, (nrounds - 1) * nclients);
+
+  printf("%zu clients, %zu rounds, broadcast time:\n", nclients, nrounds);
+  test_lat_print(&nocache, "lookup");
+  test_lat_print(&cached, "addrcache");
+  printf("cache: %"PRIu64" hits, %"PRIu64" misses, %"PRIu64" lookups, "
+         "avg lookup %.1f us\n", s.hits, s.misses, s.lookups,
+         s.lookups ? 1e6 * s.lookup_time / s.lookups : 0.0);
+
+  rpc_batch_fini(&batch);
+  addrcache_fini(&cache);
+  free(addrs);
+  test_lat_free(&nocache);
+  test_lat_free(&cached);
+  testmargo_stop();
+
+  return TEST_EXIT();
+}
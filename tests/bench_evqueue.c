@@ -0,0 +1,181 @@
+/**
+ * Malleability handoff benchmark: NREGS client registrations from
+ * NXSTREAMS handler execution streams, handed over to a malleability
+ * ULT that spends DECISION_US per decision. The handler latency of the
+ * handoff and the number of decisions are measured for the single slot
+ * the handlers used to wait on, reproduced here, one decision per
+ * registration, and for the event queue, where registrations of the
+ * same job pending together are popped as one event and decided once,
+ * as malleability_th does.
+ *
+ * Usage: bench_evqueue [NREGS [NXSTREAMS [DECISION_US]]]
+ */
+#include <inttypes.h>           /* PRIu64 */
+#include <margo.h>
+
+#include "evqueue.h"
+#include "tests.h"
+
+#define BENCH_NJOBS 16
+
+static size_t nregs, nxstreams, decision_us;
+
+/* the former handoff, one event at a time */
+static struct {
+  ABT_mutex        mutex;
+  ABT_cond         cond;        /* an event is in the slot */
+  ABT_cond         cond2;       /* the slot is free */
+  int              sleep;       /* the slot is free */
+  struct evq_event ev;
+} slot;
+
+static struct evqueue *queue;
+
+struct worker_arg {
+  size_t          id;
+  int             useslot;
+  struct test_lat lat;          /* of the handoffs */
+  uint64_t        drained;      /* time the last client was handled */
+  size_t          ndecisions;   /* by the consumer, one per event */
+};
+
+
+static void
+decide(void)
+{
+  uint64_t end = test_now_ns() + decision_us * 1000;
+  while (test_now_ns() < end)
+    ;
+}
+
+
+static void
+handoff_slot(const struct evq_event *ev)
+{
+  ABT_mutex_lock(slot.mutex);
+  while (slot.sleep == 0)
+    ABT_cond_wait(slot.cond2, slot.mutex);
+  slot.ev = *ev;
+  slot.sleep = 0;
+  ABT_cond_signal(slot.cond);
+  ABT_mutex_unlock(slot.mutex);
+}
+
+
+/* NXSTREAMS handlers, then the malleability ULT */
+static void
+worker(void *arg)
+{
+  struct worker_arg *w = (struct worker_arg *)arg;
+  struct evq_event ev = { .code = RPC_CLIENT_REGISTER };
+
+  if (w->id < nxstreams) {
+    for (size_t i = w->id; i < nregs; i += nxstreams) {
+      ev.jobid = i % BENCH_NJOBS;
+      snprintf(ev.clid, sizeof(ev.clid), "client%zu", i);
+
+      uint64_t start = test_now_ns();
+      if (w->useslot)
+        handoff_slot(&ev);
+      else
+        TEST_CHECK(evqueue_push(queue, &ev, EVQ_COALESCE_JOB) >= 0);
+      TEST_CHECK(test_lat_add(&w->lat, test_now_ns() - start) == 0);
+    }
+    return;
+  }
+
+  for (size_t n = 0; n < nregs; w->ndecisions++) {
+    if (w->useslot) {
+      ABT_mutex_lock(slot.mutex);
+      while (slot.sleep == 1)
+        ABT_cond_wait(slot.cond, slot.mutex);
+      ev = slot.ev;
+      slot.sleep = 1;
+      ABT_cond_broadcast(slot.cond2);
+      ABT_mutex_unlock(slot.mutex);
+      ev.count = 1;
+    } else if (evqueue_pop(queue, &ev)) {
+      break;
+    }
+
+    /* the hooks of the clients are negligible next to the decision */
+    decide();
+    n += ev.count;
+    evqueue_event_free(&ev);
+  }
+  w->drained = test_now_ns();
+}
+
+
+/* return the number of decisions */
+static size_t
+run(int useslot)
+{
+  struct worker_arg *args = calloc(nxstreams + 1, sizeof(*args));
+  struct test_lat lat = { 0 };
+  TEST_ASSERT(args);
+
+  for (size_t i = 0; i <= nxstreams; i++) {
+    args[i].id = i;
+    args[i].useslot = useslot;
+  }
+
+  uint64_t start = test_now_ns();
+  TEST_ASSERT(test_xstreams_run(nxstreams + 1, worker, args, sizeof(*args)) == 0);
+
+  for (size_t i = 0; i < nxstreams; i++) {
+    for (size_t j = 0; j < args[i].lat.n; j++)
+      TEST_CHECK(test_lat_add(&lat, args[i].lat.samples[j]) == 0);
+    test_lat_free(&args[i].lat);
+  }
+  TEST_CHECK_INT(lat.n, nregs);
+
+  size_t ndecisions = args[nxstreams].ndecisions;
+  printf("%s: %zu decisions (%.1f registrations each), all handled in %.1f ms\n",
+         useslot ? "slot" : "evqueue", ndecisions, (double)nregs / ndecisions,
+         (args[nxstreams].drained - start) / 1e6);
+  test_lat_print(&lat, useslot ? "slot" : "evqueue");
+
+  test_lat_free(&lat);
+  free(args);
+  return ndecisions;
+}
+
+
+int
+main(int argc, char **argv)
+{
+  struct evqueue_stats s;
+
+  nregs = test_size_arg(argc, argv, 1, 10000);
+  nxstreams = test_size_arg(argc, argv, 2, 8);
+  decision_us = test_size_arg(argc, argv, 3, 10);
+  TEST_ASSERT(nxstreams > 0);
+
+  ABT_init(0, NULL);
+
+  TEST_ASSERT(ABT_mutex_create(&slot.mutex) == ABT_SUCCESS);
+  TEST_ASSERT(ABT_cond_create(&slot.cond) == ABT_SUCCESS);
+  TEST_ASSERT(ABT_cond_create(&slot.cond2) == ABT_SUCCESS);
+  slot.sleep = 1;
+  TEST_ASSERT(evqueue_init(&queue, MARGO_INSTANCE_NULL, "bench", 0, EVQ_DROP_NEWEST) == 0);
+
+  printf("%zu registrations from %zu handler xstreams over %d jobs, "
+         "%zu us per decision, handoff time:\n", nregs, nxstreams, BENCH_NJOBS, decision_us);
+  TEST_CHECK_INT(run(1), nregs);
+  size_t ndecisions = run(0);
+
+  evqueue_stats(queue, &s);
+  TEST_CHECK_INT(s.dropped, 0);
+  TEST_CHECK_INT(s.pushed - s.coalesced, ndecisions);
+  printf("evqueue: %"PRIu64" pushed, %"PRIu64" coalesced, max depth %zu\n",
+         s.pushed, s.coalesced, s.maxdepth);
+
+  evqueue_fini(&queue);
+  ABT_cond_free(&slot.cond2);
+  ABT_cond_free(&slot.cond);
+  ABT_mutex_free(&slot.mutex);
+  ABT_finalize();
+
+  return TEST_EXIT();
+}
@@ -0,0 +1,248 @@
+/**
+ * Hashmap benchmark: insertion, lookup of present and absent keys and
+ * deletion with the Robin Hood map, against the linear probing map it
+ * replaced, from 1e3 up to 1e7 entries. Keys are host names, values
+ * the 16-bit ports of the hostalloc maps. The old map is reproduced
+ * below without its logging on every operation, which would dominate
+ * its timings; it has no deletion.
+ *
+ * Usage: bench_hashmap [MAXITEMS]
+ */
+#include "hashmap.h"
+#include "tests.h"
+
+/* the map before the Robin Hood rewrite */
+#define OLD_INITIAL_NSLOTS 32
+
+typedef struct {
+  const char *key;
+  void       *value;
+  size_t     size;
+} old_item;
+
+struct old_map {
+  old_item *items;
+  size_t   nitems;
+  size_t   nslots;
+};
+
+static uint64_t
+old_hash(const char *key)
+{
+  uint64_t hash = 14695981039346656037UL;
+  for (const char *p = key; *p; p++) {
+    hash ^= (uint64_t)(unsigned char)(*p);
+    hash *= 1099511628211UL;
+  }
+  return hash;
+}
+
+static struct old_map *
+old_create(void)
+{
+  struct old_map *map = malloc(sizeof(*map));
+  if (!map)
+    return NULL;
+  map->nslots = OLD_INITIAL_NSLOTS;
+  map->nitems = 0;
+  map->items = calloc(OLD_INITIAL_NSLOTS, sizeof(*map->items));
+  if (!map->items) {
+    free(map);
+    return NULL;
+  }
+  return map;
+}
+
+static void
+old_free(struct old_map *map)
+{
+  for (size_t i = 0; i < map->nslots; i++) {
+    if (map->items[i].key) {
+      free((char *)map->items[i].key);
+      free(map->items[i].value);
+    }
+  }
+  free(map->items);
+  free(map);
+}
+
+static const void *
+old_get(struct old_map *map, const char *key)
+{
+  size_t index = old_hash(key) % map->nslots;
+
+  while (map->items[index].key != NULL) {
+    if (!strcmp(key, map->items[index].key))
+      return map->items[index].value;
+    index = (index + 1) % map->nslots;
+  }
+  return NULL;
+}
+
+static int
+old_set_internal(old_item *items, size_t size, const char *key, void *value,
+                 size_t vsize)
+{
+  size_t index = old_hash(key) % size;
+
+  while (items[index].key != NULL) {
+    if (!strcmp(key, items[index].key)) {
+      free(items[index].value);
+      items[index].value = value;
+      items[index].size = vsize;
+      return 0;
+    }
+    index = (index + 1) % size;
+  }
+
+  key = strdup(key);
+  if (key == NULL)
+    return -1;
+  items[index].key = key;
+  items[index].value = value;
+  items[index].size = vsize;
+  return 1;
+}
+
+static int
+old_expand(struct old_map *map)
+{
+  size_t newsize = map->nslots * 2;
+  old_item *newitems = calloc(newsize, sizeof(*newitems));
+  if (!newitems)
+    return -1;
+
+  for (size_t i = 0; i < map->nslots; i++) {
+    old_item item = map->items[i];
+    if (item.key != NULL) {
+      int rc = old_set_internal(newitems, newsize, item.key, item.value, item.size);
+      free((char *)item.key);
+      if (rc == -1)
+        return -1;
+    }
+  }
+  free(map->items);
+  map->items = newitems;
+  map->nslots = newsize;
+  return 0;
+}
+
+static int
+old_set(struct old_map *map, const char *key, void *value, size_t size)
+{
+  if (map->nitems >= map->nslots / 2 && old_expand(map))
+    return -1;
+
+  void *val = malloc(size);
+  if (!val)
+    return -1;
+  memcpy(val, value, size);
+
+  int rc = old_set_internal(map->items, map->nslots, key, val, size);
+  if (rc != -1)
+    map->nitems += rc;
+  return rc;
+}
+
+
+static char **
+make_keys(size_t n, const char *prefix)
+{
+  char **keys = malloc(n * sizeof(*keys));
+  TEST_ASSERT(keys);
+  for (size_t i = 0; i < n; i++) {
+    char key[64];
+    snprintf(key, sizeof(key), "%s%zu", prefix, i);
+    keys[i] = strdup(key);
+    TEST_ASSERT(keys[i]);
+  }
+  return keys;
+}
+
+static void
+free_keys(char **keys, size_t n)
+{
+  for (size_t i = 0; i < n; i++)
+    free(keys[i]);
+  free(keys);
+}
+
+
+/* ns per operation */
+#define TIMED(n, ...) ({                                                \
+      uint64_t _start = test_now_ns();                                  \
+      __VA_ARGS__;                                                      \
+      (double)(test_now_ns() - _start) / (n); })
+
+
+static void
+bench(size_t n, int print)
+{
+  char **keys = make_keys(n, "node");
+  char **absent = make_keys(n, "absent");
+  size_t found;
+  uint16_t port = 0;
+
+  /* new map */
+  hm_t *map = hm_create();
+  TEST_ASSERT(map);
+  double set = TIMED(n, for (size_t i = 0; i < n; i++) {
+      port = i;
+      TEST_CHECK(hm_set(map, keys[i], &port, sizeof(port)) == 1);
+    });
+  found = 0;
+  double hit = TIMED(n, for (size_t i = 0; i < n; i++)
+                       found += hm_get(map, keys[i]) != NULL);
+  TEST_CHECK_INT(found, n);
+  found = 0;
+  double miss = TIMED(n, for (size_t i = 0; i < n; i++)
+                        found += hm_get(map, absent[i]) != NULL);
+  TEST_CHECK_INT(found, 0);
+  double del = TIMED(n, for (size_t i = 0; i < n; i++)
+                       TEST_CHECK(hm_del(map, keys[i]) == 1));
+  TEST_CHECK_INT(hm_length(map), 0);
+  hm_free(map);
+
+  if (print)
+    printf("%-8s %9zu %10.1f %10.1f %10.1f %10.1f\n", "robin", n, set, hit, miss, del);
+
+  /* old map */
+  struct old_map *old = old_create();
+  TEST_ASSERT(old);
+  set = TIMED(n, for (size_t i = 0; i < n; i++) {
+      port = i;
+      TEST_CHECK(old_set(old, keys[i], &port, sizeof(port)) == 1);
+    });
+  found = 0;
+  hit = TIMED(n, for (size_t i = 0; i < n; i++)
+                found += old_get(old, keys[i]) != NULL);
+  TEST_CHECK_INT(found, n);
+  found = 0;
+  miss = TIMED(n, for (size_t i = 0; i < n; i++)
+                 found += old_get(old, absent[i]) != NULL);
+  TEST_CHECK_INT(found, 0);
+  old_free(old);
+
+  if (print)
+    printf("%-8s %9zu %10.1f %10.1f %10.1f %10s\n", "linear", n, set, hit, miss, "-");
+
+  free_keys(keys, n);
+  free_keys(absent, n);
+}
+
+
+int
+main(int argc, char **argv)
+{
+  size_t maxitems = test_size_arg(argc, argv, 1, 100000);
+
+  /* warm up the allocator, the first map to grow would pay for it */
+  bench(1000, 0);
+
+  printf("%-8s %9s %10s %10s %10s %10s\n", "map", "items", "set ns",
+         "hit ns", "miss ns", "del ns");
+  for (size_t n = 1000; n <= maxitems && n <= 10000000; n *= 10)
+    bench(n, 1);
+
+  return TEST_EXIT();
+}
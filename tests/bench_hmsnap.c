@@ -0,0 +1,82 @@
+/**
+ * Hashmap snapshot benchmark: time to get a map of N items back after
+ * a restart, by loading its snapshot, against inserting the N items
+ * again as a restart without snapshot would. The load is timed with
+ * its checks, then with the first lookups that fault the mapping in,
+ * then with a first modification, which copies the map out of the
+ * mapping. The default size is small, use 1000000 for the real one.
+ *
+ * Usage: bench_hmsnap [NITEMS]
+ */
+#include <unistd.h>
+
+#include "hashmap.h"
+#include "tests.h"
+
+
+static void
+key_of(size_t i, char *key, size_t size)
+{
+  snprintf(key, size, "node%zu", i);
+}
+
+
+int
+main(int argc, char **argv)
+{
+  size_t n = test_size_arg(argc, argv, 1, 100000);
+  char dir[] = "/tmp/bench_hmsnapXXXXXX", path[64], key[32];
+  uint16_t port;
+  hm_t *map, *loaded;
+  size_t found = 0;
+
+  TEST_ASSERT(mkdtemp(dir));
+  snprintf(path, sizeof(path), "%s/map", dir);
+
+  /* a restart without snapshot */
+  uint64_t start = test_now_ns();
+  map = hm_create();
+  TEST_ASSERT(map);
+  for (size_t i = 0; i < n; i++) {
+    key_of(i, key, sizeof(key));
+    port = (uint16_t)i;
+    TEST_ASSERT(hm_set(map, key, &port, sizeof(port)) == 1);
+  }
+  double insert = (test_now_ns() - start) / 1e6;
+
+  start = test_now_ns();
+  TEST_ASSERT(hm_save(map, path) == HM_SUCCESS);
+  double save = (test_now_ns() - start) / 1e6;
+  hm_free(map);
+
+  start = test_now_ns();
+  TEST_ASSERT(hm_load(&loaded, path) == HM_SUCCESS);
+  double load = (test_now_ns() - start) / 1e6;
+
+  start = test_now_ns();
+  for (size_t i = 0; i < n; i++) {
+    key_of(i, key, sizeof(key));
+    const uint16_t *v = hm_get(loaded, key);
+    found += v && *v == (uint16_t)i;
+  }
+  double get = (test_now_ns() - start) / 1e6;
+  TEST_CHECK_INT(found, n);
+
+  start = test_now_ns();
+  port = 0;
+  TEST_CHECK_INT(hm_set(loaded, "node0", &port, sizeof(port)), 0);
+  double copy = (test_now_ns() - start) / 1e6;
+  hm_free(loaded);
+
+  printf("%zu items\n", n);
+  printf("  %-28s %10.2f ms\n", "insert all", insert);
+  printf("  %-28s %10.2f ms\n", "save", save);
+  printf("  %-28s %10.2f ms\n", "load (mmap + checks)", load);
+  printf("  %-28s %10.2f ms\n", "get all, from the mapping", get);
+  printf("  %-28s %10.2f ms\n", "first change (copy)", copy);
+
+  unlink(path);
+  rmdir(dir);
+
+  return TEST_EXIT();
+}
@@ -0,0 +1,194 @@
+/**
+ * Host table benchmark: the four host maps of the client library
+ * filled with NHOSTS hosts, each map keeping its own copy of the names
+ * (hm_create), or all of them sharing a host name table
+ * (hm_create_interned), as icc does. The malloc calls, heap bytes and
+ * resident memory this takes are reported for short names, stored
+ * inline by the maps, and for fully qualified names of NAMELEN
+ * characters. Each case runs in a process of its own, so that the
+ * memory freed by one is not reused by the next.
+ *
+ * malloc, calloc and realloc are counted by the wrappers below.
+ *
+ * Usage: bench_hosttable [NHOSTS [NAMELEN]]
+ */
+#include <inttypes.h>           /* PRIu64 */
+#include <malloc.h>             /* mallinfo2 */
+#include <stdio.h>
+#include <unistd.h>             /* fork, pipe */
+#include <sys/wait.h>
+
+#include "hashmap.h"
+#include "tests.h"
+
+#define BENCH_NMAPS    4        /* hostalloc, hostrelease, hostjob, reconfigalloc */
+#define BENCH_SHORTLEN 10       /* "node000001" */
+#define BENCH_NAMELEN  256
+#define BENCH_INLINE   24       /* KEY_INLINE of the maps */
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static uint64_t nallocs;
+
+void *
+malloc(size_t size)
+{
+  __atomic_fetch_add(&nallocs, 1, __ATOMIC_RELAXED);
+  return __libc_malloc(size);
+}
+
+void *
+calloc(size_t n, size_t size)
+{
+  __atomic_fetch_add(&nallocs, 1, __ATOMIC_RELAXED);
+  return __libc_calloc(n, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+  __atomic_fetch_add(&nallocs, 1, __ATOMIC_RELAXED);
+  return __libc_realloc(ptr, size);
+}
+
+
+struct result {
+  uint64_t nallocs;
+  size_t   heap;                /* bytes */
+  size_t   rss;                 /* bytes */
+};
+
+static size_t nhosts;
+
+
+static size_t
+heap_used(void)
+{
+  struct mallinfo2 mi = mallinfo2();
+  return mi.uordblks + mi.hblkhd;
+}
+
+
+static size_t
+rss(void)
+{
+  unsigned long size, resident = 0;
+  FILE *f = fopen("/proc/self/statm", "r");
+
+  if (f) {
+    if (fscanf(f, "%lu %lu", &size, &resident) != 2)
+      resident = 0;
+    fclose(f);
+  }
+  return resident * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+
+/* the name of host I, of NAMELEN characters */
+static void
+host_name(char *name, size_t i, size_t namelen)
+{
+  snprintf(name, namelen + 1, "node%06zu.compute.cluster.example.org%0*d",
+           i, BENCH_NAMELEN, 0);
+}
+
+
+static void
+fill(int interned, size_t namelen, struct result *res)
+{
+  hm_t *strings = NULL, *maps[BENCH_NMAPS];
+  char name[BENCH_NAMELEN + 1];
+  uint16_t ncpus = 8;
+
+  size_t rss0 = rss();
+  size_t heap0 = heap_used();
+  uint64_t nallocs0 = nallocs;
+
+  if (interned)
+    TEST_ASSERT(strings = hm_create_strings());
+  for (size_t m = 0; m < BENCH_NMAPS; m++)
+    TEST_ASSERT(maps[m] = interned ? hm_create_interned(strings) : hm_create());
+
+  for (size_t i = 0; i < nhosts; i++) {
+    host_name(name, i, namelen);
+    for (size_t m = 0; m < BENCH_NMAPS; m++)
+      TEST_CHECK(hm_set(maps[m], name, &ncpus, sizeof(ncpus)) == 1);
+  }
+
+  res->nallocs = nallocs - nallocs0;
+  res->heap = heap_used() - heap0;
+  res->rss = rss() - rss0;
+
+  for (size_t i = 0; i < nhosts; i += nhosts / 100 + 1) {
+    host_name(name, i, namelen);
+    for (size_t m = 0; m < BENCH_NMAPS; m++) {
+      const uint16_t *n = hm_get(maps[m], name);
+      TEST_CHECK(n && *n == ncpus);
+    }
+  }
+  if (strings)
+    TEST_CHECK_INT(hm_length(strings), nhosts);
+
+  for (size_t m = 0; m < BENCH_NMAPS; m++)
+    hm_free(maps[m]);
+  hm_free(strings);
+}
+
+
+/* fill the maps in a child process */
+static struct result
+run(int interned, size_t namelen)
+{
+  struct result res = { 0 };
+  int fds[2], status;
+
+  TEST_ASSERT(pipe(fds) == 0);
+  fflush(stdout);
+
+  pid_t pid = fork();
+  TEST_ASSERT(pid != -1);
+  if (pid == 0) {
+    close(fds[0]);
+    fill(interned, namelen, &res);
+    if (write(fds[1], &res, sizeof(res)) != sizeof(res))
+      _exit(1);
+    _exit(TEST_EXIT());
+  }
+
+  close(fds[1]);
+  TEST_CHECK(read(fds[0], &res, sizeof(res)) == sizeof(res));
+  close(fds[0]);
+  TEST_ASSERT(waitpid(pid, &status, 0) == pid);
+  TEST_CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+  printf("%-9s %3zu-char names: %10"PRIu64" mallocs %9.1f MiB heap %9.1f MiB RSS\n",
+         interned ? "interned" : "own", namelen, res.nallocs,
+         res.heap / 1048576.0, res.rss / 1048576.0);
+
+  return res;
+}
+
+
+int
+main(int argc, char **argv)
+{
+  nhosts = test_size_arg(argc, argv, 1, 100000);
+  size_t namelen = test_size_arg(argc, argv, 2, 40);
+  TEST_ASSERT(namelen >= BENCH_SHORTLEN && namelen <= BENCH_NAMELEN);
+
+  printf("%zu hosts in %d maps:\n", nhosts, BENCH_NMAPS);
+  run(0, BENCH_SHORTLEN);
+  run(1, BENCH_SHORTLEN);
+  struct result own = run(0, namelen);
+  struct result interned = run(1, namelen);
+
+  /* one copy of each name instead of one per map */
+  if (namelen >= BENCH_INLINE) {
+    TEST_CHECK(interned.nallocs < own.nallocs);
+    TEST_CHECK(interned.heap < own.heap);
+  }
+
+  return TEST_EXIT();
+}
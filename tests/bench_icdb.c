@@ -0,0 +1,160 @@
+/**
+ * icdb command engine benchmark: ops/s and latency of a mix of client
+ * registrations, lookups and monitor reads issued by several execution
+ * streams, either sharing a single context, which serializes them on
+ * one lock and one connection like the former global icdb_mutex, or
+ * with a context each, as the server does.
+ *
+ * Usage: bench_icdb [OPS_PER_XSTREAM [NXSTREAMS]]
+ */
+#include <inttypes.h>           /* PRIu64 */
+#include <abt.h>
+
+#include "icdb.h"
+#include "tests.h"
+#include "testdb.h"
+
+#define BENCH_NODES "n0,n1,n2,n3"
+#define BENCH_MONITOR_CLID "bench-monitor"
+
+struct worker {
+  struct icdb_context *icdb;
+  size_t               id;
+  size_t               nops;
+  size_t               nerrors;
+  struct test_lat      lat;
+};
+
+
+static void
+worker_th(void *arg)
+{
+  struct worker *w = (struct worker *)arg;
+  struct icdb_client client;
+  char clid[UUID_STR_LEN];
+  double cpu, mem, rtime, ptime, ctime;
+  int nprocs, rc = ICDB_SUCCESS;
+
+  for (size_t i = 0; i < w->nops; i++) {
+    uint64_t start = test_now_ns();
+
+    switch (i % 3) {
+    case 0:
+      snprintf(clid, sizeof(clid), "bench-%zu-%zu", w->id, i);
+      rc = icdb_setclient(w->icdb, clid, "bench", "ofi+tcp://bench", BENCH_NODES,
+                          0, w->id + 1, 4, BENCH_NODES, 1);
+      break;
+    case 1:
+      rc = icdb_getclient(w->icdb, clid, &client);
+      break;
+    case 2:
+      rc = icdb_getMonitor(w->icdb, BENCH_MONITOR_CLID, &cpu, &mem, &nprocs,
+                           &rtime, &ptime, &ctime);
+      break;
+    }
+
+    test_lat_add(&w->lat, test_now_ns() - start);
+    if (rc != ICDB_SUCCESS)
+      w->nerrors++;
+  }
+}
+
+
+static int
+setup_monitor(struct icdb_context *icdb)
+{
+  int rc;
+
+  rc = icdb_setclient(icdb, BENCH_MONITOR_CLID, "bench", "ofi+tcp://bench",
+                      BENCH_NODES, 0, 1, 4, BENCH_NODES, 1);
+  if (rc != ICDB_SUCCESS)
+    return rc;
+
+  for (int i = 0; i < 4; i++) {
+    if (testdb_command("SET monitor:n%d %s", i, "127.0.0.1 1024 0.5 4 2 0.25"))
+      return ICDB_FAILURE;
+  }
+
+  return icdb_setmonitor(icdb, BENCH_MONITOR_CLID,
+                         "monitorFlexMPI:"BENCH_MONITOR_CLID":1:current",
+                         "1 0.1 0.02 0.01 0.005 0.1 8");
+}
+
+
+static int
+run(const char *addr, const char *name, size_t nxstreams, int shared, size_t nops)
+{
+  struct worker *w = calloc(nxstreams, sizeof(*w));
+  struct test_lat all = { 0 };
+  size_t nerrors = 0;
+  int rc = 0;
+
+  TEST_ASSERT(w);
+
+  for (size_t i = 0; i < nxstreams; i++) {
+    w[i].id = i;
+    w[i].nops = nops;
+    if (shared && i > 0) {
+      w[i].icdb = w[0].icdb;
+    } else if (icdb_init(&w[i].icdb, (char *)addr) != ICDB_SUCCESS) {
+      fprintf(stderr, "icdb_init: %s\n", w[i].icdb ? icdb_errstr(w[i].icdb) : "no memory");
+      rc = -1;
+      goto end;
+    }
+  }
+
+  if (setup_monitor(w[0].icdb) != ICDB_SUCCESS) {
+    fprintf(stderr, "Monitor setup: %s\n", icdb_errstr(w[0].icdb));
+    rc = -1;
+    goto end;
+  }
+
+  uint64_t start = test_now_ns();
+  rc = test_xstreams_run(nxstreams, worker_th, w, sizeof(*w));
+  uint64_t elapsed = test_now_ns() - start;
+
+  for (size_t i = 0; i < nxstreams; i++) {
+    for (size_t j = 0; j < w[i].lat.n; j++)
+      test_lat_add(&all, w[i].lat.samples[j]);
+    nerrors += w[i].nerrors;
+  }
+
+  printf("%s, %zu xstreams: %.0f ops/s\n", name, nxstreams, all.n / (elapsed / 1e9));
+  test_lat_print(&all, name);
+  TEST_CHECK_INT(nerrors, 0);
+
+ end:
+  for (size_t i = 0; i < nxstreams; i++) {
+    if (!shared || i == 0)
+      icdb_fini(&w[i].icdb);
+    test_lat_free(&w[i].lat);
+  }
+  test_lat_free(&all);
+  free(w);
+  testdb_flush();
+
+  return rc;
+}
+
+
+int
+main(int argc, char **argv)
+{
+  size_t nops = test_size_arg(argc, argv, 1, 300);
+  size_t nxstreams = test_size_arg(argc, argv, 2, 4);
+
+  const char *addr = testdb_start();
+  if (!addr)
+    return TEST_SKIP;
+
+  ABT_init(0, NULL);
+
+  if (run(addr, "shared", nxstreams, 1, nops) ||
+      run(addr, "per-xstream", nxstreams, 0, nops))
+    test_nfailed++;
+
+  ABT_finalize();
+  testdb_stop();
+
+  return TEST_EXIT();
+}
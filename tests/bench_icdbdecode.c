@@ -0,0 +1,224 @@
+/**
+ * Reply decoder benchmark: time to decode a HGETALL client reply with
+ * the schema decoder, against the key-by-key strcmp chain it replaced,
+ * which copied the nodelist in a fixed buffer of ICDB_NODELIST_LEN
+ * bytes. Nodelists of 16 bytes, of the old limit and of 16 times the
+ * old limit are decoded; the old decoding fails on the last two.
+ *
+ * The decoder is static, so icdb.c is included here.
+ *
+ * Usage: bench_icdbdecode [NDECODES]
+ */
+#include "../src/icdb.c"
+
+#include "tests.h"
+
+/* limit of the nodelist before the schema decoder */
+#define ICDB_NODELIST_LEN 512
+
+struct legacy_client {
+  char clid[UUID_STR_LEN];
+  char type[ICC_TYPE_LEN];
+  char addr[ICC_ADDR_LEN];
+  char nodelist[ICDB_NODELIST_LEN];
+  uint16_t provid;
+  uint32_t jobid;
+  uint32_t nnodes;
+  uint64_t nprocs;
+  int32_t reconfig_nprocs;
+  int32_t reconfig_nnodes;
+};
+
+
+/* client_set_hash as it was before the schema decoder */
+static int
+legacy_decode(struct icdb_context *icdb, const redisReply *rep,
+              struct legacy_client *c)
+{
+  int rc = ICDB_SUCCESS;
+  uint64_t u;
+  int64_t i64;
+
+  memset(c, 0, sizeof(*c));
+  icdb->status = ICDB_SUCCESS;
+
+  for (size_t i = 0; i + 1 < rep->elements && rc == ICDB_SUCCESS; i += 2) {
+    const char *key = rep->element[i]->str;
+    const redisReply *r = rep->element[i + 1];
+
+    if (!key) {
+      rc = ICDB_EBADRESP;
+    }
+    else if (!strcmp(key, "clid")) {
+      rc = _icdb_get_str(r, c->clid, UUID_STR_LEN);
+    }
+    else if (!strcmp(key, "type")) {
+      rc = _icdb_get_str(r, c->type, ICC_TYPE_LEN);
+    }
+    else if (!strcmp(key, "addr")) {
+      rc = _icdb_get_str(r, c->addr, ICC_ADDR_LEN);
+    }
+    else if (!strcmp(key, "nodelist")) {
+      rc = _icdb_get_str(r, c->nodelist, ICDB_NODELIST_LEN);
+    }
+    else if (!strcmp(key, "provid")) {
+      if ((rc = _icdb_get_uint(r, UINT16_MAX, &u)) == ICDB_SUCCESS)
+        c->provid = (uint16_t)u;
+    }
+    else if (!strcmp(key, "jobid")) {
+      if ((rc = _icdb_get_uint(r, UINT32_MAX, &u)) == ICDB_SUCCESS)
+        c->jobid = (uint32_t)u;
+    }
+    else if (!strcmp(key, "nnodes")) {
+      if ((rc = _icdb_get_uint(r, UINT32_MAX, &u)) == ICDB_SUCCESS)
+        c->nnodes = (uint32_t)u;
+    }
+    else if (!strcmp(key, "nprocs")) {
+      rc = _icdb_get_uint(r, UINT64_MAX, &c->nprocs);
+    }
+    else if (!strcmp(key, "reconfig_nprocs")) {
+      if ((rc = _icdb_get_int(r, INT32_MIN, INT32_MAX, &i64)) == ICDB_SUCCESS)
+        c->reconfig_nprocs = (int32_t)i64;
+    }
+    else if (!strcmp(key, "reconfig_nnodes")) {
+      if ((rc = _icdb_get_int(r, INT32_MIN, INT32_MAX, &i64)) == ICDB_SUCCESS)
+        c->reconfig_nnodes = (int32_t)i64;
+    }
+
+    if (rc == ICDB_E2BIG) {
+      ICDB_SET_STATUS(icdb, ICDB_E2BIG, "Field %s too long", key);
+    } else if (rc != ICDB_SUCCESS) {
+      ICDB_SET_STATUS(icdb, ICDB_EBADRESP, "Bad value for field %s", key ? key : "?");
+    }
+  }
+
+  return icdb->status;
+}
+
+
+/* a HGETALL reply for a client with a nodelist of LEN bytes */
+static redisReply *
+client_reply(size_t len)
+{
+  char *nodelist = malloc(len + 1);
+  TEST_ASSERT(nodelist);
+  for (size_t i = 0; i < len; i++)
+    nodelist[i] = i % 6 == 5 ? ',' : 'n';
+  nodelist[len] = '\0';
+
+  const char *fields[] = {
+    "clid", "6f1c8a52-26c4-4d3e-9d59-2a4b6a3e0c11",
+    "type", "flexmpi",
+    "addr", "ofi+tcp;ofi_rxm://10.0.0.1:41234",
+    "nodelist", nodelist,
+    "provid", "12",
+    "jobid", "123456",
+    "nnodes", "64",
+    "nprocs", "4096",
+    "reconfig_nprocs", "-8",
+    "reconfig_nnodes", "0",
+  };
+  size_t n = sizeof(fields) / sizeof(fields[0]);
+
+  /* built the way hiredis builds it from the server response */
+  redisReply *rep = calloc(1, sizeof(*rep));
+  TEST_ASSERT(rep);
+  rep->type = REDIS_REPLY_ARRAY;
+  rep->elements = n;
+  rep->element = calloc(n, sizeof(*rep->element));
+  TEST_ASSERT(rep->element);
+  for (size_t i = 0; i < n; i++) {
+    redisReply *r = calloc(1, sizeof(*r));
+    TEST_ASSERT(r);
+    r->type = REDIS_REPLY_STRING;
+    r->len = strlen(fields[i]);
+    r->str = strdup(fields[i]);
+    TEST_ASSERT(r->str);
+    rep->element[i] = r;
+  }
+
+  free(nodelist);
+  return rep;
+}
+
+
+static double
+bench_schema(struct icdb_context *icdb, const redisReply *rep, size_t n,
+             size_t *nfail)
+{
+  struct icdb_client client;
+
+  *nfail = 0;
+  uint64_t start = test_now_ns();
+  for (size_t i = 0; i < n; i++) {
+    arena_reset(icdb->arena);
+    memset(&client, 0, sizeof(client));
+    if (_icdb_decode_hash(icdb, rep, client_schema,
+                          ICDB_NFIELDS(client_schema), &client) != ICDB_SUCCESS)
+      (*nfail)++;
+  }
+  double ns = (double)(test_now_ns() - start) / n;
+
+  TEST_CHECK(*nfail == 0);
+  TEST_CHECK_INT(client.jobid, 123456);
+  TEST_CHECK_INT(client.reconfig_nprocs, -8);
+  TEST_CHECK(client.nodelist && strlen(client.nodelist) == rep->element[7]->len);
+
+  return ns;
+}
+
+
+static double
+bench_legacy(struct icdb_context *icdb, const redisReply *rep, size_t n,
+             size_t *nfail)
+{
+  struct legacy_client client;
+
+  *nfail = 0;
+  uint64_t start = test_now_ns();
+  for (size_t i = 0; i < n; i++) {
+    if (legacy_decode(icdb, rep, &client) != ICDB_SUCCESS)
+      (*nfail)++;
+  }
+  double ns = (double)(test_now_ns() - start) / n;
+
+  if (rep->element[7]->len < ICDB_NODELIST_LEN) {
+    TEST_CHECK(*nfail == 0);
+    TEST_CHECK_INT(client.jobid, 123456);
+  } else {
+    TEST_CHECK(*nfail == n);
+  }
+
+  return ns;
+}
+
+
+int
+main(int argc, char **argv)
+{
+  size_t ndecodes = test_size_arg(argc, argv, 1, 10000);
+  const size_t lens[] = { 16, ICDB_NODELIST_LEN, 16 * ICDB_NODELIST_LEN };
+
+  struct icdb_context *icdb = calloc(1, sizeof(*icdb));
+  TEST_ASSERT(icdb);
+  icdb->arena = arena_create(0);
+  TEST_ASSERT(icdb->arena);
+
+  printf("%-10s %14s %14s %10s\n", "nodelist", "schema ns", "strcmp ns", "failed");
+  for (size_t i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+    redisReply *rep = client_reply(lens[i]);
+    size_t nfail_schema, nfail_legacy;
+
+    double schema = bench_schema(icdb, rep, ndecodes, &nfail_schema);
+    double legacy = bench_legacy(icdb, rep, ndecodes, &nfail_legacy);
+    printf("%-10zu %14.1f %14.1f %4zu/%-5zu\n", lens[i], schema, legacy,
+           nfail_schema, nfail_legacy);
+
+    freeReplyObject(rep);
+  }
+
+  arena_free(icdb->arena);
+  free(icdb);
+
+  return TEST_EXIT();
+}
@@ -0,0 +1,170 @@
+/**
+ * Statistics benchmark: cost of a timed scope and of icstats_record,
+ * alone and with NXSTREAMS execution streams recording to the same
+ * histogram, then the overhead of a timed scope on a ping RPC, the
+ * same handler with and without ICSTATS_SCOPE, in alternating blocks
+ * so that both see the same conditions. The ping client is a Margo
+ * instance of this process (see testmargo.h), the ping part is skipped
+ * if Margo cannot be initialized.
+ *
+ * The overhead is reported, not checked, it is within the noise of a
+ * ping on a loaded machine.
+ *
+ * Usage: bench_icstats [NOPS [NXSTREAMS [NPINGS]]]
+ */
+#include <margo.h>
+
+#include "icstats.h"
+#include "rpc.h"
+#include "tests.h"
+#include "testmargo.h"
+
+#define BENCH_PING_STATS_NAME "icc_test_ping_stats"
+#define BENCH_BLOCK 100
+
+static size_t nops;
+
+
+static void
+ping_stats_cb(hg_handle_t h)
+{
+  ICSTATS_SCOPE("bench", "ping");
+  hg_return_t hret;
+  lowmem_in_t in;
+  rpc_out_t out;
+
+  out.rc = RPC_SUCCESS;
+
+  hret = margo_get_input(h, &in);
+  if (hret != HG_SUCCESS)
+    out.rc = RPC_FAILURE;
+  else
+    margo_free_input(h, &in);
+
+  margo_respond(h, &out);
+  margo_destroy(h);
+}
+DEFINE_MARGO_RPC_HANDLER(ping_stats_cb);
+
+
+static void
+record_worker(void *arg)
+{
+  struct icstats_hist *h = *(struct icstats_hist **)arg;
+
+  for (size_t i = 0; i < nops; i++)
+    icstats_record(h, i);
+}
+
+
+/* nanoseconds per operation of NOPS timed scopes */
+static double
+bench_scope(void)
+{
+  uint64_t start = test_now_ns();
+  for (size_t i = 0; i < nops; i++) {
+    ICSTATS_SCOPE("bench", "scope");
+    __asm__ volatile("" ::: "memory");
+  }
+  return (double)(test_now_ns() - start) / nops;
+}
+
+
+static double
+bench_record(size_t nxstreams)
+{
+  struct icstats_hist *h = icstats_hist("bench", "record");
+  struct icstats_hist **args = malloc(nxstreams * sizeof(*args));
+  TEST_ASSERT(h && args);
+
+  for (size_t i = 0; i < nxstreams; i++)
+    args[i] = h;
+
+  uint64_t count = h->count;
+  uint64_t start = test_now_ns();
+  TEST_ASSERT(test_xstreams_run(nxstreams, record_worker, args, sizeof(*args)) == 0);
+  double ns = (double)(test_now_ns() - start) / nops;
+  TEST_CHECK_INT(h->count - count, nxstreams * nops);
+
+  free(args);
+  return ns;
+}
+
+
+/* send NPINGS of each ping, in alternating blocks, and print the
+   overhead of the instrumented one. SCOPE is the cost of a scope */
+static void
+bench_ping(size_t npings, double scope)
+{
+  struct test_lat plain = { 0 }, timed = { 0 };
+  hg_id_t ping, ping_stats;
+  margo_instance_id mid;
+  hg_addr_t addr;
+
+  mid = testmargo_start(1, &ping);
+  if (mid == MARGO_INSTANCE_NULL) {
+    printf("ping: skipped, Margo could not be initialized\n");
+    return;
+  }
+  ping_stats = MARGO_REGISTER(mid, BENCH_PING_STATS_NAME, lowmem_in_t, rpc_out_t, NULL);
+  MARGO_REGISTER(testmargo_client(0), BENCH_PING_STATS_NAME, lowmem_in_t,
+                 rpc_out_t, ping_stats_cb);
+  TEST_ASSERT(margo_addr_lookup(mid, testmargo_addr(0), &addr) == HG_SUCCESS);
+
+  struct icstats_hist *h = icstats_hist("bench", "ping");
+  lowmem_in_t in = { .nodename = "node0" };
+  uint64_t count = h ? h->count : 0;
+  size_t nfailed = 0;
+
+  for (size_t n = 0; n < npings; n += BENCH_BLOCK) {
+    for (int k = 0; k < 2; k++) {
+      for (size_t i = 0; i < BENCH_BLOCK; i++) {
+        int rc;
+        uint64_t start = test_now_ns();
+        if (rpc_send(mid, addr, k ? ping_stats : ping, &in, &rc, RPC_TIMEOUT_MS_DEFAULT)
+            || rc != RPC_SUCCESS)
+          nfailed++;
+        TEST_CHECK(test_lat_add(k ? &timed : &plain, test_now_ns() - start) == 0);
+      }
+    }
+  }
+  TEST_CHECK_INT(nfailed, 0);
+  TEST_CHECK(h && h->count - count == timed.n);
+
+  double p50 = test_lat_pct(&plain, 50);
+  printf("ping, %zu each, round trip:\n", plain.n);
+  test_lat_print(&plain, "plain");
+  test_lat_print(&timed, "ICSTATS_SCOPE");
+  printf("overhead: %+.2f%% at p50, a scope is %.2f%% of a plain ping\n",
+         p50 ? 100 * (test_lat_pct(&timed, 50) - p50) / p50 : 0.0,
+         p50 ? 100 * scope / p50 : 0.0);
+
+  margo_addr_free(mid, addr);
+  test_lat_free(&plain);
+  test_lat_free(&timed);
+  testmargo_stop();
+}
+
+
+int
+main(int argc, char **argv)
+{
+  nops = test_size_arg(argc, argv, 1, 1000000);
+  size_t nxstreams = test_size_arg(argc, argv, 2, 8);
+  size_t npings = test_size_arg(argc, argv, 3, 2000);
+
+  TEST_ASSERT(nops > 0 && nxstreams > 0);
+  ABT_init(0, NULL);
+
+  double scope = bench_scope();
+  printf("ICSTATS_SCOPE: %.1f ns\n", scope);
+  printf("icstats_record, 1 xstream: %.1f ns\n", bench_record(1));
+  printf("icstats_record, %zu xstreams on one histogram: %.1f ns per round\n",
+         nxstreams, bench_record(nxstreams));
+
+  ABT_finalize();
+
+  bench_ping(npings, scope);
+
+  return TEST_EXIT();
+}
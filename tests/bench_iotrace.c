@@ -0,0 +1,192 @@
+/**
+ * IO-set trace benchmark: latency added to the end of an IO phase by
+ * tracing it, for NPHASES phases on each of NXSTREAMS handler
+ * execution streams. The CSV line written and flushed under a lock,
+ * as hint_io_end_cb used to do, is compared with a record appended to
+ * the trace rings, drained by the writer ULT on an execution stream of
+ * its own.
+ *
+ * iotrace.c is included with its Margo calls redirected.
+ *
+ * Usage: bench_iotrace [NPHASES [NXSTREAMS]]
+ */
+#include <inttypes.h>           /* PRIu64 */
+#include <stdio.h>
+#include <stdlib.h>             /* mkdtemp */
+#include <unistd.h>             /* unlink, rmdir */
+#include <margo.h>
+
+#include "tests.h"
+
+static ABT_pool    writer_pool;
+static ABT_xstream writer_xstream;
+
+
+static int
+mock_get_handler_pool(margo_instance_id mid, ABT_pool *pool)
+{
+  (void)mid;
+  *pool = writer_pool;
+  return 0;
+}
+
+static void
+mock_thread_sleep(margo_instance_id mid, double ms)
+{
+  (void)mid;
+  test_sleep_ms((unsigned)ms);
+}
+
+static int
+mock_push_prefinalize_callback(margo_instance_id mid, margo_finalize_callback_t cb, void *arg)
+{
+  (void)mid;
+  (void)cb;
+  (void)arg;
+  return 0;
+}
+
+static void
+mock_log(margo_instance_id mid, const char *fmt, ...)
+{
+  (void)mid;
+  (void)fmt;
+}
+
+#undef margo_get_handler_pool
+#define margo_get_handler_pool mock_get_handler_pool
+#undef margo_thread_sleep
+#define margo_thread_sleep mock_thread_sleep
+#undef margo_push_prefinalize_callback
+#define margo_push_prefinalize_callback mock_push_prefinalize_callback
+#undef margo_error
+#define margo_error mock_log
+#undef margo_info
+#define margo_info mock_log
+
+#include "../src/iotrace.c"
+
+static size_t nphases, nxstreams;
+
+static char dir[] = "/tmp/bench_iotrace.XXXXXX";
+
+/* the former CSV output */
+static ABT_mutex csvlock;
+static FILE     *csv;
+
+static struct iotrace *trace;
+
+struct phase_arg {
+  size_t          id;
+  int             usecsv;
+  struct test_lat lat;
+};
+
+
+static void
+phase_th(void *arg)
+{
+  struct phase_arg *a = (struct phase_arg *)arg;
+
+  for (size_t i = 0; i < nphases; i++) {
+    uint64_t now = test_now_ns();
+    struct iotrace_rec rec = {
+      .waitstart = now - 2000, .iostart = now - 1000, .ioend = now,
+      .nbytes = 1 << 20, .jobid = a->id, .jobstepid = 0, .witer = 10,
+      .setid = 1, .nslices = 1, .type = IOTRACE_PHASE,
+    };
+
+    uint64_t start = test_now_ns();
+    if (a->usecsv) {
+      ABT_mutex_lock(csvlock);
+      fprintf(csv, "\"%"PRIu32".%"PRIu32"\",%"PRIu32",%"PRIu64",%"PRIu64",%"PRIu64
+              ",%"PRIu64",%"PRId32",%"PRIu32"\n", rec.jobid, rec.jobstepid, rec.witer,
+              rec.waitstart, rec.iostart, rec.ioend, rec.nbytes, rec.setid, rec.nslices);
+      fflush(csv);
+      ABT_mutex_unlock(csvlock);
+    } else {
+      iotrace_append(trace, &rec);
+    }
+    test_lat_add(&a->lat, test_now_ns() - start);
+  }
+}
+
+
+static void
+run(int usecsv)
+{
+  struct phase_arg *args = calloc(nxstreams, sizeof(*args));
+  struct test_lat lat = { 0 };
+
+  TEST_ASSERT(args);
+  for (size_t i = 0; i < nxstreams; i++) {
+    args[i].id = i;
+    args[i].usecsv = usecsv;
+  }
+
+  TEST_ASSERT(test_xstreams_run(nxstreams, phase_th, args, sizeof(*args)) == 0);
+
+  for (size_t i = 0; i < nxstreams; i++) {
+    TEST_CHECK_INT(args[i].lat.n, nphases);
+    for (size_t j = 0; j < args[i].lat.n; j++)
+      TEST_CHECK(test_lat_add(&lat, args[i].lat.samples[j]) == 0);
+    test_lat_free(&args[i].lat);
+  }
+  test_lat_print(&lat, usecsv ? "csv+fflush" : "iotrace");
+
+  test_lat_free(&lat);
+  free(args);
+}
+
+
+int
+main(int argc, char **argv)
+{
+  char csvpath[sizeof(dir) + 32], tracepath[sizeof(dir) + 32];
+  struct iotrace_stats s;
+
+  /* the rings hold all the records by default, none is dropped */
+  nphases = test_size_arg(argc, argv, 1, IOTRACE_RINGSIZE / 2);
+  nxstreams = test_size_arg(argc, argv, 2, 4);
+  TEST_ASSERT(nxstreams > 0);
+
+  TEST_ASSERT(mkdtemp(dir));
+  snprintf(csvpath, sizeof(csvpath), "%s/iosets_out.csv", dir);
+  snprintf(tracepath, sizeof(tracepath), "%s/iosets_out.trace", dir);
+
+  ABT_init(0, NULL);
+
+  TEST_ASSERT(ABT_pool_create_basic(ABT_POOL_FIFO_WAIT, ABT_POOL_ACCESS_MPMC,
+                                    ABT_TRUE, &writer_pool) == ABT_SUCCESS);
+  TEST_ASSERT(ABT_xstream_create_basic(ABT_SCHED_BASIC_WAIT, 1, &writer_pool,
+                                       ABT_SCHED_CONFIG_NULL, &writer_xstream) == ABT_SUCCESS);
+
+  TEST_ASSERT(ABT_mutex_create(&csvlock) == ABT_SUCCESS);
+  csv = fopen(csvpath, "w");
+  TEST_ASSERT(csv);
+  TEST_ASSERT(iotrace_init(&trace, MARGO_INSTANCE_NULL, tracepath, 0, nxstreams) == 0);
+
+  printf("%zu IO phases on each of %zu handler xstreams, time added per phase:\n",
+         nphases, nxstreams);
+  run(1);
+  run(0);
+
+  iotrace_stats(trace, &s);
+  iotrace_fini(&trace);
+  TEST_CHECK_INT(s.appended + s.dropped, nphases * nxstreams);
+  if (nphases <= IOTRACE_RINGSIZE)
+    TEST_CHECK_INT(s.dropped, 0);
+  printf("iotrace: %"PRIu64" appended, %"PRIu64" dropped\n", s.appended, s.dropped);
+
+  fclose(csv);
+  ABT_mutex_free(&csvlock);
+  ABT_xstream_join(writer_xstream);
+  ABT_xstream_free(&writer_xstream);
+  ABT_finalize();
+
+  unlink(csvpath);
+  unlink(tracepath);
+  rmdir(dir);
+
+  return TEST_EXIT();
+}
@@ -0,0 +1,163 @@
+/**
+ * Client iteration benchmark: time to prepare the fan-out to the
+ * "alert" clients among NCLIENTS registered ones, with one HGETALL per
+ * client as before icdb_iter_clients, with icdb_iter_clients, and
+ * through icdb_getclients2 and icdb_getclients built on it. Results
+ * are checked against the registered clients.
+ *
+ * Usage: bench_iter [NCLIENTS]
+ */
+#include <abt.h>
+
+#include "icdb.h"
+#include "tests.h"
+#include "testdb.h"
+
+#define BENCH_TYPE       "alert"
+#define BENCH_OTHER_TYPE "flexmpi"
+#define BENCH_NODES      "n0,n1"
+#define CLIENTS_PER_JOB  8
+
+struct collect {
+  size_t   n;
+  size_t   nbad;            /* not matching the filter */
+  uint64_t sum;             /* of client indexes, to spot duplicates */
+  uint32_t jobid;
+};
+
+
+static size_t
+client_index(const char *clid)
+{
+  return strtoull(clid + strlen("bench-"), NULL, 10);
+}
+
+
+static int
+collect_cb(const struct icdb_client *client, void *arg)
+{
+  struct collect *c = (struct collect *)arg;
+
+  c->n++;
+  c->sum += client_index(client->clid);
+  if (strcmp(client->type, BENCH_TYPE) || !client->addr[0] ||
+      (c->jobid && client->jobid != c->jobid))
+    c->nbad++;
+
+  return 0;
+}
+
+
+static int
+populate(struct icdb_context *icdb, size_t n, uint64_t *sum)
+{
+  char clid[UUID_STR_LEN], addr[64];
+  int rc;
+
+  *sum = 0;
+  for (size_t i = 0; i < n; i++) {
+    /* every other client gets the alert type */
+    const char *type = i % 2 ? BENCH_OTHER_TYPE : BENCH_TYPE;
+    snprintf(clid, sizeof(clid), "bench-%zu", i);
+    snprintf(addr, sizeof(addr), "ofi+tcp://10.0.%zu.%zu:1234", i / 256, i % 256);
+    rc = icdb_setclient(icdb, clid, type, addr, BENCH_NODES, 0,
+                        i / CLIENTS_PER_JOB + 1, 4, BENCH_NODES, 1);
+    if (rc != ICDB_SUCCESS)
+      return rc;
+    if (i % 2 == 0)
+      *sum += i;
+  }
+  return ICDB_SUCCESS;
+}
+
+
+int
+main(int argc, char **argv)
+{
+  size_t nclients = test_size_arg(argc, argv, 1, 2000);
+  struct icdb_context *icdb;
+  struct icdb_client client;
+  uint64_t expected, start;
+  size_t nalert = (nclients + 1) / 2;
+
+  const char *addr = testdb_start();
+  if (!addr)
+    return TEST_SKIP;
+
+  ABT_init(0, NULL);
+  TEST_ASSERT(icdb_init(&icdb, (char *)addr) == ICDB_SUCCESS);
+
+  start = test_now_ns();
+  TEST_ASSERT(populate(icdb, nclients, &expected) == ICDB_SUCCESS);
+  printf("%zu clients registered in %.1f ms\n", nclients,
+         (test_now_ns() - start) / 1e6);
+
+  /* one round trip per client, the clids being known */
+  struct collect c = { 0 };
+  char clid[UUID_STR_LEN];
+  start = test_now_ns();
+  for (size_t i = 0; i < nclients; i += 2) {
+    snprintf(clid, sizeof(clid), "bench-%zu", i);
+    TEST_CHECK(icdb_getclient(icdb, clid, &client) == ICDB_SUCCESS);
+    collect_cb(&client, &c);
+  }
+  printf("HGETALL per client: %.1f ms\n", (test_now_ns() - start) / 1e6);
+  TEST_CHECK_INT(c.n, nalert);
+
+  size_t batches[] = { 0, 16, 1024 };
+  for (size_t i = 0; i < sizeof(batches) / sizeof(batches[0]); i++) {
+    struct icdb_client_filter filter = { .jobid = 0, .type = BENCH_TYPE };
+    memset(&c, 0, sizeof(c));
+    start = test_now_ns();
+    TEST_CHECK(icdb_iter_clients(icdb, &filter, batches[i], collect_cb, &c)
+               == ICDB_SUCCESS);
+    printf("icdb_iter_clients, batch %zu: %.1f ms\n", batches[i],
+           (test_now_ns() - start) / 1e6);
+    TEST_CHECK_INT(c.n, nalert);
+    TEST_CHECK_INT(c.sum, expected);
+    TEST_CHECK_INT(c.nbad, 0);
+  }
+
+  /* the caller-driven cursor of lowmem_act */
+  struct icdb_client *clients = NULL;
+  size_t count;
+  uint64_t cursor = 0;
+  memset(&c, 0, sizeof(c));
+  start = test_now_ns();
+  do {
+    TEST_ASSERT(icdb_getclients2(icdb, 0, BENCH_TYPE, &clients, &count, &cursor)
+                == ICDB_SUCCESS);
+    for (size_t i = 0; i < count; i++)
+      collect_cb(&clients[i], &c);
+  } while (cursor != 0);
+  printf("icdb_getclients2: %.1f ms\n", (test_now_ns() - start) / 1e6);
+  free(clients);
+  TEST_CHECK_INT(c.n, nalert);
+  TEST_CHECK_INT(c.sum, expected);
+  TEST_CHECK_INT(c.nbad, 0);
+
+  /* per job, with a too small array first */
+  struct icdb_client jobclients[CLIENTS_PER_JOB];
+  count = 1;
+  if (nclients > 1) {
+    TEST_CHECK_INT(icdb_getclients(icdb, 1, jobclients, &count), ICDB_E2BIG);
+    TEST_CHECK_INT(count, CLIENTS_PER_JOB < nclients ? CLIENTS_PER_JOB : nclients);
+  }
+  size_t njobs = (nclients + CLIENTS_PER_JOB - 1) / CLIENTS_PER_JOB, total = 0;
+  start = test_now_ns();
+  for (uint32_t jobid = 1; jobid <= njobs; jobid++) {
+    count = CLIENTS_PER_JOB;
+    TEST_CHECK(icdb_getclients(icdb, jobid, jobclients, &count) == ICDB_SUCCESS);
+    for (size_t i = 0; i < count; i++)
+      TEST_CHECK_INT(jobclients[i].jobid, jobid);
+    total += count;
+  }
+  printf("icdb_getclients, %zu jobs: %.1f ms\n", njobs, (test_now_ns() - start) / 1e6);
+  TEST_CHECK_INT(total, nclients);
+
+  icdb_fini(&icdb);
+  ABT_finalize();
+  testdb_stop();
+
+  return TEST_EXIT();
+}
@@ -0,0 +1,165 @@
+/**
+ * Monitor read benchmark: latency of icdb_getMonitor, the input of
+ * each malleability decision, with 1k, 10k and 100k unrelated keys in
+ * the database. The iteration key of the client is found through the
+ * index maintained by icdb_setmonitor, and for comparison through a
+ * keyspace scan as for monitors that do not maintain it. The values
+ * read and the rolling iteration time averages are checked.
+ *
+ * Usage: bench_monitor [MAXKEYS [NREADS]]
+ */
+#include <math.h>               /* fabs */
+#include <abt.h>
+
+#include "icdb.h"
+#include "tests.h"
+#include "testdb.h"
+
+#define BENCH_CLID  "bench-monitor"
+#define BENCH_NODES "n0,n1,n2,n3"
+#define BENCH_ITER  "monitorFlexMPI:"BENCH_CLID":1:current"
+
+#define CHECK_DOUBLE(a,b) TEST_CHECK(fabs((a) - (b)) < 1e-9)
+
+
+static void
+setup(struct icdb_context *icdb)
+{
+  TEST_ASSERT(icdb_setclient(icdb, BENCH_CLID, "flexmpi", "ofi+tcp://bench",
+                             BENCH_NODES, 0, 1, 4, BENCH_NODES, 4) == ICDB_SUCCESS);
+
+  /* node monitors: cpu rate i / 10, memory rate i / 100 */
+  for (int i = 0; i < 4; i++) {
+    char val[64];
+    snprintf(val, sizeof(val), "10.0.0.%d 1024 %f 4 2 %f", i, i / 100., i / 10.);
+    TEST_ASSERT(testdb_command("SET monitor:n%d %s", i, val) == 0);
+  }
+}
+
+
+static void
+check_values(struct icdb_context *icdb)
+{
+  double cpu, mem, rtime, ptime, ctime;
+  int nprocs;
+
+  TEST_ASSERT(icdb_getMonitor(icdb, BENCH_CLID, &cpu, &mem, &nprocs,
+                              &rtime, &ptime, &ctime) == ICDB_SUCCESS);
+  CHECK_DOUBLE(cpu, 0.15);
+  CHECK_DOUBLE(mem, 0.015);
+  CHECK_DOUBLE(rtime, 0.02);
+  CHECK_DOUBLE(ptime, 0.01);
+  CHECK_DOUBLE(ctime, 0.005);
+  TEST_CHECK_INT(nprocs, 8);
+}
+
+
+static void
+bench(struct icdb_context *icdb, size_t nkeys, size_t nreads)
+{
+  double cpu, mem, rtime, ptime, ctime;
+  int nprocs;
+  struct test_lat indexed = { 0 }, scanned = { 0 };
+  char name[64];
+
+  setup(icdb);
+  TEST_ASSERT(testdb_fill("bench:unrelated", nkeys) == 0);
+
+  /* index maintained by the writer */
+  TEST_ASSERT(icdb_setmonitor(icdb, BENCH_CLID, BENCH_ITER,
+                              "1 0.1 0.02 0.01 0.005 0.1 8") == ICDB_SUCCESS);
+  check_values(icdb);
+  for (size_t i = 0; i < nreads; i++) {
+    uint64_t start = test_now_ns();
+    TEST_CHECK(icdb_getMonitor(icdb, BENCH_CLID, &cpu, &mem, &nprocs,
+                               &rtime, &ptime, &ctime) == ICDB_SUCCESS);
+    test_lat_add(&indexed, test_now_ns() - start);
+  }
+
+  /* a writer that only SETs the iteration key: each read scans the
+     keyspace, as KEYS did, once the index is dropped */
+  for (size_t i = 0; i < nreads; i++) {
+    TEST_ASSERT(testdb_command("DEL index:monitorFlexMPI:"BENCH_CLID) == 0);
+    uint64_t start = test_now_ns();
+    TEST_CHECK(icdb_getMonitor(icdb, BENCH_CLID, &cpu, &mem, &nprocs,
+                               &rtime, &ptime, &ctime) == ICDB_SUCCESS);
+    test_lat_add(&scanned, test_now_ns() - start);
+  }
+  check_values(icdb);
+
+  snprintf(name, sizeof(name), "indexed, %zu keys", nkeys);
+  test_lat_print(&indexed, name);
+  snprintf(name, sizeof(name), "scanned, %zu keys", nkeys);
+  test_lat_print(&scanned, name);
+
+  test_lat_free(&indexed);
+  test_lat_free(&scanned);
+  testdb_flush();
+}
+
+
+static void
+test_missing(struct icdb_context *icdb)
+{
+  double cpu, mem, rtime, ptime, ctime;
+  int nprocs;
+
+  setup(icdb);
+  TEST_CHECK_INT(icdb_getMonitor(icdb, BENCH_CLID, &cpu, &mem, &nprocs,
+                                 &rtime, &ptime, &ctime), ICDB_NORESULT);
+  testdb_flush();
+}
+
+
+static void
+test_window(struct icdb_context *icdb)
+{
+  struct icdb_monitor_avg avg;
+
+  /* samples i and 2i for i = 1..10, window of 4 */
+  for (int i = 1; i <= 10; i++) {
+    TEST_ASSERT(icdb_monitor_sample(icdb, BENCH_CLID, i, 2 * i, 4, &avg)
+                == ICDB_SUCCESS);
+    uint32_t n = i < 4 ? i : 4;
+    TEST_CHECK_INT(avg.nsamples, n);
+    /* mean of i-n+1..i */
+    CHECK_DOUBLE(avg.rtime, i - (n - 1) / 2.);
+    CHECK_DOUBLE(avg.ctime, 2 * (i - (n - 1) / 2.));
+  }
+
+  TEST_CHECK(icdb_monitor_reset(icdb, BENCH_CLID) == ICDB_SUCCESS);
+  TEST_ASSERT(icdb_monitor_sample(icdb, BENCH_CLID, 3, 1, 4, &avg) == ICDB_SUCCESS);
+  TEST_CHECK_INT(avg.nsamples, 1);
+  CHECK_DOUBLE(avg.rtime, 3);
+  CHECK_DOUBLE(avg.ctime, 1);
+
+  testdb_flush();
+}
+
+
+int
+main(int argc, char **argv)
+{
+  size_t maxkeys = test_size_arg(argc, argv, 1, 10000);
+  size_t nreads = test_size_arg(argc, argv, 2, 50);
+  struct icdb_context *icdb;
+
+  const char *addr = testdb_start();
+  if (!addr)
+    return TEST_SKIP;
+
+  ABT_init(0, NULL);
+  TEST_ASSERT(icdb_init(&icdb, (char *)addr) == ICDB_SUCCESS);
+
+  test_missing(icdb);
+  test_window(icdb);
+
+  for (size_t nkeys = 1000; nkeys <= maxkeys && nkeys <= 100000; nkeys *= 10)
+    bench(icdb, nkeys, nreads);
+
+  icdb_fini(&icdb);
+  ABT_finalize();
+  testdb_stop();
+
+  return TEST_EXIT();
+}
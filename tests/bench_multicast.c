@@ -0,0 +1,103 @@
+/**
+ * Multicast benchmark: time for the server to deliver one message to N
+ * clients, by sending it to every client itself (flat, rpc_isend and
+ * rpc_wait_all) against relaying it through the tree of rpc_multicast,
+ * for N doubling up to NCLIENTS. The clients are Margo instances of
+ * this process (see testmargo.h). The default size is small, use a few
+ * hundred clients for the real one.
+ *
+ * Usage: bench_multicast [NCLIENTS [NROUNDS [FANOUT]]]
+ */
+#include <margo.h>
+
+#include "addrcache.h"
+#include "rpc.h"
+#include "tests.h"
+#include "testmargo.h"
+
+
+int
+main(int argc, char **argv)
+{
+  size_t nclients = test_size_arg(argc, argv, 1, 32);
+  size_t nrounds = test_size_arg(argc, argv, 2, 10);
+  size_t fanout = test_size_arg(argc, argv, 3, RPC_MULTICAST_FANOUT);
+  struct addrcache *cache;
+  margo_instance_id mid;
+  hg_id_t ping, mcast;
+
+  TEST_ASSERT(nclients > 0);
+  mid = testmargo_start(nclients, &ping);
+  if (mid == MARGO_INSTANCE_NULL) {
+    fprintf(stderr, "Margo could not be initialized\n");
+    return TEST_SKIP;
+  }
+  mcast = MARGO_REGISTER(mid, RPC_MULTICAST_NAME, multicast_in_t, rpc_out_t, NULL);
+
+  /* as the server has them, addresses looked up once and cached */
+  TEST_ASSERT(addrcache_init(&cache, mid, nclients, 0) == 0);
+  const char **addrstrs = calloc(nclients, sizeof(*addrstrs));
+  hg_addr_t *addrs = calloc(nclients, sizeof(*addrs));
+  TEST_ASSERT(addrstrs && addrs);
+  for (size_t i = 0; i < nclients; i++) {
+    addrstrs[i] = testmargo_addr(i);
+    TEST_ASSERT(addrcache_lookup(cache, mid, addrstrs[i], &addrs[i]) == HG_SUCCESS);
+  }
+
+  struct rpc_batch batch;
+  rpc_batch_init(&batch, mid);
+  batch.addrcache = cache;
+
+  lowmem_in_t in = { .nodename = "node0" };
+
+  printf("fanout %zu, %zu rounds, broadcast time in us\n", fanout, nrounds);
+  printf("%8s %10s %10s %10s %10s\n", "clients", "flat p50", "flat p99",
+         "tree p50", "tree p99");
+  for (size_t n = 1; ; n *= 2) {
+    struct test_lat flat = { 0 }, tree = { 0 };
+
+    if (n > nclients)
+      n = nclients;
+
+    for (size_t round = 0; round < nrounds; round++) {
+      uint64_t received = testmargo_received();
+      uint64_t start = test_now_ns();
+      size_t nfailed = 0;
+      for (size_t i = 0; i < n; i++)
+        nfailed += rpc_isend(&batch, addrs[i], ping, &in, RPC_TIMEOUT_MS_DEFAULT, NULL, NULL) != 0;
+      nfailed += rpc_wait_all(&batch);
+      TEST_CHECK(test_lat_add(&flat, test_now_ns() - start) == 0);
+      TEST_CHECK_INT(nfailed, 0);
+      TEST_CHECK_INT(testmargo_received() - received, n);
+    }
+
+    for (size_t round = 0; round < nrounds; round++) {
+      multicast_in_t mcin = { .code = RPC_LOWMEM, .fanout = fanout };
+      uint64_t received = testmargo_received();
+      uint64_t start = test_now_ns();
+      size_t nfailed = rpc_multicast(&batch, mcast, &mcin, addrstrs, n,
+                                     RPC_TIMEOUT_MS_DEFAULT, NULL, NULL);
+      TEST_CHECK(test_lat_add(&tree, test_now_ns() - start) == 0);
+      TEST_CHECK_INT(nfailed, 0);
+      TEST_CHECK_INT(testmargo_received() - received, n);
+    }
+
+    printf("%8zu %10.1f %10.1f %10.1f %10.1f\n", n,
+           test_lat_pct(&flat, 50) / 1e3, test_lat_pct(&flat, 99) / 1e3,
+           test_lat_pct(&tree, 50) / 1e3, test_lat_pct(&tree, 99) / 1e3);
+    test_lat_free(&flat);
+    test_lat_free(&tree);
+    if (n == nclients)
+      break;
+  }
+  rpc_batch_fini(&batch);
+
+  for (size_t i = 0; i < nclients; i++)
+    margo_addr_free(mid, addrs[i]);
+  free(addrs);
+  free(addrstrs);
+  addrcache_fini(&cache);
+  testmargo_stop();
+
+  return TEST_EXIT();
+}
@@ -0,0 +1,110 @@
+/**
+ * Broadcast benchmark: time for the server to deliver one RPC to N
+ * clients with a blocking rpc_send per client, as the notification
+ * loops did, against rpc_isend and rpc_wait_all, which have all the
+ * RPCs in flight at once. The clients are Margo instances of this
+ * process (see testmargo.h), NDEAD of them are finalized to measure
+ * what unreachable clients cost, each one a timeout of BENCH_TIMEOUT_MS
+ * for the blocking loop.
+ *
+ * Usage: bench_rpcbatch [NCLIENTS [NDEAD [NROUNDS]]]
+ */
+#include <margo.h>
+
+#include "rpc.h"
+#include "tests.h"
+#include "testmargo.h"
+
+#define BENCH_TIMEOUT_MS 500
+
+static size_t ndone;
+
+
+static void
+done(margo_instance_id mid, int ret, int retcode, void *arg)
+{
+  (void)mid;
+  (void)arg;
+
+  ndone += ret == 0 && retcode == RPC_SUCCESS;
+}
+
+
+int
+main(int argc, char **argv)
+{
+  size_t nclients = test_size_arg(argc, argv, 1, 16);
+  size_t ndead = test_size_arg(argc, argv, 2, 0);
+  size_t nrounds = test_size_arg(argc, argv, 3, 10);
+  struct test_lat seq = { 0 }, batched = { 0 };
+  margo_instance_id mid;
+  hg_id_t ping;
+
+  TEST_ASSERT(ndead <= nclients);
+
+  mid = testmargo_start(nclients, &ping);
+  if (mid == MARGO_INSTANCE_NULL) {
+    fprintf(stderr, "Margo could not be initialized\n");
+    return TEST_SKIP;
+  }
+
+  /* looked up once, lookups are not what is measured */
+  hg_addr_t *addrs = calloc(nclients, sizeof(*addrs));
+  TEST_ASSERT(addrs);
+  for (size_t i = 0; i < nclients; i++)
+    TEST_ASSERT(margo_addr_lookup(mid, testmargo_addr(i), &addrs[i]) == HG_SUCCESS);
+
+  /* dead clients spread among the living */
+  for (size_t i = 0; i < ndead; i++)
+    testmargo_kill(i * nclients / ndead);
+
+  lowmem_in_t in = { .nodename = "node0" };
+  size_t nalive = nclients - ndead;
+
+  for (size_t round = 0; round < nrounds; round++) {
+    uint64_t received = testmargo_received();
+    uint64_t start = test_now_ns();
+    size_t nok = 0;
+    for (size_t i = 0; i < nclients; i++) {
+      int rc = RPC_FAILURE;
+      if (rpc_send(mid, addrs[i], ping, &in, &rc, BENCH_TIMEOUT_MS) == 0 && rc == RPC_SUCCESS)
+        nok++;
+    }
+    TEST_CHECK(test_lat_add(&seq, test_now_ns() - start) == 0);
+    TEST_CHECK_INT(nok, nalive);
+    TEST_CHECK_INT(testmargo_received() - received, nalive);
+  }
+
+  /* the handles are recycled from one round to the next */
+  struct rpc_batch batch;
+  rpc_batch_init(&batch, mid);
+  for (size_t round = 0; round < nrounds; round++) {
+    uint64_t received = testmargo_received();
+    uint64_t start = test_now_ns();
+    size_t nfailed = 0;
+    ndone = 0;
+    for (size_t i = 0; i < nclients; i++) {
+      if (rpc_isend(&batch, addrs[i], ping, &in, BENCH_TIMEOUT_MS, done, NULL))
+        nfailed++;
+    }
+    nfailed += rpc_wait_all(&batch);
+    TEST_CHECK(test_lat_add(&batched, test_now_ns() - start) == 0);
+    TEST_CHECK_INT(nfailed, ndead);
+    TEST_CHECK_INT(ndone, nalive);
+    TEST_CHECK_INT(testmargo_received() - received, nalive);
+  }
+  rpc_batch_fini(&batch);
+
+  printf("%zu clients, %zu dead, %zu rounds, broadcast time:\n", nclients, ndead, nrounds);
+  test_lat_print(&seq, "rpc_send");
+  test_lat_print(&batched, "rpc_isend");
+
+  for (size_t i = 0; i < nclients; i++)
+    margo_addr_free(mid, addrs[i]);
+  free(addrs);
+  test_lat_free(&seq);
+  test_lat_free(&batched);
+  testmargo_stop();
+
+  return TEST_EXIT();
+}
@@ -0,0 +1,2903 @@
+#include <ctype.h>              /* tolower */
+#include <errno.h>
+#include <fnmatch.h>            /* glob-style patterns */
+#include <inttypes.h>           /* PRIu64 */
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>             /* va_list */
+#include <stdio.h>              /* snprintf */
+#include <stdlib.h>             /* calloc, strtoll */
+#include <string.h>             /* memcpy, strcasecmp */
+#include <strings.h>            /* strcasecmp */
+#include <time.h>               /* clock_gettime */
+#include <unistd.h>             /* close, pipe */
+#include <arpa/inet.h>          /* inet_pton */
+#include <netinet/in.h>         /* sockaddr_in */
+#include <netinet/tcp.h>        /* TCP_NODELAY */
+#include <sys/socket.h>
+
+#include "hashmap.h"
+#include "mockredis.h"
+
+#define MR_READ_SIZE 16384
+
+#define MR_EWRONGTYPE "WRONGTYPE Operation against a key holding the wrong kind of value"
+#define MR_ENOTINT    "ERR value is not an integer or out of range"
+#define MR_ESYNTAX    "ERR syntax error"
+
+/* binary-safe string, always NULL-terminated */
+struct mr_str {
+  char   *s;
+  size_t  len;
+};
+
+struct mr_id {
+  uint64_t ms;
+  uint64_t seq;
+};
+
+struct mr_entry {
+  struct mr_id   id;
+  size_t         n;             /* field & value strings */
+  struct mr_str *kv;
+};
+
+struct mr_group {
+  char         *name;
+  struct mr_id  last;           /* last delivered ID */
+  struct mr_id *pending;        /* delivered, not acknowledged */
+  size_t        npending;
+  size_t        sizepending;
+};
+
+enum mr_type {
+  MR_STRING,
+  MR_HASH,
+  MR_LIST,
+  MR_SET,
+  MR_STREAM,
+};
+
+struct mr_obj {
+  enum mr_type     type;
+  struct mr_str    str;         /* string */
+  struct mr_str   *v;           /* hash fields & values, list items */
+  size_t           n;
+  size_t           size;
+  hm_t            *set;         /* set members */
+  struct mr_entry *entries;     /* stream */
+  size_t           nentries;
+  size_t           sizeentries;
+  struct mr_id     last;
+  struct mr_group *groups;
+  size_t           ngroups;
+};
+
+enum mr_fault_kind {
+  MR_FAULT_ERROR,
+  MR_FAULT_REPLY,
+  MR_FAULT_DROP,
+};
+
+struct mr_fault {
+  enum mr_fault_kind  kind;
+  char               *cmd;      /* NULL for any */
+  unsigned            count;
+  char               *data;     /* error string or raw reply */
+  size_t              len;
+  struct mr_fault    *next;
+};
+
+struct mr_buf {
+  char   *buf;
+  size_t  len;
+  size_t  size;
+};
+
+/* queued MULTI command */
+struct mr_cmdcopy {
+  int            argc;
+  struct mr_str *argv;
+};
+
+struct mr_conn {
+  struct mockredis  *srv;
+  int                fd;
+  pthread_mutex_t    wlock;     /* writes to fd */
+  struct mr_buf      in;
+  struct mr_buf      out;
+  int                closing;
+  int                inexec;    /* commands of EXEC do not block */
+  int                multi;
+  int                multierr;
+  struct mr_cmdcopy *queued;
+  size_t             nqueued;
+  char             **chans;     /* subscriptions */
+  size_t             nchans;
+  char             **pats;
+  size_t             npats;
+  struct mr_conn    *next;
+};
+
+struct mockredis {
+  char              host[64];
+  int               family;
+  int               port;
+  char              addr[96];
+  int               lfd;        /* listening socket, -1 when down */
+  int               wake[2];    /* stops the acceptor */
+  pthread_t         acceptor;
+  pthread_mutex_t   lock;       /* everything below */
+  pthread_cond_t    cond;       /* data changed or connection closed */
+  hm_t             *db;         /* key -> struct mr_obj * */
+  struct mr_conn   *conns;
+  struct mr_fault  *faults;
+  unsigned          latency_ms;
+  int               functions;  /* Redis Functions supported */
+  char             *library;    /* loaded function library */
+  hm_t             *scripts;    /* sha -> char * */
+  hm_t             *counts;     /* command name -> uint64_t */
+  uint64_t          ncommands;
+  uint64_t          nconnections;
+  char              notify[32]; /* notify-keyspace-events */
+};
+
+
+/*
+ * Strings and buffers
+ */
+
+static struct mr_str
+str_dup(const char *s, size_t len)
+{
+  struct mr_str r = { .s = malloc(len + 1), .len = len };
+
+  if (!r.s)
+    abort();
+  memcpy(r.s, s, len);
+  r.s[len] = '\0';
+  return r;
+}
+
+static int
+str_eq(const struct mr_str *a, const char *s, size_t len)
+{
+  return a->len == len && !memcmp(a->s, s, len);
+}
+
+static void
+buf_append(struct mr_buf *b, const void *data, size_t len)
+{
+  if (b->len + len > b->size) {
+    size_t size = b->size ? b->size : 256;
+    while (size < b->len + len)
+      size *= 2;
+    b->buf = realloc(b->buf, size);
+    if (!b->buf)
+      abort();
+    b->size = size;
+  }
+  memcpy(b->buf + b->len, data, len);
+  b->len += len;
+}
+
+static void
+buf_printf(struct mr_buf *b, const char *format, ...)
+{
+  char tmp[512];
+  va_list ap;
+
+  va_start(ap, format);
+  int n = vsnprintf(tmp, sizeof(tmp), format, ap);
+  va_end(ap);
+
+  buf_append(b, tmp, n < (int)sizeof(tmp) ? (size_t)n : sizeof(tmp) - 1);
+}
+
+static void
+reply_status(struct mr_buf *b, const char *s)
+{
+  buf_printf(b, "+%s\r\n", s);
+}
+
+static void
+reply_error(struct mr_buf *b, const char *format, ...)
+{
+  char tmp[256];
+  va_list ap;
+
+  va_start(ap, format);
+  vsnprintf(tmp, sizeof(tmp), format, ap);
+  va_end(ap);
+
+  buf_printf(b, "-%s\r\n", tmp);
+}
+
+static void
+reply_int(struct mr_buf *b, long long n)
+{
+  buf_printf(b, ":%lld\r\n", n);
+}
+
+static void
+reply_bulk(struct mr_buf *b, const char *s, size_t len)
+{
+  buf_printf(b, "$%zu\r\n", len);
+  buf_append(b, s, len);
+  buf_append(b, "\r\n", 2);
+}
+
+static void
+reply_str(struct mr_buf *b, const char *s)
+{
+  reply_bulk(b, s, strlen(s));
+}
+
+static void
+reply_nil(struct mr_buf *b)
+{
+  buf_append(b, "$-1\r\n", 5);
+}
+
+static void
+reply_nilarray(struct mr_buf *b)
+{
+  buf_append(b, "*-1\r\n", 5);
+}
+
+static void
+reply_array(struct mr_buf *b, size_t n)
+{
+  buf_printf(b, "*%zu\r\n", n);
+}
+
+static void
+reply_args(struct mr_buf *b, const char *cmd)
+{
+  reply_error(b, "ERR wrong number of arguments for '%s' command", cmd);
+}
+
+static int
+send_all(int fd, const char *buf, size_t len)
+{
+  while (len > 0) {
+    ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+static int
+conn_flush(struct mr_conn *c)
+{
+  int rc = 0;
+
+  pthread_mutex_lock(&c->wlock);
+  if (c->out.len > 0)
+    rc = send_all(c->fd, c->out.buf, c->out.len);
+  c->out.len = 0;
+  pthread_mutex_unlock(&c->wlock);
+
+  return rc;
+}
+
+static int
+parse_ll(const struct mr_str *a, long long *v)
+{
+  char *end;
+
+  errno = 0;
+  *v = strtoll(a->s, &end, 10);
+  return a->len > 0 && !errno && end == a->s + a->len ? 0 : -1;
+}
+
+
+/*
+ * Keyspace
+ */
+
+static void
+obj_free(struct mr_obj *o)
+{
+  if (!o)
+    return;
+
+  free(o->str.s);
+  for (size_t i = 0; i < o->n; i++)
+    free(o->v[i].s);
+  free(o->v);
+  hm_free(o->set);
+  for (size_t i = 0; i < o->nentries; i++) {
+    for (size_t j = 0; j < o->entries[i].n; j++)
+      free(o->entries[i].kv[j].s);
+    free(o->entries[i].kv);
+  }
+  free(o->entries);
+  for (size_t i = 0; i < o->ngroups; i++) {
+    free(o->groups[i].name);
+    free(o->groups[i].pending);
+  }
+  free(o->groups);
+  free(o);
+}
+
+static void publish(struct mockredis *srv, const char *chan, const char *msg, size_t *nrecv);
+
+static void
+notify(struct mockredis *srv, const char *key, const char *event)
+{
+  char chan[512];
+
+  if (!strchr(srv->notify, 'K'))
+    return;
+
+  snprintf(chan, sizeof(chan), "__keyspace@0__:%s", key);
+  publish(srv, chan, event, NULL);
+}
+
+static struct mr_obj *
+db_get(struct mockredis *srv, const char *key)
+{
+  struct mr_obj *const *o = hm_get(srv->db, key);
+
+  return o ? *o : NULL;
+}
+
+/* get KEY of type TYPE. WRONGTYPE is set if it is of another type */
+static struct mr_obj *
+db_get_type(struct mockredis *srv, const char *key, enum mr_type type, int *wrongtype)
+{
+  struct mr_obj *o = db_get(srv, key);
+
+  *wrongtype = o && o->type != type;
+  return *wrongtype ? NULL : o;
+}
+
+static struct mr_obj *
+db_create(struct mockredis *srv, const char *key, enum mr_type type, int *wrongtype)
+{
+  struct mr_obj *o = db_get_type(srv, key, type, wrongtype);
+
+  if (o || *wrongtype)
+    return o;
+
+  o = calloc(1, sizeof(*o));
+  if (!o)
+    abort();
+  o->type = type;
+  if (type == MR_SET && !(o->set = hm_create()))
+    abort();
+  if (hm_set(srv->db, key, &o, sizeof(o)) == -1)
+    abort();
+
+  return o;
+}
+
+static int
+db_del(struct mockredis *srv, const char *key)
+{
+  struct mr_obj *o = db_get(srv, key);
+
+  if (!o)
+    return 0;
+
+  hm_del(srv->db, key);
+  obj_free(o);
+  notify(srv, key, "del");
+  return 1;
+}
+
+/* containers disappear with their last element */
+static void
+db_del_empty(struct mockredis *srv, const char *key, struct mr_obj *o)
+{
+  if ((o->type == MR_HASH || o->type == MR_LIST) && o->n == 0)
+    db_del(srv, key);
+  else if (o->type == MR_SET && hm_length(o->set) == 0)
+    db_del(srv, key);
+}
+
+static void
+db_set(struct mockredis *srv, const char *key, const char *val, size_t len)
+{
+  struct mr_obj *o = db_get(srv, key);
+
+  if (o && o->type != MR_STRING) {
+    hm_del(srv->db, key);
+    obj_free(o);
+    o = NULL;
+  }
+  int wrongtype;
+  o = db_create(srv, key, MR_STRING, &wrongtype);
+  free(o->str.s);
+  o->str = str_dup(val, len);
+  notify(srv, key, "set");
+}
+
+static void
+vec_push(struct mr_obj *o, struct mr_str s, int left)
+{
+  if (o->n == o->size) {
+    o->size = o->size ? 2 * o->size : 16;
+    o->v = realloc(o->v, o->size * sizeof(*o->v));
+    if (!o->v)
+      abort();
+  }
+  if (left) {
+    memmove(o->v + 1, o->v, o->n * sizeof(*o->v));
+    o->v[0] = s;
+  } else {
+    o->v[o->n] = s;
+  }
+  o->n++;
+}
+
+static long
+hash_find(const struct mr_obj *o, const char *field, size_t len)
+{
+  for (size_t i = 0; i < o->n; i += 2) {
+    if (str_eq(&o->v[i], field, len))
+      return (long)i;
+  }
+  return -1;
+}
+
+static const struct mr_str *
+hash_get(struct mockredis *srv, const char *key, const char *field)
+{
+  int wrongtype;
+  struct mr_obj *o = db_get_type(srv, key, MR_HASH, &wrongtype);
+
+  if (!o)
+    return NULL;
+  long i = hash_find(o, field, strlen(field));
+  return i < 0 ? NULL : &o->v[i + 1];
+}
+
+/* returns 1 if FIELD is new */
+static int
+hash_set(struct mr_obj *o, const struct mr_str *field, const struct mr_str *val)
+{
+  long i = hash_find(o, field->s, field->len);
+
+  if (i >= 0) {
+    free(o->v[i + 1].s);
+    o->v[i + 1] = str_dup(val->s, val->len);
+    return 0;
+  }
+  vec_push(o, str_dup(field->s, field->len), 0);
+  vec_push(o, str_dup(val->s, val->len), 0);
+  return 1;
+}
+
+/* normalize Redis range START..STOP of a sequence of N items into
+   [*FIRST, *LAST), empty if *FIRST >= *LAST */
+static void
+range(long long start, long long stop, size_t n, size_t *first, size_t *last)
+{
+  if (start < 0)
+    start += n;
+  if (stop < 0)
+    stop += n;
+  if (start < 0)
+    start = 0;
+  if (stop >= (long long)n)
+    stop = (long long)n - 1;
+
+  *first = (size_t)start;
+  *last = start > stop ? (size_t)start : (size_t)stop + 1;
+}
+
+static void
+list_push(struct mockredis *srv, const char *key, struct mr_obj *o,
+          const char *item, size_t len, int left)
+{
+  vec_push(o, str_dup(item, len), left);
+  notify(srv, key, left ? "lpush" : "rpush");
+}
+
+static int
+set_add(struct mockredis *srv, const char *key, struct mr_obj *o, const char *member)
+{
+  char one = 1;
+  int rc = hm_set(o->set, member, &one, 1);
+
+  if (rc == -1)
+    abort();
+  if (rc == 1)
+    notify(srv, key, "sadd");
+  return rc;
+}
+
+static int
+set_rem(struct mockredis *srv, const char *key, const char *member)
+{
+  int wrongtype;
+  struct mr_obj *o = db_get_type(srv, key, MR_SET, &wrongtype);
+
+  if (!o || !hm_del(o->set, member))
+    return 0;
+  notify(srv, key, "srem");
+  db_del_empty(srv, key, o);
+  return 1;
+}
+
+/* split a comma-separated list, as string.gmatch(s, '[^,]+') */
+static size_t
+split(const char *s, struct mr_str **items)
+{
+  size_t n = 0, size = 0;
+
+  *items = NULL;
+  while (*s) {
+    size_t len = strcspn(s, ",");
+    if (len > 0) {
+      if (n == size) {
+        size = size ? 2 * size : 16;
+        *items = realloc(*items, size * sizeof(**items));
+        if (!*items)
+          abort();
+      }
+      (*items)[n].s = (char *)s;
+      (*items)[n++].len = len;
+    }
+    s += len;
+    if (*s == ',')
+      s++;
+  }
+  return n;
+}
+
+
+/*
+ * Pub/Sub
+ */
+
+static void
+publish(struct mockredis *srv, const char *chan, const char *msg, size_t *nrecv)
+{
+  size_t n = 0;
+
+  for (struct mr_conn *c = srv->conns; c; c = c->next) {
+    struct mr_buf b = { 0 };
+
+    for (size_t i = 0; i < c->nchans; i++) {
+      if (!strcmp(c->chans[i], chan)) {
+        reply_array(&b, 3);
+        reply_str(&b, "message");
+        reply_str(&b, chan);
+        reply_str(&b, msg);
+        n++;
+      }
+    }
+    for (size_t i = 0; i < c->npats; i++) {
+      if (!fnmatch(c->pats[i], chan, 0)) {
+        reply_array(&b, 4);
+        reply_str(&b, "pmessage");
+        reply_str(&b, c->pats[i]);
+        reply_str(&b, chan);
+        reply_str(&b, msg);
+        n++;
+      }
+    }
+    if (b.len > 0) {
+      pthread_mutex_lock(&c->wlock);
+      send_all(c->fd, b.buf, b.len);
+      pthread_mutex_unlock(&c->wlock);
+    }
+    free(b.buf);
+  }
+
+  if (nrecv)
+    *nrecv = n;
+}
+
+
+/*
+ * Commands. They run with the server lock held and write their reply
+ * to the output buffer of the connection.
+ */
+
+typedef void (*mr_cmd_fn)(struct mr_conn *c, int argc, struct mr_str *argv);
+
+#define CMD(name) static void cmd_##name(struct mr_conn *c, int argc, struct mr_str *argv)
+
+#define ARGS(cond) if (!(cond)) { reply_args(&c->out, argv[0].s); return; }
+
+CMD(ping)
+{
+  if (argc > 1)
+    reply_bulk(&c->out, argv[1].s, argv[1].len);
+  else
+    reply_status(&c->out, "PONG");
+}
+
+CMD(ok)
+{
+  (void)argc; (void)argv;
+  reply_status(&c->out, "OK");
+}
+
+static void
+flushall(struct mockredis *srv)
+{
+  const char *key;
+  const void *val;
+  size_t cur = 0;
+
+  while ((cur = hm_next(srv->db, cur, &key, &val)) != 0)
+    obj_free(*(struct mr_obj *const *)val);
+  hm_free(srv->db);
+  if (!(srv->db = hm_create()))
+    abort();
+}
+
+CMD(flushall)
+{
+  (void)argc; (void)argv;
+  flushall(c->srv);
+  reply_status(&c->out, "OK");
+}
+
+CMD(del)
+{
+  ARGS(argc >= 2);
+  long long n = 0;
+  for (int i = 1; i < argc; i++)
+    n += db_del(c->srv, argv[i].s);
+  reply_int(&c->out, n);
+}
+
+CMD(exists)
+{
+  ARGS(argc >= 2);
+  long long n = 0;
+  for (int i = 1; i < argc; i++)
+    n += db_get(c->srv, argv[i].s) != NULL;
+  reply_int(&c->out, n);
+}
+
+CMD(keys)
+{
+  ARGS(argc == 2);
+  struct mr_buf b = { 0 };
+  const char *key;
+  size_t cur = 0, n = 0;
+
+  while ((cur = hm_next(c->srv->db, cur, &key, NULL)) != 0) {
+    if (!fnmatch(argv[1].s, key, 0)) {
+      reply_str(&b, key);
+      n++;
+    }
+  }
+  reply_array(&c->out, n);
+  buf_append(&c->out, b.buf, b.len);
+  free(b.buf);
+}
+
+/* SCAN/SSCAN over the keys of MAP: CURSOR [MATCH pattern] [COUNT n] */
+static void
+scan(struct mr_conn *c, hm_t *map, int argc, struct mr_str *argv)
+{
+  const char *match = NULL;
+  long long cursor, count = 10;
+
+  if (parse_ll(&argv[0], &cursor) || cursor < 0) {
+    reply_error(&c->out, "ERR invalid cursor");
+    return;
+  }
+  for (int i = 1; i < argc; i += 2) {
+    if (i + 1 >= argc) {
+      reply_error(&c->out, MR_ESYNTAX);
+      return;
+    }
+    if (!strcasecmp(argv[i].s, "MATCH")) {
+      match = argv[i + 1].s;
+    } else if (!strcasecmp(argv[i].s, "COUNT")) {
+      if (parse_ll(&argv[i + 1], &count) || count < 1) {
+        reply_error(&c->out, MR_ENOTINT);
+        return;
+      }
+    } else {
+      reply_error(&c->out, MR_ESYNTAX);
+      return;
+    }
+  }
+
+  struct mr_buf b = { 0 };
+  const char *key;
+  size_t cur = (size_t)cursor, n = 0;
+
+  for (long long i = 0; map && i < count; i++) {
+    cur = hm_next(map, cur, &key, NULL);
+    if (cur == 0)
+      break;
+    if (!match || !fnmatch(match, key, 0)) {
+      reply_str(&b, key);
+      n++;
+    }
+  }
+
+  char next[32];
+  snprintf(next, sizeof(next), "%zu", map ? cur : 0);
+  reply_array(&c->out, 2);
+  reply_str(&c->out, next);
+  reply_array(&c->out, n);
+  buf_append(&c->out, b.buf, b.len);
+  free(b.buf);
+}
+
+CMD(scan)
+{
+  ARGS(argc >= 2);
+  scan(c, c->srv->db, argc - 1, argv + 1);
+}
+
+CMD(get)
+{
+  ARGS(argc == 2);
+  int wrongtype;
+  struct mr_obj *o = db_get_type(c->srv, argv[1].s, MR_STRING, &wrongtype);
+
+  if (wrongtype)
+    reply_error(&c->out, MR_EWRONGTYPE);
+  else if (!o)
+    reply_nil(&c->out);
+  else
+    reply_bulk(&c->out, o->str.s, o->str.len);
+}
+
+CMD(set)
+{
+  ARGS(argc >= 3);
+  /* expiration is accepted and ignored */
+  for (int i = 3; i < argc; i++) {
+    if ((strcasecmp(argv[i].s, "EX") && strcasecmp(argv[i].s, "PX")) || ++i >= argc) {
+      reply_error(&c->out, MR_ESYNTAX);
+      return;
+    }
+  }
+  db_set(c->srv, argv[1].s, argv[2].s, argv[2].len);
+  reply_status(&c->out, "OK");
+}
+
+CMD(mget)
+{
+  ARGS(argc >= 2);
+  reply_array(&c->out, argc - 1);
+  for (int i = 1; i < argc; i++) {
+    struct mr_obj *o = db_get(c->srv, argv[i].s);
+    if (o && o->type == MR_STRING)
+      reply_bulk(&c->out, o->str.s, o->str.len);
+    else
+      reply_nil(&c->out);
+  }
+}
+
+CMD(hset)
+{
+  ARGS(argc >= 4 && argc % 2 == 0);
+  int wrongtype;
+  struct mr_obj *o = db_create(c->srv, argv[1].s, MR_HASH, &wrongtype);
+
+  if (wrongtype) {
+    reply_error(&c->out, MR_EWRONGTYPE);
+    return;
+  }
+
+  long long n = 0;
+  for (int i = 2; i < argc; i += 2)
+    n += hash_set(o, &argv[i], &argv[i + 1]);
+  notify(c->srv, argv[1].s, "hset");
+
+  if (!strcasecmp(argv[0].s, "HMSET"))
+    reply_status(&c->out, "OK");
+  else
+    reply_int(&c->out, n);
+}
+
+CMD(hget)
+{
+  ARGS(argc == 3);
+  int wrongtype;
+  struct mr_obj *o = db_get_type(c->srv, argv[1].s, MR_HASH, &wrongtype);
+  long i = o ? hash_find(o, argv[2].s, argv[2].len) : -1;
+
+  if (wrongtype)
+    reply_error(&c->out, MR_EWRONGTYPE);
+  else if (i < 0)
+    reply_nil(&c->out);
+  else
+    reply_bulk(&c->out, o->v[i + 1].s, o->v[i + 1].len);
+}
+
+CMD(hmget)
+{
+  ARGS(argc >= 3);
+  int wrongtype;
+  struct mr_obj *o = db_get_type(c->srv, argv[1].s, MR_HASH, &wrongtype);
+
+  if (wrongtype) {
+    reply_error(&c->out, MR_EWRONGTYPE);
+    return;
+  }
+  reply_array(&c->out, argc - 2);
+  for (int j = 2; j < argc; j++) {
+    long i = o ? hash_find(o, argv[j].s, argv[j].len) : -1;
+    if (i < 0)
+      reply_nil(&c->out);
+    else
+      reply_bulk(&c->out, o->v[i + 1].s, o->v[i + 1].len);
+  }
+}
+
+CMD(hgetall)
+{
+  ARGS(argc == 2);
+  int wrongtype;
+  struct mr_obj *o = db_get_type(c->srv, argv[1].s, MR_HASH, &wrongtype);
+
+  if (wrongtype) {
+    reply_error(&c->out, MR_EWRONGTYPE);
+    return;
+  }
+  reply_array(&c->out, o ? o->n : 0);
+  for (size_t i = 0; o && i < o->n; i++)
+    reply_bulk(&c->out, o->v[i].s, o->v[i].len);
+}
+
+CMD(hexists)
+{
+  ARGS(argc == 3);
+  int wrongtype;
+  struct mr_obj *o = db_get_type(c->srv, argv[1].s, MR_HASH, &wrongtype);
+
+  if (wrongtype)
+    reply_error(&c->out, MR_EWRONGTYPE);
+  else
+    reply_int(&c->out, o && hash_find(o, argv[2].s, argv[2].len) >= 0);
+}
+
+CMD(hincrby)
+{
+  ARGS(argc == 4);
+  int wrongtype;
+  long long incr, val = 0;
+
+  if (parse_ll(&argv[3], &incr)) {
+    reply_error(&c->out, MR_ENOTINT);
+    return;
+  }
+  struct mr_obj *o = db_create(c->srv, argv[1].s, MR_HASH, &wrongtype);
+  if (wrongtype) {
+    reply_error(&c->out, MR_EWRONGTYPE);
+    return;
+  }
+  long i = hash_find(o, argv[2].s, argv[2].len);
+  if (i >= 0 && parse_ll(&o->v[i + 1], &val)) {
+    reply_error(&c->out, "ERR hash value is not an integer");
+    return;
+  }
+
+  char tmp[32];
+  val += incr;
+  struct mr_str s = { .s = tmp, .len = snprintf(tmp, sizeof(tmp), "%lld", val) };
+  hash_set(o, &argv[2], &s);
+  notify(c->srv, argv[1].s, "hincrby");
+  reply_int(&c->out, val);
+}
+
+CMD(hdel)
+{
+  ARGS(argc >= 3);
+  int wrongtype;
+  struct mr_obj *o = db_get_type(c->srv, argv[1].s, MR_HASH, &wrongtype);
+  long long n = 0;
+
+  if (wrongtype) {
+    reply_error(&c->out, MR_EWRONGTYPE);
+    return;
+  }
+  for (int j = 2; o && j < argc; j++) {
+    long i = hash_find(o, argv[j].s, argv[j].len);
+    if (i >= 0) {
+      free(o->v[i].s);
+      free(o->v[i + 1].s);
+      memmove(o->v + i, o->v + i + 2, (o->n - i - 2) * sizeof(*o->v));
+      o->n -= 2;
+      n++;
+    }
+  }
+  if (n > 0) {
+    notify(c->srv, argv[1].s, "hdel");
+    db_del_empty(c->srv, argv[1].s, o);
+  }
+  reply_int(&c->out, n);
+}
+
+CMD(push)
+{
+  ARGS(argc >= 3);
+  int wrongtype, left = !strcasecmp(argv[0].s, "LPUSH");
+  struct mr_obj *o = db_create(c->srv, argv[1].s, MR_LIST, &wrongtype);
+
+  if (wrongtype) {
+    reply_error(&c->out, MR_EWRONGTYPE);
+    return;
+  }
+  for (int i = 2; i < argc; i++)
+    list_push(c->srv, argv[1].s, o, argv[i].s, argv[i].len, left);
+  reply_int(&c->out, o->n);
+}
+
+CMD(lrange)
+{
+  ARGS(argc == 4);
+  int wrongtype;
+  long long start, stop;
+  size_t first, last;
+
+  if (parse_ll(&argv[2], &start) || parse_ll(&argv[3], &stop)) {
+    reply_error(&c->out, MR_ENOTINT);
+    return;
+  }
+  struct mr_obj *o = db_get_type(c->srv, argv[1].s, MR_LIST, &wrongtype);
+  if (wrongtype) {
+    reply_error(&c->out, MR_EWRONGTYPE);
+    return;
+  }
+  range(start, stop, o ? o->n : 0, &first, &last);
+  reply_array(&c->out, first < last ? last - first : 0);
+  for (size_t i = first; i < last; i++)
+    reply_bulk(&c->out, o->v[i].s, o->v[i].len);
+}
+
+CMD(lindex)
+{
+  ARGS(argc == 3);
+  int wrongtype;
+  long long idx;
+
+  if (parse_ll(&argv[2], &idx)) {
+    reply_error(&c->out, MR_ENOTINT);
+    return;
+  }
+  struct mr_obj *o = db_get_type(c->srv, argv[1].s, MR_LIST, &wrongtype);
+  if (wrongtype) {
+    reply_error(&c->out, MR_EWRONGTYPE);
+    return;
+  }
+  if (o && idx < 0)
+    idx += o->n;
+  if (!o || idx < 0 || (size_t)idx >= o->n)
+    reply_nil(&c->out);
+  else
+    reply_bulk(&c->out, o->v[idx].s, o->v[idx].len);
+}
+
+CMD(llen)
+{
+  ARGS(argc == 2);
+  int wrongtype;
+  struct mr_obj *o = db_get_type(c->srv, argv[1].s, MR_LIST, &wrongtype);
+
+  if (wrongtype)
+    reply_error(&c->out, MR_EWRONGTYPE);
+  else
+    reply_int(&c->out, o ? o->n : 0);
+}
+
+CMD(lrem)
+{
+  ARGS(argc == 4);
+  int wrongtype;
+  long long count, n = 0;
+
+  if (parse_ll(&argv[2], &count)) {
+    reply_error(&c->out, MR_ENOTINT);
+    return;
+  }
+  struct mr_obj *o = db_get_type(c->srv, argv[1].s, MR_LIST, &wrongtype);
+  if (wrongtype) {
+    reply_error(&c->out, MR_EWRONGTYPE);
+    return;
+  }
+
+  /* count > 0 from the head, < 0 from the tail, 0 all */
+  size_t max = count ? (size_t)llabs(count) : SIZE_MAX;
+  for (size_t k = 0; o && k < o->n && (size_t)n < max; ) {
+    size_t i = count < 0 ? o->n - 1 - k : k;
+    if (str_eq(&o->v[i], argv[3].s, argv[3].len)) {
+      free(o->v[i].s);
+      memmove(o->v + i, o->v + i + 1, (o->n - i - 1) * sizeof(*o->v));
+      o->n--;
+      n++;
+      if (count < 0)
+        k++;
+    } else {
+      k++;
+    }
+  }
+  if (n > 0) {
+    notify(c->srv, argv[1].s, "lrem");
+    db_del_empty(c->srv, argv[1].s, o);
+  }
+  reply_int(&c->out, n);
+}
+
+static void
+ltrim(struct mockredis *srv, const char *key, struct mr_obj *o,
+      long long start, long long stop)
+{
+  size_t first, last;
+
+  range(start, stop, o->n, &first, &last);
+  if (first >= last)
+    first = last = o->n;
+  for (size_t i = 0; i < o->n; i++) {
+    if (i < first || i >= last)
+      free(o->v[i].s);
+  }
+  memmove(o->v, o->v + first, (last - first) * sizeof(*o->v));
+  o->n = last - first;
+  notify(srv, key, "ltrim");
+  db_del_empty(srv, key, o);
+}
+
+CMD(ltrim)
+{
+  ARGS(argc == 4);
+  int wrongtype;
+  long long start, stop;
+
+  if (parse_ll(&argv[2], &start) || parse_ll(&argv[3], &stop)) {
+    reply_error(&c->out, MR_ENOTINT);
+    return;
+  }
+  struct mr_obj *o = db_get_type(c->srv, argv[1].s, MR_LIST, &wrongtype);
+  if (wrongtype) {
+    reply_error(&c->out, MR_EWRONGTYPE);
+    return;
+  }
+  if (o)
+    ltrim(c->srv, argv[1].s, o, start, stop);
+  reply_status(&c->out, "OK");
+}
+
+CMD(sadd)
+{
+  ARGS(argc >= 3);
+  int wrongtype;
+  struct mr_obj *o = db_create(c->srv, argv[1].s, MR_SET, &wrongtype);
+  long long n = 0;
+
+  if (wrongtype) {
+    reply_error(&c->out, MR_EWRONGTYPE);
+    return;
+  }
+  for (int i = 2; i < argc; i++)
+    n += set_add(c->srv, argv[1].s, o, argv[i].s);
+  reply_int(&c->out, n);
+}
+
+CMD(srem)
+{
+  ARGS(argc >= 3);
+  int wrongtype;
+  long long n = 0;
+
+  db_get_type(c->srv, argv[1].s, MR_SET, &wrongtype);
+  if (wrongtype) {
+    reply_error(&c->out, MR_EWRONGTYPE);
+    return;
+  }
+  for (int i = 2; i < argc; i++)
+    n += set_rem(c->srv, argv[1].s, argv[i].s);
+  reply_int(&c->out, n);
+}
+
+CMD(smembers)
+{
+  ARGS(argc == 2);
+  int wrongtype;
+  struct mr_obj *o = db_get_type(c->srv, argv[1].s, MR_SET, &wrongtype);
+  const char *member;
+  size_t cur = 0;
+
+  if (wrongtype) {
+    reply_error(&c->out, MR_EWRONGTYPE);
+    return;
+  }
+  reply_array(&c->out, o ? hm_length(o->set) : 0);
+  while (o && (cur = hm_next(o->set, cur, &member, NULL)) != 0)
+    reply_str(&c->out, member);
+}
+
+CMD(sismember)
+{
+  ARGS(argc == 3);
+  int wrongtype;
+  struct mr_obj *o = db_get_type(c->srv, argv[1].s, MR_SET, &wrongtype);
+
+  if (wrongtype)
+    reply_error(&c->out, MR_EWRONGTYPE);
+  else
+    reply_int(&c->out, o && hm_get(o->set, argv[2].s));
+}
+
+CMD(scard)
+{
+  ARGS(argc == 2);
+  int wrongtype;
+  struct mr_obj *o = db_get_type(c->srv, argv[1].s, MR_SET, &wrongtype);
+
+  if (wrongtype)
+    reply_error(&c->out, MR_EWRONGTYPE);
+  else
+    reply_int(&c->out, o ? hm_length(o->set) : 0);
+}
+
+CMD(sscan)
+{
+  ARGS(argc >= 3);
+  int wrongtype;
+  struct mr_obj *o = db_get_type(c->srv, argv[1].s, MR_SET, &wrongtype);
+
+  if (wrongtype)
+    reply_error(&c->out, MR_EWRONGTYPE);
+  else
+    scan(c, o ? o->set : NULL, argc - 2, argv + 2);
+}
+
+
+/* SORT patterns: "key*" gets a string, "key*->field" a hash field,
+   "#" the element itself */
+static const struct mr_str *
+sort_lookup(struct mockredis *srv, const char *pattern, const struct mr_str *elem)
+{
+  static __thread struct mr_str self;
+  char key[1024];
+
+  if (!strcmp(pattern, "#")) {
+    self = *elem;
+    return &self;
+  }
+
+  const char *star = strchr(pattern, '*');
+  if (!star)
+    return NULL;
+  const char *arrow = strstr(star, "->");
+  size_t keylen = arrow ? (size_t)(arrow - pattern) : strlen(pattern);
+
+  int n = snprintf(key, sizeof(key), "%.*s%s%.*s", (int)(star - pattern), pattern,
+                   elem->s, (int)(keylen - (star - pattern) - 1), star + 1);
+  if (n < 0 || (size_t)n >= sizeof(key))
+    return NULL;
+
+  if (arrow)
+    return hash_get(srv, key, arrow + 2);
+
+  struct mr_obj *o = db_get(srv, key);
+  return o && o->type == MR_STRING ? &o->str : NULL;
+}
+
+struct sort_item {
+  struct mr_str elem;
+  double        score;
+  const char   *alpha;
+};
+
+static int sort_desc, sort_alpha;
+
+static int
+sort_cmp(const void *a, const void *b)
+{
+  const struct sort_item *x = a, *y = b;
+  int r;
+
+  if (sort_alpha)
+    r = strcmp(x->alpha ? x->alpha : "", y->alpha ? y->alpha : "");
+  else
+    r = (x->score > y->score) - (x->score < y->score);
+  if (r == 0)
+    r = strcmp(x->elem.s, y->elem.s);
+  return sort_desc ? -r : r;
+}
+
+CMD(sort)
+{
+  ARGS(argc >= 2);
+  const char *by = NULL;
+  const char **gets = calloc(argc, sizeof(*gets));
+  long long offset = 0, count = -1;
+  size_t ngets = 0;
+  int desc = 0, alpha = 0;
+
+  if (!gets)
+    abort();
+
+  for (int i = 2; i < argc; i++) {
+    if (!strcasecmp(argv[i].s, "BY") && i + 1 < argc) {
+      by = argv[++i].s;
+    } else if (!strcasecmp(argv[i].s, "GET") && i + 1 < argc) {
+      gets[ngets++] = argv[++i].s;
+    } else if (!strcasecmp(argv[i].s, "LIMIT") && i + 2 < argc) {
+      if (parse_ll(&argv[i + 1], &offset) || parse_ll(&argv[i + 2], &count)) {
+        reply_error(&c->out, MR_ENOTINT);
+        free(gets);
+        return;
+      }
+      i += 2;
+    } else if (!strcasecmp(argv[i].s, "DESC")) {
+      desc = 1;
+    } else if (!strcasecmp(argv[i].s, "ASC")) {
+      desc = 0;
+    } else if (!strcasecmp(argv[i].s, "ALPHA")) {
+      alpha = 1;
+    } else {
+      reply_error(&c->out, MR_ESYNTAX);
+      free(gets);
+      return;
+    }
+  }
+
+  struct mr_obj *o = db_get(c->srv, argv[1].s);
+  if (o && o->type != MR_LIST && o->type != MR_SET) {
+    reply_error(&c->out, MR_EWRONGTYPE);
+    free(gets);
+    return;
+  }
+
+  size_t n = o ? (o->type == MR_LIST ? o->n : hm_length(o->set)) : 0;
+  struct sort_item *items = calloc(n + 1, sizeof(*items));
+  if (!items)
+    abort();
+
+  if (o && o->type == MR_LIST) {
+    for (size_t i = 0; i < n; i++)
+      items[i].elem = o->v[i];
+  } else if (o) {
+    const char *member;
+    size_t cur = 0, i = 0;
+    while ((cur = hm_next(o->set, cur, &member, NULL)) != 0) {
+      items[i].elem.s = (char *)member;
+      items[i++].elem.len = strlen(member);
+    }
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    const struct mr_str *w = by ? sort_lookup(c->srv, by, &items[i].elem) : &items[i].elem;
+    items[i].alpha = w ? w->s : NULL;
+    if (!alpha && w) {
+      char *end;
+      items[i].score = strtod(w->s, &end);
+      if (end == w->s || *end) {
+        reply_error(&c->out, "ERR One or more scores can't be converted into double");
+        free(items);
+        free(gets);
+        return;
+      }
+    }
+  }
+
+  sort_desc = desc;
+  sort_alpha = alpha;
+  qsort(items, n, sizeof(*items), sort_cmp);
+
+  size_t first = offset < 0 ? 0 : (size_t)offset;
+  size_t last = count < 0 ? n : first + (size_t)count;
+  if (first > n)
+    first = n;
+  if (last > n)
+    last = n;
+
+  reply_array(&c->out, (last - first) * (ngets ? ngets : 1));
+  for (size_t i = first; i < last; i++) {
+    if (!ngets) {
+      reply_bulk(&c->out, items[i].elem.s, items[i].elem.len);
+      continue;
+    }
+    for (size_t g = 0; g < ngets; g++) {
+      const struct mr_str *v = sort_lookup(c->srv, gets[g], &items[i].elem);
+      if (v)
+        reply_bulk(&c->out, v->s, v->len);
+      else
+        reply_nil(&c->out);
+    }
+  }
+
+  free(items);
+  free(gets);
+}
+
+
+/*
+ * Streams
+ */
+
+static int
+parse_id(const char *s, struct mr_id *id, uint64_t dflseq)
+{
+  char *end;
+
+  errno = 0;
+  id->ms = strtoull(s, &end, 10);
+  if (errno || end == s)
+    return -1;
+  if (*end == '\0') {
+    id->seq = dflseq;
+    return 0;
+  }
+  if (*end != '-')
+    return -1;
+  s = end + 1;
+  id->seq = strtoull(s, &end, 10);
+  return errno || end == s || *end ? -1 : 0;
+}
+
+static int
+id_cmp(const struct mr_id *a, const struct mr_id *b)
+{
+  if (a->ms != b->ms)
+    return a->ms < b->ms ? -1 : 1;
+  return (a->seq > b->seq) - (a->seq < b->seq);
+}
+
+static void
+reply_entry(struct mr_buf *b, const struct mr_entry *e)
+{
+  char id[48];
+  int len = snprintf(id, sizeof(id), "%"PRIu64"-%"PRIu64, e->id.ms, e->id.seq);
+
+  reply_array(b, 2);
+  reply_bulk(b, id, len);
+  reply_array(b, e->n);
+  for (size_t i = 0; i < e->n; i++)
+    reply_bulk(b, e->kv[i].s, e->kv[i].len);
+}
+
+CMD(xadd)
+{
+  /* XADD key [MAXLEN [~|=] n] id|* field value ... */
+  ARGS(argc >= 5);
+  int i = 2, wrongtype;
+  long long maxlen = -1;
+
+  if (!strcasecmp(argv[i].s, "MAXLEN")) {
+    i++;
+    if (i < argc && (!strcmp(argv[i].s, "~") || !strcmp(argv[i].s, "=")))
+      i++;
+    if (i >= argc || parse_ll(&argv[i], &maxlen)) {
+      reply_error(&c->out, MR_ENOTINT);
+      return;
+    }
+    i++;
+  }
+  if (i >= argc || (argc - i - 1) < 2 || (argc - i - 1) % 2) {
+    reply_args(&c->out, "xadd");
+    return;
+  }
+
+  struct mr_obj *o = db_get_type(c->srv, argv[1].s, MR_STREAM, &wrongtype);
+  if (wrongtype) {
+    reply_error(&c->out, MR_EWRONGTYPE);
+    return;
+  }
+
+  struct mr_id id, last = o ? o->last : (struct mr_id){ 0, 0 };
+  if (!strcmp(argv[i].s, "*")) {
+    struct timespec t;
+    clock_gettime(CLOCK_REALTIME, &t);
+    id.ms = (uint64_t)t.tv_sec * 1000 + t.tv_nsec / 1000000;
+    id.seq = 0;
+    if (id.ms <= last.ms) {
+      id.ms = last.ms;
+      id.seq = last.seq + 1;
+    }
+  } else if (parse_id(argv[i].s, &id, 0)) {
+    reply_error(&c->out, "ERR Invalid stream ID specified as stream command argument");
+    return;
+  }
+  if ((id.ms == 0 && id.seq == 0) || (o && id_cmp(&id, &last) <= 0)) {
+    reply_error(&c->out, "ERR The ID specified in XADD is equal or smaller than "
+                "the target stream top item");
+    return;
+  }
+  i++;
+
+  o = db_create(c->srv, argv[1].s, MR_STREAM, &wrongtype);
+  if (o->nentries == o->sizeentries) {
+    o->sizeentries = o->sizeentries ? 2 * o->sizeentries : 16;
+    o->entries = realloc(o->entries, o->sizeentries * sizeof(*o->entries));
+    if (!o->entries)
+      abort();
+  }
+  struct mr_entry *e = &o->entries[o->nentries++];
+  e->id = id;
+  e->n = argc - i;
+  e->kv = calloc(e->n, sizeof(*e->kv));
+  if (!e->kv)
+    abort();
+  for (size_t j = 0; j < e->n; j++)
+    e->kv[j] = str_dup(argv[i + j].s, argv[i + j].len);
+  o->last = id;
+
+  while (maxlen >= 0 && o->nentries > (size_t)maxlen) {
+    for (size_t j = 0; j < o->entries[0].n; j++)
+      free(o->entries[0].kv[j].s);
+    free(o->entries[0].kv);
+    memmove(o->entries, o->entries + 1, (o->nentries - 1) * sizeof(*o->entries));
+    o->nentries--;
+  }
+
+  char idstr[48];
+  reply_bulk(&c->out, idstr,
+             snprintf(idstr, sizeof(idstr), "%"PRIu64"-%"PRIu64, id.ms, id.seq));
+  notify(c->srv, argv[1].s, "xadd");
+}
+
+CMD(xlen)
+{
+  ARGS(argc == 2);
+  int wrongtype;
+  struct mr_obj *o = db_get_type(c->srv, argv[1].s, MR_STREAM, &wrongtype);
+
+  if (wrongtype)
+    reply_error(&c->out, MR_EWRONGTYPE);
+  else
+    reply_int(&c->out, o ? o->nentries : 0);
+}
+
+static struct mr_group *
+group_find(struct mr_obj *o, const char *name)
+{
+  for (size_t i = 0; o && i < o->ngroups; i++) {
+    if (!strcmp(o->groups[i].name, name))
+      return &o->groups[i];
+  }
+  return NULL;
+}
+
+CMD(xgroup)
+{
+  /* XGROUP CREATE key group id|$ [MKSTREAM] */
+  ARGS(argc >= 5 && !strcasecmp(argv[1].s, "CREATE"));
+  int wrongtype, mkstream = argc > 5 && !strcasecmp(argv[5].s, "MKSTREAM");
+  struct mr_obj *o = db_get_type(c->srv, argv[2].s, MR_STREAM, &wrongtype);
+  struct mr_id id;
+
+  if (wrongtype) {
+    reply_error(&c->out, MR_EWRONGTYPE);
+    return;
+  }
+  if (!o && !mkstream) {
+    reply_error(&c->out, "ERR The XGROUP subcommand requires the key to exist. "
+                "Note that for CREATE you may want to use the MKSTREAM option "
+                "to create an empty stream automatically.");
+    return;
+  }
+  if (group_find(o, argv[3].s)) {
+    reply_error(&c->out, "BUSYGROUP Consumer Group name already exists");
+    return;
+  }
+  if (!strcmp(argv[4].s, "$")) {
+    id = o ? o->last : (struct mr_id){ 0, 0 };
+  } else if (parse_id(argv[4].s, &id, 0)) {
+    reply_error(&c->out, "ERR Invalid stream ID specified as stream command argument");
+    return;
+  }
+
+  o = db_create(c->srv, argv[2].s, MR_STREAM, &wrongtype);
+  o->groups = realloc(o->groups, (o->ngroups + 1) * sizeof(*o->groups));
+  if (!o->groups)
+    abort();
+  struct mr_group *g = &o->groups[o->ngroups++];
+  memset(g, 0, sizeof(*g));
+  g->name = strdup(argv[3].s);
+  g->last = id;
+  reply_status(&c->out, "OK");
+}
+
+static void
+group_add_pending(struct mr_group *g, struct mr_id id)
+{
+  if (g->npending == g->sizepending) {
+    g->sizepending = g->sizepending ? 2 * g->sizepending : 16;
+    g->pending = realloc(g->pending, g->sizepending * sizeof(*g->pending));
+    if (!g->pending)
+      abort();
+  }
+  g->pending[g->npending++] = id;
+}
+
+/* wait for cond to be signaled, until DEADLINE_NS (0 for ever).
+   Returns -1 on timeout or if the connection is closing */
+static int
+conn_wait(struct mr_conn *c, uint64_t deadline_ns)
+{
+  if (c->closing)
+    return -1;
+
+  if (deadline_ns == 0) {
+    pthread_cond_wait(&c->srv->cond, &c->srv->lock);
+  } else {
+    struct timespec t = { .tv_sec = deadline_ns / 1000000000,
+                          .tv_nsec = deadline_ns % 1000000000 };
+    if (pthread_cond_timedwait(&c->srv->cond, &c->srv->lock, &t) == ETIMEDOUT)
+      return -1;
+  }
+  return c->closing ? -1 : 0;
+}
+
+/* XREAD [COUNT n] [BLOCK ms] STREAMS key id and XREADGROUP GROUP g c
+   [COUNT n] [BLOCK ms] STREAMS key id, for a single stream */
+CMD(xread)
+{
+  int group = !strcasecmp(argv[0].s, "XREADGROUP");
+  const char *gname = NULL;
+  long long count = -1, block = -1;
+  int i = 1;
+
+  if (group) {
+    ARGS(argc >= 4 && !strcasecmp(argv[1].s, "GROUP"));
+    gname = argv[2].s;
+    i = 4;
+  }
+  for (; i < argc && strcasecmp(argv[i].s, "STREAMS"); i += 2) {
+    long long *v = !strcasecmp(argv[i].s, "COUNT") ? &count :
+      !strcasecmp(argv[i].s, "BLOCK") ? &block : NULL;
+    if (!v || i + 1 >= argc || parse_ll(&argv[i + 1], v)) {
+      reply_error(&c->out, MR_ESYNTAX);
+      return;
+    }
+  }
+  if (argc - i != 3) {
+    reply_error(&c->out, "ERR mock: only single-stream reads are supported");
+    return;
+  }
+
+  const char *key = argv[i + 1].s, *idstr = argv[i + 2].s;
+  int wrongtype;
+  struct mr_obj *o = db_get_type(c->srv, key, MR_STREAM, &wrongtype);
+  struct mr_group *g = NULL;
+  struct mr_id after = { 0, 0 };
+
+  if (wrongtype) {
+    reply_error(&c->out, MR_EWRONGTYPE);
+    return;
+  }
+  if (group) {
+    if (!(g = group_find(o, gname))) {
+      reply_error(&c->out, "NOGROUP No such key '%s' or consumer group '%s'", key, gname);
+      return;
+    }
+    if (strcmp(idstr, ">")) {
+      reply_error(&c->out, "ERR mock: only new entries can be read from a group");
+      return;
+    }
+  } else if (!strcmp(idstr, "$")) {
+    after = o ? o->last : after;
+  } else if (parse_id(idstr, &after, 0)) {
+    reply_error(&c->out, "ERR Invalid stream ID specified as stream command argument");
+    return;
+  }
+
+  uint64_t deadline = 0;
+  if (block > 0) {
+    struct timespec t;
+    clock_gettime(CLOCK_REALTIME, &t);
+    deadline = (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec + block * 1000000;
+  }
+
+  for (;;) {
+    /* the stream may have been created or deleted while waiting */
+    o = db_get_type(c->srv, key, MR_STREAM, &wrongtype);
+    if (group && !(g = group_find(o, gname))) {
+      reply_error(&c->out, "NOGROUP No such key '%s' or consumer group '%s'", key, gname);
+      return;
+    }
+    if (g)
+      after = g->last;
+
+    size_t first = 0;
+    while (o && first < o->nentries && id_cmp(&o->entries[first].id, &after) <= 0)
+      first++;
+    size_t n = o ? o->nentries - first : 0;
+    if (count > 0 && n > (size_t)count)
+      n = count;
+
+    if (n > 0) {
+      reply_array(&c->out, 1);
+      reply_array(&c->out, 2);
+      reply_str(&c->out, key);
+      reply_array(&c->out, n);
+      for (size_t j = first; j < first + n; j++) {
+        reply_entry(&c->out, &o->entries[j]);
+        if (g)
+          group_add_pending(g, o->entries[j].id);
+      }
+      if (g)
+        g->last = o->entries[first + n - 1].id;
+      return;
+    }
+
+    if (block < 0 || c->inexec || conn_wait(c, deadline) == -1)
+      break;
+  }
+
+  if (!c->closing)
+    reply_nilarray(&c->out);
+}
+
+CMD(xack)
+{
+  ARGS(argc >= 4);
+  int wrongtype;
+  struct mr_obj *o = db_get_type(c->srv, argv[1].s, MR_STREAM, &wrongtype);
+  struct mr_group *g = group_find(o, argv[2].s);
+  long long n = 0;
+
+  if (wrongtype) {
+    reply_error(&c->out, MR_EWRONGTYPE);
+    return;
+  }
+  for (int i = 3; g && i < argc; i++) {
+    struct mr_id id;
+    if (parse_id(argv[i].s, &id, 0)) {
+      reply_error(&c->out, "ERR Invalid stream ID specified as stream command argument");
+      return;
+    }
+    for (size_t j = 0; j < g->npending; j++) {
+      if (!id_cmp(&g->pending[j], &id)) {
+        g->pending[j] = g->pending[--g->npending];
+        n++;
+        break;
+      }
+    }
+  }
+  reply_int(&c->out, n);
+}
+
+
+/*
+ * Configuration and Pub/Sub
+ */
+
+CMD(config)
+{
+  ARGS(argc >= 3);
+
+  if (!strcasecmp(argv[1].s, "GET")) {
+    if (!fnmatch(argv[2].s, "notify-keyspace-events", 0)) {
+      reply_array(&c->out, 2);
+      reply_str(&c->out, "notify-keyspace-events");
+      reply_str(&c->out, c->srv->notify);
+    } else {
+      reply_array(&c->out, 0);
+    }
+  } else if (!strcasecmp(argv[1].s, "SET") && argc == 4) {
+    if (!strcasecmp(argv[2].s, "notify-keyspace-events")) {
+      snprintf(c->srv->notify, sizeof(c->srv->notify), "%s", argv[3].s);
+    }
+    reply_status(&c->out, "OK");
+  } else {
+    reply_error(&c->out, "ERR mock: unsupported CONFIG subcommand");
+  }
+}
+
+static void
+subscribe(struct mr_conn *c, char ***list, size_t *n, const char *kind,
+          int argc, struct mr_str *argv)
+{
+  for (int i = 1; i < argc; i++) {
+    *list = realloc(*list, (*n + 1) * sizeof(**list));
+    if (!*list || !((*list)[*n] = strdup(argv[i].s)))
+      abort();
+    (*n)++;
+    reply_array(&c->out, 3);
+    reply_str(&c->out, kind);
+    reply_str(&c->out, argv[i].s);
+    reply_int(&c->out, c->nchans + c->npats);
+  }
+}
+
+CMD(subscribe)
+{
+  ARGS(argc >= 2);
+  subscribe(c, &c->chans, &c->nchans, "subscribe", argc, argv);
+}
+
+CMD(psubscribe)
+{
+  ARGS(argc >= 2);
+  subscribe(c, &c->pats, &c->npats, "psubscribe", argc, argv);
+}
+
+CMD(publish)
+{
+  ARGS(argc == 3);
+  size_t n;
+  publish(c->srv, argv[1].s, argv[2].s, &n);
+  reply_int(&c->out, n);
+}
+
+
+/*
+ * The icdb function library, natively. Each function mirrors its Lua
+ * version in src/icdb.c, and gets the ARGV of the call.
+ */
+
+typedef void (*mr_lib_fn)(struct mr_conn *c, int nargs, struct mr_str *args);
+
+static long long
+lib_rpush_list(struct mockredis *srv, const char *key, const char *list)
+{
+  struct mr_str *nodes;
+  size_t n = split(list, &nodes);
+  int wrongtype;
+
+  if (n > 0) {
+    struct mr_obj *o = db_create(srv, key, MR_LIST, &wrongtype);
+    for (size_t i = 0; o && i < n; i++)
+      list_push(srv, key, o, nodes[i].s, nodes[i].len, 0);
+  }
+  free(nodes);
+  return (long long)n;
+}
+
+static void
+lib_hset(struct mockredis *srv, const char *key, int n, const char *const fv[])
+{
+  int wrongtype;
+  struct mr_obj *o = db_create(srv, key, MR_HASH, &wrongtype);
+
+  for (int i = 0; o && i < n; i += 2) {
+    struct mr_str f = { (char *)fv[i], strlen(fv[i]) };
+    struct mr_str v = { (char *)fv[i + 1], strlen(fv[i + 1]) };
+    hash_set(o, &f, &v);
+  }
+  notify(srv, key, "hset");
+}
+
+static void
+lib_sadd(struct mockredis *srv, const char *key, const char *member)
+{
+  int wrongtype;
+  struct mr_obj *o = db_create(srv, key, MR_SET, &wrongtype);
+
+  if (o)
+    set_add(srv, key, o, member);
+}
+
+/* returns the jobid of client CLID, -1 if there is no such client */
+static long long
+lib_delclient(struct mockredis *srv, const char *clid)
+{
+  char key[512], jobid[32], type[128];
+
+  snprintf(key, sizeof(key), "client:%s", clid);
+  const struct mr_str *j = hash_get(srv, key, "jobid");
+  const struct mr_str *t = hash_get(srv, key, "type");
+  if (!j)
+    return -1;
+  snprintf(jobid, sizeof(jobid), "%s", j->s);
+  snprintf(type, sizeof(type), "%s", t ? t->s : "");
+
+  snprintf(key, sizeof(key), "index:clients:jobid:%s", jobid);
+  set_rem(srv, key, clid);
+  snprintf(key, sizeof(key), "index:clients:type:%s", type);
+  set_rem(srv, key, clid);
+  set_rem(srv, "index:clients", clid);
+
+  const char *fmts[] = { "client:%s", "nodelist:client:%s", "nodelist:job:%s",
+                         "client:%s:reconfig", "index:monitorFlexMPI:%s",
+                         "monitorFlexMPI:%s:samples" };
+  for (size_t i = 0; i < sizeof(fmts) / sizeof(fmts[0]); i++) {
+    snprintf(key, sizeof(key), fmts[i], i == 2 ? jobid : clid);
+    db_del(srv, key);
+  }
+
+  return strtoll(jobid, NULL, 10);
+}
+
+static void
+lib_version(struct mr_conn *c, int nargs, struct mr_str *args)
+{
+  (void)nargs; (void)args;
+  const char *s = strstr(c->srv->library, "function_name='icdb_version'");
+
+  s = s ? strstr(s, "return ") : NULL;
+  reply_int(&c->out, s ? strtoll(s + 7, NULL, 10) : 0);
+}
+
+static void
+lib_setclient(struct mr_conn *c, int nargs, struct mr_str *args)
+{
+  if (nargs != 9) {
+    reply_error(&c->out, "ERR icdb_setclient: wrong number of arguments");
+    return;
+  }
+
+  struct mockredis *srv = c->srv;
+  const char *clid = args[0].s, *jobid = args[5].s;
+  char key[512], nnodes[32];
+  int wrongtype;
+
+  snprintf(key, sizeof(key), "client:%s", clid);
+  struct mr_obj *o = db_get_type(srv, key, MR_HASH, &wrongtype);
+  if (o && hash_find(o, "addr", 4) >= 0) {
+    hash_set(o, &(struct mr_str){ "addr", 4 }, &args[2]);
+    notify(srv, key, "hset");
+    reply_int(&c->out, 0);
+    return;
+  }
+
+  snprintf(key, sizeof(key), "nodelist:client:%s", clid);
+  long long n = lib_rpush_list(srv, key, args[7].s);
+  snprintf(key, sizeof(key), "nodelist:job:%s", jobid);
+  lib_rpush_list(srv, key, args[7].s);
+  snprintf(nnodes, sizeof(nnodes), "%lld", n);
+
+  snprintf(key, sizeof(key), "job:%s", jobid);
+  lib_hset(srv, key, 8, (const char *[]){ "jobid", jobid, "ncpus", args[6].s,
+                                          "nnodes", nnodes, "nodelist", args[7].s });
+  snprintf(key, sizeof(key), "client:%s", clid);
+  lib_hset(srv, key, 20, (const char *[]){ "clid", clid, "type", args[1].s,
+                                           "addr", args[2].s, "nnodes", nnodes,
+                                           "nodelist", args[3].s, "provid", args[4].s,
+                                           "jobid", jobid, "nprocs", args[8].s,
+                                           "reconfig_nprocs", "0",
+                                           "reconfig_nnodes", "0" });
+  lib_sadd(srv, "index:clients", clid);
+  snprintf(key, sizeof(key), "index:clients:type:%s", args[1].s);
+  lib_sadd(srv, key, clid);
+  snprintf(key, sizeof(key), "index:clients:jobid:%s", jobid);
+  lib_sadd(srv, key, clid);
+
+  reply_int(&c->out, 1);
+}
+
+static void
+lib_delclient_fn(struct mr_conn *c, int nargs, struct mr_str *args)
+{
+  if (nargs != 1) {
+    reply_error(&c->out, "ERR icdb_delclient: wrong number of arguments");
+    return;
+  }
+  long long jobid = lib_delclient(c->srv, args[0].s);
+  if (jobid < 0)
+    reply_nil(&c->out);
+  else
+    reply_int(&c->out, jobid);
+}
+
+static void
+lib_deljob(struct mr_conn *c, int nargs, struct mr_str *args)
+{
+  if (nargs != 1) {
+    reply_error(&c->out, "ERR icdb_deljob: wrong number of arguments");
+    return;
+  }
+
+  char key[512];
+  int wrongtype;
+  long long n = 0;
+
+  snprintf(key, sizeof(key), "index:clients:jobid:%s", args[0].s);
+  struct mr_obj *o = db_get_type(c->srv, key, MR_SET, &wrongtype);
+  if (o) {
+    /* the set goes away with its last member */
+    size_t nmembers = hm_length(o->set);
+    char **clids = calloc(nmembers, sizeof(*clids));
+    const char *member;
+    size_t cur = 0, i = 0;
+    if (!clids)
+      abort();
+    while ((cur = hm_next(o->set, cur, &member, NULL)) != 0)
+      clids[i++] = strdup(member);
+    for (i = 0; i < nmembers; i++) {
+      n += lib_delclient(c->srv, clids[i]) >= 0;
+      free(clids[i]);
+    }
+    free(clids);
+  }
+  snprintf(key, sizeof(key), "job:%s", args[0].s);
+  db_del(c->srv, key);
+
+  reply_int(&c->out, n);
+}
+
+static void
+lib_addnodes(struct mr_conn *c, int nargs, struct mr_str *args)
+{
+  if (nargs != 2) {
+    reply_error(&c->out, "ERR icdb_addnodes: wrong number of arguments");
+    return;
+  }
+  char key[512];
+  snprintf(key, sizeof(key), "nodelist:client:%s", args[0].s);
+  reply_int(&c->out, lib_rpush_list(c->srv, key, args[1].s));
+}
+
+static void
+lib_monitor_set(struct mr_conn *c, int nargs, struct mr_str *args)
+{
+  if (nargs != 3) {
+    reply_error(&c->out, "ERR icdb_monitor_set: wrong number of arguments");
+    return;
+  }
+  char key[512];
+  db_set(c->srv, args[1].s, args[2].s, args[2].len);
+  snprintf(key, sizeof(key), "index:monitorFlexMPI:%s", args[0].s);
+  db_set(c->srv, key, args[1].s, args[1].len);
+  reply_int(&c->out, 1);
+}
+
+static void
+lib_monitor_sample(struct mr_conn *c, int nargs, struct mr_str *args)
+{
+  if (nargs != 4) {
+    reply_error(&c->out, "ERR icdb_monitor_sample: wrong number of arguments");
+    return;
+  }
+
+  char key[512], sample[128], r[64], t[64];
+  int wrongtype;
+  long long window = strtoll(args[3].s, NULL, 10);
+
+  snprintf(key, sizeof(key), "monitorFlexMPI:%s:samples", args[0].s);
+  struct mr_obj *o = db_create(c->srv, key, MR_LIST, &wrongtype);
+  if (wrongtype) {
+    reply_error(&c->out, MR_EWRONGTYPE);
+    return;
+  }
+  int len = snprintf(sample, sizeof(sample), "%s %s", args[1].s, args[2].s);
+  list_push(c->srv, key, o, sample, len, 1);
+  ltrim(c->srv, key, o, 0, window - 1);
+
+  /* the list may be gone with a window of 0 */
+  o = db_get_type(c->srv, key, MR_LIST, &wrongtype);
+  size_t n = o ? o->n : 0;
+  double rsum = 0, csum = 0;
+  for (size_t i = 0; i < n; i++) {
+    double a, b;
+    if (sscanf(o->v[i].s, "%lf %lf", &a, &b) == 2) {
+      rsum += a;
+      csum += b;
+    }
+  }
+  reply_array(&c->out, 3);
+  reply_int(&c->out, n);
+  /* Lua tostring */
+  reply_str(&c->out, (snprintf(r, sizeof(r), "%.14g", rsum / n), r));
+  reply_str(&c->out, (snprintf(t, sizeof(t), "%.14g", csum / n), t));
+}
+
+static void
+lib_shrink(struct mr_conn *c, int nargs, struct mr_str *args)
+{
+  if (nargs != 1) {
+    reply_error(&c->out, "ERR icdb_shrink: wrong number of arguments");
+    return;
+  }
+
+  char key[512];
+  int wrongtype;
+  size_t first, last;
+  struct mr_buf b = { 0 };
+
+  snprintf(key, sizeof(key), "nodelist:client:%s", args[0].s);
+  struct mr_obj *o = db_get_type(c->srv, key, MR_LIST, &wrongtype);
+  size_t n = o ? o->n : 0;
+
+  /* LRANGE 0 n/2-1, which is the whole list for a single node */
+  range(0, (long long)(n / 2) - 1, n, &first, &last);
+  for (size_t i = first; i < last; i++) {
+    if (i > first)
+      buf_append(&b, ",", 1);
+    buf_append(&b, o->v[i].s, o->v[i].len);
+  }
+  reply_bulk(&c->out, b.len ? b.buf : "", b.len);
+  free(b.buf);
+}
+
+static const struct {
+  const char *name;
+  mr_lib_fn   fn;
+} mr_lib[] = {
+  { "icdb_version",        lib_version },
+  { "icdb_setclient",      lib_setclient },
+  { "icdb_delclient",      lib_delclient_fn },
+  { "icdb_deljob",         lib_deljob },
+  { "icdb_addnodes",       lib_addnodes },
+  { "icdb_monitor_set",    lib_monitor_set },
+  { "icdb_monitor_sample", lib_monitor_sample },
+  { "icdb_shrink",         lib_shrink },
+};
+
+static mr_lib_fn
+lib_find(const char *name)
+{
+  for (size_t i = 0; i < sizeof(mr_lib) / sizeof(mr_lib[0]); i++) {
+    if (!strcmp(mr_lib[i].name, name))
+      return mr_lib[i].fn;
+  }
+  return NULL;
+}
+
+/* call function FN with ARGV[0] the number of keys, followed by keys
+   and arguments */
+static void
+lib_call(struct mr_conn *c, mr_lib_fn fn, int argc, struct mr_str *argv)
+{
+  long long nkeys;
+
+  if (argc < 1 || parse_ll(&argv[0], &nkeys) || nkeys < 0 || nkeys > argc - 1) {
+    reply_error(&c->out, "ERR Number of keys can't be greater than number of args");
+    return;
+  }
+  fn(c, argc - 1 - (int)nkeys, argv + 1 + nkeys);
+}
+
+/* script name, from its "-- name" first line */
+static mr_lib_fn
+script_fn(const char *script)
+{
+  char name[64];
+
+  if (sscanf(script, "-- %63[a-z_]", name) != 1)
+    return NULL;
+  return lib_find(name);
+}
+
+static void
+script_sha(const char *script, char sha[41])
+{
+  /* any stable 40-digit hex string will do */
+  uint64_t h[3] = { 14695981039346656037ULL, 1099511628211ULL, 0x9e3779b97f4a7c15ULL };
+
+  for (const unsigned char *s = (const unsigned char *)script; *s; s++) {
+    for (int i = 0; i < 3; i++) {
+      h[i] ^= *s + i;
+      h[i] *= 1099511628211ULL;
+    }
+  }
+  snprintf(sha, 41, "%016"PRIx64"%016"PRIx64"%08"PRIx32, h[0], h[1], (uint32_t)h[2]);
+}
+
+CMD(function)
+{
+  ARGS(argc >= 2);
+  struct mockredis *srv = c->srv;
+
+  if (!srv->functions) {
+    reply_error(&c->out, "ERR unknown command 'FUNCTION'");
+    return;
+  }
+
+  if (!strcasecmp(argv[1].s, "LOAD")) {
+    ARGS(argc >= 3);
+    int replace = argc > 3 && !strcasecmp(argv[2].s, "REPLACE");
+    const char *code = argv[argc - 1].s;
+    char name[64];
+
+    if (sscanf(code, "#!lua name=%63s", name) != 1) {
+      reply_error(&c->out, "ERR Missing library metadata");
+      return;
+    }
+    if (srv->library && !replace) {
+      reply_error(&c->out, "ERR Library '%s' already exists", name);
+      return;
+    }
+    free(srv->library);
+    srv->library = strdup(code);
+    reply_str(&c->out, name);
+  } else if (!strcasecmp(argv[1].s, "FLUSH") || !strcasecmp(argv[1].s, "DELETE")) {
+    free(srv->library);
+    srv->library = NULL;
+    reply_status(&c->out, "OK");
+  } else {
+    reply_error(&c->out, "ERR mock: unsupported FUNCTION subcommand");
+  }
+}
+
+CMD(fcall)
+{
+  ARGS(argc >= 3);
+  struct mockredis *srv = c->srv;
+  char reg[128];
+
+  if (!srv->functions) {
+    reply_error(&c->out, "ERR unknown command 'FCALL'");
+    return;
+  }
+
+  /* the function must have been registered by the loaded library */
+  snprintf(reg, sizeof(reg), "function_name='%s'", argv[1].s);
+  mr_lib_fn fn = lib_find(argv[1].s);
+  if (!srv->library || !strstr(srv->library, reg) || !fn) {
+    reply_error(&c->out, "ERR Function not found");
+    return;
+  }
+  lib_call(c, fn, argc - 2, argv + 2);
+}
+
+CMD(script)
+{
+  ARGS(argc >= 2);
+  struct mockredis *srv = c->srv;
+
+  if (!strcasecmp(argv[1].s, "LOAD") && argc == 3) {
+    char sha[41];
+    char *code = strdup(argv[2].s);
+    if (!code)
+      abort();
+    script_sha(code, sha);
+    const void *old = hm_get(srv->scripts, sha);
+    if (old)
+      free(*(char *const *)old);
+    hm_set(srv->scripts, sha, &code, sizeof(code));
+    reply_str(&c->out, sha);
+  } else if (!strcasecmp(argv[1].s, "FLUSH")) {
+    const char *sha;
+    const void *code;
+    size_t cur = 0;
+    while ((cur = hm_next(srv->scripts, cur, &sha, &code)) != 0)
+      free(*(char *const *)code);
+    hm_free(srv->scripts);
+    if (!(srv->scripts = hm_create()))
+      abort();
+    reply_status(&c->out, "OK");
+  } else {
+    reply_error(&c->out, "ERR mock: unsupported SCRIPT subcommand");
+  }
+}
+
+CMD(eval)
+{
+  ARGS(argc >= 3);
+  const char *script = argv[1].s;
+
+  if (!strcasecmp(argv[0].s, "EVALSHA")) {
+    char *const *code = hm_get(c->srv->scripts, argv[1].s);
+    if (!code) {
+      reply_error(&c->out, "NOSCRIPT No matching script. Please use EVAL.");
+      return;
+    }
+    script = *code;
+  }
+
+  mr_lib_fn fn = script_fn(script);
+  if (!fn) {
+    reply_error(&c->out, "ERR mock: unsupported script");
+    return;
+  }
+  lib_call(c, fn, argc - 2, argv + 2);
+}
+
+
+/*
+ * Dispatch
+ */
+
+static const struct {
+  const char *name;
+  mr_cmd_fn   fn;
+} mr_cmds[] = {
+  { "PING", cmd_ping },
+  { "SELECT", cmd_ok },
+  { "FLUSHALL", cmd_flushall },
+  { "FLUSHDB", cmd_flushall },
+  { "DEL", cmd_del },
+  { "EXISTS", cmd_exists },
+  { "KEYS", cmd_keys },
+  { "SCAN", cmd_scan },
+  { "GET", cmd_get },
+  { "SET", cmd_set },
+  { "MGET", cmd_mget },
+  { "HSET", cmd_hset },
+  { "HMSET", cmd_hset },
+  { "HGET", cmd_hget },
+  { "HMGET", cmd_hmget },
+  { "HGETALL", cmd_hgetall },
+  { "HEXISTS", cmd_hexists },
+  { "HINCRBY", cmd_hincrby },
+  { "HDEL", cmd_hdel },
+  { "RPUSH", cmd_push },
+  { "LPUSH", cmd_push },
+  { "LRANGE", cmd_lrange },
+  { "LINDEX", cmd_lindex },
+  { "LLEN", cmd_llen },
+  { "LREM", cmd_lrem },
+  { "LTRIM", cmd_ltrim },
+  { "SADD", cmd_sadd },
+  { "SREM", cmd_srem },
+  { "SMEMBERS", cmd_smembers },
+  { "SISMEMBER", cmd_sismember },
+  { "SCARD", cmd_scard },
+  { "SSCAN", cmd_sscan },
+  { "SORT", cmd_sort },
+  { "XADD", cmd_xadd },
+  { "XLEN", cmd_xlen },
+  { "XGROUP", cmd_xgroup },
+  { "XREAD", cmd_xread },
+  { "XREADGROUP", cmd_xread },
+  { "XACK", cmd_xack },
+  { "CONFIG", cmd_config },
+  { "SUBSCRIBE", cmd_subscribe },
+  { "PSUBSCRIBE", cmd_psubscribe },
+  { "PUBLISH", cmd_publish },
+  { "FUNCTION", cmd_function },
+  { "FCALL", cmd_fcall },
+  { "SCRIPT", cmd_script },
+  { "EVAL", cmd_eval },
+  { "EVALSHA", cmd_eval },
+};
+
+static mr_cmd_fn
+cmd_find(const char *name)
+{
+  for (size_t i = 0; i < sizeof(mr_cmds) / sizeof(mr_cmds[0]); i++) {
+    if (!strcasecmp(mr_cmds[i].name, name))
+      return mr_cmds[i].fn;
+  }
+  return NULL;
+}
+
+static void
+count_command(struct mockredis *srv, const char *name)
+{
+  char lname[32];
+  size_t i;
+
+  for (i = 0; name[i] && i < sizeof(lname) - 1; i++)
+    lname[i] = tolower((unsigned char)name[i]);
+  lname[i] = '\0';
+
+  const uint64_t *n = hm_get(srv->counts, lname);
+  uint64_t v = n ? *n + 1 : 1;
+  hm_set(srv->counts, lname, &v, sizeof(v));
+  srv->ncommands++;
+}
+
+/* take the first fault matching command NAME, NULL if none */
+static struct mr_fault *
+take_fault(struct mockredis *srv, const char *name)
+{
+  for (struct mr_fault **f = &srv->faults; *f; f = &(*f)->next) {
+    if ((*f)->cmd && strcasecmp((*f)->cmd, name))
+      continue;
+    struct mr_fault *r = *f;
+    if (--r->count == 0) {
+      *f = r->next;
+      r->next = NULL;
+      return r;
+    }
+    /* return a copy, the fault stays for the next commands */
+    struct mr_fault *copy = calloc(1, sizeof(*copy));
+    if (!copy)
+      abort();
+    copy->kind = r->kind;
+    copy->data = malloc(r->len + 1);
+    if (!copy->data)
+      abort();
+    memcpy(copy->data, r->data, r->len + 1);
+    copy->len = r->len;
+    return copy;
+  }
+  return NULL;
+}
+
+static void
+fault_free(struct mr_fault *f)
+{
+  while (f) {
+    struct mr_fault *next = f->next;
+    free(f->cmd);
+    free(f->data);
+    free(f);
+    f = next;
+  }
+}
+
+static void
+exec_command(struct mr_conn *c, int argc, struct mr_str *argv)
+{
+  mr_cmd_fn fn = cmd_find(argv[0].s);
+
+  if (!fn)
+    reply_error(&c->out, "ERR unknown command '%s'", argv[0].s);
+  else
+    fn(c, argc, argv);
+}
+
+static void
+multi_discard(struct mr_conn *c)
+{
+  for (size_t i = 0; i < c->nqueued; i++) {
+    for (int j = 0; j < c->queued[i].argc; j++)
+      free(c->queued[i].argv[j].s);
+    free(c->queued[i].argv);
+  }
+  free(c->queued);
+  c->queued = NULL;
+  c->nqueued = 0;
+  c->multi = 0;
+  c->multierr = 0;
+}
+
+/* process one command. Returns -1 if the connection must be closed */
+static int
+process(struct mr_conn *c, int argc, struct mr_str *argv)
+{
+  struct mockredis *srv = c->srv;
+  const char *name = argv[0].s;
+
+  pthread_mutex_lock(&srv->lock);
+  count_command(srv, name);
+  struct mr_fault *f = take_fault(srv, name);
+  unsigned latency = srv->latency_ms;
+  pthread_mutex_unlock(&srv->lock);
+
+  if (latency) {
+    struct timespec t = { .tv_sec = latency / 1000,
+                          .tv_nsec = (latency % 1000) * 1000000L };
+    while (nanosleep(&t, &t) == -1)
+      ;
+  }
+
+  if (f) {
+    int kind = f->kind;
+    if (kind == MR_FAULT_ERROR)
+      reply_error(&c->out, "%s", f->data);
+    else if (kind == MR_FAULT_REPLY)
+      buf_append(&c->out, f->data, f->len);
+    fault_free(f);
+    return kind == MR_FAULT_DROP ? -1 : 0;
+  }
+
+  if (!strcasecmp(name, "QUIT")) {
+    reply_status(&c->out, "OK");
+    return -1;
+  }
+
+  pthread_mutex_lock(&srv->lock);
+
+  if ((c->nchans || c->npats) && strcasecmp(name, "SUBSCRIBE") &&
+      strcasecmp(name, "PSUBSCRIBE") && strcasecmp(name, "PING")) {
+    reply_error(&c->out, "ERR Can't execute '%s': only (P)SUBSCRIBE / PING / QUIT "
+                "are allowed in this context", name);
+  } else if (!strcasecmp(name, "MULTI")) {
+    if (c->multi) {
+      reply_error(&c->out, "ERR MULTI calls can not be nested");
+    } else {
+      c->multi = 1;
+      reply_status(&c->out, "OK");
+    }
+  } else if (!strcasecmp(name, "DISCARD")) {
+    if (c->multi) {
+      multi_discard(c);
+      reply_status(&c->out, "OK");
+    } else {
+      reply_error(&c->out, "ERR DISCARD without MULTI");
+    }
+  } else if (!strcasecmp(name, "EXEC")) {
+    if (!c->multi) {
+      reply_error(&c->out, "ERR EXEC without MULTI");
+    } else if (c->multierr) {
+      reply_error(&c->out, "EXECABORT Transaction discarded because of previous errors.");
+    } else {
+      c->inexec = 1;
+      reply_array(&c->out, c->nqueued);
+      for (size_t i = 0; i < c->nqueued; i++)
+        exec_command(c, c->queued[i].argc, c->queued[i].argv);
+      c->inexec = 0;
+    }
+    multi_discard(c);
+  } else if (c->multi) {
+    if (!cmd_find(name)) {
+      reply_error(&c->out, "ERR unknown command '%s'", name);
+      c->multierr = 1;
+    } else {
+      c->queued = realloc(c->queued, (c->nqueued + 1) * sizeof(*c->queued));
+      if (!c->queued)
+        abort();
+      struct mr_cmdcopy *q = &c->queued[c->nqueued++];
+      q->argc = argc;
+      q->argv = calloc(argc, sizeof(*q->argv));
+      if (!q->argv)
+        abort();
+      for (int i = 0; i < argc; i++)
+        q->argv[i] = str_dup(argv[i].s, argv[i].len);
+      reply_status(&c->out, "QUEUED");
+    }
+  } else {
+    exec_command(c, argc, argv);
+  }
+
+  /* wake up blocked readers */
+  pthread_cond_broadcast(&srv->cond);
+  pthread_mutex_unlock(&srv->lock);
+
+  return c->closing ? -1 : 0;
+}
+
+/* parse a RESP array of bulk strings at the start of IN. Returns the
+   number of bytes used, 0 if incomplete, -1 on protocol error. ARGV
+   points into IN, whose strings are NULL-terminated in place */
+static long
+parse(struct mr_buf *in, int *argc, struct mr_str **argv, size_t *argvsize)
+{
+  char *p = in->buf, *end = in->buf + in->len;
+  char *eol;
+  long long n;
+
+  if (p == end)
+    return 0;
+  if (*p != '*')
+    return -1;
+  if (!(eol = memchr(p, '\r', end - p)) || eol + 1 >= end)
+    return 0;
+  n = strtoll(p + 1, NULL, 10);
+  if (n <= 0 || n > 1024 * 1024)
+    return -1;
+  p = eol + 2;
+
+  if ((size_t)n > *argvsize) {
+    *argv = realloc(*argv, n * sizeof(**argv));
+    if (!*argv)
+      abort();
+    *argvsize = n;
+  }
+
+  /* check that the command is complete before touching the buffer */
+  char *q = p;
+  for (long long i = 0; i < n; i++) {
+    if (q >= end)
+      return 0;
+    if (*q != '$')
+      return -1;
+    if (!(eol = memchr(q, '\r', end - q)) || eol + 1 >= end)
+      return 0;
+    long long len = strtoll(q + 1, NULL, 10);
+    if (len < 0)
+      return -1;
+    (*argv)[i].s = eol + 2;
+    (*argv)[i].len = (size_t)len;
+    q = eol + 2 + len + 2;
+    if (q > end)
+      return 0;
+  }
+
+  for (long long i = 0; i < n; i++)
+    (*argv)[i].s[(*argv)[i].len] = '\0';
+  *argc = (int)n;
+
+  return q - in->buf;
+}
+
+static void
+conn_free(struct mr_conn *c)
+{
+  for (size_t i = 0; i < c->nchans; i++)
+    free(c->chans[i]);
+  for (size_t i = 0; i < c->npats; i++)
+    free(c->pats[i]);
+  free(c->chans);
+  free(c->pats);
+  multi_discard(c);
+  free(c->in.buf);
+  free(c->out.buf);
+  pthread_mutex_destroy(&c->wlock);
+  close(c->fd);
+  free(c);
+}
+
+static void *
+conn_th(void *arg)
+{
+  struct mr_conn *c = (struct mr_conn *)arg;
+  struct mockredis *srv = c->srv;
+  struct mr_str *argv = NULL;
+  size_t argvsize = 0;
+  int argc;
+
+  for (;;) {
+    if (c->in.size - c->in.len < MR_READ_SIZE) {
+      c->in.size = c->in.size ? 2 * c->in.size : 2 * MR_READ_SIZE;
+      c->in.buf = realloc(c->in.buf, c->in.size);
+      if (!c->in.buf)
+        abort();
+    }
+    ssize_t n = recv(c->fd, c->in.buf + c->in.len, c->in.size - c->in.len, 0);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    c->in.len += n;
+
+    /* every complete command, then the replies at once */
+    long used, total = 0;
+    int quit = 0;
+    struct mr_buf rest = c->in;
+    while (!quit && (used = parse(&rest, &argc, &argv, &argvsize)) > 0) {
+      quit = process(c, argc, argv) == -1;
+      rest.buf += used;
+      rest.len -= used;
+      total += used;
+    }
+    if (used == -1) {
+      reply_error(&c->out, "ERR Protocol error");
+      quit = 1;
+    }
+    memmove(c->in.buf, c->in.buf + total, c->in.len - total);
+    c->in.len -= total;
+
+    if (conn_flush(c) == -1 || quit)
+      break;
+  }
+
+  free(argv);
+  shutdown(c->fd, SHUT_RDWR);
+
+  pthread_mutex_lock(&srv->lock);
+  for (struct mr_conn **p = &srv->conns; *p; p = &(*p)->next) {
+    if (*p == c) {
+      *p = c->next;
+      break;
+    }
+  }
+  pthread_cond_broadcast(&srv->cond);
+  pthread_mutex_unlock(&srv->lock);
+
+  conn_free(c);
+  return NULL;
+}
+
+static void *
+acceptor_th(void *arg)
+{
+  struct mockredis *srv = (struct mockredis *)arg;
+
+  for (;;) {
+    struct pollfd fds[2] = { { .fd = srv->lfd, .events = POLLIN },
+                             { .fd = srv->wake[0], .events = POLLIN } };
+
+    if (poll(fds, 2, -1) == -1) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    if (fds[1].revents)
+      break;
+
+    int fd = accept(srv->lfd, NULL, NULL);
+    if (fd == -1)
+      continue;
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    struct mr_conn *c = calloc(1, sizeof(*c));
+    if (!c)
+      abort();
+    c->srv = srv;
+    c->fd = fd;
+    pthread_mutex_init(&c->wlock, NULL);
+
+    pthread_mutex_lock(&srv->lock);
+    c->next = srv->conns;
+    srv->conns = c;
+    srv->nconnections++;
+    pthread_mutex_unlock(&srv->lock);
+
+    pthread_t th;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&th, &attr, conn_th, c) != 0) {
+      pthread_mutex_lock(&srv->lock);
+      srv->conns = c->next;
+      pthread_mutex_unlock(&srv->lock);
+      conn_free(c);
+    }
+    pthread_attr_destroy(&attr);
+  }
+
+  return NULL;
+}
+
+
+/*
+ * Public API
+ */
+
+int
+mockredis_up(struct mockredis *srv)
+{
+  struct sockaddr_storage ss = { 0 };
+  socklen_t len;
+  int one = 1;
+
+  if (srv->lfd != -1)
+    return 0;
+
+  if (srv->family == AF_INET6) {
+    struct sockaddr_in6 *sa = (struct sockaddr_in6 *)&ss;
+    sa->sin6_family = AF_INET6;
+    sa->sin6_port = htons(srv->port);
+    if (inet_pton(AF_INET6, srv->host, &sa->sin6_addr) != 1)
+      return -1;
+    len = sizeof(*sa);
+  } else {
+    struct sockaddr_in *sa = (struct sockaddr_in *)&ss;
+    sa->sin_family = AF_INET;
+    sa->sin_port = htons(srv->port);
+    if (inet_pton(AF_INET, srv->host, &sa->sin_addr) != 1)
+      return -1;
+    len = sizeof(*sa);
+  }
+
+  int fd = socket(srv->family, SOCK_STREAM, 0);
+  if (fd == -1)
+    return -1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (bind(fd, (struct sockaddr *)&ss, len) == -1 || listen(fd, 128) == -1 ||
+      getsockname(fd, (struct sockaddr *)&ss, &len) == -1) {
+    close(fd);
+    return -1;
+  }
+
+  srv->port = ntohs(srv->family == AF_INET6 ?
+                    ((struct sockaddr_in6 *)&ss)->sin6_port :
+                    ((struct sockaddr_in *)&ss)->sin_port);
+  snprintf(srv->addr, sizeof(srv->addr), srv->family == AF_INET6 ? "[%s]:%d" : "%s:%d",
+           srv->host, srv->port);
+
+  if (pipe(srv->wake) == -1) {
+    close(fd);
+    return -1;
+  }
+  srv->lfd = fd;
+  if (pthread_create(&srv->acceptor, NULL, acceptor_th, srv) != 0) {
+    close(srv->wake[0]);
+    close(srv->wake[1]);
+    close(fd);
+    srv->lfd = -1;
+    return -1;
+  }
+
+  return 0;
+}
+
+void
+mockredis_down(struct mockredis *srv)
+{
+  if (srv->lfd == -1)
+    return;
+
+  char c = 0;
+  if (write(srv->wake[1], &c, 1) != 1)
+    abort();
+  pthread_join(srv->acceptor, NULL);
+  close(srv->lfd);
+  close(srv->wake[0]);
+  close(srv->wake[1]);
+  srv->lfd = -1;
+
+  /* the connection threads exit on their own */
+  pthread_mutex_lock(&srv->lock);
+  for (struct mr_conn *c = srv->conns; c; c = c->next) {
+    c->closing = 1;
+    shutdown(c->fd, SHUT_RDWR);
+  }
+  while (srv->conns) {
+    pthread_cond_broadcast(&srv->cond);
+    pthread_cond_wait(&srv->cond, &srv->lock);
+  }
+  pthread_mutex_unlock(&srv->lock);
+}
+
+int
+mockredis_start(struct mockredis **srv, const char *host)
+{
+  struct mockredis *s = calloc(1, sizeof(*s));
+
+  *srv = NULL;
+  if (!s)
+    return -1;
+
+  snprintf(s->host, sizeof(s->host), "%s", host ? host : "127.0.0.1");
+  s->family = strchr(s->host, ':') ? AF_INET6 : AF_INET;
+  s->lfd = -1;
+  s->functions = 1;
+  pthread_mutex_init(&s->lock, NULL);
+
+  /* absolute timeouts of blocking reads are on the realtime clock */
+  pthread_cond_init(&s->cond, NULL);
+
+  if (!(s->db = hm_create()) || !(s->scripts = hm_create()) ||
+      !(s->counts = hm_create()) || mockredis_up(s) == -1) {
+    mockredis_stop(&s);
+    return -1;
+  }
+
+  *srv = s;
+  return 0;
+}
+
+void
+mockredis_flush(struct mockredis *srv)
+{
+  const char *sha;
+  const void *code;
+  size_t cur = 0;
+
+  pthread_mutex_lock(&srv->lock);
+  flushall(srv);
+  while ((cur = hm_next(srv->scripts, cur, &sha, &code)) != 0)
+    free(*(char *const *)code);
+  hm_free(srv->scripts);
+  hm_free(srv->counts);
+  if (!(srv->scripts = hm_create()) || !(srv->counts = hm_create()))
+    abort();
+  free(srv->library);
+  srv->library = NULL;
+  fault_free(srv->faults);
+  srv->faults = NULL;
+  srv->latency_ms = 0;
+  srv->functions = 1;
+  srv->ncommands = 0;
+  srv->nconnections = 0;
+  srv->notify[0] = '\0';
+  pthread_mutex_unlock(&srv->lock);
+}
+
+void
+mockredis_stop(struct mockredis **srv)
+{
+  struct mockredis *s = *srv;
+
+  if (!s)
+    return;
+
+  mockredis_down(s);
+  if (s->db)
+    flushall(s);
+  hm_free(s->db);
+  if (s->scripts) {
+    const char *sha;
+    const void *code;
+    size_t cur = 0;
+    while ((cur = hm_next(s->scripts, cur, &sha, &code)) != 0)
+      free(*(char *const *)code);
+  }
+  hm_free(s->scripts);
+  hm_free(s->counts);
+  free(s->library);
+  fault_free(s->faults);
+  pthread_cond_destroy(&s->cond);
+  pthread_mutex_destroy(&s->lock);
+  free(s);
+
+  *srv = NULL;
+}
+
+const char *
+mockredis_addr(const struct mockredis *srv)
+{
+  return srv->addr;
+}
+
+void
+mockredis_latency(struct mockredis *srv, unsigned ms)
+{
+  pthread_mutex_lock(&srv->lock);
+  srv->latency_ms = ms;
+  pthread_mutex_unlock(&srv->lock);
+}
+
+static void
+add_fault(struct mockredis *srv, enum mr_fault_kind kind, const char *cmd,
+          unsigned count, const char *data, size_t len)
+{
+  struct mr_fault *f = calloc(1, sizeof(*f));
+
+  if (!f || (cmd && !(f->cmd = strdup(cmd))) || !(f->data = malloc(len + 1)))
+    abort();
+  f->kind = kind;
+  f->count = count;
+  memcpy(f->data, data, len);
+  f->data[len] = '\0';
+  f->len = len;
+
+  /* in order of injection */
+  pthread_mutex_lock(&srv->lock);
+  struct mr_fault **p = &srv->faults;
+  while (*p)
+    p = &(*p)->next;
+  *p = f;
+  pthread_mutex_unlock(&srv->lock);
+}
+
+void
+mockredis_fail(struct mockredis *srv, const char *cmd, unsigned count, const char *err)
+{
+  if (!err)
+    err = "ERR injected failure";
+  if (count)
+    add_fault(srv, MR_FAULT_ERROR, cmd, count, err, strlen(err));
+}
+
+void
+mockredis_reply(struct mockredis *srv, const char *cmd, unsigned count,
+                const char *raw, size_t len)
+{
+  if (count)
+    add_fault(srv, MR_FAULT_REPLY, cmd, count, raw, len);
+}
+
+void
+mockredis_drop(struct mockredis *srv, const char *cmd, unsigned count)
+{
+  if (count)
+    add_fault(srv, MR_FAULT_DROP, cmd, count, "", 0);
+}
+
+void
+mockredis_clear_faults(struct mockredis *srv)
+{
+  pthread_mutex_lock(&srv->lock);
+  fault_free(srv->faults);
+  srv->faults = NULL;
+  srv->latency_ms = 0;
+  pthread_mutex_unlock(&srv->lock);
+}
+
+void
+mockredis_functions(struct mockredis *srv, int enabled)
+{
+  pthread_mutex_lock(&srv->lock);
+  srv->functions = enabled;
+  pthread_mutex_unlock(&srv->lock);
+}
+
+uint64_t
+mockredis_count(struct mockredis *srv, const char *cmd)
+{
+  uint64_t n;
+
+  pthread_mutex_lock(&srv->lock);
+  if (!cmd) {
+    n = srv->ncommands;
+  } else {
+    char lname[32];
+    size_t i;
+    for (i = 0; cmd[i] && i < sizeof(lname) - 1; i++)
+      lname[i] = tolower((unsigned char)cmd[i]);
+    lname[i] = '\0';
+    const uint64_t *v = hm_get(srv->counts, lname);
+    n = v ? *v : 0;
+  }
+  pthread_mutex_unlock(&srv->lock);
+
+  return n;
+}
+
+uint64_t
+mockredis_nconnections(struct mockredis *srv)
+{
+  uint64_t n;
+
+  pthread_mutex_lock(&srv->lock);
+  n = srv->nconnections;
+  pthread_mutex_unlock(&srv->lock);
+
+  return n;
+}
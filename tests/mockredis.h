@@ -0,0 +1,122 @@
+#ifndef ADMIRE_MOCKREDIS_H
+#define ADMIRE_MOCKREDIS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Mock Redis server for the icdb tests, served by threads of the test
+ * process. It speaks RESP2 and implements the subset of commands icdb
+ * uses, on an in-memory keyspace:
+ *
+ *   PING SELECT FLUSHALL DEL EXISTS KEYS SCAN GET SET MGET
+ *   HSET HMSET HGET HMGET HGETALL HEXISTS HINCRBY HDEL
+ *   RPUSH LPUSH LRANGE LINDEX LLEN LREM LTRIM
+ *   SADD SREM SMEMBERS SISMEMBER SCARD SSCAN SORT
+ *   MULTI EXEC DISCARD
+ *   XADD XLEN XREAD XREADGROUP XGROUP CREATE XACK
+ *   CONFIG GET/SET SUBSCRIBE PSUBSCRIBE PUBLISH
+ *   FUNCTION LOAD FCALL SCRIPT LOAD EVAL EVALSHA
+ *
+ * There is no Lua interpreter: the functions of the icdb library are
+ * implemented natively and looked up by name, from the FUNCTION LOAD
+ * library for FCALL or from the "-- <name>" first line of the scripts
+ * passed to EVAL and SCRIPT LOAD. Other scripts are rejected.
+ *
+ * Once keyspace notifications are enabled with a K in
+ * notify-keyspace-events, every event is published, whatever the
+ * event classes.
+ *
+ * Faults can be injected to test error paths: reply latency, error
+ * replies, raw replies and dropped connections.
+ */
+struct mockredis;
+
+/**
+ * Start a server on a free port of HOST, "127.0.0.1" or "::1", and
+ * return it in SRV.
+ *
+ * Returns 0 or -1 in case of error.
+ */
+int mockredis_start(struct mockredis **srv, const char *host);
+
+/**
+ * Stop SRV, closing its connections and freeing its data.
+ */
+void mockredis_stop(struct mockredis **srv);
+
+/**
+ * Return the address of SRV, as host:port, "[host]:port" for IPv6.
+ */
+const char *mockredis_addr(const struct mockredis *srv);
+
+/**
+ * Take SRV down as if it had crashed: stop listening and close all
+ * connections. The data is kept.
+ */
+void mockredis_down(struct mockredis *srv);
+
+/**
+ * Bring SRV back up on the same port after mockredis_down.
+ *
+ * Returns 0 or -1 in case of error.
+ */
+int mockredis_up(struct mockredis *srv);
+
+/**
+ * Remove all keys, scripts and functions from SRV and clear its
+ * faults and counters.
+ */
+void mockredis_flush(struct mockredis *srv);
+
+/**
+ * Delay every reply of SRV by MS milliseconds, 0 to stop.
+ */
+void mockredis_latency(struct mockredis *srv, unsigned ms);
+
+/**
+ * Fail the next COUNT commands named CMD, or any command if CMD is
+ * NULL, with error reply ERR ("ERR injected failure" if NULL).
+ */
+void mockredis_fail(struct mockredis *srv, const char *cmd, unsigned count,
+                    const char *err);
+
+/**
+ * Answer the next COUNT commands named CMD, or any command if NULL,
+ * with the LEN bytes of RAW instead of their reply. The command is not
+ * executed.
+ */
+void mockredis_reply(struct mockredis *srv, const char *cmd, unsigned count,
+                     const char *raw, size_t len);
+
+/**
+ * Close the connection receiving the next COUNT commands named CMD, or
+ * any command if NULL, without executing them.
+ */
+void mockredis_drop(struct mockredis *srv, const char *cmd, unsigned count);
+
+/**
+ * Remove the faults of SRV.
+ */
+void mockredis_clear_faults(struct mockredis *srv);
+
+/**
+ * Make SRV behave as a Redis server older than 7, without Functions,
+ * if ENABLED is 0.
+ */
+void mockredis_functions(struct mockredis *srv, int enabled);
+
+/**
+ * Return the number of commands named CMD (case insensitive), or of
+ * all commands if NULL, received by SRV since it started or was
+ * flushed.
+ */
+uint64_t mockredis_count(struct mockredis *srv, const char *cmd);
+
+/**
+ * Return the number of connections SRV accepted since it started or
+ * was flushed.
+ */
+uint64_t mockredis_nconnections(struct mockredis *srv);
+
+#endif
@@ -0,0 +1,327 @@
+/**
+ * Address cache tests: hits and misses, LRU eviction past the
+ * capacity, negative entries and their expiration, addrcache_fail and
+ * addrcache_invalidate, and the counters. Every address reference
+ * taken from Mercury is freed once, whether the cache or the caller
+ * holds it, including under concurrent lookups from several
+ * execution streams.
+ *
+ * addrcache.c is included with its Margo calls redirected to the
+ * simulated addresses below.
+ *
+ * Usage: test_addrcache [NOPS]
+ */
+#include <margo.h>
+
+#include "tests.h"
+
+#define MOCK_NADDRS 64
+
+static long     refs[MOCK_NADDRS];      /* references held */
+static int      nolookup[MOCK_NADDRS];  /* the address does not resolve */
+static char     addrs[MOCK_NADDRS][32];
+static uint64_t nlookups;               /* Mercury lookups */
+static size_t   nops;
+
+
+static size_t
+mock_index(hg_addr_t addr)
+{
+  return (size_t)(uintptr_t)addr - 1;
+}
+
+static hg_return_t
+mock_addr_lookup(margo_instance_id mid, const char *str, hg_addr_t *addr)
+{
+  size_t i;
+  (void)mid;
+
+  __atomic_fetch_add(&nlookups, 1, __ATOMIC_RELAXED);
+  if (sscanf(str, "mock:%zu", &i) != 1 || i >= MOCK_NADDRS ||
+      __atomic_load_n(&nolookup[i], __ATOMIC_RELAXED))
+    return HG_NOENTRY;
+  *addr = (hg_addr_t)(uintptr_t)(i + 1);
+  __atomic_fetch_add(&refs[i], 1, __ATOMIC_RELAXED);
+  return HG_SUCCESS;
+}
+
+static hg_return_t
+mock_addr_dup(margo_instance_id mid, hg_addr_t addr, hg_addr_t *newaddr)
+{
+  (void)mid;
+  TEST_ASSERT(addr != HG_ADDR_NULL);
+  TEST_ASSERT(__atomic_fetch_add(&refs[mock_index(addr)], 1, __ATOMIC_RELAXED) > 0);
+  *newaddr = addr;
+  return HG_SUCCESS;
+}
+
+static hg_return_t
+mock_addr_free(margo_instance_id mid, hg_addr_t addr)
+{
+  (void)mid;
+  TEST_ASSERT(addr != HG_ADDR_NULL);
+  TEST_ASSERT(__atomic_sub_fetch(&refs[mock_index(addr)], 1, __ATOMIC_RELAXED) >= 0);
+  return HG_SUCCESS;
+}
+
+static void
+mock_log(margo_instance_id mid, const char *fmt, ...)
+{
+  (void)mid;
+  (void)fmt;
+}
+
+#undef margo_addr_lookup
+#define margo_addr_lookup mock_addr_lookup
+#undef margo_addr_dup
+#define margo_addr_dup mock_addr_dup
+#undef margo_addr_free
+#define margo_addr_free mock_addr_free
+#undef margo_error
+#define margo_error mock_log
+#undef margo_info
+#define margo_info mock_log
+
+#include "../src/addrcache.c"
+
+
+static void
+check_no_refs(void)
+{
+  for (size_t i = 0; i < MOCK_NADDRS; i++)
+    TEST_CHECK_INT(refs[i], 0);
+}
+
+
+/* look up address I, expecting HRET, and free the reference */
+static void
+lookup(struct addrcache *cache, size_t i, hg_return_t expected)
+{
+  hg_addr_t addr = HG_ADDR_NULL;
+  hg_return_t hret = addrcache_lookup(cache, MARGO_INSTANCE_NULL, addrs[i], &addr);
+
+  TEST_CHECK_INT(hret, expected);
+  if (hret == HG_SUCCESS) {
+    TEST_CHECK_INT(mock_index(addr), i);
+    mock_addr_free(MARGO_INSTANCE_NULL, addr);
+  } else {
+    TEST_CHECK(addr == HG_ADDR_NULL);
+  }
+}
+
+
+static void
+test_hits(void)
+{
+  struct addrcache *cache;
+  struct addrcache_stats s;
+
+  TEST_ASSERT(addrcache_init(&cache, MARGO_INSTANCE_NULL, 0, 0) == 0);
+  TEST_CHECK_INT(cache->capacity, ADDRCACHE_CAPACITY_DEFAULT);
+
+  nlookups = 0;
+  for (int round = 0; round < 3; round++) {
+    for (size_t i = 0; i < 10; i++)
+      lookup(cache, i, HG_SUCCESS);
+  }
+  TEST_CHECK_INT(nlookups, 10);
+
+  /* the cache holds one reference each */
+  for (size_t i = 0; i < 10; i++)
+    TEST_CHECK_INT(refs[i], 1);
+
+  addrcache_stats(cache, &s);
+  TEST_CHECK_INT(s.hits, 20);
+  TEST_CHECK_INT(s.misses, 10);
+  TEST_CHECK_INT(s.neghits, 0);
+  TEST_CHECK_INT(s.lookups, 10);
+  TEST_CHECK(s.lookup_max <= s.lookup_time);
+
+  /* a reference outlives the cache */
+  hg_addr_t addr;
+  TEST_ASSERT(addrcache_lookup(cache, MARGO_INSTANCE_NULL, addrs[3], &addr) == HG_SUCCESS);
+  addrcache_fini(&cache);
+  TEST_CHECK(cache == NULL);
+  TEST_CHECK_INT(refs[3], 1);
+  mock_addr_free(MARGO_INSTANCE_NULL, addr);
+  check_no_refs();
+
+  /* without a cache, every lookup goes to Mercury */
+  nlookups = 0;
+  lookup(NULL, 1, HG_SUCCESS);
+  lookup(NULL, 1, HG_SUCCESS);
+  TEST_CHECK_INT(nlookups, 2);
+  addrcache_fail(NULL, addrs[1]);
+  addrcache_invalidate(NULL, addrs[1]);
+  addrcache_fini(NULL);
+  check_no_refs();
+}
+
+
+static void
+test_lru(void)
+{
+  struct addrcache *cache;
+  struct addrcache_stats s;
+
+  TEST_ASSERT(addrcache_init(&cache, MARGO_INSTANCE_NULL, 4, 0) == 0);
+
+  for (size_t i = 0; i < 4; i++)
+    lookup(cache, i, HG_SUCCESS);
+  lookup(cache, 0, HG_SUCCESS);       /* 1 is now the oldest */
+  lookup(cache, 4, HG_SUCCESS);
+  TEST_CHECK_INT(cache->count, 4);
+  TEST_CHECK_INT(refs[1], 0);
+  TEST_CHECK_INT(refs[0], 1);
+
+  nlookups = 0;
+  lookup(cache, 0, HG_SUCCESS);
+  lookup(cache, 2, HG_SUCCESS);
+  lookup(cache, 3, HG_SUCCESS);
+  lookup(cache, 4, HG_SUCCESS);
+  TEST_CHECK_INT(nlookups, 0);
+  lookup(cache, 1, HG_SUCCESS);       /* evicts 0 */
+  TEST_CHECK_INT(nlookups, 1);
+  TEST_CHECK_INT(refs[0], 0);
+
+  addrcache_stats(cache, &s);
+  TEST_CHECK_INT(s.evictions, 2);
+  TEST_CHECK_INT(cache->count, 4);
+
+  /* the list and the map agree */
+  size_t n = 0;
+  for (struct addrcache_entry *e = cache->head; e; e = e->next, n++) {
+    TEST_CHECK(find(cache, e->key) == e);
+    TEST_CHECK(e->next == NULL || e->next->prev == e);
+    TEST_CHECK(e->next != NULL || cache->tail == e);
+  }
+  TEST_CHECK_INT(n, 4);
+  TEST_CHECK_INT(hm_length(cache->map), 4);
+
+  addrcache_fini(&cache);
+  check_no_refs();
+}
+
+
+static void
+test_negative(void)
+{
+  struct addrcache *cache;
+  struct addrcache_stats s;
+
+  TEST_ASSERT(addrcache_init(&cache, MARGO_INSTANCE_NULL, 0, 0.05) == 0);
+
+  /* failed lookups are remembered for a while */
+  nolookup[5] = 1;
+  nlookups = 0;
+  lookup(cache, 5, HG_NOENTRY);
+  lookup(cache, 5, HG_NOENTRY);
+  TEST_CHECK_INT(nlookups, 1);
+  nolookup[5] = 0;
+  lookup(cache, 5, HG_NOENTRY);
+  TEST_CHECK_INT(nlookups, 1);
+  test_sleep_ms(100);
+  lookup(cache, 5, HG_SUCCESS);
+  TEST_CHECK_INT(nlookups, 2);
+
+  /* a client that did not answer */
+  addrcache_fail(cache, addrs[5]);
+  TEST_CHECK_INT(refs[5], 0);
+  lookup(cache, 5, HG_NOENTRY);
+  addrcache_fail(cache, addrs[6]);    /* never looked up */
+  lookup(cache, 6, HG_NOENTRY);
+  TEST_CHECK_INT(nlookups, 2);
+
+  /* it came back */
+  addrcache_invalidate(cache, addrs[5]);
+  lookup(cache, 5, HG_SUCCESS);
+  TEST_CHECK_INT(nlookups, 3);
+
+  /* a client that went away */
+  addrcache_invalidate(cache, addrs[5]);
+  TEST_CHECK_INT(refs[5], 0);
+  addrcache_invalidate(cache, addrs[7]);
+
+  addrcache_stats(cache, &s);
+  TEST_CHECK_INT(s.neghits, 4);
+  TEST_CHECK_INT(s.invalidations, 2);
+  TEST_CHECK_INT(s.lookups, 3);
+
+  addrcache_fini(&cache);
+  check_no_refs();
+}
+
+
+static struct addrcache *shared;
+
+static void
+worker(void *arg)
+{
+  uint64_t seed = 0x9e3779b97f4a7c15ULL + *(size_t *)arg;
+
+  for (size_t op = 0; op < nops; op++) {
+    seed ^= seed >> 12;
+    seed ^= seed << 25;
+    seed ^= seed >> 27;
+    uint64_t r = seed * 2685821657736338717ULL;
+    size_t i = (r >> 8) % MOCK_NADDRS;
+    hg_addr_t addr;
+
+    switch (r % 16) {
+    case 0:
+      addrcache_fail(shared, addrs[i]);
+      break;
+    case 1:
+      addrcache_invalidate(shared, addrs[i]);
+      break;
+    default:
+      if (addrcache_lookup(shared, MARGO_INSTANCE_NULL, addrs[i], &addr) == HG_SUCCESS) {
+        TEST_CHECK_INT(mock_index(addr), i);
+        mock_addr_free(MARGO_INSTANCE_NULL, addr);
+      }
+    }
+  }
+}
+
+
+static void
+test_concurrent(void)
+{
+  size_t ids[8];
+  struct addrcache_stats s;
+
+  for (size_t i = 0; i < 8; i++)
+    ids[i] = i;
+
+  /* smaller than the address set, to evict all the time */
+  TEST_ASSERT(addrcache_init(&shared, MARGO_INSTANCE_NULL, MOCK_NADDRS / 2, 0.001) == 0);
+  TEST_ASSERT(test_xstreams_run(8, worker, ids, sizeof(ids[0])) == 0);
+
+  addrcache_stats(shared, &s);
+  TEST_CHECK(s.hits + s.misses + s.neghits > 0);
+  TEST_CHECK(shared->count <= MOCK_NADDRS / 2);
+  TEST_CHECK_INT(hm_length(shared->map), shared->count);
+  addrcache_fini(&shared);
+  check_no_refs();
+}
+
+
+int
+main(int argc, char **argv)
+{
+  nops = test_size_arg(argc, argv, 1, 100000);
+
+  for (size_t i = 0; i < MOCK_NADDRS; i++)
+    snprintf(addrs[i], sizeof(addrs[i]), "mock:%zu", i);
+
+  ABT_init(0, NULL);
+
+  TEST_RUN(test_hits);
+  TEST_RUN(test_lru);
+  TEST_RUN(test_negative);
+  TEST_RUN(test_concurrent);
+
+  ABT_finalize();
+
+  return TEST_EXIT();
+}
@@ -0,0 +1,143 @@
+/**
+ * Arena tests: allocations are zeroed and aligned for any type, the
+ * arena grows block after block without moving what was allocated,
+ * larger requests get a block of their own, a reset keeps one block,
+ * and freeing a large arena gives all of its memory back.
+ */
+#include <malloc.h>             /* mallinfo2 */
+#include <stdint.h>             /* uintptr_t, SIZE_MAX */
+#include <string.h>
+
+#include "arena.h"
+#include "tests.h"
+
+#define TEST_BLOCKSIZE 256
+#define TEST_NALLOCS   1000
+#define TEST_LARGE     (64 << 20)       /* bytes in the large arena */
+
+/* the strictest alignment of the usual types */
+#define TEST_ALIGN __alignof__(union { long double ld; void *p; uint64_t u; double d; })
+
+
+/* bytes taken from malloc, mapped or not */
+static size_t
+heap_used(void)
+{
+  struct mallinfo2 mi = mallinfo2();
+  return mi.uordblks + mi.hblkhd;
+}
+
+
+static void
+test_align(void)
+{
+  struct arena *a = arena_create(0);
+  TEST_ASSERT(a);
+
+  for (size_t size = 1; size < 100; size++) {
+    unsigned char *p = arena_alloc(a, size);
+    TEST_ASSERT(p);
+    TEST_CHECK_INT((uintptr_t)p % TEST_ALIGN, 0);
+    for (size_t i = 0; i < size; i++)
+      TEST_CHECK_INT(p[i], 0);
+    memset(p, 0xff, size);
+  }
+
+  char *s = arena_strndup(a, "node12,node13", 6);
+  TEST_CHECK_STR(s, "node12");
+  TEST_CHECK_INT((uintptr_t)s % TEST_ALIGN, 0);
+
+  TEST_CHECK(arena_alloc(a, SIZE_MAX) == NULL);
+  TEST_CHECK(arena_strndup(a, "x", SIZE_MAX) == NULL);
+
+  arena_free(a);
+  arena_free(NULL);
+}
+
+
+static void
+test_growth(void)
+{
+  struct arena *a = arena_create(TEST_BLOCKSIZE);
+  struct arena_stats s;
+  unsigned char *p[TEST_NALLOCS];
+
+  TEST_ASSERT(a);
+  arena_stats(a, &s);
+  TEST_CHECK_INT(s.nblocks, 0);
+
+  /* several per block, nothing moves as blocks are added */
+  for (size_t i = 0; i < TEST_NALLOCS; i++) {
+    p[i] = arena_alloc(a, 40);
+    TEST_ASSERT(p[i]);
+    memset(p[i], (int)(i % 256), 40);
+  }
+  for (size_t i = 0; i < TEST_NALLOCS; i++) {
+    TEST_CHECK_INT(p[i][0], i % 256);
+    TEST_CHECK_INT(p[i][39], i % 256);
+  }
+
+  arena_stats(a, &s);
+  TEST_CHECK_INT(s.used, TEST_NALLOCS * 40);
+  TEST_CHECK(s.nblocks > 1 && s.nblocks < TEST_NALLOCS);
+  TEST_CHECK_INT(s.size, s.nblocks * TEST_BLOCKSIZE);
+
+  /* larger than a block */
+  size_t nblocks = s.nblocks, size = s.size;
+  unsigned char *large = arena_alloc(a, 10 * TEST_BLOCKSIZE);
+  TEST_ASSERT(large);
+  TEST_CHECK_INT(large[10 * TEST_BLOCKSIZE - 1], 0);
+  arena_stats(a, &s);
+  TEST_CHECK_INT(s.nblocks, nblocks + 1);
+  TEST_CHECK_INT(s.size, size + 10 * TEST_BLOCKSIZE);
+
+  /* one block left, reused */
+  arena_reset(a);
+  arena_stats(a, &s);
+  TEST_CHECK_INT(s.nblocks, 1);
+  TEST_CHECK_INT(s.used, 0);
+  unsigned char *q = arena_alloc(a, 40);
+  TEST_ASSERT(q);
+  TEST_CHECK_INT(q[0], 0);
+  arena_stats(a, &s);
+  TEST_CHECK_INT(s.nblocks, 1);
+
+  arena_free(a);
+}
+
+
+static void
+test_free_large(void)
+{
+  size_t before = heap_used();
+  struct arena_stats s;
+
+  struct arena *a = arena_create(0);
+  TEST_ASSERT(a);
+
+  /* small and large requests, in many blocks */
+  for (size_t i = 0, total = 0; total < TEST_LARGE; i++) {
+    size_t size = i % 8 ? 100 : 100000;
+    TEST_ASSERT(arena_alloc(a, size));
+    total += size;
+  }
+  arena_stats(a, &s);
+  TEST_CHECK(s.used >= TEST_LARGE);
+  TEST_CHECK(s.nblocks > 1000);
+  TEST_CHECK(heap_used() - before >= s.size);
+
+  /* but the few chunks malloc keeps at hand */
+  arena_free(a);
+  TEST_CHECK(heap_used() - before < s.size / 1000);
+}
+
+
+int
+main(void)
+{
+  TEST_RUN(test_align);
+  TEST_RUN(test_growth);
+  TEST_RUN(test_free_large);
+
+  return TEST_EXIT();
+}
@@ -0,0 +1,333 @@
+/**
+ * Client context checkpoint tests: a context saved and restored has
+ * the same identifiers, nodelists and host maps, older generations are
+ * dropped, and a damaged newest generation falls back to the one
+ * before. A process killed at random points while checkpointing in a
+ * loop always leaves a checkpoint that restores to one consistent
+ * state.
+ *
+ * Usage: test_ckpt [NKILLS]
+ */
+#include <dirent.h>
+#include <inttypes.h>           /* PRIu32 */
+#include <limits.h>             /* PATH_MAX */
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "icc_ckpt.h"
+#include "tests.h"
+
+#define JOBID  4242
+#define NHOSTS 5000
+
+static char   dir[] = "/tmp/test_ckptXXXXXX";
+static size_t nkills;
+
+
+/* a context at step K, every value derived from K */
+static struct icc_context *
+make_context(uint32_t k, size_t nhosts)
+{
+  struct icc_context *icc = calloc(1, sizeof(*icc));
+  char host[32];
+
+  TEST_ASSERT(icc);
+  snprintf(icc->clid, sizeof(icc->clid), "c0ffee00-0000-4000-8000-%012"PRIu32, k);
+  icc->jobid = JOBID;
+  icc->jobstepid = k;
+  icc->type = ICC_TYPE_FLEXMPI;
+  icc->registered = 1;
+  icc->reconfig_flag = ICC_RECONFIG_EXPAND;
+  icc->nodelist = strdup("n[0-3]");
+  icc->jobnodelist = strdup("n[0-7]");
+  icc->hostnames = hm_create_strings();
+  icc->hostalloc = hm_create_interned(icc->hostnames);
+  icc->hostrelease = hm_create_interned(icc->hostnames);
+  icc->hostjob = hm_create_interned(icc->hostnames);
+  icc->reconfigalloc = hm_create_interned(icc->hostnames);
+  TEST_ASSERT(icc->nodelist && icc->jobnodelist && icc->hostalloc &&
+              icc->hostrelease && icc->hostjob && icc->reconfigalloc);
+
+  for (size_t i = 0; i < nhosts; i++) {
+    /* the types icc.c stores, all bytes of which are saved */
+    uint16_t ncpus = (k + i) % UINT16_MAX;
+    unsigned int nreleased = UINT16_MAX + ncpus;
+    uint32_t jobid = k;
+
+    snprintf(host, sizeof(host), "node%zu", i);
+    TEST_ASSERT(hm_set(icc->hostalloc, host, &ncpus, sizeof(ncpus)) == 1);
+    TEST_ASSERT(hm_set(icc->hostrelease, host, &nreleased, sizeof(nreleased)) == 1);
+    TEST_ASSERT(hm_set(icc->hostjob, host, &jobid, sizeof(jobid)) == 1);
+    if (i % 2)
+      TEST_ASSERT(hm_set(icc->reconfigalloc, host, &ncpus, sizeof(ncpus)) == 1);
+  }
+
+  return icc;
+}
+
+
+static void
+free_context(struct icc_context *icc)
+{
+  free(icc->nodelist);
+  free(icc->jobnodelist);
+  hm_free(icc->hostalloc);
+  hm_free(icc->hostrelease);
+  hm_free(icc->hostjob);
+  hm_free(icc->reconfigalloc);
+  hm_free(icc->hostnames);
+  free(icc);
+}
+
+
+/* restore job JOBID, then check it is the context of some step, which
+   is returned */
+static uint32_t
+check_restored(size_t nhosts)
+{
+  struct icc_context *icc = calloc(1, sizeof(*icc));
+  char host[32], clid[UUID_STR_LEN];
+
+  TEST_ASSERT(icc);
+  TEST_ASSERT(icc_ckpt_load(icc, JOBID) == ICC_SUCCESS);
+
+  uint32_t k = icc->jobstepid;
+  snprintf(clid, sizeof(clid), "c0ffee00-0000-4000-8000-%012"PRIu32, k);
+  TEST_CHECK_STR(icc->clid, clid);
+  TEST_CHECK_INT(icc->jobid, JOBID);
+  TEST_CHECK_INT(icc->type, ICC_TYPE_FLEXMPI);
+  TEST_CHECK_INT(icc->registered, 1);
+  TEST_CHECK_INT(icc->reconfig_flag, ICC_RECONFIG_EXPAND);
+  TEST_CHECK_STR(icc->nodelist, "n[0-3]");
+  TEST_CHECK_STR(icc->jobnodelist, "n[0-7]");
+
+  TEST_CHECK_INT(hm_length(icc->hostalloc), nhosts);
+  TEST_CHECK_INT(hm_length(icc->hostrelease), nhosts);
+  TEST_CHECK_INT(hm_length(icc->hostjob), nhosts);
+  TEST_CHECK_INT(hm_length(icc->reconfigalloc), nhosts / 2);
+  for (size_t i = 0; i < nhosts; i++) {
+    uint16_t ncpus = (k + i) % UINT16_MAX;
+    snprintf(host, sizeof(host), "node%zu", i);
+
+    const uint16_t *alloc = hm_get(icc->hostalloc, host);
+    const unsigned int *released = hm_get(icc->hostrelease, host);
+    const uint32_t *jobid = hm_get(icc->hostjob, host);
+    const uint16_t *reconf = hm_get(icc->reconfigalloc, host);
+    TEST_ASSERT(alloc && released && jobid);
+    TEST_CHECK_INT(*alloc, ncpus);
+    TEST_CHECK_INT(*released, UINT16_MAX + ncpus);
+    TEST_CHECK_INT(*jobid, k);
+    if (i % 2) {
+      TEST_ASSERT(reconf);
+      TEST_CHECK_INT(*reconf, ncpus);
+    } else {
+      TEST_CHECK(reconf == NULL);
+    }
+  }
+
+  free_context(icc);
+  return k;
+}
+
+
+/* number of checkpoint generations, or of temporary files if TMP */
+static size_t
+count_files(int tmp)
+{
+  char path[PATH_MAX];
+  struct dirent *ent;
+  size_t n = 0;
+
+  snprintf(path, sizeof(path), "%s/icc-ckpt.%d", dir, JOBID);
+  DIR *d = opendir(path);
+  if (!d)
+    return 0;
+  while ((ent = readdir(d))) {
+    size_t len = strlen(ent->d_name);
+    int istmp = len > 4 && !strcmp(ent->d_name + len - 4, ".tmp");
+    n += !strncmp(ent->d_name, "ckpt.", 5) && istmp == tmp;
+  }
+  closedir(d);
+  return n;
+}
+
+
+static void
+clear_dir(void)
+{
+  char path[PATH_MAX], file[PATH_MAX + 256];
+  struct dirent *ent;
+
+  snprintf(path, sizeof(path), "%s/icc-ckpt.%d", dir, JOBID);
+  DIR *d = opendir(path);
+  if (!d)
+    return;
+  while ((ent = readdir(d))) {
+    if (ent->d_name[0] == '.')
+      continue;
+    snprintf(file, sizeof(file), "%s/%s", path, ent->d_name);
+    unlink(file);
+  }
+  closedir(d);
+  rmdir(path);
+}
+
+
+static void
+test_roundtrip(void)
+{
+  struct icc_context *icc;
+
+  clear_dir();
+  struct icc_context *none = calloc(1, sizeof(*none));
+  TEST_ASSERT(none);
+  TEST_CHECK_INT(icc_ckpt_load(none, JOBID), ICC_FAILURE);
+  hm_free(none->hostnames);
+  free(none);
+
+  /* more generations than are kept */
+  for (uint32_t k = 1; k <= 5; k++) {
+    icc = make_context(k, 100);
+    TEST_ASSERT(icc_ckpt_save(icc) == ICC_SUCCESS);
+    free_context(icc);
+  }
+  TEST_CHECK_INT(count_files(0), ICC_CKPT_GENERATIONS);
+  TEST_CHECK_INT(count_files(1), 0);
+  TEST_CHECK_INT(check_restored(100), 5);
+
+  /* restored into a context that has maps already */
+  icc = make_context(9, 10);
+  TEST_ASSERT(icc_ckpt_load(icc, JOBID) == ICC_SUCCESS);
+  TEST_CHECK_INT(icc->jobstepid, 5);
+  TEST_CHECK_INT(hm_length(icc->hostalloc), 100);
+  free_context(icc);
+}
+
+
+/* overwrite checkpoint generation GEN with the LEN first bytes of
+   generation FROM, or with its bit BIT flipped if LEN is 0 */
+static void
+damage(int gen, int from, size_t len, size_t bit)
+{
+  char src[PATH_MAX], dst[PATH_MAX];
+
+  snprintf(src, sizeof(src), "%s/icc-ckpt.%d/ckpt.%d", dir, JOBID, from);
+  snprintf(dst, sizeof(dst), "%s/icc-ckpt.%d/ckpt.%d", dir, JOBID, gen);
+
+  FILE *f = fopen(src, "rb");
+  TEST_ASSERT(f);
+  static unsigned char buf[1 << 16];
+  size_t n = fread(buf, 1, sizeof(buf), f);
+  fclose(f);
+  TEST_ASSERT(n > 0 && n < sizeof(buf));
+
+  if (len)
+    n = len < n ? len : n;
+  else
+    buf[(bit / 8) % n] ^= 1 << (bit % 8);
+
+  f = fopen(dst, "wb");
+  TEST_ASSERT(f);
+  TEST_ASSERT(fwrite(buf, n, 1, f) == 1);
+  fclose(f);
+}
+
+
+static void
+test_fallback(void)
+{
+  clear_dir();
+  for (uint32_t k = 1; k <= 2; k++) {
+    struct icc_context *icc = make_context(k, 100);
+    TEST_ASSERT(icc_ckpt_save(icc) == ICC_SUCCESS);
+    free_context(icc);
+  }
+
+  /* a torn newer generation, at every length */
+  for (size_t len = 1; len < 2000; len += 7) {
+    damage(3, 2, len, 0);
+    TEST_CHECK_INT(check_restored(100), 2);
+  }
+
+  /* a newer generation with one bit flipped */
+  for (size_t bit = 0; bit < 8 * 2000; bit += 13) {
+    damage(3, 2, 0, bit);
+    TEST_CHECK_INT(check_restored(100), 2);
+  }
+
+  /* both damaged, the oldest is used */
+  damage(2, 1, 0, 1000);
+  TEST_CHECK_INT(check_restored(100), 1);
+}
+
+
+/* checkpoint steps from K on in a loop, until killed */
+static void
+saver(uint32_t k)
+{
+  for (;; k++) {
+    struct icc_context *icc = make_context(k, NHOSTS);
+    if (icc_ckpt_save(icc) != ICC_SUCCESS)
+      _exit(1);
+    free_context(icc);
+  }
+}
+
+
+static void
+test_kill(void)
+{
+  uint32_t last = 0;
+  size_t ntorn = 0;
+
+  clear_dir();
+  for (size_t i = 0; i < nkills; i++) {
+    pid_t pid = fork();
+    TEST_ASSERT(pid != -1);
+    if (pid == 0)
+      saver(last + 1);
+
+    /* at a random point of a later checkpoint than the last one */
+    while (count_files(0) == 0)
+      test_sleep_ms(1);
+    test_sleep_ms(rand() % 50);
+    kill(pid, SIGKILL);
+
+    int status;
+    TEST_ASSERT(waitpid(pid, &status, 0) == pid);
+    TEST_CHECK(WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL);
+    ntorn += count_files(1);
+
+    /* written checkpoints are never lost, the next run resumes from
+       the restored step */
+    uint32_t k = check_restored(NHOSTS);
+    TEST_CHECK(k >= last);
+    last = k;
+    TEST_CHECK(count_files(0) <= ICC_CKPT_GENERATIONS + 1);
+  }
+  printf("killed %zu times, %zu times mid-write, restored up to step %"PRIu32"\n",
+         nkills, ntorn, last);
+  TEST_CHECK(last > 0);
+}
+
+
+int
+main(int argc, char **argv)
+{
+  nkills = test_size_arg(argc, argv, 1, 10);
+
+  TEST_ASSERT(mkdtemp(dir));
+  setenv(ICC_CKPT_ENV, dir, 1);
+  srand(42);
+
+  TEST_RUN(test_roundtrip);
+  TEST_RUN(test_fallback);
+
+  TEST_RUN(test_kill);
+
+  clear_dir();
+  rmdir(dir);
+
+  return TEST_EXIT();
+}
@@ -0,0 +1,323 @@
+/**
+ * Client cache tests: writes through the cache are seen right away,
+ * and changes made to the database behind the back of the cache, as
+ * by the Slurm plugins, are seen once their notification arrives.
+ * Hit, miss and invalidation counters are checked along the way.
+ */
+#include <abt.h>
+
+#include "clcache.h"
+#include "tests.h"
+#include "testdb.h"
+
+/* time given to a notification to invalidate the cache */
+#define NOTIFY_TIMEOUT_MS 5000
+
+#define NODES "n0,n1"
+
+static const char          *dbaddr;
+static struct clcache      *cache;
+static struct icdb_context *icdb;       /* used by the cache on misses */
+static struct icdb_context *other;      /* another writer */
+
+
+static int
+setclient(const char *clid, const char *type, uint32_t jobid)
+{
+  return clcache_setclient(cache, icdb, clid, type, "ofi+tcp://test", NODES,
+                           0, jobid, 4, NODES, 1);
+}
+
+
+static struct clcache_stats
+stats(void)
+{
+  struct clcache_stats s;
+
+  clcache_stats(cache, &s);
+  return s;
+}
+
+
+/* read CLID through the cache until its address is ADDR, or it is
+   gone if ADDR is NULL */
+static int
+wait_client(const char *clid, const char *addr)
+{
+  struct icdb_client client;
+
+  for (unsigned waited = 0; waited < NOTIFY_TIMEOUT_MS; waited++) {
+    int rc = clcache_getclient(cache, icdb, clid, &client);
+    if (!addr && rc == ICDB_NORESULT)
+      return 0;
+    if (rc == ICDB_SUCCESS) {
+      free(client.nodelist);
+      if (addr && !strcmp(client.addr, addr))
+        return 0;
+    }
+    test_sleep_ms(1);
+  }
+  return -1;
+}
+
+
+/* read the clients of JOBID (or of TYPE) through the cache until there
+   are COUNT of them */
+static int
+wait_clients(uint32_t jobid, const char *type, size_t count)
+{
+  struct icdb_client *clients = NULL;
+  size_t size = 0, n = 0;
+  int rc = -1;
+
+  for (unsigned waited = 0; waited < NOTIFY_TIMEOUT_MS; waited++) {
+    if (clcache_getclients(cache, icdb, jobid, type, &clients, &size, &n)
+        == ICDB_SUCCESS && n == count) {
+      rc = 0;
+      break;
+    }
+    test_sleep_ms(1);
+  }
+  free(clients);
+  return rc;
+}
+
+
+/* the cache only serves reads once subscribed to notifications */
+static void
+wait_live(void)
+{
+  struct icdb_client client;
+
+  TEST_ASSERT(setclient("live", "test", 99) == ICDB_SUCCESS);
+  for (unsigned waited = 0; waited < NOTIFY_TIMEOUT_MS; waited++) {
+    uint64_t hits = stats().hits;
+    TEST_ASSERT(clcache_getclient(cache, icdb, "live", &client) == ICDB_SUCCESS);
+    free(client.nodelist);
+    TEST_ASSERT(clcache_getclient(cache, icdb, "live", &client) == ICDB_SUCCESS);
+    free(client.nodelist);
+    if (stats().hits > hits)
+      return;
+    test_sleep_ms(1);
+  }
+  TEST_ASSERT(!"cache never received notifications");
+}
+
+
+static void
+test_hits(void)
+{
+  struct icdb_client client;
+  struct icdb_client *clients = NULL;
+  struct icdb_job job;
+  size_t size = 0, n;
+
+  TEST_ASSERT(setclient("a", "alert", 1) == ICDB_SUCCESS);
+  TEST_ASSERT(setclient("b", "alert", 1) == ICDB_SUCCESS);
+  TEST_ASSERT(setclient("c", "flexmpi", 2) == ICDB_SUCCESS);
+
+  /* a first read misses, until the client is stable, then it hits:
+     its own creation notification may arrive after the first read */
+  TEST_CHECK(wait_client("a", "ofi+tcp://test") == 0);
+  struct clcache_stats s0 = stats();
+  for (int i = 0; i < 10; i++) {
+    TEST_CHECK(clcache_getclient(cache, icdb, "a", &client) == ICDB_SUCCESS);
+    TEST_CHECK_STR(client.type, "alert");
+    TEST_CHECK_INT(client.jobid, 1);
+    TEST_CHECK_STR(client.nodelist, NODES);
+    free(client.nodelist);
+  }
+  struct clcache_stats s1 = stats();
+  TEST_CHECK(s1.hits - s0.hits >= 9);
+  TEST_CHECK(s1.misses - s0.misses <= 1);
+
+  TEST_CHECK(wait_clients(1, NULL, 2) == 0);
+  TEST_CHECK(wait_clients(0, "alert", 2) == 0);
+  TEST_CHECK(wait_clients(0, NULL, 4) == 0);    /* with "live" */
+
+  /* type filter applied to a cached job list */
+  TEST_CHECK(clcache_getclients(cache, icdb, 2, "alert", &clients, &size, &n)
+             == ICDB_SUCCESS);
+  TEST_CHECK_INT(n, 0);
+  TEST_CHECK(clcache_getclients(cache, icdb, 2, "flexmpi", &clients, &size, &n)
+             == ICDB_SUCCESS);
+  TEST_CHECK_INT(n, 1);
+  free(clients);
+
+  struct icdb_job *j = &job;
+  icdb_job_init(&job);
+  TEST_CHECK(clcache_getjob(cache, icdb, 1, &job) == ICDB_SUCCESS);
+  TEST_CHECK_INT(job.nnodes, 2);
+  TEST_CHECK_STR(job.nodelist, NODES);
+  icdb_job_free(&j);
+}
+
+
+/* the nodelist of a client outlives the reads that follow, hits or
+   misses on the same context */
+static void
+test_nodelists(void)
+{
+  struct icdb_client a, f, g;
+  uint32_t jobid;
+
+  /* unknown to the cache, read into the context arena on a miss */
+  TEST_ASSERT(icdb_setclient(other, "f", "alert", "ofi+tcp://other", "n2,n3",
+                             0, 3, 4, "n2,n3", 1) == ICDB_SUCCESS);
+  TEST_ASSERT(icdb_setclient(other, "g", "alert", "ofi+tcp://other", "n4,n5",
+                             0, 3, 4, "n4,n5", 1) == ICDB_SUCCESS);
+
+  TEST_ASSERT(clcache_getclient(cache, icdb, "a", &a) == ICDB_SUCCESS);
+  TEST_ASSERT(clcache_getclient(cache, icdb, "f", &f) == ICDB_SUCCESS);
+  TEST_ASSERT(clcache_getclient(cache, icdb, "g", &g) == ICDB_SUCCESS);
+  TEST_CHECK_STR(a.nodelist, NODES);
+  TEST_CHECK_STR(f.nodelist, "n2,n3");
+  TEST_CHECK_STR(g.nodelist, "n4,n5");
+  free(a.nodelist);
+  free(f.nodelist);
+  free(g.nodelist);
+
+  /* lists come without them */
+  TEST_CHECK(wait_clients(3, NULL, 2) == 0);
+  TEST_CHECK(clcache_getclient(cache, icdb, "f", &f) == ICDB_SUCCESS);
+  TEST_CHECK_STR(f.nodelist, "n2,n3");
+  free(f.nodelist);
+
+  TEST_CHECK(clcache_delclient(cache, icdb, "f", &jobid) == ICDB_SUCCESS);
+  TEST_CHECK(clcache_delclient(cache, icdb, "g", &jobid) == ICDB_SUCCESS);
+}
+
+
+static void
+test_write_through(void)
+{
+  struct icdb_client client;
+  struct icdb_client *clients = NULL;
+  size_t size = 0, n;
+  uint32_t jobid;
+
+  /* the cache is up to date right after its own writes */
+  TEST_ASSERT(setclient("d", "alert", 1) == ICDB_SUCCESS);
+  TEST_CHECK(clcache_getclient(cache, icdb, "d", &client) == ICDB_SUCCESS);
+  free(client.nodelist);
+  TEST_CHECK(clcache_getclients(cache, icdb, 1, NULL, &clients, &size, &n)
+             == ICDB_SUCCESS);
+  TEST_CHECK_INT(n, 3);
+
+  TEST_CHECK(clcache_delclient(cache, icdb, "d", &jobid) == ICDB_SUCCESS);
+  TEST_CHECK_INT(jobid, 1);
+  TEST_CHECK_INT(clcache_getclient(cache, icdb, "d", &client), ICDB_NORESULT);
+  TEST_CHECK(clcache_getclients(cache, icdb, 1, NULL, &clients, &size, &n)
+             == ICDB_SUCCESS);
+  TEST_CHECK_INT(n, 2);
+
+  /* a new address for a known client */
+  TEST_CHECK(clcache_setclient(cache, icdb, "a", "alert", "ofi+tcp://new", NODES,
+                               0, 1, 4, NODES, 1) == ICDB_SUCCESS);
+  TEST_CHECK(clcache_getclient(cache, icdb, "a", &client) == ICDB_SUCCESS);
+  TEST_CHECK_STR(client.addr, "ofi+tcp://new");
+  free(client.nodelist);
+
+  free(clients);
+}
+
+
+static void
+test_behind_back(void)
+{
+  struct icdb_job job, *j = &job;
+  uint64_t invalidations = stats().invalidations;
+
+  /* a field changed by another process */
+  TEST_ASSERT(testdb_command("HSET client:a addr %s", "ofi+tcp://moved") == 0);
+  TEST_CHECK(wait_client("a", "ofi+tcp://moved") == 0);
+  TEST_CHECK(stats().invalidations > invalidations);
+
+  /* a client registered by another server */
+  TEST_ASSERT(icdb_setclient(other, "e", "alert", "ofi+tcp://other", NODES,
+                             0, 1, 4, NODES, 1) == ICDB_SUCCESS);
+  TEST_CHECK(wait_client("e", "ofi+tcp://other") == 0);
+  TEST_CHECK(wait_clients(1, NULL, 3) == 0);
+  TEST_CHECK(wait_clients(0, "alert", 3) == 0);
+
+  /* a client removed by another server */
+  uint32_t jobid;
+  TEST_ASSERT(icdb_delclient(other, "b", &jobid) == ICDB_SUCCESS);
+  TEST_CHECK(wait_client("b", NULL) == 0);
+  TEST_CHECK(wait_clients(1, NULL, 2) == 0);
+  TEST_CHECK(wait_clients(0, "alert", 2) == 0);
+
+  /* a job record rewritten by hand */
+  TEST_ASSERT(testdb_command("HSET job:1 nnodes 5") == 0);
+  int seen = 0;
+  for (unsigned waited = 0; !seen && waited < NOTIFY_TIMEOUT_MS; waited++) {
+    icdb_job_init(&job);
+    if (clcache_getjob(cache, icdb, 1, &job) == ICDB_SUCCESS) {
+      seen = job.nnodes == 5;
+      icdb_job_free(&j);
+    }
+    test_sleep_ms(1);
+  }
+  TEST_CHECK(seen);
+
+  /* a whole job removed, as by the job cleaner */
+  TEST_ASSERT(icdb_deljob(other, 2) == ICDB_SUCCESS);
+  TEST_CHECK(wait_client("c", NULL) == 0);
+  TEST_CHECK(wait_clients(2, NULL, 0) == 0);
+}
+
+
+/* once settled, every read through the cache matches the database */
+static void
+test_consistent(void)
+{
+  struct icdb_client *clients = NULL;
+  size_t size = 0, n;
+  struct icdb_client c1, c2;
+
+  test_sleep_ms(100);
+  TEST_ASSERT(clcache_getclients(cache, icdb, 0, NULL, &clients, &size, &n)
+              == ICDB_SUCCESS);
+  for (size_t i = 0; i < n; i++) {
+    TEST_CHECK(clcache_getclient(cache, icdb, clients[i].clid, &c1) == ICDB_SUCCESS);
+    TEST_CHECK(icdb_getclient(other, clients[i].clid, &c2) == ICDB_SUCCESS);
+    TEST_CHECK_STR(c1.addr, c2.addr);
+    TEST_CHECK_STR(c1.type, c2.type);
+    TEST_CHECK_INT(c1.jobid, c2.jobid);
+    TEST_CHECK_INT(c1.nprocs, c2.nprocs);
+    TEST_CHECK_STR(c1.nodelist, c2.nodelist);
+    free(c1.nodelist);
+  }
+  TEST_CHECK_INT(n, 3);         /* live, a and e */
+  free(clients);
+}
+
+
+int
+main(void)
+{
+  dbaddr = testdb_start();
+  if (!dbaddr)
+    return TEST_SKIP;
+
+  ABT_init(0, NULL);
+
+  TEST_ASSERT(icdb_init(&icdb, (char *)dbaddr) == ICDB_SUCCESS);
+  TEST_ASSERT(icdb_init(&other, (char *)dbaddr) == ICDB_SUCCESS);
+  TEST_ASSERT(clcache_init(&cache, MARGO_INSTANCE_NULL, (char *)dbaddr) == 0);
+  wait_live();
+
+  TEST_RUN(test_hits);
+  TEST_RUN(test_nodelists);
+  TEST_RUN(test_write_through);
+  TEST_RUN(test_behind_back);
+  TEST_RUN(test_consistent);
+
+  clcache_fini(&cache);
+  icdb_fini(&other);
+  icdb_fini(&icdb);
+  ABT_finalize();
+  testdb_stop();
+
+  return TEST_EXIT();
+}
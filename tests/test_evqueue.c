@@ -0,0 +1,309 @@
+/**
+ * Event queue tests: order and blocking pop, each coalescing mode,
+ * every client of coalesced registrations handed over in push order,
+ * both backpressure policies, close, and the counters. Concurrent
+ * pushes from several execution streams against one consumer lose no
+ * client.
+ *
+ * Usage: test_evqueue [NEVENTS]
+ */
+#include <margo.h>
+
+#include "evqueue.h"
+#include "tests.h"
+
+static size_t nevents;
+
+
+static struct evq_event
+event(enum icc_rpc_code code, uint32_t jobid, const char *clid, int32_t arg)
+{
+  struct evq_event ev = { .code = code, .jobid = jobid, .args = { arg, 0, 0 } };
+  strncpy(ev.clid, clid, UUID_STR_LEN - 1);
+  return ev;
+}
+
+
+static void
+test_order(void)
+{
+  struct evqueue *q;
+  struct evq_event ev;
+  struct evqueue_stats s;
+
+  TEST_ASSERT(evqueue_init(&q, MARGO_INSTANCE_NULL, "test_order", 0, EVQ_DROP_NEWEST) == 0);
+
+  for (int i = 0; i < 10; i++) {
+    ev = event(RPC_CLIENT_REGISTER, i, "a", i);
+    TEST_CHECK_INT(evqueue_push(q, &ev, EVQ_COALESCE_NONE), 0);
+  }
+  for (int i = 0; i < 10; i++) {
+    TEST_ASSERT(evqueue_pop(q, &ev) == 0);
+    TEST_CHECK_INT(ev.jobid, i);
+    TEST_CHECK_INT(ev.args[0], i);
+    TEST_CHECK_INT(ev.count, 1);
+    TEST_CHECK(ev.clids == NULL);
+    TEST_CHECK_STR(evqueue_event_clid(&ev, 0), "a");
+  }
+
+  evqueue_stats(q, &s);
+  TEST_CHECK_INT(s.pushed, 10);
+  TEST_CHECK_INT(s.popped, 10);
+  TEST_CHECK_INT(s.maxdepth, 10);
+  TEST_CHECK_INT(s.coalesced, 0);
+  evqueue_fini(&q);
+  TEST_CHECK(q == NULL);
+}
+
+
+static void
+test_coalesce(void)
+{
+  struct evqueue *q;
+  struct evq_event ev;
+  char clid[UUID_STR_LEN];
+
+  TEST_ASSERT(evqueue_init(&q, MARGO_INSTANCE_NULL, "test_coalesce", 0, EVQ_DROP_NEWEST) == 0);
+
+  /* registrations of two jobs, interleaved */
+  for (int i = 0; i < 100; i++) {
+    snprintf(clid, sizeof(clid), "client%d", i);
+    ev = event(RPC_CLIENT_REGISTER, i % 2, clid, i);
+    TEST_CHECK_INT(evqueue_push(q, &ev, EVQ_COALESCE_JOB), i < 2 ? 0 : 1);
+  }
+  /* not with another code */
+  ev = event(RPC_CLIENT_DEREGISTER, 0, "client0", 0);
+  TEST_CHECK_INT(evqueue_push(q, &ev, EVQ_COALESCE_JOB), 0);
+
+  for (uint32_t job = 0; job < 2; job++) {
+    TEST_ASSERT(evqueue_pop(q, &ev) == 0);
+    TEST_CHECK_INT(ev.code, RPC_CLIENT_REGISTER);
+    TEST_CHECK_INT(ev.jobid, job);
+    TEST_CHECK_INT(ev.count, 50);
+    TEST_CHECK_INT(ev.args[0], 98 + job);
+    TEST_CHECK_STR(ev.clid, job ? "client1" : "client0");
+    for (uint32_t i = 0; i < ev.count; i++) {
+      snprintf(clid, sizeof(clid), "client%u", 2 * i + job);
+      TEST_CHECK_STR(evqueue_event_clid(&ev, i), clid);
+    }
+    evqueue_event_free(&ev);
+    TEST_CHECK(ev.clids == NULL);
+  }
+  TEST_ASSERT(evqueue_pop(q, &ev) == 0);
+  TEST_CHECK_INT(ev.code, RPC_CLIENT_DEREGISTER);
+  TEST_CHECK_INT(ev.count, 1);
+
+  /* region changes, per client, keep their place and the latest
+     arguments */
+  ev = event(RPC_MALLEABILITY_REGION, 1, "a", 1);
+  TEST_CHECK_INT(evqueue_push(q, &ev, EVQ_COALESCE_CLIENT), 0);
+  ev = event(RPC_MALLEABILITY_REGION, 1, "b", 2);
+  TEST_CHECK_INT(evqueue_push(q, &ev, EVQ_COALESCE_CLIENT), 0);
+  ev = event(RPC_MALLEABILITY_REGION, 1, "a", 3);
+  TEST_CHECK_INT(evqueue_push(q, &ev, EVQ_COALESCE_CLIENT), 1);
+  ev = event(RPC_MALLEABILITY_REGION, 1, "a", 4);
+  TEST_CHECK_INT(evqueue_push(q, &ev, EVQ_COALESCE_NONE), 0);
+
+  TEST_ASSERT(evqueue_pop(q, &ev) == 0);
+  TEST_CHECK_STR(ev.clid, "a");
+  TEST_CHECK_INT(ev.args[0], 3);
+  TEST_CHECK_INT(ev.count, 2);
+  TEST_CHECK(ev.clids == NULL);
+  TEST_ASSERT(evqueue_pop(q, &ev) == 0);
+  TEST_CHECK_STR(ev.clid, "b");
+  TEST_ASSERT(evqueue_pop(q, &ev) == 0);
+  TEST_CHECK_INT(ev.args[0], 4);
+
+  /* pending lists are freed with the queue */
+  for (int i = 0; i < 10; i++) {
+    ev = event(RPC_CLIENT_REGISTER, 7, "x", i);
+    evqueue_push(q, &ev, EVQ_COALESCE_JOB);
+  }
+  evqueue_fini(&q);
+}
+
+
+static void
+test_full(void)
+{
+  struct evqueue *q;
+  struct evq_event ev;
+  struct evqueue_stats s;
+
+  TEST_ASSERT(evqueue_init(&q, MARGO_INSTANCE_NULL, "test_newest", 4, EVQ_DROP_NEWEST) == 0);
+  for (int i = 0; i < 6; i++) {
+    ev = event(RPC_CLIENT_REGISTER, i, "a", i);
+    TEST_CHECK_INT(evqueue_push(q, &ev, EVQ_COALESCE_JOB), i < 4 ? 0 : -1);
+  }
+  /* coalescing needs no room */
+  ev = event(RPC_CLIENT_REGISTER, 3, "b", 0);
+  TEST_CHECK_INT(evqueue_push(q, &ev, EVQ_COALESCE_JOB), 1);
+  for (uint32_t i = 0; i < 4; i++) {
+    TEST_ASSERT(evqueue_pop(q, &ev) == 0);
+    TEST_CHECK_INT(ev.jobid, i);
+    evqueue_event_free(&ev);
+  }
+  evqueue_stats(q, &s);
+  TEST_CHECK_INT(s.dropped, 2);
+  TEST_CHECK_INT(s.coalesced, 1);
+  TEST_CHECK_INT(s.maxdepth, 4);
+  evqueue_fini(&q);
+
+  TEST_ASSERT(evqueue_init(&q, MARGO_INSTANCE_NULL, "test_oldest", 4, EVQ_DROP_OLDEST) == 0);
+  for (int i = 0; i < 6; i++) {
+    ev = event(RPC_CLIENT_REGISTER, i, "a", i);
+    evqueue_push(q, &ev, EVQ_COALESCE_NONE);
+    /* dropping an event frees its clients */
+    evqueue_push(q, &ev, EVQ_COALESCE_JOB);
+  }
+  for (uint32_t i = 2; i < 6; i++) {
+    TEST_ASSERT(evqueue_pop(q, &ev) == 0);
+    TEST_CHECK_INT(ev.jobid, i);
+    TEST_CHECK_INT(ev.count, 2);
+    evqueue_event_free(&ev);
+  }
+  evqueue_stats(q, &s);
+  TEST_CHECK_INT(s.dropped, 2);
+  evqueue_fini(&q);
+}
+
+
+/* what the execution streams of a test do */
+struct worker_arg {
+  size_t  id;
+  int     close;                /* close the queue rather than push */
+  int     rc;                   /* of the pop */
+  uint8_t *seen;                /* clients popped */
+};
+
+static struct evqueue *shared;
+
+
+/* the first worker pops, the second pushes or closes a little later */
+static void
+close_worker(void *arg)
+{
+  struct worker_arg *w = (struct worker_arg *)arg;
+  struct evq_event ev;
+
+  if (w->id == 0) {
+    w->rc = evqueue_pop(shared, &ev);
+    TEST_CHECK(w->rc == -1 || ev.jobid == 5);
+    return;
+  }
+
+  test_sleep_ms(20);
+  if (w->close) {
+    evqueue_close(shared);
+  } else {
+    ev = event(RPC_CLIENT_REGISTER, 5, "a", 0);
+    TEST_CHECK_INT(evqueue_push(shared, &ev, EVQ_COALESCE_NONE), 0);
+  }
+}
+
+
+static void
+test_close(void)
+{
+  struct worker_arg args[2] = { { .id = 0, .rc = 1 }, { .id = 1 } };
+  struct evq_event ev = event(RPC_CLIENT_REGISTER, 5, "a", 0);
+
+  TEST_ASSERT(evqueue_init(&shared, MARGO_INSTANCE_NULL, "test_close", 0, EVQ_DROP_NEWEST) == 0);
+
+  /* a pop waits for the push */
+  TEST_ASSERT(test_xstreams_run(2, close_worker, args, sizeof(args[0])) == 0);
+  TEST_CHECK_INT(args[0].rc, 0);
+
+  /* and for the close */
+  args[0].rc = 1;
+  args[1].close = 1;
+  TEST_ASSERT(test_xstreams_run(2, close_worker, args, sizeof(args[0])) == 0);
+  TEST_CHECK_INT(args[0].rc, -1);
+
+  TEST_CHECK_INT(evqueue_push(shared, &ev, EVQ_COALESCE_NONE), -1);
+  TEST_CHECK_INT(evqueue_pop(shared, &ev), -1);
+
+  evqueue_fini(&shared);
+  evqueue_close(NULL);
+  evqueue_fini(NULL);
+}
+
+
+/* the first 8 workers register NEVENTS clients each over 4 jobs, the
+   last pops them all */
+static void
+register_worker(void *arg)
+{
+  struct worker_arg *w = (struct worker_arg *)arg;
+  char clid[UUID_STR_LEN];
+  struct evq_event ev;
+
+  if (w->id < 8) {
+    for (size_t i = 0; i < nevents; i++) {
+      snprintf(clid, sizeof(clid), "%zu-%zu", w->id, i);
+      ev = event(RPC_CLIENT_REGISTER, i % 4, clid, 0);
+      TEST_CHECK(evqueue_push(shared, &ev, EVQ_COALESCE_JOB) >= 0);
+    }
+    return;
+  }
+
+  for (size_t n = 0; n < 8 * nevents && evqueue_pop(shared, &ev) == 0; n += ev.count) {
+    for (uint32_t i = 0; i < ev.count; i++) {
+      size_t id, j;
+      TEST_ASSERT(sscanf(evqueue_event_clid(&ev, i), "%zu-%zu", &id, &j) == 2);
+      TEST_ASSERT(id < 8 && j < nevents);
+      TEST_CHECK_INT(j % 4, ev.jobid);
+      w->seen[id * nevents + j]++;
+    }
+    evqueue_event_free(&ev);
+  }
+}
+
+
+static void
+test_concurrent(void)
+{
+  struct worker_arg args[9];
+  struct evqueue_stats s;
+
+  uint8_t *seen = calloc(8 * nevents, 1);
+  TEST_ASSERT(seen);
+  for (size_t i = 0; i < 9; i++)
+    args[i] = (struct worker_arg){ .id = i, .seen = seen };
+
+  /* room for every job, nothing is dropped */
+  TEST_ASSERT(evqueue_init(&shared, MARGO_INSTANCE_NULL, "test_concurrent", 4,
+                           EVQ_DROP_NEWEST) == 0);
+  TEST_ASSERT(test_xstreams_run(9, register_worker, args, sizeof(args[0])) == 0);
+
+  size_t nmissed = 0;
+  for (size_t i = 0; i < 8 * nevents; i++)
+    nmissed += seen[i] != 1;
+  TEST_CHECK_INT(nmissed, 0);
+
+  evqueue_stats(shared, &s);
+  TEST_CHECK_INT(s.pushed, 8 * nevents);
+  TEST_CHECK_INT(s.dropped, 0);
+  TEST_CHECK_INT(s.popped + s.coalesced, s.pushed);
+  evqueue_fini(&shared);
+  free(seen);
+}
+
+
+int
+main(int argc, char **argv)
+{
+  nevents = test_size_arg(argc, argv, 1, 10000);
+
+  ABT_init(0, NULL);
+
+  TEST_RUN(test_order);
+  TEST_RUN(test_coalesce);
+  TEST_RUN(test_full);
+  TEST_RUN(test_close);
+  TEST_RUN(test_concurrent);
+
+  ABT_finalize();
+
+  return TEST_EXIT();
+}
@@ -0,0 +1,290 @@
+/**
+ * Hashmap tests: random insertions, updates and deletions checked
+ * against a plain array, with short and long keys and small and large
+ * values so that both the inline and the allocated storage are used.
+ * Deletions shift items back, so every remaining key is looked up
+ * again after each round. Iteration, hm_keys, hm_reserve and the
+ * string tables are checked too.
+ *
+ * Usage: test_hashmap [NOPS [SEED]]
+ */
+#include "hashmap.h"
+#include "tests.h"
+
+#define NKEYS 4096
+
+/* the current value of a key, of random size */
+struct value {
+  size_t   size;
+  unsigned char data[64];
+};
+
+static char         *keys[NKEYS];
+static struct value  values[NKEYS];
+static int           present[NKEYS];
+static size_t        npresent;
+static size_t        nops;
+
+static uint64_t seed = 0x2545f4914f6cdd1dULL;
+
+
+static uint64_t
+rnd(void)
+{
+  seed ^= seed >> 12;
+  seed ^= seed << 25;
+  seed ^= seed >> 27;
+  return seed * 2685821657736338717ULL;
+}
+
+
+static void
+make_keys(void)
+{
+  for (size_t i = 0; i < NKEYS; i++) {
+    /* a third of them too long to be inline */
+    char key[64];
+    if (i % 3)
+      snprintf(key, sizeof(key), "n%zu", i);
+    else
+      snprintf(key, sizeof(key), "a-rather-long-hostname-%zu.cluster.local", i);
+    keys[i] = strdup(key);
+    TEST_ASSERT(keys[i]);
+  }
+}
+
+
+static void
+make_value(struct value *v)
+{
+  /* 1 to 64 bytes, inline up to 16 */
+  v->size = 1 + rnd() % sizeof(v->data);
+  for (size_t j = 0; j < v->size; j++)
+    v->data[j] = rnd();
+}
+
+
+/* every key is found with its value, or absent */
+static void
+check_all(hm_t *map)
+{
+  TEST_CHECK_INT(hm_length(map), npresent);
+  for (size_t i = 0; i < NKEYS; i++) {
+    const void *v = hm_get(map, keys[i]);
+    if (present[i]) {
+      TEST_ASSERT(v);
+      TEST_CHECK(!memcmp(v, values[i].data, values[i].size));
+    } else {
+      TEST_CHECK(v == NULL);
+    }
+  }
+}
+
+
+static void
+test_random(void)
+{
+  hm_t *map = hm_create();
+  TEST_ASSERT(map);
+
+  for (size_t op = 0; op < nops; op++) {
+    size_t i = rnd() % NKEYS;
+    if (rnd() % 3) {
+      make_value(&values[i]);
+      int rc = hm_set(map, keys[i], values[i].data, values[i].size);
+      TEST_CHECK_INT(rc, !present[i]);
+      npresent += !present[i];
+      present[i] = 1;
+    } else {
+      TEST_CHECK_INT(hm_del(map, keys[i]), present[i]);
+      npresent -= present[i];
+      present[i] = 0;
+    }
+    if (op % 1000 == 0)
+      check_all(map);
+  }
+  check_all(map);
+
+  /* empty it, then fill it again */
+  for (size_t i = 0; i < NKEYS; i++) {
+    TEST_CHECK_INT(hm_del(map, keys[i]), present[i]);
+    present[i] = 0;
+  }
+  npresent = 0;
+  check_all(map);
+  for (size_t i = 0; i < NKEYS; i++) {
+    make_value(&values[i]);
+    TEST_CHECK_INT(hm_set(map, keys[i], values[i].data, values[i].size), 1);
+    present[i] = 1;
+  }
+  npresent = NKEYS;
+  check_all(map);
+
+  hm_free(map);
+}
+
+
+/* hm_next and hm_keys see each item once */
+static void
+test_iterate(void)
+{
+  hm_t *map = hm_create();
+  static unsigned char seen[NKEYS];
+  const char *key;
+  const void *value;
+  size_t n = 0;
+
+  TEST_ASSERT(map);
+  memset(seen, 0, sizeof(seen));
+
+  /* with holes left by deletions */
+  for (size_t i = 0; i < NKEYS; i++)
+    TEST_ASSERT(hm_set(map, keys[i], &i, sizeof(i)) == 1);
+  for (size_t i = 0; i < NKEYS; i += 3)
+    TEST_ASSERT(hm_del(map, keys[i]) == 1);
+
+  size_t cursor = 0;
+  do {
+    cursor = hm_next(map, cursor, &key, &value);
+    if (cursor) {
+      size_t i;
+      memcpy(&i, value, sizeof(i));
+      TEST_ASSERT(i < NKEYS);
+      TEST_CHECK_STR(key, keys[i]);
+      TEST_CHECK(i % 3 != 0);
+      seen[i]++;
+      n++;
+    }
+  } while (cursor);
+  TEST_CHECK_INT(n, hm_length(map));
+  for (size_t i = 0; i < NKEYS; i++)
+    TEST_CHECK_INT(seen[i], i % 3 != 0);
+
+  const char **all = malloc(n * sizeof(*all));
+  TEST_ASSERT(all);
+  TEST_CHECK_INT(hm_keys(map, all, n), n);
+  for (size_t i = 0; i < n; i++) {
+    const void *v = hm_get(map, all[i]);
+    TEST_CHECK(v != NULL);
+  }
+  /* a short array gets the first keys only */
+  const char *few[4] = { 0 };
+  TEST_CHECK_INT(hm_keys(map, few, 2), n);
+  TEST_CHECK(few[0] && few[1] && !few[2]);
+  TEST_CHECK_INT(hm_keys(map, NULL, 0), n);
+  free(all);
+
+  hm_free(map);
+}
+
+
+static void
+test_update(void)
+{
+  hm_t *map = hm_create();
+  unsigned char big[100];
+  uint16_t port = 4242;
+
+  TEST_ASSERT(map);
+  TEST_CHECK_INT(hm_set(map, "n1", &port, sizeof(port)), 1);
+  TEST_CHECK_INT(*(uint16_t *)hm_get(map, "n1"), 4242);
+
+  /* inline to allocated and back */
+  memset(big, 7, sizeof(big));
+  TEST_CHECK_INT(hm_set(map, "n1", big, sizeof(big)), 0);
+  TEST_CHECK(!memcmp(hm_get(map, "n1"), big, sizeof(big)));
+  port = 1;
+  TEST_CHECK_INT(hm_set(map, "n1", &port, sizeof(port)), 0);
+  TEST_CHECK_INT(*(uint16_t *)hm_get(map, "n1"), 1);
+  TEST_CHECK_INT(hm_length(map), 1);
+
+  TEST_CHECK_INT(hm_set(map, "n2", NULL, 0), -1);
+  TEST_CHECK_INT(hm_del(map, "n2"), 0);
+  TEST_CHECK(hm_get(map, "") == NULL);
+  TEST_CHECK_INT(hm_set(map, "", &port, sizeof(port)), 1);
+  TEST_CHECK(hm_get(map, "") != NULL);
+
+  hm_free(map);
+}
+
+
+static void
+test_reserve(void)
+{
+  hm_t *map = hm_create();
+
+  TEST_ASSERT(map);
+  TEST_CHECK_INT(hm_reserve(map, 3 * NKEYS), 0);
+  for (size_t i = 0; i < NKEYS; i++)
+    TEST_ASSERT(hm_set(map, keys[i], &i, sizeof(i)) == 1);
+  TEST_CHECK_INT(hm_reserve(map, 10), 0);       /* never shrinks */
+  for (size_t i = 0; i < NKEYS; i++) {
+    const size_t *v = hm_get(map, keys[i]);
+    TEST_CHECK(v && *v == i);
+  }
+  hm_free(map);
+}
+
+
+static void
+test_strings(void)
+{
+  hm_t *strings = hm_create_strings();
+  TEST_ASSERT(strings);
+
+  const char *a = hm_intern(strings, keys[0]);
+  TEST_CHECK_STR(a, keys[0]);
+  TEST_CHECK(a != keys[0]);
+
+  /* interned keys never move, whatever the table grows to */
+  for (size_t i = 1; i < NKEYS; i++)
+    TEST_ASSERT(hm_intern(strings, keys[i]));
+  TEST_CHECK(hm_intern(strings, keys[0]) == a);
+
+  hm_t *m1 = hm_create_interned(strings);
+  hm_t *m2 = hm_create_interned(strings);
+  TEST_ASSERT(m1 && m2);
+  int one = 1, two = 2;
+  for (size_t i = 0; i < NKEYS; i++) {
+    TEST_ASSERT(hm_set(m1, keys[i], &one, sizeof(one)) == 1);
+    TEST_ASSERT(hm_set(m2, keys[i], &two, sizeof(two)) == 1);
+  }
+  for (size_t i = 0; i < NKEYS; i += 2)
+    TEST_ASSERT(hm_del(m1, keys[i]) == 1);
+
+  /* both maps point to the table copy of their keys */
+  const char *k1 = NULL, *k2 = NULL;
+  for (size_t c = 0; (c = hm_next(m1, c, &k1, NULL)) && strcmp(k1, keys[1]); )
+    ;
+  for (size_t c = 0; (c = hm_next(m2, c, &k2, NULL)) && strcmp(k2, keys[1]); )
+    ;
+  TEST_CHECK(k1 && k1 == k2 && k1 == hm_intern(strings, keys[1]));
+  TEST_CHECK_INT(hm_length(m1), NKEYS / 2);
+  TEST_CHECK(hm_get(m1, keys[0]) == NULL);
+  TEST_CHECK_INT(*(int *)hm_get(m2, keys[0]), 2);
+
+  hm_free(m1);
+  hm_free(m2);
+  hm_free(strings);
+}
+
+
+int
+main(int argc, char **argv)
+{
+  nops = test_size_arg(argc, argv, 1, 100000);
+  seed ^= test_size_arg(argc, argv, 2, 0);
+
+  make_keys();
+
+  TEST_RUN(test_random);
+  TEST_RUN(test_iterate);
+  TEST_RUN(test_update);
+  TEST_RUN(test_reserve);
+  TEST_RUN(test_strings);
+
+  for (size_t i = 0; i < NKEYS; i++)
+    free(keys[i]);
+
+  return TEST_EXIT();
+}
@@ -0,0 +1,370 @@
+/**
+ * Hashmap snapshot tests: a map saved and loaded back has the same
+ * items, is queried in place and copied on its first modification.
+ * Damaged snapshots, truncated, with flipped bits or with consistent
+ * checksums but impossible contents, are rejected with an error code.
+ *
+ * Usage: test_hmsnap [NITEMS]
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "crc32c.h"
+#include "hashmap.h"
+#include "tests.h"
+
+/* header fields forged below, see the snapshot format in hashmap.c */
+#define SNAP_VERSION_OFF   8
+#define SNAP_NSLOTS_OFF    32
+#define SNAP_NITEMS_OFF    40
+#define SNAP_DATASIZE_OFF  48
+#define SNAP_HEADERCRC_OFF 64
+#define SNAP_HEADER_LEN    72
+#define SNAP_SLOTS         128
+
+static char   dir[] = "/tmp/test_hmsnapXXXXXX";
+static char   path[64];
+static size_t nitems;
+
+
+static void
+key_of(size_t i, char *key, size_t size)
+{
+  /* short and long keys, inline or not in the snapshot slots */
+  if (i % 2)
+    snprintf(key, size, "n%zu", i);
+  else
+    snprintf(key, size, "host-with-a-long-name-%zu.cluster.local", i);
+}
+
+
+/* value of I: small ones inline, one in 3 out of line */
+static size_t
+value_of(size_t i, unsigned char *value)
+{
+  size_t size = i % 3 ? sizeof(uint16_t) : 40;
+  for (size_t j = 0; j < size; j++)
+    value[j] = (unsigned char)(i + j);
+  return size;
+}
+
+
+static hm_t *
+make_map(size_t n)
+{
+  hm_t *map = hm_create();
+  char key[64];
+  unsigned char value[64];
+
+  TEST_ASSERT(map);
+  for (size_t i = 0; i < n; i++) {
+    key_of(i, key, sizeof(key));
+    size_t size = value_of(i, value);
+    TEST_ASSERT(hm_set(map, key, value, size) == 1);
+  }
+  /* with holes */
+  for (size_t i = 0; i < n; i += 5) {
+    key_of(i, key, sizeof(key));
+    TEST_ASSERT(hm_del(map, key) == 1);
+  }
+  return map;
+}
+
+
+static void
+check_map(hm_t *map, size_t n)
+{
+  char key[64];
+  unsigned char value[64];
+  size_t count = 0;
+
+  for (size_t i = 0; i < n; i++) {
+    key_of(i, key, sizeof(key));
+    const void *v = hm_get(map, key);
+    if (i % 5 == 0) {
+      TEST_CHECK(v == NULL);
+    } else {
+      size_t size = value_of(i, value);
+      TEST_ASSERT(v);
+      TEST_CHECK(!memcmp(v, value, size));
+      count++;
+    }
+  }
+  TEST_CHECK_INT(hm_length(map), count);
+  TEST_CHECK(hm_get(map, "absent") == NULL);
+}
+
+
+static void *
+read_file(const char *name, size_t *len)
+{
+  FILE *f = fopen(name, "rb");
+  TEST_ASSERT(f);
+  TEST_ASSERT(fseek(f, 0, SEEK_END) == 0);
+  *len = ftell(f);
+  rewind(f);
+  char *buf = malloc(*len);
+  TEST_ASSERT(buf);
+  TEST_ASSERT(fread(buf, *len, 1, f) == 1);
+  fclose(f);
+  return buf;
+}
+
+
+static void
+write_file(const char *name, const void *buf, size_t len)
+{
+  FILE *f = fopen(name, "wb");
+  TEST_ASSERT(f);
+  TEST_ASSERT(len == 0 || fwrite(buf, len, 1, f) == 1);
+  TEST_ASSERT(fclose(f) == 0);
+}
+
+
+/* load BUF written out, returning the error code */
+static int
+load_buf(const void *buf, size_t len)
+{
+  char name[96];
+  hm_t *map;
+
+  snprintf(name, sizeof(name), "%s/damaged", dir);
+  write_file(name, buf, len);
+  int rc = hm_load(&map, name);
+  if (rc == HM_SUCCESS) {
+    hm_free(map);
+  } else {
+    TEST_CHECK(map == NULL);
+  }
+  return rc;
+}
+
+
+static void
+test_roundtrip(void)
+{
+  hm_t *map = make_map(nitems), *loaded;
+
+  TEST_ASSERT(hm_save(map, path) == HM_SUCCESS);
+  hm_free(map);
+
+  /* written aside and renamed */
+  char tmp[96];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  TEST_CHECK(access(tmp, F_OK) == -1 && errno == ENOENT);
+
+  TEST_ASSERT(hm_load(&loaded, path) == HM_SUCCESS);
+  check_map(loaded, nitems);
+
+  /* iteration from the mapping */
+  const char *key;
+  const void *value;
+  size_t n = 0;
+  for (size_t c = 0; (c = hm_next(loaded, c, &key, &value)); n++)
+    TEST_CHECK(hm_get(loaded, key) == value);
+  TEST_CHECK_INT(n, hm_length(loaded));
+
+  /* a loaded map saved again is the same */
+  char again[96];
+  snprintf(again, sizeof(again), "%s/again", dir);
+  TEST_CHECK(hm_save(loaded, again) == HM_SUCCESS);
+  size_t len1, len2;
+  void *b1 = read_file(path, &len1), *b2 = read_file(again, &len2);
+  TEST_CHECK(len1 == len2 && !memcmp(b1, b2, len1));
+  free(b1);
+  free(b2);
+
+  /* the first change copies it, the file is left as is */
+  uint16_t port = 1;
+  TEST_CHECK_INT(hm_set(loaded, "n1", &port, sizeof(port)), 0);
+  TEST_CHECK_INT(*(uint16_t *)hm_get(loaded, "n1"), 1);
+  TEST_CHECK_INT(hm_del(loaded, "n3"), 1);
+  TEST_CHECK_INT(hm_set(loaded, "new", &port, sizeof(port)), 1);
+  hm_free(loaded);
+
+  TEST_ASSERT(hm_load(&loaded, path) == HM_SUCCESS);
+  check_map(loaded, nitems);
+  TEST_CHECK_INT(hm_del(loaded, "n1"), 1);
+  TEST_CHECK(hm_get(loaded, "n1") == NULL);
+  hm_free(loaded);
+
+  /* an empty map */
+  map = hm_create();
+  TEST_ASSERT(map);
+  TEST_CHECK(hm_save(map, again) == HM_SUCCESS);
+  hm_free(map);
+  TEST_ASSERT(hm_load(&loaded, again) == HM_SUCCESS);
+  TEST_CHECK_INT(hm_length(loaded), 0);
+  TEST_CHECK(hm_get(loaded, "n1") == NULL);
+  hm_free(loaded);
+}
+
+
+static void
+test_missing(void)
+{
+  hm_t *map = (hm_t *)1;
+  char name[96];
+
+  snprintf(name, sizeof(name), "%s/missing", dir);
+  TEST_CHECK_INT(hm_load(&map, name), HM_EIO);
+  TEST_CHECK_INT(errno, ENOENT);
+  TEST_CHECK(map == NULL);
+
+  /* cannot write into a missing directory */
+  map = hm_create();
+  TEST_ASSERT(map);
+  snprintf(name, sizeof(name), "%s/missing/map", dir);
+  TEST_CHECK_INT(hm_save(map, name), HM_EIO);
+  hm_free(map);
+
+  TEST_CHECK_INT(load_buf("", 0), HM_EFORMAT);
+  char text[4 * SNAP_SLOTS];
+  memset(text, 'x', sizeof(text));
+  TEST_CHECK_INT(load_buf(text, sizeof(text)), HM_EFORMAT);
+}
+
+
+static void
+test_truncated(void)
+{
+  size_t len;
+  char *buf = read_file(path, &len);
+
+  /* every length short of the whole file fails */
+  for (size_t l = 0; l < len; l += l < SNAP_SLOTS + 256 ? 1 : 61) {
+    int rc = load_buf(buf, l);
+    TEST_CHECK(rc == HM_EFORMAT || rc == HM_ECORRUPT);
+  }
+  /* as does trailing garbage */
+  char *longer = malloc(len + 16);
+  TEST_ASSERT(longer);
+  memcpy(longer, buf, len);
+  memset(longer + len, 0, 16);
+  TEST_CHECK_INT(load_buf(longer, len + 16), HM_ECORRUPT);
+
+  free(longer);
+  free(buf);
+}
+
+
+static void
+test_bitflips(void)
+{
+  size_t len;
+  char *buf = read_file(path, &len);
+  uint64_t seed = 42;
+
+  for (size_t i = 0; i < 2000; i++) {
+    /* every bit of the header, random ones elsewhere */
+    size_t off, bit;
+    if (i < 8 * SNAP_HEADER_LEN) {
+      off = i / 8;
+      bit = i % 8;
+    } else {
+      seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+      off = SNAP_SLOTS + (seed >> 33) % (len - SNAP_SLOTS);
+      bit = (seed >> 20) % 8;
+    }
+
+    buf[off] ^= 1 << bit;
+    int rc = load_buf(buf, len);
+    buf[off] ^= 1 << bit;
+
+    if (off < 8)
+      TEST_CHECK_INT(rc, HM_EFORMAT);
+    else
+      TEST_CHECK(rc == HM_ECORRUPT || rc == HM_EFORMAT);
+  }
+  TEST_CHECK_INT(load_buf(buf, len), HM_SUCCESS);
+
+  free(buf);
+}
+
+
+/* set the 64-bit header field at OFF and fix the header checksum */
+static void
+forge(char *buf, size_t off, uint64_t v)
+{
+  uint32_t crc = 0;
+
+  memcpy(buf + off, &v, sizeof(v));
+  memcpy(buf + SNAP_HEADERCRC_OFF, &crc, sizeof(crc));
+  crc = crc32c(0, buf, SNAP_HEADER_LEN);
+  memcpy(buf + SNAP_HEADERCRC_OFF, &crc, sizeof(crc));
+}
+
+
+/* checksums are right, the contents are not */
+static void
+test_forged(void)
+{
+  size_t len;
+  char *buf = read_file(path, &len), *copy = malloc(len);
+  uint64_t nslots, nitems, datasize;
+
+  TEST_ASSERT(copy);
+  memcpy(&nslots, buf + SNAP_NSLOTS_OFF, sizeof(nslots));
+  memcpy(&nitems, buf + SNAP_NITEMS_OFF, sizeof(nitems));
+  memcpy(&datasize, buf + SNAP_DATASIZE_OFF, sizeof(datasize));
+
+  struct { size_t off; uint64_t v; int rc; } cases[] = {
+    { SNAP_NITEMS_OFF, nitems + 1, HM_ECORRUPT },
+    { SNAP_NITEMS_OFF, nitems - 1, HM_ECORRUPT },
+    { SNAP_NITEMS_OFF, nslots, HM_ECORRUPT },     /* no empty slot */
+    { SNAP_NSLOTS_OFF, nslots - 1, HM_ECORRUPT },
+    { SNAP_NSLOTS_OFF, nslots * 2, HM_ECORRUPT },
+    { SNAP_NSLOTS_OFF, 0, HM_ECORRUPT },
+    { SNAP_NSLOTS_OFF, UINT64_MAX / 2 + 1, HM_ECORRUPT },
+    { SNAP_DATASIZE_OFF, datasize + 16, HM_ECORRUPT },
+    { SNAP_DATASIZE_OFF, UINT64_MAX, HM_ECORRUPT },
+  };
+
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    memcpy(copy, buf, len);
+    forge(copy, cases[i].off, cases[i].v);
+    int rc = load_buf(copy, len);
+    if (rc != cases[i].rc)
+      fprintf(stderr, "forged case %zu: %s\n", i, hm_strerror(rc));
+    TEST_CHECK_INT(rc, cases[i].rc);
+  }
+
+  /* a future version, with a right checksum */
+  memcpy(copy, buf, len);
+  uint32_t version = 2;
+  memcpy(copy + SNAP_VERSION_OFF, &version, sizeof(version));
+  forge(copy, SNAP_NITEMS_OFF, nitems);
+  TEST_CHECK_INT(load_buf(copy, len), HM_EVERSION);
+
+  free(copy);
+  free(buf);
+}
+
+
+int
+main(int argc, char **argv)
+{
+  nitems = test_size_arg(argc, argv, 1, 1000);
+
+  TEST_ASSERT(mkdtemp(dir));
+  snprintf(path, sizeof(path), "%s/map", dir);
+
+  TEST_RUN(test_roundtrip);
+  TEST_RUN(test_missing);
+  TEST_RUN(test_truncated);
+  TEST_RUN(test_bitflips);
+  TEST_RUN(test_forged);
+
+  char name[96];
+  const char *files[] = { "map", "again", "damaged" };
+  for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+    snprintf(name, sizeof(name), "%s/%s", dir, files[i]);
+    unlink(name);
+  }
+  rmdir(dir);
+
+  return TEST_EXIT();
+}
@@ -0,0 +1,402 @@
+/**
+ * icdb unit tests: the client, job and node records on the
+ * test database, then the error paths on a mock server of our own,
+ * with injected error replies, garbage, dropped connections, a server
+ * crash and slow replies, and with a server that has no Redis
+ * Functions.
+ */
+#include <abt.h>
+
+#include "icdb.h"
+#include "mockredis.h"
+#include "tests.h"
+#include "testdb.h"
+
+/* time given to a context to reconnect after a fault, longer than
+   the first reconnection delays */
+#define RECONNECT_TIMEOUT_MS 5000
+
+#define NODES "n0,n1,n2,n3"
+
+static char *dbaddr;
+
+
+static int
+setclient(struct icdb_context *icdb, const char *clid, const char *type,
+          const char *nodelist, uint32_t jobid)
+{
+  return icdb_setclient(icdb, clid, type, "ofi+tcp://test", nodelist, 0,
+                        jobid, 4, nodelist, 2);
+}
+
+
+static struct icdb_context *
+db_connect(const char *addr)
+{
+  struct icdb_context *icdb;
+
+  TEST_ASSERT(icdb_init(&icdb, (char *)addr) == ICDB_SUCCESS);
+  return icdb;
+}
+
+
+static void
+test_addr(void)
+{
+  struct icdb_context *icdb;
+  char addr[64];
+
+  /* host:port of the test database, and the default port */
+  icdb = db_connect(dbaddr);
+  TEST_CHECK(icdb_getclient(icdb, "none", &(struct icdb_client){ 0 })
+             == ICDB_NORESULT);
+  icdb_fini(&icdb);
+
+  const char *bad[] = { "127.0.0.1:", "127.0.0.1:0", "127.0.0.1:x",
+                        "127.0.0.1:70000", "[::1", "[::1]6379", "[::1]:" };
+  for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+    TEST_CHECK_INT(icdb_init(&icdb, (char *)bad[i]), ICDB_EPARAM);
+    TEST_CHECK(icdb != NULL);
+    icdb_fini(&icdb);
+  }
+  TEST_CHECK_INT(icdb_init(&icdb, NULL), ICDB_EPARAM);
+
+  /* IPv6, bracketed with a port */
+  struct mockredis *v6;
+  if (mockredis_start(&v6, "::1") != 0) {
+    fprintf(stderr, "no IPv6 loopback, skipping\n");
+    return;
+  }
+  icdb = db_connect(mockredis_addr(v6));
+  TEST_CHECK(setclient(icdb, "v6", "test", NODES, 1) == ICDB_SUCCESS);
+  icdb_fini(&icdb);
+
+  /* a bare v6 address is not split at its last group */
+  const char *port = strrchr(mockredis_addr(v6), ':') + 1;
+  snprintf(addr, sizeof(addr), "[::1]:%s", port);
+  icdb = db_connect(addr);
+  icdb_fini(&icdb);
+  snprintf(addr, sizeof(addr), "::1:%s", port);
+  /* split, it would reach the server */
+  TEST_CHECK_INT(icdb_init(&icdb, addr), ICDB_EPROTO);
+  icdb_fini(&icdb);
+
+  mockredis_stop(&v6);
+}
+
+
+static void
+test_clients(void)
+{
+  struct icdb_context *icdb = db_connect(dbaddr);
+  struct icdb_client client, clients[4];
+  size_t count;
+  uint32_t jobid;
+
+  TEST_ASSERT(setclient(icdb, "a", "alert", "n0,n1", 1) == ICDB_SUCCESS);
+  TEST_ASSERT(setclient(icdb, "b", "flexmpi", NODES, 1) == ICDB_SUCCESS);
+  TEST_ASSERT(setclient(icdb, "c", "alert", "n5", 2) == ICDB_SUCCESS);
+
+  TEST_CHECK(icdb_getclient(icdb, "b", &client) == ICDB_SUCCESS);
+  TEST_CHECK_STR(client.clid, "b");
+  TEST_CHECK_STR(client.type, "flexmpi");
+  TEST_CHECK_STR(client.addr, "ofi+tcp://test");
+  TEST_CHECK_STR(client.nodelist, NODES);
+  TEST_CHECK_INT(client.jobid, 1);
+  TEST_CHECK_INT(client.nnodes, 4);
+  TEST_CHECK_INT(client.nprocs, 2);
+  TEST_CHECK_INT(icdb_getclient(icdb, "z", &client), ICDB_NORESULT);
+
+  /* registering again only changes the address */
+  TEST_CHECK(icdb_setclient(icdb, "a", "other", "ofi+tcp://new", "n9", 0, 3,
+                            4, "n9", 7) == ICDB_SUCCESS);
+  TEST_CHECK(icdb_getclient(icdb, "a", &client) == ICDB_SUCCESS);
+  TEST_CHECK_STR(client.addr, "ofi+tcp://new");
+  TEST_CHECK_STR(client.type, "alert");
+  TEST_CHECK_INT(client.jobid, 1);
+
+  TEST_CHECK(icdb_getlargestclient(icdb, &client) == ICDB_SUCCESS);
+  TEST_CHECK_STR(client.clid, "b");
+
+  count = 1;
+  TEST_CHECK_INT(icdb_getclients(icdb, 1, clients, &count), ICDB_E2BIG);
+  TEST_CHECK_INT(count, 2);
+  count = 4;
+  TEST_CHECK(icdb_getclients(icdb, 0, clients, &count) == ICDB_SUCCESS);
+  TEST_CHECK_INT(count, 3);
+
+  struct icdb_client *all = NULL;
+  uint64_t cursor = 0;
+  size_t total = 0;
+  do {
+    TEST_ASSERT(icdb_getclients2(icdb, 0, "alert", &all, &count, &cursor)
+                == ICDB_SUCCESS);
+    for (size_t i = 0; i < count; i++)
+      TEST_CHECK_STR(all[i].type, "alert");
+    total += count;
+  } while (cursor != 0);
+  TEST_CHECK_INT(total, 2);
+  free(all);
+
+  /* process counts and malleability hints */
+  TEST_CHECK(icdb_incrnprocs(icdb, "b", 3) == ICDB_SUCCESS);
+  TEST_CHECK(icdb_incrnprocs(icdb, "b", -1) == ICDB_SUCCESS);
+  TEST_CHECK(icdb_reconfigurable(icdb, "b", 8, 2) == ICDB_SUCCESS);
+  TEST_CHECK(icdb_getclient(icdb, "b", &client) == ICDB_SUCCESS);
+  TEST_CHECK_INT(client.nprocs, 4);
+  TEST_CHECK_INT(client.reconfig_nprocs, 8);
+  TEST_CHECK_INT(client.reconfig_nnodes, 2);
+
+  TEST_CHECK(icdb_delclient(icdb, "a", &jobid) == ICDB_SUCCESS);
+  TEST_CHECK_INT(jobid, 1);
+  TEST_CHECK_INT(icdb_getclient(icdb, "a", &client), ICDB_NORESULT);
+  count = 4;
+  TEST_CHECK(icdb_getclients(icdb, 1, clients, &count) == ICDB_SUCCESS);
+  TEST_CHECK_INT(count, 1);
+
+  icdb_fini(&icdb);
+  testdb_flush();
+}
+
+
+static void
+test_jobs(void)
+{
+  struct icdb_context *icdb = db_connect(dbaddr);
+  struct icdb_job job, *j = &job;
+  struct icdb_client clients[4];
+  size_t count = 4;
+  uint32_t jobid;
+
+  TEST_ASSERT(setclient(icdb, "a", "alert", NODES, 7) == ICDB_SUCCESS);
+  TEST_ASSERT(setclient(icdb, "b", "alert", NODES, 7) == ICDB_SUCCESS);
+
+  icdb_job_init(&job);
+  TEST_CHECK(icdb_getjob(icdb, 7, &job) == ICDB_SUCCESS);
+  TEST_CHECK_INT(job.jobid, 7);
+  TEST_CHECK_INT(job.nnodes, 4);
+  TEST_CHECK_INT(job.ncpus, 4);
+  TEST_CHECK_STR(job.nodelist, NODES);
+  icdb_job_free(&j);
+
+  TEST_CHECK(icdb_deljob(icdb, 7) == ICDB_SUCCESS);
+  TEST_CHECK(icdb_getclients(icdb, 7, clients, &count) == ICDB_SUCCESS);
+  TEST_CHECK_INT(count, 0);
+
+  /* jobs of the Slurm job monitor */
+  TEST_CHECK(icdb_getlargestjob(icdb, &jobid) == ICDB_SUCCESS);
+  TEST_CHECK_INT(jobid, 0);
+  TEST_ASSERT(testdb_command("HSET admire:job:11 jobid 11 nnodes 2") == 0);
+  TEST_ASSERT(testdb_command("HSET admire:job:12 jobid 12 nnodes 8") == 0);
+  TEST_ASSERT(testdb_command("SADD admire:jobs:running 11 12") == 0);
+  TEST_CHECK(icdb_getlargestjob(icdb, &jobid) == ICDB_SUCCESS);
+  TEST_CHECK_INT(jobid, 12);
+
+  icdb_fini(&icdb);
+  testdb_flush();
+}
+
+
+static void
+test_nodes(void)
+{
+  struct icdb_context *icdb = db_connect(dbaddr);
+  struct icdb_client clients[3];
+  char *nodelist;
+
+  TEST_ASSERT(setclient(icdb, "a", "test", "n2", 1) == ICDB_SUCCESS);
+  TEST_ASSERT(setclient(icdb, "b", "test", "n0", 1) == ICDB_SUCCESS);
+  TEST_ASSERT(setclient(icdb, "c", "test", "n9", 1) == ICDB_SUCCESS);
+  TEST_ASSERT(testdb_command("DEL nodelist:job:1") == 0);
+  TEST_ASSERT(testdb_command("RPUSH nodelist:job:1 n0 n1 n2 n3") == 0);
+
+  TEST_CHECK(icdb_addnodes(icdb, "a", "n4,n5,n6") == ICDB_SUCCESS);
+  TEST_CHECK(icdb_shrink(icdb, "a", &nodelist) == ICDB_SUCCESS);
+  TEST_CHECK_STR(nodelist, "n2,n4");
+  free(nodelist);
+
+  TEST_CHECK(icdb_delnodes(icdb, "a", "n2,n5") == ICDB_SUCCESS);
+  TEST_CHECK(icdb_shrink(icdb, "a", &nodelist) == ICDB_SUCCESS);
+  TEST_CHECK_STR(nodelist, "n4");
+  free(nodelist);
+
+  /* by first node in the job nodelist, a (now on n4) and c on no
+     node of the job last, in the same order */
+  strcpy(clients[0].clid, "c");
+  strcpy(clients[1].clid, "a");
+  strcpy(clients[2].clid, "b");
+  TEST_CHECK(icdb_sort_clients(icdb, 1, clients, 3) == ICDB_SUCCESS);
+  TEST_CHECK_STR(clients[0].clid, "b");
+  TEST_CHECK_STR(clients[1].clid, "c");
+  TEST_CHECK_STR(clients[2].clid, "a");
+
+  icdb_fini(&icdb);
+  testdb_flush();
+}
+
+
+static void
+test_beegfs(void)
+{
+  const char *keys[] = { "timestamp", "fs", "qlen" };
+  const char *vals[] = { "1700000000", "beegfs", "12" };
+  struct icdb_mstream_msg msg = { "1-0", 3, keys, vals };
+  struct icdb_beegfs b;
+
+  TEST_CHECK(icdb_mstream_beegfs(&msg, &b) == ICDB_SUCCESS);
+  TEST_CHECK_INT(b.timestamp, 1700000000);
+  TEST_CHECK_INT(b.qlen, 12);
+
+  vals[2] = "12x";
+  TEST_CHECK_INT(icdb_mstream_beegfs(&msg, &b), ICDB_EBADRESP);
+  vals[2] = "99999999999";
+  TEST_CHECK_INT(icdb_mstream_beegfs(&msg, &b), ICDB_EBADRESP);
+}
+
+
+/* retry reading client A on ICDB until the connection is back */
+static int
+wait_reconnect(struct icdb_context *icdb)
+{
+  struct icdb_client client;
+
+  for (unsigned waited = 0; waited < RECONNECT_TIMEOUT_MS; waited += 10) {
+    if (icdb_getclient(icdb, "a", &client) == ICDB_SUCCESS)
+      return 0;
+    test_sleep_ms(10);
+  }
+  return -1;
+}
+
+
+static void
+test_faults(void)
+{
+  struct mockredis *srv;
+  struct icdb_client client;
+
+  TEST_ASSERT(mockredis_start(&srv, "127.0.0.1") == 0);
+  struct icdb_context *icdb = db_connect(mockredis_addr(srv));
+  TEST_ASSERT(setclient(icdb, "a", "test", NODES, 1) == ICDB_SUCCESS);
+
+  /* error replies */
+  mockredis_fail(srv, "HGETALL", 1, NULL);
+  TEST_CHECK(icdb_getclient(icdb, "a", &client) != ICDB_SUCCESS);
+  TEST_CHECK(strstr(icdb_errstr(icdb), "injected failure") != NULL);
+  TEST_CHECK(icdb_getclient(icdb, "a", &client) == ICDB_SUCCESS);
+  mockredis_fail(srv, "FCALL", 1, "OOM command not allowed");
+  mockredis_fail(srv, "EVALSHA", 1, "OOM command not allowed");
+  TEST_CHECK(setclient(icdb, "b", "test", NODES, 1) != ICDB_SUCCESS);
+  TEST_CHECK(strstr(icdb_errstr(icdb), "OOM") != NULL);
+  mockredis_clear_faults(srv);
+
+  /* a reply of the wrong type, then a malformed one, which breaks
+     the connection */
+  mockredis_reply(srv, "HGETALL", 1, "+OK\r\n", 5);
+  TEST_CHECK(icdb_getclient(icdb, "a", &client) != ICDB_SUCCESS);
+  TEST_CHECK(icdb_getclient(icdb, "a", &client) == ICDB_SUCCESS);
+  uint64_t nconn = mockredis_nconnections(srv);
+  mockredis_reply(srv, "HGETALL", 1, "?garbage\r\n", 10);
+  TEST_CHECK(icdb_getclient(icdb, "a", &client) != ICDB_SUCCESS);
+  TEST_CHECK(wait_reconnect(icdb) == 0);
+  TEST_CHECK_INT(mockredis_nconnections(srv), nconn + 1);
+
+  /* the connection dropped in the middle of a command */
+  mockredis_drop(srv, "HGETALL", 1);
+  TEST_CHECK(icdb_getclient(icdb, "a", &client) != ICDB_SUCCESS);
+  TEST_CHECK(wait_reconnect(icdb) == 0);
+  TEST_CHECK_INT(mockredis_nconnections(srv), nconn + 2);
+
+  /* and in a pipeline */
+  mockredis_drop(srv, "LREM", 1);
+  TEST_CHECK(icdb_delnodes(icdb, "a", "n0,n1,n2") != ICDB_SUCCESS);
+  TEST_CHECK(wait_reconnect(icdb) == 0);
+
+  /* a crash: calls fail until the server is back, with the data it
+     had */
+  mockredis_down(srv);
+  TEST_CHECK(icdb_getclient(icdb, "a", &client) != ICDB_SUCCESS);
+  TEST_CHECK(icdb_getclient(icdb, "a", &client) != ICDB_SUCCESS);
+  TEST_ASSERT(mockredis_up(srv) == 0);
+  TEST_CHECK(wait_reconnect(icdb) == 0);
+  TEST_CHECK(icdb_getclient(icdb, "a", &client) == ICDB_SUCCESS);
+  TEST_CHECK_STR(client.addr, "ofi+tcp://test");
+
+  /* a server restarted empty: the library is loaded again */
+  mockredis_flush(srv);
+  TEST_CHECK(setclient(icdb, "a", "test", NODES, 1) == ICDB_SUCCESS);
+  TEST_CHECK(icdb_getclient(icdb, "a", &client) == ICDB_SUCCESS);
+  TEST_CHECK(mockredis_count(srv, "FUNCTION") == 1);
+
+  /* slow replies past the timeout */
+  TEST_CHECK(icdb_set_timeout(icdb, 50) == ICDB_SUCCESS);
+  mockredis_latency(srv, 200);
+  uint64_t start = test_now_ns();
+  TEST_CHECK(icdb_getclient(icdb, "a", &client) != ICDB_SUCCESS);
+  TEST_CHECK(test_now_ns() - start < 190 * 1000000ULL);
+  mockredis_latency(srv, 0);
+  TEST_CHECK(wait_reconnect(icdb) == 0);
+  /* the late reply of the timed out command is not taken for the
+     next one */
+  TEST_CHECK(icdb_getclient(icdb, "none", &client) == ICDB_NORESULT);
+
+  icdb_fini(&icdb);
+  mockredis_stop(&srv);
+}
+
+
+/* a server without Redis Functions gets scripts, reloaded when they
+   disappear */
+static void
+test_scripts(void)
+{
+  struct mockredis *srv;
+  struct icdb_client client;
+  char *nodelist;
+
+  TEST_ASSERT(mockredis_start(&srv, "127.0.0.1") == 0);
+  mockredis_functions(srv, 0);
+
+  struct icdb_context *icdb = db_connect(mockredis_addr(srv));
+  TEST_CHECK(setclient(icdb, "a", "test", NODES, 1) == ICDB_SUCCESS);
+  TEST_CHECK(icdb_shrink(icdb, "a", &nodelist) == ICDB_SUCCESS);
+  TEST_CHECK_STR(nodelist, "n0,n1");
+  free(nodelist);
+  TEST_CHECK(mockredis_count(srv, "EVALSHA") == 2);
+  TEST_CHECK(mockredis_count(srv, "FCALL") == 1);  /* icdb_version */
+
+  /* SCRIPT FLUSH, the script is loaded again */
+  mockredis_flush(srv);
+  mockredis_functions(srv, 0);
+  TEST_CHECK(setclient(icdb, "a", "test", NODES, 1) == ICDB_SUCCESS);
+  TEST_CHECK(icdb_getclient(icdb, "a", &client) == ICDB_SUCCESS);
+  TEST_CHECK(mockredis_count(srv, "SCRIPT") > 0);
+
+  icdb_fini(&icdb);
+  mockredis_stop(&srv);
+}
+
+
+int
+main(void)
+{
+  const char *addr = testdb_start();
+  if (!addr)
+    return TEST_SKIP;
+  dbaddr = (char *)addr;
+
+  ABT_init(0, NULL);
+
+  TEST_RUN(test_addr);
+  TEST_RUN(test_clients);
+  TEST_RUN(test_jobs);
+  TEST_RUN(test_nodes);
+  TEST_RUN(test_beegfs);
+  TEST_RUN(test_faults);
+  TEST_RUN(test_scripts);
+
+  ABT_finalize();
+  testdb_stop();
+
+  return TEST_EXIT();
+}
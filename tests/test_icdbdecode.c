@@ -0,0 +1,385 @@
+/**
+ * Reply decoder fuzzing: random and malformed RESP replies are parsed
+ * by hiredis as they would come from the server, then decoded with the
+ * client and job schemas, both as HGETALL hashes and as SORT ... GET
+ * arrays. Decoding must never read or write out of bounds, and must
+ * fail or yield terminated strings. Well-formed replies with random
+ * values must decode to exactly these values.
+ *
+ * The decoder is static, so icdb.c is included here. Built with
+ * -DTEST_LIBFUZZER -fsanitize=fuzzer, this is a libFuzzer target fed
+ * raw bytes instead.
+ *
+ * Usage: test_icdbdecode [NITERS [SEED]]
+ */
+#include "../src/icdb.c"
+
+#include "tests.h"
+
+/* largest generated string, past every fixed-size member */
+#define FUZZ_MAXSTR 5000
+
+static const char *names[] = {
+  "clid", "type", "addr", "nodelist", "provid", "jobid", "nnodes", "nprocs",
+  "reconfig_nprocs", "reconfig_nnodes", "ncpus", "", "jobi", "nodelist2",
+};
+
+static const char *numbers[] = {
+  "0", "1", "-1", "+5", " 1", "1x", "", "0x10", "255", "256", "65535",
+  "65536", "2147483647", "2147483648", "-2147483648", "-2147483649",
+  "4294967295", "4294967296", "9223372036854775807", "-9223372036854775808",
+  "18446744073709551615", "18446744073709551616", "99999999999999999999999",
+};
+
+/* string lengths around the member sizes */
+static const size_t lengths[] = {
+  0, 1, 35, 36, 37, 63, 64, 65, 127, 128, 129, 511, 512, 513, FUZZ_MAXSTR,
+};
+
+#define NELEMS(a) (sizeof(a) / sizeof((a)[0]))
+
+static uint64_t seed = 0x9e3779b97f4a7c15ULL;
+
+
+static uint64_t
+rnd(void)
+{
+  /* xorshift64* */
+  seed ^= seed >> 12;
+  seed ^= seed << 25;
+  seed ^= seed >> 27;
+  return seed * 2685821657736338717ULL;
+}
+
+
+static size_t
+rndn(size_t n)
+{
+  return n ? rnd() % n : 0;
+}
+
+
+struct buf {
+  char   *data;
+  size_t  len;
+  size_t  size;
+};
+
+static void
+buf_add(struct buf *b, const void *data, size_t len)
+{
+  if (b->len + len > b->size) {
+    b->size = (b->len + len) * 2;
+    b->data = realloc(b->data, b->size);
+    TEST_ASSERT(b->data);
+  }
+  memcpy(b->data + b->len, data, len);
+  b->len += len;
+}
+
+static void
+buf_printf(struct buf *b, const char *format, ...)
+{
+  char tmp[64];
+  va_list ap;
+
+  va_start(ap, format);
+  int n = vsnprintf(tmp, sizeof(tmp), format, ap);
+  va_end(ap);
+  buf_add(b, tmp, n);
+}
+
+static void
+buf_bulk(struct buf *b, const char *s, size_t len)
+{
+  buf_printf(b, "$%zu\r\n", len);
+  buf_add(b, s, len);
+  buf_add(b, "\r\n", 2);
+}
+
+
+/* a random string, with the odd NUL or CRLF inside */
+static void
+gen_str(struct buf *b)
+{
+  static char s[FUZZ_MAXSTR];
+  size_t len = lengths[rndn(NELEMS(lengths))];
+
+  for (size_t i = 0; i < len; i++)
+    s[i] = "abcn0,1-:[]\r\n"[rndn(14)];
+  if (len && rndn(8) == 0)
+    s[rndn(len)] = '\0';
+  buf_bulk(b, s, len);
+}
+
+
+static void
+gen_value(struct buf *b, int depth)
+{
+  switch (rndn(depth < 2 ? 9 : 8)) {
+  case 0: case 1: case 2: {
+    const char *n = numbers[rndn(NELEMS(numbers))];
+    buf_bulk(b, n, strlen(n));
+    break;
+  }
+  case 3: case 4:
+    gen_str(b);
+    break;
+  case 5:
+    buf_printf(b, ":%lld\r\n", (long long)rnd());
+    break;
+  case 6:
+    buf_add(b, "$-1\r\n", 5);
+    break;
+  case 7: {
+    const char *s = rndn(2) ? "+OK\r\n" : "-ERR nope\r\n";
+    buf_add(b, s, strlen(s));
+    break;
+  }
+  case 8: {
+    size_t n = rndn(4);
+    buf_printf(b, "*%zu\r\n", n);
+    for (size_t i = 0; i < n; i++)
+      gen_value(b, depth + 1);
+    break;
+  }
+  }
+}
+
+
+/* a hash of random fields, mostly known ones, or an array of values */
+static void
+gen_reply(struct buf *b)
+{
+  size_t n = rndn(16);
+
+  if (rndn(4) == 0) {
+    /* SORT ... GET shape */
+    buf_printf(b, "*%zu\r\n", n);
+    for (size_t i = 0; i < n; i++)
+      gen_value(b, 1);
+    return;
+  }
+
+  /* an odd count now and then */
+  size_t nelems = 2 * n - (n && rndn(8) == 0);
+  buf_printf(b, "*%zu\r\n", nelems);
+  for (size_t i = 0; i < nelems; i++) {
+    if (i % 2 == 0 && rndn(8)) {
+      const char *name = names[rndn(NELEMS(names))];
+      buf_bulk(b, name, strlen(name));
+    } else {
+      gen_value(b, 1);
+    }
+  }
+}
+
+
+/* flip, drop or duplicate bytes */
+static void
+mutate(struct buf *b)
+{
+  size_t n = 1 + rndn(4);
+
+  for (size_t i = 0; i < n && b->len > 0; i++) {
+    size_t pos = rndn(b->len);
+    switch (rndn(3)) {
+    case 0:
+      b->data[pos] ^= 1 << rndn(8);
+      break;
+    case 1:
+      b->len = pos;
+      break;
+    case 2:
+      b->data[pos] = b->data[rndn(b->len)];
+      break;
+    }
+  }
+}
+
+
+static void
+check_str(const char *s, size_t size)
+{
+  TEST_CHECK(strnlen(s, size) < size);
+}
+
+
+/* decode REP every possible way and check the results */
+static void
+decode(struct icdb_context *icdb, const redisReply *rep)
+{
+  struct icdb_client client;
+  struct icdb_job job, *j = &job;
+
+  arena_reset(icdb->arena);
+  memset(&client, 0, sizeof(client));
+  if (_icdb_decode_hash(icdb, rep, client_schema, ICDB_NFIELDS(client_schema),
+                        &client) == ICDB_SUCCESS) {
+    check_str(client.clid, sizeof(client.clid));
+    check_str(client.type, sizeof(client.type));
+    check_str(client.addr, sizeof(client.addr));
+    if (client.nodelist)
+      (void)strlen(client.nodelist);
+  }
+
+  icdb_job_init(&job);
+  _icdb_decode_hash(icdb, rep, job_schema, ICDB_NFIELDS(job_schema), &job);
+  icdb_job_free(&j);
+
+  if (rep->type == REDIS_REPLY_ARRAY &&
+      rep->elements >= ICDB_NFIELDS(client_schema)) {
+    memset(&client, 0, sizeof(client));
+    if (_icdb_decode_array(icdb, rep->element, client_schema,
+                           ICDB_NFIELDS(client_schema), &client) == ICDB_SUCCESS) {
+      check_str(client.clid, sizeof(client.clid));
+      check_str(client.type, sizeof(client.type));
+      check_str(client.addr, sizeof(client.addr));
+    }
+  }
+}
+
+
+/* parse DATA as the server replies and decode them */
+static void
+fuzz_one(struct icdb_context *icdb, const char *data, size_t len)
+{
+  redisReader *reader = redisReaderCreate();
+  void *rep;
+
+  TEST_ASSERT(reader);
+  /* mutated counts must not allocate gigabytes */
+  reader->maxelements = 1024;
+  if (redisReaderFeed(reader, data, len) == REDIS_OK) {
+    while (redisReaderGetReply(reader, &rep) == REDIS_OK && rep) {
+      decode(icdb, rep);
+      freeReplyObject(rep);
+    }
+  }
+  redisReaderFree(reader);
+}
+
+
+/* a well-formed client with random values decodes to them */
+static void
+roundtrip(struct icdb_context *icdb)
+{
+  struct icdb_client in = { 0 }, out;
+  struct buf b = { 0 };
+  char nodelist[FUZZ_MAXSTR + 1], num[32];
+  size_t len = rndn(FUZZ_MAXSTR);
+
+  snprintf(in.clid, sizeof(in.clid), "%016"PRIx64"-%08"PRIx64, rnd(), rnd() >> 32);
+  snprintf(in.type, sizeof(in.type), "type%"PRIu64, rnd());
+  snprintf(in.addr, sizeof(in.addr), "ofi+tcp://10.%u.%u.%u:%u", (unsigned)rndn(256),
+           (unsigned)rndn(256), (unsigned)rndn(256), (unsigned)rndn(65536));
+  for (size_t i = 0; i < len; i++)
+    nodelist[i] = i % 4 == 3 ? ',' : 'a' + rndn(26);
+  nodelist[len] = '\0';
+  in.provid = rnd();
+  in.jobid = rnd();
+  in.nnodes = rnd();
+  in.nprocs = rnd();
+  in.reconfig_nprocs = rnd();
+  in.reconfig_nnodes = rnd();
+
+  buf_printf(&b, "*20\r\n");
+#define ADD_STR(name, s)   buf_bulk(&b, name, strlen(name)); buf_bulk(&b, s, strlen(s))
+#define ADD_NUM(name, fmt, v)                                          \
+  snprintf(num, sizeof(num), "%"fmt, v); ADD_STR(name, num)
+  ADD_STR("clid", in.clid);
+  ADD_STR("type", in.type);
+  ADD_STR("addr", in.addr);
+  ADD_STR("nodelist", nodelist);
+  ADD_NUM("provid", PRIu16, in.provid);
+  ADD_NUM("jobid", PRIu32, in.jobid);
+  ADD_NUM("nnodes", PRIu32, in.nnodes);
+  ADD_NUM("nprocs", PRIu64, in.nprocs);
+  ADD_NUM("reconfig_nprocs", PRIi32, in.reconfig_nprocs);
+  ADD_NUM("reconfig_nnodes", PRIi32, in.reconfig_nnodes);
+#undef ADD_NUM
+#undef ADD_STR
+
+  redisReader *reader = redisReaderCreate();
+  redisReply *rep = NULL;
+  TEST_ASSERT(reader);
+  TEST_ASSERT(redisReaderFeed(reader, b.data, b.len) == REDIS_OK);
+  TEST_ASSERT(redisReaderGetReply(reader, (void **)&rep) == REDIS_OK && rep);
+
+  arena_reset(icdb->arena);
+  memset(&out, 0, sizeof(out));
+  TEST_CHECK(_icdb_decode_hash(icdb, rep, client_schema, ICDB_NFIELDS(client_schema),
+                               &out) == ICDB_SUCCESS);
+  TEST_CHECK_STR(out.clid, in.clid);
+  TEST_CHECK_STR(out.type, in.type);
+  TEST_CHECK_STR(out.addr, in.addr);
+  TEST_CHECK_STR(out.nodelist, nodelist);
+  TEST_CHECK_INT(out.provid, in.provid);
+  TEST_CHECK_INT(out.jobid, in.jobid);
+  TEST_CHECK_INT(out.nnodes, in.nnodes);
+  TEST_CHECK(out.nprocs == in.nprocs);
+  TEST_CHECK_INT(out.reconfig_nprocs, in.reconfig_nprocs);
+  TEST_CHECK_INT(out.reconfig_nnodes, in.reconfig_nnodes);
+
+  freeReplyObject(rep);
+  redisReaderFree(reader);
+  free(b.data);
+}
+
+
+static struct icdb_context *
+decoder_context(void)
+{
+  /* decoding only needs the status and the arena */
+  struct icdb_context *icdb = calloc(1, sizeof(*icdb));
+  TEST_ASSERT(icdb);
+  icdb->arena = arena_create(0);
+  TEST_ASSERT(icdb->arena);
+  return icdb;
+}
+
+
+#ifdef TEST_LIBFUZZER
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  static struct icdb_context *icdb = NULL;
+
+  if (!icdb)
+    icdb = decoder_context();
+  fuzz_one(icdb, (const char *)data, size);
+  if (test_nfailed)
+    abort();
+
+  return 0;
+}
+#else
+int
+main(int argc, char **argv)
+{
+  size_t niters = test_size_arg(argc, argv, 1, 20000);
+  seed ^= test_size_arg(argc, argv, 2, 0);
+
+  struct icdb_context *icdb = decoder_context();
+  struct buf b = { 0 };
+
+  for (size_t i = 0; i < niters; i++) {
+    if (i % 8 == 0) {
+      roundtrip(icdb);
+      continue;
+    }
+    b.len = 0;
+    gen_reply(&b);
+    if (rndn(4) == 0)
+      mutate(&b);
+    fuzz_one(icdb, b.data, b.len);
+  }
+  printf("%zu replies decoded\n", niters);
+
+  free(b.data);
+  arena_free(icdb->arena);
+  free(icdb);
+
+  return TEST_EXIT();
+}
+#endif
@@ -0,0 +1,224 @@
+/**
+ * icdb connection pool tests: connections are opened on first use and
+ * bounded by the pool size, and a workload of several execution
+ * streams resumes on its own after the database crashed and came back
+ * in the middle of it. The pool statistics are checked along the way.
+ *
+ * Usage: test_icdbpool [NXSTREAMS]
+ */
+#include <inttypes.h>           /* PRIu64 */
+#include <abt.h>
+
+#include "icdb.h"
+#include "mockredis.h"
+#include "tests.h"
+
+#define POOL_SIZE  4
+#define TIMEOUT_MS 200
+
+/* time given to the workload to resume once the server is back */
+#define RESUME_TIMEOUT_MS 5000
+
+#define NODES "n0,n1"
+
+struct worker {
+  size_t   id;
+  int      controller;          /* crashes the server instead */
+  uint64_t nok;
+  uint64_t nfail;
+  uint64_t last_ok;             /* time of the last success */
+};
+
+static struct mockredis *srv;
+static struct icdb_pool *pool;
+static struct worker    *workers;
+static size_t            nworkers;
+static int               stop;
+static uint64_t          up_at;  /* time the server came back */
+
+
+/* register then read back a client of worker W */
+static int
+op(struct icdb_context *icdb, struct worker *w)
+{
+  struct icdb_client client;
+  char clid[UUID_STR_LEN];
+
+  snprintf(clid, sizeof(clid), "w%zu", w->id);
+  int rc = icdb_setclient(icdb, clid, "test", "ofi+tcp://test", NODES, 0,
+                          w->id + 1, 4, NODES, 1);
+  if (rc == ICDB_SUCCESS)
+    rc = icdb_getclient(icdb, clid, &client);
+  if (rc == ICDB_SUCCESS && client.jobid != w->id + 1)
+    rc = ICDB_FAILURE;
+
+  return rc;
+}
+
+
+static uint64_t
+total_ok(void)
+{
+  uint64_t n = 0;
+
+  for (size_t i = 0; i < nworkers; i++)
+    n += __atomic_load_n(&workers[i].nok, __ATOMIC_ACQUIRE);
+  return n;
+}
+
+
+/* wait until every worker succeeded after the server came back */
+static int
+wait_resumed(void)
+{
+  for (unsigned waited = 0; waited < RESUME_TIMEOUT_MS; waited++) {
+    size_t n = 0;
+    for (size_t i = 0; i < nworkers; i++) {
+      if (!workers[i].controller &&
+          __atomic_load_n(&workers[i].last_ok, __ATOMIC_ACQUIRE) > up_at)
+        n++;
+    }
+    if (n == nworkers - 1)
+      return 0;
+    test_sleep_ms(1);
+  }
+  return -1;
+}
+
+
+static void
+controller(void)
+{
+  /* let the workload run, then crash the server for a while */
+  while (total_ok() < 100 * nworkers)
+    test_sleep_ms(1);
+
+  mockredis_down(srv);
+  test_sleep_ms(300);
+  up_at = test_now_ns();
+  TEST_ASSERT(mockredis_up(srv) == 0);
+
+  TEST_CHECK(wait_resumed() == 0);
+  __atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+}
+
+
+static void
+worker_th(void *arg)
+{
+  struct worker *w = (struct worker *)arg;
+
+  if (w->controller) {
+    controller();
+    return;
+  }
+
+  while (!__atomic_load_n(&stop, __ATOMIC_ACQUIRE)) {
+    struct icdb_context *icdb = icdb_pool_get(pool);
+    TEST_ASSERT(icdb);
+    int rc = op(icdb, w);
+    icdb_pool_put(pool, icdb);
+
+    if (rc == ICDB_SUCCESS) {
+      __atomic_add_fetch(&w->nok, 1, __ATOMIC_RELEASE);
+      __atomic_store_n(&w->last_ok, test_now_ns(), __ATOMIC_RELEASE);
+    } else {
+      w->nfail++;
+      test_sleep_ms(1);
+    }
+  }
+}
+
+
+static void
+test_crash(void)
+{
+  struct icdb_pool_stats stats;
+
+  TEST_ASSERT(icdb_pool_init(&pool, (char *)mockredis_addr(srv), POOL_SIZE,
+                             TIMEOUT_MS) == ICDB_SUCCESS);
+  TEST_CHECK_INT(mockredis_nconnections(srv), 0);
+
+  workers = calloc(nworkers, sizeof(*workers));
+  TEST_ASSERT(workers);
+  for (size_t i = 0; i < nworkers; i++)
+    workers[i].id = i;
+  workers[0].controller = 1;
+
+  TEST_ASSERT(test_xstreams_run(nworkers, worker_th, workers,
+                                sizeof(*workers)) == 0);
+
+  uint64_t nok = 0, nfail = 0;
+  for (size_t i = 1; i < nworkers; i++) {
+    nok += workers[i].nok;
+    nfail += workers[i].nfail;
+  }
+  printf("%"PRIu64" operations, %"PRIu64" failed while the server was down\n",
+         nok + nfail, nfail);
+  TEST_CHECK(nfail > 0);
+
+  icdb_pool_stats(pool, &stats);
+  printf("gets %"PRIu64", waits %"PRIu64" (%"PRIu64" ms), reconnects %"PRIu64
+         ", open %zu\n", stats.gets, stats.waits, stats.wait_ms,
+         stats.reconnects, stats.nopen);
+  TEST_CHECK_INT(stats.gets, nok + nfail);
+  TEST_CHECK(stats.nopen <= POOL_SIZE);
+  TEST_CHECK_INT(stats.nbusy, 0);
+  TEST_CHECK(stats.reconnects > 0);
+  if (nworkers - 1 > POOL_SIZE)
+    TEST_CHECK(stats.waits > 0);
+
+  free(workers);
+  icdb_pool_fini(&pool);
+}
+
+
+/* a connection first opened while the server is down */
+static void
+test_lazy_down(void)
+{
+  struct icdb_client client;
+
+  TEST_ASSERT(icdb_pool_init(&pool, (char *)mockredis_addr(srv), 1,
+                             TIMEOUT_MS) == ICDB_SUCCESS);
+  mockredis_down(srv);
+
+  struct icdb_context *icdb = icdb_pool_get(pool);
+  TEST_ASSERT(icdb);
+  TEST_CHECK(icdb_getclient(icdb, "w1", &client) != ICDB_SUCCESS);
+  icdb_pool_put(pool, icdb);
+
+  TEST_ASSERT(mockredis_up(srv) == 0);
+  int rc = ICDB_FAILURE;
+  for (unsigned waited = 0; rc != ICDB_SUCCESS && waited < RESUME_TIMEOUT_MS;
+       waited += 10) {
+    icdb = icdb_pool_get(pool);
+    rc = icdb_getclient(icdb, "w1", &client);
+    icdb_pool_put(pool, icdb);
+    if (rc != ICDB_SUCCESS)
+      test_sleep_ms(10);
+  }
+  TEST_CHECK(rc == ICDB_SUCCESS);
+  TEST_CHECK_INT(client.jobid, 2);
+
+  icdb_pool_fini(&pool);
+}
+
+
+int
+main(int argc, char **argv)
+{
+  /* plus the controller */
+  nworkers = test_size_arg(argc, argv, 1, 2 * POOL_SIZE) + 1;
+
+  ABT_init(0, NULL);
+  TEST_ASSERT(mockredis_start(&srv, "127.0.0.1") == 0);
+
+  TEST_RUN(test_crash);
+  TEST_RUN(test_lazy_down);
+
+  mockredis_stop(&srv);
+  ABT_finalize();
+
+  return TEST_EXIT();
+}
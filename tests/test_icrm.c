@@ -0,0 +1,263 @@
+/**
+ * Tests of the resource manager interface (see icrm.h) on the mock
+ * libslurm. The process runs in job TEST_JOBID, on the first
+ * TEST_JOBNODES of TEST_NNODES nodes of TEST_NCPUS CPUs each.
+ */
+#include <stdio.h>              /* snprintf */
+#include <stdlib.h>             /* setenv */
+#include <string.h>             /* strstr */
+#include <abt.h>
+
+#include "hashmap.h"
+#include "icc_common.h"         /* ICC_ERRSTR_LEN */
+#include "icrm.h"
+#include "tests.h"
+
+#define TEST_JOBID       42
+#define TEST_NODES       "node[1-8]"
+#define TEST_NNODES      8
+#define TEST_JOBNODES    2
+#define TEST_NCPUS       8
+#define TEST_PENDING_MS  300    /* before the pending job is killed */
+
+
+/* allocate NNODES whole nodes, put their names in NAMES, which point
+   into the returned host map */
+static hm_t *
+alloc_nodes(uint32_t nnodes, uint32_t *jobid, const char **names)
+{
+  char errstr[ICC_ERRSTR_LEN];
+  uint32_t ncpus = nnodes * TEST_NCPUS;
+  hm_t *hostmap = NULL;
+
+  TEST_ASSERT(icrm_alloc(jobid, &ncpus, &nnodes, &hostmap, errstr) == ICRM_SUCCESS);
+  TEST_ASSERT(hostmap);
+  TEST_CHECK_INT(ncpus, nnodes * TEST_NCPUS);
+  TEST_ASSERT(hm_keys(hostmap, names, nnodes) == nnodes);
+
+  return hostmap;
+}
+
+
+static size_t
+job_nnodes(uint32_t jobid)
+{
+  char errstr[ICC_ERRSTR_LEN];
+  hm_t *hostmap = NULL;
+
+  TEST_ASSERT(icrm_get_job_hostmap(jobid, &hostmap, errstr) == ICRM_SUCCESS);
+  size_t n = hm_length(hostmap);
+  hm_free(hostmap);
+
+  return n;
+}
+
+
+static void
+test_jobstate(void)
+{
+  char errstr[ICC_ERRSTR_LEN];
+  enum icrm_jobstate state;
+  uint32_t ncpus, nnodes;
+  char *nodelist = NULL;
+
+  TEST_CHECK_INT(icrm_jobstate(TEST_JOBID, &state, errstr), ICRM_SUCCESS);
+  TEST_CHECK_INT(state, ICRM_JOB_RUNNING);
+
+  TEST_ASSERT(icrm_info(TEST_JOBID, &ncpus, &nnodes, &nodelist, errstr) == ICRM_SUCCESS);
+  TEST_CHECK_INT(ncpus, TEST_JOBNODES * TEST_NCPUS);
+  TEST_CHECK_INT(nnodes, TEST_JOBNODES);
+  TEST_CHECK(nodelist && strstr(nodelist, "node1") && strstr(nodelist, "node2"));
+  free(nodelist);
+
+  TEST_CHECK_INT(icrm_jobstate(TEST_JOBID + 1000, &state, errstr), ICRM_EJOBID);
+}
+
+
+static void
+test_hostmap(void)
+{
+  char errstr[ICC_ERRSTR_LEN];
+  hm_t *hostmap = NULL;
+  uint32_t ncpus = 0;
+
+  TEST_ASSERT(icrm_get_job_hostmap(TEST_JOBID, &hostmap, errstr) == ICRM_SUCCESS);
+  TEST_CHECK_INT(hm_length(hostmap), TEST_JOBNODES);
+
+  const uint16_t *n = hm_get(hostmap, "node1");
+  TEST_CHECK(n && *n == TEST_NCPUS);
+
+  char *hostlist = icrm_hostlist(hostmap, 1, &ncpus);
+  TEST_CHECK(hostlist != NULL);
+  TEST_CHECK_INT(ncpus, TEST_JOBNODES * TEST_NCPUS);
+  free(hostlist);
+  hm_free(hostmap);
+
+  hostmap = NULL;
+  TEST_CHECK(icrm_get_job_hostmap(TEST_JOBID + 1000, &hostmap, errstr) != ICRM_SUCCESS);
+  TEST_CHECK(hostmap == NULL);
+}
+
+
+static void
+test_alloc(void)
+{
+  char errstr[ICC_ERRSTR_LEN];
+  uint32_t jobid, ncpus, nnodes;
+  hm_t *hostmap = NULL;
+
+  /* whole nodes, as many as needed */
+  ncpus = TEST_NCPUS + 2;
+  nnodes = 0;
+  TEST_ASSERT(icrm_alloc(&jobid, &ncpus, &nnodes, &hostmap, errstr) == ICRM_SUCCESS);
+  TEST_CHECK(jobid != 0 && jobid != TEST_JOBID);
+  TEST_CHECK_INT(ncpus, 2 * TEST_NCPUS);
+  TEST_CHECK_INT(hm_length(hostmap), 2);
+  TEST_CHECK(hm_get(hostmap, "node1") == NULL);
+  hm_free(hostmap);
+
+  TEST_CHECK_INT(job_nnodes(jobid), 2);
+  TEST_CHECK_INT(icrm_merge(jobid, errstr), ICRM_SUCCESS);
+
+  /* more nodes than there are */
+  ncpus = TEST_NCPUS;
+  nnodes = 100;
+  errstr[0] = '\0';
+  TEST_CHECK_INT(icrm_alloc(&jobid, &ncpus, &nnodes, &hostmap, errstr), ICRM_ERESOURCEMAN);
+  TEST_CHECK(errstr[0] != '\0');
+}
+
+
+static void
+test_release_node(void)
+{
+  char errstr[ICC_ERRSTR_LEN];
+  enum icrm_jobstate state;
+  const char *names[2];
+  uint32_t jobid;
+
+  hm_t *hostmap = alloc_nodes(2, &jobid, names);
+
+  TEST_CHECK_INT(icrm_release_node(names[0], jobid, TEST_NCPUS, errstr), ICRM_SUCCESS);
+  TEST_CHECK_INT(job_nnodes(jobid), 1);
+
+  /* part of the CPUs, a node of another job */
+  TEST_CHECK_INT(icrm_release_node(names[1], jobid, TEST_NCPUS / 2, errstr), ICRM_EAGAIN);
+  TEST_CHECK_INT(icrm_release_node("node1", jobid, TEST_NCPUS, errstr), ICRM_FAILURE);
+  TEST_CHECK_INT(job_nnodes(jobid), 1);
+
+  /* the last node ends the job */
+  TEST_CHECK_INT(icrm_release_node(names[1], jobid, TEST_NCPUS, errstr), ICRM_SUCCESS);
+  TEST_CHECK_INT(icrm_jobstate(jobid, &state, errstr), ICRM_SUCCESS);
+  TEST_CHECK_INT(state, ICRM_JOB_OTHER);
+
+  hm_free(hostmap);
+}
+
+
+static void
+test_release_nodes(void)
+{
+  char errstr[ICC_ERRSTR_LEN];
+  enum icrm_jobstate state;
+  const char *names[3];
+  uint32_t jobid;
+
+  hm_t *hostmap = alloc_nodes(3, &jobid, names);
+
+  /* one update for all */
+  const char *nodenames[] = { names[0], "node1", names[2] };
+  uint32_t ncpus[] = { TEST_NCPUS, TEST_NCPUS, TEST_NCPUS / 2 };
+  icrmerr_t rets[3];
+
+  TEST_CHECK_INT(icrm_release_nodes(jobid, 3, nodenames, ncpus, rets, errstr), ICRM_SUCCESS);
+  TEST_CHECK_INT(rets[0], ICRM_SUCCESS);
+  TEST_CHECK_INT(rets[1], ICRM_FAILURE);
+  TEST_CHECK_INT(rets[2], ICRM_EAGAIN);
+  TEST_CHECK_INT(job_nnodes(jobid), 2);
+
+  TEST_CHECK_INT(icrm_merge(jobid, errstr), ICRM_SUCCESS);
+  TEST_CHECK_INT(icrm_jobstate(jobid, &state, errstr), ICRM_SUCCESS);
+  TEST_CHECK_INT(state, ICRM_JOB_OTHER);
+
+  hm_free(hostmap);
+}
+
+
+struct pending_arg {
+  size_t    id;
+  icrmerr_t rc;
+};
+
+/* an allocation that cannot be granted, then the kill of it */
+static void
+pending_th(void *arg)
+{
+  struct pending_arg *a = (struct pending_arg *)arg;
+  char errstr[ICC_ERRSTR_LEN];
+
+  if (a->id == 0) {
+    uint32_t jobid, ncpus = TEST_NCPUS, nnodes = TEST_NNODES;
+    hm_t *hostmap = NULL;
+
+    a->rc = icrm_alloc(&jobid, &ncpus, &nnodes, &hostmap, errstr);
+    if (hostmap)
+      hm_free(hostmap);
+    icrm_clear_pending_job();
+  } else {
+    test_sleep_ms(TEST_PENDING_MS);
+    a->rc = icrm_kill_wait_pending_job(errstr);
+  }
+}
+
+
+static void
+test_kill_pending(void)
+{
+  struct pending_arg args[2] = { { .id = 0 }, { .id = 1 } };
+  char errstr[ICC_ERRSTR_LEN];
+
+  TEST_ASSERT(test_xstreams_run(2, pending_th, args, sizeof(*args)) == 0);
+  TEST_CHECK_INT(args[0].rc, ICRM_ERESOURCEMAN);
+  TEST_CHECK_INT(args[1].rc, ICRM_SUCCESS);
+
+  /* nothing pending, returns at once */
+  TEST_CHECK_INT(icrm_kill_wait_pending_job(errstr), ICRM_SUCCESS);
+}
+
+
+static void
+setenv_int(const char *name, int value)
+{
+  char buf[16];
+  snprintf(buf, sizeof(buf), "%d", value);
+  TEST_ASSERT(setenv(name, buf, 1) == 0);
+}
+
+
+int
+main(void)
+{
+  /* read by the mock on the first Slurm call */
+  setenv("MOCKSLURM_NODES", TEST_NODES, 1);
+  setenv_int("MOCKSLURM_CPUS", TEST_NCPUS);
+  setenv_int("SLURM_JOB_ID", TEST_JOBID);
+  setenv_int("SLURM_JOB_NUM_NODES", TEST_JOBNODES);
+  unsetenv("MOCKSLURM_LATENCY");
+  unsetenv("MOCKSLURM_FAIL");
+
+  ABT_init(0, NULL);
+  icrm_init();
+
+  TEST_RUN(test_jobstate);
+  TEST_RUN(test_hostmap);
+  TEST_RUN(test_alloc);
+  TEST_RUN(test_release_node);
+  TEST_RUN(test_release_nodes);
+  TEST_RUN(test_kill_pending);
+
+  icrm_fini();
+  ABT_finalize();
+
+  return TEST_EXIT();
+}
@@ -0,0 +1,245 @@
+/**
+ * Tests of the queue of resource manager requests (see icrmq.h) on the
+ * mock libslurm, with a latency of TEST_LATENCY_MS per Slurm call.
+ *
+ * Nodes are released the way icc_release_nodes releases them: the host
+ * lock is held to pick a node and submit the request, and the release
+ * is waited for once it is unlocked. The time the lock is held must
+ * not depend on the latency of Slurm, while releasing with the lock
+ * held until the request completes, as before the queue, holds it for
+ * at least two calls. Releases of the job pending together are made in
+ * one call.
+ */
+#include <inttypes.h>           /* PRIu32 */
+#include <stdio.h>              /* snprintf */
+#include <stdlib.h>             /* setenv */
+#include <abt.h>
+
+#include "hashmap.h"
+#include "icrmq.h"
+#include "icstats.h"
+#include "tests.h"
+
+#define TEST_JOBID      42
+#define TEST_NODES      "node[1-72]"
+#define TEST_NNODES     64      /* of the job, the others are free */
+#define TEST_NCPUS      8
+#define TEST_LATENCY_MS 50
+#define TEST_NWORKERS   2       /* as icc */
+#define TEST_NRELEASES  16      /* per round, one per execution stream */
+
+static struct icrmq *queue;
+static ABT_pool     pool;
+static ABT_xstream  xstreams[TEST_NWORKERS];
+
+static ABT_rwlock   hostlock;
+static uint32_t     nextnode = 1; /* next node of the job to release */
+
+struct release_arg {
+  int       serial;             /* hold the lock until the release completes */
+  uint64_t  hold;               /* time the lock was held */
+  uint64_t  done;               /* time until the release completed */
+  icrmerr_t rc;
+};
+
+
+static void
+release_th(void *arg)
+{
+  struct release_arg *a = (struct release_arg *)arg;
+  struct icrmq_result res;
+  ABT_eventual ev;
+  char nodename[16];
+
+  uint64_t start = test_now_ns();
+
+  ABT_rwlock_wrlock(hostlock);
+  uint64_t locked = test_now_ns();
+
+  snprintf(nodename, sizeof(nodename), "node%"PRIu32, nextnode++);
+  a->rc = icrmq_submit_release(queue, nodename, TEST_JOBID, TEST_NCPUS, &ev);
+  if (a->rc == ICRM_SUCCESS && a->serial)
+    a->rc = icrmq_wait(&ev, &res);
+
+  a->hold = test_now_ns() - locked;
+  ABT_rwlock_unlock(hostlock);
+
+  if (a->rc == ICRM_SUCCESS && !a->serial)
+    a->rc = icrmq_wait(&ev, &res);
+
+  a->done = test_now_ns() - start;
+}
+
+
+/* release TEST_NRELEASES nodes concurrently, return the number of
+   icrm_release_nodes calls it took */
+static uint64_t
+release_round(int serial, struct test_lat *hold, struct test_lat *done)
+{
+  struct icstats_hist *h = icstats_hist("icrm", "icrm_release_nodes");
+  struct release_arg args[TEST_NRELEASES] = { 0 };
+
+  TEST_ASSERT(h);
+  uint64_t ncalls = h->count;
+
+  for (size_t i = 0; i < TEST_NRELEASES; i++)
+    args[i].serial = serial;
+
+  TEST_ASSERT(test_xstreams_run(TEST_NRELEASES, release_th, args, sizeof(*args)) == 0);
+
+  for (size_t i = 0; i < TEST_NRELEASES; i++) {
+    TEST_CHECK_INT(args[i].rc, ICRM_SUCCESS);
+    TEST_CHECK(test_lat_add(hold, args[i].hold) == 0);
+    TEST_CHECK(test_lat_add(done, args[i].done) == 0);
+  }
+
+  return h->count - ncalls;
+}
+
+
+static void
+test_alloc(void)
+{
+  struct icrmq_result res;
+  ABT_eventual ev;
+
+  TEST_ASSERT(icrmq_submit_alloc(queue, 2 * TEST_NCPUS, 0, &ev) == ICRM_SUCCESS);
+  TEST_CHECK_INT(icrmq_wait(&ev, &res), ICRM_SUCCESS);
+  TEST_CHECK(res.jobid != 0 && res.jobid != TEST_JOBID);
+  TEST_CHECK_INT(res.ncpus, 2 * TEST_NCPUS);
+  TEST_CHECK(res.hostmap && hm_length(res.hostmap) == 2);
+  hm_free(res.hostmap);
+
+  /* more nodes than there are */
+  TEST_ASSERT(icrmq_submit_alloc(queue, 0, 1000, &ev) == ICRM_SUCCESS);
+  TEST_CHECK_INT(icrmq_wait(&ev, &res), ICRM_ERESOURCEMAN);
+  TEST_CHECK(res.errstr[0] != '\0');
+}
+
+
+static void
+test_hold(void)
+{
+  struct test_lat shold = { 0 }, sdone = { 0 }, qhold = { 0 }, qdone = { 0 };
+  const uint64_t latency = TEST_LATENCY_MS * 1000000ULL;
+  char errstr[ICC_ERRSTR_LEN];
+  hm_t *hostmap = NULL;
+
+  uint64_t scalls = release_round(1, &shold, &sdone);
+  uint64_t qcalls = release_round(0, &qhold, &qdone);
+
+  printf("%d releases, Slurm latency %d ms:\n", TEST_NRELEASES, TEST_LATENCY_MS);
+  printf("lock held until completion, %"PRIu64" calls\n", scalls);
+  test_lat_print(&shold, "hostlock");
+  test_lat_print(&sdone, "release");
+  printf("lock held to submit, %"PRIu64" calls\n", qcalls);
+  test_lat_print(&qhold, "hostlock");
+  test_lat_print(&qdone, "release");
+
+  /* a lookup then an update, under the lock or not */
+  TEST_CHECK(test_lat_pct(&shold, 0) >= 2 * latency);
+  TEST_CHECK(test_lat_pct(&qhold, 100) < latency / 2);
+  TEST_CHECK(test_lat_pct(&qdone, 0) >= 2 * latency);
+
+  /* one call per release, or the pending releases merged */
+  TEST_CHECK_INT(scalls, TEST_NRELEASES);
+  TEST_CHECK(qcalls >= 1 && qcalls < TEST_NRELEASES);
+
+  TEST_ASSERT(icrm_get_job_hostmap(TEST_JOBID, &hostmap, errstr) == ICRM_SUCCESS);
+  TEST_CHECK_INT(hm_length(hostmap), TEST_NNODES - 2 * TEST_NRELEASES);
+  TEST_CHECK(hm_get(hostmap, "node1") == NULL);
+  TEST_CHECK(hm_get(hostmap, "node32") == NULL);
+  TEST_CHECK(hm_get(hostmap, "node33") != NULL);
+  hm_free(hostmap);
+
+  test_lat_free(&shold);
+  test_lat_free(&sdone);
+  test_lat_free(&qhold);
+  test_lat_free(&qdone);
+}
+
+
+static void
+test_full(void)
+{
+  /* the worker that takes the first release of the job is busy for a
+     lookup, a batch at most is taken meanwhile, the queue fills up */
+  const size_t nsubmits = ICRMQ_LEN + ICRMQ_COALESCE + 1;
+  ABT_eventual *evs = calloc(nsubmits, sizeof(*evs));
+  struct icrmq_result res;
+  size_t nqueued = 0, nfull = 0;
+
+  TEST_ASSERT(evs);
+
+  for (size_t i = 0; i < nsubmits; i++) {
+    icrmerr_t rc = icrmq_submit_release(queue, "nosuchnode", TEST_JOBID, TEST_NCPUS, &evs[i]);
+    if (rc == ICRM_SUCCESS)
+      nqueued++;
+    else if (rc == ICRM_EAGAIN)
+      nfull++;
+    else
+      TEST_CHECK_INT(rc, ICRM_SUCCESS);
+  }
+  TEST_CHECK(nfull > 0);
+  TEST_CHECK(nqueued >= ICRMQ_LEN);
+
+  /* the node is not in the job */
+  for (size_t i = 0; i < nsubmits; i++) {
+    if (evs[i] != ABT_EVENTUAL_NULL)
+      TEST_CHECK_INT(icrmq_wait(&evs[i], &res), ICRM_FAILURE);
+  }
+
+  TEST_CHECK_INT(icrmq_submit_release(queue, NULL, TEST_JOBID, 1, &evs[0]), ICRM_EPARAM);
+  TEST_CHECK_INT(icrmq_submit_release(queue, "node1", 0, 1, &evs[0]), ICRM_EPARAM);
+
+  free(evs);
+}
+
+
+static void
+setenv_int(const char *name, int value)
+{
+  char buf[16];
+  snprintf(buf, sizeof(buf), "%d", value);
+  TEST_ASSERT(setenv(name, buf, 1) == 0);
+}
+
+
+int
+main(void)
+{
+  /* read by the mock on the first Slurm call */
+  setenv("MOCKSLURM_NODES", TEST_NODES, 1);
+  setenv_int("MOCKSLURM_CPUS", TEST_NCPUS);
+  setenv_int("MOCKSLURM_LATENCY", TEST_LATENCY_MS);
+  setenv_int("SLURM_JOB_ID", TEST_JOBID);
+  setenv_int("SLURM_JOB_NUM_NODES", TEST_NNODES);
+
+  ABT_init(0, NULL);
+  icrm_init();
+
+  /* the workers make blocking calls, they get execution streams of their own */
+  TEST_ASSERT(ABT_pool_create_basic(ABT_POOL_FIFO_WAIT, ABT_POOL_ACCESS_MPMC,
+                                    ABT_TRUE, &pool) == ABT_SUCCESS);
+  for (size_t i = 0; i < TEST_NWORKERS; i++)
+    TEST_ASSERT(ABT_xstream_create_basic(ABT_SCHED_BASIC_WAIT, 1, &pool,
+                                         ABT_SCHED_CONFIG_NULL, &xstreams[i]) == ABT_SUCCESS);
+  TEST_ASSERT(icrmq_init(&queue, pool, TEST_NWORKERS) == ICRM_SUCCESS);
+  TEST_ASSERT(ABT_rwlock_create(&hostlock) == ABT_SUCCESS);
+
+  TEST_RUN(test_alloc);
+  TEST_RUN(test_hold);
+  TEST_RUN(test_full);
+
+  icrmq_fini(&queue);
+  TEST_CHECK(queue == NULL);
+  ABT_rwlock_free(&hostlock);
+  for (size_t i = 0; i < TEST_NWORKERS; i++) {
+    ABT_xstream_join(xstreams[i]);
+    ABT_xstream_free(&xstreams[i]);
+  }
+  icrm_fini();
+  ABT_finalize();
+
+  return TEST_EXIT();
+}
@@ -0,0 +1,397 @@
+/**
+ * Statistics tests: every value falls in a bucket no wider than 1/16
+ * of it, quantiles are within that error of the exact ones, counts and
+ * sums are exact under concurrent recording, gauges keep their
+ * maximum, and the summary and Prometheus texts hold what was
+ * recorded. The exporter writes its file and answers on its socket.
+ *
+ * icstats.c is included for its bucket functions.
+ *
+ * Usage: test_icstats [NRECORDS]
+ */
+#include "../src/icstats.c"
+
+#include <sys/stat.h>           /* stat */
+#include <abt.h>
+
+#include "tests.h"
+
+static size_t nrecords;
+
+static uint64_t seed = 0x2545f4914f6cdd1dULL;
+
+
+static uint64_t
+rnd(void)
+{
+  seed ^= seed >> 12;
+  seed ^= seed << 25;
+  seed ^= seed >> 27;
+  return seed * 2685821657736338717ULL;
+}
+
+
+static int
+cmp_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+
+static void
+test_buckets(void)
+{
+  unsigned last = 0;
+
+  for (uint64_t v = 0; v < 100000; v++) {
+    unsigned i = bucket_index(v);
+    TEST_ASSERT(i < ICSTATS_NBUCKETS);
+    TEST_CHECK(i >= last);
+    TEST_CHECK(bucket_low(i) <= v && v < bucket_low(i) + bucket_width(i));
+    last = i;
+  }
+
+  for (int k = 0; k < 100000; k++) {
+    uint64_t v = rnd() >> (rnd() % 64);
+    unsigned i = bucket_index(v);
+    TEST_ASSERT(i < ICSTATS_NBUCKETS);
+    if (v >= UINT64_C(1) << ICSTATS_MAX_BITS) {
+      TEST_CHECK_INT(i, ICSTATS_NBUCKETS - 1);
+      continue;
+    }
+    TEST_CHECK(bucket_low(i) <= v && v < bucket_low(i) + bucket_width(i));
+    TEST_CHECK(v < ICSTATS_SUB || bucket_width(i) * ICSTATS_SUB <= v);
+  }
+
+  /* buckets follow each other */
+  for (unsigned i = 1; i < ICSTATS_NBUCKETS; i++)
+    TEST_CHECK_INT(bucket_low(i), bucket_low(i - 1) + bucket_width(i - 1));
+}
+
+
+/* HIST has the N values of V, check its quantiles against theirs */
+static void
+check_quantiles(const struct icstats_hist *hist, uint64_t *v, size_t n)
+{
+  static const double qs[] = { 0.01, 0.1, 0.5, 0.9, 0.99, 0.999, 1 };
+
+  qsort(v, n, sizeof(*v), cmp_u64);
+  for (size_t i = 0; i < sizeof(qs) / sizeof(qs[0]); i++) {
+    size_t rank = (size_t)(qs[i] * n + 0.5);
+    uint64_t exact = v[rank ? rank - 1 : 0];
+    uint64_t est = icstats_quantile(hist, qs[i]);
+    double err = exact ? ((double)est - exact) / exact : est;
+    if (err < 0)
+      err = -err;
+    if (err > 1.0 / ICSTATS_SUB) {
+      fprintf(stderr, "q%g: %"PRIu64" for %"PRIu64"\n", qs[i], est, exact);
+      test_nfailed++;
+    }
+  }
+}
+
+
+static void
+test_quantiles(void)
+{
+  uint64_t *v = malloc(nrecords * sizeof(*v));
+  uint64_t sum = 0, max = 0;
+  TEST_ASSERT(v);
+
+  struct icstats_hist *h = icstats_hist("test", "quantiles");
+  TEST_ASSERT(h);
+  TEST_CHECK_INT(icstats_quantile(h, 0.5), 0);
+
+  /* log-uniform, from ns to seconds */
+  for (size_t i = 0; i < nrecords; i++) {
+    v[i] = (rnd() % 1000 + 1) << (rnd() % 30);
+    sum += v[i];
+    max = v[i] > max ? v[i] : max;
+    icstats_record(h, v[i]);
+  }
+  TEST_CHECK_INT(h->count, nrecords);
+  TEST_CHECK_INT(h->sum, sum);
+  TEST_CHECK_INT(h->max, max);
+  TEST_CHECK(icstats_quantile(h, 1) <= max);
+  check_quantiles(h, v, nrecords);
+
+  /* one value */
+  struct icstats_hist *one = icstats_hist("test", "one");
+  TEST_ASSERT(one);
+  icstats_record(one, 1234567);
+  TEST_CHECK_INT(icstats_quantile(one, 0), icstats_quantile(one, 1));
+  TEST_CHECK(icstats_quantile(one, 1) <= 1234567);
+  TEST_CHECK(icstats_quantile(one, 1) >= 1234567 - 1234567 / ICSTATS_SUB);
+
+  /* past the clamp */
+  icstats_record(one, UINT64_MAX);
+  TEST_CHECK_INT(one->buckets[ICSTATS_NBUCKETS - 1], 1);
+
+  icstats_record(NULL, 1);
+  TEST_CHECK_INT(icstats_quantile(NULL, 0.5), 0);
+  free(v);
+}
+
+
+static void
+test_registry(void)
+{
+  struct icstats_hist *a = icstats_hist("test", "a");
+  struct icstats_hist *b = icstats_hist("test", "b");
+  struct icstats_hist *a2 = icstats_hist("other", "a");
+
+  TEST_ASSERT(a && b && a2);
+  TEST_CHECK(a != b && a != a2);
+  TEST_CHECK(icstats_hist("test", "a") == a);
+  TEST_CHECK(icstats_gauge("test", "a") != NULL);
+  TEST_CHECK(icstats_gauge("test", "a") == icstats_gauge("test", "a"));
+
+  for (int i = 0; i < 3; i++)
+    TEST_CHECK(ICSTATS_HIST("test", "a") == a);
+
+  /* a scope records its duration when it ends */
+  struct icstats_hist *s = icstats_hist("test", "scope");
+  TEST_ASSERT(s);
+  {
+    ICSTATS_SCOPE("test", "scope");
+    test_sleep_ms(10);
+  }
+  TEST_CHECK_INT(s->count, 1);
+  TEST_CHECK(s->sum >= 10000000);
+}
+
+
+static void
+test_gauges(void)
+{
+  struct icstats_gauge *g = icstats_gauge("test", "depth");
+  struct icstats_hist *h = icstats_hist("test", "reset");
+  TEST_ASSERT(g && h);
+
+  for (int i = 0; i < 10; i++)
+    icstats_gauge_add(g, 1);
+  icstats_gauge_add(g, -7);
+  TEST_CHECK_INT(g->value, 3);
+  TEST_CHECK_INT(g->max, 10);
+  icstats_gauge_add(NULL, 1);
+
+  icstats_record(h, 100);
+  icstats_reset();
+  TEST_CHECK_INT(g->value, 3);
+  TEST_CHECK_INT(g->max, 3);
+  TEST_CHECK_INT(h->count, 0);
+  TEST_CHECK_INT(h->sum, 0);
+  TEST_CHECK_INT(h->max, 0);
+  TEST_CHECK_INT(icstats_quantile(h, 0.5), 0);
+}
+
+
+static void
+test_summary(void)
+{
+  struct icstats_hist *h = icstats_hist("test", "summary");
+  struct icstats_gauge *g = icstats_gauge("test", "summary");
+  TEST_ASSERT(h && g);
+
+  for (uint64_t v = 1; v <= 100; v++)
+    icstats_record(h, v * 1000);
+  icstats_gauge_add(g, 5);
+  icstats_gauge_add(g, -2);
+
+  char *text;
+  TEST_ASSERT(icstats_summary(&text) == 0);
+
+  int foundh = 0, foundg = 0;
+  char *saveptr;
+  for (char *line = strtok_r(text, "\n", &saveptr); line;
+       line = strtok_r(NULL, "\n", &saveptr)) {
+    uint64_t count, sum, max, p50, p90, p99, p999;
+    int64_t value, gmax;
+
+    if (sscanf(line, "hist test summary %"SCNu64" %"SCNu64" %"SCNu64" %"SCNu64
+               " %"SCNu64" %"SCNu64" %"SCNu64, &count, &sum, &max, &p50, &p90,
+               &p99, &p999) == 7) {
+      foundh++;
+      TEST_CHECK_INT(count, 100);
+      TEST_CHECK_INT(sum, 5050000);
+      TEST_CHECK_INT(max, 100000);
+      TEST_CHECK(p50 >= 47000 && p50 <= 53000);
+      TEST_CHECK(p50 <= p90 && p90 <= p99 && p99 <= p999 && p999 <= max);
+    } else if (sscanf(line, "gauge test summary %"SCNd64" %"SCNd64, &value, &gmax) == 2) {
+      foundg++;
+      TEST_CHECK_INT(value, 3);
+      TEST_CHECK_INT(gmax, 5);
+    } else {
+      TEST_CHECK(!strncmp(line, "hist ", 5) || !strncmp(line, "gauge ", 6));
+    }
+  }
+  TEST_CHECK_INT(foundh, 1);
+  TEST_CHECK_INT(foundg, 1);
+  free(text);
+}
+
+
+static void
+test_prometheus(void)
+{
+  char *text = NULL;
+  size_t len;
+
+  /* interleaved families */
+  struct icstats_hist *x = icstats_hist("promA", "x");
+  TEST_ASSERT(icstats_hist("promB", "y"));
+  struct icstats_hist *z = icstats_hist("promA", "z");
+  TEST_ASSERT(x && z);
+  for (uint64_t v = 0; v < 1000; v++)
+    icstats_record(x, v * v * 100);
+  icstats_record(z, 1);
+
+  FILE *f = open_memstream(&text, &len);
+  TEST_ASSERT(f);
+  TEST_CHECK_INT(icstats_prometheus(f), 0);
+  TEST_ASSERT(fclose(f) == 0);
+
+  int ntype = 0, nseries = 0, inA = 0, doneA = 0;
+  uint64_t last = 0, inf = 0, count = 0;
+  char *saveptr;
+  for (char *line = strtok_r(text, "\n", &saveptr); line;
+       line = strtok_r(NULL, "\n", &saveptr)) {
+    uint64_t n;
+
+    if (!strcmp(line, "# TYPE icc_promA_seconds histogram")) {
+      ntype++;
+      inA = 1;
+      continue;
+    }
+    if (!strncmp(line, "# TYPE ", 7)) {
+      doneA |= inA;
+      inA = 0;
+      continue;
+    }
+    if (!strncmp(line, "icc_promA_", 10)) {
+      TEST_CHECK(inA && !doneA);
+      nseries++;
+    }
+    if (sscanf(line, "icc_promA_seconds_bucket{name=\"x\",le=\"+Inf\"} %"SCNu64, &n) == 1) {
+      inf = n;
+    } else if (sscanf(line, "icc_promA_seconds_bucket{name=\"x\",le=\"%*[0-9.e+-]\"} %"SCNu64, &n) == 1) {
+      TEST_CHECK(n >= last);
+      last = n;
+    } else if (sscanf(line, "icc_promA_seconds_count{name=\"x\"} %"SCNu64, &n) == 1) {
+      count = n;
+    }
+  }
+  TEST_CHECK_INT(ntype, 1);
+  TEST_CHECK(nseries > 0);
+  TEST_CHECK(last <= inf);
+  TEST_CHECK_INT(inf, 1000);
+  TEST_CHECK_INT(count, 1000);
+  free(text);
+}
+
+
+struct worker_arg {
+  struct icstats_hist  *hist;
+  struct icstats_gauge *gauge;
+  size_t                id;
+};
+
+static void
+worker(void *arg)
+{
+  struct worker_arg *w = (struct worker_arg *)arg;
+
+  for (size_t i = 0; i < nrecords; i++) {
+    icstats_gauge_add(w->gauge, 1);
+    icstats_record(w->hist, w->id * nrecords + i);
+    icstats_gauge_add(w->gauge, -1);
+  }
+}
+
+
+static void
+test_concurrent(void)
+{
+  struct worker_arg args[8];
+  struct icstats_hist *h = icstats_hist("test", "concurrent");
+  struct icstats_gauge *g = icstats_gauge("test", "concurrent");
+  TEST_ASSERT(h && g);
+
+  for (size_t i = 0; i < 8; i++)
+    args[i] = (struct worker_arg){ h, g, i };
+  TEST_ASSERT(test_xstreams_run(8, worker, args, sizeof(args[0])) == 0);
+
+  uint64_t n = 8 * nrecords, total = 0;
+  TEST_CHECK_INT(h->count, n);
+  TEST_CHECK_INT(h->sum, n * (n - 1) / 2);
+  TEST_CHECK_INT(h->max, n - 1);
+  for (unsigned i = 0; i < ICSTATS_NBUCKETS; i++)
+    total += h->buckets[i];
+  TEST_CHECK_INT(total, n);
+  TEST_CHECK_INT(g->value, 0);
+  TEST_CHECK(g->max >= 1 && g->max <= 8);
+}
+
+
+static void
+test_export(void)
+{
+  char dir[] = "/tmp/test_icstatsXXXXXX", file[64], sock[64], buf[4096];
+  struct sockaddr_un sa = { .sun_family = AF_UNIX };
+  struct stat st;
+
+  TEST_ASSERT(mkdtemp(dir));
+  snprintf(file, sizeof(file), "%s/metrics", dir);
+  snprintf(sock, sizeof(sock), "%s/sock", dir);
+
+  TEST_CHECK_INT(icstats_export_start(NULL, NULL, 1), -1);
+  TEST_ASSERT(icstats_export_start(file, sock, 1) == 0);
+  TEST_CHECK_INT(icstats_export_start(file, sock, 1), -1);
+
+  /* written as the thread starts */
+  for (int i = 0; i < 100 && stat(file, &st); i++)
+    test_sleep_ms(10);
+  TEST_CHECK(stat(file, &st) == 0 && st.st_size > 0);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  TEST_ASSERT(fd != -1);
+  strcpy(sa.sun_path, sock);
+  TEST_ASSERT(connect(fd, (struct sockaddr *)&sa, sizeof(sa)) == 0);
+  size_t len = 0;
+  ssize_t n;
+  while ((n = read(fd, buf + len, sizeof(buf) - 1 - len)) > 0)
+    len += n;
+  buf[len] = '\0';
+  close(fd);
+  TEST_CHECK(strstr(buf, "# TYPE icc_test_seconds histogram") != NULL);
+
+  icstats_export_stop();
+  TEST_CHECK(stat(sock, &st) == -1);
+  icstats_export_stop();
+
+  unlink(file);
+  rmdir(dir);
+}
+
+
+int
+main(int argc, char **argv)
+{
+  nrecords = test_size_arg(argc, argv, 1, 100000);
+
+  ABT_init(0, NULL);
+
+  TEST_RUN(test_buckets);
+  TEST_RUN(test_quantiles);
+  TEST_RUN(test_registry);
+  TEST_RUN(test_gauges);
+  TEST_RUN(test_summary);
+  TEST_RUN(test_prometheus);
+  TEST_RUN(test_concurrent);
+  TEST_RUN(test_export);
+
+  ABT_finalize();
+
+  return TEST_EXIT();
+}
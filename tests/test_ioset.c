@@ -0,0 +1,374 @@
+/**
+ * IO-set lease tests: an application whose lease expired is revoked
+ * and the next one waiting for its set, or for admission, is granted.
+ * Asking again renews the lease, time waiting for admission does not
+ * count, and a grant counts at most 16 slices. Then a simulation of
+ * applications dying while granted or queued, in exclusive and budget
+ * modes, checks that every dead application is revoked, no live one
+ * is, and the queues drain. A revoked application restarts.
+ *
+ * Usage: test_ioset [NSTEPS]
+ */
+#include "ioset.h"
+#include "tests.h"
+
+#define LEASE 1000              /* ns per slice */
+
+static size_t nsteps;
+
+struct revoked {
+  size_t   n;
+  uint32_t jobid;
+};
+
+static void
+revoke(void *arg, uint32_t jobid, uint32_t jobstepid, uint32_t witer)
+{
+  struct revoked *rv = (struct revoked *)arg;
+  (void)jobstepid;
+  (void)witer;
+  rv->n++;
+  rv->jobid = jobid;
+}
+
+
+static void
+check_stats(struct ioset_sched *s, size_t running, size_t nsets, size_t setwaiting,
+            size_t waiting)
+{
+  struct ioset_sched_stats st;
+
+  ioset_sched_stats(s, &st);
+  TEST_CHECK_INT(st.running, running);
+  TEST_CHECK_INT(st.nsets, nsets);
+  TEST_CHECK_INT(st.setwaiting, setwaiting);
+  TEST_CHECK_INT(st.waiting, waiting);
+}
+
+
+static void
+test_expire_set(void)
+{
+  struct ioset_sched *s;
+  struct ioset_req a = { .jobid = 1, .witer = 10 }, b = { .jobid = 2, .witer = 10 };
+  struct revoked rv = { 0 };
+  struct ioset_sched_stats st;
+
+  TEST_ASSERT(ioset_sched_init(&s, 0, LEASE) == 0);
+
+  TEST_CHECK_INT(ioset_begin(s, &a, 0), IOSET_GRANTED);
+  TEST_CHECK_INT(a.nslices, 1);
+  TEST_CHECK_INT(ioset_begin(s, &b, 10), IOSET_QUEUED);
+  check_stats(s, 1, 1, 1, 0);
+
+  /* not yet */
+  TEST_CHECK(ioset_expire(s, LEASE - 1, revoke, &rv) == NULL);
+  TEST_CHECK_INT(rv.n, 0);
+
+  /* A died, B gets the set */
+  struct ioset_req *granted = ioset_expire(s, LEASE, revoke, &rv);
+  TEST_CHECK(granted == &b);
+  TEST_CHECK(granted && granted->next == NULL);
+  TEST_CHECK_INT(rv.n, 1);
+  TEST_CHECK_INT(rv.jobid, 1);
+  check_stats(s, 1, 1, 0, 0);
+  ioset_sched_stats(s, &st);
+  TEST_CHECK_INT(st.revoked, 1);
+
+  /* A coming back late changes nothing */
+  TEST_CHECK(ioset_end(s, 1, 0, 10, 1, LEASE + 1) == NULL);
+  check_stats(s, 1, 1, 0, 0);
+
+  /* B's lease starts at its grant */
+  TEST_CHECK(ioset_expire(s, 2 * LEASE - 1, revoke, &rv) == NULL);
+  TEST_CHECK_INT(rv.n, 1);
+  TEST_CHECK(ioset_end(s, 2, 0, 10, 1, 2 * LEASE - 1) == NULL);
+  check_stats(s, 0, 0, 0, 0);
+  TEST_CHECK(ioset_expire(s, 100 * LEASE, revoke, &rv) == NULL);
+  TEST_CHECK_INT(rv.n, 1);
+
+  ioset_sched_fini(&s);
+}
+
+
+static void
+test_expire_admission(void)
+{
+  struct ioset_sched *s;
+  struct ioset_req a = { .jobid = 1, .witer = 10 }, c = { .jobid = 3, .witer = 100 };
+  struct revoked rv = { 0 };
+
+  /* one app at a time, C holds its set but waits for A */
+  TEST_ASSERT(ioset_sched_init(&s, 0, LEASE) == 0);
+  TEST_CHECK_INT(ioset_begin(s, &a, 0), IOSET_GRANTED);
+  TEST_CHECK_INT(ioset_begin(s, &c, 0), IOSET_QUEUED);
+  check_stats(s, 1, 2, 0, 1);
+  /* A's set has 10 times the priority of C's */
+  TEST_CHECK_INT(a.nslices, 1);
+
+  /* waiting does not count, C is not revoked */
+  TEST_CHECK(ioset_expire(s, LEASE, revoke, &rv) == &c);
+  TEST_CHECK_INT(rv.n, 1);
+  TEST_CHECK_INT(rv.jobid, 1);
+  TEST_CHECK_INT(c.nslices, 1);
+  check_stats(s, 1, 1, 0, 0);
+
+  TEST_CHECK(ioset_expire(s, 2 * LEASE - 1, revoke, &rv) == NULL);
+  TEST_CHECK(ioset_expire(s, 2 * LEASE, revoke, &rv) == NULL);
+  TEST_CHECK_INT(rv.n, 2);
+  TEST_CHECK_INT(rv.jobid, 3);
+  check_stats(s, 0, 0, 0, 0);
+
+  ioset_sched_fini(&s);
+}
+
+
+static void
+test_renew(void)
+{
+  struct ioset_sched *s;
+  struct ioset_req a = { .jobid = 1, .witer = 10 };
+  struct revoked rv = { 0 };
+
+  TEST_ASSERT(ioset_sched_init(&s, 0, LEASE) == 0);
+  TEST_CHECK_INT(ioset_begin(s, &a, 0), IOSET_GRANTED);
+
+  /* asking again renews */
+  TEST_CHECK_INT(ioset_begin(s, &a, LEASE / 2), IOSET_GRANTED);
+  TEST_CHECK(ioset_expire(s, LEASE, revoke, &rv) == NULL);
+  TEST_CHECK_INT(rv.n, 0);
+
+  /* between two slices, one lease to come back */
+  TEST_CHECK(ioset_end(s, 1, 0, 10, 0, LEASE) == NULL);
+  check_stats(s, 0, 1, 0, 0);
+  TEST_CHECK(ioset_expire(s, 2 * LEASE - 1, revoke, &rv) == NULL);
+  TEST_CHECK_INT(rv.n, 0);
+  TEST_CHECK(ioset_expire(s, 2 * LEASE, revoke, &rv) == NULL);
+  TEST_CHECK_INT(rv.n, 1);
+  check_stats(s, 0, 0, 0, 0);
+
+  ioset_sched_fini(&s);
+}
+
+
+static void
+test_maxslices(void)
+{
+  struct ioset_sched *s;
+  struct ioset_req low = { .jobid = 1, .witer = 100000 }, high = { .jobid = 2, .witer = 1 };
+  struct revoked rv = { 0 };
+
+  /* both admitted on a budget */
+  TEST_ASSERT(ioset_sched_init(&s, 100, LEASE) == 0);
+  low.bandwidth = high.bandwidth = 10;
+  TEST_CHECK_INT(ioset_begin(s, &low, 0), IOSET_GRANTED);
+  TEST_CHECK_INT(ioset_begin(s, &high, 0), IOSET_GRANTED);
+  TEST_CHECK_INT(high.nslices, 100000);
+
+  /* LOW's one slice, then HIGH's 16 */
+  TEST_CHECK(ioset_expire(s, LEASE, revoke, &rv) == NULL);
+  TEST_CHECK_INT(rv.n, 1);
+  TEST_CHECK_INT(rv.jobid, 1);
+  TEST_CHECK(ioset_expire(s, 16 * LEASE - 1, revoke, &rv) == NULL);
+  TEST_CHECK_INT(rv.n, 1);
+  TEST_CHECK(ioset_expire(s, 16 * LEASE, revoke, &rv) == NULL);
+  TEST_CHECK_INT(rv.n, 2);
+  TEST_CHECK_INT(rv.jobid, 2);
+
+  ioset_sched_fini(&s);
+}
+
+
+static void
+test_nolease(void)
+{
+  struct ioset_sched *s;
+  struct ioset_req a = { .jobid = 1, .witer = 10 };
+  struct revoked rv = { 0 };
+
+  TEST_ASSERT(ioset_sched_init(&s, 0, 0) == 0);
+  TEST_CHECK_INT(ioset_begin(s, &a, 0), IOSET_GRANTED);
+  TEST_CHECK(ioset_expire(s, UINT64_MAX, revoke, &rv) == NULL);
+  TEST_CHECK_INT(rv.n, 0);
+  check_stats(s, 1, 1, 0, 0);
+  ioset_sched_fini(&s);
+}
+
+
+/* simulated applications */
+
+#define NAPPS 32
+
+enum app_state {
+  APP_IDLE,
+  APP_QUEUED,                   /* for its set or admission */
+  APP_GRANTED,
+  APP_BETWEEN,                  /* between two slices, holding its set */
+};
+
+struct app {
+  struct ioset_req req;
+  enum app_state   state;
+  int              dead;
+};
+
+static struct app apps[NAPPS];
+static size_t ndeaths, nrevoked;
+
+static uint64_t seed = 0x853c49e6748fea9bULL;
+
+static uint64_t
+rnd(void)
+{
+  seed ^= seed >> 12;
+  seed ^= seed << 25;
+  seed ^= seed >> 27;
+  return seed * 2685821657736338717ULL;
+}
+
+
+static void
+sim_revoke(void *arg, uint32_t jobid, uint32_t jobstepid, uint32_t witer)
+{
+  struct app *a = &apps[jobid];
+  (void)arg;
+  (void)jobstepid;
+  (void)witer;
+
+  TEST_ASSERT(jobid < NAPPS);
+  TEST_CHECK(a->dead);
+  TEST_CHECK(a->state == APP_GRANTED || a->state == APP_BETWEEN);
+  nrevoked++;
+
+  /* restarted */
+  a->dead = 0;
+  a->state = APP_IDLE;
+}
+
+static void
+sim_granted(struct ioset_req *r)
+{
+  for (; r; r = r->next) {
+    struct app *a = (struct app *)r->arg;
+    TEST_CHECK_INT(a->state, APP_QUEUED);
+    a->state = APP_GRANTED;
+  }
+}
+
+
+static void
+sim_run(uint64_t budget)
+{
+  struct ioset_sched *s;
+  struct ioset_sched_stats st;
+  static const uint32_t witers[] = { 1, 10, 100, 1000 };
+  uint64_t now = 0;
+
+  TEST_ASSERT(ioset_sched_init(&s, budget, LEASE) == 0);
+  ndeaths = nrevoked = 0;
+  for (size_t i = 0; i < NAPPS; i++) {
+    apps[i] = (struct app){
+      .req = {
+        .jobid = i,
+        .witer = witers[i % 4],
+        .bandwidth = budget ? rnd() % (budget / 2) : 0,
+        .arg = &apps[i],
+      },
+    };
+  }
+
+  /* then without deaths, until the queues drain */
+  for (size_t step = 0; step < 2 * nsteps; step++) {
+    size_t ngranted = 0;
+
+    /* the live apps never wait more than a quarter of a lease */
+    now += 1 + rnd() % (LEASE / 4);
+
+    for (size_t i = 0; i < NAPPS; i++) {
+      struct app *a = &apps[(i + step) % NAPPS];
+      uint64_t r = rnd();
+
+      if (a->dead)
+        continue;
+      if (step < nsteps && r % 200 == 0 && a->state != APP_IDLE) {
+        a->dead = 1;
+        ndeaths++;
+        continue;
+      }
+
+      switch (a->state) {
+      case APP_IDLE:
+        if (step >= nsteps || r % 4)
+          break;
+        /* fall through */
+      case APP_BETWEEN: {
+        int rc = ioset_begin(s, &a->req, now);
+        TEST_ASSERT(rc != -1);
+        a->state = rc == IOSET_GRANTED ? APP_GRANTED : APP_QUEUED;
+        break;
+      }
+      case APP_GRANTED: {
+        /* end of a slice, or of the IO phase */
+        int iterflag = step >= nsteps || r % 3 == 0;
+        a->state = iterflag ? APP_IDLE : APP_BETWEEN;
+        sim_granted(ioset_end(s, a->req.jobid, 0, a->req.witer, iterflag, now));
+        break;
+      }
+      case APP_QUEUED:
+        break;
+      }
+    }
+
+    sim_granted(ioset_expire(s, now, sim_revoke, NULL));
+
+    for (size_t i = 0; i < NAPPS; i++)
+      ngranted += apps[i].state == APP_GRANTED;
+    ioset_sched_stats(s, &st);
+    TEST_CHECK_INT(st.running, ngranted);
+    TEST_CHECK(budget == 0 ? st.running <= 1 : st.used <= budget);
+  }
+
+  /* every dead app had come to the front and was revoked */
+  for (size_t i = 0; i < NAPPS; i++) {
+    TEST_CHECK(!apps[i].dead);
+    TEST_CHECK_INT(apps[i].state, APP_IDLE);
+  }
+  TEST_CHECK(ndeaths > 0);
+  TEST_CHECK_INT(nrevoked, ndeaths);
+  check_stats(s, 0, 0, 0, 0);
+  ioset_sched_stats(s, &st);
+  TEST_CHECK_INT(st.revoked, ndeaths);
+  TEST_CHECK_INT(st.used, 0);
+
+  ioset_sched_fini(&s);
+}
+
+
+static void
+test_sim_exclusive(void)
+{
+  sim_run(0);
+}
+
+static void
+test_sim_budget(void)
+{
+  sim_run(400);
+}
+
+
+int
+main(int argc, char **argv)
+{
+  nsteps = test_size_arg(argc, argv, 1, 20000);
+
+  TEST_RUN(test_expire_set);
+  TEST_RUN(test_expire_admission);
+  TEST_RUN(test_renew);
+  TEST_RUN(test_maxslices);
+  TEST_RUN(test_nolease);
+  TEST_RUN(test_sim_exclusive);
+  TEST_RUN(test_sim_budget);
+
+  return TEST_EXIT();
+}
@@ -0,0 +1,417 @@
+/**
+ * IO-set trace tests: the records appended are written out by the
+ * writer ULT and read back by the icc_iotrace converter, records are
+ * dropped while their ring is full, files are rotated past their
+ * maximum size with IOTRACE_KEEP of them kept, a failed
+ * initialization is undone, and the converter refuses the files of
+ * another version.
+ *
+ * iotrace.c is included with its Margo calls redirected, so that the
+ * writer ULT only goes through its loop when the test ticks it, and
+ * with the allocations failing on demand. iotracecat.c is included
+ * for its reader.
+ */
+#include <errno.h>
+#include <getopt.h>             /* optind */
+#include <stdio.h>
+#include <stdlib.h>             /* calloc */
+#include <string.h>
+#include <unistd.h>             /* access, rmdir */
+#include <margo.h>
+
+#include "tests.h"
+
+#define TEST_NRECS     100
+#define TEST_PERFILE   8        /* records per rotated file */
+#define TEST_NROUNDS   (IOTRACE_KEEP + 2)
+
+static unsigned calloc_fail;    /* fail the N-th calloc, if not 0 */
+
+static ABT_pool    writer_pool;
+static ABT_xstream writer_xstream;
+static ABT_mutex   tick_mutex;
+static ABT_cond    tick_cond;
+static uint64_t    ticks;       /* writer loops allowed */
+static uint64_t    nsleeps;     /* writer loops done */
+
+
+static void *
+mock_calloc(size_t n, size_t size)
+{
+  if (calloc_fail && --calloc_fail == 0)
+    return NULL;
+  return calloc(n, size);
+}
+
+static int
+mock_get_handler_pool(margo_instance_id mid, ABT_pool *pool)
+{
+  (void)mid;
+  *pool = writer_pool;
+  return 0;
+}
+
+/* the writer sleeps until ticked */
+static void
+mock_thread_sleep(margo_instance_id mid, double ms)
+{
+  (void)mid;
+  (void)ms;
+
+  ABT_mutex_lock(tick_mutex);
+  nsleeps++;
+  ABT_cond_broadcast(tick_cond);
+  while (nsleeps > ticks)
+    ABT_cond_wait(tick_cond, tick_mutex);
+  ABT_mutex_unlock(tick_mutex);
+}
+
+static int
+mock_push_prefinalize_callback(margo_instance_id mid, margo_finalize_callback_t cb, void *arg)
+{
+  (void)mid;
+  (void)cb;
+  (void)arg;
+  return 0;
+}
+
+static void
+mock_log(margo_instance_id mid, const char *fmt, ...)
+{
+  (void)mid;
+  (void)fmt;
+}
+
+#define calloc mock_calloc
+#undef margo_get_handler_pool
+#define margo_get_handler_pool mock_get_handler_pool
+#undef margo_thread_sleep
+#define margo_thread_sleep mock_thread_sleep
+#undef margo_push_prefinalize_callback
+#define margo_push_prefinalize_callback mock_push_prefinalize_callback
+#undef margo_error
+#define margo_error mock_log
+#undef margo_info
+#define margo_info mock_log
+
+#include "../src/iotrace.c"
+
+#undef calloc
+#define main iotracecat_main
+#include "../examples/iotracecat.c"
+#undef main
+
+static char dir[] = "/tmp/test_iotrace.XXXXXX";
+static char path[256];
+
+
+static struct iotrace_rec
+test_rec(uint32_t jobid, uint32_t i)
+{
+  struct iotrace_rec rec = {
+    .waitstart = 1000 * i,
+    .iostart = 1000 * i + 10,
+    .ioend = 1000 * i + 500,
+    .nbytes = 4096 * (uint64_t)i,
+    .jobid = jobid,
+    .jobstepid = i,
+    .witer = 2,
+    .setid = -1,
+    .nslices = 1,
+    .type = i % 2 ? IOTRACE_REVOKED : IOTRACE_PHASE,
+  };
+
+  return rec;
+}
+
+
+/* let the writer go once more through its loop: write out the
+   pending records and rotate if needed */
+static void
+tick(void)
+{
+  ABT_mutex_lock(tick_mutex);
+  ticks++;
+  ABT_cond_broadcast(tick_cond);
+  while (nsleeps <= ticks)
+    ABT_cond_wait(tick_cond, tick_mutex);
+  ABT_mutex_unlock(tick_mutex);
+}
+
+
+/* start tracing to PATH, the writer asleep */
+static void
+init(struct iotrace **t, uint64_t maxsize, unsigned nrings)
+{
+  TEST_ASSERT(iotrace_init(t, MARGO_INSTANCE_NULL, path, maxsize, nrings) == 0);
+
+  ABT_mutex_lock(tick_mutex);
+  while (nsleeps == 0)
+    ABT_cond_wait(tick_cond, tick_mutex);
+  ABT_mutex_unlock(tick_mutex);
+}
+
+
+/* let the writer go, for iotrace_fini to stop it */
+static void
+fini(struct iotrace **t)
+{
+  ABT_mutex_lock(tick_mutex);
+  ticks = UINT64_MAX;
+  ABT_cond_broadcast(tick_cond);
+  ABT_mutex_unlock(tick_mutex);
+
+  iotrace_fini(t);
+  ticks = nsleeps = 0;
+}
+
+
+/* read the records of FILE with the converter, return their number */
+static size_t
+read_back(const char *file, struct iotrace_rec **recs)
+{
+  size_t n = 0, cap = 0;
+
+  *recs = NULL;
+  TEST_CHECK_INT(read_trace(file, recs, &n, &cap), 0);
+  return n;
+}
+
+
+static void
+remove_traces(void)
+{
+  char file[sizeof(path) + 16];
+
+  unlink(path);
+  for (int i = 1; i <= IOTRACE_KEEP + 1; i++) {
+    snprintf(file, sizeof(file), "%s.%d", path, i);
+    unlink(file);
+  }
+}
+
+
+static void
+test_append(void)
+{
+  struct iotrace *t;
+  struct iotrace_stats s;
+  struct iotrace_rec *recs;
+
+  init(&t, 0, 2);
+
+  for (uint32_t i = 0; i < TEST_NRECS; i++) {
+    struct iotrace_rec rec = test_rec(1, i);
+    TEST_CHECK_INT(iotrace_append(t, &rec), 0);
+  }
+  tick();
+
+  iotrace_stats(t, &s);
+  TEST_CHECK_INT(s.appended, TEST_NRECS);
+  TEST_CHECK_INT(s.dropped, 0);
+  TEST_CHECK_INT(s.written, TEST_NRECS);
+  TEST_CHECK_INT(s.rotations, 0);
+
+  /* the pending ones are written out at the end */
+  struct iotrace_rec last = test_rec(1, TEST_NRECS);
+  TEST_CHECK_INT(iotrace_append(t, &last), 0);
+  fini(&t);
+  TEST_CHECK(t == NULL);
+
+  TEST_CHECK_INT(read_back(path, &recs), TEST_NRECS + 1);
+  for (uint32_t i = 0; recs && i <= TEST_NRECS; i++) {
+    struct iotrace_rec rec = test_rec(1, i);
+    TEST_CHECK(memcmp(&recs[i], &rec, sizeof(rec)) == 0);
+  }
+  free(recs);
+  remove_traces();
+}
+
+
+static void
+test_full(void)
+{
+  struct iotrace *t;
+  struct iotrace_stats s;
+  struct iotrace_rec rec, *recs;
+
+  init(&t, 0, 1);
+
+  /* the writer does not run meanwhile */
+  for (uint32_t i = 0; i < IOTRACE_RINGSIZE; i++) {
+    rec = test_rec(1, i);
+    TEST_CHECK_INT(iotrace_append(t, &rec), 0);
+  }
+  rec = test_rec(2, 0);
+  TEST_CHECK_INT(iotrace_append(t, &rec), -1);
+
+  iotrace_stats(t, &s);
+  TEST_CHECK_INT(s.appended, IOTRACE_RINGSIZE);
+  TEST_CHECK_INT(s.dropped, 1);
+
+  /* room again once drained */
+  tick();
+  rec = test_rec(3, 0);
+  TEST_CHECK_INT(iotrace_append(t, &rec), 0);
+  fini(&t);
+
+  TEST_CHECK_INT(read_back(path, &recs), IOTRACE_RINGSIZE + 1);
+  if (recs) {
+    TEST_CHECK_INT(recs[IOTRACE_RINGSIZE - 1].jobid, 1);
+    TEST_CHECK_INT(recs[IOTRACE_RINGSIZE].jobid, 3);
+  }
+  free(recs);
+  remove_traces();
+}
+
+
+static void
+test_rotate(void)
+{
+  const uint64_t maxsize = sizeof(struct iotrace_header)
+    + TEST_PERFILE * sizeof(struct iotrace_rec);
+  char file[sizeof(path) + 16];
+  struct iotrace *t;
+  struct iotrace_stats s;
+  struct iotrace_rec *recs;
+
+  init(&t, maxsize, 1);
+
+  /* one file per round, the writer rotates once it is full */
+  for (uint32_t round = 0; round < TEST_NROUNDS; round++) {
+    for (uint32_t i = 0; i < TEST_PERFILE; i++) {
+      struct iotrace_rec rec = test_rec(round, i);
+      TEST_CHECK_INT(iotrace_append(t, &rec), 0);
+    }
+    tick();
+  }
+
+  iotrace_stats(t, &s);
+  TEST_CHECK_INT(s.written, TEST_NROUNDS * TEST_PERFILE);
+  TEST_CHECK_INT(s.rotations, TEST_NROUNDS);
+  fini(&t);
+
+  /* a new file with its header only, then the last rounds first */
+  TEST_CHECK_INT(read_back(path, &recs), 0);
+  free(recs);
+
+  for (int i = 1; i <= IOTRACE_KEEP; i++) {
+    snprintf(file, sizeof(file), "%s.%d", path, i);
+    TEST_CHECK_INT(read_back(file, &recs), TEST_PERFILE);
+    if (recs) {
+      TEST_CHECK_INT(recs[0].jobid, TEST_NROUNDS - i);
+      TEST_CHECK_INT(recs[TEST_PERFILE - 1].jobstepid, TEST_PERFILE - 1);
+    }
+    free(recs);
+  }
+
+  snprintf(file, sizeof(file), "%s.%d", path, IOTRACE_KEEP + 1);
+  TEST_CHECK(access(file, F_OK) == -1 && errno == ENOENT);
+
+  remove_traces();
+}
+
+
+/* the converter takes the files of its own version only */
+static void
+test_version(void)
+{
+  struct iotrace *t;
+  struct iotrace_header h;
+  struct iotrace_rec rec = test_rec(1, 0), *recs;
+  char *argv[] = { "icc_iotrace", path, NULL };
+  FILE *f;
+
+  init(&t, 0, 1);
+  TEST_CHECK_INT(iotrace_append(t, &rec), 0);
+  fini(&t);
+
+  f = fopen(path, "r+");
+  TEST_ASSERT(f);
+  TEST_ASSERT(fread(&h, sizeof(h), 1, f) == 1);
+  TEST_CHECK_STR(h.magic, IOTRACE_MAGIC);
+  TEST_CHECK_INT(h.version, IOTRACE_VERSION);
+  TEST_CHECK_INT(h.recsize, sizeof(struct iotrace_rec));
+
+  optind = 1;
+  TEST_CHECK_INT(iotracecat_main(2, argv), EXIT_SUCCESS);
+  fflush(stdout);
+
+  /* a later version */
+  h.version++;
+  TEST_ASSERT(fseek(f, 0, SEEK_SET) == 0);
+  TEST_ASSERT(fwrite(&h, sizeof(h), 1, f) == 1);
+  TEST_ASSERT(fflush(f) == 0);
+
+  size_t n = 0, cap = 0;
+  recs = NULL;
+  TEST_CHECK_INT(read_trace(path, &recs, &n, &cap), -1);
+  TEST_CHECK_INT(n, 0);
+  optind = 1;
+  TEST_CHECK_INT(iotracecat_main(2, argv), EXIT_FAILURE);
+
+  /* not a trace */
+  h.version--;
+  h.magic[0] = 'X';
+  TEST_ASSERT(fseek(f, 0, SEEK_SET) == 0);
+  TEST_ASSERT(fwrite(&h, sizeof(h), 1, f) == 1);
+  fclose(f);
+  TEST_CHECK_INT(read_trace(path, &recs, &n, &cap), -1);
+
+  free(recs);
+  remove_traces();
+}
+
+
+/* a ring that cannot be allocated, the others are freed */
+static void
+test_init_error(void)
+{
+  struct iotrace *t;
+
+  /* the trace, its rings, then the cells of the rings */
+  calloc_fail = 4;
+  TEST_CHECK_INT(iotrace_init(&t, MARGO_INSTANCE_NULL, path, 0, 4), -1);
+  TEST_CHECK(t == NULL);
+  TEST_CHECK_INT(calloc_fail, 0);
+
+  /* before the rings */
+  calloc_fail = 2;
+  TEST_CHECK_INT(iotrace_init(&t, MARGO_INSTANCE_NULL, path, 0, 4), -1);
+  TEST_CHECK(t == NULL);
+
+  calloc_fail = 0;
+  TEST_CHECK(access(path, F_OK) == -1);
+}
+
+
+int
+main(void)
+{
+  TEST_ASSERT(mkdtemp(dir));
+  snprintf(path, sizeof(path), "%s/trace", dir);
+
+  ABT_init(0, NULL);
+
+  TEST_ASSERT(ABT_pool_create_basic(ABT_POOL_FIFO_WAIT, ABT_POOL_ACCESS_MPMC,
+                                    ABT_TRUE, &writer_pool) == ABT_SUCCESS);
+  TEST_ASSERT(ABT_xstream_create_basic(ABT_SCHED_BASIC_WAIT, 1, &writer_pool,
+                                       ABT_SCHED_CONFIG_NULL, &writer_xstream) == ABT_SUCCESS);
+  TEST_ASSERT(ABT_mutex_create(&tick_mutex) == ABT_SUCCESS);
+  TEST_ASSERT(ABT_cond_create(&tick_cond) == ABT_SUCCESS);
+
+  TEST_RUN(test_append);
+  TEST_RUN(test_full);
+  TEST_RUN(test_rotate);
+  TEST_RUN(test_version);
+  TEST_RUN(test_init_error);
+
+  ABT_cond_free(&tick_cond);
+  ABT_mutex_free(&tick_mutex);
+  ABT_xstream_join(writer_xstream);
+  ABT_xstream_free(&writer_xstream);
+  ABT_finalize();
+  rmdir(dir);
+
+  return TEST_EXIT();
+}
@@ -0,0 +1,250 @@
+/**
+ * Stream consumer tests: delivery order, consumer groups sharing a
+ * stream, and the latency from an XADD on another connection to the
+ * handler.
+ *
+ * Usage: test_mstream [NENTRIES]
+ */
+#include <abt.h>
+
+#include "mstream.h"
+#include "tests.h"
+#include "testdb.h"
+
+#define TEST_STREAM "test:mstream"
+#define TEST_GROUP  "test-group"
+
+/* time given to an entry to reach its handler */
+#define DELIVERY_TIMEOUT_MS 5000
+
+struct recv {
+  size_t    n;              /* entries delivered, atomically */
+  size_t    nmax;
+  uint64_t *at;             /* delivery time of each seq */
+  unsigned *count;          /* deliveries of each seq */
+  size_t    outoforder;
+  long long lastseq;
+};
+
+static const char *dbaddr;
+static ABT_pool    pool;
+static ABT_xstream xstream;
+
+
+static void
+handler(const struct icdb_mstream_msg *msg, void *arg)
+{
+  struct recv *r = (struct recv *)arg;
+  uint64_t now = test_now_ns();
+
+  for (size_t i = 0; i < msg->nfields; i++) {
+    if (strcmp(msg->keys[i], "seq"))
+      continue;
+    long long seq = strtoll(msg->vals[i], NULL, 10);
+    if (seq >= 0 && (size_t)seq < r->nmax) {
+      r->at[seq] = now;
+      r->count[seq]++;
+      if (seq <= r->lastseq)
+        r->outoforder++;
+      r->lastseq = seq;
+    }
+  }
+  __atomic_add_fetch(&r->n, 1, __ATOMIC_RELEASE);
+}
+
+
+static void
+recv_init(struct recv *r, size_t nmax)
+{
+  r->n = 0;
+  r->nmax = nmax;
+  r->at = calloc(nmax, sizeof(*r->at));
+  r->count = calloc(nmax, sizeof(*r->count));
+  r->outoforder = 0;
+  r->lastseq = -1;
+  TEST_ASSERT(r->at && r->count);
+}
+
+
+static void
+recv_free(struct recv *r)
+{
+  free(r->at);
+  free(r->count);
+}
+
+
+/* wait until N entries have been delivered in total to R[0..NR-1] */
+static int
+wait_delivered(struct recv *r, size_t nr, size_t n)
+{
+  for (unsigned waited = 0; waited < DELIVERY_TIMEOUT_MS; waited++) {
+    size_t total = 0;
+    for (size_t i = 0; i < nr; i++)
+      total += __atomic_load_n(&r[i].n, __ATOMIC_ACQUIRE);
+    if (total >= n)
+      return 0;
+    test_sleep_ms(1);
+  }
+  return -1;
+}
+
+
+static int
+xadd(long long seq)
+{
+  return testdb_command("XADD "TEST_STREAM" * seq %lld fs beegfs status ok", seq);
+}
+
+
+/* entries are only delivered from the first read on, so add markers
+   until one gets through */
+static int
+warmup(struct recv *r)
+{
+  for (int i = 0; i < DELIVERY_TIMEOUT_MS / 10; i++) {
+    if (xadd(-1))
+      return -1;
+    test_sleep_ms(10);
+    if (__atomic_load_n(&r->n, __ATOMIC_ACQUIRE) > 0)
+      return 0;
+  }
+  return -1;
+}
+
+
+static void
+test_order_latency(size_t n)
+{
+  struct mstream *ms;
+  struct test_lat lat = { 0 };
+  struct recv r;
+
+  recv_init(&r, n);
+
+  TEST_ASSERT(mstream_init(&ms, MARGO_INSTANCE_NULL, pool, (char *)dbaddr,
+                           TEST_STREAM, NULL, NULL) == 0);
+  TEST_ASSERT(mstream_add_handler(ms, handler, &r) == 0);
+  TEST_ASSERT(mstream_start(ms) == 0);
+  TEST_ASSERT(warmup(&r) == 0);
+  size_t base = __atomic_load_n(&r.n, __ATOMIC_ACQUIRE);
+
+  /* one entry at a time, so that each is delivered on an idle
+     consumer */
+  for (size_t i = 0; i < n; i++) {
+    uint64_t sent = test_now_ns();
+    TEST_ASSERT(xadd(i) == 0);
+    if (wait_delivered(&r, 1, base + i + 1)) {
+      fprintf(stderr, "entry %zu not delivered\n", i);
+      test_nfailed++;
+      break;
+    }
+    test_lat_add(&lat, r.at[i] - sent);
+  }
+
+  /* and a burst, delivered in order */
+  for (size_t i = 0; i < n; i++)
+    r.count[i] = 0;
+  r.lastseq = -1;
+  base = __atomic_load_n(&r.n, __ATOMIC_ACQUIRE);
+  for (size_t i = 0; i < n; i++)
+    TEST_ASSERT(xadd(i) == 0);
+  TEST_CHECK(wait_delivered(&r, 1, base + n) == 0);
+
+  mstream_fini(&ms);
+
+  for (size_t i = 0; i < n; i++)
+    TEST_CHECK_INT(r.count[i], 1);
+  TEST_CHECK_INT(r.outoforder, 0);
+
+  test_lat_print(&lat, "XADD to handler");
+  /* the former polling loop took up to a second */
+  TEST_CHECK(lat.n == n && test_lat_pct(&lat, 50) < 100 * 1000000ULL);
+
+  test_lat_free(&lat);
+  recv_free(&r);
+  testdb_flush();
+}
+
+
+static void
+test_group(size_t n)
+{
+  struct mstream *ms[2];
+  struct recv r[2];
+  const char *consumers[2] = { "consumer-a", "consumer-b" };
+
+  for (int i = 0; i < 2; i++) {
+    recv_init(&r[i], n);
+    TEST_ASSERT(mstream_init(&ms[i], MARGO_INSTANCE_NULL, pool, (char *)dbaddr,
+                             TEST_STREAM, TEST_GROUP, consumers[i]) == 0);
+    TEST_ASSERT(mstream_add_handler(ms[i], handler, &r[i]) == 0);
+    TEST_ASSERT(mstream_start(ms[i]) == 0);
+  }
+
+  /* the group exists from mstream_init, no entry can be missed */
+  for (size_t i = 0; i < n; i++)
+    TEST_ASSERT(xadd(i) == 0);
+  TEST_CHECK(wait_delivered(r, 2, n) == 0);
+
+  for (int i = 0; i < 2; i++)
+    mstream_fini(&ms[i]);
+
+  /* each entry goes to exactly one consumer of the group */
+  for (size_t i = 0; i < n; i++)
+    TEST_CHECK_INT(r[0].count[i] + r[1].count[i], 1);
+  TEST_CHECK_INT(r[0].n + r[1].n, n);
+  TEST_CHECK_INT(r[0].outoforder + r[1].outoforder, 0);
+
+  /* a consumer restarting in the group gets no entry twice */
+  struct recv again;
+  recv_init(&again, n);
+  TEST_ASSERT(mstream_init(&ms[0], MARGO_INSTANCE_NULL, pool, (char *)dbaddr,
+                           TEST_STREAM, TEST_GROUP, consumers[0]) == 0);
+  TEST_ASSERT(mstream_add_handler(ms[0], handler, &again) == 0);
+  TEST_ASSERT(mstream_start(ms[0]) == 0);
+  TEST_ASSERT(xadd(0) == 0);
+  TEST_CHECK(wait_delivered(&again, 1, 1) == 0);
+  mstream_fini(&ms[0]);
+  TEST_CHECK_INT(again.n, 1);
+
+  recv_free(&again);
+  for (int i = 0; i < 2; i++)
+    recv_free(&r[i]);
+  testdb_flush();
+}
+
+
+static size_t nentries;
+
+static void test_order_latency_n(void) { test_order_latency(nentries); }
+static void test_group_n(void) { test_group(nentries); }
+
+
+int
+main(int argc, char **argv)
+{
+  nentries = test_size_arg(argc, argv, 1, 200);
+
+  dbaddr = testdb_start();
+  if (!dbaddr)
+    return TEST_SKIP;
+
+  ABT_init(0, NULL);
+
+  /* handlers run on an execution stream of their own */
+  TEST_ASSERT(ABT_pool_create_basic(ABT_POOL_FIFO_WAIT, ABT_POOL_ACCESS_MPMC,
+                                    ABT_TRUE, &pool) == ABT_SUCCESS);
+  TEST_ASSERT(ABT_xstream_create_basic(ABT_SCHED_BASIC_WAIT, 1, &pool,
+                                       ABT_SCHED_CONFIG_NULL, &xstream) == ABT_SUCCESS);
+
+  TEST_RUN(test_order_latency_n);
+  TEST_RUN(test_group_n);
+
+  ABT_xstream_join(xstream);
+  ABT_xstream_free(&xstream);
+  ABT_finalize();
+  testdb_stop();
+
+  return TEST_EXIT();
+}
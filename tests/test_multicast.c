@@ -0,0 +1,512 @@
+/**
+ * Multicast tree tests: rpc_multicast delivers a message to every
+ * reachable client exactly once, through a tree no deeper than
+ * planned, and accounts for every client it could not reach. Clients
+ * that are dead, whose address does not resolve or to which the RPC
+ * cannot be sent are skipped and their subtrees adopted, at every
+ * level of the tree. Allocation failures fail the clients concerned
+ * without reporting them unreachable in the address cache.
+ *
+ * The clients are simulated below the Margo calls of rpc.c and
+ * addrcache.c, which are included here with these calls redirected:
+ * an RPC to a live client runs its handler, which relays the message
+ * to its subtree with rpc_multicast as multicast_cb does, before
+ * rpc_isend returns.
+ *
+ * Usage: test_multicast [NROUNDS [SEED]]
+ */
+#include <margo.h>
+
+#include "rpc.h"
+#include "tests.h"
+
+#define MOCK_RPC_ID  42
+#define MOCK_MAXADDR 2048
+
+struct mock_client {
+  int      dead;                /* RPCs to it time out */
+  int      nolookup;            /* its address does not resolve */
+  int      nosend;              /* RPCs to it cannot be sent */
+  unsigned nreceived;
+  unsigned depth;               /* hops from the root */
+};
+
+struct mock_handle {
+  size_t      client;
+  hg_return_t hret;
+  int64_t     rc;
+};
+
+static struct mock_client clients[MOCK_MAXADDR];
+static char               addrstr[MOCK_MAXADDR][32];
+static const char        *addrs[MOCK_MAXADDR];
+
+static unsigned depth;          /* of the handler running */
+static unsigned maxdepth;
+static size_t   nrootsends;     /* RPCs sent by the root */
+static long     naddrs_held;    /* references not freed */
+static long     nhandles_held;
+static size_t   realloc_countdown; /* fail this realloc, 0 for none */
+static uint32_t code;           /* of the message sent */
+static size_t   nrounds;
+
+static uint64_t seed = 0x9e3779b97f4a7c15ULL;
+
+
+static uint64_t
+rnd(void)
+{
+  seed ^= seed >> 12;
+  seed ^= seed << 25;
+  seed ^= seed >> 27;
+  return seed * 2685821657736338717ULL;
+}
+
+
+/* Margo, as rpc.c and addrcache.c see it */
+
+static size_t
+mock_index(hg_addr_t addr)
+{
+  return (size_t)(uintptr_t)addr - 1;
+}
+
+static hg_return_t
+mock_addr_lookup(margo_instance_id mid, const char *str, hg_addr_t *addr)
+{
+  size_t i;
+  (void)mid;
+
+  if (sscanf(str, "mock:%zu", &i) != 1 || i >= MOCK_MAXADDR || clients[i].nolookup)
+    return HG_NOENTRY;
+  *addr = (hg_addr_t)(uintptr_t)(i + 1);
+  naddrs_held++;
+  return HG_SUCCESS;
+}
+
+static hg_return_t
+mock_addr_dup(margo_instance_id mid, hg_addr_t addr, hg_addr_t *newaddr)
+{
+  (void)mid;
+  *newaddr = addr;
+  naddrs_held++;
+  return HG_SUCCESS;
+}
+
+static hg_return_t
+mock_addr_free(margo_instance_id mid, hg_addr_t addr)
+{
+  (void)mid;
+  TEST_ASSERT(addr != HG_ADDR_NULL);
+  naddrs_held--;
+  return HG_SUCCESS;
+}
+
+static hg_return_t
+mock_create(margo_instance_id mid, hg_addr_t addr, hg_id_t id, hg_handle_t *handle)
+{
+  struct mock_handle *h = calloc(1, sizeof(*h));
+  (void)mid;
+
+  TEST_ASSERT(h);
+  TEST_CHECK_INT(id, MOCK_RPC_ID);
+  h->client = mock_index(addr);
+  *handle = (hg_handle_t)h;
+  nhandles_held++;
+  return HG_SUCCESS;
+}
+
+static hg_return_t
+mock_reset(hg_handle_t handle, hg_addr_t addr, hg_id_t id)
+{
+  TEST_CHECK_INT(id, MOCK_RPC_ID);
+  ((struct mock_handle *)handle)->client = mock_index(addr);
+  return HG_SUCCESS;
+}
+
+static hg_return_t
+mock_destroy(hg_handle_t handle)
+{
+  free(handle);
+  nhandles_held--;
+  return HG_SUCCESS;
+}
+
+static int64_t mock_handler(struct mock_client *c, multicast_in_t *in);
+
+static hg_return_t
+mock_iforward_timed(hg_handle_t handle, void *in, double timeout_ms, margo_request *req)
+{
+  struct mock_handle *h = (struct mock_handle *)handle;
+  struct mock_client *c = &clients[h->client];
+
+  TEST_CHECK(timeout_ms > 0);
+  nrootsends += depth == 0;
+  if (c->nosend)
+    return HG_OTHER_ERROR;
+
+  *req = (margo_request)h;
+  h->hret = c->dead ? HG_TIMEOUT : HG_SUCCESS;
+  if (!c->dead)
+    h->rc = mock_handler(c, (multicast_in_t *)in);
+  return HG_SUCCESS;
+}
+
+static hg_return_t
+mock_wait(margo_request req)
+{
+  return ((struct mock_handle *)req)->hret;
+}
+
+static hg_return_t
+mock_get_output(hg_handle_t handle, void *out)
+{
+  ((rpc_out_t *)out)->rc = ((struct mock_handle *)handle)->rc;
+  return HG_SUCCESS;
+}
+
+static hg_return_t
+mock_free_output(hg_handle_t handle, void *out)
+{
+  (void)handle;
+  (void)out;
+  return HG_SUCCESS;
+}
+
+/* unused by rpc_multicast */
+static hg_return_t
+mock_forward_timed(hg_handle_t handle, void *in, double timeout_ms)
+{
+  (void)handle;
+  (void)in;
+  (void)timeout_ms;
+  return HG_OTHER_ERROR;
+}
+
+static hg_bool_t
+mock_is_listening(margo_instance_id mid)
+{
+  (void)mid;
+  return HG_FALSE;
+}
+
+static hg_return_t
+mock_addr_self(margo_instance_id mid, hg_addr_t *addr)
+{
+  (void)mid;
+  (void)addr;
+  return HG_OTHER_ERROR;
+}
+
+static hg_return_t
+mock_addr_to_string(margo_instance_id mid, char *str, hg_size_t *size, hg_addr_t addr)
+{
+  (void)mid;
+  (void)str;
+  (void)size;
+  (void)addr;
+  return HG_OTHER_ERROR;
+}
+
+static const char *
+mock_error_to_string(hg_return_t hret)
+{
+  return hret == HG_TIMEOUT ? "timeout" : "mock error";
+}
+
+static void
+mock_log(margo_instance_id mid, const char *fmt, ...)
+{
+  (void)mid;
+  (void)fmt;
+}
+
+static void *
+mock_realloc(void *ptr, size_t size)
+{
+  if (realloc_countdown && --realloc_countdown == 0)
+    return NULL;
+  return realloc(ptr, size);
+}
+
+#undef margo_addr_lookup
+#define margo_addr_lookup mock_addr_lookup
+#undef margo_addr_dup
+#define margo_addr_dup mock_addr_dup
+#undef margo_addr_free
+#define margo_addr_free mock_addr_free
+#undef margo_create
+#define margo_create mock_create
+#undef margo_reset
+#define margo_reset mock_reset
+#undef margo_destroy
+#define margo_destroy mock_destroy
+#undef margo_iforward_timed
+#define margo_iforward_timed mock_iforward_timed
+#undef margo_wait
+#define margo_wait mock_wait
+#undef margo_get_output
+#define margo_get_output mock_get_output
+#undef margo_free_output
+#define margo_free_output mock_free_output
+#undef margo_forward_timed
+#define margo_forward_timed mock_forward_timed
+#undef margo_is_listening
+#define margo_is_listening mock_is_listening
+#undef margo_addr_self
+#define margo_addr_self mock_addr_self
+#undef margo_addr_to_string
+#define margo_addr_to_string mock_addr_to_string
+#undef HG_Error_to_string
+#define HG_Error_to_string mock_error_to_string
+#undef margo_error
+#define margo_error mock_log
+#undef margo_warning
+#define margo_warning mock_log
+#undef margo_info
+#define margo_info mock_log
+
+#include "../src/addrcache.c"
+
+#define realloc mock_realloc
+#include "../src/rpc.c"
+#undef realloc
+
+
+/* multicast_cb, without the Margo input and output */
+static int64_t
+mock_handler(struct mock_client *c, multicast_in_t *in)
+{
+  const char **sub = malloc(MOCK_MAXADDR * sizeof(*sub));
+  char *subtree = NULL;
+  size_t nsub = 0;
+
+  TEST_ASSERT(sub);
+  c->nreceived++;
+  c->depth = depth + 1;
+  if (c->depth > maxdepth)
+    maxdepth = c->depth;
+  TEST_CHECK_INT(in->code, code);
+
+  if (in->subtree && in->subtree[0] != '\0') {
+    subtree = strdup(in->subtree);
+    TEST_ASSERT(subtree);
+    char *saveptr;
+    for (char *tok = strtok_r(subtree, "\n", &saveptr); tok;
+         tok = strtok_r(NULL, "\n", &saveptr)) {
+      TEST_ASSERT(nsub < MOCK_MAXADDR);
+      sub[nsub++] = tok;
+    }
+  }
+
+  struct rpc_batch batch;
+  multicast_in_t fwd = *in;
+  size_t nfailed;
+
+  depth++;
+  rpc_batch_init(&batch, MARGO_INSTANCE_NULL);
+  nfailed = rpc_multicast(&batch, MOCK_RPC_ID, &fwd, sub, nsub, 100, NULL, NULL);
+  rpc_batch_fini(&batch);
+  depth--;
+
+  free(subtree);
+  free(sub);
+  return nfailed;
+}
+
+
+static void
+reset_clients(size_t n)
+{
+  memset(clients, 0, sizeof(clients));
+  for (size_t i = 0; i < n; i++) {
+    snprintf(addrstr[i], sizeof(addrstr[i]), "mock:%zu", i);
+    addrs[i] = addrstr[i];
+  }
+}
+
+
+static void
+local(void *arg)
+{
+  (*(int *)arg)++;
+}
+
+
+/* multicast to clients 0 to N-1 through CACHE, return the number of
+   failures reported */
+static size_t
+multicast(struct addrcache *cache, size_t n, size_t fanout)
+{
+  struct rpc_batch batch;
+  multicast_in_t in = { .code = ++code, .fanout = fanout };
+  int nlocal = 0;
+
+  for (size_t i = 0; i < n; i++)
+    clients[i].nreceived = 0;
+  maxdepth = 0;
+  nrootsends = 0;
+
+  rpc_batch_init(&batch, MARGO_INSTANCE_NULL);
+  batch.addrcache = cache;
+  size_t nfailed = rpc_multicast(&batch, MOCK_RPC_ID, &in, addrs, n, 100, local, &nlocal);
+  rpc_batch_fini(&batch);
+
+  TEST_CHECK_INT(nlocal, 1);
+  TEST_CHECK(in.subtree == NULL);
+  TEST_CHECK_INT(nhandles_held, 0);
+  return nfailed;
+}
+
+
+/* every client reached exactly once, but unreachable ones, which are
+   all reported */
+static void
+check_delivered(size_t n, size_t nfailed)
+{
+  size_t nunreachable = 0;
+
+  for (size_t i = 0; i < n; i++) {
+    struct mock_client *c = &clients[i];
+    int unreachable = c->dead || c->nolookup || c->nosend;
+    nunreachable += unreachable;
+    TEST_CHECK_INT(c->nreceived, !unreachable);
+  }
+  TEST_CHECK_INT(nfailed, nunreachable);
+}
+
+
+static void
+test_alive(void)
+{
+  static const size_t sizes[] = { 0, 1, 2, 7, 8, 9, 64, 65, 100, 1000, MOCK_MAXADDR };
+  static const size_t fanouts[] = { 1, 2, 3, 8, 16 };
+
+  for (size_t f = 0; f < sizeof(fanouts) / sizeof(fanouts[0]); f++) {
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+      size_t n = sizes[s], fanout = fanouts[f];
+
+      reset_clients(n);
+      size_t nfailed = multicast(NULL, n, fanout);
+      check_delivered(n, nfailed);
+      TEST_CHECK(maxdepth <= mc_depth(n, fanout));
+      TEST_CHECK_INT(nrootsends, n < fanout ? n : fanout);
+      TEST_CHECK_INT(naddrs_held, 0);
+    }
+  }
+
+  /* the default fanout */
+  reset_clients(100);
+  TEST_CHECK_INT(multicast(NULL, 100, 0), 0);
+  TEST_CHECK_INT(nrootsends, RPC_MULTICAST_FANOUT);
+}
+
+
+/* random clients unreachable in random ways, whole ranges and chains
+   of successive subtree roots included */
+static void
+test_repair(void)
+{
+  for (size_t round = 0; round < nrounds; round++) {
+    size_t n = 1 + rnd() % 300;
+    size_t fanout = 1 + rnd() % 8;
+    unsigned pct = rnd() % 4 == 0 ? 100 : rnd() % 60;
+
+    reset_clients(n);
+    for (size_t i = 0; i < n; i++) {
+      if (rnd() % 100 >= pct)
+        continue;
+      switch (rnd() % 3) {
+      case 0: clients[i].dead = 1; break;
+      case 1: clients[i].nolookup = 1; break;
+      default: clients[i].nosend = 1; break;
+      }
+    }
+
+    size_t nfailed = multicast(NULL, n, fanout);
+    check_delivered(n, nfailed);
+    TEST_CHECK_INT(naddrs_held, 0);
+  }
+}
+
+
+/* dead clients get negative cache entries, live ones do not */
+static void
+test_cache(void)
+{
+  struct addrcache *cache;
+  struct addrcache_stats stats;
+  size_t n = 200;
+
+  TEST_ASSERT(addrcache_init(&cache, MARGO_INSTANCE_NULL, 0, 60) == 0);
+
+  reset_clients(n);
+  for (size_t i = 0; i < n; i += 8)
+    clients[i].dead = 1;
+  check_delivered(n, multicast(cache, n, 8));
+
+  /* the dead roots are not sent to again, their subtrees still
+     reached */
+  check_delivered(n, multicast(cache, n, 8));
+  addrcache_stats(cache, &stats);
+  TEST_CHECK(stats.neghits > 0);
+
+  /* back to life, but negative entries until invalidated */
+  for (size_t i = 0; i < n; i += 8) {
+    clients[i].dead = 0;
+    addrcache_invalidate(cache, addrs[i]);
+  }
+  check_delivered(n, multicast(cache, n, 8));
+
+  addrcache_fini(&cache);
+  TEST_CHECK_INT(naddrs_held, 0);
+}
+
+
+/* an allocation failure at any point loses no reference and reports
+   no live client unreachable */
+static void
+test_nomem(void)
+{
+  struct addrcache *cache;
+  size_t n = 300;
+
+  reset_clients(n);
+  for (size_t k = 1; k < 200; k++) {
+    TEST_ASSERT(addrcache_init(&cache, MARGO_INSTANCE_NULL, 0, 60) == 0);
+
+    realloc_countdown = k;
+    size_t nfailed = multicast(cache, n, 4);
+    size_t nreceived = 0;
+    for (size_t i = 0; i < n; i++) {
+      TEST_CHECK(clients[i].nreceived <= 1);
+      nreceived += clients[i].nreceived;
+    }
+    TEST_CHECK_INT(nreceived + nfailed, n);
+    realloc_countdown = 0;
+
+    check_delivered(n, multicast(cache, n, 4));
+
+    addrcache_fini(&cache);
+    TEST_CHECK_INT(naddrs_held, 0);
+  }
+}
+
+
+int
+main(int argc, char **argv)
+{
+  nrounds = test_size_arg(argc, argv, 1, 2000);
+  seed ^= test_size_arg(argc, argv, 2, 0);
+
+  ABT_init(0, NULL);
+
+  TEST_RUN(test_alive);
+  TEST_RUN(test_repair);
+  TEST_RUN(test_cache);
+  TEST_RUN(test_nomem);
+
+  ABT_finalize();
+
+  return TEST_EXIT();
+}
@@ -0,0 +1,224 @@
+/**
+ * Simulator tests: small fixed workloads are replayed by icc_sim and
+ * the figures of its report checked. A trace in each format gives
+ * known makespans and malleability decisions, and with a bandwidth
+ * budget, jobs of different IO-sets do IO together and use more of
+ * the file system than one at a time.
+ *
+ * sim.c is included, its main called with the options of each run and
+ * its report read back from its output.
+ */
+#include <math.h>               /* fabs */
+#include <stdio.h>
+#include <stdlib.h>             /* mkdtemp, unsetenv */
+#include <string.h>
+#include <unistd.h>             /* dup, dup2, unlink, rmdir */
+
+#include "tests.h"
+
+#define main sim_main
+#include "../examples/sim.c"
+#undef main
+
+#define TEST_MAXARGS 16
+#define TEST_NIOSETS 12         /* IO phases of each application */
+
+/* within the precision of the report */
+#define TEST_CHECK_SECONDS(a, b) TEST_CHECK(fabs((a) - (b)) < 0.0005)
+
+/* four jobs of a set each, IO at a quarter of the file system */
+static const char workload_sets[] =
+  "# submit,nnodes,nphases,compute,witer,nbytes,malleable,bandwidth\n"
+  "0,1,4,1,1,268435456,0,256\n"
+  "0,1,4,1,10,268435456,0,256\n"
+  "0,1,4,1,100,268435456,0,256\n"
+  "0,1,4,1,1000,268435456,0,256\n";
+
+/* one malleable job expanded twice, one shrunk and then refused, one
+   rigid */
+static const char workload_jobs[] =
+  "# submit,nnodes,nphases,compute,witer,nbytes,malleable,bandwidth\n"
+  "0,1,24,0.5,10,67108864,1,256\n"
+  "0,1,24,0.005,100,0,1\n"
+  "1,2,12,1,1000,134217728,0,128\n";
+
+struct simres {
+  size_t njobs, unfinished, nphases;
+  double makespan;
+  double util, busy;
+  size_t expand, shrink, shrinknodes, refused;
+};
+
+static char dir[] = "/tmp/test_sim.XXXXXX";
+
+
+/* write CONTENT to the file NAME of the test directory into PATH */
+static void
+write_trace(char *path, size_t len, const char *name, const char *content)
+{
+  snprintf(path, len, "%s/%s", dir, name);
+
+  FILE *f = fopen(path, "w");
+  TEST_ASSERT(f);
+  TEST_ASSERT(fputs(content, f) >= 0);
+  TEST_ASSERT(fclose(f) == 0);
+}
+
+
+/* replay TRACE with the NULL-terminated options OPTS, read the report
+   into RES */
+static int
+run(const char *trace, const char *const *opts, struct simres *res)
+{
+  char *argv[TEST_MAXARGS];
+  char line[SIM_LINE_LEN];
+  int argc = 0, rc, saved;
+  FILE *out = tmpfile();
+
+  TEST_ASSERT(out);
+
+  argv[argc++] = "icc_sim";
+  for (size_t i = 0; opts[i]; i++) {
+    TEST_ASSERT(argc < TEST_MAXARGS - 2);
+    argv[argc++] = (char *)opts[i];
+  }
+  argv[argc++] = (char *)trace;
+  argv[argc] = NULL;
+
+  /* the report goes to stdout */
+  fflush(stdout);
+  saved = dup(STDOUT_FILENO);
+  TEST_ASSERT(saved != -1 && dup2(fileno(out), STDOUT_FILENO) != -1);
+  optind = 0;
+  rc = sim_main(argc, argv);
+  fflush(stdout);
+  TEST_ASSERT(dup2(saved, STDOUT_FILENO) != -1);
+  close(saved);
+
+  memset(res, 0, sizeof(*res));
+  rewind(out);
+  while (fgets(line, sizeof(line), out)) {
+    fputs(line, stdout);
+    sscanf(line, "jobs %zu", &res->njobs);
+    sscanf(line, "unfinished %zu", &res->unfinished);
+    sscanf(line, "makespan %lf", &res->makespan);
+    sscanf(line, "IO phases %zu", &res->nphases);
+    sscanf(line, "IO utilisation %lf (busy %lf)", &res->util, &res->busy);
+    sscanf(line, "decisions expand %zu shrink %zu shrink_nodes %zu refused %zu",
+           &res->expand, &res->shrink, &res->shrinknodes, &res->refused);
+  }
+  fclose(out);
+
+  return rc;
+}
+
+
+static void
+test_jobs(void)
+{
+  const char *const opts[] = { "--nodes", "4", "--bandwidth", "1024", "--stream", "0",
+                               NULL };
+  char trace[sizeof(dir) + 32];
+  struct simres r;
+
+  write_trace(trace, sizeof(trace), "jobs.csv", workload_jobs);
+  TEST_ASSERT(run(trace, opts, &r) == EXIT_SUCCESS);
+
+  TEST_CHECK_INT(r.njobs, 3);
+  TEST_CHECK_INT(r.unfinished, 0);
+  TEST_CHECK_INT(r.nphases, 36);
+  TEST_CHECK_SECONDS(r.makespan, 28.0);
+  TEST_CHECK_INT(r.expand, 2);
+  TEST_CHECK_INT(r.shrink, 1);
+  TEST_CHECK_INT(r.shrinknodes, 0);
+  TEST_CHECK_INT(r.refused, 1);
+
+  unlink(trace);
+}
+
+
+static void
+test_iosets(void)
+{
+  const char *const opts[] = { "--nodes", "4", "--rtime-scale", "0.1", "--stream", "0",
+                               NULL };
+  char trace[sizeof(dir) + 32];
+  struct simres r;
+  FILE *f;
+
+  /* as written by icc_iotrace, header included: two applications
+     computing 1 s and 1.25 s between their IO phases, the second one
+     waiting for the first */
+  snprintf(trace, sizeof(trace), "%s/iosets.csv", dir);
+  f = fopen(trace, "w");
+  TEST_ASSERT(f);
+  fputs("\"appid\",witer,waitstart,iostart,ioend,nbytes,setid,nslices,wait,type\n", f);
+  for (int k = 0; k < TEST_NIOSETS; k++) {
+    double a = 100 + 1.5 * k, b = 100.25 + 2 * k;
+    fprintf(f, "\"12.0\",10,%.9f,%.9f,%.9f,268435456,1,1,0.000000000,write\n",
+            a, a, a + 0.5);
+    fprintf(f, "\"13.0\",100,%.9f,%.9f,%.9f,134217728,2,1,0.250000000,write\n",
+            b, b + 0.25, b + 0.75);
+  }
+  TEST_ASSERT(fclose(f) == 0);
+
+  TEST_ASSERT(run(trace, opts, &r) == EXIT_SUCCESS);
+
+  TEST_CHECK_INT(r.njobs, 2);
+  TEST_CHECK_INT(r.unfinished, 0);
+  TEST_CHECK_INT(r.nphases, 2 * TEST_NIOSETS);
+  TEST_CHECK_SECONDS(r.makespan, 20.625);
+  TEST_CHECK_INT(r.expand, 2);
+  TEST_CHECK_INT(r.shrink, 0);
+  TEST_CHECK_INT(r.refused, 0);
+
+  unlink(trace);
+}
+
+
+static void
+test_budget(void)
+{
+  const char *const one[] = { "--nodes", "4", "--bandwidth", "1024", "--stream", "0",
+                              "--static", NULL };
+  const char *const budget[] = { "--nodes", "4", "--bandwidth", "1024", "--stream", "0",
+                                 "--static", "--budget", "1024", NULL };
+  char trace[sizeof(dir) + 32];
+  struct simres r1, r2;
+
+  write_trace(trace, sizeof(trace), "sets.csv", workload_sets);
+
+  TEST_ASSERT(run(trace, one, &r1) == EXIT_SUCCESS);
+  TEST_ASSERT(run(trace, budget, &r2) == EXIT_SUCCESS);
+
+  TEST_CHECK_INT(r1.njobs, 4);
+  TEST_CHECK_INT(r2.njobs, 4);
+  TEST_CHECK_INT(r1.unfinished, 0);
+  TEST_CHECK_INT(r2.unfinished, 0);
+  TEST_CHECK_INT(r1.nphases, 16);
+  TEST_CHECK_INT(r2.nphases, 16);
+
+  /* the four sets within the budget at once */
+  TEST_CHECK(r2.util > r1.util);
+  TEST_CHECK(r2.makespan < r1.makespan);
+
+  unlink(trace);
+}
+
+
+int
+main(void)
+{
+  TEST_ASSERT(mkdtemp(dir));
+
+  /* the default policy, whatever the environment */
+  unsetenv(ICC_MALL_POLICY_ENV);
+
+  TEST_RUN(test_jobs);
+  TEST_RUN(test_iosets);
+  TEST_RUN(test_budget);
+
+  rmdir(dir);
+
+  return TEST_EXIT();
+}
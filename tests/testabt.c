@@ -0,0 +1,51 @@
+#include <stdlib.h>             /* calloc */
+#include <abt.h>
+
+#include "tests.h"
+
+
+int
+test_xstreams_run(size_t n, void (*fn)(void *), void *args, size_t argsize)
+{
+  ABT_pool *pools = calloc(n, sizeof(*pools));
+  ABT_xstream *xstreams = calloc(n, sizeof(*xstreams));
+  ABT_thread *threads = calloc(n, sizeof(*threads));
+  int rc = 0;
+  size_t i;
+
+  if (!pools || !xstreams || !threads) {
+    rc = -1;
+    goto end;
+  }
+
+  for (i = 0; i < n; i++) {
+    if (ABT_pool_create_basic(ABT_POOL_FIFO_WAIT, ABT_POOL_ACCESS_MPMC, ABT_TRUE,
+                              &pools[i]) != ABT_SUCCESS ||
+        ABT_xstream_create_basic(ABT_SCHED_BASIC_WAIT, 1, &pools[i],
+                                 ABT_SCHED_CONFIG_NULL, &xstreams[i]) != ABT_SUCCESS ||
+        ABT_thread_create(pools[i], fn, (char *)args + i * argsize,
+                          ABT_THREAD_ATTR_NULL, &threads[i]) != ABT_SUCCESS) {
+      rc = -1;
+      break;
+    }
+  }
+
+  /* wait for the ULTs that were started */
+  for (size_t j = 0; j < n; j++) {
+    if (threads[j] != ABT_THREAD_NULL) {
+      ABT_thread_join(threads[j]);
+      ABT_thread_free(&threads[j]);
+    }
+    if (xstreams[j] != ABT_XSTREAM_NULL) {
+      ABT_xstream_join(xstreams[j]);
+      ABT_xstream_free(&xstreams[j]);
+    }
+  }
+
+ end:
+  free(pools);
+  free(xstreams);
+  free(threads);
+
+  return rc;
+}
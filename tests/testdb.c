@@ -0,0 +1,212 @@
+#include <stdarg.h>             /* va_list */
+#include <signal.h>             /* kill */
+#include <stdio.h>              /* snprintf */
+#include <stdlib.h>             /* getenv */
+#include <string.h>             /* strrchr */
+#include <unistd.h>             /* fork, execlp */
+#include <arpa/inet.h>          /* htonl */
+#include <netinet/in.h>         /* sockaddr_in */
+#include <sys/socket.h>
+#include <sys/wait.h>           /* waitpid */
+#include <hiredis.h>
+
+#include "mockredis.h"
+#include "tests.h"
+#include "testdb.h"
+
+/* time given to a spawned server to accept connections */
+#define TESTDB_START_MS 5000
+
+static char  testdb_addr[256];
+static pid_t testdb_pid = 0;
+static struct mockredis *testdb_mockredis = NULL;
+
+
+/* connect to the database at testdb_addr */
+static redisContext *
+_testdb_connect(void)
+{
+  char host[256];
+  int port = 6379;
+
+  /* host:port or [host]:port */
+  const char *h = testdb_addr[0] == '[' ? testdb_addr + 1 : testdb_addr;
+  snprintf(host, sizeof(host), "%s", h);
+  char *colon = strrchr(host, ':');
+  if (colon && (h == testdb_addr || colon[-1] == ']')) {
+    *colon = '\0';
+    port = atoi(colon + 1);
+  }
+  if (h != testdb_addr)
+    host[strcspn(host, "]")] = '\0';
+
+  redisContext *ctx = redisConnect(host, port);
+  if (ctx && ctx->err) {
+    redisFree(ctx);
+    ctx = NULL;
+  }
+  return ctx;
+}
+
+
+int
+testdb_command(const char *format, ...)
+{
+  redisContext *ctx = _testdb_connect();
+  if (!ctx)
+    return -1;
+
+  va_list ap;
+  va_start(ap, format);
+  redisReply *rep = redisvCommand(ctx, format, ap);
+  va_end(ap);
+  int rc = rep && rep->type != REDIS_REPLY_ERROR ? 0 : -1;
+  if (rep)
+    freeReplyObject(rep);
+  redisFree(ctx);
+
+  return rc;
+}
+
+
+int
+testdb_fill(const char *prefix, size_t n)
+{
+  /* bounds the replies waiting to be read */
+  const size_t chunk = 1024;
+  int rc = 0;
+
+  redisContext *ctx = _testdb_connect();
+  if (!ctx)
+    return -1;
+
+  for (size_t i = 0; i < n && rc == 0; i += chunk) {
+    size_t m = n - i < chunk ? n - i : chunk;
+    for (size_t j = 0; j < m; j++) {
+      char key[256];
+      snprintf(key, sizeof(key), "%s:%zu", prefix, i + j);
+      if (redisAppendCommand(ctx, "SET %s x", key) != REDIS_OK)
+        rc = -1;
+    }
+    for (size_t j = 0; j < m && rc == 0; j++) {
+      redisReply *rep = NULL;
+      if (redisGetReply(ctx, (void **)&rep) != REDIS_OK)
+        rc = -1;
+      else if (rep->type == REDIS_REPLY_ERROR)
+        rc = -1;
+      if (rep)
+        freeReplyObject(rep);
+    }
+  }
+  redisFree(ctx);
+
+  return rc;
+}
+
+
+/* get a port nobody listens on, reusable right away */
+static int
+_testdb_free_port(void)
+{
+  struct sockaddr_in sa = { .sin_family = AF_INET,
+                            .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+  socklen_t len = sizeof(sa);
+  int port = -1;
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd == -1)
+    return -1;
+  if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) == 0 &&
+      getsockname(fd, (struct sockaddr *)&sa, &len) == 0)
+    port = ntohs(sa.sin_port);
+  close(fd);
+
+  return port;
+}
+
+
+static int
+_testdb_spawn(void)
+{
+  int port = _testdb_free_port();
+  if (port == -1)
+    return -1;
+
+  char portstr[8];
+  snprintf(portstr, sizeof(portstr), "%d", port);
+  snprintf(testdb_addr, sizeof(testdb_addr), "127.0.0.1:%d", port);
+
+  pid_t pid = fork();
+  if (pid == -1)
+    return -1;
+
+  if (pid == 0) {
+    /* no persistence, no output */
+    freopen("/dev/null", "w", stdout);
+    execlp("redis-server", "redis-server", "--port", portstr,
+           "--bind", "127.0.0.1", "--save", "", "--appendonly", "no", NULL);
+    _exit(127);
+  }
+
+  testdb_pid = pid;
+
+  for (unsigned waited = 0; waited < TESTDB_START_MS; waited += 10) {
+    int status;
+    if (waitpid(pid, &status, WNOHANG) == pid) {
+      /* not installed or failed to start */
+      testdb_pid = 0;
+      return -1;
+    }
+    if (testdb_command("PING") == 0)
+      return 0;
+    test_sleep_ms(10);
+  }
+
+  testdb_stop();
+  return -1;
+}
+
+
+const char *
+testdb_start(void)
+{
+  const char *addr = getenv(TESTDB_ENV);
+
+  if (addr && *addr) {
+    snprintf(testdb_addr, sizeof(testdb_addr), "%s", addr);
+  } else if (!testdb_pid && !testdb_mockredis && _testdb_spawn() != 0) {
+    /* no redis-server, use the mock */
+    if (mockredis_start(&testdb_mockredis, "127.0.0.1") != 0) {
+      fprintf(stderr, "No database: set "TESTDB_ENV" or install redis-server\n");
+      return NULL;
+    }
+    snprintf(testdb_addr, sizeof(testdb_addr), "%s",
+             mockredis_addr(testdb_mockredis));
+  }
+
+  if (testdb_flush() != 0) {
+    fprintf(stderr, "Could not flush database %s\n", testdb_addr);
+    return NULL;
+  }
+
+  return testdb_addr;
+}
+
+
+void
+testdb_stop(void)
+{
+  if (testdb_pid) {
+    kill(testdb_pid, SIGTERM);
+    waitpid(testdb_pid, NULL, 0);
+    testdb_pid = 0;
+  }
+  if (testdb_mockredis)
+    mockredis_stop(&testdb_mockredis);
+}
+
+int
+testdb_flush(void)
+{
+  return testdb_command("FLUSHALL");
+}
@@ -0,0 +1,53 @@
+#ifndef ADMIRE_TESTDB_H
+#define ADMIRE_TESTDB_H
+
+/**
+ * Database for the icdb tests and benchmarks.
+ *
+ * The server at the address in the ICC_TEST_DB environment variable is
+ * used if set. It is flushed by the tests, so it must not hold
+ * anything valuable. Otherwise a redis-server found in the PATH is
+ * started on a free local port, for the duration of the program, or
+ * failing that the mock server of mockredis.h.
+ */
+#include <stddef.h>
+
+#define TESTDB_ENV "ICC_TEST_DB"
+
+/**
+ * Get a database, started if needed, and flush it.
+ *
+ * Returns its host:port address or NULL if there is none, in which
+ * case the program should exit with TEST_SKIP.
+ */
+const char *testdb_start(void);
+
+/**
+ * Stop the database started by testdb_start, if any.
+ */
+void testdb_stop(void);
+
+/**
+ * Remove all keys from the database.
+ *
+ * Returns 0 or -1 in case of error.
+ */
+int testdb_flush(void);
+
+/**
+ * Run a command on the database, for test setups that go behind
+ * icdb's back. FORMAT is as for redisCommand.
+ *
+ * Returns 0 or -1 if the command could not be sent or failed.
+ */
+int testdb_command(const char *format, ...);
+
+/**
+ * Add N string keys PREFIX:0 to PREFIX:N-1, pipelined over a single
+ * connection, to load the keyspace.
+ *
+ * Returns 0 or -1 in case of error.
+ */
+int testdb_fill(const char *prefix, size_t n);
+
+#endif
@@ -0,0 +1,181 @@
+#include <stdlib.h>             /* calloc, getenv */
+#include <string.h>             /* strdup, strtok_r */
+#include <margo.h>
+
+#include "rpc.h"
+#include "testmargo.h"
+
+static margo_instance_id  testmargo_sender = MARGO_INSTANCE_NULL;
+static margo_instance_id *testmargo_clients = NULL;
+static char             (*testmargo_addrs)[256] = NULL;
+static size_t             testmargo_nclients = 0;
+static uint64_t           testmargo_nreceived = 0;
+static hg_id_t            testmargo_multicast_id = 0;
+
+
+static void
+ping_cb(hg_handle_t h)
+{
+  hg_return_t hret;
+  lowmem_in_t in;
+  rpc_out_t out;
+
+  out.rc = RPC_SUCCESS;
+
+  hret = margo_get_input(h, &in);
+  if (hret != HG_SUCCESS) {
+    out.rc = RPC_FAILURE;
+  } else {
+    __atomic_fetch_add(&testmargo_nreceived, 1, __ATOMIC_RELAXED);
+    margo_free_input(h, &in);
+  }
+
+  margo_respond(h, &out);
+  margo_destroy(h);
+}
+DEFINE_MARGO_RPC_HANDLER(ping_cb);
+
+
+static void
+multicast_cb(hg_handle_t h)
+{
+  margo_instance_id mid = margo_hg_handle_get_instance(h);
+  hg_return_t hret;
+  multicast_in_t in;
+  rpc_out_t out;
+  char *subtree = NULL;
+  const char **addrs = NULL;
+  size_t naddrs = 0;
+
+  out.rc = RPC_FAILURE;
+
+  hret = margo_get_input(h, &in);
+  if (hret != HG_SUCCESS)
+    goto respond;
+  __atomic_fetch_add(&testmargo_nreceived, 1, __ATOMIC_RELAXED);
+
+  /* one address per line */
+  if (in.subtree && in.subtree[0] != '\0') {
+    subtree = strdup(in.subtree);
+    if (!subtree)
+      goto end;
+    naddrs = 1;
+    for (char *p = subtree; *p; p++)
+      naddrs += (*p == '\n');
+    addrs = malloc(naddrs * sizeof(*addrs));
+    if (!addrs)
+      goto end;
+    naddrs = 0;
+    char *saveptr;
+    for (char *tok = strtok_r(subtree, "\n", &saveptr); tok;
+         tok = strtok_r(NULL, "\n", &saveptr))
+      addrs[naddrs++] = tok;
+  }
+
+  struct rpc_batch batch;
+  multicast_in_t fwd = in;
+
+  rpc_batch_init(&batch, mid);
+  out.rc = rpc_multicast(&batch, testmargo_multicast_id, &fwd, addrs, naddrs,
+                         RPC_TIMEOUT_MS_DEFAULT, NULL, NULL);
+  rpc_batch_fini(&batch);
+
+ end:
+  free(addrs);
+  free(subtree);
+  margo_free_input(h, &in);
+
+ respond:
+  margo_respond(h, &out);
+  margo_destroy(h);
+}
+DEFINE_MARGO_RPC_HANDLER(multicast_cb);
+
+
+margo_instance_id
+testmargo_start(size_t n, hg_id_t *ping_id)
+{
+  const char *proto = getenv(TESTMARGO_PROTO_ENV);
+  if (!proto)
+    proto = TESTMARGO_PROTO_DEFAULT;
+
+  testmargo_clients = calloc(n, sizeof(*testmargo_clients));
+  testmargo_addrs = calloc(n, sizeof(*testmargo_addrs));
+  if (!testmargo_clients || !testmargo_addrs)
+    goto error;
+  testmargo_nclients = n;
+
+  testmargo_sender = margo_init(proto, MARGO_SERVER_MODE, 1, 0);
+  if (testmargo_sender == MARGO_INSTANCE_NULL)
+    goto error;
+  *ping_id = MARGO_REGISTER(testmargo_sender, TESTMARGO_PING_NAME, lowmem_in_t, rpc_out_t, NULL);
+
+  /* one progress stream each, the handlers run on it */
+  for (size_t i = 0; i < n; i++) {
+    hg_size_t size = sizeof(testmargo_addrs[i]);
+    margo_instance_id mid = margo_init(proto, MARGO_SERVER_MODE, 1, 0);
+    if (mid == MARGO_INSTANCE_NULL)
+      goto error;
+    testmargo_clients[i] = mid;
+
+    MARGO_REGISTER(mid, TESTMARGO_PING_NAME, lowmem_in_t, rpc_out_t, ping_cb);
+    testmargo_multicast_id = MARGO_REGISTER(mid, RPC_MULTICAST_NAME, multicast_in_t,
+                                            rpc_out_t, multicast_cb);
+    if (get_hg_addr(mid, testmargo_addrs[i], &size))
+      goto error;
+  }
+
+  return testmargo_sender;
+
+ error:
+  testmargo_stop();
+  return MARGO_INSTANCE_NULL;
+}
+
+
+void
+testmargo_stop(void)
+{
+  for (size_t i = 0; i < testmargo_nclients; i++)
+    testmargo_kill(i);
+  free(testmargo_clients);
+  free(testmargo_addrs);
+  testmargo_clients = NULL;
+  testmargo_addrs = NULL;
+  testmargo_nclients = 0;
+
+  if (testmargo_sender != MARGO_INSTANCE_NULL)
+    margo_finalize(testmargo_sender);
+  testmargo_sender = MARGO_INSTANCE_NULL;
+}
+
+
+const char *
+testmargo_addr(size_t i)
+{
+  return i < testmargo_nclients ? testmargo_addrs[i] : NULL;
+}
+
+
+margo_instance_id
+testmargo_client(size_t i)
+{
+  return i < testmargo_nclients ? testmargo_clients[i] : MARGO_INSTANCE_NULL;
+}
+
+
+void
+testmargo_kill(size_t i)
+{
+  if (i < testmargo_nclients && testmargo_clients[i] != MARGO_INSTANCE_NULL) {
+    margo_finalize(testmargo_clients[i]);
+    testmargo_clients[i] = MARGO_INSTANCE_NULL;
+  }
+}
+
+
+uint64_t
+testmargo_received(void)
+{
+  return __atomic_load_n(&testmargo_nreceived, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,61 @@
+#ifndef ADMIRE_TESTMARGO_H
+#define ADMIRE_TESTMARGO_H
+
+/**
+ * Mock clients for the RPC benchmarks.
+ *
+ * The clients are Margo instances of the calling process, listening
+ * on the shared memory transport, or on the Mercury protocol in the
+ * ICC_TEST_PROTO environment variable if set. Each has its own
+ * progress execution stream and answers the ping RPC with
+ * RPC_SUCCESS. RPC_MULTICAST is relayed to the subtree of the client
+ * as multicast_cb does, without other effect.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <margo.h>
+
+#define TESTMARGO_PROTO_ENV     "ICC_TEST_PROTO"
+#define TESTMARGO_PROTO_DEFAULT "na+sm"
+
+/* takes a lowmem_in_t, the payload of low memory broadcasts */
+#define TESTMARGO_PING_NAME     "icc_test_ping"
+
+/**
+ * Start a sender instance and N clients. *PING_ID is set to the id of
+ * the ping RPC on the sender.
+ *
+ * Returns the sender instance, or MARGO_INSTANCE_NULL if Margo could
+ * not be initialized, in which case the program should exit with
+ * TEST_SKIP.
+ */
+margo_instance_id testmargo_start(size_t n, hg_id_t *ping_id);
+
+/**
+ * Stop the instances started by testmargo_start.
+ */
+void testmargo_stop(void);
+
+/**
+ * Address string of client I.
+ */
+const char *testmargo_addr(size_t i);
+
+/**
+ * Instance of client I, to register more RPCs on, or
+ * MARGO_INSTANCE_NULL.
+ */
+margo_instance_id testmargo_client(size_t i);
+
+/**
+ * Finalize client I, so that its address becomes unreachable.
+ */
+void testmargo_kill(size_t i);
+
+/**
+ * Number of RPCs handled by all the clients so far, multicasts
+ * included.
+ */
+uint64_t testmargo_received(void);
+
+#endif
@@ -0,0 +1,105 @@
+#include <stdlib.h>             /* qsort, strtoull */
+#include <time.h>               /* clock_gettime, nanosleep */
+
+#include "tests.h"
+
+int test_nfailed = 0;
+
+
+uint64_t
+test_now_ns(void)
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+
+void
+test_sleep_ms(unsigned ms)
+{
+  struct timespec t = { .tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000L };
+
+  while (nanosleep(&t, &t) == -1)
+    ;
+}
+
+
+size_t
+test_size_arg(int argc, char **argv, int i, size_t dflt)
+{
+  if (i >= argc)
+    return dflt;
+
+  char *end;
+  unsigned long long v = strtoull(argv[i], &end, 10);
+  if (end == argv[i] || *end != '\0' || v == 0) {
+    fprintf(stderr, "Bad size \"%s\"\n", argv[i]);
+    exit(2);
+  }
+  return (size_t)v;
+}
+
+
+int
+test_lat_add(struct test_lat *lat, uint64_t ns)
+{
+  if (lat->n == lat->size) {
+    size_t size = lat->size ? 2 * lat->size : 1024;
+    uint64_t *tmp = realloc(lat->samples, size * sizeof(*tmp));
+    if (!tmp)
+      return -1;
+    lat->samples = tmp;
+    lat->size = size;
+  }
+  lat->samples[lat->n++] = ns;
+
+  return 0;
+}
+
+
+static int
+_u64cmp(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+  return (x > y) - (x < y);
+}
+
+
+uint64_t
+test_lat_pct(struct test_lat *lat, double p)
+{
+  if (lat->n == 0)
+    return 0;
+
+  qsort(lat->samples, lat->n, sizeof(*lat->samples), _u64cmp);
+
+  size_t i = (size_t)(p / 100.0 * (lat->n - 1) + 0.5);
+  return lat->samples[i < lat->n ? i : lat->n - 1];
+}
+
+
+void
+test_lat_print(struct test_lat *lat, const char *name)
+{
+  uint64_t sum = 0;
+
+  for (size_t i = 0; i < lat->n; i++)
+    sum += lat->samples[i];
+
+  printf("%-28s n=%-8zu mean=%9.1fus p50=%9.1fus p99=%9.1fus max=%9.1fus\n",
+         name, lat->n, lat->n ? sum / 1e3 / lat->n : 0.0,
+         test_lat_pct(lat, 50) / 1e3, test_lat_pct(lat, 99) / 1e3,
+         test_lat_pct(lat, 100) / 1e3);
+}
+
+
+void
+test_lat_free(struct test_lat *lat)
+{
+  free(lat->samples);
+  lat->samples = NULL;
+  lat->n = lat->size = 0;
+}
@@ -0,0 +1,127 @@
+#ifndef ADMIRE_TESTS_H
+#define ADMIRE_TESTS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>             /* exit */
+#include <string.h>             /* strcmp */
+
+/**
+ * Unit tests and benchmarks. Each program runs its own cases and
+ * exits with 0 on success, 1 on failure, or TEST_SKIP if something it
+ * needs is not available, as understood by "make check" and CTest.
+ *
+ * Benchmarks run with a small size by default so that they can be
+ * part of the checks, and take the real size as argument.
+ */
+#define TEST_SKIP 77
+
+extern int test_nfailed;
+
+/**
+ * Report a failed check without stopping the test.
+ */
+#define TEST_CHECK(cond) do {                                           \
+    if (!(cond)) {                                                      \
+      fprintf(stderr, "%s:%d: %s: check failed: %s\n",                  \
+              __FILE__, __LINE__, __func__, #cond);                     \
+      test_nfailed++;                                                   \
+    }                                                                   \
+  } while (0)
+
+#define TEST_CHECK_INT(a,b) do {                                        \
+    long long _a = (a), _b = (b);                                       \
+    if (_a != _b) {                                                     \
+      fprintf(stderr, "%s:%d: %s: check failed: %s == %s (%lld != %lld)\n", \
+              __FILE__, __LINE__, __func__, #a, #b, _a, _b);            \
+      test_nfailed++;                                                   \
+    }                                                                   \
+  } while (0)
+
+#define TEST_CHECK_STR(a,b) do {                                        \
+    const char *_a = (a), *_b = (b);                                    \
+    if (!_a || !_b || strcmp(_a, _b)) {                                 \
+      fprintf(stderr, "%s:%d: %s: check failed: %s == %s (\"%s\" != \"%s\")\n", \
+              __FILE__, __LINE__, __func__, #a, #b,                     \
+              _a ? _a : "(null)", _b ? _b : "(null)");                  \
+      test_nfailed++;                                                   \
+    }                                                                   \
+  } while (0)
+
+/**
+ * Stop the program if COND is false, for failures later checks
+ * cannot survive.
+ */
+#define TEST_ASSERT(cond) do {                                          \
+    if (!(cond)) {                                                      \
+      fprintf(stderr, "%s:%d: %s: assertion failed: %s\n",              \
+              __FILE__, __LINE__, __func__, #cond);                     \
+      exit(1);                                                          \
+    }                                                                   \
+  } while (0)
+
+/**
+ * Run test case FN, reporting its name and outcome.
+ */
+#define TEST_RUN(fn) do {                                               \
+    int _n = test_nfailed;                                              \
+    fn();                                                               \
+    fprintf(stderr, "%s %s\n", test_nfailed == _n ? "PASS" : "FAIL", #fn); \
+  } while (0)
+
+#define TEST_EXIT() (test_nfailed ? 1 : 0)
+
+/**
+ * Monotonic time in nanoseconds.
+ */
+uint64_t test_now_ns(void);
+
+/**
+ * Sleep for MS milliseconds.
+ */
+void test_sleep_ms(unsigned ms);
+
+/**
+ * Size argument ARGV[I] of a benchmark, or DEFAULT if absent.
+ */
+size_t test_size_arg(int argc, char **argv, int i, size_t dflt);
+
+/**
+ * Latency samples, in nanoseconds.
+ */
+struct test_lat {
+  uint64_t *samples;
+  size_t    n;
+  size_t    size;
+};
+
+/**
+ * Add sample NS to LAT. Returns 0 or -1 if out of memory.
+ */
+int test_lat_add(struct test_lat *lat, uint64_t ns);
+
+/**
+ * Return the P-th percentile (0 to 100) of the samples of LAT, which
+ * get sorted.
+ */
+uint64_t test_lat_pct(struct test_lat *lat, double p);
+
+/**
+ * Print the mean, median and tail percentiles of LAT in microseconds,
+ * on one line headed by NAME.
+ */
+void test_lat_print(struct test_lat *lat, const char *name);
+
+void test_lat_free(struct test_lat *lat);
+
+/**
+ * Run FN on N new Argobots execution streams, one ULT each, passing
+ * it the I-th element of ARGS, an array of N elements of ARGSIZE
+ * bytes, and wait for all of them. Argobots must be initialized.
+ *
+ * Returns 0 or -1 in case of error.
+ */
+int test_xstreams_run(size_t n, void (*fn)(void *), void *args, size_t argsize);
+
+#endif